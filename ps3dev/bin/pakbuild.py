@@ -0,0 +1,380 @@
+#!/usr/bin/env python2.7
+from __future__ import print_function
+import fnmatch
+import struct
+import getopt
+import zlib
+import sys
+import os
+
+"""
+	Builds the asset archives read by pak/pak.h, lists them and checks
+	that every chunk decodes.
+
+	Entries are named by their path under the directory given on the
+	command line, with / separators. The index is sorted by the FNV-1a
+	hash of the name; the data keeps the order of the command line, so
+	assets loaded together stay together on the disc.
+
+	LZ4 chunks use the lz4 module when it is installed, and a slower
+	compressor in this file otherwise.
+"""
+
+PAK_MAGIC      = 0x50414b31
+PAK_VERSION    = 1
+PAK_CHUNK_SIZE = 65536
+PAK_SLOT_PAD   = 128
+
+CODEC_STORED = 0
+CODEC_ZLIB   = 1
+CODEC_LZ4    = 2
+CODECS = {"none": CODEC_STORED, "zlib": CODEC_ZLIB, "lz4": CODEC_LZ4}
+CODEC_NAMES = dict((v, k) for k, v in CODECS.items())
+
+ENTRY_STORED = 0x01
+
+HEADER = ">IIIIIIIIQIIIIQ"
+ENTRY  = ">IIIIIIQ"
+CHUNK  = ">II"
+
+def fnv1a(name):
+	h = 0x811c9dc5
+	for c in bytearray(name):
+		h = ((h ^ c) * 0x01000193) & 0xffffffff
+	return h
+
+def align(value, n):
+	return (value + n - 1) // n * n
+
+def lz4_compress(data):
+	try:
+		import lz4.block
+		return lz4.block.compress(bytes(data), mode="high_compression", store_size=False)
+	except ImportError:
+		pass
+	src = bytearray(data)
+	n = len(src)
+	out = bytearray()
+	table = {}
+	anchor = 0
+	i = 0
+
+	def length(v):
+		while v >= 255:
+			out.append(255)
+			v -= 255
+		out.append(v)
+
+	# greedy, one candidate per 4 byte key; the last 5 bytes are literals and
+	# no match starts in the last 12, as the block format asks
+	while i < n - 12:
+		key = src[i] | src[i + 1] << 8 | src[i + 2] << 16 | src[i + 3] << 24
+		ref = table.get(key, -1)
+		table[key] = i
+		if ref < 0 or i - ref > 65535:
+			i += 1
+			continue
+		m = i + 4
+		while m < n - 5 and src[m] == src[ref + m - i]:
+			m += 1
+		while i > anchor and ref > 0 and src[i - 1] == src[ref - 1]:
+			i -= 1
+			ref -= 1
+		lit = i - anchor
+		ml = m - i - 4
+		out.append(min(lit, 15) << 4 | min(ml, 15))
+		if lit >= 15:
+			length(lit - 15)
+		out += src[anchor:i]
+		out += struct.pack("<H", i - ref)
+		if ml >= 15:
+			length(ml - 15)
+		anchor = i = m
+	lit = n - anchor
+	out.append(min(lit, 15) << 4)
+	if lit >= 15:
+		length(lit - 15)
+	out += src[anchor:]
+	return bytes(out)
+
+def lz4_decompress(data, size):
+	src = bytearray(data)
+	out = bytearray()
+	i = 0
+	while True:
+		token = src[i]
+		i += 1
+		lit = token >> 4
+		if lit == 15:
+			while True:
+				c = src[i]
+				i += 1
+				lit += c
+				if c != 255:
+					break
+		out += src[i:i + lit]
+		i += lit
+		if len(out) >= size:
+			break
+		offset = src[i] | src[i + 1] << 8
+		i += 2
+		ml = token & 15
+		if ml == 15:
+			while True:
+				c = src[i]
+				i += 1
+				ml += c
+				if c != 255:
+					break
+		ml += 4
+		start = len(out) - offset
+		if offset <= 0 or start < 0:
+			raise ValueError("bad lz4 offset")
+		for k in range(ml):
+			out.append(out[start + k])
+	if len(out) != size:
+		raise ValueError("bad lz4 size")
+	return bytes(out)
+
+def compress(codec, data, level):
+	if codec == CODEC_ZLIB:
+		return zlib.compress(data, level)
+	if codec == CODEC_LZ4:
+		return lz4_compress(data)
+	return data
+
+def decompress(codec, data, size):
+	if codec == CODEC_ZLIB:
+		return zlib.decompress(data)
+	if codec == CODEC_LZ4:
+		return lz4_decompress(data, size)
+	return data
+
+def collect(paths):
+	""" (name, path) in command line order, directories walked sorted """
+	files = []
+	for p in paths:
+		if os.path.isdir(p):
+			for root, dirs, names in os.walk(p):
+				dirs.sort()
+				for n in sorted(names):
+					full = os.path.join(root, n)
+					files.append((os.path.relpath(full, p).replace(os.sep, "/"), full))
+		else:
+			name = os.path.normpath(p).replace(os.sep, "/")
+			while name.startswith("../"):
+				name = name[3:]
+			files.append((name.lstrip("/"), p))
+	return files
+
+def build(output, paths, codec, level, entry_align, stored_align, stored, verbose):
+	files = collect(paths)
+	seen = set()
+	for name, path in files:
+		if name in seen:
+			raise ValueError("%s: duplicate name" % name)
+		seen.add(name)
+	count = len(files)
+	bits = 0
+	while (1 << bits) < count:
+		bits += 1
+
+	# chunks first: the index size decides where the data starts
+	entries = []
+	chunk_count = 0
+	for name, path in files:
+		with open(path, "rb") as f:
+			data = f.read()
+		if len(data) >= 1 << 32:
+			raise ValueError("%s: larger than 4GB" % name)
+		store = any(fnmatch.fnmatch(name, pat) for pat in stored)
+		chunks = []
+		for off in range(0, len(data), PAK_CHUNK_SIZE):
+			raw = data[off:off + PAK_CHUNK_SIZE]
+			c = CODEC_STORED if store else codec
+			packed = compress(c, raw, level) if c != CODEC_STORED else raw
+			if c != CODEC_STORED and (len(packed) >= len(raw) or len(packed) > PAK_CHUNK_SIZE + PAK_SLOT_PAD - 16):
+				c = CODEC_STORED
+				packed = raw
+			chunks.append((c, packed))
+		all_stored = all(c == CODEC_STORED for c, p in chunks)
+		entries.append({"name": name.encode("utf-8"), "hash": fnv1a(name.encode("utf-8")), "size": len(data),
+			"chunks": chunks, "flags": ENTRY_STORED if all_stored else 0, "first": chunk_count})
+		chunk_count += len(chunks)
+
+	names = bytearray()
+	for e in entries:
+		e["name_offset"] = len(names)
+		names += e["name"] + b"\0"
+	index = sorted(entries, key=lambda e: (e["hash"], e["name"]))
+	buckets = []
+	k = 0
+	for b in range((1 << bits) + 1):
+		while k < count and (index[k]["hash"] >> (32 - bits) if bits else 0) < b:
+			k += 1
+		buckets.append(k)
+
+	header_size = struct.calcsize(HEADER)
+	off_entries = align(4 * len(buckets), 16)
+	off_chunks = off_entries + count * struct.calcsize(ENTRY)
+	off_names = align(off_chunks + chunk_count * struct.calcsize(CHUNK), 16)
+	index_size = align(off_names + len(names), 16)
+	pos = header_size + index_size
+
+	# data layout, in command line order
+	for e in entries:
+		pos = align(pos, stored_align if e["flags"] & ENTRY_STORED else entry_align)
+		e["offset"] = pos
+		e["chunk_offsets"] = []
+		for c, packed in e["chunks"]:
+			e["chunk_offsets"].append(pos - e["offset"])
+			pos += len(packed)
+	file_size = pos
+
+	out = bytearray()
+	out += struct.pack(HEADER, PAK_MAGIC, PAK_VERSION, PAK_CHUNK_SIZE, entry_align, count, bits, chunk_count,
+		len(names), header_size, index_size, off_entries, off_chunks, off_names, file_size)
+	out += b"".join(struct.pack(">I", b) for b in buckets)
+	out += b"\0" * (header_size + off_entries - len(out))
+	for e in index:
+		out += struct.pack(ENTRY, e["hash"], e["name_offset"], e["size"], e["flags"], e["first"], len(e["chunks"]), e["offset"])
+	for e in entries:
+		for (c, packed), coff in zip(e["chunks"], e["chunk_offsets"]):
+			out += struct.pack(CHUNK, coff, len(packed) | c << 24)
+	out += b"\0" * (header_size + off_names - len(out))
+	out += names
+	out += b"\0" * (header_size + index_size - len(out))
+	for e in entries:
+		out += b"\0" * (e["offset"] - len(out))
+		for c, packed in e["chunks"]:
+			out += packed
+	with open(output, "wb") as f:
+		f.write(out)
+
+	if verbose:
+		raw = sum(e["size"] for e in entries)
+		print("%s: %d entries, %d chunks, %d -> %d bytes (%.1f%%), index %d bytes" % (output, count, chunk_count,
+			raw, file_size, 100.0 * file_size / raw if raw else 100.0, index_size))
+
+def read(path):
+	with open(path, "rb") as f:
+		d = f.read()
+	hs = struct.calcsize(HEADER)
+	h = dict(zip(("magic", "version", "chunk_size", "align", "entry_count", "bucket_bits", "chunk_count", "names_size",
+		"index_offset", "index_size", "entries", "chunks", "names", "file_size"), struct.unpack(HEADER, d[:hs])))
+	if h["magic"] != PAK_MAGIC or h["version"] != PAK_VERSION:
+		raise ValueError("%s: not a pak archive" % path)
+	base = h["index_offset"]
+	entries = []
+	for i in range(h["entry_count"]):
+		off = base + h["entries"] + i * struct.calcsize(ENTRY)
+		hash, name, size, flags, first, chunks, offset = struct.unpack(ENTRY, d[off:off + struct.calcsize(ENTRY)])
+		nstart = base + h["names"] + name
+		nm = d[nstart:d.index(b"\0", nstart)].decode("utf-8")
+		cl = []
+		for j in range(first, first + chunks):
+			coff = base + h["chunks"] + j * struct.calcsize(CHUNK)
+			cl.append(struct.unpack(CHUNK, d[coff:coff + struct.calcsize(CHUNK)]))
+		entries.append({"hash": hash, "name": nm, "size": size, "flags": flags, "offset": offset, "chunks": cl})
+	return h, entries, d
+
+def list_archive(path, check):
+	h, entries, d = read(path)
+	bad = 0
+	print("%8s %10s %10s %6s %-5s %s" % ("hash", "size", "packed", "ratio", "codec", "name"))
+	for e in sorted(entries, key=lambda e: e["offset"]):
+		packed = sum(info & 0xffffff for off, info in e["chunks"])
+		codecs = sorted(set(CODEC_NAMES[info >> 24] for off, info in e["chunks"]))
+		status = ""
+		if check:
+			data = b""
+			try:
+				for j, (off, info) in enumerate(e["chunks"]):
+					raw = min(h["chunk_size"], e["size"] - j * h["chunk_size"])
+					start = e["offset"] + off
+					chunk = decompress(info >> 24, d[start:start + (info & 0xffffff)], raw)
+					if len(chunk) != raw:
+						raise ValueError("chunk %d: %d bytes" % (j, len(chunk)))
+					data += chunk
+				status = "  ok"
+			except (ValueError, IndexError, zlib.error) as err:
+				status = "  BAD: %s" % err
+				bad += 1
+		print("%08x %10d %10d %5.1f%% %-5s %s%s" % (e["hash"], e["size"], packed, 100.0 * packed / e["size"] if e["size"] else 100.0,
+			"+".join(codecs) or "-", e["name"], status))
+	return bad
+
+def usage():
+	print("""pakbuild.py usage:
+	pakbuild.py [options] archive.pak directory|file...
+	pakbuild.py -t [-c] archive.pak
+	Options:
+		-z, --codec=c     zlib (default), lz4 or none
+		-l, --level=n     zlib level, 9 by default
+		-a, --align=n     alignment of the entries, 16 by default
+		-A, --stored-align=n
+		                  alignment of the stored entries, 2048 (a sector) by default
+		-s, --store=pattern
+		                  store the entries matching the pattern, e.g. '*.gtf' for
+		                  textures read straight into RSX memory; may be repeated
+		-v, --verbose     print the totals
+		-t, --list        list an archive
+		-c, --check       with -t: decode every chunk""")
+
+def main():
+	try:
+		opts, args = getopt.getopt(sys.argv[1:], "hz:l:a:A:s:vtc", ["help", "codec=", "level=", "align=", "stored-align=",
+			"store=", "verbose", "list", "check"])
+	except getopt.GetoptError:
+		usage()
+		sys.exit(2)
+	codec = CODEC_ZLIB
+	level = 9
+	entry_align = 16
+	stored_align = 2048
+	stored = []
+	verbose = False
+	listing = False
+	check = False
+	for opt, arg in opts:
+		if opt in ("-h", "--help"):
+			usage()
+			sys.exit(0)
+		elif opt in ("-z", "--codec"):
+			if arg not in CODECS:
+				usage()
+				sys.exit(2)
+			codec = CODECS[arg]
+		elif opt in ("-l", "--level"):
+			level = int(arg, 0)
+		elif opt in ("-a", "--align"):
+			entry_align = int(arg, 0)
+		elif opt in ("-A", "--stored-align"):
+			stored_align = int(arg, 0)
+		elif opt in ("-s", "--store"):
+			stored.append(arg)
+		elif opt in ("-v", "--verbose"):
+			verbose = True
+		elif opt in ("-t", "--list"):
+			listing = True
+		elif opt in ("-c", "--check"):
+			check = True
+	if entry_align < 16 or entry_align & (entry_align - 1) or stored_align < 16 or stored_align & (stored_align - 1):
+		print("pakbuild.py: alignments are powers of 2 from 16", file=sys.stderr)
+		sys.exit(2)
+	try:
+		if listing:
+			if len(args) != 1:
+				usage()
+				sys.exit(2)
+			sys.exit(1 if list_archive(args[0], check) else 0)
+		if len(args) < 2:
+			usage()
+			sys.exit(2)
+		build(args[0], args[1:], codec, level, entry_align, stored_align, stored, verbose)
+	except (IOError, OSError, ValueError, struct.error) as e:
+		print("pakbuild.py: %s" % e, file=sys.stderr)
+		sys.exit(1)
+
+if __name__ == "__main__":
+	main()
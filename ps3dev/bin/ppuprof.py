@@ -0,0 +1,335 @@
+#!/usr/bin/env python2.7
+from __future__ import print_function
+import bisect
+import binascii
+import socket
+import struct
+import getopt
+import sys
+
+"""
+	Decodes the stream of ppuprof/ppuprof.h, either raw (a capture of
+	ppuProfSinkSocket, or -L to listen for it) or as the "PPROF <hex>" lines
+	of ppuProfSinkTty mixed into a program's output, symbolises it against
+	the PPU ELF and prints a flat profile, folded stacks for flamegraph.pl,
+	frame times or the hitches with their stacks.
+
+	Functions of the 64 bit PowerPC ABI are described by their .opd
+	descriptors; the entry point is the first doubleword of the descriptor.
+"""
+
+PPUPROF_MAGIC = 0x50505246
+
+REC_HEADER = 0
+REC_SAMPLE = 1
+REC_FRAME  = 2
+REC_HITCH  = 3
+REC_THREAD = 4
+REC_LOST   = 5
+
+STATUS = ("idle", "runnable", "running", "sleeping", "stopped", "zombie", "deleted", "unknown")
+
+SHT_SYMTAB = 2
+SHF_EXEC   = 4
+STT_FUNC   = 2
+
+class PpuElf:
+	def __init__(self, path):
+		with open(path, "rb") as f:
+			self.data = f.read()
+		d = self.data
+		if d[:4] != b"\x7fELF" or d[4:5] != b"\x02":
+			raise ValueError("%s: not a 64 bit ELF" % path)
+		e = ">" if d[5:6] == b"\x02" else "<"
+		shoff, = struct.unpack(e + "Q", d[40:48])
+		shentsize, shnum, shstrndx = struct.unpack(e + "HHH", d[58:64])
+		sections = []
+		for i in range(shnum):
+			name, type, flags, addr, off, size, link, info, align, entsize = \
+				struct.unpack(e + "IIQQQQIIQQ", d[shoff + i * shentsize:shoff + i * shentsize + 64])
+			sections.append({"name": name, "type": type, "flags": flags, "addr": addr, "offset": off,
+				"size": size, "link": link})
+		names = sections[shstrndx]
+		for s in sections:
+			s["name"] = self.cstr(names["offset"] + s["name"])
+		funcs = {}
+		for symtab in [s for s in sections if s["type"] == SHT_SYMTAB]:
+			strtab = sections[symtab["link"]]
+			for off in range(symtab["offset"], symtab["offset"] + symtab["size"], 24):
+				name, info, other, shndx, value, size = struct.unpack(e + "IBBHQQ", d[off:off + 24])
+				if info & 15 != STT_FUNC or not name or shndx == 0 or shndx >= len(sections):
+					continue
+				sec = sections[shndx]
+				name = self.cstr(strtab["offset"] + name)
+				if sec["name"] == ".opd":
+					# descriptor: entry, toc, environment
+					desc = sec["offset"] + value - sec["addr"]
+					value, = struct.unpack(e + "Q", d[desc:desc + 8])
+					size = 0
+				elif not sec["flags"] & SHF_EXEC:
+					continue
+				if value not in funcs or (size and not funcs[value][0]):
+					funcs[value] = (size, name)
+		self.text = [(s["addr"], s["addr"] + s["size"]) for s in sections if s["flags"] & SHF_EXEC and s["size"]]
+		self.starts = sorted(funcs)
+		self.funcs = [funcs[a] for a in self.starts]
+
+	def cstr(self, off):
+		end = self.data.find(b"\0", off)
+		return self.data[off:end].decode("latin-1")
+
+	def resolve(self, addr):
+		i = bisect.bisect_right(self.starts, addr) - 1
+		if i >= 0:
+			size, name = self.funcs[i]
+			# unsized descriptors end where the next function starts, or with their section
+			if size and addr < self.starts[i] + size:
+				return name
+			if not size and any(lo <= self.starts[i] and addr < hi for lo, hi in self.text):
+				return name
+		return "0x%08x" % addr
+
+class NoElf:
+	def resolve(self, addr):
+		return "0x%08x" % addr
+
+class Stream:
+	def __init__(self, data):
+		self.threads = {}
+		self.samples = []       # (thread, status, stamp, words, hitch)
+		self.frames = []        # (frame, start, duration)
+		self.hitches = []       # (frame, start, duration, budget, samples)
+		self.lost = 0
+		self.header = None
+		if len(data) < 32:
+			raise ValueError("stream too short")
+		if struct.unpack(">I", data[8:12])[0] == PPUPROF_MAGIC:
+			e = ">"
+		elif struct.unpack("<I", data[8:12])[0] == PPUPROF_MAGIC:
+			e = "<"
+		else:
+			raise ValueError("no ppuprof header")
+		off = 0
+		hitch = None
+		left = 0
+		while off + 8 <= len(data):
+			type, thread, count, status, stamp = struct.unpack(e + "BBBBI", data[off:off + 8])
+			if off + 8 + 4 * count > len(data):
+				break
+			words = struct.unpack(e + "%dI" % count, data[off + 8:off + 8 + 4 * count])
+			off += 8 + 4 * count
+			if type == REC_HEADER:
+				self.header = dict(zip(("magic", "version", "interval", "mode", "budget", "flags"), words))
+			elif type == REC_SAMPLE:
+				self.samples.append((thread, status, stamp, words, hitch if left else None))
+				if left:
+					left -= 1
+			elif type == REC_FRAME:
+				self.frames.append((words[0], stamp, words[1]))
+			elif type == REC_HITCH:
+				hitch = len(self.hitches)
+				left = words[3]
+				self.hitches.append((words[0], stamp, words[1], words[2], words[3]))
+			elif type == REC_THREAD:
+				name = struct.pack(">7I" if e == ">" else "<7I", *words[1:8])
+				self.threads[thread] = (words[0], name.split(b"\0")[0].decode("latin-1"))
+			elif type == REC_LOST:
+				self.lost += words[0]
+			else:
+				raise ValueError("bad record type %d at %d" % (type, off))
+
+	def thread_name(self, index):
+		return self.threads.get(index, (0, "thread%d" % index))[1]
+
+def read_input(path):
+	with open(path, "rb") as f:
+		data = f.read()
+	if b"PPROF " not in data[:4096] and data[:6] != b"PPROF ":
+		return data
+	out = []
+	for line in data.splitlines():
+		i = line.find(b"PPROF ")
+		if i >= 0:
+			out.append(binascii.unhexlify(line[i + 6:].strip()))
+	return b"".join(out)
+
+def listen(port, path):
+	s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+	s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+	s.bind(("", port))
+	s.listen(1)
+	print("ppuprof.py: waiting on port %d" % port, file=sys.stderr)
+	c, addr = s.accept()
+	print("ppuprof.py: capturing from %s to %s" % (addr[0], path), file=sys.stderr)
+	with open(path, "wb") as f:
+		while True:
+			b = c.recv(65536)
+			if not b:
+				break
+			f.write(b)
+	c.close()
+	s.close()
+
+def stack(elf, status, words, use_lr):
+	""" function names of a sample, innermost first """
+	if not words:
+		return ["[%s]" % STATUS[min(status, len(STATUS) - 1)]]
+	frames = [elf.resolve(words[0])]
+	walked = words[2:]
+	if use_lr and len(words) > 1 and words[1]:
+		# a leaf has not saved lr yet; once it has, lr is either the first
+		# walked address or points back into the function after a call
+		lr = elf.resolve(words[1] - 4)
+		if lr != frames[0] and (not walked or lr != elf.resolve(walked[0] - 4)):
+			frames.append(lr)
+	for a in walked:
+		frames.append(elf.resolve(a - 4))
+	return frames
+
+def select(stream, thread, hitch):
+	for s in stream.samples:
+		if thread is not None and str(s[0]) != thread and stream.thread_name(s[0]) != thread:
+			continue
+		if hitch is not None and s[4] != hitch:
+			continue
+		yield s
+
+def flat(elf, stream, samples, use_lr, top):
+	own = {}
+	total = {}
+	count = 0
+	for thread, status, stamp, words, hitch in samples:
+		frames = stack(elf, status, words, use_lr)
+		own[frames[0]] = own.get(frames[0], 0) + 1
+		for name in set(frames):
+			total[name] = total.get(name, 0) + 1
+		count += 1
+	if not count:
+		return
+	print("%8s %7s %8s %7s  %s" % ("self", "self%", "total", "total%", "function"))
+	rows = sorted(own.items(), key=lambda r: (-r[1], r[0]))
+	for name in sorted((n for n in total if n not in own), key=lambda n: (-total[n], n)):
+		rows.append((name, 0))
+	for name, n in rows[:top] if top else rows:
+		print("%8d %6.2f%% %8d %6.2f%%  %s" % (n, 100.0 * n / count, total[name], 100.0 * total[name] / count, name))
+
+def folded(elf, stream, samples, use_lr):
+	stacks = {}
+	for thread, status, stamp, words, hitch in samples:
+		frames = stack(elf, status, words, use_lr)
+		frames.append(stream.thread_name(thread))
+		frames.reverse()
+		key = ";".join(frames)
+		stacks[key] = stacks.get(key, 0) + 1
+	for key in sorted(stacks):
+		print("%s %d" % (key, stacks[key]))
+
+def frame_times(stream):
+	d = sorted(f[2] for f in stream.frames)
+	if not d:
+		print("no frames")
+		return
+	pct = lambda p: d[min(len(d) - 1, int(p * len(d)))]
+	print("frames %d  mean %.0f us  p50 %d  p95 %d  p99 %d  max %d" % (len(d), float(sum(d)) / len(d),
+		pct(0.5), pct(0.95), pct(0.99), d[-1]))
+	budget = stream.header["budget"] if stream.header else 0
+	if budget:
+		over = [f for f in stream.frames if f[2] > budget]
+		print("over budget (%d us): %d" % (budget, len(over)))
+
+def hitches(elf, stream, use_lr, top):
+	for i, (frame, start, duration, budget, n) in enumerate(stream.hitches):
+		print("hitch %d: frame %d at %.3f s took %d us (budget %d), %d samples" % (i, frame, start / 1e6,
+			duration, budget, n))
+		flat(elf, stream, select(stream, None, i), use_lr, top)
+		print("")
+
+def raw(elf, stream, samples):
+	for thread, status, stamp, words, hitch in samples:
+		print("%10u %-12s %-8s %s" % (stamp, stream.thread_name(thread), STATUS[min(status, len(STATUS) - 1)],
+			" ".join("%08x(%s)" % (a, elf.resolve(a - 4 if i else a)) for i, a in enumerate(words))))
+
+def usage():
+	print("""ppuprof.py usage:
+	ppuprof.py [options] [ppu.elf] capture
+	ppuprof.py -L port -o capture
+	The capture is the raw stream or a log holding the PPROF lines of the TTY sink.
+	Options:
+		-f, --flat         flat profile: self and total samples per function (default)
+		-F, --folded       folded stacks for flamegraph.pl, rooted at the thread
+		-T, --frames       frame time statistics
+		-H, --hitches      every hitch with the profile of its samples
+		-r, --raw          every sample with its addresses
+		-t, --thread=name  only the samples of a thread (name or index)
+		-n, --top=n        flat: only the first n functions
+		-l, --no-lr        ignore the link register
+		-L, --listen=port  wait for ppuProfSinkSocket and save the stream to -o
+		-o, --output=file  where -L saves the stream""")
+
+def main():
+	try:
+		opts, args = getopt.getopt(sys.argv[1:], "hfFTHrt:n:lL:o:", ["help", "flat", "folded", "frames", "hitches",
+			"raw", "thread=", "top=", "no-lr", "listen=", "output="])
+	except getopt.GetoptError:
+		usage()
+		sys.exit(2)
+	mode = "flat"
+	thread = None
+	top = 0
+	use_lr = True
+	port = None
+	output = None
+	for opt, arg in opts:
+		if opt in ("-h", "--help"):
+			usage()
+			sys.exit(0)
+		elif opt in ("-f", "--flat"):
+			mode = "flat"
+		elif opt in ("-F", "--folded"):
+			mode = "folded"
+		elif opt in ("-T", "--frames"):
+			mode = "frames"
+		elif opt in ("-H", "--hitches"):
+			mode = "hitches"
+		elif opt in ("-r", "--raw"):
+			mode = "raw"
+		elif opt in ("-t", "--thread"):
+			thread = arg
+		elif opt in ("-n", "--top"):
+			top = int(arg, 0)
+		elif opt in ("-l", "--no-lr"):
+			use_lr = False
+		elif opt in ("-L", "--listen"):
+			port = int(arg, 0)
+		elif opt in ("-o", "--output"):
+			output = arg
+	if port is not None:
+		if not output:
+			usage()
+			sys.exit(2)
+		listen(port, output)
+		sys.exit(0)
+	if len(args) not in (1, 2):
+		usage()
+		sys.exit(2)
+	try:
+		elf = PpuElf(args[0]) if len(args) == 2 else NoElf()
+		stream = Stream(read_input(args[-1]))
+	except (IOError, ValueError, TypeError, struct.error, binascii.Error) as e:
+		print("ppuprof.py: %s" % e, file=sys.stderr)
+		sys.exit(1)
+	if stream.lost:
+		print("# %d records lost in transport" % stream.lost)
+	if mode == "flat":
+		flat(elf, stream, select(stream, thread, None), use_lr, top)
+	elif mode == "folded":
+		folded(elf, stream, select(stream, thread, None), use_lr)
+	elif mode == "frames":
+		frame_times(stream)
+	elif mode == "hitches":
+		hitches(elf, stream, use_lr, top)
+	else:
+		raw(elf, stream, select(stream, thread, None))
+
+if __name__ == "__main__":
+	main()
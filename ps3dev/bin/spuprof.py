@@ -0,0 +1,299 @@
+#!/usr/bin/env python2.7
+from __future__ import print_function
+import bisect
+import struct
+import getopt
+import sys
+
+"""
+	Symbolises the profiles written by spuProfSave (spuprof/spuprof.h)
+	against the SPU ELF and prints a flat profile or folded stacks, one
+	line per stack, for flamegraph.pl.
+
+	Sample addresses carry the overlay that was mapped at them in the bits
+	above SPUPROF_ADDR_BITS; they are looked up in the symbols of that
+	overlay section, found through the _ovly_table of the ELF.
+"""
+
+SPUPROF_MAGIC      = 0x53505246
+SPUPROF_FILE_MAGIC = 0x53504644
+SPUPROF_ADDR_BITS  = 18
+SPUPROF_ADDR_MASK  = (1 << SPUPROF_ADDR_BITS) - 1
+SPUPROF_WRAP       = 0x01
+SPUPROF_STOPPED    = 0x04
+SPUPROF_SAMPLE_LR  = 0x01
+
+SHT_SYMTAB = 2
+SHT_NOBITS = 8
+SHF_ALLOC  = 2
+SHF_EXEC   = 4
+STT_NOTYPE = 0
+STT_FUNC   = 2
+
+HEADER_FIELDS = ("magic", "version", "capacity", "interval", "flags", "index", "thread",
+		"sample_size", "depth", "written", "samples", "dropped", "flushes", "start", "stop", "bytes")
+
+class SpuElf:
+	def __init__(self, path):
+		with open(path, "rb") as f:
+			self.data = f.read()
+		d = self.data
+		if d[:4] != b"\x7fELF" or d[4:5] != b"\x01":
+			raise ValueError("%s: not a 32 bit ELF" % path)
+		self.e = ">" if d[5:6] == b"\x02" else "<"
+		shoff, = struct.unpack(self.e + "I", d[32:36])
+		shentsize, shnum, shstrndx = struct.unpack(self.e + "HHH", d[46:52])
+		self.sections = []
+		for i in range(shnum):
+			name, type, flags, addr, off, size, link, info, align, entsize = \
+				struct.unpack(self.e + "10I", d[shoff + i * shentsize:shoff + i * shentsize + 40])
+			self.sections.append({"name": name, "type": type, "flags": flags, "addr": addr,
+				"offset": off, "size": size, "link": link, "entsize": entsize})
+		strtab = self.sections[shstrndx]
+		for s in self.sections:
+			s["name"] = self.cstr(strtab["offset"] + s["name"])
+		self.symbols = {}
+		for s in self.sections:
+			if s["type"] == SHT_SYMTAB:
+				self.load_symbols(s)
+		self.load_overlays()
+
+	def cstr(self, off):
+		end = self.data.find(b"\0", off)
+		return self.data[off:end].decode("latin-1")
+
+	def load_symbols(self, symtab):
+		strtab = self.sections[symtab["link"]]
+		funcs = []
+		for off in range(symtab["offset"], symtab["offset"] + symtab["size"], 16):
+			name, value, size, info, other, shndx = struct.unpack(self.e + "IIIBBH", self.data[off:off + 16])
+			if shndx == 0 or shndx >= len(self.sections):
+				continue
+			if not self.sections[shndx]["flags"] & SHF_EXEC:
+				continue
+			if info & 15 not in (STT_FUNC, STT_NOTYPE) or not name:
+				continue
+			name = self.cstr(strtab["offset"] + name)
+			if name.startswith(".L") or name.startswith("__ovly_"):
+				continue
+			funcs.append((value, size, shndx, name))
+		self.symbols = {}
+		for value, size, shndx, name in sorted(funcs, key=lambda f: (f[2], f[0], -f[1])):
+			table = self.symbols.setdefault(shndx, ([], []))
+			# one name per address, the sized (function) symbol first
+			if table[0] and table[0][-1] == value:
+				continue
+			table[0].append(value)
+			table[1].append((size, name))
+
+	def symbol(self, name):
+		for s in self.sections:
+			if s["type"] != SHT_SYMTAB:
+				continue
+			strtab = self.sections[s["link"]]
+			for off in range(s["offset"], s["offset"] + s["size"], 16):
+				n, value, size, info, other, shndx = struct.unpack(self.e + "IIIBBH", self.data[off:off + 16])
+				if n and self.cstr(strtab["offset"] + n) == name:
+					return value, shndx
+		return None
+
+	def load_overlays(self):
+		""" overlay n -> section index, from { vma, size, file offset, buffer } entries """
+		self.overlays = {}
+		table = self.symbol("_ovly_table")
+		end = self.symbol("_ovly_table_end")
+		if not table or not end or table[1] >= len(self.sections):
+			return
+		sec = self.sections[table[1]]
+		if sec["type"] == SHT_NOBITS:
+			return
+		base = sec["offset"] + table[0] - sec["addr"]
+		for i in range((end[0] - table[0]) // 16):
+			vma, size, foff, buf = struct.unpack(self.e + "4I", self.data[base + i * 16:base + i * 16 + 16])
+			for n, s in enumerate(self.sections):
+				if s["flags"] & SHF_ALLOC and s["addr"] == vma and s["offset"] == foff and s["size"]:
+					self.overlays[i + 1] = n
+					break
+
+	def lookup(self, shndx, addr):
+		sec = self.sections[shndx]
+		if shndx not in self.symbols or not sec["addr"] <= addr < sec["addr"] + sec["size"]:
+			return None
+		starts, info = self.symbols[shndx]
+		i = bisect.bisect_right(starts, addr) - 1
+		if i < 0:
+			return None
+		size, name = info[i]
+		if size and addr >= starts[i] + size:
+			return None
+		return name
+
+	def resolve(self, addr, ret):
+		""" name of the function at a sample address; return addresses are looked up one instruction back """
+		a = addr & SPUPROF_ADDR_MASK
+		if ret and a >= 4:
+			a -= 4
+		ovl = addr >> SPUPROF_ADDR_BITS
+		if ovl:
+			if ovl in self.overlays:
+				name = self.lookup(self.overlays[ovl], a)
+				if name:
+					return name
+			return "0x%05x@ovl%d" % (a, ovl)
+		for shndx in self.symbols:
+			if shndx in self.overlays.values():
+				continue
+			name = self.lookup(shndx, a)
+			if name:
+				return name
+		return "0x%05x" % a
+
+class Profile:
+	def __init__(self, path):
+		with open(path, "rb") as f:
+			d = f.read()
+		if struct.unpack(">I", d[:4])[0] == SPUPROF_FILE_MAGIC:
+			e = ">"
+		elif struct.unpack("<I", d[:4])[0] == SPUPROF_FILE_MAGIC:
+			e = "<"
+		else:
+			raise ValueError("%s: not a spuprof profile" % path)
+		magic, version, count, self.group, self.timebase = struct.unpack(e + "5I", d[:20])
+		off = 32
+		self.threads = []
+		for i in range(count):
+			h = dict(zip(HEADER_FIELDS, struct.unpack(e + "16I", d[off:off + 64])))
+			off += 128
+			if h["magic"] != SPUPROF_MAGIC:
+				raise ValueError("%s: bad buffer %d" % (path, i))
+			n = min(h["written"], h["capacity"]) if h["sample_size"] else 0
+			samples = []
+			for j in range(n):
+				stamp, depth, flags = struct.unpack(e + "IHH", d[off:off + 8])
+				depth = min(depth, h["depth"])
+				pcs = struct.unpack(e + "%dI" % depth, d[off + 8:off + 8 + 4 * depth])
+				samples.append((stamp, flags, pcs))
+				off += h["sample_size"]
+			self.threads.append((h, samples))
+
+def stack(elf, flags, pcs, use_lr):
+	""" function names of a sample, innermost first """
+	frames = [elf.resolve(pcs[0], False)]
+	walked = pcs[2:]
+	if use_lr and len(pcs) > 1 and pcs[1] and flags & SPUPROF_SAMPLE_LR:
+		# a leaf has not saved $0 yet; once it has, $0 is either the first
+		# walked address or points back into the function after a call
+		lr = elf.resolve(pcs[1], True)
+		if lr != frames[0] and (not walked or not walked[0] or lr != elf.resolve(walked[0], True)):
+			frames.append(lr)
+	for a in walked:
+		if not a:
+			break
+		frames.append(elf.resolve(a, True))
+	return frames
+
+def flat(elf, prof, threads, use_lr, top):
+	own = {}
+	total = {}
+	count = 0
+	for h, samples in threads:
+		for stamp, flags, pcs in samples:
+			frames = stack(elf, flags, pcs, use_lr)
+			own[frames[0]] = own.get(frames[0], 0) + 1
+			for name in set(frames):
+				total[name] = total.get(name, 0) + 1
+			count += 1
+	for h, samples in threads:
+		secs = float(h["samples"]) * h["interval"] / prof.timebase if prof.timebase else 0
+		print("# spu %d thread 0x%x: %d samples kept, %d taken, %d dropped, %.3f s at %d ticks%s" % (h["index"],
+			h["thread"], len(samples), h["samples"], h["dropped"], secs, h["interval"],
+			"" if h["flags"] & SPUPROF_STOPPED else " (not stopped)"))
+	if not count:
+		return
+	print("%8s %7s %8s %7s  %s" % ("self", "self%", "total", "total%", "function"))
+	rows = sorted(own.items(), key=lambda r: (-r[1], r[0]))
+	for name in sorted((n for n in total if n not in own), key=lambda n: (-total[n], n)):
+		rows.append((name, 0))
+	for name, n in rows[:top] if top else rows:
+		print("%8d %6.2f%% %8d %6.2f%%  %s" % (n, 100.0 * n / count, total[name], 100.0 * total[name] / count, name))
+
+def folded(elf, prof, threads, use_lr, per_spu):
+	stacks = {}
+	for h, samples in threads:
+		for stamp, flags, pcs in samples:
+			frames = stack(elf, flags, pcs, use_lr)
+			frames.reverse()
+			if per_spu:
+				frames.insert(0, "spu%d" % h["index"])
+			key = ";".join(frames)
+			stacks[key] = stacks.get(key, 0) + 1
+	for key in sorted(stacks):
+		print("%s %d" % (key, stacks[key]))
+
+def raw(elf, prof, threads):
+	for h, samples in threads:
+		for stamp, flags, pcs in samples:
+			print("%d %10u %s" % (h["index"], stamp, " ".join(
+				"%05x%s(%s)" % (a & SPUPROF_ADDR_MASK, "@%d" % (a >> SPUPROF_ADDR_BITS) if a >> SPUPROF_ADDR_BITS else "",
+				elf.resolve(a, i > 0)) for i, a in enumerate(pcs))))
+
+def usage():
+	print("""spuprof.py usage:
+	spuprof.py [options] spu.elf profile
+	Options:
+		-f, --flat        flat profile: self and total samples per function (default)
+		-F, --folded      folded stacks for flamegraph.pl
+		-r, --raw         every sample with its addresses
+		-s, --spu=n       only the thread with collector index n
+		-t, --threads     folded: start every stack with the thread
+		-n, --top=n       flat: only the first n functions
+		-l, --no-lr       ignore the interrupted link register""")
+
+def main():
+	try:
+		opts, args = getopt.getopt(sys.argv[1:], "hfFrs:tn:l", ["help", "flat", "folded", "raw", "spu=", "threads", "top=", "no-lr"])
+	except getopt.GetoptError:
+		usage()
+		sys.exit(2)
+	mode = "flat"
+	spu = None
+	per_spu = False
+	top = 0
+	use_lr = True
+	for opt, arg in opts:
+		if opt in ("-h", "--help"):
+			usage()
+			sys.exit(0)
+		elif opt in ("-f", "--flat"):
+			mode = "flat"
+		elif opt in ("-F", "--folded"):
+			mode = "folded"
+		elif opt in ("-r", "--raw"):
+			mode = "raw"
+		elif opt in ("-s", "--spu"):
+			spu = int(arg, 0)
+		elif opt in ("-t", "--threads"):
+			per_spu = True
+		elif opt in ("-n", "--top"):
+			top = int(arg, 0)
+		elif opt in ("-l", "--no-lr"):
+			use_lr = False
+	if len(args) != 2:
+		usage()
+		sys.exit(2)
+	try:
+		elf = SpuElf(args[0])
+		prof = Profile(args[1])
+	except (IOError, ValueError, struct.error) as e:
+		print("spuprof.py: %s" % e, file=sys.stderr)
+		sys.exit(1)
+	threads = [t for t in prof.threads if spu is None or t[0]["index"] == spu]
+	if mode == "flat":
+		flat(elf, prof, threads, use_lr, top)
+	elif mode == "folded":
+		folded(elf, prof, threads, use_lr, per_spu)
+	else:
+		raw(elf, prof, threads)
+
+if __name__ == "__main__":
+	main()
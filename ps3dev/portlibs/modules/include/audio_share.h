@@ -0,0 +1,73 @@
+/*
+    Copyright (C) 1985, 2010  Francisco Mu�oz "Hermes" <www.elotrolado.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+    libaudio reference count shared by the soundlib outputs (audio_stream.h, spu_mixer.h).
+
+    The first user calls audioInit() and the last one to leave calls audioQuit(), unless
+    libaudio was already initialized by the application (audioInit() failed), in which
+    case it is never closed here. The counter is a weak symbol, so every source file that
+    includes this header shares the same one without an implementation macro.
+*/
+
+#ifndef AUDIO_SHARE_H
+#define AUDIO_SHARE_H
+
+#ifdef __PPU__
+
+#include <sys/thread.h>
+#include <audio/audio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+__attribute__((weak)) volatile int audio_share_lock;
+__attribute__((weak)) int audio_share_users, audio_share_owner;
+
+/* takes a libaudio reference, audioInit() for the first one */
+
+static inline void AudioShareAcquire(void)
+{
+	while (__sync_lock_test_and_set(&audio_share_lock, 1))
+		sysThreadYield();
+	if (audio_share_users++ == 0)
+		audio_share_owner = audioInit() == 0;
+	__sync_lock_release(&audio_share_lock);
+}
+
+/* drops a reference taken by AudioShareAcquire(), audioQuit() for the last one */
+
+static inline void AudioShareRelease(void)
+{
+	while (__sync_lock_test_and_set(&audio_share_lock, 1))
+		sysThreadYield();
+	if (audio_share_users > 0 && --audio_share_users == 0 && audio_share_owner) {
+		audioQuit();
+		audio_share_owner = 0;
+	}
+	__sync_lock_release(&audio_share_lock);
+}
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif /* __PPU__ */
+
+#endif
@@ -0,0 +1,596 @@
+/*
+    Copyright (C) 1985, 2010  Francisco Mu�oz "Hermes" <www.elotrolado.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+    Audio stream: lock-free PCM rings feeding a libaudio port.
+
+    Every producer (a decoder thread, a synth...) owns one single producer / single consumer
+    ring of stereo float frames and writes into it with AST_RingWrite(), without locks.
+    The stream thread sleeps on the audio notify event queue (audioSetNotifyEventQueue),
+    and every time the port consumes a block it mixes one block of every ring into the
+    port buffer (AltiVec madd on the PPU).
+
+    On the host the port is simulated by a thread that consumes blocks at 48000 Hz and
+    passes them to a sink callback, so the same code can be tested off the console.
+
+    Streams share libaudio with the other soundlib outputs (audio_share.h): the first user
+    calls audioInit() and the last one to close calls audioQuit(), unless libaudio was
+    already initialized by someone else.
+
+    Building: #define AST_IMPLEMENTATION in one source file before the include.
+*/
+
+#ifndef AUDIO_STREAM_H
+#define AUDIO_STREAM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef __PPU__
+#include <ppu-lv2.h>
+#include <ppu-types.h>
+#include <malloc.h>
+#include <sys/thread.h>
+#include <sys/systime.h>
+#include <sys/event_queue.h>
+#include <audio/audio.h>
+#include "audio_share.h"
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#ifdef __ALTIVEC__
+#include <altivec.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AST_RATE          48000
+#define AST_BLOCK         256		// frames per port block, AUDIO_BLOCK_SAMPLES
+#define AST_PORT_BLOCKS   8
+#define AST_MAX_PRODUCERS 8
+#define AST_LEAD_BLOCKS   2			// blocks written ahead of the port read index
+
+#define AST_OK       0
+#define AST_INVALID -1
+
+/* single producer / single consumer ring of stereo float frames */
+
+typedef struct {
+	float *data;			// 2 * frames floats, 16 byte aligned
+	uint32_t frames;		// power of 2, multiple of AST_BLOCK
+	volatile uint32_t head;	// written frames, only the producer changes it
+	volatile uint32_t tail;	// read frames, only the consumer changes it
+	uint64_t *marks;		// write time of each block slot, for the latency
+	uint32_t underruns;		// blocks the consumer found incomplete
+	uint32_t underrun_frames;
+	float volume;
+} AST_Ring;
+
+typedef struct {
+	uint64_t blocks;		// blocks written to the port
+	uint64_t wakeups;		// notify events received
+	uint32_t underruns;		// sum of all the rings
+	uint32_t underrun_frames;
+	uint32_t late_blocks;	// port went past the stream before it wrote
+	uint32_t latency_us;	// last write -> play time, ring + port queue
+	uint32_t max_latency_us;
+} AST_Stats;
+
+typedef void (*AST_Sink) (const float *block, uint32_t frames, void *user);
+
+typedef struct {
+	AST_Ring rings[AST_MAX_PRODUCERS];
+	uint32_t producers;
+	volatile int running;
+	AST_Stats stats;
+	uint64_t played;		// port read index, not wrapped
+	uint64_t written;		// blocks written to the port buffer
+	float mix[AST_BLOCK * 2] __attribute__((aligned(16)));	// one block of a ring, for the stream thread
+	int audio;				// holds a libaudio reference
+
+#ifdef __PPU__
+	u32 port;
+	audioPortConfig config;
+	sys_event_queue_t queue;
+	sys_ipc_key_t key;
+	sys_ppu_thread_t thread;
+#else
+	float port_data[AST_PORT_BLOCKS * AST_BLOCK * 2] __attribute__((aligned(16)));
+	volatile uint64_t read_index;
+	pthread_t thread, sim;
+	pthread_mutex_t lock;
+	pthread_cond_t event;
+	uint64_t events;
+	AST_Sink sink;
+	void *sink_user;
+#endif
+} AST_Stream;
+
+/* memory barrier between the ring data and the index update */
+
+static inline void AST_Barrier()
+{
+#if defined(__PPU__) || defined(__powerpc__)
+	__asm__ volatile ("lwsync":::"memory");
+#else
+	__sync_synchronize();
+#endif
+}
+
+/* microseconds from a monotonic clock */
+
+static inline uint64_t AST_Time()
+{
+#ifdef __PPU__
+	u64 tb;
+	__asm__ volatile ("mftb %0":"=r" (tb));
+	return tb / (sysGetTimebaseFrequency() / 1000000);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+static inline uint32_t AST_RingAvailable(const AST_Ring * r)
+{
+	return r->head - r->tail;
+}
+
+static inline uint32_t AST_RingSpace(const AST_Ring * r)
+{
+	return r->frames - (r->head - r->tail);
+}
+
+/*------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+/* uint32_t AST_RingWrite(AST_Ring *r, const float *frames, uint32_t count);
+
+Producer side. Copies up to 'count' stereo frames (L/R float) in the ring.
+
+return: the frames written, less than 'count' if the ring is full
+
+*/
+
+static inline uint32_t AST_RingWrite(AST_Ring * r, const float *frames, uint32_t count)
+{
+	uint32_t head = r->head, space = AST_RingSpace(r), done = 0;
+	uint64_t now = AST_Time();
+
+	if (count > space)
+		count = space;
+	while (done < count) {
+		uint32_t pos = (head + done) & (r->frames - 1);
+		uint32_t n = r->frames - pos;
+		if (n > count - done)
+			n = count - done;
+		memcpy(r->data + pos * 2, frames + done * 2, n * 2 * sizeof(float));
+		done += n;
+	}
+	// the first write that reaches a block stamps it
+	for (done = (head + AST_BLOCK - 1) & ~(AST_BLOCK - 1); done < head + count; done += AST_BLOCK)
+		r->marks[(done & (r->frames - 1)) / AST_BLOCK] = now;
+	AST_Barrier();
+	r->head = head + count;
+	return count;
+}
+
+/* consumer side, 'count' frames or less */
+
+static inline uint32_t AST_RingRead(AST_Ring * r, float *frames, uint32_t count)
+{
+	uint32_t tail = r->tail, avail = AST_RingAvailable(r), done = 0;
+
+	if (count > avail)
+		count = avail;
+	AST_Barrier();
+	while (done < count) {
+		uint32_t pos = (tail + done) & (r->frames - 1);
+		uint32_t n = r->frames - pos;
+		if (n > count - done)
+			n = count - done;
+		memcpy(frames + done * 2, r->data + pos * 2, n * 2 * sizeof(float));
+		done += n;
+	}
+	AST_Barrier();
+	r->tail = tail + count;
+	return count;
+}
+
+/* out += in * volume over 'n' floats (multiple of 4), both 16 byte aligned */
+
+static inline void AST_MixBlock(float *out, const float *in, float volume, uint32_t n)
+{
+	uint32_t i;
+#ifdef __ALTIVEC__
+	vector float v = (vector float) {volume, volume, volume, volume};
+	for (i = 0; i < n; i += 8) {
+		vec_st(vec_madd(vec_ld(0, in + i), v, vec_ld(0, out + i)), 0, out + i);
+		vec_st(vec_madd(vec_ld(16, in + i), v, vec_ld(16, out + i)), 16, out + i);
+	}
+#else
+	for (i = 0; i < n; i += 4) {
+		out[i] += in[i] * volume;
+		out[i + 1] += in[i + 1] * volume;
+		out[i + 2] += in[i + 2] * volume;
+		out[i + 3] += in[i + 3] * volume;
+	}
+#endif
+}
+
+static inline void AST_ClampBlock(float *out, uint32_t n)
+{
+	uint32_t i;
+#ifdef __ALTIVEC__
+	vector float one = (vector float) {1.0f, 1.0f, 1.0f, 1.0f};
+	vector float mone = (vector float) {-1.0f, -1.0f, -1.0f, -1.0f};
+	for (i = 0; i < n; i += 4)
+		vec_st(vec_max(vec_min(vec_ld(0, out + i), one), mone), 0, out + i);
+#else
+	for (i = 0; i < n; i++)
+		out[i] = out[i] > 1.0f ? 1.0f : (out[i] < -1.0f ? -1.0f : out[i]);
+#endif
+}
+
+/*------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+/* int AST_StreamOpen(AST_Stream *s, uint32_t producers, uint32_t ring_frames);
+
+Allocates 'producers' rings of 'ring_frames' frames (rounded up to a power of 2) and opens a stereo
+port (a simulated one on the host). Rings can be filled before AST_StreamStart() to prime the port.
+
+return: AST_OK or AST_INVALID
+
+*/
+
+int AST_StreamOpen(AST_Stream * s, uint32_t producers, uint32_t ring_frames);
+
+/* int AST_StreamStart(AST_Stream *s);  starts the port and the feeding thread */
+
+int AST_StreamStart(AST_Stream * s);
+
+/* void AST_StreamClose(AST_Stream *s);  stops everything and frees the rings */
+
+void AST_StreamClose(AST_Stream * s);
+
+/* AST_Ring *AST_StreamProducer(AST_Stream *s, uint32_t n);  ring of producer 'n', NULL if invalid */
+
+static inline AST_Ring *AST_StreamProducer(AST_Stream * s, uint32_t n)
+{
+	return n < s->producers ? &s->rings[n] : NULL;
+}
+
+static inline void AST_StreamSetVolume(AST_Stream * s, uint32_t n, float volume)
+{
+	if (n < s->producers)
+		s->rings[n].volume = volume;
+}
+
+/* void AST_StreamGetStats(AST_Stream *s, AST_Stats *stats);  under-runs, wake ups and latency */
+
+void AST_StreamGetStats(AST_Stream * s, AST_Stats * stats);
+
+#ifndef __PPU__
+/* host only: called by the simulated port with every block it plays */
+static inline void AST_StreamSetSink(AST_Stream * s, AST_Sink sink, void *user)
+{
+	s->sink = sink;
+	s->sink_user = user;
+}
+#endif
+
+#ifdef AST_IMPLEMENTATION
+
+#ifdef __PPU__
+
+static void ast_audio_acquire(AST_Stream * s)
+{
+	AudioShareAcquire();
+	s->audio = 1;
+}
+
+static void ast_audio_release(AST_Stream * s)
+{
+	if (!s->audio)
+		return;
+	AudioShareRelease();
+	s->audio = 0;
+}
+
+#endif
+
+static void ast_fill_block(AST_Stream * s, float *out)
+{
+	float *tmp = s->mix;
+	uint64_t now = AST_Time(), oldest = now;
+	uint32_t n, latency;
+
+	memset(out, 0, AST_BLOCK * 2 * sizeof(float));
+	for (n = 0; n < s->producers; n++) {
+		AST_Ring *r = &s->rings[n];
+		uint32_t slot = (r->tail & (r->frames - 1)) / AST_BLOCK;
+		uint32_t got;
+
+		if (AST_RingAvailable(r) > 0 && r->marks[slot] < oldest)
+			oldest = r->marks[slot];
+		got = AST_RingRead(r, tmp, AST_BLOCK);
+		if (got < AST_BLOCK) {
+			r->underruns++;
+			r->underrun_frames += AST_BLOCK - got;
+			s->stats.underruns++;
+			s->stats.underrun_frames += AST_BLOCK - got;
+			memset(tmp + got * 2, 0, (AST_BLOCK - got) * 2 * sizeof(float));
+		}
+		if (got)
+			AST_MixBlock(out, tmp, r->volume, AST_BLOCK * 2);
+	}
+	AST_ClampBlock(out, AST_BLOCK * 2);
+
+	// time in the ring + time before the port plays this block
+	latency = (uint32_t) (now - oldest) + AST_LEAD_BLOCKS * AST_BLOCK * 1000000 / AST_RATE;
+	s->stats.latency_us = latency;
+	if (latency > s->stats.max_latency_us)
+		s->stats.max_latency_us = latency;
+	s->stats.blocks++;
+}
+
+/* before the port starts: writes blocks 0 .. AST_LEAD_BLOCKS, the first ones it plays */
+
+static void ast_prime(AST_Stream * s, float *data)
+{
+	for (s->written = 0; s->written <= AST_LEAD_BLOCKS; s->written++)
+		ast_fill_block(s, data + (s->written % AST_PORT_BLOCKS) * AST_BLOCK * 2);
+}
+
+/* while playing: writes every block between the last written one and read index + AST_LEAD_BLOCKS */
+
+static void ast_feed(AST_Stream * s, float *data, uint64_t read_index)
+{
+	if (read_index >= s->written) {
+		// the port already played blocks we did not write, restart after it
+		s->stats.late_blocks += (uint32_t) (read_index + 1 - s->written);
+		s->written = read_index + 1;
+	}
+	while (s->written <= read_index + AST_LEAD_BLOCKS) {
+		ast_fill_block(s, data + (s->written % AST_PORT_BLOCKS) * AST_BLOCK * 2);
+		s->written++;
+	}
+}
+
+#ifdef __PPU__
+
+static void ast_thread(void *arg)
+{
+	AST_Stream *s = (AST_Stream *) arg;
+	float *data = (float *) (u64) s->config.audioDataStart;
+	u64 last = 0;
+
+	while (s->running) {
+		sys_event_t ev;
+		u64 read;
+
+		// 20 ms timeout so AST_StreamClose() is never stuck
+		if (sysEventQueueReceive(s->queue, &ev, 20000) == 0)
+			s->stats.wakeups++;
+		read = *(vu64 *) (u64) s->config.readIndex;
+		if (read == last)
+			continue;
+		// readIndex wraps at numBlocks, keep a 64 bit count
+		s->played += (read + AST_PORT_BLOCKS - last) % AST_PORT_BLOCKS;
+		last = read;
+		ast_feed(s, data, s->played);
+	}
+	sysThreadExit(0);
+}
+
+#else
+
+/* simulated port: consumes one block every 256/48000 s and raises the notify event */
+
+static void *ast_sim_thread(void *arg)
+{
+	AST_Stream *s = (AST_Stream *) arg;
+	uint64_t start = AST_Time(), n = 0;
+
+	while (s->running) {
+		uint64_t due = start + (n + 1) * AST_BLOCK * 1000000 / AST_RATE, now = AST_Time();
+		struct timespec ts;
+
+		if (now < due) {
+			ts.tv_sec = (due - now) / 1000000;
+			ts.tv_nsec = ((due - now) % 1000000) * 1000;
+			nanosleep(&ts, NULL);
+		}
+		if (s->sink)
+			s->sink(s->port_data + (n % AST_PORT_BLOCKS) * AST_BLOCK * 2, AST_BLOCK, s->sink_user);
+		n++;
+		pthread_mutex_lock(&s->lock);
+		s->read_index = n;
+		s->events++;
+		pthread_cond_signal(&s->event);
+		pthread_mutex_unlock(&s->lock);
+	}
+	return NULL;
+}
+
+static void *ast_thread(void *arg)
+{
+	AST_Stream *s = (AST_Stream *) arg;
+	uint64_t seen = 0;
+
+	while (s->running) {
+		uint64_t read;
+
+		pthread_mutex_lock(&s->lock);
+		while (s->events == seen && s->running)
+			pthread_cond_wait(&s->event, &s->lock);
+		seen = s->events;
+		read = s->read_index;
+		pthread_mutex_unlock(&s->lock);
+		s->stats.wakeups++;
+		// the read index is the block in play, as on the console
+		s->played = read;
+		ast_feed(s, s->port_data, read);
+	}
+	return NULL;
+}
+
+#endif
+
+int AST_StreamOpen(AST_Stream * s, uint32_t producers, uint32_t ring_frames)
+{
+	uint32_t n, frames = AST_BLOCK;
+
+	if (!s || producers < 1 || producers > AST_MAX_PRODUCERS)
+		return AST_INVALID;
+	while (frames < ring_frames)
+		frames <<= 1;
+
+	memset(s, 0, sizeof(*s));
+#ifndef __PPU__
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->event, NULL);
+#endif
+	for (n = 0; n < producers; n++) {
+		AST_Ring *r = &s->rings[n];
+#ifdef __PPU__
+		r->data = (float *) memalign(16, frames * 2 * sizeof(float));
+#else
+		if (posix_memalign((void **) &r->data, 16, frames * 2 * sizeof(float)))
+			r->data = NULL;
+#endif
+		r->marks = (uint64_t *) calloc(frames / AST_BLOCK, sizeof(uint64_t));
+		r->frames = frames;
+		r->volume = 1.0f;
+		s->producers = n + 1;
+		if (!r->data || !r->marks) {
+			AST_StreamClose(s);
+			return AST_INVALID;
+		}
+	}
+
+#ifdef __PPU__
+	{
+		audioPortParam params;
+
+		ast_audio_acquire(s);
+		params.numChannels = AUDIO_PORT_2CH;
+		params.numBlocks = AUDIO_BLOCK_8;
+		params.attrib = 0;
+		params.level = 1.0f;
+		if (audioPortOpen(&params, &s->port) || audioGetPortConfig(s->port, &s->config) ||
+		    audioCreateNotifyEventQueue(&s->queue, &s->key) || audioSetNotifyEventQueue(s->key)) {
+			AST_StreamClose(s);
+			return AST_INVALID;
+		}
+		memset((void *) (u64) s->config.audioDataStart, 0, s->config.portSize);
+	}
+#endif
+	return AST_OK;
+}
+
+int AST_StreamStart(AST_Stream * s)
+{
+	if (!s || s->running || !s->producers)
+		return AST_INVALID;
+	s->running = 1;
+
+	// prime the blocks the port plays first
+#ifdef __PPU__
+	ast_prime(s, (float *) (u64) s->config.audioDataStart);
+	audioPortStart(s->port);
+	if (sysThreadCreate(&s->thread, ast_thread, s, 100, 0x4000, THREAD_JOINABLE, (char *) "Audio Stream")) {
+		s->running = 0;
+		audioPortStop(s->port);
+		return AST_INVALID;
+	}
+#else
+	ast_prime(s, s->port_data);
+	if (pthread_create(&s->thread, NULL, ast_thread, s)) {
+		s->running = 0;
+		return AST_INVALID;
+	}
+	if (pthread_create(&s->sim, NULL, ast_sim_thread, s)) {
+		pthread_mutex_lock(&s->lock);
+		s->running = 0;
+		pthread_cond_signal(&s->event);
+		pthread_mutex_unlock(&s->lock);
+		pthread_join(s->thread, NULL);
+		return AST_INVALID;
+	}
+#endif
+	return AST_OK;
+}
+
+void AST_StreamClose(AST_Stream * s)
+{
+	uint32_t n;
+
+	if (!s)
+		return;
+	if (s->running) {
+#ifdef __PPU__
+		u64 ret;
+		s->running = 0;
+		sysThreadJoin(s->thread, &ret);
+		audioPortStop(s->port);
+#else
+		pthread_mutex_lock(&s->lock);
+		s->running = 0;
+		pthread_cond_signal(&s->event);
+		pthread_mutex_unlock(&s->lock);
+		pthread_join(s->sim, NULL);
+		pthread_join(s->thread, NULL);
+#endif
+	}
+#ifdef __PPU__
+	if (s->key) {
+		audioRemoveNotifyEventQueue(s->key);
+		sysEventQueueDestroy(s->queue, 0);
+	}
+	if (s->config.audioDataStart)
+		audioPortClose(s->port);
+	ast_audio_release(s);
+#else
+	pthread_cond_destroy(&s->event);
+	pthread_mutex_destroy(&s->lock);
+#endif
+	for (n = 0; n < s->producers; n++) {
+		free(s->rings[n].data);
+		free(s->rings[n].marks);
+	}
+	memset(s, 0, sizeof(*s));
+}
+
+void AST_StreamGetStats(AST_Stream * s, AST_Stats * stats)
+{
+	*stats = s->stats;
+}
+
+#endif /* AST_IMPLEMENTATION */
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif
@@ -0,0 +1,920 @@
+/*
+Copyright (c) 2002,2003, Christian Nowak <chnowak@web.de>
+All rights reserved.
+
+Modified by Francisco Mu�oz 'Hermes' (www.elotrolado.net) MAY 2008
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+- Redistributions of source code must retain the above copyright notice, this list of
+  conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright notice, this list
+  of conditions and the following disclaimer in the documentation and/or other
+  materials provided with the distribution.
+- The names of the contributors may not be used to endorse or promote products derived
+  from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+   Channel mixer for MOD players.
+
+   The channels are mixed tick by tick: MODMIX_Render() asks the sequencer for a new tick
+   (the 'tick' callback updates notes, effects and volumes and returns samplespertick),
+   then mixes the whole tick in one block, 8 frames at a time with AltiVec on the PPU.
+   Linear interpolation can be enabled per mixer; without it the output is the plain
+   "sample at playpos" mix and the vector and scalar paths give the same bits.
+
+   With MODMIX_StartSPU() the blocks are mixed by an SPU thread (MODMIX_SpuMain), the
+   samples are fetched with DMA through a small window in local store. The SPU signals
+   the end of a block with an SPU thread event, the PPU sleeps on the event queue.
+
+   libmod (MOD_Player, and the MODPlay thread of gcmodplay.h on top of it) mixes through
+   mix_stereo_16bit()/mix_mono_16bit(). Link with
+
+       -Wl,--wrap=mix_stereo_16bit,--wrap=mix_mono_16bit
+
+   and MODMIX_AttachMOD() sends the mixing of that MOD to the mixer, sequencing stays in
+   libmod. In this mode each channel is scaled and saturated like libmod does it
+   (((sample * vol) >> 6) << shiftval, clamped after every channel), so with interpolation
+   off the output is bit-exact with the libmod mixer, including its tail quirk: when a
+   one-shot instrument ends inside libmod's loop unrolled by 4, libmod jumps to its
+   remainder loop and keeps mixing the last byte for up to numSamples % 4 frames. The
+   mixer replays that tail sample by sample (MODMIX_Scale.tail / .unrolled, set by
+   MODMIX_LibmodScale()); ps3dev/portlibs/tests/modmix_test.c checks it against a
+   transcription of the libmod loop.
+
+   MODMIX_FromMOD()/MODMIX_ToMOD() copy the channel state of a libmod MOD structure
+   (playpos, inctab[] with the instrument finetune, volume, instrument loop) in and out
+   of the mixer.
+
+   MODMIX_Bench() measures the CPU load of 4, 8, ... MODMIX_MAX_CHANNELS channels.
+
+   Building: #define MODMIX_IMPLEMENTATION in one source file before the include.
+*/
+
+#ifndef __MODMIX_H__
+#define __MODMIX_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SPU__
+#include <spu_intrinsics.h>
+#include <spu_mfcio.h>
+#include <sys/spu_thread.h>
+#include <sys/spu_event.h>
+#else
+#include <stdlib.h>
+#ifdef __PPU__
+#include <ppu-lv2.h>
+#include <malloc.h>
+#include <sys/spu.h>
+#include <sys/event_queue.h>
+#include <sys/systime.h>
+#include <lv2/spu.h>
+#include "modplay.h"
+#else
+#include <time.h>
+#endif
+#ifdef __ALTIVEC__
+#include <altivec.h>
+#endif
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MODMIX_MAX_CHANNELS  32		// MAX_VOICES of modplay.h
+#ifndef MODMIX_FRAC_BITS
+#define MODMIX_FRAC_BITS     16		// fixed point of playpos / inctab
+#endif
+#define MODMIX_MAX_BLOCK     2048	// frames mixed at once, a tick is split in blocks of this size
+#define MODMIX_SPU_WINDOW    2048	// sample bytes kept in local store per fetch
+#define MODMIX_SPU_PORT      17		// SPU event port of the block completion
+#define MODMIX_MAX_MODS      4		// MODs attached at the same time
+
+#define MODMIX_ACTIVE        1
+#define MODMIX_LOOP          2
+#define MODMIX_TAIL          4		// one-shot past its end, replaying libmod's remainder loop
+
+/* one channel, 64 bytes */
+
+typedef struct {
+	uint64_t data;			// address of the s8 samples
+	uint32_t pos;			// MODMIX_FRAC_BITS fixed point
+	uint32_t inc;
+	uint32_t length;		// samples
+	uint32_t loop_start, loop_end;
+	int32_t vol_l, vol_r;	// 0..256
+	uint32_t flags;
+	uint32_t tail;			// MODMIX_TAIL: frames left
+	uint32_t pad[5];
+} __attribute__((aligned(16))) MODMIX_Channel;
+
+typedef struct {
+	uint64_t frames;		// frames mixed
+	uint64_t channel_frames;	// frames * active channels
+	uint64_t time;			// mixing time in timebase ticks (decrementer ticks on the SPU)
+	uint32_t ticks;			// sequencer ticks
+} MODMIX_Stats;
+
+/*
+   How a channel reaches the output: each channel adds ((s * vol) >> pre) << post to the bus,
+   clamped to 16 bits after every channel with 'saturate'; the bus is shifted right by 'shift'
+   and clamped at the end. The MODMIX default is pre = post = 0, no saturation.
+
+   'tail' and 'unrolled' reproduce libmod's end of a one-shot: if a channel steps past its end
+   after a frame below 'unrolled' (frames of this block inside libmod's unrolled loop, may be
+   negative), it mixes its last sample again for up to 'tail' frames. tail = 0 turns it off.
+*/
+
+typedef struct {
+	uint32_t interpolate;
+	uint32_t shift;
+	uint32_t pre;
+	uint32_t post;
+	uint32_t saturate;
+	uint32_t tail;
+	int32_t unrolled;
+	uint32_t pad;
+} MODMIX_Scale;
+
+/* scale of libmod's mixer for the block at frame 'done' of a mix_*_16bit(numSamples = 'frames') call */
+
+static inline void MODMIX_LibmodScale(MODMIX_Scale * sc, uint32_t shiftval, int stereo, uint32_t frames, uint32_t done)
+{
+	sc->shift = 0;
+	sc->pre = 6;
+	sc->post = shiftval + (stereo ? 1 : 0);
+	sc->saturate = 1;
+	sc->tail = frames % 4;
+	sc->unrolled = (int32_t) (frames - frames % 4) - (int32_t) done;
+}
+
+/* command block of the SPU mixer */
+
+typedef struct {
+	uint64_t channels;		// address of MODMIX_Channel[nchannels]
+	uint64_t out;			// address of int16_t[frames * 2]
+	uint32_t nchannels;
+	uint32_t frames;
+	MODMIX_Scale scale;
+	uint32_t cmd;
+	uint32_t seq;
+	volatile uint32_t done;
+	uint32_t time;
+	uint32_t active;
+	uint32_t pad[11];
+} __attribute__((aligned(128))) MODMIX_SpuCommand;
+
+#define MODMIX_CMD_MIX   1
+#define MODMIX_CMD_QUIT  2
+
+/* where the samples come from: direct on the PPU and host, a DMA window on the SPU */
+
+typedef struct {
+#ifdef __SPU__
+	int8_t buf[MODMIX_SPU_WINDOW + 32] __attribute__((aligned(128)));
+	uint64_t base;			// ea of buf[0], 16 byte aligned
+	uint64_t data;			// channel the window belongs to
+#else
+	int dummy;
+#endif
+} MODMIX_Window;
+
+/* planar stereo bus of one block */
+
+typedef struct {
+	int32_t l[MODMIX_MAX_BLOCK + 8] __attribute__((aligned(16)));
+	int32_t r[MODMIX_MAX_BLOCK + 8] __attribute__((aligned(16)));
+} MODMIX_Bus;
+
+static inline int MODMIX_Fetch(MODMIX_Window * w, const MODMIX_Channel * c, uint32_t idx)
+{
+#ifdef __SPU__
+	uint64_t ea = c->data + idx;
+	if (w->data != c->data || ea < w->base || ea >= w->base + MODMIX_SPU_WINDOW) {
+		uint64_t last = (c->data + c->length + 15) & ~15ULL;	// never read past the instrument
+		w->base = ea & ~15ULL;
+		w->data = c->data;
+		mfc_get(w->buf, w->base, last - w->base < MODMIX_SPU_WINDOW ? last - w->base : MODMIX_SPU_WINDOW, 5, 0, 0);
+		mfc_write_tag_mask(1 << 5);
+		mfc_read_tag_status_all();
+	}
+	return w->buf[ea - w->base];
+#else
+	(void) w;
+	return ((const int8_t *) (uintptr_t) c->data)[idx];
+#endif
+}
+
+/*
+   Gathers up to 'n' frames of a channel, starting at frame 'f' of the block: s0 = sample at pos,
+   s1 = next sample, frac = 8 bit fraction. Advances the channel and stops it at the end of a non
+   looped instrument (after the libmod tail, see MODMIX_Scale). Returns the frames gathered.
+*/
+
+static inline uint32_t MODMIX_Gather(MODMIX_Channel * c, MODMIX_Window * w, const MODMIX_Scale * sc, uint32_t f, uint32_t n,
+				     int16_t * s0, int16_t * s1, int16_t * frac)
+{
+	uint32_t i, end = (c->flags & MODMIX_LOOP) ? c->loop_end : c->length;
+	int interpolate = sc->interpolate;
+
+	for (i = 0; i < n; i++) {
+		uint32_t idx = c->pos >> MODMIX_FRAC_BITS;
+
+		while (idx >= end && (c->flags & MODMIX_LOOP) && c->loop_end > c->loop_start) {
+			c->pos -= (c->loop_end - c->loop_start) << MODMIX_FRAC_BITS;
+			idx = c->pos >> MODMIX_FRAC_BITS;
+		}
+		if (idx >= end && !(c->flags & MODMIX_TAIL) && sc->tail && end && (int32_t) (f + i) - 1 < sc->unrolled) {
+			// libmod saw the end inside its unrolled loop: restart from the last sample in the remainder loop
+			c->flags |= MODMIX_TAIL;
+			c->tail = sc->tail;
+			c->pos = (end - 1) << MODMIX_FRAC_BITS;
+			idx = end - 1;
+		}
+		if (idx >= end || ((c->flags & MODMIX_TAIL) && c->tail-- == 0)) {
+			c->flags &= ~(MODMIX_ACTIVE | MODMIX_TAIL);
+			break;
+		}
+		s0[i] = (int16_t) MODMIX_Fetch(w, c, idx);
+		if (interpolate) {
+			uint32_t next = idx + 1 < end ? idx + 1 : ((c->flags & MODMIX_LOOP) ? c->loop_start : idx);
+			s1[i] = (int16_t) MODMIX_Fetch(w, c, next);
+			frac[i] = (int16_t) ((c->pos >> (MODMIX_FRAC_BITS - 8)) & 0xff);
+		}
+		c->pos += c->inc;
+	}
+	return i;
+}
+
+static inline int32_t MODMIX_Clamp(int32_t s)
+{
+	return s > 32767 ? 32767 : (s < -32768 ? -32768 : s);
+}
+
+/*
+   Adds 8 gathered frames to the planar buses:
+   s = s0 + ((s1 - s0) * frac >> 8), l += ((s * vol_l) >> pre) << post, r likewise
+*/
+
+static inline void MODMIX_Accumulate8(const int16_t * s0, const int16_t * s1, const int16_t * frac, const MODMIX_Scale * sc,
+				      int32_t vol_l, int32_t vol_r, int32_t * l, int32_t * r)
+{
+#if defined(__ALTIVEC__) && !defined(__SPU__)
+	vector signed short s = vec_ld(0, s0);
+	signed short sl = (signed short) vol_l, sr = (signed short) vol_r;
+	vector signed short vl = (vector signed short) {sl, sl, sl, sl, sl, sl, sl, sl};
+	vector signed short vr = (vector signed short) {sr, sr, sr, sr, sr, sr, sr, sr};
+	vector unsigned int pre = (vector unsigned int) {sc->pre, sc->pre, sc->pre, sc->pre};
+	vector unsigned int post = (vector unsigned int) {sc->post, sc->post, sc->post, sc->post};
+	vector signed int hi = (vector signed int) {32767, 32767, 32767, 32767};
+	vector signed int lo = (vector signed int) {-32768, -32768, -32768, -32768};
+	vector signed int e, o, a, b;
+
+	if (sc->interpolate) {
+		vector signed short d = vec_sub(vec_ld(0, s1), s);
+		vector signed short f = vec_ld(0, frac);
+		vector unsigned int eight = vec_splat_u32(8);
+		e = vec_sra(vec_mule(d, f), eight);
+		o = vec_sra(vec_mulo(d, f), eight);
+		s = vec_add(s, vec_pack(vec_mergeh(e, o), vec_mergel(e, o)));
+	}
+	e = vec_sl(vec_sra(vec_mule(s, vl), pre), post);
+	o = vec_sl(vec_sra(vec_mulo(s, vl), pre), post);
+	a = vec_add(vec_ld(0, l), vec_mergeh(e, o));
+	b = vec_add(vec_ld(16, l), vec_mergel(e, o));
+	if (sc->saturate) {
+		a = vec_min(vec_max(a, lo), hi);
+		b = vec_min(vec_max(b, lo), hi);
+	}
+	vec_st(a, 0, l);
+	vec_st(b, 16, l);
+	e = vec_sl(vec_sra(vec_mule(s, vr), pre), post);
+	o = vec_sl(vec_sra(vec_mulo(s, vr), pre), post);
+	a = vec_add(vec_ld(0, r), vec_mergeh(e, o));
+	b = vec_add(vec_ld(16, r), vec_mergel(e, o));
+	if (sc->saturate) {
+		a = vec_min(vec_max(a, lo), hi);
+		b = vec_min(vec_max(b, lo), hi);
+	}
+	vec_st(a, 0, r);
+	vec_st(b, 16, r);
+#else
+	int i;
+	for (i = 0; i < 8; i++) {
+		int32_t s = s0[i];
+		if (sc->interpolate)
+			s += ((s1[i] - s0[i]) * frac[i]) >> 8;
+		l[i] += (int32_t) ((uint32_t) ((s * vol_l) >> sc->pre) << sc->post);
+		r[i] += (int32_t) ((uint32_t) ((s * vol_r) >> sc->pre) << sc->post);
+		if (sc->saturate) {
+			l[i] = MODMIX_Clamp(l[i]);
+			r[i] = MODMIX_Clamp(r[i]);
+		}
+	}
+#endif
+}
+
+/*
+   Mixes 'frames' (<= MODMIX_MAX_BLOCK) of every channel through 'bus' and writes interleaved s16 stereo.
+   Returns the channels that were playing.
+*/
+
+static inline uint32_t MODMIX_MixBlock(MODMIX_Channel * ch, uint32_t nch, uint32_t frames, const MODMIX_Scale * sc,
+				       MODMIX_Bus * bus, MODMIX_Window * w, int16_t * out)
+{
+	int16_t s0[8] __attribute__((aligned(16)));
+	int16_t s1[8] __attribute__((aligned(16)));
+	int16_t frac[8] __attribute__((aligned(16)));
+	uint32_t c, f, active = 0;
+
+	memset(bus->l, 0, ((frames + 7) & ~7) * sizeof(int32_t));
+	memset(bus->r, 0, ((frames + 7) & ~7) * sizeof(int32_t));
+
+	for (c = 0; c < nch; c++) {
+		if (!(ch[c].flags & MODMIX_ACTIVE))
+			continue;
+		active++;
+		for (f = 0; f < frames; f += 8) {
+			uint32_t want = frames - f < 8 ? frames - f : 8;
+			uint32_t got = MODMIX_Gather(&ch[c], w, sc, f, want, s0, s1, frac);
+			if (got < 8) {
+				memset(s0 + got, 0, (8 - got) * sizeof(int16_t));
+				memset(s1 + got, 0, (8 - got) * sizeof(int16_t));
+				memset(frac + got, 0, (8 - got) * sizeof(int16_t));
+			}
+			if (got)
+				MODMIX_Accumulate8(s0, s1, frac, sc, ch[c].vol_l, ch[c].vol_r, bus->l + f, bus->r + f);
+			if (got < want)
+				break;
+		}
+	}
+
+	for (f = 0; f < frames; f++) {
+		out[f * 2] = (int16_t) MODMIX_Clamp(bus->l[f] >> sc->shift);
+		out[f * 2 + 1] = (int16_t) MODMIX_Clamp(bus->r[f] >> sc->shift);
+	}
+	return active;
+}
+
+#ifdef __SPU__
+
+static MODMIX_SpuCommand modmix_cmd;
+static MODMIX_Channel modmix_channels[MODMIX_MAX_CHANNELS];
+static MODMIX_Window modmix_window;
+static MODMIX_Bus modmix_bus;
+static int16_t modmix_out[MODMIX_MAX_BLOCK * 2] __attribute__((aligned(128)));
+
+static inline void MODMIX_SpuDma(void *ls, uint64_t ea, uint32_t size, int put)
+{
+	while (size) {
+		uint32_t n = size > 16384 ? 16384 : size;
+		if (put)
+			mfc_put(ls, ea, n, 4, 0, 0);
+		else
+			mfc_get(ls, ea, n, 4, 0, 0);
+		ls = (char *) ls + n;
+		ea += n;
+		size -= n;
+	}
+	mfc_write_tag_mask(1 << 4);
+	mfc_read_tag_status_all();
+}
+
+/* SPU thread: mixes one block per mailbox kick, then sends an event on MODMIX_SPU_PORT */
+
+static inline int MODMIX_SpuMain(uint64_t command)
+{
+	spu_write_decrementer(0xffffffff);
+	for (;;) {
+		uint32_t start, bytes;
+
+		spu_read_in_mbox();
+		MODMIX_SpuDma(&modmix_cmd, command, sizeof(modmix_cmd), 0);
+		if (modmix_cmd.cmd == MODMIX_CMD_QUIT)
+			break;
+		start = spu_read_decrementer();
+		MODMIX_SpuDma(modmix_channels, modmix_cmd.channels, modmix_cmd.nchannels * sizeof(MODMIX_Channel), 0);
+		modmix_window.data = 0;
+		modmix_cmd.active = MODMIX_MixBlock(modmix_channels, modmix_cmd.nchannels, modmix_cmd.frames, &modmix_cmd.scale,
+						    &modmix_bus, &modmix_window, modmix_out);
+		bytes = (modmix_cmd.frames * 2 * sizeof(int16_t) + 15) & ~15;
+		MODMIX_SpuDma(modmix_out, modmix_cmd.out, bytes, 1);
+		MODMIX_SpuDma(modmix_channels, modmix_cmd.channels, modmix_cmd.nchannels * sizeof(MODMIX_Channel), 1);
+		modmix_cmd.time = start - spu_read_decrementer();
+		modmix_cmd.done = modmix_cmd.seq;
+		MODMIX_SpuDma(&modmix_cmd, command, sizeof(modmix_cmd), 1);
+		spu_thread_send_event(MODMIX_SPU_PORT, modmix_cmd.seq & EVENT_DATA0_MASK, 0);
+	}
+	spu_thread_exit(0);
+	return 0;
+}
+
+#else
+
+typedef uint32_t (*MODMIX_TickFunc) (void *user);	// sequencer step, returns the frames of the new tick
+
+typedef struct {
+	MODMIX_SpuCommand cmd;		// first, 128 byte aligned
+	MODMIX_Channel ch[MODMIX_MAX_CHANNELS];
+	int16_t block[MODMIX_MAX_BLOCK * 2] __attribute__((aligned(16)));
+	MODMIX_Bus bus;
+	uint32_t nchannels;
+	MODMIX_Scale scale;
+	uint32_t tick_left;
+	MODMIX_TickFunc tick;
+	void *user;
+	MODMIX_Stats stats;
+	MODMIX_Window window;
+	int on_spu;
+	void *mod;			// attached libmod MOD
+#ifdef __PPU__
+	sysSpuImage image;
+	sys_spu_group_t group;
+	sys_spu_thread_t thread;
+	sys_event_queue_t queue;
+#endif
+} __attribute__((aligned(128))) MODMIX;
+
+static inline uint64_t MODMIX_Time()
+{
+#ifdef __PPU__
+	uint64_t tb;
+	__asm__ volatile ("mftb %0":"=r" (tb));
+	return tb;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/* ticks per second of MODMIX_Time() and MODMIX_Stats.time */
+
+static inline uint64_t MODMIX_TimeFrequency()
+{
+#ifdef __PPU__
+	return sysGetTimebaseFrequency();
+#else
+	return 1000000000ULL;
+#endif
+}
+
+/*------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+/* void MODMIX_Init(MODMIX *m, uint32_t nchannels, MODMIX_TickFunc tick, void *user);
+
+nchannels: channels to mix (up to MODMIX_MAX_CHANNELS)
+
+tick: called at the start of every tick to update the channels, returns the frames of the tick (samplespertick)
+
+*/
+
+void MODMIX_Init(MODMIX * m, uint32_t nchannels, MODMIX_TickFunc tick, void *user);
+
+/* 1 -> linear interpolation, 0 -> sample at playpos (the classic MOD_Player output) */
+
+static inline void MODMIX_SetInterpolation(MODMIX * m, int on)
+{
+	m->scale.interpolate = on ? 1 : 0;
+}
+
+/* right shift applied to the sum of the channels (each channel is sample * volume, up to +-32768) */
+
+static inline void MODMIX_SetShift(MODMIX * m, uint32_t shift)
+{
+	m->scale.shift = shift;
+}
+
+/* void MODMIX_Render(MODMIX *m, int16_t *out, uint32_t frames);  interleaved stereo, calls 'tick' between ticks */
+
+void MODMIX_Render(MODMIX * m, int16_t * out, uint32_t frames);
+
+/* reference mixer: the same block mix without SIMD, used by the tests */
+
+uint32_t MODMIX_MixReference(MODMIX_Channel * ch, uint32_t nch, uint32_t frames, int interpolate, uint32_t shift, int16_t * out);
+
+void MODMIX_GetStats(MODMIX * m, MODMIX_Stats * stats);
+
+/* channels one thread can mix in real time at 'rate' Hz; tbfreq is the frequency of MODMIX_Stats.time */
+
+static inline float MODMIX_ChannelsPerCPU(const MODMIX_Stats * s, uint32_t rate, uint64_t tbfreq)
+{
+	if (!s->time)
+		return 0.0f;
+	return (float) ((double) s->channel_frames / ((double) s->time / (double) tbfreq) / (double) rate);
+}
+
+/* result of MODMIX_Bench(): load[i] is the CPU share to mix 4 * (i + 1) channels in real time */
+
+typedef struct {
+	float load[MODMIX_MAX_CHANNELS / 4];
+	float channels_per_cpu;		// from the MODMIX_MAX_CHANNELS run
+} MODMIX_BenchResult;
+
+/* int MODMIX_Bench(MODMIX *m, uint32_t rate, uint32_t seconds, MODMIX_BenchResult *res);
+
+Mixes 'seconds' of synthetic looped channels at 'rate' Hz for 4, 8, ... MODMIX_MAX_CHANNELS channels with the
+settings of 'm' (interpolation, SPU). The channels of 'm' are overwritten, do not run it on a playing mixer.
+
+return: 0 or -1
+
+*/
+
+int MODMIX_Bench(MODMIX * m, uint32_t rate, uint32_t seconds, MODMIX_BenchResult * res);
+
+#ifdef __PPU__
+/* runs the block mixing on an SPU thread (MODMIX_SpuMain), 0 or -1 */
+int MODMIX_StartSPU(MODMIX * m, const void *spu_elf);
+void MODMIX_StopSPU(MODMIX * m);
+
+/* channel state of libmod: instrument, playpos, inctab[] with finetune, volume (Amiga LRRL panning) */
+void MODMIX_FromMOD(MODMIX * m, const MOD * mod);
+void MODMIX_ToMOD(const MODMIX * m, MOD * mod);
+
+/* mixes 'mod' from MOD_Player() / MODPlay with this mixer (needs the --wrap link flags), 0 or -1 */
+int MODMIX_AttachMOD(MODMIX * m, MOD * mod);
+void MODMIX_DetachMOD(MODMIX * m);
+#endif
+
+#ifdef MODMIX_IMPLEMENTATION
+
+void MODMIX_Init(MODMIX * m, uint32_t nchannels, MODMIX_TickFunc tick, void *user)
+{
+	memset(m, 0, sizeof(*m));
+	m->nchannels = nchannels > MODMIX_MAX_CHANNELS ? MODMIX_MAX_CHANNELS : nchannels;
+	m->tick = tick;
+	m->user = user;
+	m->scale.shift = 2;
+}
+
+static uint32_t modmix_block(MODMIX * m, uint32_t frames, int16_t * out)
+{
+	uint64_t t = MODMIX_Time();
+	uint32_t active;
+
+#ifdef __PPU__
+	if (m->on_spu) {
+		sys_event_t ev;
+
+		m->cmd.channels = (u64) m->ch;
+		m->cmd.out = (u64) m->block;
+		m->cmd.nchannels = m->nchannels;
+		m->cmd.frames = frames;
+		m->cmd.scale = m->scale;
+		m->cmd.cmd = MODMIX_CMD_MIX;
+		m->cmd.seq++;
+		__asm__ volatile ("lwsync":::"memory");
+		sysSpuThreadWriteMb(m->thread, 1);
+		// one event per block, sent after the command block is written back
+		while (sysEventQueueReceive(m->queue, &ev, 0) != 0)
+			;
+		__asm__ volatile ("lwsync":::"memory");
+		if (out != m->block)
+			memcpy(out, m->block, frames * 2 * sizeof(int16_t));
+		active = m->cmd.active;
+	} else
+#endif
+		active = MODMIX_MixBlock(m->ch, m->nchannels, frames, &m->scale, &m->bus, &m->window, out);
+
+	m->stats.time += MODMIX_Time() - t;
+	m->stats.frames += frames;
+	m->stats.channel_frames += (uint64_t) frames * active;
+	return active;
+}
+
+void MODMIX_Render(MODMIX * m, int16_t * out, uint32_t frames)
+{
+	while (frames) {
+		uint32_t n;
+
+		if (m->tick_left == 0) {
+			m->tick_left = m->tick ? m->tick(m->user) : MODMIX_MAX_BLOCK;
+			if (m->tick_left == 0)
+				m->tick_left = MODMIX_MAX_BLOCK;
+			m->stats.ticks++;
+		}
+		n = m->tick_left < frames ? m->tick_left : frames;
+		if (n > MODMIX_MAX_BLOCK)
+			n = MODMIX_MAX_BLOCK;
+		modmix_block(m, n, out);
+		out += n * 2;
+		frames -= n;
+		m->tick_left -= n;
+	}
+}
+
+uint32_t MODMIX_MixReference(MODMIX_Channel * ch, uint32_t nch, uint32_t frames, int interpolate, uint32_t shift, int16_t * out)
+{
+	uint32_t c, f, active = 0;
+	int32_t *l = (int32_t *) calloc(frames * 2, sizeof(int32_t));
+
+	if (!l)
+		return 0;
+	for (c = 0; c < nch; c++) {
+		MODMIX_Channel *v = &ch[c];
+		uint32_t end = (v->flags & MODMIX_LOOP) ? v->loop_end : v->length;
+
+		if (!(v->flags & MODMIX_ACTIVE))
+			continue;
+		active++;
+		for (f = 0; f < frames; f++) {
+			uint32_t idx = v->pos >> MODMIX_FRAC_BITS;
+			int32_t s;
+			while (idx >= end && (v->flags & MODMIX_LOOP) && v->loop_end > v->loop_start) {
+				v->pos -= (v->loop_end - v->loop_start) << MODMIX_FRAC_BITS;
+				idx = v->pos >> MODMIX_FRAC_BITS;
+			}
+			if (idx >= end) {
+				v->flags &= ~MODMIX_ACTIVE;
+				break;
+			}
+			s = ((const int8_t *) (uintptr_t) v->data)[idx];
+			if (interpolate) {
+				uint32_t next = idx + 1 < end ? idx + 1 : ((v->flags & MODMIX_LOOP) ? v->loop_start : idx);
+				int32_t s1 = ((const int8_t *) (uintptr_t) v->data)[next];
+				s += ((s1 - s) * (int32_t) ((v->pos >> (MODMIX_FRAC_BITS - 8)) & 0xff)) >> 8;
+			}
+			l[f * 2] += s * v->vol_l;
+			l[f * 2 + 1] += s * v->vol_r;
+			v->pos += v->inc;
+		}
+	}
+	for (f = 0; f < frames * 2; f++)
+		out[f] = (int16_t) MODMIX_Clamp(l[f] >> shift);
+	free(l);
+	return active;
+}
+
+void MODMIX_GetStats(MODMIX * m, MODMIX_Stats * stats)
+{
+	*stats = m->stats;
+}
+
+int MODMIX_Bench(MODMIX * m, uint32_t rate, uint32_t seconds, MODMIX_BenchResult * res)
+{
+	int8_t *sample;
+	int16_t *out;
+	uint32_t i, c, n, left;
+	uint32_t seed = 0x2545f491;
+
+#ifdef __PPU__
+	sample = (int8_t *) memalign(128, 4096);
+	out = (int16_t *) memalign(128, MODMIX_MAX_BLOCK * 2 * sizeof(int16_t));
+#else
+	sample = (int8_t *) malloc(4096);
+	out = (int16_t *) malloc(MODMIX_MAX_BLOCK * 2 * sizeof(int16_t));
+#endif
+	if (!sample || !out || !rate || !seconds) {
+		free(sample);
+		free(out);
+		return -1;
+	}
+	for (i = 0; i < 4096; i++) {
+		seed = seed * 1103515245 + 12345;
+		sample[i] = (int8_t) (seed >> 24);
+	}
+	memset(res, 0, sizeof(*res));
+
+	for (n = 4; n <= MODMIX_MAX_CHANNELS; n += 4) {
+		MODMIX_Stats before = m->stats;
+		uint64_t time;
+
+		m->nchannels = n;
+		for (c = 0; c < n; c++) {
+			MODMIX_Channel *ch = &m->ch[c];
+			memset(ch, 0, sizeof(*ch));
+			ch->data = (uint64_t) (uintptr_t) sample;
+			ch->inc = (1u << MODMIX_FRAC_BITS) / 2 + c * 2731;	// 0.5 .. 1.8 samples per frame
+			ch->length = 4096;
+			ch->loop_start = 1024;
+			ch->loop_end = 4096;
+			ch->vol_l = (c & 1) ? 16 : 48;
+			ch->vol_r = 64 - ch->vol_l;
+			ch->flags = MODMIX_ACTIVE | MODMIX_LOOP;
+		}
+		for (left = rate * seconds; left;) {
+			uint32_t f = left > MODMIX_MAX_BLOCK ? MODMIX_MAX_BLOCK : left;
+			modmix_block(m, f, out);
+			left -= f;
+		}
+		time = m->stats.time - before.time;
+		res->load[n / 4 - 1] = (float) ((double) time / (double) MODMIX_TimeFrequency() / (double) seconds);
+	}
+	if (res->load[MODMIX_MAX_CHANNELS / 4 - 1] > 0.0f)
+		res->channels_per_cpu = (float) MODMIX_MAX_CHANNELS / res->load[MODMIX_MAX_CHANNELS / 4 - 1];
+
+	free(sample);
+	free(out);
+	return 0;
+}
+
+#ifdef __PPU__
+
+int MODMIX_StartSPU(MODMIX * m, const void *spu_elf)
+{
+	sysSpuThreadGroupAttribute gattr = { sizeof("MOD Mixer"), (u32) (u64) "MOD Mixer", 0, 0 };
+	sysSpuThreadAttribute attr = { (u32) (u64) "MOD Mixer", sizeof("MOD Mixer"), SPU_THREAD_ATTR_NONE };
+	sysSpuThreadArgument arg = { (u64) & m->cmd, 0, 0, 0 };
+	sys_event_queue_attr_t qattr = { SYS_EVENT_QUEUE_FIFO, SYS_EVENT_QUEUE_PPU, "modmix" };
+
+	if (m->on_spu || !spu_elf)
+		return -1;
+	if (sysEventQueueCreate(&m->queue, &qattr, SYS_EVENT_QUEUE_KEY_LOCAL, 4))
+		return -1;
+	if (sysSpuImageImport(&m->image, spu_elf, SPU_IMAGE_PROTECT)) {
+		sysEventQueueDestroy(m->queue, 0);
+		return -1;
+	}
+	if (sysSpuThreadGroupCreate(&m->group, 1, 100, &gattr)) {
+		sysSpuImageClose(&m->image);
+		sysEventQueueDestroy(m->queue, 0);
+		return -1;
+	}
+	if (sysSpuThreadInitialize(&m->thread, m->group, 0, &m->image, &attr, &arg) ||
+	    sysSpuThreadConnectEvent(m->thread, m->queue, SPU_THREAD_EVENT_USER, MODMIX_SPU_PORT) ||
+	    sysSpuThreadGroupStart(m->group)) {
+		sysSpuThreadGroupDestroy(m->group);
+		sysSpuImageClose(&m->image);
+		sysEventQueueDestroy(m->queue, 0);
+		return -1;
+	}
+	m->on_spu = 1;
+	return 0;
+}
+
+void MODMIX_StopSPU(MODMIX * m)
+{
+	u32 cause, status;
+
+	if (!m->on_spu)
+		return;
+	m->cmd.cmd = MODMIX_CMD_QUIT;
+	__asm__ volatile ("lwsync":::"memory");
+	sysSpuThreadWriteMb(m->thread, 1);
+	sysSpuThreadGroupJoin(m->group, &cause, &status);
+	sysSpuThreadDisconnectEvent(m->thread, SPU_THREAD_EVENT_USER, MODMIX_SPU_PORT);
+	sysSpuThreadGroupDestroy(m->group);
+	sysSpuImageClose(&m->image);
+	sysEventQueueDestroy(m->queue, 0);
+	m->on_spu = 0;
+}
+
+void MODMIX_FromMOD(MODMIX * m, const MOD * mod)
+{
+	uint32_t v;
+
+	for (v = 0; v < m->nchannels && v < (uint32_t) mod->num_channels; v++) {
+		const MOD_INSTR *in = &mod->instrument[mod->instnum[v]];
+		MODMIX_Channel *c = &m->ch[v];
+		int32_t freq = mod->chanfreq[v];
+		int32_t vol = (mod->volume[v] * (v < (uint32_t) mod->num_voices ? mod->musicvolume : mod->sfxvolume)) >> 6;
+		int left = (v & 3) == 0 || (v & 3) == 3;
+
+		// the period table lookup of libmod: finetune moves the note by up to 1/16
+		c->data = (u64) in->data;
+		c->pos = mod->playpos[v];
+		c->inc = mod->inctab[freq - freq * 2 * ((int32_t) in->finetune - 8) / 256];
+		if (mod->freq == 32000 || mod->freq == 48000)
+			c->inc >>= 2;
+		c->length = in->loop_end;
+		c->loop_start = in->loop_end - in->loop_length;
+		c->loop_end = in->loop_end;
+		c->vol_l = mod->channels == 1 || left ? vol : 0;
+		c->vol_r = mod->channels != 1 && !left ? vol : 0;
+		c->flags = (mod->channel_active[v] && in->data ? MODMIX_ACTIVE : 0) | (in->looped ? MODMIX_LOOP : 0);
+	}
+	for (; v < m->nchannels; v++)
+		m->ch[v].flags = 0;
+}
+
+void MODMIX_ToMOD(const MODMIX * m, MOD * mod)
+{
+	uint32_t v;
+
+	for (v = 0; v < m->nchannels && v < (uint32_t) mod->num_channels; v++) {
+		const MODMIX_Channel *c = &m->ch[v];
+		uint32_t pos = c->pos;
+
+		if (!mod->channel_active[v] || !mod->instrument[mod->instnum[v]].data)
+			continue;
+		// libmod wraps or stops a channel as soon as it steps past the end, the mixer on the next fetch
+		while ((pos >> MODMIX_FRAC_BITS) >= c->loop_end && (c->flags & MODMIX_LOOP) && c->loop_end > c->loop_start)
+			pos -= (c->loop_end - c->loop_start) << MODMIX_FRAC_BITS;
+		if (!(c->flags & MODMIX_ACTIVE) || (pos >> MODMIX_FRAC_BITS) >= c->loop_end) {
+			pos = (c->loop_end - 1) << MODMIX_FRAC_BITS;
+			mod->channel_active[v] = FALSE;
+		}
+		mod->playpos[v] = pos;
+	}
+}
+
+static MODMIX *modmix_mods[MODMIX_MAX_MODS];
+
+int MODMIX_AttachMOD(MODMIX * m, MOD * mod)
+{
+	int i;
+
+	MODMIX_DetachMOD(m);
+	for (i = 0; i < MODMIX_MAX_MODS; i++)
+		if (!modmix_mods[i]) {
+			m->mod = mod;
+			modmix_mods[i] = m;
+			return 0;
+		}
+	return -1;
+}
+
+void MODMIX_DetachMOD(MODMIX * m)
+{
+	int i;
+
+	for (i = 0; i < MODMIX_MAX_MODS; i++)
+		if (modmix_mods[i] == m)
+			modmix_mods[i] = NULL;
+	m->mod = NULL;
+}
+
+/* one libmod mixing call: 'frames' of the current tick, interleaved stereo or mono */
+
+static int modmix_mod(MOD * mod, s16 * buf, s32 frames, int stereo)
+{
+	MODMIX *m = NULL;
+	MODMIX_Scale keep;
+	uint32_t done = 0, f;
+	int i;
+
+	for (i = 0; i < MODMIX_MAX_MODS; i++)
+		if (modmix_mods[i] && modmix_mods[i]->mod == mod)
+			m = modmix_mods[i];
+	if (!m)
+		return -1;
+
+	keep = m->scale;
+	m->nchannels = mod->num_channels > MODMIX_MAX_CHANNELS ? MODMIX_MAX_CHANNELS : mod->num_channels;
+	MODMIX_FromMOD(m, mod);
+	if (!stereo)
+		for (f = 0; f < m->nchannels; f++)
+			m->ch[f].vol_r = 0;
+
+	while (done < (uint32_t) frames) {
+		uint32_t n = (uint32_t) frames - done > MODMIX_MAX_BLOCK ? MODMIX_MAX_BLOCK : (uint32_t) frames - done;
+		MODMIX_LibmodScale(&m->scale, mod->shiftval, stereo, frames, done);
+		if (stereo) {
+			modmix_block(m, n, buf + done * 2);
+		} else {
+			modmix_block(m, n, m->block);
+			for (f = 0; f < n; f++)
+				buf[done + f] = m->block[f * 2];
+		}
+		done += n;
+	}
+	MODMIX_ToMOD(m, mod);
+	m->scale = keep;
+	return 0;
+}
+
+/* libmod's mixer (mixer.o), reached through MOD_Player(); the originals stay reachable as __real_* */
+
+s32 __real_mix_stereo_16bit(MOD * mod, s16 * buf, s32 numSamples) __attribute__((weak));
+s32 __real_mix_mono_16bit(MOD * mod, s16 * buf, s32 numSamples) __attribute__((weak));
+
+s32 __wrap_mix_stereo_16bit(MOD * mod, s16 * buf, s32 numSamples)
+{
+	if (modmix_mod(mod, buf, numSamples, 1) == 0)
+		return numSamples;
+	return __real_mix_stereo_16bit(mod, buf, numSamples);
+}
+
+s32 __wrap_mix_mono_16bit(MOD * mod, s16 * buf, s32 numSamples)
+{
+	if (modmix_mod(mod, buf, numSamples, 0) == 0)
+		return numSamples;
+	return __real_mix_mono_16bit(mod, buf, numSamples);
+}
+
+#endif /* __PPU__ */
+
+#endif /* MODMIX_IMPLEMENTATION */
+
+#endif /* __SPU__ */
+
+#ifdef __cplusplus
+  }
+#endif
+
+#endif
@@ -0,0 +1,1136 @@
+/*
+    Copyright (C) 1985, 2010  Francisco Mu�oz "Hermes" <www.elotrolado.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+    Multi SPU voice mixer.
+
+    Same voice model as spu_soundlib (SND_SetVoice, SND_AddVoice, double buffer callbacks...)
+    but with up to SNDM_MAX_VOICES voices mixed by 1 to SNDM_MAX_SPUS SPU threads.
+    Voice 'v' is mixed by the SPU (v % spus); every SPU writes its own partial bus, then
+    every SPU sums its slice of the frames of all the buses, converts it to float and
+    writes it into the audio port block.
+
+    Resampling uses an 8 tap, 32 phase polyphase filter (integer, Q14 coefficients, so a
+    tap never overflows a 16 bit lane), and the SPU, the PPU and the host give the same
+    samples. The taps that fall before the start or past the end of a voice buffer read
+    the end of the previous buffer and the start of the next one (the buffer queued by
+    SND_AddVoice, or the same buffer for a looping voice). Every voice also has a pan
+    and a one pole low-pass filter.
+
+    Building:
+
+    - in one PPU source file:   #define SNDM_IMPLEMENTATION  before  #include <soundlib/spu_mixer.h>
+    - the SPU kernel (spu-gcc): #include <soundlib/spu_mixer.h>
+                                int main(uint64_t control) { return SNDM_SpuMain(control); }
+      embedded with bin2o and passed to SNDM_Init().
+    - on the host the same file gives SNDM_BuildCoefTable() and SNDM_MixVoices(), the
+      reference mixer used by the tests.
+
+    Defining SNDM_REPLACE_SND_API before the include maps the SND_* voice functions to
+    this mixer, so old code only has to be rebuilt (SND_Init() then uses SNDM_SPU_ELF and
+    SNDM_DEFAULT_SPUS).
+*/
+
+#ifndef SPU_MIXER_H
+#define SPU_MIXER_H
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SPU__
+#include <spu_intrinsics.h>
+#include <spu_mfcio.h>
+#include <sys/spu_thread.h>
+#include <sys/spu_event.h>
+#else
+#include <math.h>
+#include <stdlib.h>
+#ifdef __PPU__
+#include <ppu-lv2.h>
+#include <ppu-types.h>
+#include <malloc.h>
+#include <sys/spu.h>
+#include <sys/thread.h>
+#include <sys/systime.h>
+#include <sys/event_queue.h>
+#include <lv2/mutex.h>
+#include <audio/audio.h>
+#include "audio_share.h"
+#endif
+#ifdef __ALTIVEC__
+#include <altivec.h>
+#endif
+#endif
+
+#define SNDM_MAX_VOICES   128
+#define SNDM_MAX_SPUS     6
+#define SNDM_BLOCK        256		// frames per mix, the same as AUDIO_BLOCK_SAMPLES
+#define SNDM_TAPS         8
+#define SNDM_PHASE_BITS   5
+#define SNDM_PHASES       (1 << SNDM_PHASE_BITS)
+#define SNDM_WINDOW       512		// frames converted to 16 bit planar per refill
+#define SNDM_HIST         (SNDM_TAPS / 2 - 1)	// frames before the current one read by the taps
+#define SNDM_SPU_PORT     20		// SPU event port of the command completion
+
+#ifndef SNDM_DEFAULT_SPUS
+#define SNDM_DEFAULT_SPUS 2
+#endif
+
+// same values of spu_soundlib.h
+
+#ifndef SPU_SNDLIB_H
+#define MIN_FREQ      1
+#define F44100HZ_FREQ 44100
+#define MAX_FREQ      144000
+
+#define SND_OK               0
+#define SND_INVALID         -1
+#define SND_ISNOTASONGVOICE -2
+#define SND_BUSY             1
+
+#define SND_UNUSED   0
+#define SND_WORKING  1
+#define SND_WAITING  2
+
+#define VOICE_MONO_8BIT    0
+#define VOICE_STEREO_8BIT  1
+#define VOICE_MONO_16BIT   2
+#define VOICE_STEREO_16BIT 3
+
+#define MIN_VOLUME 0
+#define MID_VOLUME 127
+#define MAX_VOLUME 255
+#endif
+
+// voice flags
+
+#define SNDM_ACTIVE     1
+#define SNDM_PAUSED     2
+#define SNDM_LOOP       4		// SND_SetInfiniteVoice
+#define SNDM_CALLBACK   8		// never stops, waits for SND_AddVoice
+#define SNDM_WAITING    16		// no more samples, waiting for SND_AddVoice
+#define SNDM_NEED_DATA  32		// the second buffer was consumed, the callback must be called
+
+#define SNDM_CMD_MIX    1
+#define SNDM_CMD_QUIT   2
+#define SNDM_CMD_REDUCE 3		// sum a slice of every bus into 'out'
+
+/* one voice, 128 bytes so the SPU moves it with a single DMA */
+
+typedef struct {
+	uint64_t snd;			// samples in play
+	uint64_t snd2;			// queued by SND_AddVoice (0 = none)
+	uint32_t size, size2;	// bytes
+	uint32_t format;
+	uint32_t flags;
+	uint64_t pos;			// 32.32 frame position in 'snd'
+	uint32_t step;			// 16.16 source frames per output frame
+	int32_t  delay;			// output frames to wait before playing
+	int32_t  vol_l, vol_r;	// 0..256, pan already applied
+	int32_t  lp_coef;		// Q15 one pole coefficient, 32768 = filter off
+	int32_t  lp_state[2];
+	int16_t  hist[2][SNDM_HIST];	// last frames of the previous buffer
+	uint32_t pad[12];
+} __attribute__((aligned(128))) SNDM_Voice;
+
+/* one per SPU */
+
+typedef struct {
+	uint64_t voices;		// address of SNDM_Voice[nvoices]
+	uint64_t coef;			// address of the polyphase table
+	uint64_t bus;			// address of this SPU's partial bus (int32, L/R interleaved)
+	uint64_t buses;			// address of the partial bus of SPU 0, the others follow
+	uint64_t out;			// SNDM_CMD_REDUCE: the audio port block (float, L/R interleaved)
+	uint32_t rank, nspus, nvoices;
+	uint32_t cmd;
+	uint32_t seq;
+	volatile uint32_t done;	// = seq when the block is mixed
+	uint32_t ticks;			// decrementer ticks of the last block
+	uint32_t mixed;			// active voices of the last block
+	uint32_t pad[14];
+} __attribute__((aligned(128))) SNDM_Control;
+
+typedef int16_t SNDM_Coef[SNDM_PHASES][SNDM_TAPS] __attribute__((aligned(16)));
+
+/* frames [first - SNDM_TAPS/2 + 1, ...) of a voice, converted to 16 bit planar */
+
+typedef struct {
+	int16_t ch[2][SNDM_WINDOW + SNDM_TAPS + 8] __attribute__((aligned(16)));
+	uint8_t raw[(SNDM_WINDOW + SNDM_TAPS) * 4 + 32] __attribute__((aligned(128)));
+	uint32_t first;
+	int valid;
+} SNDM_Window;
+
+static inline uint32_t SNDM_FrameBytes(uint32_t format)
+{
+	static const uint32_t bytes[4] = {1, 2, 2, 4};
+	return bytes[format & 3];
+}
+
+/* 8 tap dot product, the same integer result on every target */
+
+static inline int32_t SNDM_Dot8(const int16_t *x, const int16_t *c)
+{
+#if defined(__SPU__)
+	const vec_short8 *q = (const vec_short8 *) ((uintptr_t) x & ~15);
+	int sh = (uintptr_t) x & 15;
+	vec_short8 v = (vec_short8) spu_or(spu_slqwbyte(q[0], sh), spu_rlmaskqwbyte(q[1], sh - 16));
+	vec_int4 s = spu_add(spu_mule(v, *(const vec_short8 *) c), spu_mulo(v, *(const vec_short8 *) c));
+	s = spu_add(s, spu_rlqwbyte(s, 8));
+	s = spu_add(s, spu_rlqwbyte(s, 4));
+	return spu_extract(s, 0);
+#elif defined(__ALTIVEC__)
+	vector signed short lo = vec_ld(0, x), hi = vec_ld(15, x);
+	vector signed short v = vec_perm(lo, hi, vec_lvsl(0, x));
+	vector signed int zero = vec_splat_s32(0);
+	vector signed int s = vec_sums(vec_msums(v, vec_ld(0, c), zero), zero);
+	int32_t out[4] __attribute__((aligned(16)));
+	vec_st(s, 0, out);
+	return out[3];
+#else
+	return x[0] * c[0] + x[1] * c[1] + x[2] * c[2] + x[3] * c[3] +
+	       x[4] * c[4] + x[5] * c[5] + x[6] * c[6] + x[7] * c[7];
+#endif
+}
+
+/* raw bytes [ea, ea + size) of a voice buffer */
+
+static inline const uint8_t *SNDM_Fetch(SNDM_Window *w, uint64_t ea, uint32_t size)
+{
+#ifdef __SPU__
+	uint64_t start = ea & ~15ULL;
+	uint32_t len = (uint32_t) (((ea + size + 15) & ~15ULL) - start);
+	mfc_get(w->raw, start, len, 3, 0, 0);
+	mfc_write_tag_mask(1 << 3);
+	mfc_read_tag_status_all();
+	return w->raw + (ea & 15);
+#else
+	(void) w;
+	(void) size;
+	return (const uint8_t *) (uintptr_t) ea;
+#endif
+}
+
+static inline void SNDM_Convert(const uint8_t *p, uint32_t format, int16_t *l, int16_t *r)
+{
+	switch (format & 3) {
+	case 0: *l = *r = (int16_t) ((int8_t) p[0] << 8); break;
+	case 1: *l = (int16_t) ((int8_t) p[0] << 8); *r = (int16_t) ((int8_t) p[1] << 8); break;
+	case 2: *l = *r = (int16_t) ((p[0] << 8) | p[1]); break;
+	default: *l = (int16_t) ((p[0] << 8) | p[1]); *r = (int16_t) ((p[2] << 8) | p[3]); break;
+	}
+}
+
+/* converts 'count' frames at 'ea' into the window, from position 'at' */
+
+static inline void SNDM_Load(SNDM_Window *w, uint64_t ea, uint32_t format, int32_t at, int32_t count)
+{
+	uint32_t fb = SNDM_FrameBytes(format);
+	const uint8_t *p;
+
+	if (count <= 0)
+		return;
+	p = SNDM_Fetch(w, ea, count * fb);
+	for (; count--; at++, p += fb)
+		SNDM_Convert(p, format, &w->ch[0][at], &w->ch[1][at]);
+}
+
+/*
+    Fills the window so that frame 'idx' and its taps are inside. The frames before the
+    buffer come from the voice history, the frames past its end from the start of the
+    next buffer; silence when there is none.
+*/
+
+static inline void SNDM_Fill(SNDM_Window *w, const SNDM_Voice *v, uint32_t idx)
+{
+	uint32_t fb = SNDM_FrameBytes(v->format);
+	int32_t frames = v->size / fb;
+	int32_t first = (int32_t) idx - SNDM_HIST;
+	int32_t lo = first < 0 ? 0 : first;
+	int32_t hi = first + SNDM_WINDOW + SNDM_TAPS;
+	int32_t i;
+
+	memset(w->ch, 0, sizeof(w->ch));
+	for (i = first; i < 0; i++) {
+		w->ch[0][i - first] = v->hist[0][SNDM_HIST + i];
+		w->ch[1][i - first] = v->hist[1][SNDM_HIST + i];
+	}
+	if (hi > frames) {
+		uint64_t next = v->snd2 ? v->snd2 : ((v->flags & SNDM_LOOP) ? v->snd : 0);
+		int32_t count = hi - frames;
+		int32_t avail = (int32_t) ((v->snd2 ? v->size2 : v->size) / fb);
+
+		if (count > SNDM_TAPS / 2)
+			count = SNDM_TAPS / 2;
+		if (count > avail)
+			count = avail;
+		if (next)
+			SNDM_Load(w, next, v->format, frames - first, count);
+		hi = frames;
+	}
+	SNDM_Load(w, v->snd + (uint64_t) lo * fb, v->format, lo - first, hi - lo);
+	w->first = idx;
+	w->valid = 1;
+}
+
+/* keeps the last frames of the buffer in play, the taps before the start of the next one */
+
+static inline void SNDM_KeepTail(SNDM_Window *w, SNDM_Voice *v, uint32_t frames)
+{
+	uint32_t fb = SNDM_FrameBytes(v->format);
+	uint32_t n = frames < SNDM_HIST ? frames : SNDM_HIST, i;
+	const uint8_t *p;
+
+	for (i = 0; i + n < SNDM_HIST; i++) {
+		v->hist[0][i] = v->hist[0][i + n];
+		v->hist[1][i] = v->hist[1][i + n];
+	}
+	p = SNDM_Fetch(w, v->snd + (uint64_t) (frames - n) * fb, n * fb);
+	for (; i < SNDM_HIST; i++, p += fb)
+		SNDM_Convert(p, v->format, &v->hist[0][i], &v->hist[1][i]);
+}
+
+/*
+    Mixes SNDM_BLOCK frames of one voice into 'bus' (int32, L/R interleaved).
+    Returns 1 if the voice was playing.
+*/
+
+static inline int SNDM_MixVoice(SNDM_Voice *v, const SNDM_Coef coef, int32_t *bus, SNDM_Window *w)
+{
+	uint32_t fb, frames, f = 0;
+
+	if (!(v->flags & SNDM_ACTIVE) || (v->flags & (SNDM_PAUSED | SNDM_WAITING)))
+		return 0;
+
+	if (v->delay > 0) {
+		f = v->delay < SNDM_BLOCK ? v->delay : SNDM_BLOCK;
+		v->delay -= f;
+	}
+
+	fb = SNDM_FrameBytes(v->format);
+	frames = v->size / fb;
+	w->valid = 0;
+
+	for (; f < SNDM_BLOCK; f++) {
+		uint32_t idx = (uint32_t) (v->pos >> 32);
+		uint32_t phase;
+		int32_t l, r;
+
+		if (idx >= frames) {
+			if (frames)
+				SNDM_KeepTail(w, v, frames);
+			if (v->snd2) {
+				v->pos -= (uint64_t) frames << 32;
+				v->snd = v->snd2;
+				v->size = v->size2;
+				v->snd2 = 0;
+				v->size2 = 0;
+				v->flags |= SNDM_NEED_DATA;
+			} else if (v->flags & SNDM_LOOP) {
+				v->pos -= (uint64_t) frames << 32;
+			} else if (v->flags & SNDM_CALLBACK) {
+				v->flags |= SNDM_WAITING | SNDM_NEED_DATA;
+				break;
+			} else {
+				v->flags &= ~SNDM_ACTIVE;
+				break;
+			}
+			frames = v->size / fb;
+			w->valid = 0;
+			if (frames == 0) {
+				v->flags &= ~SNDM_ACTIVE;
+				break;
+			}
+			f--;
+			continue;
+		}
+
+		if (!w->valid || idx < w->first || idx >= w->first + SNDM_WINDOW)
+			SNDM_Fill(w, v, idx);
+
+		phase = (uint32_t) (v->pos >> (32 - SNDM_PHASE_BITS)) & (SNDM_PHASES - 1);
+		l = SNDM_Dot8(&w->ch[0][idx - w->first], coef[phase]) >> 14;
+		r = (v->format & 1) ? SNDM_Dot8(&w->ch[1][idx - w->first], coef[phase]) >> 14 : l;
+		l = l > 32767 ? 32767 : (l < -32768 ? -32768 : l);
+		r = r > 32767 ? 32767 : (r < -32768 ? -32768 : r);
+
+		if (v->lp_coef < 32768) {
+			v->lp_state[0] += ((l - v->lp_state[0]) * v->lp_coef) >> 15;
+			v->lp_state[1] += ((r - v->lp_state[1]) * v->lp_coef) >> 15;
+			l = v->lp_state[0];
+			r = v->lp_state[1];
+		}
+
+		bus[f * 2] += (l * v->vol_l) >> 8;
+		bus[f * 2 + 1] += (r * v->vol_r) >> 8;
+		v->pos += (uint64_t) v->step << 16;
+	}
+	return 1;
+}
+
+#ifdef __SPU__
+
+static SNDM_Control sndm_control;
+static SNDM_Voice sndm_voice;
+static SNDM_Coef sndm_coef;
+static SNDM_Window sndm_window;
+static int32_t sndm_bus[SNDM_BLOCK * 2] __attribute__((aligned(128)));
+static int32_t sndm_part[SNDM_BLOCK * 2] __attribute__((aligned(128)));
+static float sndm_out[SNDM_BLOCK * 2] __attribute__((aligned(128)));
+
+static inline void SNDM_SpuDma(void *ls, uint64_t ea, uint32_t size, int put)
+{
+	if (put)
+		mfc_put(ls, ea, size, 2, 0, 0);
+	else
+		mfc_get(ls, ea, size, 2, 0, 0);
+	mfc_write_tag_mask(1 << 2);
+	mfc_read_tag_status_all();
+}
+
+/* sums this SPU's slice of every partial bus, clamps it and writes it as float into the port block */
+
+static inline void SNDM_SpuReduce(void)
+{
+	uint32_t n = sndm_control.nspus, rank = sndm_control.rank, s, i;
+	uint32_t lo = (SNDM_BLOCK * 2 * rank / n) & ~3;
+	uint32_t hi = rank + 1 == n ? SNDM_BLOCK * 2 : (SNDM_BLOCK * 2 * (rank + 1) / n) & ~3;
+	vec_int4 *acc = (vec_int4 *) &sndm_bus[lo];
+	const vec_int4 *part = (const vec_int4 *) &sndm_part[lo];
+	vec_float4 *out = (vec_float4 *) &sndm_out[lo];
+	vec_int4 top = spu_splats(32768), bottom = spu_splats(-32768);
+
+	if (hi <= lo)
+		return;
+	for (i = 0; i < (hi - lo) / 4; i++)
+		acc[i] = spu_splats(0);
+	for (s = 0; s < n; s++) {
+		SNDM_SpuDma(&sndm_part[lo], sndm_control.buses + ((uint64_t) s * SNDM_BLOCK * 2 + lo) * sizeof(int32_t),
+			    (hi - lo) * sizeof(int32_t), 0);
+		for (i = 0; i < (hi - lo) / 4; i++)
+			acc[i] = spu_add(acc[i], part[i]);
+	}
+	for (i = 0; i < (hi - lo) / 4; i++) {
+		vec_int4 v = spu_sel(acc[i], top, spu_cmpgt(acc[i], top));
+		v = spu_sel(v, bottom, spu_cmpgt(bottom, v));
+		out[i] = spu_convtf(v, 15);
+	}
+	SNDM_SpuDma(&sndm_out[lo], sndm_control.out + lo * sizeof(float), (hi - lo) * sizeof(float), 1);
+}
+
+/*
+    SPU thread: waits for a kick in the inbound mailbox, then either mixes its voices into
+    its partial bus or, once every SPU has mixed, reduces its slice of the buses. Every
+    command ends with an event on SNDM_SPU_PORT.
+*/
+
+static inline int SNDM_SpuMain(uint64_t control)
+{
+	int coef_loaded = 0;
+
+	spu_write_decrementer(0xffffffff);
+	for (;;) {
+		uint32_t v, start;
+
+		spu_read_in_mbox();
+		SNDM_SpuDma(&sndm_control, control, sizeof(sndm_control), 0);
+		if (sndm_control.cmd == SNDM_CMD_QUIT)
+			break;
+		if (sndm_control.cmd == SNDM_CMD_REDUCE) {
+			SNDM_SpuReduce();
+			sndm_control.done = sndm_control.seq;
+			SNDM_SpuDma(&sndm_control, control, sizeof(sndm_control), 1);
+			spu_thread_send_event(SNDM_SPU_PORT, sndm_control.seq & EVENT_DATA0_MASK, 0);
+			continue;
+		}
+		if (!coef_loaded) {
+			SNDM_SpuDma(sndm_coef, sndm_control.coef, sizeof(SNDM_Coef), 0);
+			coef_loaded = 1;
+		}
+
+		start = spu_read_decrementer();
+		memset(sndm_bus, 0, sizeof(sndm_bus));
+		sndm_control.mixed = 0;
+		for (v = sndm_control.rank; v < sndm_control.nvoices; v += sndm_control.nspus) {
+			uint64_t ea = sndm_control.voices + (uint64_t) v * sizeof(SNDM_Voice);
+			SNDM_SpuDma(&sndm_voice, ea, sizeof(SNDM_Voice), 0);
+			if (!(sndm_voice.flags & SNDM_ACTIVE))
+				continue;
+			sndm_control.mixed += SNDM_MixVoice(&sndm_voice, sndm_coef, sndm_bus, &sndm_window);
+			SNDM_SpuDma(&sndm_voice, ea, sizeof(SNDM_Voice), 1);
+		}
+		SNDM_SpuDma(sndm_bus, sndm_control.bus, sizeof(sndm_bus), 1);
+
+		sndm_control.ticks = start - spu_read_decrementer();
+		sndm_control.done = sndm_control.seq;
+		SNDM_SpuDma(&sndm_control, control, sizeof(sndm_control), 1);
+		spu_thread_send_event(SNDM_SPU_PORT, sndm_control.seq & EVENT_DATA0_MASK, 0);
+	}
+	spu_thread_exit(0);
+	return 0;
+}
+
+#else
+
+/* Blackman windowed sinc, Q14, every phase sums to exactly 16384 */
+
+static inline void SNDM_BuildCoefTable(SNDM_Coef coef)
+{
+	int p, k;
+
+	for (p = 0; p < SNDM_PHASES; p++) {
+		double frac = (double) p / SNDM_PHASES, w[SNDM_TAPS], sum = 0.0;
+		int total = 0, peak = SNDM_TAPS / 2 - 1;
+
+		for (k = 0; k < SNDM_TAPS; k++) {
+			double x = (k - (SNDM_TAPS / 2 - 1)) - frac;
+			double n = (x + SNDM_TAPS / 2) / SNDM_TAPS;
+			double sinc = fabs(x) < 1e-9 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+			double win = 0.42 - 0.5 * cos(2.0 * M_PI * n) + 0.08 * cos(4.0 * M_PI * n);
+			w[k] = sinc * win;
+			sum += w[k];
+		}
+		for (k = 0; k < SNDM_TAPS; k++) {
+			coef[p][k] = (int16_t) floor(w[k] / sum * 16384.0 + 0.5);
+			total += coef[p][k];
+		}
+		if (frac > 0.5)
+			peak++;
+		coef[p][peak] += 16384 - total;
+	}
+}
+
+/* reference mixer: mixes 'count' voices into 'bus' (SNDM_BLOCK frames, int32 L/R), returns the playing voices */
+
+static inline int SNDM_MixVoices(SNDM_Voice *voices, int count, const SNDM_Coef coef, int32_t *bus)
+{
+	static SNDM_Window w;
+	int n, mixed = 0;
+
+	memset(bus, 0, SNDM_BLOCK * 2 * sizeof(int32_t));
+	for (n = 0; n < count; n++)
+		mixed += SNDM_MixVoice(&voices[n], coef, bus, &w);
+	return mixed;
+}
+
+/* 16.16 step from a frequency */
+
+static inline uint32_t SNDM_FreqToStep(int freq)
+{
+	return (uint32_t) (((uint64_t) freq << 16) / 48000);
+}
+
+/* Q15 one pole coefficient for a cut-off frequency, 0 or >= 24000 disables the filter */
+
+static inline int32_t SNDM_LowPassCoef(int cutoff)
+{
+	if (cutoff <= 0 || cutoff >= 24000)
+		return 32768;
+	return (int32_t) ((1.0 - exp(-2.0 * M_PI * cutoff / 48000.0)) * 32768.0);
+}
+
+#endif
+
+#ifdef __PPU__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+	u32 spus;
+	u32 voices_mixed;			// active voices in the last block
+	u32 spu_ticks[SNDM_MAX_SPUS];	// decrementer ticks of the last block on each SPU
+	u32 spu_voices[SNDM_MAX_SPUS];	// voices mixed by each SPU in the last block
+	u64 blocks;
+	u64 late_blocks;			// blocks written after the port already read them
+} SNDM_Stats;
+
+/*------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+/* int SNDM_Init(const void *spu_elf, u32 spus);
+
+Starts the mixer on 'spus' SPU threads (1 to SNDM_MAX_SPUS) and opens the audio port at 48000 Hz. The sound starts paused, as SND_Init().
+libaudio is shared with the other soundlib outputs (audio_share.h).
+
+-- Params ---
+
+spu_elf: the SPU kernel built from SNDM_SpuMain()
+
+spus: number of SPU threads
+
+return: SND_OK or SND_INVALID
+
+*/
+
+int SNDM_Init(const void *spu_elf, u32 spus);
+void SNDM_End();
+void SNDM_Pause(int paused);
+
+int SNDM_SetVoice(int voice, int format, int freq, int delay, void *snd, int size_snd, int volume_l, int volume_r, void (*callback) (int voice));
+int SNDM_SetInfiniteVoice(int voice, int format, int freq, int delay, void *snd, int size_snd, int volume_l, int volume_r);
+int SNDM_AddVoice(int voice, void *snd, int size_snd);
+int SNDM_StopVoice(int voice);
+int SNDM_PauseVoice(int voice, int pause);
+int SNDM_StatusVoice(int voice);
+int SNDM_GetFirstUnusedVoice();
+int SNDM_ChangeFreqVoice(int voice, int freq);
+int SNDM_ChangeVolumeVoice(int voice, int volume_l, int volume_r);
+int SNDM_TestVoiceBufferReady(int voice);
+
+/*------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+/* int SNDM_SetVoicePan(int voice, int pan);
+
+pan: from -128 (left) to 127 (right), 0 is the center. It is applied on top of the voice volumes.
+
+return: SND_OK, SND_INVALID
+
+*/
+
+int SNDM_SetVoicePan(int voice, int pan);
+
+/* int SNDM_SetVoiceLowPass(int voice, int cutoff);
+
+cutoff: cut-off frequency in Hz of the voice low-pass filter, 0 disables it
+
+return: SND_OK, SND_INVALID
+
+*/
+
+int SNDM_SetVoiceLowPass(int voice, int cutoff);
+
+/* void SNDM_GetStats(SNDM_Stats *stats);
+
+Per SPU mix time of the last block. With a 79.8 MHz decrementer a block lasts 425600 ticks, so
+voices_per_spu = spu_voices * 425600 / spu_ticks is the number of voices one SPU can handle.
+
+*/
+
+void SNDM_GetStats(SNDM_Stats *stats);
+
+/* result of SNDM_Bench(): load[i] is the busy share of the slowest SPU to mix 16 * (i + 1) voices in real time */
+
+typedef struct {
+	u32 spus;
+	float load[SNDM_MAX_VOICES / 16];
+	float voices_per_spu;		// from the SNDM_MAX_VOICES run
+	float ppu_usec_per_block;	// PPU side of a block (both commands and the waits), SNDM_MAX_VOICES run
+} SNDM_BenchResult;
+
+/* int SNDM_Bench(u32 blocks, SNDM_BenchResult *res);
+
+Mixes 'blocks' blocks of synthetic looped 44100 Hz stereo voices for 16, 32, ... SNDM_MAX_VOICES voices on the
+SPUs given to SNDM_Init(). The mixer must be paused (SNDM_Pause(1)); every voice is overwritten and stopped
+at the end, so do not run it while the game is playing sounds.
+
+return: SND_OK or SND_INVALID
+
+*/
+
+int SNDM_Bench(u32 blocks, SNDM_BenchResult *res);
+
+#ifdef SNDM_REPLACE_SND_API
+#define SND_Init(spu)                   SNDM_Init(SNDM_SPU_ELF, SNDM_DEFAULT_SPUS)
+#define SND_End                         SNDM_End
+#define SND_Pause                       SNDM_Pause
+#define SND_SetVoice                    SNDM_SetVoice
+#define SND_SetInfiniteVoice            SNDM_SetInfiniteVoice
+#define SND_AddVoice                    SNDM_AddVoice
+#define SND_StopVoice                   SNDM_StopVoice
+#define SND_PauseVoice                  SNDM_PauseVoice
+#define SND_StatusVoice                 SNDM_StatusVoice
+#define SND_GetFirstUnusedVoice         SNDM_GetFirstUnusedVoice
+#define SND_ChangeFreqVoice             SNDM_ChangeFreqVoice
+#define SND_ChangeVolumeVoice           SNDM_ChangeVolumeVoice
+#define SND_TestVoiceBufferReady        SNDM_TestVoiceBufferReady
+#endif
+
+#ifdef SNDM_IMPLEMENTATION
+
+static SNDM_Voice *sndm_voices;
+static SNDM_Control *sndm_ctl;
+static int32_t *sndm_buses;
+static SNDM_Coef sndm_coef_table;
+static void (*sndm_callbacks[SNDM_MAX_VOICES]) (int voice);
+static int sndm_volume[SNDM_MAX_VOICES][2];
+static int sndm_pan[SNDM_MAX_VOICES];
+
+static sys_lwmutex_t sndm_lock;
+static sysSpuImage sndm_image;
+static sys_spu_group_t sndm_group;
+static sys_spu_thread_t sndm_threads[SNDM_MAX_SPUS];
+static sys_ppu_thread_t sndm_thread;
+static sys_event_queue_t sndm_queue;
+static u32 sndm_port, sndm_spus, sndm_seq;
+static volatile int sndm_running, sndm_paused;
+static SNDM_Stats sndm_stats;
+
+static void sndm_apply_volume(int voice)
+{
+	int pan = sndm_pan[voice];
+	int l = sndm_volume[voice][0], r = sndm_volume[voice][1];
+
+	if (pan > 0)
+		l = l * (128 - pan) / 128;
+	else if (pan < 0)
+		r = r * (128 + pan) / 128;
+	sndm_voices[voice].vol_l = l + (l >> 7);	// 0..255 -> 0..256
+	sndm_voices[voice].vol_r = r + (r >> 7);
+}
+
+/* runs one command on every SPU and sleeps until all of them sent their completion event */
+
+static void sndm_run(u32 cmd, float *out)
+{
+	sys_event_t ev;
+	u32 s;
+
+	sndm_seq++;
+	for (s = 0; s < sndm_spus; s++) {
+		sndm_ctl[s].cmd = cmd;
+		sndm_ctl[s].out = (u64) out;
+		sndm_ctl[s].seq = sndm_seq;
+	}
+	__asm__ volatile ("lwsync":::"memory");
+	for (s = 0; s < sndm_spus; s++)
+		sysSpuThreadWriteMb(sndm_threads[s], 1);
+	for (s = 0; s < sndm_spus; s++)
+		while (sysEventQueueReceive(sndm_queue, &ev, 0) != 0)
+			;
+	__asm__ volatile ("lwsync":::"memory");
+}
+
+static void sndm_mix_block(float *out)
+{
+	static void (*pending[SNDM_MAX_VOICES]) (int voice);
+	u32 i, s;
+
+	sysLwMutexLock(&sndm_lock, 0);
+	sndm_run(SNDM_CMD_MIX, NULL);
+	sndm_run(SNDM_CMD_REDUCE, out);
+
+	sndm_stats.voices_mixed = 0;
+	for (s = 0; s < sndm_spus; s++) {
+		sndm_stats.spu_ticks[s] = sndm_ctl[s].ticks;
+		sndm_stats.spu_voices[s] = sndm_ctl[s].mixed;
+		sndm_stats.voices_mixed += sndm_ctl[s].mixed;
+	}
+	sndm_stats.blocks++;
+
+	// callbacks are called without the lock, they usually call SNDM_AddVoice()
+	for (i = 0; i < SNDM_MAX_VOICES; i++) {
+		pending[i] = NULL;
+		if (sndm_voices[i].flags & SNDM_NEED_DATA) {
+			sndm_voices[i].flags &= ~SNDM_NEED_DATA;
+			pending[i] = sndm_callbacks[i];
+		}
+	}
+	sysLwMutexUnlock(&sndm_lock);
+
+	for (i = 0; i < SNDM_MAX_VOICES; i++)
+		if (pending[i])
+			pending[i] (i);
+}
+
+static void sndm_thread_entry(void *arg)
+{
+	audioPortConfig config;
+	u64 last = (u64) - 1;
+	float *blk;
+
+	(void) arg;
+	audioGetPortConfig(sndm_port, &config);
+	while (sndm_running) {
+		u64 read = *(vu64 *) (u64) config.readIndex;
+		if (read == last) {
+			sysUsleep(500);
+			continue;
+		}
+		if (last != (u64) - 1 && read != (last + 1) % config.numBlocks)
+			sndm_stats.late_blocks++;
+		last = read;
+		blk = (float *) (u64) (config.audioDataStart + ((read + 2) % config.numBlocks) * SNDM_BLOCK * 2 * sizeof(float));
+		if (sndm_paused)
+			memset(blk, 0, SNDM_BLOCK * 2 * sizeof(float));
+		else
+			sndm_mix_block(blk);
+	}
+	sysThreadExit(0);
+}
+
+int SNDM_Init(const void *spu_elf, u32 spus)
+{
+	sysSpuThreadGroupAttribute gattr = { sizeof("SNDM Mixer"), (u32) (u64) "SNDM Mixer", 0, 0 };
+	sysSpuThreadAttribute attr = { (u32) (u64) "SNDM Mixer", sizeof("SNDM Mixer"), SPU_THREAD_ATTR_NONE };
+	sys_lwmutex_attr_t mattr = { SYS_LWMUTEX_PROTOCOL_PRIO, SYS_LWMUTEX_ATTR_NOT_RECURSIVE, "sndm" };
+	sys_event_queue_attr_t qattr = { SYS_EVENT_QUEUE_FIFO, SYS_EVENT_QUEUE_PPU, "sndm" };
+	audioPortParam params;
+	u32 s;
+
+	if (sndm_running || !spu_elf || spus < 1 || spus > SNDM_MAX_SPUS)
+		return SND_INVALID;
+
+	sndm_voices = (SNDM_Voice *) memalign(128, sizeof(SNDM_Voice) * SNDM_MAX_VOICES);
+	sndm_ctl = (SNDM_Control *) memalign(128, sizeof(SNDM_Control) * spus);
+	sndm_buses = (int32_t *) memalign(128, sizeof(int32_t) * SNDM_BLOCK * 2 * spus);
+	if (!sndm_voices || !sndm_ctl || !sndm_buses)
+		goto fail;
+	memset(sndm_voices, 0, sizeof(SNDM_Voice) * SNDM_MAX_VOICES);
+	memset(sndm_ctl, 0, sizeof(SNDM_Control) * spus);
+	memset(sndm_callbacks, 0, sizeof(sndm_callbacks));
+	memset(sndm_pan, 0, sizeof(sndm_pan));
+	memset(&sndm_stats, 0, sizeof(sndm_stats));
+	SNDM_BuildCoefTable(sndm_coef_table);
+
+	// one completion event per SPU and command
+	if (sysEventQueueCreate(&sndm_queue, &qattr, SYS_EVENT_QUEUE_KEY_LOCAL, SNDM_MAX_SPUS * 2))
+		goto fail;
+	if (sysSpuImageImport(&sndm_image, spu_elf, SPU_IMAGE_PROTECT)) {
+		sysEventQueueDestroy(sndm_queue, 0);
+		goto fail;
+	}
+	if (sysSpuThreadGroupCreate(&sndm_group, spus, 100, &gattr)) {
+		sysSpuImageClose(&sndm_image);
+		sysEventQueueDestroy(sndm_queue, 0);
+		goto fail;
+	}
+	for (s = 0; s < spus; s++) {
+		sysSpuThreadArgument arg = { (u64) & sndm_ctl[s], 0, 0, 0 };
+		sndm_ctl[s].voices = (u64) sndm_voices;
+		sndm_ctl[s].coef = (u64) sndm_coef_table;
+		sndm_ctl[s].bus = (u64) & sndm_buses[s * SNDM_BLOCK * 2];
+		sndm_ctl[s].buses = (u64) sndm_buses;
+		sndm_ctl[s].rank = s;
+		sndm_ctl[s].nspus = spus;
+		sndm_ctl[s].nvoices = SNDM_MAX_VOICES;
+		if (sysSpuThreadInitialize(&sndm_threads[s], sndm_group, s, &sndm_image, &attr, &arg) ||
+		    sysSpuThreadConnectEvent(sndm_threads[s], sndm_queue, SPU_THREAD_EVENT_USER, SNDM_SPU_PORT))
+			break;
+	}
+	if (s < spus || sysSpuThreadGroupStart(sndm_group)) {
+		sysSpuThreadGroupDestroy(sndm_group);
+		sysSpuImageClose(&sndm_image);
+		sysEventQueueDestroy(sndm_queue, 0);
+		goto fail;
+	}
+	sndm_spus = spus;
+	sndm_stats.spus = spus;
+	sndm_seq = 0;
+
+	sysLwMutexCreate(&sndm_lock, &mattr);
+	AudioShareAcquire();
+	params.numChannels = AUDIO_PORT_2CH;
+	params.numBlocks = AUDIO_BLOCK_8;
+	params.attrib = 0;
+	params.level = 1.0f;
+	audioPortOpen(&params, &sndm_port);
+	audioPortStart(sndm_port);
+
+	sndm_paused = 1;
+	sndm_running = 1;
+	sysThreadCreate(&sndm_thread, sndm_thread_entry, NULL, 100, 0x4000, THREAD_JOINABLE, (char *) "SNDM Mixer");
+	return SND_OK;
+
+  fail:
+	free(sndm_voices);
+	free(sndm_ctl);
+	free(sndm_buses);
+	sndm_voices = NULL;
+	sndm_ctl = NULL;
+	sndm_buses = NULL;
+	return SND_INVALID;
+}
+
+void SNDM_End()
+{
+	u32 s, cause, status;
+	u64 ret;
+
+	if (!sndm_running)
+		return;
+	sndm_running = 0;
+	sysThreadJoin(sndm_thread, &ret);
+	audioPortStop(sndm_port);
+	audioPortClose(sndm_port);
+	AudioShareRelease();
+
+	for (s = 0; s < sndm_spus; s++)
+		sndm_ctl[s].cmd = SNDM_CMD_QUIT;
+	__asm__ volatile ("lwsync":::"memory");
+	for (s = 0; s < sndm_spus; s++)
+		sysSpuThreadWriteMb(sndm_threads[s], 1);
+	sysSpuThreadGroupJoin(sndm_group, &cause, &status);
+	for (s = 0; s < sndm_spus; s++)
+		sysSpuThreadDisconnectEvent(sndm_threads[s], SPU_THREAD_EVENT_USER, SNDM_SPU_PORT);
+	sysSpuThreadGroupDestroy(sndm_group);
+	sysSpuImageClose(&sndm_image);
+	sysEventQueueDestroy(sndm_queue, 0);
+	sysLwMutexDestroy(&sndm_lock);
+
+	free(sndm_voices);
+	free(sndm_ctl);
+	free(sndm_buses);
+	sndm_voices = NULL;
+	sndm_ctl = NULL;
+	sndm_buses = NULL;
+}
+
+void SNDM_Pause(int paused)
+{
+	sndm_paused = paused;
+}
+
+#define SNDM_CHECK_VOICE(voice) \
+	if (!sndm_voices || (voice) < 0 || (voice) >= SNDM_MAX_VOICES) return SND_INVALID
+
+static int sndm_set(int voice, int format, int freq, int delay, void *snd, int size_snd, int volume_l, int volume_r,
+		    void (*callback) (int voice), u32 flags)
+{
+	SNDM_Voice *v;
+
+	SNDM_CHECK_VOICE(voice);
+	if (format < VOICE_MONO_8BIT || format > VOICE_STEREO_16BIT || freq < MIN_FREQ || freq > MAX_FREQ || !snd || size_snd <= 0)
+		return SND_INVALID;
+
+	sysLwMutexLock(&sndm_lock, 0);
+	v = &sndm_voices[voice];
+	v->flags = 0;
+	v->snd = (u64) snd;
+	v->size = size_snd;
+	v->snd2 = 0;
+	v->size2 = 0;
+	v->format = format;
+	v->pos = 0;
+	v->step = SNDM_FreqToStep(freq);
+	v->delay = delay * 48;
+	v->lp_state[0] = v->lp_state[1] = 0;
+	memset(v->hist, 0, sizeof(v->hist));
+	if (v->lp_coef == 0)
+		v->lp_coef = 32768;
+	sndm_volume[voice][0] = volume_l < 0 ? 0 : (volume_l > 255 ? 255 : volume_l);
+	sndm_volume[voice][1] = volume_r < 0 ? 0 : (volume_r > 255 ? 255 : volume_r);
+	sndm_apply_volume(voice);
+	sndm_callbacks[voice] = callback;
+	v->flags = flags | (callback ? SNDM_CALLBACK : 0) | SNDM_ACTIVE;
+	sysLwMutexUnlock(&sndm_lock);
+	return SND_OK;
+}
+
+int SNDM_SetVoice(int voice, int format, int freq, int delay, void *snd, int size_snd, int volume_l, int volume_r, void (*callback) (int voice))
+{
+	return sndm_set(voice, format, freq, delay, snd, size_snd, volume_l, volume_r, callback, 0);
+}
+
+int SNDM_SetInfiniteVoice(int voice, int format, int freq, int delay, void *snd, int size_snd, int volume_l, int volume_r)
+{
+	return sndm_set(voice, format, freq, delay, snd, size_snd, volume_l, volume_r, NULL, SNDM_LOOP);
+}
+
+int SNDM_AddVoice(int voice, void *snd, int size_snd)
+{
+	SNDM_Voice *v;
+	int ret = SND_OK;
+
+	SNDM_CHECK_VOICE(voice);
+	if (!snd || size_snd <= 0)
+		return SND_INVALID;
+	sysLwMutexLock(&sndm_lock, 0);
+	v = &sndm_voices[voice];
+	if (!(v->flags & SNDM_ACTIVE))
+		ret = SND_INVALID;
+	else if (v->flags & SNDM_WAITING) {
+		v->snd = (u64) snd;
+		v->size = size_snd;
+		v->pos &= 0xffffffffULL;
+		v->flags &= ~(SNDM_WAITING | SNDM_NEED_DATA);
+	} else if (v->snd2)
+		ret = SND_BUSY;
+	else {
+		v->snd2 = (u64) snd;
+		v->size2 = size_snd;
+	}
+	sysLwMutexUnlock(&sndm_lock);
+	return ret;
+}
+
+int SNDM_StopVoice(int voice)
+{
+	SNDM_CHECK_VOICE(voice);
+	sysLwMutexLock(&sndm_lock, 0);
+	sndm_voices[voice].flags = 0;
+	sndm_callbacks[voice] = NULL;
+	sysLwMutexUnlock(&sndm_lock);
+	return SND_OK;
+}
+
+int SNDM_PauseVoice(int voice, int pause)
+{
+	SNDM_CHECK_VOICE(voice);
+	sysLwMutexLock(&sndm_lock, 0);
+	if (pause)
+		sndm_voices[voice].flags |= SNDM_PAUSED;
+	else
+		sndm_voices[voice].flags &= ~SNDM_PAUSED;
+	sysLwMutexUnlock(&sndm_lock);
+	return SND_OK;
+}
+
+int SNDM_StatusVoice(int voice)
+{
+	u32 flags;
+
+	SNDM_CHECK_VOICE(voice);
+	flags = sndm_voices[voice].flags;
+	if (!(flags & SNDM_ACTIVE))
+		return SND_UNUSED;
+	return (flags & SNDM_WAITING) ? SND_WAITING : SND_WORKING;
+}
+
+int SNDM_GetFirstUnusedVoice()
+{
+	int n;
+
+	if (!sndm_voices)
+		return SND_INVALID;
+	for (n = 1; n < SNDM_MAX_VOICES; n++)
+		if (!(sndm_voices[n].flags & SNDM_ACTIVE))
+			return n;
+	return (sndm_voices[0].flags & SNDM_ACTIVE) ? SND_INVALID : 0;
+}
+
+int SNDM_ChangeFreqVoice(int voice, int freq)
+{
+	SNDM_CHECK_VOICE(voice);
+	if (freq < MIN_FREQ || freq > MAX_FREQ)
+		return SND_INVALID;
+	sysLwMutexLock(&sndm_lock, 0);
+	sndm_voices[voice].step = SNDM_FreqToStep(freq);
+	sysLwMutexUnlock(&sndm_lock);
+	return SND_OK;
+}
+
+int SNDM_ChangeVolumeVoice(int voice, int volume_l, int volume_r)
+{
+	SNDM_CHECK_VOICE(voice);
+	sysLwMutexLock(&sndm_lock, 0);
+	sndm_volume[voice][0] = volume_l < 0 ? 0 : (volume_l > 255 ? 255 : volume_l);
+	sndm_volume[voice][1] = volume_r < 0 ? 0 : (volume_r > 255 ? 255 : volume_r);
+	sndm_apply_volume(voice);
+	sysLwMutexUnlock(&sndm_lock);
+	return SND_OK;
+}
+
+int SNDM_TestVoiceBufferReady(int voice)
+{
+	SNDM_CHECK_VOICE(voice);
+	if (!(sndm_voices[voice].flags & SNDM_ACTIVE))
+		return 0;
+	return (sndm_voices[voice].snd2 == 0) ? 1 : 0;
+}
+
+int SNDM_SetVoicePan(int voice, int pan)
+{
+	SNDM_CHECK_VOICE(voice);
+	sysLwMutexLock(&sndm_lock, 0);
+	sndm_pan[voice] = pan < -128 ? -128 : (pan > 127 ? 127 : pan);
+	sndm_apply_volume(voice);
+	sysLwMutexUnlock(&sndm_lock);
+	return SND_OK;
+}
+
+int SNDM_SetVoiceLowPass(int voice, int cutoff)
+{
+	SNDM_CHECK_VOICE(voice);
+	sysLwMutexLock(&sndm_lock, 0);
+	sndm_voices[voice].lp_coef = SNDM_LowPassCoef(cutoff);
+	sysLwMutexUnlock(&sndm_lock);
+	return SND_OK;
+}
+
+void SNDM_GetStats(SNDM_Stats *stats)
+{
+	*stats = sndm_stats;
+}
+
+int SNDM_Bench(u32 blocks, SNDM_BenchResult *res)
+{
+	int16_t *sample;
+	float *out;
+	u32 i, n, b, s, seed = 0x2545f491;
+
+	if (!sndm_running || !sndm_paused || !blocks)
+		return SND_INVALID;
+	sample = (int16_t *) memalign(128, 4096 * 2 * sizeof(int16_t));
+	out = (float *) memalign(128, SNDM_BLOCK * 2 * sizeof(float));
+	if (!sample || !out) {
+		free(sample);
+		free(out);
+		return SND_INVALID;
+	}
+	for (i = 0; i < 4096 * 2; i++) {
+		seed = seed * 1103515245 + 12345;
+		sample[i] = (int16_t) (seed >> 16);
+	}
+	memset(res, 0, sizeof(*res));
+	res->spus = sndm_spus;
+
+	for (n = 16; n <= SNDM_MAX_VOICES; n += 16) {
+		u64 spu = 0, start;
+
+		for (i = 0; i < n; i++) {
+			sndm_set(i, VOICE_STEREO_16BIT, 44100 - i * 97, 0, sample, 4096 * 2 * sizeof(int16_t), 200, 200, NULL, SNDM_LOOP);
+			SNDM_SetVoiceLowPass(i, (i & 1) ? 8000 : 0);
+		}
+		sysLwMutexLock(&sndm_lock, 0);
+		start = sysGetSystemTime();
+		for (b = 0; b < blocks; b++) {
+			u32 slowest = 0;
+
+			sndm_run(SNDM_CMD_MIX, NULL);
+			for (s = 0; s < sndm_spus; s++)
+				if (sndm_ctl[s].ticks > slowest)
+					slowest = sndm_ctl[s].ticks;
+			spu += slowest;
+			sndm_run(SNDM_CMD_REDUCE, out);
+		}
+		res->ppu_usec_per_block = (float) (sysGetSystemTime() - start) / (float) blocks;
+		sysLwMutexUnlock(&sndm_lock);
+
+		// a block is 256 frames at 48000 Hz, 425600 ticks of the 79.8 MHz decrementer
+		res->load[n / 16 - 1] = (float) ((double) spu / blocks / 425600.0);
+		for (i = 0; i < n; i++)
+			SNDM_StopVoice(i);
+	}
+	if (res->load[SNDM_MAX_VOICES / 16 - 1] > 0.0f)
+		res->voices_per_spu = (float) SNDM_MAX_VOICES / sndm_spus / res->load[SNDM_MAX_VOICES / 16 - 1];
+
+	free(sample);
+	free(out);
+	return SND_OK;
+}
+
+#endif /* SNDM_IMPLEMENTATION */
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif /* __PPU__ */
+
+#endif
@@ -28,12 +28,15 @@
 #include <NoRSX/Background.h>
 #include <NoRSX/Objects.h>
 #include <NoRSX/Font.h>
+#include <NoRSX/GlyphCache.h>
 #include <NoRSX/Msg.h>
 #include <NoRSX/Bitmap.h>
 #include <NoRSX/EventHandler.h>
 #include <NoRSX/Animation.h>
 #include <NoRSX/Errors.h>
 #include <NoRSX/Spu.h>
+#include <NoRSX/SpuRaster.h>
+#include <NoRSX/Damage.h>
 
 #include <NoRSX/Printf.h>
 
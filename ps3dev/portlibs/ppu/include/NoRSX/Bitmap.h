@@ -24,6 +24,7 @@
 #define __NORSX_BITMAP_H__
 
 #include "Min.h"
+#include "Blit.h"
 
 typedef struct {
 	uint32_t *bitmap;
@@ -50,6 +51,13 @@ public:
 	void DrawCustomBitmap(uint32_t start_width, uint32_t start_height, uint32_t end_width, uint32_t end_height, NoRSX_Bitmap *a);
 	void DrawBitmap(NoRSX_Bitmap *a);
 
+//same as DrawBitmap() through the Blit.h kernels, see Image::BlitIMG() for mode/arg
+	void BlitBitmap(NoRSX_Bitmap *a, u32 mode = BLIT_COPY, u32 arg = 0){
+		if(a->load == 1)
+			BlitRect(G->buffer, G->width, G->height, G->width*4, 0, 0,
+				 a->bitmap, a->width, a->height, a->width*4, mode, arg);
+	}
+
 	
 
 private:
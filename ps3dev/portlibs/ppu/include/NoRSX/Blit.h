@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2013, Giovanni Dante Grazioli (deroad)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef __NORSX_BLIT_H__
+#define __NORSX_BLIT_H__
+
+#include <ppu-types.h>
+#include <cstring>
+
+#ifdef __ALTIVEC__
+#include <altivec.h>
+#endif
+
+/*
+ * Row and rectangle blit kernels used by Image and Bitmap. Animation still
+ * draws through its prebuilt implementation in libNoRSX.
+ *
+ * Every kernel has two builds: an AltiVec one (PPU compiled with -maltivec)
+ * that handles 8 pixels per iteration, and a portable one that handles 4.
+ * Both produce exactly the same pixels as the per pixel AlphaBlend():
+ *
+ *     c = (src_c * a + bg_c * (255 - a)) >> 8,  alpha = src alpha
+ *     a == 0 leaves the background untouched.
+ *
+ * so the portable build can be compiled on the host to check the PPU one.
+ */
+
+#define BLIT_COPY			0
+#define BLIT_ALPHA			1
+#define BLIT_CONST_ALPHA		2
+#define BLIT_CHROMAKEY			3
+
+typedef struct {
+	u64 pixels;    //pixels written since the last BlitResetStats()
+	u64 ticks;     //time spent in the kernels, in timebase ticks
+	u32 calls;
+} NoRSX_BlitStats;
+
+//one instance shared by every translation unit
+inline NoRSX_BlitStats &BlitStats(){
+	static NoRSX_BlitStats stats;
+	return stats;
+}
+
+static inline u64 BlitTimebase(){
+#ifdef __PPU__
+	u64 tb;
+	__asm__ volatile("mftb %0" : "=r"(tb));
+	return tb;
+#else
+	return 0;
+#endif
+}
+
+static inline void BlitResetStats(){
+	memset(&BlitStats(), 0, sizeof(NoRSX_BlitStats));
+}
+
+//Megapixels per second given the timebase frequency (79800000 on retail PS3).
+static inline float BlitMegapixelsPerSecond(u64 timebase_freq){
+	const NoRSX_BlitStats &s = BlitStats();
+	if(s.ticks == 0)
+		return 0.0f;
+	return (float)((double)s.pixels * (double)timebase_freq / (double)s.ticks / 1000000.0);
+}
+
+/* scalar reference, identical to AlphaBlend() */
+static inline u32 BlitBlendPixel(u32 bg, u32 src){
+	u32 a = src >> 24;
+	if(a == 0)
+		return bg;
+	u32 rb = (((src & 0x00ff00ff) * a) + ((bg & 0x00ff00ff) * (0xff - a))) & 0xff00ff00;
+	u32 g  = (((src & 0x0000ff00) * a) + ((bg & 0x0000ff00) * (0xff - a))) & 0x00ff0000;
+	return (src & 0xff000000) | ((rb | g) >> 8);
+}
+
+#ifdef __ALTIVEC__
+
+typedef vector unsigned char  blit_vu8;
+typedef vector unsigned short blit_vu16;
+typedef vector unsigned int   blit_vu32;
+
+/* loads 4 pixels from a pointer that may not be 16 byte aligned */
+static inline blit_vu32 BlitLoadU(const u32 *p){
+	blit_vu8 lo = vec_ld(0, (const unsigned char*)p);
+	blit_vu8 hi = vec_ld(15, (const unsigned char*)p);
+	return (blit_vu32)vec_perm(lo, hi, vec_lvsl(0, (const unsigned char*)p));
+}
+
+/* blends 4 pixels: per byte (s*a + b*(255-a)) >> 8, keeps src alpha, a==0 keeps bg */
+static inline blit_vu32 BlitBlendVec(blit_vu32 bg, blit_vu32 src, blit_vu8 a){
+	const blit_vu8 hi_bytes = (blit_vu8){0,16,2,18,4,20,6,22,8,24,10,26,12,28,14,30};
+	const blit_vu32 amask = vec_splats((u32)0xff000000);
+	blit_vu8 ia = vec_nor(a, a);
+	blit_vu16 e = vec_add(vec_mule((blit_vu8)src, a), vec_mule((blit_vu8)bg, ia));
+	blit_vu16 o = vec_add(vec_mulo((blit_vu8)src, a), vec_mulo((blit_vu8)bg, ia));
+	blit_vu32 c = (blit_vu32)vec_perm((blit_vu8)e, (blit_vu8)o, hi_bytes);
+	c = vec_sel(c, src, amask);
+	blit_vu32 transparent = (blit_vu32)vec_cmpeq(vec_and((blit_vu32)a, amask), vec_splats((u32)0));
+	return vec_sel(c, bg, transparent);
+}
+
+static inline blit_vu8 BlitSplatAlpha(blit_vu32 src){
+	const blit_vu8 splat = (blit_vu8){0,0,0,0,4,4,4,4,8,8,8,8,12,12,12,12};
+	return vec_perm((blit_vu8)src, (blit_vu8)src, splat);
+}
+
+#endif
+
+/* Opaque copy. */
+static inline void BlitCopyRow(u32 *dst, const u32 *src, u32 n){
+#ifdef __ALTIVEC__
+	while(n && ((uintptr_t)dst & 15)){
+		*dst++ = *src++;
+		n--;
+	}
+	for(; n >= 8; n -= 8, dst += 8, src += 8){
+		blit_vu32 s0 = BlitLoadU(src);
+		blit_vu32 s1 = BlitLoadU(src + 4);
+		vec_st(s0, 0, dst);
+		vec_st(s1, 16, dst);
+	}
+	while(n--)
+		*dst++ = *src++;
+#else
+	memcpy(dst, src, n * sizeof(u32));
+#endif
+}
+
+/* Per pixel alpha, same result as AlphaBlend(dst, src). */
+static inline void BlitAlphaRow(u32 *dst, const u32 *src, u32 n){
+#ifdef __ALTIVEC__
+	while(n && ((uintptr_t)dst & 15)){
+		*dst = BlitBlendPixel(*dst, *src++);
+		dst++; n--;
+	}
+	for(; n >= 8; n -= 8, dst += 8, src += 8){
+		blit_vu32 s0 = BlitLoadU(src);
+		blit_vu32 s1 = BlitLoadU(src + 4);
+		blit_vu32 d0 = vec_ld(0, dst);
+		blit_vu32 d1 = vec_ld(16, dst);
+		vec_st(BlitBlendVec(d0, s0, BlitSplatAlpha(s0)), 0, dst);
+		vec_st(BlitBlendVec(d1, s1, BlitSplatAlpha(s1)), 16, dst);
+	}
+#else
+	for(; n >= 4; n -= 4, dst += 4, src += 4){
+		u32 s0 = src[0], s1 = src[1], s2 = src[2], s3 = src[3];
+		dst[0] = BlitBlendPixel(dst[0], s0);
+		dst[1] = BlitBlendPixel(dst[1], s1);
+		dst[2] = BlitBlendPixel(dst[2], s2);
+		dst[3] = BlitBlendPixel(dst[3], s3);
+	}
+#endif
+	while(n--){
+		*dst = BlitBlendPixel(*dst, *src++);
+		dst++;
+	}
+}
+
+/* Constant alpha: every source pixel is blended as if its alpha was 'alpha'. */
+static inline void BlitConstAlphaRow(u32 *dst, const u32 *src, u32 n, u32 alpha){
+	alpha &= 0xff;
+	if(alpha == 0)
+		return;
+	u32 abits = alpha << 24;
+#ifdef __ALTIVEC__
+	while(n && ((uintptr_t)dst & 15)){
+		*dst = BlitBlendPixel(*dst, (*src++ & 0x00ffffff) | abits);
+		dst++; n--;
+	}
+	const blit_vu8 a = vec_splats((u8)alpha);
+	const blit_vu32 rgb = vec_splats((u32)0x00ffffff);
+	const blit_vu32 av = vec_splats(abits);
+	for(; n >= 8; n -= 8, dst += 8, src += 8){
+		blit_vu32 s0 = vec_or(vec_and(BlitLoadU(src), rgb), av);
+		blit_vu32 s1 = vec_or(vec_and(BlitLoadU(src + 4), rgb), av);
+		blit_vu32 d0 = vec_ld(0, dst);
+		blit_vu32 d1 = vec_ld(16, dst);
+		vec_st(BlitBlendVec(d0, s0, a), 0, dst);
+		vec_st(BlitBlendVec(d1, s1, a), 16, dst);
+	}
+#else
+	for(; n >= 4; n -= 4, dst += 4, src += 4){
+		dst[0] = BlitBlendPixel(dst[0], (src[0] & 0x00ffffff) | abits);
+		dst[1] = BlitBlendPixel(dst[1], (src[1] & 0x00ffffff) | abits);
+		dst[2] = BlitBlendPixel(dst[2], (src[2] & 0x00ffffff) | abits);
+		dst[3] = BlitBlendPixel(dst[3], (src[3] & 0x00ffffff) | abits);
+	}
+#endif
+	while(n--){
+		*dst = BlitBlendPixel(*dst, (*src++ & 0x00ffffff) | abits);
+		dst++;
+	}
+}
+
+/* Chroma key: source pixels equal to 'key' are skipped. */
+static inline void BlitChromaKeyRow(u32 *dst, const u32 *src, u32 n, u32 key){
+#ifdef __ALTIVEC__
+	while(n && ((uintptr_t)dst & 15)){
+		if(*src != key)
+			*dst = *src;
+		dst++; src++; n--;
+	}
+	const blit_vu32 k = vec_splats(key);
+	for(; n >= 8; n -= 8, dst += 8, src += 8){
+		blit_vu32 s0 = BlitLoadU(src);
+		blit_vu32 s1 = BlitLoadU(src + 4);
+		blit_vu32 d0 = vec_ld(0, dst);
+		blit_vu32 d1 = vec_ld(16, dst);
+		vec_st(vec_sel(s0, d0, (blit_vu32)vec_cmpeq(s0, k)), 0, dst);
+		vec_st(vec_sel(s1, d1, (blit_vu32)vec_cmpeq(s1, k)), 16, dst);
+	}
+#else
+	for(; n >= 4; n -= 4, dst += 4, src += 4){
+		u32 s0 = src[0], s1 = src[1], s2 = src[2], s3 = src[3];
+		dst[0] = (s0 != key) ? s0 : dst[0];
+		dst[1] = (s1 != key) ? s1 : dst[1];
+		dst[2] = (s2 != key) ? s2 : dst[2];
+		dst[3] = (s3 != key) ? s3 : dst[3];
+	}
+#endif
+	while(n--){
+		if(*src != key)
+			*dst = *src;
+		dst++; src++;
+	}
+}
+
+/* Coverage to ARGB: each 8 bit coverage value is the alpha of 'color' (glyph drawing). */
+static inline void BlitCoverageRow(u32 *dst, const u8 *cov, u32 n, u32 color){
+	color &= 0x00ffffff;
+#ifdef __ALTIVEC__
+	while(n && ((uintptr_t)dst & 15)){
+		*dst = BlitBlendPixel(*dst, ((u32)*cov++ << 24) | color);
+		dst++; n--;
+	}
+	const blit_vu32 c = vec_splats(color);
+	const blit_vu32 amask = vec_splats((u32)0xff000000);
+	const blit_vu8 s0 = (blit_vu8){0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3};
+	const blit_vu8 four = vec_splats((u8)4);
+	for(; n >= 16; n -= 16, dst += 16, cov += 16){
+		blit_vu8 lo = vec_ld(0, cov);
+		blit_vu8 hi = vec_ld(15, cov);
+		blit_vu8 cv = vec_perm(lo, hi, vec_lvsl(0, cov));
+		blit_vu8 sel = s0;
+		for(int k = 0; k < 4; k++, sel = vec_add(sel, four)){
+			blit_vu8 a = vec_perm(cv, cv, sel);
+			blit_vu32 d = vec_ld(16 * k, dst);
+			vec_st(BlitBlendVec(d, vec_sel(c, (blit_vu32)a, amask), a), 16 * k, dst);
+		}
+	}
+#endif
+	while(n--){
+		*dst = BlitBlendPixel(*dst, ((u32)*cov++ << 24) | color);
+		dst++;
+	}
+}
+
+/*
+ * Clipped rectangle blit. 'src_pitch' and 'dst_pitch' are in bytes (like
+ * pngData::pitch), 'arg' is the constant alpha or the chroma key.
+ */
+static inline void BlitRect(u32 *dst, u32 dst_w, u32 dst_h, u32 dst_pitch, int x, int y,
+			    const u32 *src, u32 src_w, u32 src_h, u32 src_pitch, u32 mode, u32 arg){
+	int sx = 0, sy = 0;
+	int w = (int)src_w, h = (int)src_h;
+	if(x < 0){ sx = -x; w += x; x = 0; }
+	if(y < 0){ sy = -y; h += y; y = 0; }
+	if(x + w > (int)dst_w) w = (int)dst_w - x;
+	if(y + h > (int)dst_h) h = (int)dst_h - y;
+	if(w <= 0 || h <= 0)
+		return;
+
+	u64 start = BlitTimebase();
+	const u8 *s = (const u8*)src + sy * src_pitch + sx * sizeof(u32);
+	u8 *d = (u8*)dst + y * dst_pitch + x * sizeof(u32);
+	for(int j = 0; j < h; j++, s += src_pitch, d += dst_pitch){
+		switch(mode){
+		case BLIT_ALPHA:
+			BlitAlphaRow((u32*)d, (const u32*)s, w);
+			break;
+		case BLIT_CONST_ALPHA:
+			BlitConstAlphaRow((u32*)d, (const u32*)s, w, arg);
+			break;
+		case BLIT_CHROMAKEY:
+			BlitChromaKeyRow((u32*)d, (const u32*)s, w, arg);
+			break;
+		default:
+			BlitCopyRow((u32*)d, (const u32*)s, w);
+			break;
+		}
+	}
+	NoRSX_BlitStats &st = BlitStats();
+	st.ticks += BlitTimebase() - start;
+	st.pixels += (u64)w * h;
+	st.calls++;
+}
+
+#endif
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2013, Giovanni Dante Grazioli (deroad)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef __NORSX_DAMAGE_H__
+#define __NORSX_DAMAGE_H__
+
+#include <rsx/rsx.h>
+#include "Min.h"
+#include "Bitmap.h"
+#include "Blit.h"
+
+/*
+ * Dirty rectangle tracking for mostly static screens.
+ *
+ * Each of the two Minimum::buffers[] has its own damage list, because a
+ * change has to reach both of them before they show the same picture.
+ * Add() marks a region on both lists; Mono(), Gradient() and DrawBitmap()
+ * only touch the damaged part of Minimum::buffer; Present() copies it to
+ * buffers[currentBuffer] (with the CPU or an RSX transfer), clears that
+ * buffer's list and flips. Call it instead of NoRSX::Flip(), which copies
+ * the whole frame.
+ */
+
+#define DAMAGE_MAX_RECTS		32
+
+typedef struct {
+	s32 x0, y0, x1, y1;    //x1/y1 excluded
+} NoRSX_Rect;
+
+class Damage{
+public:
+	Damage(Minimum *g){
+		G=g;
+		rsx_transfer = false;
+		transfer_mode = GCM_TRANSFER_LOCAL_TO_LOCAL;
+		damaged_pixels = 0;
+		count[0] = count[1] = 0;
+	}
+	~Damage(){}
+
+	void Add(s32 X, s32 Y, s32 Width, s32 Height){
+		NoRSX_Rect r = {X, Y, X + Width, Y + Height};
+		if(r.x0 < 0) r.x0 = 0;
+		if(r.y0 < 0) r.y0 = 0;
+		if(r.x1 > G->width) r.x1 = G->width;
+		if(r.y1 > G->height) r.y1 = G->height;
+		if(r.x0 >= r.x1 || r.y0 >= r.y1)
+			return;
+		Insert(0, r);
+		Insert(1, r);
+	}
+
+	void AddAll(){
+		Add(0, 0, G->width, G->height);
+	}
+
+	//mode is GCM_TRANSFER_LOCAL_TO_LOCAL when Minimum::buffer comes from rsxMemalign,
+	//GCM_TRANSFER_MAIN_TO_LOCAL when it is mapped main memory.
+	void EnableRSXTransfer(bool enable, u8 mode = GCM_TRANSFER_LOCAL_TO_LOCAL){
+		rsx_transfer = enable;
+		transfer_mode = mode;
+	}
+
+	void Mono(u32 Color){
+		NoRSX_Rect *r = rects[G->currentBuffer];
+		for(u32 i = 0; i < count[G->currentBuffer]; i++)
+			for(s32 y = r[i].y0; y < r[i].y1; y++){
+				u32 *p = G->buffer + y * G->width;
+				for(s32 x = r[i].x0; x < r[i].x1; x++)
+					p[x] = Color;
+			}
+	}
+
+	//vertical gradient from Color1 (top) to Color2 (bottom)
+	void Gradient(u32 Color1, u32 Color2){
+		NoRSX_Rect *r = rects[G->currentBuffer];
+		for(u32 i = 0; i < count[G->currentBuffer]; i++)
+			for(s32 y = r[i].y0; y < r[i].y1; y++){
+				u32 c = GradientRow(Color1, Color2, y);
+				u32 *p = G->buffer + y * G->width;
+				for(s32 x = r[i].x0; x < r[i].x1; x++)
+					p[x] = c;
+			}
+	}
+
+	//same as Bitmap::DrawBitmap() restricted to the damaged regions
+	void DrawBitmap(NoRSX_Bitmap *a){
+		if(a->load != 1)
+			return;
+		NoRSX_Rect *r = rects[G->currentBuffer];
+		for(u32 i = 0; i < count[G->currentBuffer]; i++){
+			s32 x1 = r[i].x1 < (s32)a->width ? r[i].x1 : (s32)a->width;
+			s32 y1 = r[i].y1 < (s32)a->height ? r[i].y1 : (s32)a->height;
+			for(s32 y = r[i].y0; y < y1; y++)
+				if(x1 > r[i].x0)
+					BlitCopyRow(G->buffer + y * G->width + r[i].x0, a->bitmap + y * a->width + r[i].x0, x1 - r[i].x0);
+		}
+	}
+
+	void Present(){
+		int cur = G->currentBuffer;
+		rsxBuffer *b = &G->buffers[cur];
+		NoRSX_Rect *r = rects[cur];
+		u32 pitch = G->width * sizeof(u32);
+		u32 src_off, dst_off;
+		bool rsx = rsx_transfer && b->ptr != G->buffer &&
+			   rsxAddressToOffset(G->buffer, &src_off) == 0 &&
+			   rsxAddressToOffset(b->ptr, &dst_off) == 0;
+
+		damaged_pixels = 0;
+		for(u32 i = 0; i < count[cur]; i++){
+			u32 w = r[i].x1 - r[i].x0, h = r[i].y1 - r[i].y0;
+			damaged_pixels += w * h;
+			if(b->ptr == G->buffer)
+				continue;
+			if(rsx)
+				rsxSetTransferImage(G->context, transfer_mode, dst_off, b->width * sizeof(u32), r[i].x0, r[i].y0,
+						    src_off, pitch, r[i].x0, r[i].y0, w, h, sizeof(u32));
+			else
+				for(s32 y = r[i].y0; y < r[i].y1; y++)
+					BlitCopyRow(b->ptr + y * b->width + r[i].x0, G->buffer + y * G->width + r[i].x0, w);
+		}
+		count[cur] = 0;
+
+		//the transfers are queued ahead of the flip in the same command buffer
+		flip(G->context, b->id);
+		G->currentBuffer = !cur;
+		setRenderTarget(G->context, &G->buffers[G->currentBuffer]);
+		waitFlip();
+	}
+
+	//pixels copied by the last Present()
+	u32 GetDamagedPixels() const { return damaged_pixels; }
+	u32 GetRectCount(int buffer) const { return count[buffer & 1]; }
+	const NoRSX_Rect *GetRects(int buffer) const { return rects[buffer & 1]; }
+
+protected:
+	Minimum *G;
+	NoRSX_Rect rects[2][DAMAGE_MAX_RECTS];
+	u32 count[2];
+	u32 damaged_pixels;
+	bool rsx_transfer;
+	u8 transfer_mode;
+
+	static s64 Area(const NoRSX_Rect &r){
+		return (s64)(r.x1 - r.x0) * (r.y1 - r.y0);
+	}
+
+	static NoRSX_Rect Union(const NoRSX_Rect &a, const NoRSX_Rect &b){
+		NoRSX_Rect u = {a.x0 < b.x0 ? a.x0 : b.x0, a.y0 < b.y0 ? a.y0 : b.y0,
+				a.x1 > b.x1 ? a.x1 : b.x1, a.y1 > b.y1 ? a.y1 : b.y1};
+		return u;
+	}
+
+	static bool Touch(const NoRSX_Rect &a, const NoRSX_Rect &b){
+		return a.x0 <= b.x1 && b.x0 <= a.x1 && a.y0 <= b.y1 && b.y0 <= a.y1;
+	}
+
+	//merges touching rectangles; when the list is full the cheapest pair is merged
+	void Insert(int buf, NoRSX_Rect r){
+		NoRSX_Rect *l = rects[buf];
+		u32 i = 0;
+		while(i < count[buf]){
+			if(Touch(l[i], r)){
+				r = Union(l[i], r);
+				l[i] = l[--count[buf]];
+				i = 0;
+			}else
+				i++;
+		}
+		if(count[buf] == DAMAGE_MAX_RECTS){
+			u32 bi = 0, bj = 1;
+			s64 best = -1;
+			for(u32 a = 0; a < count[buf]; a++)
+				for(u32 b = a + 1; b < count[buf]; b++){
+					s64 cost = Area(Union(l[a], l[b])) - Area(l[a]) - Area(l[b]);
+					if(best < 0 || cost < best){
+						best = cost;
+						bi = a;
+						bj = b;
+					}
+				}
+			l[bi] = Union(l[bi], l[bj]);
+			l[bj] = l[--count[buf]];
+		}
+		l[count[buf]++] = r;
+	}
+
+	u32 GradientRow(u32 c1, u32 c2, s32 y) const {
+		u32 h = G->height > 1 ? G->height - 1 : 1;
+		u32 out = 0;
+		for(int s = 0; s < 32; s += 8){
+			s32 a = (c1 >> s) & 0xff, b = (c2 >> s) & 0xff;
+			out |= (u32)(a + (b - a) * y / (s32)h) << s;
+		}
+		return out;
+	}
+};
+
+#endif
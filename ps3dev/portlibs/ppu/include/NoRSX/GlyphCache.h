@@ -0,0 +1,399 @@
+/*
+ * Copyright (c) 2013, Giovanni Dante Grazioli (deroad)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef __NORSX_GLYPHCACHE_H__
+#define __NORSX_GLYPHCACHE_H__
+
+#include <NoRSX/Font.h>
+#include <NoRSX/Blit.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+/*
+ * Glyph cache for Font.
+ *
+ * GlyphCache keeps rendered coverage bitmaps and metrics keyed by
+ * (face, size, codepoint, stroke) in a hash table with an LRU list, and
+ * evicts the oldest glyphs once the byte budget is exceeded. Kerning
+ * pairs are kept in a small direct mapped table.
+ *
+ * CachedFont is a Font whose Printf()/PrintfToBitmap() draw from the
+ * cache with BlitCoverageRow() instead of rasterising every glyph again.
+ * All the CachedFont objects share GlyphCache::Shared() unless they are
+ * given their own cache.
+ */
+
+#define GLYPHCACHE_BUCKETS		1024
+#define GLYPHCACHE_KERN_SLOTS		512
+#define GLYPHCACHE_DEFAULT_LIMIT	(2*1024*1024)
+
+typedef struct _norsx_glyph {
+	struct _norsx_glyph *next;     //hash chain
+	struct _norsx_glyph *prev_lru;
+	struct _norsx_glyph *next_lru;
+
+	FT_Face face;
+	u32 size;
+	u32 codepoint;
+	u32 stroke;
+
+	s32 left;      //offset from the pen position to the bitmap
+	s32 top;       //offset from the baseline to the first row (upwards)
+	s32 advance;   //pen advance in pixels
+	u32 index;     //FreeType glyph index, used for kerning
+	u32 width;
+	u32 rows;
+	u8 coverage[]; //width*rows bytes
+} NoRSX_Glyph;
+
+typedef struct {
+	FT_Face face;
+	u32 size;
+	u32 left, right;
+	s32 kern;
+	int valid;
+} NoRSX_KernPair;
+
+typedef struct {
+	u64 hits;
+	u64 misses;
+	u64 evictions;
+	u64 kern_hits;
+	u64 kern_misses;
+	u32 glyphs;
+	u32 bytes;
+	u32 limit;
+} NoRSX_GlyphCacheStats;
+
+class GlyphCache{
+public:
+	GlyphCache(u32 limit = GLYPHCACHE_DEFAULT_LIMIT){
+		memset(buckets, 0, sizeof(buckets));
+		memset(kerning, 0, sizeof(kerning));
+		memset(&stats, 0, sizeof(stats));
+		stats.limit = limit;
+		head = tail = NULL;
+	}
+	~GlyphCache(){
+		Clear();
+	}
+
+	static GlyphCache *Shared(){
+		static GlyphCache cache;
+		return &cache;
+	}
+
+	void SetLimit(u32 bytes){
+		stats.limit = bytes;
+		Trim();
+	}
+
+	void Clear(){
+		while(tail)
+			Evict(tail);
+		memset(kerning, 0, sizeof(kerning));
+	}
+
+	//drops every glyph of a face, call it before FT_Done_Face()
+	void Forget(FT_Face face){
+		NoRSX_Glyph *g = head;
+		while(g){
+			NoRSX_Glyph *n = g->next_lru;
+			if(g->face == face)
+				Evict(g);
+			g = n;
+		}
+		for(u32 i = 0; i < GLYPHCACHE_KERN_SLOTS; i++)
+			if(kerning[i].face == face)
+				kerning[i].valid = 0;
+	}
+
+	const NoRSX_GlyphCacheStats &GetStats() const { return stats; }
+	void ResetStats(){
+		stats.hits = stats.misses = stats.evictions = 0;
+		stats.kern_hits = stats.kern_misses = 0;
+	}
+	float HitRate() const {
+		u64 total = stats.hits + stats.misses;
+		return total ? (float)stats.hits / (float)total : 0.0f;
+	}
+
+	//returns NULL if the glyph cannot be rendered
+	NoRSX_Glyph *Get(FT_Face face, u32 size, u32 codepoint, u32 stroke, FT_Stroker stroker){
+		u32 h = Hash(face, size, codepoint, stroke);
+		for(NoRSX_Glyph *g = buckets[h]; g; g = g->next)
+			if(g->face == face && g->size == size && g->codepoint == codepoint && g->stroke == stroke){
+				stats.hits++;
+				Touch(g);
+				return g;
+			}
+		stats.misses++;
+		NoRSX_Glyph *g = Render(face, size, codepoint, stroke, stroker);
+		if(!g)
+			return NULL;
+		g->next = buckets[h];
+		buckets[h] = g;
+		g->prev_lru = NULL;
+		g->next_lru = head;
+		if(head) head->prev_lru = g;
+		head = g;
+		if(!tail) tail = g;
+		stats.glyphs++;
+		stats.bytes += sizeof(NoRSX_Glyph) + g->width * g->rows;
+		Trim(g);
+		return g;
+	}
+
+	s32 Kerning(FT_Face face, u32 size, u32 left, u32 right){
+		u32 slot = (((uintptr_t)face >> 4) ^ (size * 31) ^ (left * 2654435761u) ^ (right * 40503u)) % GLYPHCACHE_KERN_SLOTS;
+		NoRSX_KernPair *k = &kerning[slot];
+		if(k->valid && k->face == face && k->size == size && k->left == left && k->right == right){
+			stats.kern_hits++;
+			return k->kern;
+		}
+		stats.kern_misses++;
+		FT_Vector delta;
+		FT_Set_Pixel_Sizes(face, 0, size);
+		FT_Get_Kerning(face, left, right, FT_KERNING_DEFAULT, &delta);
+		k->face = face;
+		k->size = size;
+		k->left = left;
+		k->right = right;
+		k->kern = delta.x >> 6;
+		k->valid = 1;
+		return k->kern;
+	}
+
+protected:
+	NoRSX_Glyph *buckets[GLYPHCACHE_BUCKETS];
+	NoRSX_Glyph *head, *tail;
+	NoRSX_KernPair kerning[GLYPHCACHE_KERN_SLOTS];
+	NoRSX_GlyphCacheStats stats;
+
+	static u32 Hash(FT_Face face, u32 size, u32 codepoint, u32 stroke){
+		u32 h = (u32)((uintptr_t)face >> 4) * 2654435761u;
+		h ^= size * 0x9e3779b1u;
+		h ^= codepoint * 0x85ebca6bu;
+		h ^= stroke * 0xc2b2ae35u;
+		return (h ^ (h >> 16)) % GLYPHCACHE_BUCKETS;
+	}
+
+	void Touch(NoRSX_Glyph *g){
+		if(g == head)
+			return;
+		g->prev_lru->next_lru = g->next_lru;
+		if(g->next_lru) g->next_lru->prev_lru = g->prev_lru;
+		else tail = g->prev_lru;
+		g->prev_lru = NULL;
+		g->next_lru = head;
+		head->prev_lru = g;
+		head = g;
+	}
+
+	void Evict(NoRSX_Glyph *g){
+		NoRSX_Glyph **p = &buckets[Hash(g->face, g->size, g->codepoint, g->stroke)];
+		while(*p != g)
+			p = &(*p)->next;
+		*p = g->next;
+		if(g->prev_lru) g->prev_lru->next_lru = g->next_lru;
+		else head = g->next_lru;
+		if(g->next_lru) g->next_lru->prev_lru = g->prev_lru;
+		else tail = g->prev_lru;
+		stats.glyphs--;
+		stats.bytes -= sizeof(NoRSX_Glyph) + g->width * g->rows;
+		stats.evictions++;
+		free(g);
+	}
+
+	//never evicts 'keep', the glyph that is about to be drawn
+	void Trim(NoRSX_Glyph *keep = NULL){
+		while(stats.bytes > stats.limit && tail && tail != keep)
+			Evict(tail);
+	}
+
+	NoRSX_Glyph *Render(FT_Face face, u32 size, u32 codepoint, u32 stroke, FT_Stroker stroker){
+		FT_Glyph glyph;
+		FT_Set_Pixel_Sizes(face, 0, size);
+		u32 index = FT_Get_Char_Index(face, codepoint);
+		if(FT_Load_Glyph(face, index, FT_LOAD_DEFAULT))
+			return NULL;
+		if(FT_Get_Glyph(face->glyph, &glyph))
+			return NULL;
+		if(stroke && stroker)
+			FT_Glyph_StrokeBorder(&glyph, stroker, 0, 1);
+		if(FT_Glyph_To_Bitmap(&glyph, FT_RENDER_MODE_NORMAL, 0, 1)){
+			FT_Done_Glyph(glyph);
+			return NULL;
+		}
+		FT_BitmapGlyph bg = (FT_BitmapGlyph)glyph;
+		FT_Bitmap *bm = &bg->bitmap;
+		u32 w = bm->width, rows = bm->rows;
+		NoRSX_Glyph *g = (NoRSX_Glyph*)malloc(sizeof(NoRSX_Glyph) + w * rows);
+		if(g){
+			g->face = face;
+			g->size = size;
+			g->codepoint = codepoint;
+			g->stroke = stroke;
+			g->left = bg->left;
+			g->top = bg->top;
+			g->advance = face->glyph->advance.x >> 6;
+			g->index = index;
+			g->width = w;
+			g->rows = rows;
+			for(u32 y = 0; y < rows; y++)
+				memcpy(g->coverage + y * w, bm->buffer + y * bm->pitch, w);
+		}
+		FT_Done_Glyph(glyph);
+		return g;
+	}
+};
+
+class CachedFont : public Font{
+public:
+	CachedFont(u32 Color, u32 Size, const void *MemFont, u32 MemFont_size, Minimum *min) : Font(Color, Size, MemFont, MemFont_size, min) { Init(); }
+	CachedFont(u32 Color, u32 Size, const char *Font_Path, Minimum *min) : Font(Color, Size, Font_Path, min) { Init(); }
+	CachedFont(u32 Size, const void *MemFont, u32 MemFont_size, Minimum *min) : Font(Size, MemFont, MemFont_size, min) { Init(); }
+	CachedFont(u32 Size, const char *Font_Path, Minimum *min) : Font(Size, Font_Path, min) { Init(); }
+	CachedFont(const void *MemFont, u32 MemFont_size, Minimum *min) : Font(MemFont, MemFont_size, min) { Init(); }
+	CachedFont(const char *Font_Path, Minimum *min) : Font(Font_Path, min) { Init(); }
+	CachedFont(const int ID, Minimum *min) : Font(ID, min) { Init(); }
+	~CachedFont(){
+		cache->Forget(face);
+		if(cache_stroker)
+			FT_Stroker_Done(cache_stroker);
+	}
+
+	void SetCache(GlyphCache *c){ cache = c ? c : GlyphCache::Shared(); }
+	GlyphCache *GetCache() const { return cache; }
+
+	//outline width in pixels, 0 disables the stroke
+	void SetStroke(u32 pixels){
+		stroke = pixels;
+		if(pixels && !cache_stroker)
+			FT_Stroker_New(library, &cache_stroker);
+		if(cache_stroker)
+			FT_Stroker_Set(cache_stroker, pixels * 64, FT_STROKER_LINECAP_ROUND, FT_STROKER_LINEJOIN_ROUND, 0);
+	}
+
+	//renders the given UTF-8 characters ahead of time
+	void Preload(const char *chars, u32 Size){
+		const u8 *s = (const u8*)chars;
+		u32 cp;
+		while((cp = NextCodepoint(&s)))
+			cache->Get(face, Size, cp, stroke, cache_stroker);
+	}
+
+	void Printf(u32 x, u32 y, const char *a, ...){
+		va_list va; va_start(va, a);
+		Print(x, y, FontColor, FontSize, NULL, a, va);
+		va_end(va);
+	}
+	void Printf(u32 x, u32 y, u32 Color, const char *a, ...){
+		va_list va; va_start(va, a);
+		Print(x, y, Color, FontSize, NULL, a, va);
+		va_end(va);
+	}
+	void Printf(u32 x, u32 y, u32 Color, u32 Size, const char *a, ...){
+		va_list va; va_start(va, a);
+		Print(x, y, Color, Size, NULL, a, va);
+		va_end(va);
+	}
+	void PrintfToBitmap(u32 x, u32 y, NoRSX_Bitmap* bmap, const char *a, ...){
+		va_list va; va_start(va, a);
+		Print(x, y, FontColor, FontSize, bmap, a, va);
+		va_end(va);
+	}
+	void PrintfToBitmap(u32 x, u32 y, NoRSX_Bitmap* bmap, u32 Color, const char *a, ...){
+		va_list va; va_start(va, a);
+		Print(x, y, Color, FontSize, bmap, a, va);
+		va_end(va);
+	}
+	void PrintfToBitmap(u32 x, u32 y, NoRSX_Bitmap* bmap, u32 Color, u32 Size, const char *a, ...){
+		va_list va; va_start(va, a);
+		Print(x, y, Color, Size, bmap, a, va);
+		va_end(va);
+	}
+
+protected:
+	GlyphCache *cache;
+	FT_Stroker cache_stroker;
+	u32 stroke;
+
+	void Init(){
+		cache = GlyphCache::Shared();
+		cache_stroker = NULL;
+		stroke = 0;
+	}
+
+	static u32 NextCodepoint(const u8 **p){
+		const u8 *s = *p;
+		u32 c = *s;
+		if(!c)
+			return 0;
+		int n = c < 0x80 ? 0 : (c >> 5) == 0x6 ? 1 : (c >> 4) == 0xe ? 2 : (c >> 3) == 0x1e ? 3 : 0;
+		if(n)
+			c &= 0x3f >> n;
+		s++;
+		while(n-- && (*s & 0xc0) == 0x80)
+			c = (c << 6) | (*s++ & 0x3f);
+		*p = s;
+		return c;
+	}
+
+	//y is the baseline, like Font::Printf()
+	void Print(u32 x, u32 y, u32 Color, u32 Size, NoRSX_Bitmap *bmap, const char *fmt, va_list va){
+		char text[1024];
+		vsnprintf(text, sizeof(text), fmt, va);
+
+		u32 *dst = bmap ? bmap->bitmap : m->buffer;
+		s32 dw = bmap ? (s32)bmap->width : (s32)m->width;
+		s32 dh = bmap ? (s32)bmap->height : (s32)m->height;
+		bool kern = Kerning && FT_HAS_KERNING(face);
+		s32 pen = x;
+		u32 prev = 0;
+		const u8 *s = (const u8*)text;
+		u32 cp;
+
+		while((cp = NextCodepoint(&s))){
+			NoRSX_Glyph *g = cache->Get(face, Size, cp, stroke, cache_stroker);
+			if(!g)
+				continue;
+			if(kern && prev && g->index)
+				pen += cache->Kerning(face, Size, prev, g->index);
+			prev = g->index;
+
+			s32 gx = pen + g->left, gy = (s32)y - g->top;
+			s32 cx = 0, w = g->width;
+			if(gx < 0){ cx = -gx; w += gx; gx = 0; }
+			if(gx + w > dw) w = dw - gx;
+			for(u32 r = 0; w > 0 && r < g->rows; r++){
+				s32 py = gy + (s32)r;
+				if(py < 0 || py >= dh)
+					continue;
+				BlitCoverageRow(dst + py * dw + gx, g->coverage + r * g->width + cx, w, Color);
+			}
+			pen += g->advance;
+		}
+	}
+};
+
+#endif
@@ -29,6 +29,8 @@
 #include <sysmodule/sysmodule.h>
 #include "Min.h"
 #include "Bitmap.h"
+#include "Blit.h"
+#include "Resample.h"
 
 //#define CROMAKEY	0xffbcbc222
 
@@ -58,9 +60,34 @@ public:
 	void DrawIMGtoBitmap(int x, int y, jpgData *jpg1, NoRSX_Bitmap *a);
 	void AlphaDrawIMGtoBitmap(int x, int y, pngData *png1, NoRSX_Bitmap *a);
 
+//mode is one of BLIT_COPY, BLIT_ALPHA, BLIT_CONST_ALPHA (arg = alpha) or BLIT_CHROMAKEY (arg = key)
+	void BlitIMG(int x, int y, pngData *png1, u32 mode = BLIT_ALPHA, u32 arg = 0){
+		BlitRect(G->buffer, G->width, G->height, G->width*4, x, y,
+			 (const u32*)png1->bmp_out, png1->width, png1->height, png1->pitch, mode, arg);
+	}
+	void BlitIMG(int x, int y, jpgData *jpg1, u32 mode = BLIT_COPY, u32 arg = 0){
+		BlitRect(G->buffer, G->width, G->height, G->width*4, x, y,
+			 (const u32*)jpg1->bmp_out, jpg1->width, jpg1->height, jpg1->pitch, mode, arg);
+	}
+	void BlitIMGtoBitmap(int x, int y, pngData *png1, NoRSX_Bitmap *a, u32 mode = BLIT_ALPHA, u32 arg = 0){
+		BlitRect(a->bitmap, a->width, a->height, a->width*4, x, y,
+			 (const u32*)png1->bmp_out, png1->width, png1->height, png1->pitch, mode, arg);
+	}
+
 	pngData *ResizeImage(pngData *png_in, u32 TgtWidth, u32 TgtHeight);
 	jpgData *ResizeImage(jpgData *jpg_in, u32 TgtWidth, u32 TgtHeight);
 
+//filtered resize into a caller provided image: set bmp_out, width, height and pitch of the output first.
+//filter is RESAMPLE_BOX, RESAMPLE_BILINEAR or RESAMPLE_LANCZOS3. Returns 0 on success.
+	int ResizeImageTo(pngData *png_in, pngData *png_out, u32 filter = RESAMPLE_BILINEAR, u32 threads = 2){
+		return ResampleImage((const u32*)png_in->bmp_out, png_in->width, png_in->height, png_in->pitch,
+				     (u32*)png_out->bmp_out, png_out->width, png_out->height, png_out->pitch, filter, threads);
+	}
+	int ResizeImageTo(jpgData *jpg_in, jpgData *jpg_out, u32 filter = RESAMPLE_BILINEAR, u32 threads = 2){
+		return ResampleImage((const u32*)jpg_in->bmp_out, jpg_in->width, jpg_in->height, jpg_in->pitch,
+				     (u32*)jpg_out->bmp_out, jpg_out->width, jpg_out->height, jpg_out->pitch, filter, threads);
+	}
+
 protected:
 	Minimum *G;
 	void DrawPartialImage(int x, int y, unsigned int s_width, unsigned int s_height, unsigned int e_width, unsigned int e_height, unsigned int bg, unsigned int color, pngData *png1); 
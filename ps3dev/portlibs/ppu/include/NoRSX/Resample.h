@@ -0,0 +1,350 @@
+/*
+ * Copyright (c) 2013, Giovanni Dante Grazioli (deroad)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef __NORSX_RESAMPLE_H__
+#define __NORSX_RESAMPLE_H__
+
+#include <ppu-types.h>
+#include <malloc.h>
+#include <math.h>
+#include <cstring>
+
+#ifdef __PPU__
+#include <sys/thread.h>
+#else
+#include <pthread.h>
+#endif
+
+#ifdef __ALTIVEC__
+#include <altivec.h>
+#endif
+
+/*
+ * Separable image resampler, used by Image::ResizeImageTo().
+ *
+ * The filter is sampled once per axis into a fixed point table (14 bit
+ * weights that always sum to 1<<14). The horizontal pass writes 16 bit
+ * channels scaled by 128, the vertical pass sums them and rounds back to
+ * 8 bit. All maths is integer, so the AltiVec vertical pass and the host
+ * build give the same bytes and can be compared against golden images.
+ *
+ * Output rows are split in stripes, one per thread.
+ */
+
+#define RESAMPLE_BOX			0
+#define RESAMPLE_BILINEAR		1
+#define RESAMPLE_LANCZOS3		2
+
+#define RESAMPLE_MAX_THREADS		4
+
+#define RESAMPLE_WEIGHT_BITS		14
+#define RESAMPLE_TMP_BITS		7
+
+typedef struct {
+	u32 taps;      //stride of weights[]
+	s32 *start;    //first source index of each output sample
+	u32 *count;    //used taps of each output sample
+	s16 *weights;
+} NoRSX_ResampleTable;
+
+static inline double ResampleKernel(u32 filter, double x){
+	if(x < 0) x = -x;
+	switch(filter){
+	case RESAMPLE_BOX:
+		return x < 0.5 ? 1.0 : 0.0;
+	case RESAMPLE_BILINEAR:
+		return x < 1.0 ? 1.0 - x : 0.0;
+	default:
+		if(x < 1e-8)
+			return 1.0;
+		if(x >= 3.0)
+			return 0.0;
+		return (3.0 * sin(M_PI * x) * sin(M_PI * x / 3.0)) / (M_PI * M_PI * x * x);
+	}
+}
+
+static inline double ResampleSupport(u32 filter){
+	switch(filter){
+	case RESAMPLE_BOX:      return 0.5;
+	case RESAMPLE_BILINEAR: return 1.0;
+	default:                return 3.0;
+	}
+}
+
+static inline void ResampleFreeTable(NoRSX_ResampleTable *t){
+	free(t->start);
+	free(t->count);
+	free(t->weights);
+	memset(t, 0, sizeof(*t));
+}
+
+/* Returns 0 on success, -1 if out of memory. */
+static inline int ResampleBuildTable(NoRSX_ResampleTable *t, u32 src, u32 dst, u32 filter){
+	double scale = (double)src / (double)dst;
+	double fscale = scale > 1.0 ? scale : 1.0;
+	double support = ResampleSupport(filter) * fscale;
+
+	t->taps = (u32)ceil(support * 2.0) + 1;
+	t->start = (s32*)malloc(dst * sizeof(s32));
+	t->count = (u32*)malloc(dst * sizeof(u32));
+	t->weights = (s16*)calloc(dst * t->taps, sizeof(s16));
+	if(!t->start || !t->count || !t->weights){
+		ResampleFreeTable(t);
+		return -1;
+	}
+
+	double *w = (double*)malloc(t->taps * sizeof(double));
+	if(!w){
+		ResampleFreeTable(t);
+		return -1;
+	}
+
+	for(u32 i = 0; i < dst; i++){
+		double center = (i + 0.5) * scale;
+		s32 lo = (s32)floor(center - support);
+		s32 hi = (s32)ceil(center + support);
+		if(lo < 0) lo = 0;
+		if(hi > (s32)src) hi = src;
+		if(hi - lo > (s32)t->taps) hi = lo + t->taps;
+
+		double sum = 0.0;
+		u32 n = 0;
+		for(s32 j = lo; j < hi; j++, n++){
+			w[n] = ResampleKernel(filter, (j + 0.5 - center) / fscale);
+			sum += w[n];
+		}
+		if(n == 0 || sum == 0.0){
+			//nothing under the kernel, fall back to the nearest sample
+			lo = (s32)center;
+			if(lo >= (s32)src) lo = src - 1;
+			n = 1;
+			w[0] = sum = 1.0;
+		}
+
+		s16 *fw = t->weights + i * t->taps;
+		s32 total = 0, peak = 0;
+		for(u32 k = 0; k < n; k++){
+			fw[k] = (s16)floor(w[k] / sum * (1 << RESAMPLE_WEIGHT_BITS) + 0.5);
+			total += fw[k];
+			if(fw[k] > fw[peak])
+				peak = k;
+		}
+		//put the rounding error on the biggest tap so the row sums to exactly 1.0
+		fw[peak] += (1 << RESAMPLE_WEIGHT_BITS) - total;
+
+		t->start[i] = lo;
+		t->count[i] = n;
+	}
+	free(w);
+	return 0;
+}
+
+/* one source row to 4*dst_w channels scaled by 1<<RESAMPLE_TMP_BITS */
+static inline void ResampleRowH(s16 *out, const u8 *in, const NoRSX_ResampleTable *t, u32 dst_w){
+	const s32 round = 1 << (RESAMPLE_WEIGHT_BITS - RESAMPLE_TMP_BITS - 1);
+	for(u32 x = 0; x < dst_w; x++){
+		const s16 *w = t->weights + x * t->taps;
+		const u8 *p = in + t->start[x] * 4;
+		s32 c0 = round, c1 = round, c2 = round, c3 = round;
+		for(u32 k = 0; k < t->count[x]; k++, p += 4){
+			c0 += w[k] * p[0];
+			c1 += w[k] * p[1];
+			c2 += w[k] * p[2];
+			c3 += w[k] * p[3];
+		}
+		c0 >>= RESAMPLE_WEIGHT_BITS - RESAMPLE_TMP_BITS;
+		c1 >>= RESAMPLE_WEIGHT_BITS - RESAMPLE_TMP_BITS;
+		c2 >>= RESAMPLE_WEIGHT_BITS - RESAMPLE_TMP_BITS;
+		c3 >>= RESAMPLE_WEIGHT_BITS - RESAMPLE_TMP_BITS;
+		out[x*4+0] = (s16)(c0 > 32767 ? 32767 : (c0 < -32768 ? -32768 : c0));
+		out[x*4+1] = (s16)(c1 > 32767 ? 32767 : (c1 < -32768 ? -32768 : c1));
+		out[x*4+2] = (s16)(c2 > 32767 ? 32767 : (c2 < -32768 ? -32768 : c2));
+		out[x*4+3] = (s16)(c3 > 32767 ? 32767 : (c3 < -32768 ? -32768 : c3));
+	}
+}
+
+/* n channels of the output row from 'count' temporary rows */
+static inline void ResampleRowV(u8 *out, const s16 *tmp, u32 stride, const s16 *w, u32 count, u32 n){
+	const u32 shift = RESAMPLE_WEIGHT_BITS + RESAMPLE_TMP_BITS;
+	const s32 round = 1 << (shift - 1);
+	u32 x = 0;
+#ifdef __ALTIVEC__
+	const vector signed int vround = vec_splats(round);
+	const vector unsigned int vshift = vec_splats(shift);
+	for(; x + 16 <= n; x += 16){
+		vector signed int e0 = vround, o0 = vround, e1 = vround, o1 = vround;
+		const s16 *row = tmp + x;
+		for(u32 k = 0; k < count; k++, row += stride){
+			vector signed short vw = vec_splats(w[k]);
+			vector signed short t0 = vec_ld(0, row);
+			vector signed short t1 = vec_ld(16, row);
+			e0 = vec_add(e0, vec_mule(t0, vw));
+			o0 = vec_add(o0, vec_mulo(t0, vw));
+			e1 = vec_add(e1, vec_mule(t1, vw));
+			o1 = vec_add(o1, vec_mulo(t1, vw));
+		}
+		e0 = vec_sra(e0, vshift); o0 = vec_sra(o0, vshift);
+		e1 = vec_sra(e1, vshift); o1 = vec_sra(o1, vshift);
+		vector signed short h0 = vec_packs(vec_mergeh(e0, o0), vec_mergel(e0, o0));
+		vector signed short h1 = vec_packs(vec_mergeh(e1, o1), vec_mergel(e1, o1));
+		vector unsigned char b = vec_packsu(h0, h1);
+		if(((uintptr_t)(out + x) & 15) == 0)
+			vec_st(b, 0, out + x);
+		else{
+			u8 tmpb[16] __attribute__((aligned(16)));
+			vec_st(b, 0, tmpb);
+			memcpy(out + x, tmpb, 16);
+		}
+	}
+#endif
+	for(; x < n; x++){
+		s32 acc = round;
+		const s16 *row = tmp + x;
+		for(u32 k = 0; k < count; k++, row += stride)
+			acc += w[k] * *row;
+		acc >>= shift;
+		out[x] = (u8)(acc < 0 ? 0 : (acc > 255 ? 255 : acc));
+	}
+}
+
+typedef struct {
+	const u8 *src;
+	u32 src_pitch;
+	u8 *dst;
+	u32 dst_w;
+	u32 dst_pitch;
+	u32 y0, y1;    //output rows of this stripe
+	const NoRSX_ResampleTable *h;
+	const NoRSX_ResampleTable *v;
+	int error;
+} NoRSX_ResampleJob;
+
+static inline void ResampleStripe(NoRSX_ResampleJob *job){
+	if(job->y0 >= job->y1)
+		return;
+	const NoRSX_ResampleTable *v = job->v;
+	u32 first = v->start[job->y0];
+	u32 last = 0;
+	for(u32 y = job->y0; y < job->y1; y++)
+		if(v->start[y] + v->count[y] > last)
+			last = v->start[y] + v->count[y];
+
+	//16 byte aligned rows padded to a whole vector for the AltiVec pass
+	u32 stride = (job->dst_w * 4 + 15) & ~15;
+	s16 *tmp = (s16*)memalign(16, (size_t)stride * (last - first) * sizeof(s16));
+	if(!tmp){
+		job->error = -1;
+		return;
+	}
+	for(u32 j = first; j < last; j++)
+		ResampleRowH(tmp + (j - first) * stride, job->src + (size_t)j * job->src_pitch, job->h, job->dst_w);
+	for(u32 y = job->y0; y < job->y1; y++)
+		ResampleRowV(job->dst + (size_t)y * job->dst_pitch, tmp + (v->start[y] - first) * stride,
+			     stride, v->weights + y * v->taps, v->count[y], job->dst_w * 4);
+	free(tmp);
+	job->error = 0;
+}
+
+#ifdef __PPU__
+static void ResampleThread(void *arg){
+	ResampleStripe((NoRSX_ResampleJob*)arg);
+	sysThreadExit(0);
+}
+#else
+static void *ResampleThread(void *arg){
+	ResampleStripe((NoRSX_ResampleJob*)arg);
+	return NULL;
+}
+#endif
+
+/*
+ * Resizes a 32 bit image into a caller provided buffer. Pitches are in bytes.
+ * 'threads' is clamped to [1, RESAMPLE_MAX_THREADS]; 2 uses both PPU hardware
+ * threads. Returns 0 on success, -1 on bad arguments or out of memory.
+ */
+static inline int ResampleImage(const u32 *src, u32 src_w, u32 src_h, u32 src_pitch,
+				u32 *dst, u32 dst_w, u32 dst_h, u32 dst_pitch, u32 filter, u32 threads){
+	if(!src || !dst || !src_w || !src_h || !dst_w || !dst_h)
+		return -1;
+	if(threads < 1) threads = 1;
+	if(threads > RESAMPLE_MAX_THREADS) threads = RESAMPLE_MAX_THREADS;
+	if(threads > dst_h) threads = dst_h;
+
+	NoRSX_ResampleTable h, v;
+	memset(&h, 0, sizeof(h));
+	memset(&v, 0, sizeof(v));
+	if(ResampleBuildTable(&h, src_w, dst_w, filter) || ResampleBuildTable(&v, src_h, dst_h, filter)){
+		ResampleFreeTable(&h);
+		ResampleFreeTable(&v);
+		return -1;
+	}
+
+	NoRSX_ResampleJob jobs[RESAMPLE_MAX_THREADS];
+#ifdef __PPU__
+	sys_ppu_thread_t tid[RESAMPLE_MAX_THREADS];
+#else
+	pthread_t tid[RESAMPLE_MAX_THREADS];
+#endif
+	int started[RESAMPLE_MAX_THREADS] = {0};
+
+	for(u32 i = 0; i < threads; i++){
+		jobs[i].src = (const u8*)src;
+		jobs[i].src_pitch = src_pitch;
+		jobs[i].dst = (u8*)dst;
+		jobs[i].dst_w = dst_w;
+		jobs[i].dst_pitch = dst_pitch;
+		jobs[i].y0 = dst_h * i / threads;
+		jobs[i].y1 = dst_h * (i + 1) / threads;
+		jobs[i].h = &h;
+		jobs[i].v = &v;
+		jobs[i].error = 0;
+	}
+	for(u32 i = 1; i < threads; i++){
+#ifdef __PPU__
+		started[i] = sysThreadCreate(&tid[i], ResampleThread, &jobs[i], 1000, 0x4000, THREAD_JOINABLE, (char*)"NoRSX Resample") == 0;
+#else
+		started[i] = pthread_create(&tid[i], NULL, ResampleThread, &jobs[i]) == 0;
+#endif
+		if(!started[i])
+			ResampleStripe(&jobs[i]);
+	}
+	ResampleStripe(&jobs[0]);
+
+	int ret = jobs[0].error;
+	for(u32 i = 1; i < threads; i++){
+		if(started[i]){
+#ifdef __PPU__
+			u64 retval;
+			sysThreadJoin(tid[i], &retval);
+#else
+			pthread_join(tid[i], NULL);
+#endif
+		}
+		if(jobs[i].error)
+			ret = jobs[i].error;
+	}
+	ResampleFreeTable(&h);
+	ResampleFreeTable(&v);
+	return ret;
+}
+
+#endif
@@ -0,0 +1,585 @@
+/*
+ * Copyright (c) 2013, Giovanni Dante Grazioli (deroad)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef __NORSX_SPURASTER_H__
+#define __NORSX_SPURASTER_H__
+
+/*
+ * SPU back end for framebuffer fills, gradients and blits.
+ *
+ * An operation is cut in horizontal stripes, one NoRSX_RasterJob per
+ * worker. The job code (RasterRunJob) streams one row at a time through
+ * two local buffers: while row N is processed, row N+1 is fetched and
+ * row N-1 is written back. The same code is built three ways:
+ *
+ *  - on the SPU the transfers are mfc_get/mfc_put;
+ *  - on the PPU and on the host they are memcpy, and the jobs run on
+ *    PPU threads / pthreads, which is what the correctness tests use.
+ *
+ * The SPU kernel is a two line program built with spu-gcc and linked in
+ * with bin2o, like any other SPU image:
+ *
+ *     #include <NoRSX/SpuRaster.h>
+ *     int main(uint64_t slot){ return RasterSpuMain(slot); }
+ *
+ * and is given to SpuRaster::Start(). Call SpuRaster::Sync() before
+ * Flip(): it sleeps on an event queue until every stripe of the pending
+ * operation has reported back on RASTER_SPU_PORT.
+ *
+ * Each stripe times itself (decrementer on the SPU, timebase elsewhere,
+ * both tick at the timebase rate) and an operation is charged the time
+ * of its slowest stripe, so PPU work done between Submit and Sync does
+ * not show up in the SPU figures.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SPU__
+#include <spu_mfcio.h>
+#include <sys/spu_thread.h>
+#include <sys/spu_event.h>
+#else
+#include <malloc.h>
+#include <NoRSX/Min.h>
+#include <NoRSX/Bitmap.h>
+#include <NoRSX/Blit.h>
+#ifdef __PPU__
+#include <sys/spu.h>
+#include <sys/thread.h>
+#include <sys/event_queue.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+#endif
+
+#define RASTER_OP_FILL			1
+#define RASTER_OP_GRADIENT		2
+#define RASTER_OP_COPY			3
+#define RASTER_OP_ALPHA			4
+#define RASTER_OP_QUIT			0xff
+#define RASTER_OP_COUNT			5
+
+#define RASTER_MAX_WORKERS		6
+#define RASTER_MAX_ROW			4092    //pixels: a row and its quadword padding fit one 16 KB DMA
+#define RASTER_SPU_PORT			19      //SPU event port of the stripe completion
+
+/* 128 bytes: one job slot per worker, one DMA to fetch it */
+typedef struct {
+	uint64_t dst;          //address of (0, 0) of the destination
+	uint64_t src;          //address of (0, 0) of the source, if any
+	uint32_t op;
+	uint32_t x;            //destination rectangle
+	uint32_t y0, y1;       //rows of this stripe
+	uint32_t width;
+	uint32_t height;       //full destination height, for the gradient
+	uint32_t dst_pitch;    //bytes
+	uint32_t src_pitch;    //bytes
+	int32_t  src_x, src_y; //source pixel mapped onto (x, y0)
+	uint32_t color1, color2;
+	uint32_t seq;          //request number
+	volatile uint32_t done;//set to seq when the stripe is finished
+	uint32_t ticks;        //time spent on the stripe, measured by the worker
+	uint32_t pad[13];
+} __attribute__((aligned(128))) NoRSX_RasterJob;
+
+static inline uint32_t RasterBlend(uint32_t bg, uint32_t src){
+	uint32_t a = src >> 24;
+	if(a == 0)
+		return bg;
+	uint32_t rb = (((src & 0x00ff00ff) * a) + ((bg & 0x00ff00ff) * (0xff - a))) & 0xff00ff00;
+	uint32_t g  = (((src & 0x0000ff00) * a) + ((bg & 0x0000ff00) * (0xff - a))) & 0x00ff0000;
+	return (src & 0xff000000) | ((rb | g) >> 8);
+}
+
+static inline uint32_t RasterGradient(uint32_t c1, uint32_t c2, uint32_t y, uint32_t height){
+	int32_t h = height > 1 ? (int32_t)height - 1 : 1;
+	uint32_t out = 0;
+	for(int s = 0; s < 32; s += 8){
+		int32_t a = (c1 >> s) & 0xff, b = (c2 >> s) & 0xff;
+		out |= (uint32_t)(a + (b - a) * (int32_t)y / h) << s;
+	}
+	return out;
+}
+
+/* transfers: 'ls' has the same low 4 bits as 'ea'; gets are whole quadwords, puts are exact */
+#ifdef __SPU__
+static inline void RasterGet(void *ls, uint64_t ea, uint32_t size, uint32_t tag){
+	mfc_get(ls, ea, size, tag, 0, 0);
+}
+/* writes exactly [ea, ea+size): 4 byte transfers on the ragged edges so neighbour rows are never touched */
+static inline void RasterPut(void *ls, uint64_t ea, uint32_t size, uint32_t tag){
+	uint8_t *p = (uint8_t*)ls;
+	while(size && (ea & 15)){
+		mfc_put(p, ea, 4, tag, 0, 0);
+		p += 4; ea += 4; size -= 4;
+	}
+	if(size & ~15){
+		mfc_put(p, ea, size & ~15, tag, 0, 0);
+		p += size & ~15; ea += size & ~15; size &= 15;
+	}
+	while(size){
+		mfc_put(p, ea, 4, tag, 0, 0);
+		p += 4; ea += 4; size -= 4;
+	}
+}
+static inline void RasterWait(uint32_t tag){
+	mfc_write_tag_mask(1 << tag);
+	mfc_read_tag_status_all();
+}
+#else
+static inline void RasterGet(void *ls, uint64_t ea, uint32_t size, uint32_t tag){
+	(void)tag;
+	memcpy(ls, (const void*)(uintptr_t)ea, size);
+}
+static inline void RasterPut(void *ls, uint64_t ea, uint32_t size, uint32_t tag){
+	(void)tag;
+	memcpy((void*)(uintptr_t)ea, ls, size);
+}
+static inline void RasterWait(uint32_t tag){
+	(void)tag;
+}
+#endif
+
+typedef struct {
+	uint8_t dst[2][RASTER_MAX_ROW*4 + 32] __attribute__((aligned(128)));
+	uint8_t src[2][RASTER_MAX_ROW*4 + 32] __attribute__((aligned(128)));
+} NoRSX_RasterBuffers;
+
+/* quadword aligned span covering [ea, ea+bytes) */
+static inline void RasterSpan(uint64_t ea, uint32_t bytes, uint64_t *start, uint32_t *size){
+	*start = ea & ~15ULL;
+	*size = (uint32_t)(((ea + bytes + 15) & ~15ULL) - *start);
+}
+
+static inline void RasterFetch(const NoRSX_RasterJob *job, NoRSX_RasterBuffers *b, int i, uint32_t y){
+	uint64_t ea, start;
+	uint32_t size;
+	ea = job->dst + (uint64_t)y * job->dst_pitch + job->x * 4;
+	RasterSpan(ea, job->width * 4, &start, &size);
+	RasterGet(b->dst[i], start, size, i);
+	if(job->op == RASTER_OP_COPY || job->op == RASTER_OP_ALPHA){
+		ea = job->src + (uint64_t)(job->src_y + (y - job->y0)) * job->src_pitch + job->src_x * 4;
+		RasterSpan(ea, job->width * 4, &start, &size);
+		RasterGet(b->src[i], start, size, i);
+	}
+}
+
+static inline void RasterProcess(const NoRSX_RasterJob *job, NoRSX_RasterBuffers *b, int i, uint32_t y){
+	uint32_t *d = (uint32_t*)(b->dst[i] + ((job->dst + (uint64_t)y * job->dst_pitch + job->x * 4) & 15));
+	const uint32_t *s = (const uint32_t*)(b->src[i] +
+		((job->src + (uint64_t)(job->src_y + (y - job->y0)) * job->src_pitch + job->src_x * 4) & 15));
+	uint32_t n = job->width, x;
+	switch(job->op){
+	case RASTER_OP_FILL:
+	case RASTER_OP_GRADIENT: {
+		uint32_t c = job->op == RASTER_OP_FILL ? job->color1 : RasterGradient(job->color1, job->color2, y, job->height);
+		x = 0;
+#ifdef __SPU__
+		for(; x < n && ((uintptr_t)(d + x) & 15); x++)
+			d[x] = c;
+		vec_uint4 v = spu_splats(c);
+		for(; x + 4 <= n; x += 4)
+			*(vec_uint4*)(d + x) = v;
+#endif
+		for(; x < n; x++)
+			d[x] = c;
+		break;
+	}
+	case RASTER_OP_COPY:
+		memcpy(d, s, n * 4);
+		break;
+	case RASTER_OP_ALPHA:
+		for(x = 0; x < n; x++)
+			d[x] = RasterBlend(d[x], s[x]);
+		break;
+	}
+}
+
+/* runs one stripe; returns the number of pixels written */
+static inline uint32_t RasterRunJob(const NoRSX_RasterJob *job, NoRSX_RasterBuffers *b){
+	if(job->y0 >= job->y1 || job->width == 0 || job->width > RASTER_MAX_ROW)
+		return 0;
+	uint32_t rows = job->y1 - job->y0;
+	RasterFetch(job, b, 0, job->y0);
+	for(uint32_t r = 0; r < rows; r++){
+		int i = r & 1;
+		uint32_t y = job->y0 + r;
+		if(r + 1 < rows){
+			RasterWait(!i);    //previous put from this buffer
+			RasterFetch(job, b, !i, y + 1);
+		}
+		RasterWait(i);
+		RasterProcess(job, b, i, y);
+
+		uint64_t ea = job->dst + (uint64_t)y * job->dst_pitch + job->x * 4;
+		RasterPut(b->dst[i] + (ea & 15), ea, job->width * 4, i);
+	}
+	RasterWait(0);
+	RasterWait(1);
+	return rows * job->width;
+}
+
+#ifdef __SPU__
+
+static NoRSX_RasterBuffers raster_ls;
+static NoRSX_RasterJob raster_job;
+
+/* SPU thread main loop: wait for a kick in the inbound mailbox, run the job, mark it done, send an event. */
+static inline int RasterSpuMain(uint64_t slot){
+	spu_write_decrementer(0xffffffff);
+	for(;;){
+		uint32_t start;
+		spu_read_in_mbox();
+		mfc_get(&raster_job, slot, sizeof(raster_job), 2, 0, 0);
+		RasterWait(2);
+		if(raster_job.op == RASTER_OP_QUIT)
+			break;
+		start = spu_read_decrementer();
+		RasterRunJob(&raster_job, &raster_ls);
+		raster_job.ticks = start - spu_read_decrementer();
+		raster_job.done = raster_job.seq;
+		mfc_putf(&raster_job, slot, sizeof(raster_job), 2, 0, 0);
+		RasterWait(2);
+		spu_thread_send_event(RASTER_SPU_PORT, raster_job.seq & EVENT_DATA0_MASK, 0);
+	}
+	spu_thread_exit(0);
+	return 0;
+}
+
+#else
+
+#define RASTER_MODE_PPU			0    //run the stripes on the calling thread
+#define RASTER_MODE_THREADS		1    //PPU threads (pthreads on the host)
+#define RASTER_MODE_SPU			2
+
+/* PPU and host side of the stripe timing */
+static inline void RasterRunTimed(NoRSX_RasterJob *job, NoRSX_RasterBuffers *b){
+	u64 start = BlitTimebase();
+	RasterRunJob(job, b);
+	job->ticks = (uint32_t)(BlitTimebase() - start);
+}
+
+typedef struct {
+	uint64_t ticks[RASTER_OP_COUNT][3];   //per op, per mode
+	uint64_t pixels[RASTER_OP_COUNT][3];
+} NoRSX_RasterStats;
+
+class SpuRaster{
+public:
+	SpuRaster(Minimum *g){
+		G=g;
+		mode = RASTER_MODE_PPU;
+		workers = 1;
+		seq = 0;
+		pending_op = 0;
+		pending_jobs = 0;
+		jobs = (NoRSX_RasterJob*)memalign(128, sizeof(NoRSX_RasterJob) * RASTER_MAX_WORKERS);
+		buffers = NULL;
+		ppu_buffers = (NoRSX_RasterBuffers*)memalign(128, sizeof(NoRSX_RasterBuffers));
+		if(jobs)
+			memset(jobs, 0, sizeof(NoRSX_RasterJob) * RASTER_MAX_WORKERS);
+		memset(&stats, 0, sizeof(stats));
+#ifdef __PPU__
+		group = 0;
+		queue = 0;
+#endif
+	}
+	~SpuRaster(){
+		Stop();
+		free(jobs);
+		free(ppu_buffers);
+	}
+
+#ifdef __PPU__
+	//elf: SPU image built from RasterSpuMain(). Returns 0 on success.
+	int Start(const void *elf, uint32_t spus){
+		Stop();
+		if(!jobs)
+			return -1;
+		if(spus < 1) spus = 1;
+		if(spus > RASTER_MAX_WORKERS) spus = RASTER_MAX_WORKERS;
+		sys_event_queue_attr_t qattr = {SYS_EVENT_QUEUE_FIFO, SYS_EVENT_QUEUE_PPU, "raster"};
+		if(sysEventQueueCreate(&queue, &qattr, SYS_EVENT_QUEUE_KEY_LOCAL, RASTER_MAX_WORKERS * 2))
+			return -1;
+		if(sysSpuImageImport(&image, elf, SPU_IMAGE_PROTECT)){
+			sysEventQueueDestroy(queue, 0);
+			queue = 0;
+			return -1;
+		}
+		sysSpuThreadGroupAttribute gattr = {sizeof("NoRSX Raster"), (u32)(uintptr_t)"NoRSX Raster", 0, 0};
+		if(sysSpuThreadGroupCreate(&group, spus, 100, &gattr)){
+			sysSpuImageClose(&image);
+			sysEventQueueDestroy(queue, 0);
+			group = 0;
+			queue = 0;
+			return -1;
+		}
+		uint32_t ok = 0;
+		for(; ok < spus; ok++){
+			sysSpuThreadAttribute attr = {(u32)(uintptr_t)"NoRSX Raster", sizeof("NoRSX Raster"), SPU_THREAD_ATTR_NONE};
+			sysSpuThreadArgument arg = {(u64)(uintptr_t)&jobs[ok], 0, 0, 0};
+			if(sysSpuThreadInitialize(&threads[ok], group, ok, &image, &attr, &arg) ||
+			   sysSpuThreadConnectEvent(threads[ok], queue, SPU_THREAD_EVENT_USER, RASTER_SPU_PORT))
+				break;
+		}
+		if(ok < spus || sysSpuThreadGroupStart(group)){
+			sysSpuThreadGroupDestroy(group);
+			sysSpuImageClose(&image);
+			sysEventQueueDestroy(queue, 0);
+			group = 0;
+			queue = 0;
+			return -1;
+		}
+		workers = spus;
+		mode = RASTER_MODE_SPU;
+		return 0;
+	}
+#endif
+
+	//same job code on PPU threads, or pthreads on the host
+	int StartThreads(uint32_t count){
+		Stop();
+		if(!jobs)
+			return -1;
+		if(count < 1) count = 1;
+		if(count > RASTER_MAX_WORKERS) count = RASTER_MAX_WORKERS;
+		buffers = (NoRSX_RasterBuffers*)memalign(128, sizeof(NoRSX_RasterBuffers) * count);
+		if(!buffers)
+			return -1;
+		workers = count;
+		mode = RASTER_MODE_THREADS;
+		return 0;
+	}
+
+	void Stop(){
+		Sync();
+#ifdef __PPU__
+		if(mode == RASTER_MODE_SPU && group){
+			u32 cause, status;
+			for(uint32_t i = 0; i < workers; i++){
+				jobs[i].op = RASTER_OP_QUIT;
+				__asm__ volatile("lwsync" ::: "memory");
+				sysSpuThreadWriteMb(threads[i], 1);
+			}
+			sysSpuThreadGroupJoin(group, &cause, &status);
+			for(uint32_t i = 0; i < workers; i++)
+				sysSpuThreadDisconnectEvent(threads[i], SPU_THREAD_EVENT_USER, RASTER_SPU_PORT);
+			sysSpuThreadGroupDestroy(group);
+			sysSpuImageClose(&image);
+			sysEventQueueDestroy(queue, 0);
+			group = 0;
+			queue = 0;
+		}
+#endif
+		free(buffers);
+		buffers = NULL;
+		mode = RASTER_MODE_PPU;
+		workers = 1;
+	}
+
+	//Background::Mono
+	void Fill(uint32_t Color){
+		Submit(RASTER_OP_FILL, G->buffer, 0, G->width, G->height, G->width * 4, NULL, 0, 0, 0, Color, 0);
+	}
+	//Background::Gradient, top to bottom
+	void Gradient(uint32_t Color1, uint32_t Color2){
+		Submit(RASTER_OP_GRADIENT, G->buffer, 0, G->width, G->height, G->width * 4, NULL, 0, 0, 0, Color1, Color2);
+	}
+	//Bitmap::DrawBitmap
+	void DrawBitmap(NoRSX_Bitmap *a){
+		if(a->load != 1)
+			return;
+		uint32_t w = a->width < G->width ? a->width : G->width;
+		uint32_t h = a->height < G->height ? a->height : G->height;
+		Submit(RASTER_OP_COPY, G->buffer, 0, w, h, G->width * 4, a->bitmap, a->width * 4, 0, 0, 0, 0);
+	}
+	//Image::DrawIMG / AlphaDrawIMG of a 32 bit image with its pitch in bytes
+	void Blit(int X, int Y, const uint32_t *src, uint32_t Width, uint32_t Height, uint32_t Pitch, bool alpha){
+		int sx = 0, sy = 0, w = Width, h = Height;
+		if(X < 0){ sx = -X; w += X; X = 0; }
+		if(Y < 0){ sy = -Y; h += Y; Y = 0; }
+		if(X + w > G->width) w = G->width - X;
+		if(Y + h > G->height) h = G->height - Y;
+		if(w <= 0 || h <= 0)
+			return;
+		Submit(alpha ? RASTER_OP_ALPHA : RASTER_OP_COPY, G->buffer + Y * G->width, X, w, h, G->width * 4,
+		       src, Pitch, sx, sy, 0, 0);
+	}
+
+	//waits for the pending operation; call it before Flip()
+	void Sync(){
+		if(!pending_op)
+			return;
+#ifdef __PPU__
+		if(mode == RASTER_MODE_SPU){
+			//one event per kicked stripe, sent after its job slot is written back
+			sys_event_t ev;
+			for(uint32_t i = 0; i < pending_jobs; i++)
+				while(sysEventQueueReceive(queue, &ev, 0) != 0)
+					;
+			__asm__ volatile("lwsync" ::: "memory");
+		}
+#endif
+		uint64_t ticks = 0;
+		for(uint32_t i = 0; i < pending_jobs; i++)
+			if(jobs[i].ticks > ticks)
+				ticks = jobs[i].ticks;
+		Account(pending_op, mode, pending_pixels, ticks);
+		pending_op = 0;
+	}
+
+	int GetMode() const { return mode; }
+	const NoRSX_RasterStats &GetStats() const { return stats; }
+
+	//PPU time per pixel divided by the time per pixel of the current mode; 0 until both were measured
+	float Speedup(uint32_t op) const {
+		if(op >= RASTER_OP_COUNT || !stats.pixels[op][RASTER_MODE_PPU] || !stats.pixels[op][mode] || !stats.ticks[op][mode])
+			return 0.0f;
+		double ppu = (double)stats.ticks[op][RASTER_MODE_PPU] / stats.pixels[op][RASTER_MODE_PPU];
+		double cur = (double)stats.ticks[op][mode] / stats.pixels[op][mode];
+		return (float)(ppu / cur);
+	}
+
+protected:
+	Minimum *G;
+	int mode;
+	uint32_t workers;
+	uint32_t seq;
+	NoRSX_RasterJob *jobs;
+	NoRSX_RasterBuffers *buffers;
+	NoRSX_RasterBuffers *ppu_buffers;    //RASTER_MODE_PPU, kept for the life of the object
+	NoRSX_RasterStats stats;
+	uint32_t pending_op;
+	uint64_t pending_pixels;
+	uint32_t pending_jobs;     //stripes of the pending operation
+#ifdef __PPU__
+	sysSpuImage image;
+	sys_spu_group_t group;
+	sys_event_queue_t queue;
+	sys_spu_thread_t threads[RASTER_MAX_WORKERS];
+#endif
+
+	void Account(uint32_t op, int m, uint64_t pixels, uint64_t ticks){
+		stats.ticks[op][m] += ticks;
+		stats.pixels[op][m] += pixels;
+	}
+
+#ifdef __PPU__
+	static void Worker(void *arg){
+		void **p = (void**)arg;
+		RasterRunTimed((NoRSX_RasterJob*)p[0], (NoRSX_RasterBuffers*)p[1]);
+		sysThreadExit(0);
+	}
+#else
+	static void *Worker(void *arg){
+		void **p = (void**)arg;
+		RasterRunTimed((NoRSX_RasterJob*)p[0], (NoRSX_RasterBuffers*)p[1]);
+		return NULL;
+	}
+#endif
+
+	void Submit(uint32_t op, uint32_t *dst, uint32_t x, uint32_t w, uint32_t h, uint32_t dst_pitch,
+		    const uint32_t *src, uint32_t src_pitch, int32_t sx, int32_t sy, uint32_t c1, uint32_t c2){
+		Sync();
+		if(!jobs)
+			return;
+		seq++;
+		uint32_t n = workers < h ? workers : h;
+		pending_op = op;
+		pending_pixels = (uint64_t)w * h;
+		pending_jobs = n;
+
+		for(uint32_t i = 0; i < n; i++){
+			NoRSX_RasterJob *j = &jobs[i];
+			j->dst = (uint64_t)(uintptr_t)dst;
+			j->src = (uint64_t)(uintptr_t)src;
+			j->op = op;
+			j->x = x;
+			j->y0 = h * i / n;
+			j->y1 = h * (i + 1) / n;
+			j->width = w;
+			j->height = G->height;
+			j->dst_pitch = dst_pitch;
+			j->src_pitch = src_pitch;
+			j->src_x = sx;
+			j->src_y = sy + j->y0;
+			j->color1 = c1;
+			j->color2 = c2;
+			j->seq = seq;
+			j->done = 0;
+			j->ticks = 0;
+		}
+		for(uint32_t i = n; i < workers; i++)
+			jobs[i].done = seq;    //idle workers
+
+		if(mode == RASTER_MODE_SPU){
+#ifdef __PPU__
+			__asm__ volatile("lwsync" ::: "memory");
+			for(uint32_t i = 0; i < n; i++)
+				sysSpuThreadWriteMb(threads[i], 1);
+#endif
+			return;
+		}
+
+		if(mode == RASTER_MODE_PPU){
+			if(ppu_buffers)
+				RasterRunTimed(&jobs[0], ppu_buffers);
+		}else{
+			void *args[RASTER_MAX_WORKERS][2];
+#ifdef __PPU__
+			sys_ppu_thread_t tid[RASTER_MAX_WORKERS];
+#else
+			pthread_t tid[RASTER_MAX_WORKERS];
+#endif
+			int started[RASTER_MAX_WORKERS];
+			for(uint32_t i = 0; i < n; i++){
+				args[i][0] = &jobs[i];
+				args[i][1] = &buffers[i];
+#ifdef __PPU__
+				started[i] = sysThreadCreate(&tid[i], Worker, args[i], 1000, 0x4000, THREAD_JOINABLE, (char*)"NoRSX Raster") == 0;
+#else
+				started[i] = pthread_create(&tid[i], NULL, Worker, args[i]) == 0;
+#endif
+				if(!started[i])
+					RasterRunTimed(&jobs[i], &buffers[i]);
+			}
+			for(uint32_t i = 0; i < n; i++){
+				if(!started[i])
+					continue;
+#ifdef __PPU__
+				u64 ret;
+				sysThreadJoin(tid[i], &ret);
+#else
+				pthread_join(tid[i], NULL);
+#endif
+			}
+		}
+		for(uint32_t i = 0; i < n; i++)
+			jobs[i].done = seq;
+	}
+};
+
+#endif
+
+#endif
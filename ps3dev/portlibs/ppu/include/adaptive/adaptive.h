@@ -0,0 +1,702 @@
+/*! \file adaptive.h
+ \brief Adaptive spinning mutex and condition variable.
+
+ A user space lock word in front of the lv2 lightweight mutex and
+ condition variable. An uncontended lock or unlock is one lwarx/stwcx.
+ sequence. A contended lock first spins on the lock word, reading it
+ with lwarx at low SMT priority (or 1,1,1) so the other hardware thread
+ holding the lock runs faster, and only then sleeps in the kernel. The
+ spin budget of each mutex adapts: it grows toward twice the iterations
+ that last succeeded and shrinks when spinning ends in a sleep anyway.
+
+ The lock word is 0 (free), 1 (locked) or 2 (locked, maybe sleepers). A
+ thread going to sleep sets 2 under the sys_lwmutex and waits on the
+ sys_lwcond. An unlock that swaps out 2 signals it, so the kernel is only
+ entered when a thread actually sleeps.
+
+ Recursive mutexes and timeouts behave as with sysLwMutexLock: the
+ timeout is in microseconds, 0 waits forever, and errors use the lv2
+ error values.
+
+ Each mutex keeps statistics (acquisitions, contended acquisitions,
+ spins, sleeps, timeouts, hold time). Mutexes created with a name are
+ registered, and \ref adaptiveDumpStats prints all of them.
+
+ On the host the kernel objects are a pthread mutex and condition
+ variable, for the stress tests.
+
+ - #define ADAPTIVE_IMPLEMENTATION in one source file.
+*/
+
+#ifndef __ADAPTIVE_H__
+#define __ADAPTIVE_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <ppu-types.h>
+
+#ifdef __PPU__
+#include <ppu-asm.h>
+#include <sys/atomic.h>
+#include <sys/thread.h>
+#include <sys/systime.h>
+#include <lv2/mutex.h>
+#include <lv2/cond.h>
+#include <lv2/thread.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+/* same values as the lv2 errors */
+#define ADAPTIVE_OK             0
+#define ADAPTIVE_EINVAL         0x80010002
+#define ADAPTIVE_EDEADLK        0x80010008
+#define ADAPTIVE_EPERM          0x80010009
+#define ADAPTIVE_EBUSY          0x8001000a
+#define ADAPTIVE_ETIMEDOUT      0x8001000b
+
+#define ADAPTIVE_RECURSIVE      1           /*!< the owner may lock again */
+
+#ifndef ADAPTIVE_SPIN_MIN
+#define ADAPTIVE_SPIN_MIN       16          /*!< smallest spin budget */
+#endif
+#ifndef ADAPTIVE_SPIN_MAX
+#define ADAPTIVE_SPIN_MAX       4000        /*!< largest spin budget, about 10 us */
+#endif
+
+#define ADAPTIVE_NAME_MAX       15
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! \brief Contention statistics of one mutex. */
+typedef struct _adaptive_stats
+{
+	u64 acquisitions;               /*!< \brief successful locks, recursive ones included */
+	u64 contended;                  /*!< \brief locks that found the mutex held */
+	u64 spins;                      /*!< \brief spin iterations */
+	u64 spin_acquired;              /*!< \brief contended locks won while spinning */
+	u64 sleeps;                     /*!< \brief waits in the kernel */
+	u64 timeouts;
+	u64 hold_ticks;                 /*!< \brief timebase ticks held, summed */
+	u64 max_hold_ticks;
+	u32 spin_limit;                 /*!< \brief current spin budget */
+	u32 pad;
+} adaptiveStats;
+
+typedef struct _adaptive_mutex
+{
+	volatile u32 lock;              /*!< \brief 0 free, 1 locked, 2 locked with sleepers */
+	u32 flags;
+	volatile u64 owner;             /*!< \brief thread id of the owner, 0: none */
+	u32 recursion;
+	u32 spin_limit;
+	u64 acquired_at;                /*!< \brief timebase at the outermost lock */
+	adaptiveStats stats;
+	struct _adaptive_mutex *next;   /*!< \brief registry of named mutexes */
+	char name[ADAPTIVE_NAME_MAX + 1];
+#ifdef __PPU__
+	sys_lwmutex_t sleep_mutex;
+	sys_lwcond_t sleep_cond;
+#else
+	pthread_mutex_t sleep_mutex;
+	pthread_cond_t sleep_cond;
+#endif
+} __attribute__((aligned(128))) adaptiveMutex;
+
+typedef struct _adaptive_cond
+{
+	volatile u32 seq;               /*!< \brief incremented by every signal */
+	volatile u32 sleepers;          /*!< \brief threads in the kernel wait */
+	u64 signals;
+	u64 wakeups_spinning;           /*!< \brief waits ended while spinning */
+	u64 sleeps;
+#ifdef __PPU__
+	sys_lwmutex_t sleep_mutex;
+	sys_lwcond_t sleep_cond;
+#else
+	pthread_mutex_t sleep_mutex;
+	pthread_cond_t sleep_cond;
+#endif
+} __attribute__((aligned(128))) adaptiveCond;
+
+/*! \brief Create a mutex.
+ \param flags
+ 0 or ADAPTIVE_RECURSIVE.
+ \param name
+ Name shown by \ref adaptiveDumpStats, NULL to keep the mutex out of the registry.
+*/
+s32 adaptiveMutexCreate(adaptiveMutex *mutex, u32 flags, const char *name);
+s32 adaptiveMutexDestroy(adaptiveMutex *mutex);
+
+/*! \brief Contended part of \ref adaptiveMutexLock: spin, then sleep. */
+s32 adaptiveMutexLockSlow(adaptiveMutex *mutex, u64 timeout_usec);
+
+/*! \brief Wake a sleeper after an unlock that swapped out 2. */
+void adaptiveMutexWake(adaptiveMutex *mutex);
+
+s32 adaptiveCondCreate(adaptiveCond *cond);
+s32 adaptiveCondDestroy(adaptiveCond *cond);
+
+/*! \brief Release \p mutex, wait for a signal, take \p mutex back (also after a timeout).
+ \return ADAPTIVE_OK, or ADAPTIVE_ETIMEDOUT
+*/
+s32 adaptiveCondWait(adaptiveCond *cond, adaptiveMutex *mutex, u64 timeout_usec);
+s32 adaptiveCondSignal(adaptiveCond *cond);
+s32 adaptiveCondSignalAll(adaptiveCond *cond);
+
+/*! \brief Copy of the statistics of a mutex. */
+void adaptiveMutexGetStats(adaptiveMutex *mutex, adaptiveStats *stats);
+
+/*! \brief Zero the statistics of every registered mutex. */
+void adaptiveResetStats(void);
+
+/*! \brief Print one line per registered mutex to \p out (stdout for NULL). */
+void adaptiveDumpStats(FILE *out);
+
+/* atomics and clocks */
+
+#ifdef __PPU__
+
+static inline u64 adaptive_self(void)
+{
+	sys_ppu_thread_t id;
+
+	sysThreadGetId(&id);
+	return (u64) id + 1;
+}
+
+static inline u64 adaptive_ticks(void)
+{
+	return __gettime();
+}
+
+static inline int adaptive_cas(volatile u32 *p, u32 old, u32 value)
+{
+	u32 prev = (u32) __cmpxchg_u32((volatile unsigned int *) p, old, value);
+	__asm__ volatile ("isync" ::: "memory");
+	return prev == old;
+}
+
+static inline u32 adaptive_swap_release(volatile u32 *p, u32 value)
+{
+	__asm__ volatile ("lwsync" ::: "memory");
+	return __xchg_u32(p, value);
+}
+
+/* swap that may take the lock: ordered both ways */
+static inline u32 adaptive_swap(volatile u32 *p, u32 value)
+{
+	u32 prev;
+
+	__asm__ volatile ("lwsync" ::: "memory");
+	prev = __xchg_u32(p, value);
+	__asm__ volatile ("isync" ::: "memory");
+	return prev;
+}
+
+/* the hint lowers this hardware thread's priority while it waits */
+static inline u32 adaptive_spin_read(volatile u32 *p)
+{
+	u32 v;
+
+	__asm__ volatile ("or 1,1,1\n\tlwarx %0,0,%1" : "=r" (v) : "r" (p) : "memory");
+	return v;
+}
+
+static inline void adaptive_spin_end(void)
+{
+	__asm__ volatile ("or 2,2,2" ::: "memory");
+}
+
+#define adaptive_full_fence()   __asm__ volatile ("sync" ::: "memory")
+
+#else
+
+static inline u64 adaptive_self(void)
+{
+	return (u64) (uintptr_t) pthread_self() + 1;
+}
+
+static inline u64 adaptive_ticks(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline int adaptive_cas(volatile u32 *p, u32 old, u32 value)
+{
+	return __atomic_compare_exchange_n(p, &old, value, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline u32 adaptive_swap_release(volatile u32 *p, u32 value)
+{
+	return __atomic_exchange_n(p, value, __ATOMIC_RELEASE);
+}
+
+static inline u32 adaptive_swap(volatile u32 *p, u32 value)
+{
+	return __atomic_exchange_n(p, value, __ATOMIC_ACQ_REL);
+}
+
+static inline u32 adaptive_spin_read(volatile u32 *p)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+	return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static inline void adaptive_spin_end(void)
+{
+}
+
+#define adaptive_full_fence()   __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#endif
+
+/* other threads read owner to detect recursion, it only ever matches the reader */
+#define adaptive_get_owner(m)       __atomic_load_n(&(m)->owner, __ATOMIC_RELAXED)
+#define adaptive_set_owner(m, v)    __atomic_store_n(&(m)->owner, (v), __ATOMIC_RELAXED)
+
+/*! \brief Lock; the fast path is one compare and swap. */
+static inline s32 adaptiveMutexLock(adaptiveMutex *mutex, u64 timeout_usec)
+{
+	if (adaptive_cas(&mutex->lock, 0, 1)) {
+		adaptive_set_owner(mutex, adaptive_self());
+		mutex->recursion = 1;
+		mutex->acquired_at = adaptive_ticks();
+		mutex->stats.acquisitions++;
+		return ADAPTIVE_OK;
+	}
+	return adaptiveMutexLockSlow(mutex, timeout_usec);
+}
+
+static inline s32 adaptiveMutexTryLock(adaptiveMutex *mutex)
+{
+	u64 self = adaptive_self();
+
+	if (adaptive_cas(&mutex->lock, 0, 1)) {
+		adaptive_set_owner(mutex, self);
+		mutex->recursion = 1;
+		mutex->acquired_at = adaptive_ticks();
+		mutex->stats.acquisitions++;
+		return ADAPTIVE_OK;
+	}
+	if (adaptive_get_owner(mutex) == self && (mutex->flags & ADAPTIVE_RECURSIVE)) {
+		mutex->recursion++;
+		mutex->stats.acquisitions++;
+		return ADAPTIVE_OK;
+	}
+	return ADAPTIVE_EBUSY;
+}
+
+static inline s32 adaptiveMutexUnlock(adaptiveMutex *mutex)
+{
+	u64 held;
+
+	if (adaptive_get_owner(mutex) != adaptive_self())
+		return ADAPTIVE_EPERM;
+	if (--mutex->recursion)
+		return ADAPTIVE_OK;
+
+	held = adaptive_ticks() - mutex->acquired_at;
+	mutex->stats.hold_ticks += held;
+	if (held > mutex->stats.max_hold_ticks)
+		mutex->stats.max_hold_ticks = held;
+	adaptive_set_owner(mutex, 0);
+	if (adaptive_swap_release(&mutex->lock, 0) == 2)
+		adaptiveMutexWake(mutex);
+	return ADAPTIVE_OK;
+}
+
+#ifdef ADAPTIVE_IMPLEMENTATION
+
+#ifndef __PPU__
+#include <errno.h>
+#include <string.h>
+
+static u64 adaptive_ticks_per_sec(void)
+{
+	return 1000000000ULL;
+}
+
+static u64 adaptive_usecs(void)
+{
+	return adaptive_ticks() / 1000;
+}
+
+static s32 adaptive_kernel_create(pthread_mutex_t *m, pthread_cond_t *c, const char *name)
+{
+	pthread_condattr_t attr;
+
+	(void) name;
+	if (pthread_mutex_init(m, NULL))
+		return ADAPTIVE_EINVAL;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	if (pthread_cond_init(c, &attr)) {
+		pthread_mutex_destroy(m);
+		return ADAPTIVE_EINVAL;
+	}
+	return ADAPTIVE_OK;
+}
+
+static void adaptive_kernel_destroy(pthread_mutex_t *m, pthread_cond_t *c)
+{
+	pthread_cond_destroy(c);
+	pthread_mutex_destroy(m);
+}
+
+#define adaptive_kernel_lock(m)     pthread_mutex_lock(m)
+#define adaptive_kernel_unlock(m)   pthread_mutex_unlock(m)
+#define adaptive_kernel_signal(c)   pthread_cond_signal(c)
+#define adaptive_kernel_broadcast(c) pthread_cond_broadcast(c)
+
+/* returns non zero on timeout */
+static int adaptive_kernel_wait(pthread_cond_t *c, pthread_mutex_t *m, u64 timeout_usec)
+{
+	struct timespec ts;
+	u64 ns;
+
+	if (!timeout_usec)
+		return pthread_cond_wait(c, m);
+	ns = adaptive_ticks() + timeout_usec * 1000;
+	ts.tv_sec = ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+	return pthread_cond_timedwait(c, m, &ts) == ETIMEDOUT;
+}
+
+static pthread_mutex_t adaptive_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+#define adaptive_registry_acquire()     pthread_mutex_lock(&adaptive_registry_lock)
+#define adaptive_registry_release()     pthread_mutex_unlock(&adaptive_registry_lock)
+
+#else
+
+#include <string.h>
+
+static u64 adaptive_ticks_per_sec(void)
+{
+	return sysGetTimebaseFrequency();
+}
+
+static u64 adaptive_usecs(void)
+{
+	return sysGetSystemTime();
+}
+
+static s32 adaptive_kernel_create(sys_lwmutex_t *m, sys_lwcond_t *c, const char *name)
+{
+	sys_lwmutex_attr_t mattr = { SYS_LWMUTEX_PROTOCOL_FIFO, SYS_LWMUTEX_ATTR_NOT_RECURSIVE, "" };
+	sys_lwcond_attr_t cattr = { "" };
+
+	if (name) {
+		strncpy(mattr.name, name, sizeof(mattr.name));
+		strncpy(cattr.name, name, sizeof(cattr.name));
+	}
+	if (sysLwMutexCreate(m, &mattr))
+		return ADAPTIVE_EINVAL;
+	if (sysLwCondCreate(c, m, &cattr)) {
+		sysLwMutexDestroy(m);
+		return ADAPTIVE_EINVAL;
+	}
+	return ADAPTIVE_OK;
+}
+
+static void adaptive_kernel_destroy(sys_lwmutex_t *m, sys_lwcond_t *c)
+{
+	sysLwCondDestroy(c);
+	sysLwMutexDestroy(m);
+}
+
+#define adaptive_kernel_lock(m)     sysLwMutexLock((m), 0)
+#define adaptive_kernel_unlock(m)   sysLwMutexUnlock(m)
+#define adaptive_kernel_signal(c)   sysLwCondSignal(c)
+#define adaptive_kernel_broadcast(c) sysLwCondSignalAll(c)
+
+static int adaptive_kernel_wait(sys_lwcond_t *c, sys_lwmutex_t *m, u64 timeout_usec)
+{
+	(void) m;
+	return sysLwCondWait(c, timeout_usec) == ADAPTIVE_ETIMEDOUT;
+}
+
+static sys_lwmutex_t adaptive_registry_mutex;
+static volatile u32 adaptive_registry_state;   /* 0 none, 1 creating, 2 ready */
+
+static void adaptive_registry_acquire(void)
+{
+	if (adaptive_registry_state != 2) {
+		if (adaptive_cas(&adaptive_registry_state, 0, 1)) {
+			sys_lwmutex_attr_t attr = { SYS_LWMUTEX_PROTOCOL_FIFO, SYS_LWMUTEX_ATTR_NOT_RECURSIVE, "adaptreg" };
+			sysLwMutexCreate(&adaptive_registry_mutex, &attr);
+			adaptive_swap_release(&adaptive_registry_state, 2);
+		}
+		while (adaptive_registry_state != 2)
+			sysThreadYield();
+	}
+	sysLwMutexLock(&adaptive_registry_mutex, 0);
+}
+
+#define adaptive_registry_release()     sysLwMutexUnlock(&adaptive_registry_mutex)
+
+#endif
+
+static adaptiveMutex *adaptive_registry;
+
+s32 adaptiveMutexCreate(adaptiveMutex *mutex, u32 flags, const char *name)
+{
+	s32 ret;
+
+	if (!mutex)
+		return ADAPTIVE_EINVAL;
+	memset(mutex, 0, sizeof(*mutex));
+	mutex->flags = flags;
+	mutex->spin_limit = ADAPTIVE_SPIN_MIN * 4;
+	ret = adaptive_kernel_create(&mutex->sleep_mutex, &mutex->sleep_cond, name);
+	if (ret)
+		return ret;
+	if (name) {
+		strncpy(mutex->name, name, ADAPTIVE_NAME_MAX);
+		adaptive_registry_acquire();
+		mutex->next = adaptive_registry;
+		adaptive_registry = mutex;
+		adaptive_registry_release();
+	}
+	return ADAPTIVE_OK;
+}
+
+s32 adaptiveMutexDestroy(adaptiveMutex *mutex)
+{
+	adaptiveMutex **p;
+
+	if (mutex->lock)
+		return ADAPTIVE_EBUSY;
+	if (mutex->name[0]) {
+		adaptive_registry_acquire();
+		for (p = &adaptive_registry; *p; p = &(*p)->next)
+			if (*p == mutex) {
+				*p = mutex->next;
+				break;
+			}
+		adaptive_registry_release();
+	}
+	adaptive_kernel_destroy(&mutex->sleep_mutex, &mutex->sleep_cond);
+	return ADAPTIVE_OK;
+}
+
+s32 adaptiveMutexLockSlow(adaptiveMutex *mutex, u64 timeout_usec)
+{
+	u64 self = adaptive_self();
+	u64 deadline = 0;
+	u32 limit, n;
+	s32 ret = ADAPTIVE_OK;
+
+	if (adaptive_get_owner(mutex) == self) {
+		if (!(mutex->flags & ADAPTIVE_RECURSIVE))
+			return ADAPTIVE_EDEADLK;
+		mutex->recursion++;
+		mutex->stats.acquisitions++;
+		return ADAPTIVE_OK;
+	}
+
+	/* spin while the owner is likely to let go soon */
+	limit = __atomic_load_n(&mutex->spin_limit, __ATOMIC_RELAXED);
+	for (n = 0; n < limit; n++) {
+		if (adaptive_spin_read(&mutex->lock) == 0 && adaptive_cas(&mutex->lock, 0, 1))
+			break;
+	}
+	adaptive_spin_end();
+
+	if (n < limit) {
+		limit += ((int) (2 * n) - (int) limit) / 8;
+		mutex->stats.spin_acquired++;
+	} else {
+		limit -= limit / 4;
+		/* sleep: 2 tells the unlocker to wake us */
+		if (timeout_usec)
+			deadline = adaptive_usecs() + timeout_usec;
+		adaptive_kernel_lock(&mutex->sleep_mutex);
+		while (adaptive_swap(&mutex->lock, 2) != 0) {
+			u64 wait = 0;
+
+			if (deadline) {
+				u64 now = adaptive_usecs();
+				if (now >= deadline) {
+					ret = ADAPTIVE_ETIMEDOUT;
+					break;
+				}
+				wait = deadline - now;
+			}
+			mutex->stats.sleeps++;
+			adaptive_kernel_wait(&mutex->sleep_cond, &mutex->sleep_mutex, wait);
+		}
+		adaptive_kernel_unlock(&mutex->sleep_mutex);
+	}
+	if (limit < ADAPTIVE_SPIN_MIN)
+		limit = ADAPTIVE_SPIN_MIN;
+	if (limit > ADAPTIVE_SPIN_MAX)
+		limit = ADAPTIVE_SPIN_MAX;
+
+	if (ret) {
+		/* not the owner: statistics of the owner are not ours to update */
+		__atomic_fetch_add(&mutex->stats.timeouts, 1, __ATOMIC_RELAXED);
+		return ret;
+	}
+	adaptive_set_owner(mutex, self);
+	mutex->recursion = 1;
+	mutex->acquired_at = adaptive_ticks();
+	__atomic_store_n(&mutex->spin_limit, limit, __ATOMIC_RELAXED);
+	mutex->stats.acquisitions++;
+	mutex->stats.contended++;
+	mutex->stats.spins += n;
+	mutex->stats.spin_limit = limit;
+	return ADAPTIVE_OK;
+}
+
+void adaptiveMutexWake(adaptiveMutex *mutex)
+{
+	adaptive_kernel_lock(&mutex->sleep_mutex);
+	adaptive_kernel_signal(&mutex->sleep_cond);
+	adaptive_kernel_unlock(&mutex->sleep_mutex);
+}
+
+s32 adaptiveCondCreate(adaptiveCond *cond)
+{
+	if (!cond)
+		return ADAPTIVE_EINVAL;
+	memset(cond, 0, sizeof(*cond));
+	return adaptive_kernel_create(&cond->sleep_mutex, &cond->sleep_cond, "adaptcnd");
+}
+
+s32 adaptiveCondDestroy(adaptiveCond *cond)
+{
+	if (cond->sleepers)
+		return ADAPTIVE_EBUSY;
+	adaptive_kernel_destroy(&cond->sleep_mutex, &cond->sleep_cond);
+	return ADAPTIVE_OK;
+}
+
+s32 adaptiveCondWait(adaptiveCond *cond, adaptiveMutex *mutex, u64 timeout_usec)
+{
+	u32 seq = cond->seq, recursion, n;
+	u32 limit = __atomic_load_n(&mutex->spin_limit, __ATOMIC_RELAXED);
+	u64 deadline = timeout_usec ? adaptive_usecs() + timeout_usec : 0;
+	s32 ret = ADAPTIVE_OK;
+
+	if (adaptive_get_owner(mutex) != adaptive_self())
+		return ADAPTIVE_EPERM;
+	/* a recursive owner gives up every level and gets them all back */
+	recursion = mutex->recursion;
+	mutex->recursion = 1;
+	adaptiveMutexUnlock(mutex);
+
+	for (n = 0; n < limit && adaptive_spin_read(&cond->seq) == seq; n++)
+		;
+	adaptive_spin_end();
+
+	if (n < limit) {
+		__atomic_fetch_add(&cond->wakeups_spinning, 1, __ATOMIC_RELAXED);
+	} else {
+		adaptive_kernel_lock(&cond->sleep_mutex);
+		__atomic_fetch_add(&cond->sleepers, 1, __ATOMIC_RELAXED);
+		/* pairs with the fence in signal: one side sees the other */
+		adaptive_full_fence();
+		while (__atomic_load_n(&cond->seq, __ATOMIC_RELAXED) == seq) {
+			u64 wait = 0;
+
+			if (deadline) {
+				u64 now = adaptive_usecs();
+				if (now >= deadline) {
+					ret = ADAPTIVE_ETIMEDOUT;
+					break;
+				}
+				wait = deadline - now;
+			}
+			cond->sleeps++;
+			adaptive_kernel_wait(&cond->sleep_cond, &cond->sleep_mutex, wait);
+		}
+		__atomic_fetch_sub(&cond->sleepers, 1, __ATOMIC_RELAXED);
+		adaptive_kernel_unlock(&cond->sleep_mutex);
+	}
+
+	adaptiveMutexLock(mutex, 0);
+	mutex->recursion = recursion;
+	return ret;
+}
+
+s32 adaptiveCondSignal(adaptiveCond *cond)
+{
+	__atomic_fetch_add(&cond->seq, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&cond->signals, 1, __ATOMIC_RELAXED);
+	adaptive_full_fence();
+	if (__atomic_load_n(&cond->sleepers, __ATOMIC_RELAXED)) {
+		adaptive_kernel_lock(&cond->sleep_mutex);
+		adaptive_kernel_signal(&cond->sleep_cond);
+		adaptive_kernel_unlock(&cond->sleep_mutex);
+	}
+	return ADAPTIVE_OK;
+}
+
+s32 adaptiveCondSignalAll(adaptiveCond *cond)
+{
+	__atomic_fetch_add(&cond->seq, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&cond->signals, 1, __ATOMIC_RELAXED);
+	adaptive_full_fence();
+	if (__atomic_load_n(&cond->sleepers, __ATOMIC_RELAXED)) {
+		adaptive_kernel_lock(&cond->sleep_mutex);
+		adaptive_kernel_broadcast(&cond->sleep_cond);
+		adaptive_kernel_unlock(&cond->sleep_mutex);
+	}
+	return ADAPTIVE_OK;
+}
+
+void adaptiveMutexGetStats(adaptiveMutex *mutex, adaptiveStats *stats)
+{
+	*stats = mutex->stats;
+	stats->spin_limit = __atomic_load_n(&mutex->spin_limit, __ATOMIC_RELAXED);
+}
+
+void adaptiveResetStats(void)
+{
+	adaptiveMutex *m;
+
+	adaptive_registry_acquire();
+	for (m = adaptive_registry; m; m = m->next)
+		memset(&m->stats, 0, sizeof(m->stats));
+	adaptive_registry_release();
+}
+
+void adaptiveDumpStats(FILE *out)
+{
+	double us = 1e6 / adaptive_ticks_per_sec();
+	adaptiveMutex *m;
+
+	if (!out)
+		out = stdout;
+	fprintf(out, "%-16s %10s %9s %10s %9s %8s %6s %10s %10s %6s\n",
+	        "mutex", "acquired", "contended", "spins", "spin-won", "sleeps", "t/o", "avg-hold", "max-hold", "budget");
+	adaptive_registry_acquire();
+	for (m = adaptive_registry; m; m = m->next) {
+		adaptiveStats s;
+
+		adaptiveMutexGetStats(m, &s);
+		fprintf(out, "%-16s %10llu %9llu %10llu %9llu %8llu %6llu %8.2fus %8.2fus %6u\n", m->name,
+		        (unsigned long long) s.acquisitions, (unsigned long long) s.contended,
+		        (unsigned long long) s.spins, (unsigned long long) s.spin_acquired,
+		        (unsigned long long) s.sleeps, (unsigned long long) s.timeouts,
+		        s.acquisitions ? s.hold_ticks * us / s.acquisitions : 0.0, s.max_hold_ticks * us, s.spin_limit);
+	}
+	adaptive_registry_release();
+}
+
+#endif /* ADAPTIVE_IMPLEMENTATION */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
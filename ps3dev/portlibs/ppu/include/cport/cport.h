@@ -0,0 +1,748 @@
+/*! \file cport.h
+ \brief Completion port: batched completion records over an event queue.
+
+ sysEventQueueReceive returns one sys_event_t per system call, so a PPU
+ thread handling one event per SPU job completion spends its frame in
+ the kernel. A completion port moves the records themselves into a
+ bounded multi producer ring in main memory (the cell layout of
+ lockfree.h \ref lfMpmcRing, with a 24 byte record per cell), and keeps
+ the event queue only as a doorbell:
+
+ - producers (SPU threads, PPU threads) append a \ref cportRecord and
+   return; no system call is made while the consumer is busy;
+ - the consumer drains up to \p max records per call. When the ring is
+   empty it arms the port and sleeps in sysEventQueueReceive;
+ - the producer that makes an armed port non-empty disarms it and sends
+   the single event that wakes the consumer (sysEventPortSend on the
+   PPU, spu_thread_send_event on the SPU).
+
+ Arming and posting are ordered by a full barrier on each side, so a
+ record posted while the consumer goes to sleep either is seen by its
+ last look at the ring or rings the doorbell.
+
+ The consumer keeps statistics: records, receives, a histogram of batch
+ sizes, kernel waits and notifications, and the latency from post to
+ receive for records carrying a time stamp. cportPost stamps records
+ with the timebase on the PPU; SPU records carry no stamp (the
+ decrementer of an SPU is not the PPU timebase) unless the SPU passes
+ its own to cportPostStamped.
+
+ On the host the event queue is simulated with a pthread condition
+ variable, and \ref cportBench runs producers against the consumer.
+
+ - PPU consumer and producers, host: #include <cport/cport.h>;
+   #define CPORT_IMPLEMENTATION in one source file.
+ - SPU producers: #include <cport/cport.h>, post with the ea of the port.
+   Every SPU thread that posts is connected with \ref cportConnectSpu.
+*/
+
+#ifndef __CPORT_H__
+#define __CPORT_H__
+
+#include <lockfree/lockfree.h>
+
+#ifdef __SPU__
+#include <sys/spu_event.h>
+#elif defined(__PPU__)
+#include <ppu-asm.h>
+#include <sys/event_queue.h>
+#include <sys/spu.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#define CPORT_OK                0
+#define CPORT_EFULL             -1
+#define CPORT_ETIMEDOUT         -2
+#define CPORT_EINVAL            -3
+#define CPORT_EKERNEL           -4          /* an lv2 call failed */
+
+#ifndef CPORT_SPU_PORT
+#define CPORT_SPU_PORT          58          /*!< SPU event port (spup) used for the doorbell */
+#endif
+
+#define CPORT_HISTOGRAM         8           /*!< batch size buckets: 1, 2-3, 4-7, ..., 128+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! \brief Completion record. */
+typedef struct _cport_record
+{
+	uint32_t source;                /*!< \brief producer, e.g. SPU index */
+	uint32_t code;                  /*!< \brief status or kind, free for the user */
+	uint64_t data;                  /*!< \brief free for the user, e.g. ea of the job */
+	uint64_t stamp;                 /*!< \brief timebase at post, 0: none */
+} cportRecord;
+
+/* 32 bytes on a 32 byte boundary: four cells per line, none straddles two reservation granules */
+typedef struct _cport_cell
+{
+	volatile uint32_t seq;
+	uint32_t pad;
+	cportRecord record;
+} __attribute__((aligned(32))) cportCell;
+
+/*! \brief Statistics of a port, kept by the consumer. */
+typedef struct _cport_stats
+{
+	uint64_t records;               /*!< \brief records received */
+	uint64_t receives;              /*!< \brief receive calls that returned records */
+	uint64_t max_batch;
+	uint64_t batches[CPORT_HISTOGRAM]; /*!< \brief receives by batch size, power of 2 buckets */
+	uint64_t waits;                 /*!< \brief kernel waits */
+	uint64_t spurious;              /*!< \brief waits that ended with the ring empty */
+	uint64_t timeouts;
+	uint64_t notifies;              /*!< \brief events sent by producers */
+	uint64_t full;                  /*!< \brief posts refused with the ring full */
+	uint64_t stamped;               /*!< \brief records with a time stamp */
+	uint64_t latency_ticks;         /*!< \brief post to receive, summed over stamped records */
+	uint64_t max_latency_ticks;
+} cportStats;
+
+/*! \brief Completion port; opaque to the caller. */
+typedef struct _cport
+{
+	volatile uint32_t head;         /* consumer line */
+	uint32_t pad0[31];
+	volatile uint32_t tail;         /* producer line */
+	uint32_t pad1[31];
+	volatile uint32_t armed;        /* doorbell line: 1 while the consumer sleeps or is about to */
+	volatile uint32_t notifies;
+	volatile uint32_t full;
+	uint32_t pad2[29];
+	uint64_t cells;                 /* read only after cportCreate */
+	uint32_t capacity;
+	uint32_t spu_port;
+	uint64_t event_port;
+	uint64_t queue;
+	uint32_t pad3[24];
+	cportStats stats;               /* consumer only */
+#if !defined(__PPU__) && !defined(__SPU__)
+	pthread_mutex_t mutex;          /* simulated event queue */
+	pthread_cond_t cond;
+	uint32_t events;
+#endif
+} __attribute__((aligned(128))) cport;
+
+/* clock and barriers */
+
+#ifdef __SPU__
+
+#define cport_sync()    do { } while (0)    /* putllc and getllar are already in order */
+
+static inline uint64_t cport_ticks(void)
+{
+	return 0;
+}
+
+#elif defined(__PPU__)
+
+#define cport_sync()    __asm__ volatile ("sync" ::: "memory")
+
+static inline uint64_t cport_ticks(void)
+{
+	return __gettime();
+}
+
+#else
+
+#define cport_sync()    __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+static inline uint64_t cport_ticks(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#endif
+
+/* record and sequence number of a cell land together: one line update on the SPU */
+#ifdef __SPU__
+
+static inline void cport_cell_store(uint64_t ea, uint32_t seq, const cportRecord *record)
+{
+	do {
+		mfc_getllar(lf_line, ea & ~127ULL, 0, 0);
+		mfc_read_atomic_status();
+		((cportCell *) (lf_line + (ea & 127)))->record = *record;
+		((cportCell *) (lf_line + (ea & 127)))->seq = seq;
+		mfc_putllc(lf_line, ea & ~127ULL, 0, 0);
+	} while (mfc_read_atomic_status() & MFC_PUTLLC_STATUS);
+}
+
+static inline void cport_notify(uint64_t ea, uint32_t source)
+{
+	spu_thread_send_event(lf_peek32(LF_FIELD(ea, cport, spu_port)), source & EVENT_DATA0_MASK, 0);
+}
+
+#else
+
+static inline void cport_cell_store(uint64_t ea, uint32_t seq, const cportRecord *record)
+{
+	((cportCell *) LF_PTR(ea))->record = *record;
+	lf_store32(ea + offsetof(cportCell, seq), seq);
+}
+
+#ifdef __PPU__
+static inline void cport_notify(uint64_t ea, uint32_t source)
+{
+	sysEventPortSend((sys_event_port_t) ((cport *) LF_PTR(ea))->event_port, source, 0, 0);
+}
+#else
+static inline void cport_notify(uint64_t ea, uint32_t source)
+{
+	cport *port = (cport *) LF_PTR(ea);
+
+	(void) source;
+	pthread_mutex_lock(&port->mutex);
+	port->events++;
+	pthread_cond_signal(&port->cond);
+	pthread_mutex_unlock(&port->mutex);
+}
+#endif
+
+#endif
+
+/*! \brief Append a record with the given time stamp (0: none).
+ \return CPORT_OK, or CPORT_EFULL when the consumer is \p capacity records behind.
+*/
+static inline int cportPostStamped(LF_REF(cport) port, uint32_t source, uint32_t code, uint64_t data, uint64_t stamp)
+{
+	uint64_t ea = LF_EA(port);
+	uint64_t cells = lf_load64(LF_FIELD(ea, cport, cells));
+	uint32_t mask = lf_peek32(LF_FIELD(ea, cport, capacity)) - 1;
+	uint32_t pos = lf_load32(LF_FIELD(ea, cport, tail));
+	cportRecord record;
+
+	record.source = source;
+	record.code = code;
+	record.data = data;
+	record.stamp = stamp;
+	for (;;) {
+		uint64_t cell = cells + (uint64_t) (pos & mask) * sizeof(cportCell);
+		int32_t dif = (int32_t) (lf_load32(cell + offsetof(cportCell, seq)) - pos);
+
+		if (dif == 0) {
+			if (lf_cas32(LF_FIELD(ea, cport, tail), pos, pos + 1)) {
+				cport_cell_store(cell, pos + 1, &record);
+				break;
+			}
+		} else if (dif < 0) {
+			lf_add32(LF_FIELD(ea, cport, full), 1);
+			return CPORT_EFULL;
+		}
+		pos = lf_load32(LF_FIELD(ea, cport, tail));
+	}
+
+	/* pairs with the barrier in cportReceive after arming */
+	cport_sync();
+	if (lf_load32(LF_FIELD(ea, cport, armed)) && lf_cas32(LF_FIELD(ea, cport, armed), 1, 0)) {
+		lf_add32(LF_FIELD(ea, cport, notifies), 1);
+		cport_notify(ea, source);
+	}
+	return CPORT_OK;
+}
+
+/*! \brief Append a record, stamped with the timebase on the PPU. */
+static inline int cportPost(LF_REF(cport) port, uint32_t source, uint32_t code, uint64_t data)
+{
+	return cportPostStamped(port, source, code, data, cport_ticks());
+}
+
+#ifndef __SPU__
+
+/*! \brief Create a port over \p cells (capacity cells, a power of 2, 32 byte aligned).
+
+ On the PPU this creates the event queue and a local event port for PPU
+ producers.
+*/
+int cportCreate(cport *port, cportCell *cells, uint32_t capacity);
+
+/*! \brief Destroy the port; SPU threads must be disconnected or stopped first. */
+int cportDestroy(cport *port);
+
+#ifdef __PPU__
+/*! \brief Let an SPU thread ring the doorbell (connects CPORT_SPU_PORT to the event queue). */
+int cportConnectSpu(cport *port, sys_spu_thread_t thread);
+int cportDisconnectSpu(cport *port, sys_spu_thread_t thread);
+#endif
+
+/*! \brief Take up to \p max records without waiting.
+ \return Records stored in \p records.
+*/
+uint32_t cportTryReceive(cport *port, cportRecord *records, uint32_t max);
+
+/*! \brief Take up to \p max records, waiting up to \p timeout_usec (0: forever) for the first one.
+ \return Records stored in \p records (at least 1), or CPORT_ETIMEDOUT / CPORT_EKERNEL.
+*/
+int cportReceive(cport *port, cportRecord *records, uint32_t max, uint64_t timeout_usec);
+
+void cportGetStats(cport *port, cportStats *stats);
+void cportResetStats(cport *port);
+
+/*! \brief Ticks per second of record time stamps and latency statistics. */
+uint64_t cportTicksPerSecond(void);
+
+/*! \brief Result of \ref cportBench. */
+typedef struct _cport_bench_result
+{
+	uint64_t records;
+	uint64_t usecs;
+	double records_per_sec;
+	double records_per_kernel_call; /*!< \brief records per wait or notification; 1.0 without the port */
+	double mean_batch;
+	double mean_latency_usec;
+	cportStats stats;
+	uint32_t errors;                /*!< \brief lost, duplicated or reordered records (must be 0) */
+} cportBenchResult;
+
+/*! \brief Run \p producers threads posting \p records each, in bursts of \p burst with a yield in between, against a consumer on the calling thread. */
+int cportBench(uint32_t producers, uint32_t records, uint32_t burst, cportBenchResult *result);
+
+#endif /* !__SPU__ */
+
+#ifdef CPORT_IMPLEMENTATION
+
+#include <stdlib.h>
+
+#ifdef __PPU__
+#include <malloc.h>
+#include <sys/thread.h>
+#include <sys/systime.h>
+
+uint64_t cportTicksPerSecond(void)
+{
+	return sysGetTimebaseFrequency();
+}
+
+static uint64_t cport_usecs(void)
+{
+	return sysGetSystemTime();
+}
+
+static int cport_kernel_create(cport *port)
+{
+	sys_event_queue_attr_t attr = { SYS_EVENT_QUEUE_FIFO, SYS_EVENT_QUEUE_PPU, "cport" };
+	sys_event_queue_t queue;
+	sys_event_port_t event_port;
+
+	if (sysEventQueueCreate(&queue, &attr, SYS_EVENT_QUEUE_KEY_LOCAL, 127))
+		return CPORT_EKERNEL;
+	if (sysEventPortCreate(&event_port, SYS_EVENT_PORT_LOCAL, SYS_EVENT_PORT_NO_NAME)) {
+		sysEventQueueDestroy(queue, 0);
+		return CPORT_EKERNEL;
+	}
+	if (sysEventPortConnectLocal(event_port, queue)) {
+		sysEventPortDestroy(event_port);
+		sysEventQueueDestroy(queue, 0);
+		return CPORT_EKERNEL;
+	}
+	port->queue = queue;
+	port->event_port = event_port;
+	return CPORT_OK;
+}
+
+static void cport_kernel_destroy(cport *port)
+{
+	sysEventPortDisconnect((sys_event_port_t) port->event_port);
+	sysEventPortDestroy((sys_event_port_t) port->event_port);
+	sysEventQueueDestroy((sys_event_queue_t) port->queue, 0);
+}
+
+/* 0: an event arrived, 1: timeout, CPORT_EKERNEL */
+static int cport_kernel_wait(cport *port, uint64_t timeout_usec)
+{
+	sys_event_t event;
+	s32 ret = sysEventQueueReceive((sys_event_queue_t) port->queue, &event, timeout_usec);
+
+	if (ret == 0)
+		return 0;
+	return ret == (s32) 0x8001000b ? 1 : CPORT_EKERNEL;
+}
+
+int cportConnectSpu(cport *port, sys_spu_thread_t thread)
+{
+	if (sysSpuThreadConnectEvent(thread, (sys_event_queue_t) port->queue, SPU_THREAD_EVENT_USER, port->spu_port))
+		return CPORT_EKERNEL;
+	return CPORT_OK;
+}
+
+int cportDisconnectSpu(cport *port, sys_spu_thread_t thread)
+{
+	if (sysSpuThreadDisconnectEvent(thread, SPU_THREAD_EVENT_USER, port->spu_port))
+		return CPORT_EKERNEL;
+	return CPORT_OK;
+}
+
+#else
+
+#include <errno.h>
+#include <sched.h>
+
+uint64_t cportTicksPerSecond(void)
+{
+	return 1000000000ULL;
+}
+
+static uint64_t cport_usecs(void)
+{
+	return cport_ticks() / 1000;
+}
+
+static int cport_kernel_create(cport *port)
+{
+	pthread_condattr_t attr;
+
+	if (pthread_mutex_init(&port->mutex, NULL))
+		return CPORT_EKERNEL;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	if (pthread_cond_init(&port->cond, &attr)) {
+		pthread_mutex_destroy(&port->mutex);
+		return CPORT_EKERNEL;
+	}
+	port->events = 0;
+	return CPORT_OK;
+}
+
+static void cport_kernel_destroy(cport *port)
+{
+	pthread_cond_destroy(&port->cond);
+	pthread_mutex_destroy(&port->mutex);
+}
+
+/* a receive on a queue of events: one event is consumed per wait, like lv2 */
+static int cport_kernel_wait(cport *port, uint64_t timeout_usec)
+{
+	struct timespec ts;
+	uint64_t ns = cport_ticks() + timeout_usec * 1000;
+	int ret = 0;
+
+	ts.tv_sec = ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+	pthread_mutex_lock(&port->mutex);
+	while (!port->events && ret != ETIMEDOUT) {
+		if (timeout_usec)
+			ret = pthread_cond_timedwait(&port->cond, &port->mutex, &ts);
+		else
+			pthread_cond_wait(&port->cond, &port->mutex);
+	}
+	if (port->events) {
+		port->events--;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&port->mutex);
+	return ret ? 1 : 0;
+}
+
+#endif
+
+int cportCreate(cport *port, cportCell *cells, uint32_t capacity)
+{
+	uint32_t i;
+	int ret;
+
+	/* a cell updated as one line on the SPU must not cross a line */
+	if (!port || !cells || (LF_EA(cells) & (sizeof(cportCell) - 1)) || !capacity || (capacity & (capacity - 1)))
+		return CPORT_EINVAL;
+	memset(port, 0, sizeof(*port));
+	port->cells = LF_EA(cells);
+	port->capacity = capacity;
+	port->spu_port = CPORT_SPU_PORT;
+	for (i = 0; i < capacity; i++) {
+		memset(&cells[i], 0, sizeof(cells[i]));
+		cells[i].seq = i;
+	}
+	ret = cport_kernel_create(port);
+	lf_fence();
+	return ret;
+}
+
+int cportDestroy(cport *port)
+{
+	cport_kernel_destroy(port);
+	return CPORT_OK;
+}
+
+static void cport_account(cport *port, const cportRecord *records, uint32_t n, uint64_t now)
+{
+	cportStats *s = &port->stats;
+	uint32_t i, bucket = 0;
+
+	s->records += n;
+	s->receives++;
+	if (n > s->max_batch)
+		s->max_batch = n;
+	while ((n >> (bucket + 1)) && bucket < CPORT_HISTOGRAM - 1)
+		bucket++;
+	s->batches[bucket]++;
+	for (i = 0; i < n; i++) {
+		uint64_t latency;
+
+		if (!records[i].stamp || records[i].stamp > now)
+			continue;
+		latency = now - records[i].stamp;
+		s->stamped++;
+		s->latency_ticks += latency;
+		if (latency > s->max_latency_ticks)
+			s->max_latency_ticks = latency;
+	}
+}
+
+uint32_t cportTryReceive(cport *port, cportRecord *records, uint32_t max)
+{
+	cportCell *cells = (cportCell *) LF_PTR(port->cells);
+	uint32_t mask = port->capacity - 1;
+	uint32_t pos = port->head;
+	uint32_t n = 0;
+
+	while (n < max) {
+		cportCell *cell = &cells[pos & mask];
+
+		if (lf_load32(LF_EA(&cell->seq)) != pos + 1)
+			break;
+		records[n++] = cell->record;
+		/* hand the cell back to the producers one lap later */
+		lf_store32(LF_EA(&cell->seq), pos + mask + 1);
+		pos++;
+	}
+	if (n) {
+		lf_store32(LF_EA(&port->head), pos);
+		cport_account(port, records, n, cport_ticks());
+	}
+	return n;
+}
+
+/* the cell at head is published (consumer only) */
+static int cport_ready(cport *port)
+{
+	cportCell *cells = (cportCell *) LF_PTR(port->cells);
+	uint32_t pos = port->head;
+
+	return lf_load32(LF_EA(&cells[pos & (port->capacity - 1)].seq)) == pos + 1;
+}
+
+int cportReceive(cport *port, cportRecord *records, uint32_t max, uint64_t timeout_usec)
+{
+	uint64_t deadline = timeout_usec ? cport_usecs() + timeout_usec : 0;
+	uint32_t n;
+	int woken = 0;
+
+	if (!max)
+		return CPORT_EINVAL;
+	for (;;) {
+		uint64_t wait = 0;
+		int ret;
+
+		n = cportTryReceive(port, records, max);
+		if (n)
+			return (int) n;
+		if (woken)
+			port->stats.spurious++;
+
+		lf_store32(LF_EA(&port->armed), 1);
+		/* pairs with the barrier in cportPostStamped after the record */
+		cport_sync();
+		if (cport_ready(port)) {
+			/* if a producer disarmed first, its event is already on the way
+			   and will end a later wait early; that wait counts as spurious */
+			lf_cas32(LF_EA(&port->armed), 1, 0);
+			woken = 0;
+			continue;
+		}
+
+		if (deadline) {
+			uint64_t now = cport_usecs();
+			if (now >= deadline) {
+				lf_cas32(LF_EA(&port->armed), 1, 0);
+				port->stats.timeouts++;
+				return CPORT_ETIMEDOUT;
+			}
+			wait = deadline - now;
+		}
+		port->stats.waits++;
+		ret = cport_kernel_wait(port, wait);
+		if (ret < 0) {
+			lf_cas32(LF_EA(&port->armed), 1, 0);
+			return ret;
+		}
+		woken = (ret == 0);
+	}
+}
+
+void cportGetStats(cport *port, cportStats *stats)
+{
+	*stats = port->stats;
+	stats->notifies = lf_load32(LF_EA(&port->notifies));
+	stats->full = lf_load32(LF_EA(&port->full));
+}
+
+void cportResetStats(cport *port)
+{
+	memset(&port->stats, 0, sizeof(port->stats));
+	lf_store32(LF_EA(&port->notifies), 0);
+	lf_store32(LF_EA(&port->full), 0);
+}
+
+/* benchmark */
+
+#define CPORT_BENCH_MAX_PRODUCERS   16
+#define CPORT_BENCH_CAPACITY        1024
+#define CPORT_BENCH_BATCH           64
+
+typedef struct
+{
+	cport port;
+	cportCell cells[CPORT_BENCH_CAPACITY];
+	volatile uint32_t start;
+	uint32_t records;
+	uint32_t burst;
+} __attribute__((aligned(128))) cport_bench;
+
+typedef struct
+{
+	cport_bench *bench;
+	uint32_t index;
+} cport_bench_arg;
+
+static void cport_bench_yield(void)
+{
+#ifdef __PPU__
+	sysThreadYield();
+#else
+	sched_yield();
+#endif
+}
+
+static void cport_bench_produce(cport_bench_arg *arg)
+{
+	cport_bench *b = arg->bench;
+	uint32_t i;
+
+	while (!__atomic_load_n(&b->start, __ATOMIC_ACQUIRE))
+		cport_bench_yield();
+	for (i = 0; i < b->records; i++) {
+		/* data: producer and sequence, so the consumer can check order */
+		while (cportPost(&b->port, arg->index, i, ((uint64_t) arg->index << 32) | i) != CPORT_OK)
+			cport_bench_yield();
+		if ((i + 1) % b->burst == 0)
+			cport_bench_yield();
+	}
+}
+
+#ifdef __PPU__
+static void cport_bench_thread(void *arg)
+{
+	cport_bench_produce((cport_bench_arg *) arg);
+	sysThreadExit(0);
+}
+#else
+static void *cport_bench_thread(void *arg)
+{
+	cport_bench_produce((cport_bench_arg *) arg);
+	return NULL;
+}
+#endif
+
+int cportBench(uint32_t producers, uint32_t records, uint32_t burst, cportBenchResult *result)
+{
+	cport_bench_arg args[CPORT_BENCH_MAX_PRODUCERS];
+	uint32_t expect[CPORT_BENCH_MAX_PRODUCERS];
+#ifdef __PPU__
+	sys_ppu_thread_t ids[CPORT_BENCH_MAX_PRODUCERS];
+#else
+	pthread_t ids[CPORT_BENCH_MAX_PRODUCERS];
+#endif
+	cportRecord batch[CPORT_BENCH_BATCH];
+	uint64_t total, received = 0, t0;
+	uint32_t i, started;
+	cport_bench *b;
+	int ret;
+
+	if (!producers || producers > CPORT_BENCH_MAX_PRODUCERS || !result)
+		return CPORT_EINVAL;
+#ifdef __PPU__
+	b = (cport_bench *) memalign(128, sizeof(cport_bench));
+#else
+	if (posix_memalign((void **) &b, 128, sizeof(cport_bench)))
+		b = NULL;
+#endif
+	if (!b)
+		return CPORT_EINVAL;
+	memset(b, 0, sizeof(*b));
+	memset(result, 0, sizeof(*result));
+	b->records = records;
+	b->burst = burst ? burst : 1;
+	ret = cportCreate(&b->port, b->cells, CPORT_BENCH_CAPACITY);
+	if (ret) {
+		free(b);
+		return ret;
+	}
+
+	for (started = 0; started < producers; started++) {
+		args[started].bench = b;
+		args[started].index = started;
+		expect[started] = 0;
+#ifdef __PPU__
+		if (sysThreadCreate(&ids[started], cport_bench_thread, &args[started], 1000, 0x4000, THREAD_JOINABLE, (char *) "cportbench"))
+#else
+		if (pthread_create(&ids[started], NULL, cport_bench_thread, &args[started]))
+#endif
+			break;
+	}
+	total = (uint64_t) started * records;
+	t0 = cport_usecs();
+	__atomic_store_n(&b->start, 1, __ATOMIC_RELEASE);
+
+	while (received < total) {
+		int n = cportReceive(&b->port, batch, CPORT_BENCH_BATCH, 1000000);
+
+		if (n < 0) {
+			result->errors++;
+			break;
+		}
+		for (i = 0; i < (uint32_t) n; i++) {
+			uint32_t p = batch[i].source;
+
+			if (p >= started || batch[i].code != expect[p] || batch[i].data != (((uint64_t) p << 32) | expect[p]))
+				result->errors++;
+			else
+				expect[p]++;
+		}
+		received += n;
+	}
+
+	for (i = 0; i < started; i++) {
+#ifdef __PPU__
+		u64 retval;
+		sysThreadJoin(ids[i], &retval);
+#else
+		pthread_join(ids[i], NULL);
+#endif
+	}
+	result->usecs = cport_usecs() - t0;
+	result->records = received;
+	result->records_per_sec = result->usecs ? received * 1e6 / result->usecs : 0;
+	cportGetStats(&b->port, &result->stats);
+	total = result->stats.waits + result->stats.notifies;
+	result->records_per_kernel_call = (double) received / (double) (total ? total : 1);
+	result->mean_batch = result->stats.receives ? (double) result->stats.records / result->stats.receives : 0;
+	result->mean_latency_usec = result->stats.stamped ?
+	    result->stats.latency_ticks * 1e6 / cportTicksPerSecond() / result->stats.stamped : 0;
+	cportDestroy(&b->port);
+	free(b);
+	return started < producers ? CPORT_EINVAL : CPORT_OK;
+}
+
+#endif /* CPORT_IMPLEMENTATION */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,751 @@
+/*! \file eacache.h
+ \brief Software cache for effective addresses on the SPU.
+
+ A replacement for the libgcc __ea cache (spu_cache.h) whose geometry is
+ chosen at build time and whose behaviour can be observed:
+
+ - size, associativity and line size are set with EACACHE_SIZE,
+   EACACHE_WAYS and EACACHE_LINE (define them the same way for every
+   object of the SPU program, e.g. with -D);
+ - \ref eaCachePrefetch starts filling a line without waiting for it;
+ - \ref eaCacheStreamStore writes through a few 128 byte write combining
+   buffers without fetching the destination lines;
+ - hit, miss, eviction, write back and DMA stall counters are kept in an
+   \ref eaCacheStats block that the SPU copies to main memory, where the
+   PPU reads it.
+
+ Lines are written back with byte granularity: fully written 128 byte
+ blocks with plain puts, partially written ones merged under a lock line
+ reservation, so bytes the SPU did not write are never overwritten.
+
+ The compiler inlines its own tag lookups for __ea dereferences against
+ the libgcc tag array layout, so the cache is used through explicit
+ calls taking an effective address (\ref EACACHE_EA converts an __ea
+ pointer). Defining EACACHE_OVERRIDE_SPU_CACHE before including this
+ header routes the spu_cache.h macros (cache_fetch, cache_fetch_dirty,
+ cache_touch, cache_evict, cache_flush) to this cache.
+
+ Off the SPU (and off the PPU) the same cache runs on memcpy, for unit
+ tests and for \ref eaCacheBench comparisons. On the PPU only the
+ statistics are available.
+
+ - SPU / host: #define EACACHE_IMPLEMENTATION in one source file.
+ - PPU:        \ref eaCacheStatsRead on the block passed to \ref eaCacheInit.
+*/
+
+#ifndef __EACACHE_H__
+#define __EACACHE_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SPU__
+#include <spu_intrinsics.h>
+#include <spu_mfcio.h>
+#elif !defined(__PPU__)
+#include <time.h>
+#endif
+
+#ifndef EACACHE_SIZE
+#define EACACHE_SIZE            32768       /*!< bytes of line data in local store */
+#endif
+#ifndef EACACHE_WAYS
+#define EACACHE_WAYS            4           /*!< lines per set, power of 2 */
+#endif
+#ifndef EACACHE_LINE
+#define EACACHE_LINE            128         /*!< bytes per line, power of 2, 128 to 16384 */
+#endif
+#ifndef EACACHE_WC_LINES
+#define EACACHE_WC_LINES        4           /*!< 128 byte write combining buffers */
+#endif
+#ifndef EACACHE_MAX_PENDING
+#define EACACHE_MAX_PENDING     8           /*!< prefetches in flight */
+#endif
+#ifndef EACACHE_TAG
+#define EACACHE_TAG             30          /*!< MFC tag of every cache transfer */
+#endif
+#ifndef EACACHE_PUBLISH_MISSES
+#define EACACHE_PUBLISH_MISSES  0           /*!< copy the statistics out every n misses (0: on flush only) */
+#endif
+
+#define EACACHE_SETS            (EACACHE_SIZE / (EACACHE_WAYS * EACACHE_LINE))
+#define EACACHE_LINES           (EACACHE_SETS * EACACHE_WAYS)
+
+#if EACACHE_LINE < 128 || EACACHE_LINE > 16384 || (EACACHE_LINE & (EACACHE_LINE - 1))
+#error "EACACHE_LINE must be a power of 2 between 128 and 16384"
+#endif
+#if EACACHE_SETS < 1 || (EACACHE_SETS & (EACACHE_SETS - 1)) || (EACACHE_WAYS & (EACACHE_WAYS - 1))
+#error "EACACHE_SIZE / (EACACHE_WAYS * EACACHE_LINE) must be a power of 2"
+#endif
+
+#define EACACHE_BENCH_SEQUENTIAL            0   /*!< 32 bit loads in address order */
+#define EACACHE_BENCH_SEQUENTIAL_PREFETCH   1   /*!< the same, prefetching 2 lines ahead */
+#define EACACHE_BENCH_RANDOM                2   /*!< 32 bit loads at pseudo random addresses */
+#define EACACHE_BENCH_LINKED_LIST           3   /*!< chase 16 byte nodes in pseudo random order */
+
+#if defined(__SPU__) && defined(__EA64__)
+#define EACACHE_EA(p)   ((uint64_t) (unsigned long long) (p))
+#elif defined(__SPU__) && defined(__EA32__)
+#define EACACHE_EA(p)   ((uint64_t) (unsigned int) (p))
+#else
+#define EACACHE_EA(p)   ((uint64_t) (uintptr_t) (p))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! \brief Cache counters, copied to main memory by \ref eaCacheStatsPublish. */
+typedef struct _ea_cache_stats
+{
+	uint64_t hits;                  /*!< \brief accesses served from local store */
+	uint64_t misses;                /*!< \brief accesses that waited for a line fill */
+	uint64_t evictions;             /*!< \brief valid lines replaced */
+	uint64_t writebacks;            /*!< \brief dirty lines written back */
+	uint64_t merges;                /*!< \brief partially written 128 byte blocks merged atomically */
+	uint64_t prefetches;            /*!< \brief line fills started by \ref eaCachePrefetch */
+	uint64_t prefetch_hits;         /*!< \brief first accesses to a prefetched line */
+	uint64_t prefetch_dropped;      /*!< \brief prefetches ignored, EACACHE_MAX_PENDING in flight */
+	uint64_t stream_stores;         /*!< \brief bytes written by \ref eaCacheStreamStore */
+	uint64_t stream_flushes;        /*!< \brief write combining buffers written out */
+	uint64_t dma_bytes;             /*!< \brief bytes moved by gets and puts */
+	uint64_t stall_ticks;           /*!< \brief decrementer ticks spent waiting for DMA */
+	uint32_t size;                  /*!< \brief geometry of the cache */
+	uint32_t ways;
+	uint32_t line;
+	uint32_t sets;
+	uint32_t publishes;             /*!< \brief incremented by every copy to main memory */
+	uint32_t pad[3];
+} __attribute__((aligned(128))) eaCacheStats;
+
+/*! \brief Result of \ref eaCacheBench. */
+typedef struct _ea_cache_bench_result
+{
+	uint32_t accesses;
+	uint32_t ticks;                 /*!< \brief decrementer ticks (nanoseconds on the host) */
+	float ns_per_access;
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t sink;                  /*!< \brief sum of the values read, keeps the loads alive */
+} eaCacheBenchResult;
+
+#if defined(__SPU__) || !defined(__PPU__)
+
+/* most recently used line: checked inline before the set lookup */
+extern uint64_t eacache_last_line;
+extern uint8_t *eacache_last_data;
+extern uint8_t *eacache_last_dirty;
+extern uint32_t eacache_fast_hits;
+
+/*! \brief Set up the cache.
+ \param stats_ea
+ ea of an eaCacheStats block in main memory, 128 byte aligned (0: none).
+*/
+void eaCacheInit(uint64_t stats_ea);
+
+/*! \brief Lookup (and fill on a miss) of the line holding ea; writes mark \p dirty bytes from ea. */
+void *eaCacheFetchSlow(uint64_t ea, uint32_t dirty);
+
+/*! \brief Start filling the line holding ea, if it is not cached. */
+void eaCachePrefetch(uint64_t ea);
+
+/*! \brief Write \p size bytes to ea without allocating lines (write combining). */
+void eaCacheStreamStore(uint64_t ea, const void *src, uint32_t size);
+
+/*! \brief Write back the line holding ea and drop it. */
+void eaCacheEvict(uint64_t ea);
+
+/*! \brief Write back every dirty line and write combining buffer, then publish the statistics. */
+void eaCacheFlush(void);
+
+/*! \brief Drop every line without writing it back, after main memory changed under the cache. */
+void eaCacheInvalidateAll(void);
+
+/*! \brief Current counters (the inline hits folded in). */
+void eaCacheGetStats(eaCacheStats *stats);
+
+/*! \brief Copy the counters to the block passed to \ref eaCacheInit. */
+void eaCacheStatsPublish(void);
+
+/*! \brief Time \p accesses accesses of \p pattern over \p bytes at ea (a power of 2, at least 16).
+
+ Linked list runs build the list through \ref eaCacheStreamStore first.
+ The cache is flushed and invalidated before the timed part.
+ \return 0, or -1 for a bad pattern or size
+*/
+int eaCacheBench(uint64_t ea, uint32_t bytes, uint32_t accesses, int pattern, eaCacheBenchResult *result);
+
+static inline void eacache_mark(uint8_t *mask, uint32_t off, uint32_t n)
+{
+	for (; n; n--, off++)
+		mask[off >> 3] |= 1 << (off & 7);
+}
+
+/*! \brief Local store address of ea, valid until the next cache call. */
+static inline void *eaCacheFetch(uint64_t ea)
+{
+	if ((ea & ~(uint64_t) (EACACHE_LINE - 1)) == eacache_last_line) {
+		eacache_fast_hits++;
+		return eacache_last_data + (ea & (EACACHE_LINE - 1));
+	}
+	return eaCacheFetchSlow(ea, 0);
+}
+
+/*! \brief Like \ref eaCacheFetch, for writing \p size bytes (within one line) at ea. */
+static inline void *eaCacheFetchDirty(uint64_t ea, uint32_t size)
+{
+	if ((ea & ~(uint64_t) (EACACHE_LINE - 1)) == eacache_last_line) {
+		eacache_fast_hits++;
+		eacache_mark(eacache_last_dirty, ea & (EACACHE_LINE - 1), size);
+		return eacache_last_data + (ea & (EACACHE_LINE - 1));
+	}
+	return eaCacheFetchSlow(ea, size);
+}
+
+/*! \brief Typed load and store through the cache; the object must not cross a line. */
+#define EACACHE_LOAD(type, ea)          (*(const type *) eaCacheFetch(ea))
+#define EACACHE_STORE(type, ea, value)  (*(type *) eaCacheFetchDirty((ea), sizeof(type)) = (value))
+
+#ifdef EACACHE_OVERRIDE_SPU_CACHE
+#undef cache_fetch
+#undef cache_fetch_dirty
+#undef cache_touch
+#undef cache_evict
+#undef cache_flush
+#define cache_fetch(_ea)                    eaCacheFetch(EACACHE_EA(_ea))
+#define cache_fetch_dirty(_ea, _n_dirty)    eaCacheFetchDirty(EACACHE_EA(_ea), (_n_dirty))
+#define cache_touch(_ea)                    eaCachePrefetch(EACACHE_EA(_ea))
+#define cache_evict(_ea)                    eaCacheEvict(EACACHE_EA(_ea))
+#define cache_flush()                       eaCacheFlush()
+#endif
+
+#ifdef EACACHE_IMPLEMENTATION
+
+#define EACACHE_VALID       1
+#define EACACHE_PENDING     2               /* prefetch in flight */
+#define EACACHE_PREFETCHED  4               /* filled by a prefetch, not accessed yet */
+
+typedef struct
+{
+	uint64_t ea;                            /* 128 byte line, ~0: free */
+	uint8_t mask[16];                       /* bytes written */
+	int busy;                               /* put in flight from data */
+	uint32_t stamp;
+} eacache_wc;
+
+static uint8_t eacache_data[EACACHE_LINES][EACACHE_LINE] __attribute__((aligned(128)));
+static uint8_t eacache_wc_data[EACACHE_WC_LINES][128] __attribute__((aligned(128)));
+static uint8_t eacache_dirty[EACACHE_LINES][EACACHE_LINE / 8];
+static uint64_t eacache_tags[EACACHE_LINES];
+static uint32_t eacache_stamps[EACACHE_LINES];
+static uint8_t eacache_state[EACACHE_LINES];
+static eacache_wc eacache_wcs[EACACHE_WC_LINES];
+static uint32_t eacache_pending[EACACHE_MAX_PENDING];
+static uint32_t eacache_pending_count;
+static uint32_t eacache_clock;
+static uint32_t eacache_last_index;
+static uint64_t eacache_stats_ea;
+static eaCacheStats eacache_stats;
+
+uint64_t eacache_last_line = ~0ULL;
+uint8_t *eacache_last_data;
+uint8_t *eacache_last_dirty;
+uint32_t eacache_fast_hits;
+
+/* DMA primitives: every transfer on EACACHE_TAG, gets fenced behind earlier puts */
+
+#ifdef __SPU__
+
+static uint8_t eacache_merge_line[128] __attribute__((aligned(128)));
+
+static inline uint32_t eacache_ticks(void)
+{
+	return ~spu_read_decrementer();
+}
+
+static inline void eacache_dma_get(void *ls, uint64_t ea, uint32_t size)
+{
+	mfc_getf(ls, ea, size, EACACHE_TAG, 0, 0);
+}
+
+static inline void eacache_dma_put(const void *ls, uint64_t ea, uint32_t size)
+{
+	mfc_put((volatile void *) ls, ea, size, EACACHE_TAG, 0, 0);
+}
+
+static inline void eacache_dma_sync(void)
+{
+	mfc_write_tag_mask(1 << EACACHE_TAG);
+	mfc_read_tag_status_all();
+}
+
+static void eacache_dma_merge(uint64_t ea, const uint8_t *src, const uint8_t *mask)
+{
+	uint32_t i;
+
+	do {
+		mfc_getllar(eacache_merge_line, ea, 0, 0);
+		mfc_read_atomic_status();
+		for (i = 0; i < 128; i++)
+			if (mask[i >> 3] & (1 << (i & 7)))
+				eacache_merge_line[i] = src[i];
+		mfc_putllc(eacache_merge_line, ea, 0, 0);
+	} while (mfc_read_atomic_status() & MFC_PUTLLC_STATUS);
+}
+
+#else
+
+static inline uint32_t eacache_ticks(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t) (ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+static inline void eacache_dma_get(void *ls, uint64_t ea, uint32_t size)
+{
+	memcpy(ls, (const void *) (uintptr_t) ea, size);
+}
+
+static inline void eacache_dma_put(const void *ls, uint64_t ea, uint32_t size)
+{
+	memcpy((void *) (uintptr_t) ea, ls, size);
+}
+
+static inline void eacache_dma_sync(void)
+{
+}
+
+static void eacache_dma_merge(uint64_t ea, const uint8_t *src, const uint8_t *mask)
+{
+	uint8_t *dst = (uint8_t *) (uintptr_t) ea;
+	uint32_t i;
+
+	for (i = 0; i < 128; i++)
+		if (mask[i >> 3] & (1 << (i & 7)))
+			dst[i] = src[i];
+}
+
+#endif
+
+static void eacache_wait(void)
+{
+	uint32_t t = eacache_ticks();
+	uint32_t i;
+
+	eacache_dma_sync();
+	eacache_stats.stall_ticks += (uint32_t) (eacache_ticks() - t);
+	for (i = 0; i < eacache_pending_count; i++)
+		eacache_state[eacache_pending[i]] &= ~EACACHE_PENDING;
+	eacache_pending_count = 0;
+	for (i = 0; i < EACACHE_WC_LINES; i++)
+		eacache_wcs[i].busy = 0;
+}
+
+static void eacache_get(void *ls, uint64_t ea, uint32_t size)
+{
+	eacache_dma_get(ls, ea, size);
+	eacache_stats.dma_bytes += size;
+}
+
+static void eacache_put(const void *ls, uint64_t ea, uint32_t size)
+{
+	eacache_dma_put(ls, ea, size);
+	eacache_stats.dma_bytes += size;
+}
+
+/* a reservation merge must not pass an older put of the same block */
+static void eacache_merge(uint64_t ea, const uint8_t *src, const uint8_t *mask)
+{
+	eacache_wait();
+	eacache_dma_merge(ea, src, mask);
+	eacache_stats.merges++;
+	eacache_stats.dma_bytes += 256;
+}
+
+/* write back the written bytes of one line: runs of full 128 byte blocks as one put */
+static void eacache_writeback(uint32_t i)
+{
+	const uint8_t *mask = eacache_dirty[i];
+	uint32_t run = 0, b, k;
+	int any = 0;
+
+	for (b = 0; b <= EACACHE_LINE / 128; b++) {
+		int full = 0, some = 0;
+
+		if (b < EACACHE_LINE / 128) {
+			full = 1;
+			for (k = 0; k < 16; k++) {
+				full &= mask[b * 16 + k] == 0xff;
+				some |= mask[b * 16 + k];
+			}
+		}
+		if (!full && b > run)
+			eacache_put(eacache_data[i] + run * 128, eacache_tags[i] + run * 128, (b - run) * 128);
+		if (!full) {
+			if (some)
+				eacache_merge(eacache_tags[i] + b * 128, eacache_data[i] + b * 128, mask + b * 16);
+			run = b + 1;
+		}
+		any |= some;
+	}
+	if (any) {
+		memset(eacache_dirty[i], 0, sizeof(eacache_dirty[i]));
+		eacache_stats.writebacks++;
+	}
+}
+
+static void eacache_wc_flush(eacache_wc *wc)
+{
+	uint8_t *data = eacache_wc_data[wc - eacache_wcs];
+	uint32_t k;
+	int full = 1, any = 0;
+
+	for (k = 0; k < 16; k++) {
+		full &= wc->mask[k] == 0xff;
+		any |= wc->mask[k];
+	}
+	if (!any) {
+		wc->ea = ~0ULL;
+		return;
+	}
+	if (full) {
+		eacache_put(data, wc->ea, 128);
+		wc->busy = 1;
+	} else {
+		eacache_merge(wc->ea, data, wc->mask);
+	}
+	memset(wc->mask, 0, sizeof(wc->mask));
+	wc->ea = ~0ULL;
+	eacache_stats.stream_flushes++;
+}
+
+/* write combined bytes of a line about to be filled go out first; the fenced get orders after them */
+static void eacache_wc_flush_range(uint64_t line)
+{
+	uint32_t i;
+
+	for (i = 0; i < EACACHE_WC_LINES; i++)
+		if (eacache_wcs[i].ea != ~0ULL && eacache_wcs[i].ea - line < EACACHE_LINE)
+			eacache_wc_flush(&eacache_wcs[i]);
+}
+
+static int eacache_lookup(uint64_t line)
+{
+	uint32_t base = ((uint32_t) (line / EACACHE_LINE) & (EACACHE_SETS - 1)) * EACACHE_WAYS;
+	uint32_t w;
+
+	for (w = 0; w < EACACHE_WAYS; w++)
+		if ((eacache_state[base + w] & EACACHE_VALID) && eacache_tags[base + w] == line)
+			return base + w;
+	return -1;
+}
+
+static void eacache_forget(uint32_t i)
+{
+	if (eacache_last_index == i)
+		eacache_last_line = ~0ULL;
+}
+
+/* pick the least recently used way of the set of line, write it back, start the fill */
+static uint32_t eacache_fill(uint64_t line)
+{
+	uint32_t base = ((uint32_t) (line / EACACHE_LINE) & (EACACHE_SETS - 1)) * EACACHE_WAYS;
+	uint32_t i = base, w;
+
+	for (w = 0; w < EACACHE_WAYS; w++) {
+		if (!(eacache_state[base + w] & EACACHE_VALID)) {
+			i = base + w;
+			break;
+		}
+		if ((int32_t) (eacache_stamps[base + w] - eacache_stamps[i]) < 0)
+			i = base + w;
+	}
+	if (eacache_state[i] & EACACHE_VALID) {
+		eacache_writeback(i);
+		eacache_stats.evictions++;
+		eacache_forget(i);
+	}
+	eacache_wc_flush_range(line);
+	eacache_get(eacache_data[i], line, EACACHE_LINE);
+	eacache_tags[i] = line;
+	eacache_state[i] = EACACHE_VALID;
+	eacache_stamps[i] = ++eacache_clock;
+	return i;
+}
+
+void eaCacheInit(uint64_t stats_ea)
+{
+	uint32_t i;
+
+	memset(eacache_state, 0, sizeof(eacache_state));
+	memset(eacache_dirty, 0, sizeof(eacache_dirty));
+	memset(eacache_wcs, 0, sizeof(eacache_wcs));
+	for (i = 0; i < EACACHE_WC_LINES; i++)
+		eacache_wcs[i].ea = ~0ULL;
+	memset(&eacache_stats, 0, sizeof(eacache_stats));
+	eacache_pending_count = 0;
+	eacache_fast_hits = 0;
+	eacache_last_line = ~0ULL;
+	eacache_stats_ea = stats_ea;
+}
+
+void *eaCacheFetchSlow(uint64_t ea, uint32_t dirty)
+{
+	uint64_t line = ea & ~(uint64_t) (EACACHE_LINE - 1);
+	int i = eacache_lookup(line);
+
+	if (i >= 0) {
+		if (eacache_state[i] & EACACHE_PENDING)
+			eacache_wait();
+		if (eacache_state[i] & EACACHE_PREFETCHED)
+			eacache_stats.prefetch_hits++;
+		eacache_state[i] &= ~EACACHE_PREFETCHED;
+		eacache_stats.hits++;
+		eacache_stamps[i] = ++eacache_clock;
+	} else {
+		i = eacache_fill(line);
+		eacache_wait();
+		eacache_stats.misses++;
+#if EACACHE_PUBLISH_MISSES
+		if (eacache_stats.misses % EACACHE_PUBLISH_MISSES == 0)
+			eaCacheStatsPublish();
+#endif
+	}
+	if (dirty)
+		eacache_mark(eacache_dirty[i], ea & (EACACHE_LINE - 1), dirty);
+	eacache_last_line = line;
+	eacache_last_index = i;
+	eacache_last_data = eacache_data[i];
+	eacache_last_dirty = eacache_dirty[i];
+	return eacache_data[i] + (ea & (EACACHE_LINE - 1));
+}
+
+void eaCachePrefetch(uint64_t ea)
+{
+	uint64_t line = ea & ~(uint64_t) (EACACHE_LINE - 1);
+	uint32_t i;
+
+	if (eacache_lookup(line) >= 0)
+		return;
+	if (eacache_pending_count == EACACHE_MAX_PENDING) {
+		eacache_stats.prefetch_dropped++;
+		return;
+	}
+	i = eacache_fill(line);
+	eacache_state[i] |= EACACHE_PENDING | EACACHE_PREFETCHED;
+	eacache_pending[eacache_pending_count++] = i;
+	eacache_stats.prefetches++;
+}
+
+void eaCacheStreamStore(uint64_t ea, const void *src, uint32_t size)
+{
+	const uint8_t *p = (const uint8_t *) src;
+
+	eacache_stats.stream_stores += size;
+	while (size) {
+		uint64_t line = ea & ~127ULL;
+		uint32_t off = ea & 127;
+		uint32_t n = size < 128 - off ? size : 128 - off;
+		eacache_wc *wc = NULL;
+		uint32_t k;
+		int i = eacache_lookup(ea & ~(uint64_t) (EACACHE_LINE - 1));
+
+		if (i >= 0) {
+			/* cached lines take the bytes, the write combining buffers never alias them */
+			if (eacache_state[i] & EACACHE_PENDING)
+				eacache_wait();
+			memcpy(eacache_data[i] + (ea & (EACACHE_LINE - 1)), p, n);
+			eacache_mark(eacache_dirty[i], ea & (EACACHE_LINE - 1), n);
+		} else {
+			for (k = 0; k < EACACHE_WC_LINES && !wc; k++)
+				if (eacache_wcs[k].ea == line)
+					wc = &eacache_wcs[k];
+			if (!wc) {
+				wc = &eacache_wcs[0];
+				for (k = 1; k < EACACHE_WC_LINES; k++)
+					if ((int32_t) (eacache_wcs[k].stamp - wc->stamp) < 0)
+						wc = &eacache_wcs[k];
+				eacache_wc_flush(wc);
+				if (wc->busy)
+					eacache_wait();
+				wc->ea = line;
+			}
+			wc->stamp = ++eacache_clock;
+			memcpy(eacache_wc_data[wc - eacache_wcs] + off, p, n);
+			eacache_mark(wc->mask, off, n);
+			if (off + n == 128)
+				eacache_wc_flush(wc);
+		}
+		ea += n;
+		p += n;
+		size -= n;
+	}
+}
+
+void eaCacheEvict(uint64_t ea)
+{
+	uint64_t line = ea & ~(uint64_t) (EACACHE_LINE - 1);
+	int i = eacache_lookup(line);
+
+	eacache_wc_flush_range(line);
+	if (i >= 0) {
+		eacache_writeback(i);
+		eacache_state[i] = 0;
+		eacache_forget(i);
+	}
+	eacache_wait();
+}
+
+void eaCacheFlush(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < EACACHE_LINES; i++)
+		if (eacache_state[i] & EACACHE_VALID)
+			eacache_writeback(i);
+	for (i = 0; i < EACACHE_WC_LINES; i++)
+		eacache_wc_flush(&eacache_wcs[i]);
+	eacache_wait();
+	eaCacheStatsPublish();
+}
+
+void eaCacheInvalidateAll(void)
+{
+	uint32_t i;
+
+	eacache_wait();
+	memset(eacache_state, 0, sizeof(eacache_state));
+	memset(eacache_dirty, 0, sizeof(eacache_dirty));
+	for (i = 0; i < EACACHE_WC_LINES; i++) {
+		memset(eacache_wcs[i].mask, 0, sizeof(eacache_wcs[i].mask));
+		eacache_wcs[i].ea = ~0ULL;
+	}
+	eacache_last_line = ~0ULL;
+}
+
+void eaCacheGetStats(eaCacheStats *stats)
+{
+	*stats = eacache_stats;
+	stats->hits += eacache_fast_hits;
+	stats->size = EACACHE_SIZE;
+	stats->ways = EACACHE_WAYS;
+	stats->line = EACACHE_LINE;
+	stats->sets = EACACHE_SETS;
+}
+
+void eaCacheStatsPublish(void)
+{
+	static eaCacheStats copy;
+
+	if (!eacache_stats_ea)
+		return;
+	eacache_stats.publishes++;
+	eaCacheGetStats(&copy);
+	eacache_dma_put(&copy, eacache_stats_ea, sizeof(copy));
+	eacache_dma_sync();
+}
+
+int eaCacheBench(uint64_t ea, uint32_t bytes, uint32_t accesses, int pattern, eaCacheBenchResult *result)
+{
+	eaCacheStats before, after;
+	uint32_t start, x = 12345, sum = 0, n, k;
+	uint64_t node;
+
+	if (bytes < 16 || (bytes & (bytes - 1)) || pattern < EACACHE_BENCH_SEQUENTIAL || pattern > EACACHE_BENCH_LINKED_LIST)
+		return -1;
+
+	if (pattern == EACACHE_BENCH_LINKED_LIST) {
+		/* node k links to (5k + 1) mod n: one cycle through every node */
+		n = bytes / 16;
+		for (k = 0; k < n; k++) {
+			uint64_t link[2];
+
+			link[0] = ea + (uint64_t) ((5 * k + 1) & (n - 1)) * 16;
+			link[1] = k;
+			eaCacheStreamStore(ea + (uint64_t) k * 16, link, 16);
+		}
+	}
+	eaCacheFlush();
+	eaCacheInvalidateAll();
+	eaCacheGetStats(&before);
+
+	start = eacache_ticks();
+	switch (pattern) {
+	case EACACHE_BENCH_SEQUENTIAL:
+		for (k = 0; k < accesses; k++)
+			sum += EACACHE_LOAD(uint32_t, ea + ((k * 4) & (bytes - 1)));
+		break;
+	case EACACHE_BENCH_SEQUENTIAL_PREFETCH:
+		for (k = 0; k < accesses; k++) {
+			uint32_t off = (k * 4) & (bytes - 1);
+
+			if (!(off & (EACACHE_LINE - 1)))
+				eaCachePrefetch(ea + ((off + 2 * EACACHE_LINE) & (bytes - 1)));
+			sum += EACACHE_LOAD(uint32_t, ea + off);
+		}
+		break;
+	case EACACHE_BENCH_RANDOM:
+		for (k = 0; k < accesses; k++) {
+			x = x * 1664525 + 1013904223;
+			sum += EACACHE_LOAD(uint32_t, ea + ((x >> 8) & (bytes - 4)));
+		}
+		break;
+	case EACACHE_BENCH_LINKED_LIST:
+		node = ea;
+		for (k = 0; k < accesses; k++) {
+			const uint64_t *p = (const uint64_t *) eaCacheFetch(node);
+
+			sum += (uint32_t) p[1];
+			node = p[0];
+		}
+		break;
+	}
+	result->ticks = eacache_ticks() - start;
+
+	eaCacheGetStats(&after);
+	result->accesses = accesses;
+#ifdef __SPU__
+	result->ns_per_access = accesses ? result->ticks * (1e9f / 79800000.0f) / accesses : 0;
+#else
+	result->ns_per_access = accesses ? (float) result->ticks / accesses : 0;
+#endif
+	result->hits = after.hits - before.hits;
+	result->misses = after.misses - before.misses;
+	result->sink = sum;
+	return 0;
+}
+
+#endif /* EACACHE_IMPLEMENTATION */
+
+#else /* __PPU__ */
+
+/*! \brief Consistent copy of the counters published by the SPU. */
+static inline void eaCacheStatsRead(const volatile eaCacheStats *src, eaCacheStats *dst)
+{
+	uint32_t seq;
+
+	do {
+		seq = src->publishes;
+		__asm__ volatile ("lwsync" ::: "memory");
+		memcpy(dst, (const void *) src, sizeof(*dst));
+		__asm__ volatile ("lwsync" ::: "memory");
+	} while (src->publishes != seq);
+}
+
+#endif
+
+/*! \brief Fraction of the accesses served from local store. */
+static inline float eaCacheHitRate(const eaCacheStats *stats)
+{
+	uint64_t total = stats->hits + stats->misses;
+
+	return total ? (float) stats->hits / total : 0.0f;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1358 @@
+/*! \file fsched.h
+ \brief Asynchronous file read scheduler over sysFsAio.
+
+ Streaming code hands read requests (file, offset, size, buffer,
+ priority, deadline) to the scheduler and gets them back through a
+ callback or by waiting on the request. The scheduler owns the drive:
+
+ - pending requests are served by priority (0 first), and within a
+   priority in elevator order (C-SCAN) of their physical position, the
+   base given to \ref fschedOpen plus the offset. A request whose
+   deadline is nearer than \ref fschedConfig::urgent jumps the queue,
+   earliest deadline first;
+ - requests of the same file that overlap or lie within
+   \ref fschedConfig::gap bytes of each other are read by one operation
+   into a staging buffer and copied out; a lone request, or one flagged
+   \ref FSCHED_DIRECT (e.g. into RSX memory), is read straight into the
+   buffer of the caller;
+ - at most \ref fschedConfig::inflight operations are in flight;
+ - a file read sequentially gets \ref fschedConfig::readahead bytes read
+   past the request. Staging buffers stay as windows of the file until
+   they are reused: requests that fall inside one are copied at once,
+   requests that fall inside a read in flight join it, and a sequential
+   reader getting close to the end of its window queues the next one at
+   the lowest priority. A request running past the end of a window gets
+   its head from the window and goes on from the end of it.
+
+ The physical position is only known to the caller: on a disc, files
+ are laid out in the order of the image, so passing that order (or
+ reading everything from one archive) gives the elevator something to
+ work with. \ref FSCHED_BASE_AUTO places files one after another in the
+ order they are opened.
+
+ Callbacks run on the completion thread (the AIO thread of lv2) and
+ must not block; they may submit new requests, the completed one
+ included. \ref fschedWait returns after the callback ran.
+
+ The scheduler counts queue depth, operations, seeks and their
+ distance, bytes read and delivered, readahead, deadline misses and
+ latency; \ref fschedDumpStats prints them with the rate of the drive
+ while busy.
+
+ On the host, sysFs is replaced by a simulated drive: one thread serving
+ the operations in order with pread(), after sleeping for a seek (fixed
+ part plus a part per GB of distance) and the transfer at a fixed rate.
+
+ - #define FSCHED_IMPLEMENTATION in one source file.
+*/
+
+#ifndef __FSCHED_H__
+#define __FSCHED_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __PPU__
+#include <ppu-types.h>
+#include <sys/systime.h>
+#include <lv2/sysfs.h>
+#include <lv2/mutex.h>
+#include <lv2/cond.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#define FSCHED_OK               0
+#define FSCHED_PENDING          1           /*!< status of a request not completed yet */
+#define FSCHED_EINVAL           -1
+#define FSCHED_ENOMEM           -2
+#define FSCHED_EBUSY            -3
+#define FSCHED_EIO              -4          /* open or read failed */
+#define FSCHED_ECANCELED        -5
+#define FSCHED_ETIMEDOUT        -6
+#define FSCHED_EFULL            -7          /* no free file slot */
+
+#ifndef FSCHED_MAX_FILES
+#define FSCHED_MAX_FILES        32
+#endif
+
+#define FSCHED_BASE_AUTO        (~0ULL)     /*!< \ref fschedOpen: place after the previous file */
+#define FSCHED_PRIORITY_IDLE    0xffffffff  /*!< priority of readahead */
+
+#define FSCHED_DIRECT           0x01        /*!< request flag: read into the buffer alone, never staged */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _fsched fsched;
+typedef struct _fsched_request fschedRequest;
+
+/*! \brief Completion callback, on the completion thread. */
+typedef void (*fschedCallback)(fschedRequest *req, void *arg);
+
+/*! \brief Read request; owned by the caller until its status is no longer \ref FSCHED_PENDING. */
+struct _fsched_request
+{
+	uint32_t file;                  /*!< \brief from \ref fschedOpen */
+	uint32_t priority;              /*!< \brief 0 is served first */
+	uint64_t offset;
+	uint64_t size;
+	void *buffer;
+	uint64_t deadline;              /*!< \brief \ref fschedNow time the data is needed by, 0: none */
+	fschedCallback callback;        /*!< \brief may be NULL */
+	void *arg;
+	uint32_t flags;                 /*!< \brief \ref FSCHED_DIRECT */
+
+	volatile int32_t status;        /*!< \brief \ref FSCHED_PENDING, then FSCHED_OK or an error */
+	uint64_t result;                /*!< \brief bytes read, short at the end of the file */
+	uint64_t submitted;             /*!< \brief \ref fschedNow times */
+	uint64_t completed;
+
+	/* private */
+	fschedRequest *next;
+	fschedRequest *prev;
+	uint64_t phys;
+	uint64_t begin;
+	uint64_t end;
+	void *op;
+	int32_t error;
+	uint32_t where;
+};
+
+/*! \brief Scheduler configuration, see \ref fschedDefaults. */
+typedef struct _fsched_config
+{
+	uint32_t inflight;              /*!< \brief operations in flight at once */
+	uint32_t buffers;               /*!< \brief staging buffers, kept as readahead windows */
+	uint32_t buffer_size;           /*!< \brief bytes per staging buffer: the largest coalesced read */
+	uint32_t readahead;             /*!< \brief bytes read past a sequential request, 0: none */
+	uint32_t gap;                   /*!< \brief largest hole read through to coalesce two requests */
+	uint32_t urgent;                /*!< \brief usec: a nearer deadline jumps the queue */
+	const char *mount;              /*!< \brief PPU: mount point for sysFsAioInit */
+	uint32_t seek_usec;             /*!< \brief simulated drive: fixed cost of a seek */
+	uint32_t seek_usec_gb;          /*!< \brief simulated drive: seek cost per GB of distance */
+	uint32_t rate;                  /*!< \brief simulated drive: bytes per second */
+} fschedConfig;
+
+/*! \brief Statistics since \ref fschedCreate or \ref fschedResetStats. */
+typedef struct _fsched_stats
+{
+	uint64_t requests;
+	uint64_t completed;
+	uint64_t cancelled;
+	uint64_t errors;
+	uint64_t hits;                  /*!< \brief served from a window without a read */
+	uint64_t joined;                /*!< \brief joined an operation already in flight */
+	uint64_t coalesced;             /*!< \brief served by an operation together with others */
+	uint64_t ops;                   /*!< \brief operations issued */
+	uint64_t direct;                /*!< \brief of which read into the buffer of the caller */
+	uint64_t prefetches;            /*!< \brief readahead operations without a request */
+	uint64_t seeks;                 /*!< \brief operations not starting where the last one ended */
+	uint64_t seek_bytes;            /*!< \brief summed seek distance */
+	uint64_t bytes_read;
+	uint64_t bytes_delivered;
+	uint64_t readahead_bytes;       /*!< \brief read past the requests of an operation */
+	uint64_t deadline_misses;
+	uint64_t max_late_usec;
+	uint64_t latency_usec;          /*!< \brief submit to completion, summed */
+	uint64_t max_latency_usec;
+	uint32_t queue;                 /*!< \brief requests waiting now */
+	uint32_t max_queue;
+	uint64_t queue_sum;             /*!< \brief queue depth seen by each request, summed */
+	uint32_t inflight;              /*!< \brief operations in flight now */
+	uint32_t max_inflight;
+	uint64_t busy_usec;             /*!< \brief time with an operation in flight */
+	uint64_t elapsed_usec;
+} fschedStats;
+
+/*! \brief Current time in usec, the clock of deadlines. */
+static inline uint64_t fschedNow(void)
+{
+#ifdef __PPU__
+	return sysGetSystemTime();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+#endif
+}
+
+/*! \brief Fill \p config with the defaults: 2 in flight, 4 buffers of 1MB,
+    512KB readahead, 64KB gap, 100ms urgency, /dev_bdvd and a drive with
+    80ms + 120ms/GB seeks at 9MB/s. */
+void fschedDefaults(fschedConfig *config);
+
+/*! \brief Create a scheduler; \p config may be NULL for the defaults. */
+int fschedCreate(fsched **sched, const fschedConfig *config);
+
+/*! \brief Wait for every request, then free the scheduler and close its files. */
+int fschedDestroy(fsched *sched);
+
+/*! \brief Open \p path for reading at physical position \p base (or \ref FSCHED_BASE_AUTO).
+    \return the file index, or an error */
+int fschedOpen(fsched *sched, const char *path, uint64_t base);
+
+/*! \brief Close a file; FSCHED_EBUSY while it has requests. */
+int fschedClose(fsched *sched, uint32_t file);
+
+/*! \brief Size of an open file. */
+uint64_t fschedFileSize(fsched *sched, uint32_t file);
+
+/*! \brief Queue a read. The request may complete, and its callback run, before this returns. */
+int fschedRead(fsched *sched, fschedRequest *req);
+
+/*! \brief Fill a request, without flags, and queue it. */
+int fschedReadAsync(fsched *sched, fschedRequest *req, uint32_t file, uint64_t offset, uint64_t size, void *buffer,
+	uint32_t priority, uint64_t deadline, fschedCallback callback, void *arg);
+
+/*! \brief Complete a request that was not read yet with FSCHED_ECANCELED;
+    FSCHED_EBUSY when it is being read into its own buffer, delivered or done. */
+int fschedCancel(fsched *sched, fschedRequest *req);
+
+/*! \brief Wait for a request; \p timeout_usec 0 waits forever.
+    \return the status of the request, FSCHED_ETIMEDOUT */
+int fschedWait(fsched *sched, fschedRequest *req, uint64_t timeout_usec);
+
+/*! \brief Wait until every request and readahead submitted so far is completed. */
+void fschedDrain(fsched *sched);
+
+void fschedGetStats(fsched *sched, fschedStats *stats);
+void fschedResetStats(fsched *sched);
+void fschedDumpStats(fsched *sched, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef FSCHED_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __PPU__
+#include <malloc.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#define FSCHED_OP_FREE          0
+#define FSCHED_OP_INFLIGHT      1
+#define FSCHED_OP_CACHED        2
+#define FSCHED_OP_DONE          3           /* read, being delivered */
+
+#define FSCHED_IN_NONE          0
+#define FSCHED_IN_QUEUE         1
+#define FSCHED_IN_OP            2
+#define FSCHED_IN_CALLBACK      3
+
+#define FSCHED_FILE_OPEN        0x01
+#define FSCHED_FILE_PREFETCH    0x02        /* the readahead request is queued */
+
+#define FSCHED_INTERNAL(s, req) ((req) >= &(s)->files[0].prefetch && (req) <= &(s)->files[FSCHED_MAX_FILES - 1].prefetch)
+
+typedef struct _fsched_op
+{
+#ifdef __PPU__
+	sysFSAio aio;
+#endif
+	fsched *sched;
+	uint32_t state;
+	uint32_t file;
+	uint64_t offset;
+	uint64_t size;
+	uint64_t got;                   /* bytes read */
+	uint8_t *buffer;                /* staging, NULL: direct */
+	uint8_t *target;
+	fschedRequest *waiters;
+	uint32_t readers;               /* copies out of the buffer running unlocked */
+	int32_t error;
+	uint64_t used;                  /* lru stamp */
+	struct _fsched_op *next;        /* simulated drive queue */
+} fsched_op;
+
+typedef struct _fsched_file
+{
+	uint32_t flags;
+	int32_t fd;
+	uint64_t size;
+	uint64_t base;
+	uint64_t last_end;
+	uint32_t streak;                /* sequential requests in a row */
+	fschedRequest prefetch;
+} fsched_file;
+
+struct _fsched
+{
+	fschedConfig config;
+	fsched_file files[FSCHED_MAX_FILES];
+	fsched_op *ops;                 /* buffers staging ops, then inflight direct ops */
+	uint32_t nops;
+	uint8_t *memory;
+	fschedRequest *head;            /* pending */
+	fschedRequest *tail;
+	uint32_t outstanding;           /* requests not completed */
+	uint32_t completing;            /* completions running */
+	uint64_t position;              /* physical end of the last operation issued */
+	uint64_t next_base;
+	uint64_t clock;
+	uint64_t busy_start;
+	uint64_t stats_start;
+	fschedStats stats;
+#ifdef __PPU__
+	sys_lwmutex_t mutex;
+	sys_lwcond_t cond;
+#else
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t drive;
+	pthread_mutex_t drive_mutex;
+	pthread_cond_t drive_cond;
+	fsched_op *drive_head;
+	fsched_op *drive_tail;
+	uint64_t drive_position;
+	int drive_stop;
+#endif
+};
+
+static void fsched_complete(fsched *s, fsched_op *op, int32_t error, uint64_t got);
+
+/* locking and the drive */
+
+#ifdef __PPU__
+
+static int fsched_kernel_create(fsched *s)
+{
+	sys_lwmutex_attr_t mattr = { SYS_LWMUTEX_PROTOCOL_FIFO, SYS_LWMUTEX_ATTR_NOT_RECURSIVE, "fsched" };
+	sys_lwcond_attr_t cattr = { "fsched" };
+
+	if (sysLwMutexCreate(&s->mutex, &mattr))
+		return FSCHED_ENOMEM;
+	if (sysLwCondCreate(&s->cond, &s->mutex, &cattr)) {
+		sysLwMutexDestroy(&s->mutex);
+		return FSCHED_ENOMEM;
+	}
+	return FSCHED_OK;
+}
+
+static void fsched_kernel_destroy(fsched *s)
+{
+	sysLwCondDestroy(&s->cond);
+	sysLwMutexDestroy(&s->mutex);
+}
+
+#define fsched_lock(s)          sysLwMutexLock(&(s)->mutex, 0)
+#define fsched_unlock(s)        sysLwMutexUnlock(&(s)->mutex)
+#define fsched_broadcast(s)     sysLwCondSignalAll(&(s)->cond)
+#define fsched_wait(s, usec)    sysLwCondWait(&(s)->cond, (usec))
+
+static void *fsched_alloc(size_t size)
+{
+	return memalign(128, size);
+}
+
+static int fsched_drive_start(fsched *s)
+{
+	return sysFsAioInit(s->config.mount) ? FSCHED_EIO : FSCHED_OK;
+}
+
+static void fsched_drive_stop(fsched *s)
+{
+	sysFsAioFinish(s->config.mount);
+}
+
+static int fsched_drive_open(fsched *s, const char *path, int32_t *fd, uint64_t *size)
+{
+	sysFSStat st;
+	s32 handle;
+
+	(void) s;
+	if (sysFsOpen(path, SYS_O_RDONLY, &handle, NULL, 0))
+		return FSCHED_EIO;
+	if (sysFsFstat(handle, &st)) {
+		sysFsClose(handle);
+		return FSCHED_EIO;
+	}
+	*fd = handle;
+	*size = st.st_size;
+	return FSCHED_OK;
+}
+
+static void fsched_drive_close(fsched *s, int32_t fd)
+{
+	(void) s;
+	sysFsClose(fd);
+}
+
+static void fsched_aio_done(sysFSAio *aio, s32 error, s32 xid, u64 size)
+{
+	fsched_op *op = (fsched_op *) (uintptr_t) aio->usrdata;
+
+	(void) xid;
+	fsched_complete(op->sched, op, error ? FSCHED_EIO : FSCHED_OK, error ? 0 : size);
+}
+
+static int fsched_drive_read(fsched *s, fsched_op *op)
+{
+	s32 id;
+
+	op->aio.fd = s->files[op->file].fd;
+	op->aio.offset = op->offset;
+	op->aio.buffer_addr = (u32) (uintptr_t) op->target;
+	op->aio.size = op->size;
+	op->aio.usrdata = (u64) (uintptr_t) op;
+	return sysFsAioRead(&op->aio, &id, fsched_aio_done) ? FSCHED_EIO : FSCHED_OK;
+}
+
+#else
+
+static int fsched_kernel_create(fsched *s)
+{
+	pthread_condattr_t attr;
+
+	if (pthread_mutex_init(&s->mutex, NULL))
+		return FSCHED_ENOMEM;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	if (pthread_cond_init(&s->cond, &attr)) {
+		pthread_condattr_destroy(&attr);
+		pthread_mutex_destroy(&s->mutex);
+		return FSCHED_ENOMEM;
+	}
+	pthread_condattr_destroy(&attr);
+	return FSCHED_OK;
+}
+
+static void fsched_kernel_destroy(fsched *s)
+{
+	pthread_cond_destroy(&s->cond);
+	pthread_mutex_destroy(&s->mutex);
+}
+
+#define fsched_lock(s)          pthread_mutex_lock(&(s)->mutex)
+#define fsched_unlock(s)        pthread_mutex_unlock(&(s)->mutex)
+#define fsched_broadcast(s)     pthread_cond_broadcast(&(s)->cond)
+
+static void fsched_wait(fsched *s, uint64_t usec)
+{
+	struct timespec ts;
+
+	if (!usec) {
+		pthread_cond_wait(&s->cond, &s->mutex);
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec += usec / 1000000;
+	ts.tv_nsec += (usec % 1000000) * 1000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	pthread_cond_timedwait(&s->cond, &s->mutex, &ts);
+}
+
+static void *fsched_alloc(size_t size)
+{
+	void *p;
+
+	return posix_memalign(&p, 128, size) ? NULL : p;
+}
+
+/* the simulated drive serves one operation at a time, in the order issued */
+static void *fsched_drive_thread(void *arg)
+{
+	fsched *s = (fsched *) arg;
+	fsched_op *op;
+	uint64_t phys, dist, usec;
+	ssize_t n;
+
+	for (;;) {
+		pthread_mutex_lock(&s->drive_mutex);
+		while (!s->drive_head && !s->drive_stop)
+			pthread_cond_wait(&s->drive_cond, &s->drive_mutex);
+		op = s->drive_head;
+		if (!op) {
+			pthread_mutex_unlock(&s->drive_mutex);
+			break;
+		}
+		s->drive_head = op->next;
+		if (!s->drive_head)
+			s->drive_tail = NULL;
+		pthread_mutex_unlock(&s->drive_mutex);
+
+		phys = s->files[op->file].base + op->offset;
+		usec = 0;
+		if (phys != s->drive_position) {
+			dist = phys > s->drive_position ? phys - s->drive_position : s->drive_position - phys;
+			usec = s->config.seek_usec + (uint64_t) ((double) s->config.seek_usec_gb * dist / (1 << 30));
+		}
+		if (s->config.rate)
+			usec += op->size * 1000000ULL / s->config.rate;
+		if (usec)
+			usleep(usec);
+		n = pread(s->files[op->file].fd, op->target, op->size, op->offset);
+		s->drive_position = phys + (n > 0 ? n : 0);
+		fsched_complete(s, op, n < 0 ? FSCHED_EIO : FSCHED_OK, n < 0 ? 0 : n);
+	}
+	return NULL;
+}
+
+static int fsched_drive_start(fsched *s)
+{
+	s->drive_head = s->drive_tail = NULL;
+	s->drive_position = 0;
+	s->drive_stop = 0;
+	if (pthread_mutex_init(&s->drive_mutex, NULL))
+		return FSCHED_ENOMEM;
+	if (pthread_cond_init(&s->drive_cond, NULL)) {
+		pthread_mutex_destroy(&s->drive_mutex);
+		return FSCHED_ENOMEM;
+	}
+	if (pthread_create(&s->drive, NULL, fsched_drive_thread, s)) {
+		pthread_cond_destroy(&s->drive_cond);
+		pthread_mutex_destroy(&s->drive_mutex);
+		return FSCHED_ENOMEM;
+	}
+	return FSCHED_OK;
+}
+
+static void fsched_drive_stop(fsched *s)
+{
+	pthread_mutex_lock(&s->drive_mutex);
+	s->drive_stop = 1;
+	pthread_cond_signal(&s->drive_cond);
+	pthread_mutex_unlock(&s->drive_mutex);
+	pthread_join(s->drive, NULL);
+	pthread_cond_destroy(&s->drive_cond);
+	pthread_mutex_destroy(&s->drive_mutex);
+}
+
+static int fsched_drive_open(fsched *s, const char *path, int32_t *fd, uint64_t *size)
+{
+	struct stat st;
+	int handle;
+
+	(void) s;
+	handle = open(path, O_RDONLY);
+	if (handle < 0)
+		return FSCHED_EIO;
+	if (fstat(handle, &st)) {
+		close(handle);
+		return FSCHED_EIO;
+	}
+	*fd = handle;
+	*size = st.st_size;
+	return FSCHED_OK;
+}
+
+static void fsched_drive_close(fsched *s, int32_t fd)
+{
+	(void) s;
+	close(fd);
+}
+
+static int fsched_drive_read(fsched *s, fsched_op *op)
+{
+	op->next = NULL;
+	pthread_mutex_lock(&s->drive_mutex);
+	if (s->drive_tail)
+		s->drive_tail->next = op;
+	else
+		s->drive_head = op;
+	s->drive_tail = op;
+	pthread_cond_signal(&s->drive_cond);
+	pthread_mutex_unlock(&s->drive_mutex);
+	return FSCHED_OK;
+}
+
+#endif
+
+/* queue */
+
+static void fsched_enqueue(fsched *s, fschedRequest *req)
+{
+	req->next = NULL;
+	req->prev = s->tail;
+	if (s->tail)
+		s->tail->next = req;
+	else
+		s->head = req;
+	s->tail = req;
+	req->where = FSCHED_IN_QUEUE;
+	s->stats.queue++;
+	if (s->stats.queue > s->stats.max_queue)
+		s->stats.max_queue = s->stats.queue;
+}
+
+static void fsched_dequeue(fsched *s, fschedRequest *req)
+{
+	if (req->prev)
+		req->prev->next = req->next;
+	else
+		s->head = req->next;
+	if (req->next)
+		req->next->prev = req->prev;
+	else
+		s->tail = req->prev;
+	req->next = req->prev = NULL;
+	req->where = FSCHED_IN_NONE;
+	s->stats.queue--;
+	if (FSCHED_INTERNAL(s, req))
+		s->files[req->file].flags &= ~FSCHED_FILE_PREFETCH;
+}
+
+/* window of the file holding offset, read or being read; the one reaching furthest */
+static fsched_op *fsched_find(fsched *s, uint32_t file, uint64_t offset)
+{
+	fsched_op *best = NULL;
+	uint64_t best_end = 0, end;
+	uint32_t i;
+
+	for (i = 0; i < s->nops; i++) {
+		fsched_op *op = &s->ops[i];
+
+		if (!op->buffer || op->file != file || offset < op->offset)
+			continue;
+		if (op->state == FSCHED_OP_INFLIGHT)
+			end = op->offset + op->size;
+		else if (op->state == FSCHED_OP_CACHED)
+			end = op->offset + op->got;
+		else
+			continue;
+		if (offset < end && end > best_end) {
+			best = op;
+			best_end = end;
+		}
+	}
+	return best;
+}
+
+/* a sequential reader close to the end of its window queues the next one */
+static void fsched_readahead(fsched *s, fsched_op *op, fschedRequest *req)
+{
+	fsched_file *f = &s->files[req->file];
+	fschedRequest *pf = &f->prefetch;
+	uint64_t end = op->offset + (op->state == FSCHED_OP_INFLIGHT ? op->size : op->got);
+
+	if (!s->config.readahead || !f->streak || (f->flags & FSCHED_FILE_PREFETCH))
+		return;
+	if (end >= f->size || end >= req->end + s->config.readahead / 2 || fsched_find(s, req->file, end))
+		return;
+	memset(pf, 0, sizeof(*pf));
+	pf->file = req->file;
+	pf->priority = FSCHED_PRIORITY_IDLE;
+	pf->offset = pf->begin = end;
+	pf->end = end + s->config.readahead < f->size ? end + s->config.readahead : f->size;
+	pf->size = pf->end - end;
+	pf->phys = f->base + end;
+	pf->status = FSCHED_PENDING;
+	fsched_enqueue(s, pf);
+	f->flags |= FSCHED_FILE_PREFETCH;
+}
+
+/* next request to serve: urgent deadlines, then priority, then elevator */
+static fschedRequest *fsched_pick(fsched *s, uint64_t now)
+{
+	fschedRequest *req, *best = NULL;
+	uint32_t priority = FSCHED_PRIORITY_IDLE;
+
+	for (req = s->head; req; req = req->next) {
+		if (req->deadline && req->deadline <= now + s->config.urgent && (!best || req->deadline < best->deadline))
+			best = req;
+		if (req->priority < priority)
+			priority = req->priority;
+	}
+	if (best)
+		return best;
+	for (req = s->head; req; req = req->next) {
+		if (req->priority != priority)
+			continue;
+		if (!best)
+			best = req;
+		else if ((req->phys >= s->position) != (best->phys >= s->position))
+			best = req->phys >= s->position ? req : best;
+		else if (req->phys < best->phys)
+			best = req;
+	}
+	return best;
+}
+
+/* an op for the next operation; direct ops are always free below the in flight limit */
+static fsched_op *fsched_op_get(fsched *s, int staging)
+{
+	fsched_op *lru = NULL;
+	uint32_t i;
+
+	if (!staging) {
+		for (i = s->config.buffers; i < s->nops; i++)
+			if (s->ops[i].state == FSCHED_OP_FREE)
+				return &s->ops[i];
+		return NULL;
+	}
+	for (i = 0; i < s->config.buffers; i++) {
+		fsched_op *op = &s->ops[i];
+
+		if (op->state == FSCHED_OP_FREE)
+			return op;
+		if (op->state == FSCHED_OP_CACHED && !op->readers && (!lru || op->used < lru->used))
+			lru = op;
+	}
+	return lru;
+}
+
+static void fsched_attach(fsched_op *op, fschedRequest *req)
+{
+	req->next = op->waiters;
+	req->prev = NULL;
+	op->waiters = req;
+	req->op = op;
+	req->where = FSCHED_IN_OP;
+}
+
+/* take the next operation off the queue, locked */
+static fsched_op *fsched_next(fsched *s)
+{
+	fschedRequest *seed, *req, *next;
+	fsched_file *f;
+	fsched_op *op;
+	uint64_t now = fschedNow(), start, end, cover, served, limit = s->config.buffer_size;
+	uint32_t members = 0;
+	int grown, big;
+
+	if (s->stats.inflight >= s->config.inflight || !s->head)
+		return NULL;
+	seed = fsched_pick(s, now);
+	f = &s->files[seed->file];
+	start = seed->begin;
+	end = seed->end;
+	big = end - start > limit;
+
+	if (!big) {
+		do {
+			grown = 0;
+			for (req = s->head; req; req = req->next) {
+				if (req->file != seed->file || (req->flags & FSCHED_DIRECT) || (req->begin >= start && req->end <= end))
+					continue;
+				if (req->begin >= start && req->begin <= end + s->config.gap && req->end - start <= limit) {
+					end = req->end;
+					grown = 1;
+				} else if (req->begin < start && req->end + s->config.gap >= start &&
+					(req->end > end ? req->end : end) - req->begin <= limit) {
+					start = req->begin;
+					if (req->end > end)
+						end = req->end;
+					grown = 1;
+				}
+			}
+		} while (grown && end - start <= limit);
+	}
+	cover = end;
+	for (req = s->head; req; req = req->next)
+		if (req->file == seed->file && !(req->flags & FSCHED_DIRECT) && req->begin >= start && req->end <= end)
+			members++;
+
+	if (big || (seed->flags & FSCHED_DIRECT) || (members == 1 && !FSCHED_INTERNAL(s, seed) && (!s->config.readahead || !f->streak)))
+		op = fsched_op_get(s, 0);
+	else {
+		op = fsched_op_get(s, 1);
+		if (!op) {
+			/* every buffer is busy: read the seed alone into its own buffer */
+			if (FSCHED_INTERNAL(s, seed))
+				return NULL;
+			op = fsched_op_get(s, 0);
+		} else if (s->config.readahead && f->streak && end < f->size) {
+			end = end + s->config.readahead < f->size ? end + s->config.readahead : f->size;
+			if (end - start > limit)
+				end = start + limit;
+		}
+	}
+	if (op && !op->buffer) {
+		start = seed->begin;
+		end = cover = seed->end;
+	}
+	if (!op)
+		return NULL;
+	if (op->state == FSCHED_OP_CACHED)
+		op->state = FSCHED_OP_FREE;
+
+	op->file = seed->file;
+	op->offset = start;
+	op->size = end - start;
+	op->got = 0;
+	op->error = FSCHED_OK;
+	op->waiters = NULL;
+	op->target = op->buffer ? op->buffer : (uint8_t *) seed->buffer + (seed->begin - seed->offset);
+	op->state = FSCHED_OP_INFLIGHT;
+
+	members = 0;
+	served = start;
+	for (req = s->head; req; req = next) {
+		next = req->next;
+		if (req->file != seed->file || req->begin < start || req->end > cover ||
+			(op->buffer ? (req->flags & FSCHED_DIRECT) != 0 : req != seed))
+			continue;
+		fsched_dequeue(s, req);
+		if (FSCHED_INTERNAL(s, req))
+			continue;
+		fsched_attach(op, req);
+		if (req->end > served)
+			served = req->end;
+		members++;
+	}
+
+	s->stats.ops++;
+	if (!op->buffer)
+		s->stats.direct++;
+	if (members > 1)
+		s->stats.coalesced += members;
+	if (!members)
+		s->stats.prefetches++;
+	if (end > served)
+		s->stats.readahead_bytes += end - served;
+	if (f->base + start != s->position) {
+		s->stats.seeks++;
+		s->stats.seek_bytes += f->base + start > s->position ? f->base + start - s->position : s->position - f->base - start;
+	}
+	s->position = f->base + end;
+	if (!s->stats.inflight++)
+		s->busy_start = now;
+	if (s->stats.inflight > s->stats.max_inflight)
+		s->stats.max_inflight = s->stats.inflight;
+	return op;
+}
+
+/* issue operations while there is room */
+static void fsched_pump(fsched *s)
+{
+	fsched_op *op;
+
+	for (;;) {
+		fsched_lock(s);
+		op = fsched_next(s);
+		fsched_unlock(s);
+		if (!op)
+			break;
+		if (fsched_drive_read(s, op))
+			fsched_complete(s, op, FSCHED_EIO, 0);
+	}
+}
+
+/* copy out of a window, unlocked; the op is held by its readers count.
+   Nonzero when the request runs past the window, which was read in full: the rest is still to read */
+static int fsched_copy(fsched_op *op, fschedRequest *req)
+{
+	uint64_t skip = req->begin - op->offset;
+	uint64_t n;
+
+	if (op->error) {
+		req->error = op->error;
+		req->result = 0;
+		return 0;
+	}
+	n = op->got > skip ? op->got - skip : 0;
+	if (n > req->end - req->begin)
+		n = req->end - req->begin;
+	if (op->buffer && n)
+		memcpy((uint8_t *) req->buffer + (req->begin - req->offset), op->buffer + skip, n);
+	req->begin += n;
+	req->error = FSCHED_OK;
+	req->result = req->begin - req->offset;
+	return req->begin < req->end && op->got == op->size;
+}
+
+/* serve a request from the windows as far as they go, then join the read in flight or queue the rest; locked.
+   Nonzero when it is complete */
+static int fsched_place(fsched *s, fschedRequest *req)
+{
+	fsched_op *op;
+	int more;
+
+	while ((op = fsched_find(s, req->file, req->begin)) != NULL) {
+		if (op->state == FSCHED_OP_INFLIGHT) {
+			fsched_attach(op, req);
+			s->stats.joined++;
+			fsched_readahead(s, op, req);
+			return 0;
+		}
+		op->readers++;
+		op->used = ++s->clock;
+		s->stats.hits++;
+		fsched_readahead(s, op, req);
+		fsched_unlock(s);
+		more = fsched_copy(op, req);
+		fsched_lock(s);
+		op->readers--;
+		if (!more)
+			return 1;
+	}
+	req->phys = s->files[req->file].base + req->begin;
+	fsched_enqueue(s, req);
+	return 0;
+}
+
+/* account, call back and publish requests linked through next */
+static void fsched_finish(fsched *s, fschedRequest *list)
+{
+	fschedRequest *req, *next;
+	uint64_t now = fschedNow(), latency;
+
+	fsched_lock(s);
+	for (req = list; req; req = req->next) {
+		req->completed = now;
+		latency = now - req->submitted;
+		s->stats.latency_usec += latency;
+		if (latency > s->stats.max_latency_usec)
+			s->stats.max_latency_usec = latency;
+		if (req->deadline && now > req->deadline) {
+			s->stats.deadline_misses++;
+			if (now - req->deadline > s->stats.max_late_usec)
+				s->stats.max_late_usec = now - req->deadline;
+		}
+		if (req->error == FSCHED_ECANCELED)
+			s->stats.cancelled++;
+		else if (req->error)
+			s->stats.errors++;
+		else
+			s->stats.bytes_delivered += req->result;
+		s->stats.completed++;
+	}
+	fsched_unlock(s);
+
+	/* a callback may submit the request again: waiters go on for the new read */
+	for (req = list; req; req = next) {
+		next = req->next;
+		req->op = NULL;
+		fsched_lock(s);
+		req->status = req->error;
+		req->where = req->callback ? FSCHED_IN_CALLBACK : FSCHED_IN_NONE;
+		fsched_unlock(s);
+		if (req->callback)
+			req->callback(req, req->arg);
+		fsched_lock(s);
+		if (req->where == FSCHED_IN_CALLBACK)
+			req->where = FSCHED_IN_NONE;
+		s->outstanding--;
+		fsched_broadcast(s);
+		fsched_unlock(s);
+	}
+}
+
+static void fsched_complete(fsched *s, fsched_op *op, int32_t error, uint64_t got)
+{
+	fschedRequest *list, *req, *next, **p, *rest = NULL;
+	uint64_t now = fschedNow();
+
+	fsched_lock(s);
+	s->completing++;
+	if (got > op->size)
+		got = op->size;
+	op->got = got;
+	op->error = error;
+	s->stats.bytes_read += got;
+	if (!--s->stats.inflight)
+		s->stats.busy_usec += now - s->busy_start;
+	list = op->waiters;
+	op->waiters = NULL;
+	for (req = list; req; req = req->next)
+		req->where = FSCHED_IN_NONE;
+	op->readers++;
+	op->state = op->buffer && !error ? FSCHED_OP_CACHED : FSCHED_OP_DONE;
+	op->used = ++s->clock;
+	fsched_unlock(s);
+
+	for (p = &list; (req = *p) != NULL;) {
+		if (fsched_copy(op, req)) {
+			*p = req->next;
+			req->next = rest;
+			rest = req;
+		} else
+			p = &req->next;
+	}
+
+	fsched_lock(s);
+	op->readers--;
+	if (op->state == FSCHED_OP_DONE)
+		op->state = FSCHED_OP_FREE;
+	fsched_unlock(s);
+
+	if (list)
+		fsched_finish(s, list);
+	/* the requests running past the window go on from its end */
+	for (req = rest; req; req = next) {
+		next = req->next;
+		fsched_lock(s);
+		if (fsched_place(s, req)) {
+			fsched_unlock(s);
+			req->next = NULL;
+			fsched_finish(s, req);
+		} else
+			fsched_unlock(s);
+	}
+	fsched_pump(s);
+
+	fsched_lock(s);
+	s->completing--;
+	fsched_broadcast(s);
+	fsched_unlock(s);
+}
+
+/* API */
+
+void fschedDefaults(fschedConfig *config)
+{
+	memset(config, 0, sizeof(*config));
+	config->inflight = 2;
+	config->buffers = 4;
+	config->buffer_size = 1 << 20;
+	config->readahead = 512 << 10;
+	config->gap = 64 << 10;
+	config->urgent = 100000;
+	config->mount = "/dev_bdvd";
+	config->seek_usec = 80000;
+	config->seek_usec_gb = 120000;
+	config->rate = 9 << 20;
+}
+
+int fschedCreate(fsched **sched, const fschedConfig *config)
+{
+	fsched *s;
+	uint32_t i;
+	int ret;
+
+	if (!sched)
+		return FSCHED_EINVAL;
+	*sched = NULL;
+	s = (fsched *) calloc(1, sizeof(fsched));
+	if (!s)
+		return FSCHED_ENOMEM;
+	if (config)
+		s->config = *config;
+	else
+		fschedDefaults(&s->config);
+	/* the size the buffers really get, before anything is checked or clamped against it: a readahead
+	   past it would turn a buffered read into one without a buffer */
+	s->config.buffer_size &= ~127U;
+	if (!s->config.inflight || !s->config.buffers || s->config.buffer_size < 2048) {
+		free(s);
+		return FSCHED_EINVAL;
+	}
+	if (s->config.readahead > s->config.buffer_size)
+		s->config.readahead = s->config.buffer_size;
+
+	s->nops = s->config.buffers + s->config.inflight;
+	s->ops = (fsched_op *) calloc(s->nops, sizeof(fsched_op));
+	s->memory = (uint8_t *) fsched_alloc((size_t) s->config.buffers * s->config.buffer_size);
+	if (!s->ops || !s->memory) {
+		free(s->ops);
+		free(s->memory);
+		free(s);
+		return FSCHED_ENOMEM;
+	}
+	for (i = 0; i < s->nops; i++) {
+		s->ops[i].sched = s;
+		s->ops[i].buffer = i < s->config.buffers ? s->memory + (size_t) i * s->config.buffer_size : NULL;
+	}
+	ret = fsched_kernel_create(s);
+	if (ret == FSCHED_OK) {
+		ret = fsched_drive_start(s);
+		if (ret)
+			fsched_kernel_destroy(s);
+	}
+	if (ret) {
+		free(s->ops);
+		free(s->memory);
+		free(s);
+		return ret;
+	}
+	s->stats_start = fschedNow();
+	*sched = s;
+	return FSCHED_OK;
+}
+
+int fschedDestroy(fsched *s)
+{
+	uint32_t i;
+
+	if (!s)
+		return FSCHED_EINVAL;
+	fsched_lock(s);
+	for (i = 0; i < FSCHED_MAX_FILES; i++)
+		if (s->files[i].flags & FSCHED_FILE_PREFETCH)
+			fsched_dequeue(s, &s->files[i].prefetch);
+	fsched_unlock(s);
+	fschedDrain(s);
+	fsched_drive_stop(s);
+	for (i = 0; i < FSCHED_MAX_FILES; i++)
+		if (s->files[i].flags & FSCHED_FILE_OPEN)
+			fsched_drive_close(s, s->files[i].fd);
+	fsched_kernel_destroy(s);
+	free(s->ops);
+	free(s->memory);
+	free(s);
+	return FSCHED_OK;
+}
+
+int fschedOpen(fsched *s, const char *path, uint64_t base)
+{
+	fsched_file *f = NULL;
+	int32_t fd;
+	uint64_t size;
+	uint32_t i;
+	int ret;
+
+	if (!s || !path)
+		return FSCHED_EINVAL;
+	ret = fsched_drive_open(s, path, &fd, &size);
+	if (ret)
+		return ret;
+	fsched_lock(s);
+	for (i = 0; i < FSCHED_MAX_FILES; i++)
+		if (!(s->files[i].flags & FSCHED_FILE_OPEN)) {
+			f = &s->files[i];
+			break;
+		}
+	if (!f) {
+		fsched_unlock(s);
+		fsched_drive_close(s, fd);
+		return FSCHED_EFULL;
+	}
+	memset(f, 0, sizeof(*f));
+	f->flags = FSCHED_FILE_OPEN;
+	f->fd = fd;
+	f->size = size;
+	f->base = base == FSCHED_BASE_AUTO ? s->next_base : base;
+	f->last_end = ~0ULL;
+	if (f->base + size > s->next_base)
+		s->next_base = (f->base + size + 0xfffff) & ~0xfffffULL;
+	fsched_unlock(s);
+	return (int) i;
+}
+
+int fschedClose(fsched *s, uint32_t file)
+{
+	fschedRequest *req;
+	uint32_t i;
+
+	if (!s || file >= FSCHED_MAX_FILES)
+		return FSCHED_EINVAL;
+	fsched_lock(s);
+	if (!(s->files[file].flags & FSCHED_FILE_OPEN)) {
+		fsched_unlock(s);
+		return FSCHED_EINVAL;
+	}
+	for (req = s->head; req; req = req->next)
+		if (req->file == file && !FSCHED_INTERNAL(s, req))
+			break;
+	for (i = 0; !req && i < s->nops; i++)
+		if (s->ops[i].file == file && (s->ops[i].state == FSCHED_OP_INFLIGHT || s->ops[i].state == FSCHED_OP_DONE ||
+			s->ops[i].readers))
+			break;
+	if (req || i < s->nops) {
+		fsched_unlock(s);
+		return FSCHED_EBUSY;
+	}
+	if (s->files[file].flags & FSCHED_FILE_PREFETCH)
+		fsched_dequeue(s, &s->files[file].prefetch);
+	for (i = 0; i < s->nops; i++)
+		if (s->ops[i].file == file && s->ops[i].state == FSCHED_OP_CACHED)
+			s->ops[i].state = FSCHED_OP_FREE;
+	s->files[file].flags = 0;
+	fsched_unlock(s);
+	fsched_drive_close(s, s->files[file].fd);
+	return FSCHED_OK;
+}
+
+uint64_t fschedFileSize(fsched *s, uint32_t file)
+{
+	if (!s || file >= FSCHED_MAX_FILES || !(s->files[file].flags & FSCHED_FILE_OPEN))
+		return 0;
+	return s->files[file].size;
+}
+
+int fschedRead(fsched *s, fschedRequest *req)
+{
+	fsched_file *f;
+
+	if (!s || !req || req->file >= FSCHED_MAX_FILES || (!req->buffer && req->size))
+		return FSCHED_EINVAL;
+	fsched_lock(s);
+	f = &s->files[req->file];
+	if (!(f->flags & FSCHED_FILE_OPEN)) {
+		fsched_unlock(s);
+		return FSCHED_EINVAL;
+	}
+	req->status = FSCHED_PENDING;
+	req->result = 0;
+	req->error = FSCHED_OK;
+	req->submitted = fschedNow();
+	req->completed = 0;
+	req->next = req->prev = NULL;
+	req->op = NULL;
+	req->phys = f->base + req->offset;
+	req->end = req->offset + req->size;
+	if (req->end > f->size || req->end < req->offset)
+		req->end = f->size;
+	if (req->offset > req->end)
+		req->offset = req->end;
+	req->begin = req->offset;
+	f->streak = req->offset == f->last_end ? f->streak + 1 : 0;
+	f->last_end = req->end;
+	s->outstanding++;
+	s->stats.requests++;
+	s->stats.queue_sum += s->stats.queue;
+
+	if (req->offset == req->end) {
+		/* nothing to read */
+		fsched_unlock(s);
+		fsched_finish(s, req);
+		return FSCHED_OK;
+	}
+	if (fsched_place(s, req)) {
+		fsched_unlock(s);
+		req->next = NULL;
+		fsched_finish(s, req);
+	} else
+		fsched_unlock(s);
+	fsched_pump(s);
+	return FSCHED_OK;
+}
+
+int fschedReadAsync(fsched *s, fschedRequest *req, uint32_t file, uint64_t offset, uint64_t size, void *buffer,
+	uint32_t priority, uint64_t deadline, fschedCallback callback, void *arg)
+{
+	if (!req)
+		return FSCHED_EINVAL;
+	req->file = file;
+	req->offset = offset;
+	req->size = size;
+	req->buffer = buffer;
+	req->priority = priority;
+	req->deadline = deadline;
+	req->callback = callback;
+	req->arg = arg;
+	req->flags = 0;
+	return fschedRead(s, req);
+}
+
+int fschedCancel(fsched *s, fschedRequest *req)
+{
+	fschedRequest **p;
+
+	if (!s || !req)
+		return FSCHED_EINVAL;
+	fsched_lock(s);
+	if (req->where == FSCHED_IN_QUEUE)
+		fsched_dequeue(s, req);
+	else if (req->where == FSCHED_IN_OP && ((fsched_op *) req->op)->buffer) {
+		/* the operation goes on for the others and the window */
+		for (p = &((fsched_op *) req->op)->waiters; *p != req; p = &(*p)->next)
+			;
+		*p = req->next;
+		req->where = FSCHED_IN_NONE;
+	} else {
+		fsched_unlock(s);
+		return FSCHED_EBUSY;
+	}
+	fsched_unlock(s);
+	req->next = NULL;
+	req->error = FSCHED_ECANCELED;
+	req->result = 0;
+	fsched_finish(s, req);
+	return FSCHED_OK;
+}
+
+int fschedWait(fsched *s, fschedRequest *req, uint64_t timeout_usec)
+{
+	uint64_t now, end = timeout_usec ? fschedNow() + timeout_usec : 0;
+	int32_t status;
+
+	if (!s || !req)
+		return FSCHED_EINVAL;
+	fsched_lock(s);
+	while (req->status == FSCHED_PENDING || req->where == FSCHED_IN_CALLBACK) {
+		if (!end)
+			fsched_wait(s, 0);
+		else {
+			now = fschedNow();
+			if (now >= end)
+				break;
+			fsched_wait(s, end - now);
+		}
+	}
+	status = req->status;
+	fsched_unlock(s);
+	return status == FSCHED_PENDING ? FSCHED_ETIMEDOUT : status;
+}
+
+void fschedDrain(fsched *s)
+{
+	fsched_lock(s);
+	while (s->outstanding || s->stats.inflight || s->completing)
+		fsched_wait(s, 0);
+	fsched_unlock(s);
+}
+
+void fschedGetStats(fsched *s, fschedStats *stats)
+{
+	uint64_t now = fschedNow();
+
+	fsched_lock(s);
+	*stats = s->stats;
+	stats->elapsed_usec = now - s->stats_start;
+	if (s->stats.inflight)
+		stats->busy_usec += now - s->busy_start;
+	fsched_unlock(s);
+}
+
+void fschedResetStats(fsched *s)
+{
+	uint32_t queue, inflight;
+
+	fsched_lock(s);
+	queue = s->stats.queue;
+	inflight = s->stats.inflight;
+	memset(&s->stats, 0, sizeof(s->stats));
+	s->stats.queue = s->stats.max_queue = queue;
+	s->stats.inflight = s->stats.max_inflight = inflight;
+	s->stats_start = s->busy_start = fschedNow();
+	fsched_unlock(s);
+}
+
+void fschedDumpStats(fsched *s, FILE *out)
+{
+	fschedStats st;
+	double busy, elapsed;
+
+	fschedGetStats(s, &st);
+	busy = st.busy_usec / 1000000.0;
+	elapsed = st.elapsed_usec / 1000000.0;
+	fprintf(out, "fsched: %llu requests, %llu completed, %llu cancelled, %llu errors\n",
+		(unsigned long long) st.requests, (unsigned long long) st.completed,
+		(unsigned long long) st.cancelled, (unsigned long long) st.errors);
+	fprintf(out, "  served: %llu window hits, %llu joined, %llu coalesced\n",
+		(unsigned long long) st.hits, (unsigned long long) st.joined, (unsigned long long) st.coalesced);
+	fprintf(out, "  ops: %llu (%llu direct, %llu readahead), max in flight %u\n",
+		(unsigned long long) st.ops, (unsigned long long) st.direct, (unsigned long long) st.prefetches,
+		st.max_inflight);
+	fprintf(out, "  queue: now %u, max %u, avg %.2f\n", st.queue, st.max_queue,
+		st.requests ? (double) st.queue_sum / st.requests : 0.0);
+	fprintf(out, "  seeks: %llu, avg distance %.2f MB\n", (unsigned long long) st.seeks,
+		st.seeks ? st.seek_bytes / 1048576.0 / st.seeks : 0.0);
+	fprintf(out, "  read %.2f MB (%.2f MB readahead), delivered %.2f MB\n", st.bytes_read / 1048576.0,
+		st.readahead_bytes / 1048576.0, st.bytes_delivered / 1048576.0);
+	fprintf(out, "  rate: %.2f MB/s busy (%.1f%% of %.2f s), %.2f MB/s delivered\n",
+		busy > 0 ? st.bytes_read / 1048576.0 / busy : 0.0, elapsed > 0 ? 100.0 * busy / elapsed : 0.0, elapsed,
+		elapsed > 0 ? st.bytes_delivered / 1048576.0 / elapsed : 0.0);
+	fprintf(out, "  latency: avg %.2f ms, max %.2f ms; deadline misses %llu, max late %.2f ms\n",
+		st.completed ? st.latency_usec / 1000.0 / st.completed : 0.0, st.max_latency_usec / 1000.0,
+		(unsigned long long) st.deadline_misses, st.max_late_usec / 1000.0);
+}
+
+#endif /* FSCHED_IMPLEMENTATION */
+
+#endif
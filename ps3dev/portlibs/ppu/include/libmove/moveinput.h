@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2013, Giovanni Dante Grazioli (deroad)
+ */
+
+/*
+ * PS Move source of the input service (io/input.h).
+ *
+ * Each sample runs moveCapture() on a snapshot context and stores the connected controllers and
+ * their buttons in the inputState, so the service queues their press and release events. The poses
+ * stay in the history rings of the context (moveHistoryGet(), moveSnapshotPredict()).
+ *
+ * On the PS3 chain it after the pads, keyboards and mice:
+ *        inputDevice move, system;
+ *        moveInputDevice( &move, &ctx );
+ *        inputDeviceSystem( &system, &move );
+ *        inputServiceStart( &service, &system, 240, 1000 );
+ * On the host it can be the device of the service, with a moveRecordedSource behind the context.
+ */
+
+#ifndef __LIBMOVE_MOVEINPUT_H__
+#define __LIBMOVE_MOVEINPUT_H__
+
+#include <io/input.h>
+#include <libmove/movesnapshot.h>
+
+static s32 move_input_sample(void *user, inputState *state)
+{
+	moveSnapshot pads[MOVE_SNAPSHOT_MAX_PADS];
+	int n = moveCapture((moveSnapshotContext *) user, pads, MOVE_SNAPSHOT_MAX_PADS), i;
+
+	/* an error keeps the previous state, like the other devices */
+	if (n < 0)
+		return 0;
+	/* a controller missing from the capture releases its buttons */
+	state->move_connected = 0;
+	memset(state->move_buttons, 0, sizeof(state->move_buttons));
+	for (i = 0; i < n; i++) {
+		if (pads[i].pad >= INPUT_MAX_MOVES)
+			continue;
+		state->move_connected |= 1 << pads[i].pad;
+		state->move_buttons[pads[i].pad] = pads[i].buttons;
+	}
+	return 0;
+}
+
+/*
+ * Fills device to sample the Move controllers of ctx (initialized with moveSnapshotInit()).
+ */
+static inline void moveInputDevice(inputDevice *device, moveSnapshotContext *ctx)
+{
+	device->sample = move_input_sample;
+	device->user = ctx;
+}
+
+#endif
@@ -0,0 +1,496 @@
+/*
+ * Copyright (C) 2013, Giovanni Dante Grazioli (deroad)
+ */
+
+/*
+ * Batched PS Move snapshots.
+ *
+ * moveCapture() reads every connected PLAYSTATION_MOVE_PAD_* in one call, all pads sampled at the
+ * same camera image time, and appends each sample to a per pad history ring. Readers of the ring
+ * (any thread) never block the capture thread. moveSnapshotPredict() extrapolates a sample to the
+ * display time to hide the camera latency.
+ *
+ * The samples come from a moveSource: the gem library on the PS3, or a recorded stream
+ * (moveRecordedSource) that also builds on the host, so the code using it can be tested offline.
+ *
+ * Define MOVE_SNAPSHOT_IMPLEMENTATION in one source file.
+ */
+
+#ifndef __LIBMOVE_MOVESNAPSHOT_H__
+#define __LIBMOVE_MOVESNAPSHOT_H__
+
+#include <ppu-types.h>
+#include <string.h>
+#include <math.h>
+#include <libmove/movebuttons.h>
+
+#ifdef __PPU__
+#include <io/move.h>
+#include <lv2/systime.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef LIBMOVE_OK
+#define LIBMOVE_OK			(0)
+#define LIBMOVE_ERROR			(-1)
+#endif
+
+#define MOVE_SNAPSHOT_MAX_PADS		8
+#define MOVE_HISTORY_LENGTH		64		/* power of 2 */
+
+/* gemPadData.buttons bits */
+#define MOVE_BUTTON_SELECT		0x0001
+#define MOVE_BUTTON_T			0x0002
+#define MOVE_BUTTON_ACTION		0x0004
+#define MOVE_BUTTON_START		0x0008
+#define MOVE_BUTTON_TRIANGLE		0x0010
+#define MOVE_BUTTON_CIRCLE		0x0020
+#define MOVE_BUTTON_CROSS		0x0040
+#define MOVE_BUTTON_SQUARE		0x0080
+
+/* moveSnapshot.tracking (GEM_TRACKING_*) */
+#define MOVE_TRACKING_POSITION		1
+#define MOVE_TRACKING_VISIBLE		2
+
+typedef struct {
+	u32 pad;			/* PLAYSTATION_MOVE_PAD_n */
+	u32 tracking;			/* MOVE_TRACKING_* */
+	system_time_t time;		/* sample time, microseconds */
+	f32 pos[3];			/* mm, camera space */
+	f32 vel[3];			/* mm/s */
+	f32 accel[3];			/* mm/s^2 */
+	f32 quat[4];			/* x, y, z, w */
+	f32 angvel[3];			/* rad/s */
+	u16 buttons;			/* MOVE_BUTTON_* */
+	u16 trigger;			/* 0x00 - 0xFF */
+	f32 temperature;
+} moveSnapshot;
+
+/* where the samples come from */
+
+typedef struct {
+	/* bit n set when PLAYSTATION_MOVE_PAD_n is connected */
+	int (*connected)(void *user, u32 *mask);
+	/* one consistent sample of every pad in mask; returns the number written to out */
+	int (*sample)(void *user, u32 mask, moveSnapshot *out);
+	void *user;
+} moveSource;
+
+/* lock free history of one pad: one writer (moveCapture), any number of readers */
+
+typedef struct {
+	volatile u32 head;		/* samples written so far */
+	u32 pad;
+	moveSnapshot ring[MOVE_HISTORY_LENGTH];
+} moveHistory;
+
+/* alpha-beta tracker smoothing position and velocity before the prediction */
+
+typedef struct {
+	f32 alpha;			/* position gain, 0 < alpha <= 1 */
+	f32 beta;			/* velocity gain, 0 <= beta < 2 */
+	u32 enabled;
+} moveFilter;
+
+typedef struct {
+	moveSource source;
+	moveFilter filter;
+	moveHistory history[MOVE_SNAPSHOT_MAX_PADS];
+	moveSnapshot filtered[MOVE_SNAPSHOT_MAX_PADS];
+	u32 filter_valid;		/* bit mask of pads with a filter state */
+	u32 captures;
+	u32 samples;
+} moveSnapshotContext;
+
+/* recorded input: plays back an array of snapshots, captured with moveRecord() or written by a tool */
+
+typedef struct {
+	const moveSnapshot *frames;	/* sorted by time, pads of a capture share one time */
+	u32 count;
+	u32 next;
+	u32 loop;
+} moveRecordedSource;
+
+/*
+ * Initializes the context. source NULL uses the gem library (initLibMove() must have been called),
+ * the filter starts disabled.
+ * Return LIBMOVE_OK if nothing went wrong.
+ */
+int  moveSnapshotInit(moveSnapshotContext *ctx, const moveSource *source);
+
+/*
+ * Captures all connected pads into out (max entries) and into the history rings.
+ * Return the number of snapshots written to out, 0 if no pad is connected, -1 (LIBMOVE_ERROR) on error.
+ * an example:
+ *        moveSnapshot pads[MOVE_SNAPSHOT_MAX_PADS];
+ *        int n = moveCapture( &ctx, pads, MOVE_SNAPSHOT_MAX_PADS );
+ */
+int  moveCapture(moveSnapshotContext *ctx, moveSnapshot *out, u32 max);
+
+/*
+ * Copies up to count of the latest samples of pad_number, newest first.
+ * Safe against a concurrent moveCapture(); return the number copied.
+ */
+u32  moveHistoryGet(moveSnapshotContext *ctx, int pad_number, moveSnapshot *out, u32 count);
+
+/*
+ * Highest speed (mm/s, from the tracked positions) of pad_number over the last window microseconds.
+ */
+f32  moveHistoryPeakSpeed(moveSnapshotContext *ctx, int pad_number, s64 window);
+
+/*
+ * Sets the alpha-beta tracker (alpha, beta); enable 0 turns it off.
+ */
+void moveSetFilter(moveSnapshotContext *ctx, int enable, f32 alpha, f32 beta);
+
+/*
+ * Extrapolates s to display_time (microseconds, same clock as moveSnapshot.time):
+ * position with velocity and acceleration, orientation with the angular velocity.
+ * The extrapolation stops max_predict microseconds after s->time.
+ */
+void moveSnapshotPredict(const moveSnapshot *s, system_time_t display_time, s64 max_predict, moveSnapshot *out);
+
+/*
+ * Fills the libmove button struct from a snapshot.
+ */
+void moveSnapshotButtons(const moveSnapshot *s, movePadData *data);
+
+/*
+ * Builds a moveSource playing the recorded frames.
+ */
+void moveRecordedSourceInit(moveRecordedSource *rec, moveSource *source, const moveSnapshot *frames, u32 count, int loop);
+
+/*
+ * Records count samples into frames (size max); return the total number stored.
+ */
+u32  moveRecord(moveSnapshot *frames, u32 stored, u32 max, const moveSnapshot *samples, u32 count);
+
+#ifdef MOVE_SNAPSHOT_IMPLEMENTATION
+
+#ifdef __PPU__
+#define MOVE_BARRIER()	__asm__ volatile ("lwsync" ::: "memory")
+#else
+#define MOVE_BARRIER()	__sync_synchronize()
+#endif
+
+#ifdef __PPU__
+
+/* gemInfo.status[] of a connected controller, CELL_GEM_STATUS_READY of the SDK (io/move.h does not define it) */
+#define MOVE_GEM_STATUS_READY	1
+
+static void move_vec3(vec_float4 v, f32 *out)
+{
+	union { vec_float4 v; f32 f[4]; } u;
+
+	u.v = v;
+	out[0] = u.f[0];
+	out[1] = u.f[1];
+	out[2] = u.f[2];
+}
+
+static int move_gem_connected(void *user, u32 *mask)
+{
+	gemInfo info;
+	u32 i;
+
+	(void) user;
+	if (gemGetInfo(&info))
+		return LIBMOVE_ERROR;
+	*mask = 0;
+	for (i = 0; i < info.max && i < MAX_MOVES; i++)
+		if (info.status[i] == MOVE_GEM_STATUS_READY)
+			*mask |= 1 << i;
+	return LIBMOVE_OK;
+}
+
+static int move_gem_sample(void *user, u32 mask, moveSnapshot *out)
+{
+	gemState state;
+	system_time_t time = 0;
+	u32 flag = STATE_LATEST_IMAGE_TIME, i;
+	int n = 0;
+
+	(void) user;
+	for (i = 0; i < MAX_MOVES; i++) {
+		moveSnapshot *s = &out[n];
+		union { vec_float4 v; f32 f[4]; } q;
+
+		if (!(mask & (1 << i)))
+			continue;
+		/* the first pad picks the camera image, the others are read at its time */
+		if (gemGetState(i, flag, time, &state) < 0)
+			continue;
+		if (flag == STATE_LATEST_IMAGE_TIME) {
+			time = state.time;
+			flag = STATE_SPECIFY_TIME;
+		}
+		s->pad = i;
+		s->tracking = state.tracking;
+		s->time = time;
+		move_vec3(state.pos, s->pos);
+		move_vec3(state.vel, s->vel);
+		move_vec3(state.accel, s->accel);
+		move_vec3(state.angvel, s->angvel);
+		q.v = state.quat;
+		memcpy(s->quat, q.f, sizeof(s->quat));
+		s->buttons = state.paddata.buttons;
+		s->trigger = state.paddata.ANA_T;
+		s->temperature = state.temperature;
+		n++;
+	}
+	return n;
+}
+
+#endif /* __PPU__ */
+
+static int move_recorded_connected(void *user, u32 *mask)
+{
+	moveRecordedSource *rec = (moveRecordedSource *) user;
+	u32 i;
+
+	*mask = 0;
+	if (rec->next >= rec->count) {
+		if (!rec->loop || !rec->count)
+			return LIBMOVE_OK;
+		rec->next = 0;
+	}
+	for (i = rec->next; i < rec->count && rec->frames[i].time == rec->frames[rec->next].time; i++)
+		*mask |= 1 << rec->frames[i].pad;
+	return LIBMOVE_OK;
+}
+
+static int move_recorded_sample(void *user, u32 mask, moveSnapshot *out)
+{
+	moveRecordedSource *rec = (moveRecordedSource *) user;
+	system_time_t time;
+	int n = 0;
+
+	if (rec->next >= rec->count)
+		return 0;
+	time = rec->frames[rec->next].time;
+	while (rec->next < rec->count && rec->frames[rec->next].time == time) {
+		if (mask & (1 << rec->frames[rec->next].pad))
+			out[n++] = rec->frames[rec->next];
+		rec->next++;
+	}
+	return n;
+}
+
+void moveRecordedSourceInit(moveRecordedSource *rec, moveSource *source, const moveSnapshot *frames, u32 count, int loop)
+{
+	rec->frames = frames;
+	rec->count = count;
+	rec->next = 0;
+	rec->loop = loop;
+	source->connected = move_recorded_connected;
+	source->sample = move_recorded_sample;
+	source->user = rec;
+}
+
+u32 moveRecord(moveSnapshot *frames, u32 stored, u32 max, const moveSnapshot *samples, u32 count)
+{
+	u32 i;
+
+	for (i = 0; i < count && stored < max; i++)
+		frames[stored++] = samples[i];
+	return stored;
+}
+
+int moveSnapshotInit(moveSnapshotContext *ctx, const moveSource *source)
+{
+	u32 i;
+
+	memset(ctx, 0, sizeof(*ctx));
+	if (source) {
+		ctx->source = *source;
+	} else {
+#ifdef __PPU__
+		ctx->source.connected = move_gem_connected;
+		ctx->source.sample = move_gem_sample;
+#else
+		return LIBMOVE_ERROR;
+#endif
+	}
+	for (i = 0; i < MOVE_SNAPSHOT_MAX_PADS; i++)
+		ctx->history[i].pad = i;
+	ctx->filter.alpha = 0.85f;
+	ctx->filter.beta = 0.005f;
+	return LIBMOVE_OK;
+}
+
+void moveSetFilter(moveSnapshotContext *ctx, int enable, f32 alpha, f32 beta)
+{
+	ctx->filter.enabled = enable != 0;
+	ctx->filter.alpha = alpha;
+	ctx->filter.beta = beta;
+	ctx->filter_valid = 0;
+}
+
+static void move_filter_update(moveSnapshotContext *ctx, moveSnapshot *s)
+{
+	moveSnapshot *f = &ctx->filtered[s->pad];
+	f32 dt;
+	int i;
+
+	if (!(ctx->filter_valid & (1 << s->pad)) || s->time <= f->time || !(s->tracking & MOVE_TRACKING_POSITION)) {
+		ctx->filter_valid |= 1 << s->pad;
+		*f = *s;
+		return;
+	}
+	dt = (f32) (s->time - f->time) * 1e-6f;
+	for (i = 0; i < 3; i++) {
+		f32 predicted = f->pos[i] + f->vel[i] * dt;
+		f32 r = s->pos[i] - predicted;
+		s->pos[i] = predicted + ctx->filter.alpha * r;
+		s->vel[i] = f->vel[i] + ctx->filter.beta / dt * r;
+	}
+	*f = *s;
+}
+
+static void move_history_push(moveHistory *h, const moveSnapshot *s)
+{
+	u32 head = h->head;
+
+	h->ring[head & (MOVE_HISTORY_LENGTH - 1)] = *s;
+	MOVE_BARRIER();
+	h->head = head + 1;
+}
+
+int moveCapture(moveSnapshotContext *ctx, moveSnapshot *out, u32 max)
+{
+	moveSnapshot samples[MOVE_SNAPSHOT_MAX_PADS];
+	u32 mask, i;
+	int n, count = 0;
+
+	if (ctx->source.connected(ctx->source.user, &mask) != LIBMOVE_OK)
+		return LIBMOVE_ERROR;
+	if (!mask)
+		return 0;
+	n = ctx->source.sample(ctx->source.user, mask, samples);
+	if (n < 0)
+		return LIBMOVE_ERROR;
+
+	for (i = 0; i < (u32) n; i++) {
+		if (samples[i].pad >= MOVE_SNAPSHOT_MAX_PADS)
+			continue;
+		if (ctx->filter.enabled)
+			move_filter_update(ctx, &samples[i]);
+		move_history_push(&ctx->history[samples[i].pad], &samples[i]);
+		if ((u32) count < max)
+			out[count++] = samples[i];
+		ctx->samples++;
+	}
+	ctx->captures++;
+	return count;
+}
+
+u32 moveHistoryGet(moveSnapshotContext *ctx, int pad_number, moveSnapshot *out, u32 count)
+{
+	moveHistory *h;
+	u32 head, i, n;
+
+	if (pad_number < 0 || pad_number >= MOVE_SNAPSHOT_MAX_PADS)
+		return 0;
+	h = &ctx->history[pad_number];
+	for (;;) {
+		head = h->head;
+		MOVE_BARRIER();
+		n = head < count ? head : count;
+		/* the slot being overwritten next is not stable */
+		if (n > MOVE_HISTORY_LENGTH - 1)
+			n = MOVE_HISTORY_LENGTH - 1;
+		for (i = 0; i < n; i++)
+			out[i] = h->ring[(head - 1 - i) & (MOVE_HISTORY_LENGTH - 1)];
+		MOVE_BARRIER();
+		/* the writer wrapped over the copied slots: copy again */
+		if (h->head - head <= MOVE_HISTORY_LENGTH - 1 - n)
+			return n;
+	}
+}
+
+f32 moveHistoryPeakSpeed(moveSnapshotContext *ctx, int pad_number, s64 window)
+{
+	moveSnapshot s[MOVE_HISTORY_LENGTH];
+	u32 n = moveHistoryGet(ctx, pad_number, s, MOVE_HISTORY_LENGTH), i;
+	f32 peak = 0.0f;
+
+	for (i = 0; i + 1 < n && s[0].time - s[i + 1].time <= window; i++) {
+		f32 dx = s[i].pos[0] - s[i + 1].pos[0];
+		f32 dy = s[i].pos[1] - s[i + 1].pos[1];
+		f32 dz = s[i].pos[2] - s[i + 1].pos[2];
+		s64 dt = s[i].time - s[i + 1].time;
+		f32 v;
+
+		if (dt <= 0 || !(s[i].tracking & s[i + 1].tracking & MOVE_TRACKING_POSITION))
+			continue;
+		v = sqrtf(dx * dx + dy * dy + dz * dz) * 1e6f / (f32) dt;
+		if (v > peak)
+			peak = v;
+	}
+	return peak;
+}
+
+void moveSnapshotPredict(const moveSnapshot *s, system_time_t display_time, s64 max_predict, moveSnapshot *out)
+{
+	s64 us = display_time - s->time;
+	f32 dt, wx, wy, wz, angle, k, c, qx, qy, qz, qw;
+	int i;
+
+	if (us < 0)
+		us = 0;
+	if (us > max_predict)
+		us = max_predict;
+	dt = (f32) us * 1e-6f;
+	*out = *s;
+	out->time = s->time + us;
+
+	for (i = 0; i < 3; i++) {
+		out->pos[i] = s->pos[i] + s->vel[i] * dt + 0.5f * s->accel[i] * dt * dt;
+		out->vel[i] = s->vel[i] + s->accel[i] * dt;
+	}
+
+	/* q' = dq * q, dq the rotation of angvel * dt (angvel in camera space) */
+	wx = s->angvel[0] * dt;
+	wy = s->angvel[1] * dt;
+	wz = s->angvel[2] * dt;
+	angle = sqrtf(wx * wx + wy * wy + wz * wz);
+	if (angle < 1e-6f)
+		return;
+	k = sinf(angle * 0.5f) / angle;
+	c = cosf(angle * 0.5f);
+	wx *= k;
+	wy *= k;
+	wz *= k;
+	qx = s->quat[0];
+	qy = s->quat[1];
+	qz = s->quat[2];
+	qw = s->quat[3];
+	out->quat[0] = c * qx + wx * qw + wy * qz - wz * qy;
+	out->quat[1] = c * qy - wx * qz + wy * qw + wz * qx;
+	out->quat[2] = c * qz + wx * qy - wy * qx + wz * qw;
+	out->quat[3] = c * qw - wx * qx - wy * qy - wz * qz;
+}
+
+void moveSnapshotButtons(const moveSnapshot *s, movePadData *data)
+{
+	data->BTN_SELECT = (s->buttons & MOVE_BUTTON_SELECT) != 0;
+	data->BTN_T = (s->buttons & MOVE_BUTTON_T) != 0;
+	data->BTN_ACTION = (s->buttons & MOVE_BUTTON_ACTION) != 0;
+	data->BTN_START = (s->buttons & MOVE_BUTTON_START) != 0;
+	data->BTN_TRIANGLE = (s->buttons & MOVE_BUTTON_TRIANGLE) != 0;
+	data->BTN_CIRCLE = (s->buttons & MOVE_BUTTON_CIRCLE) != 0;
+	data->BTN_CROSS = (s->buttons & MOVE_BUTTON_CROSS) != 0;
+	data->BTN_SQUARE = (s->buttons & MOVE_BUTTON_SQUARE) != 0;
+	data->ANA_T = s->trigger;
+}
+
+#endif /* MOVE_SNAPSHOT_IMPLEMENTATION */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LIBMOVE_MOVESNAPSHOT_H__ */
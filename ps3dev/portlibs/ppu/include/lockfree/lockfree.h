@@ -0,0 +1,956 @@
+/*! \file lockfree.h
+ \brief Lock-free containers for PPU threads and SPUs.
+
+ Containers that never take a sysLwMutex:
+
+ - \ref lfSpscRing: bounded single producer, single consumer ring of
+   fixed size elements;
+ - \ref lfMpmcRing: bounded multi producer, multi consumer ring of u64
+   values (a sequence number per cell);
+ - \ref lfStack: Treiber stack of node indices with an ABA tag in the
+   upper half of the head word, a lock-free free list;
+ - \ref lfSeqlock: sequence lock for data read far more often than written;
+ - \ref lfBitset: bitmap allocator of indices.
+
+ Each container header keeps every word written by one side on its own
+ 128 byte line, which is both the PPU cache line and the SPU reservation
+ granule, and the read-only configuration on another. Element storage is
+ a separate array referenced by effective address.
+
+ On the PPU the operations are lwarx/stwcx. loops from sys/atomic.h with
+ lwsync barriers. On the SPU every container is addressed by its
+ effective address and each atomic update is a getllar/putllc pair on the
+ line holding the word; element data moves by DMA, so on the SPU ring
+ elements and seqlock data must be multiples of 16 bytes, 16 byte
+ aligned. On the host the same code runs on the GCC __atomic builtins
+ for stress tests; \ref lfBench measures contended throughput there and
+ on the PPU.
+
+ - PPU / SPU / host: #include <lockfree/lockfree.h>
+ - \ref lfBench: #define LOCKFREE_IMPLEMENTATION in one PPU or host source file.
+*/
+
+#ifndef __LOCKFREE_H__
+#define __LOCKFREE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifdef __SPU__
+#include <spu_intrinsics.h>
+#include <spu_mfcio.h>
+#else
+#include <ppu-types.h>
+#ifdef __PPU__
+#include <sys/atomic.h>
+#endif
+#endif
+
+#ifndef LF_TAG
+#define LF_TAG                  29          /*!< MFC tag of the SPU element transfers */
+#endif
+
+#define LF_OK                   0
+#define LF_EFULL                -1
+#define LF_EEMPTY               -2
+#define LF_EINVAL               -3
+
+#define LF_BENCH_SPSC           0           /*!< one producer, one consumer */
+#define LF_BENCH_MPMC           1           /*!< half the threads produce, half consume */
+#define LF_BENCH_STACK          2           /*!< every thread pops and pushes back */
+#define LF_BENCH_SEQLOCK        3           /*!< one writer, the other threads read */
+#define LF_BENCH_BITSET         4           /*!< every thread allocates and frees */
+
+/* containers are passed by pointer on the PPU and the host, by effective address on the SPU */
+#ifdef __SPU__
+#define LF_REF(type)            uint64_t
+#define LF_EA(ref)              (ref)
+#else
+#define LF_REF(type)            type *
+#define LF_EA(ref)              ((uint64_t) (uintptr_t) (ref))
+#define LF_PTR(ea)              ((void *) (uintptr_t) (ea))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! \brief Single producer, single consumer ring. */
+typedef struct _lf_spsc_ring
+{
+	volatile uint32_t head;         /*!< \brief next element to pop, written by the consumer */
+	uint32_t tail_cache;            /*!< \brief consumer's last view of tail */
+	uint32_t pad0[30];
+	volatile uint32_t tail;         /*!< \brief next element to push, written by the producer */
+	uint32_t head_cache;            /*!< \brief producer's last view of head */
+	uint32_t pad1[30];
+	uint64_t data;                  /*!< \brief ea of capacity * size bytes */
+	uint32_t capacity;              /*!< \brief elements, power of 2 */
+	uint32_t size;                  /*!< \brief bytes per element */
+	uint32_t pad2[28];
+} __attribute__((aligned(128))) lfSpscRing;
+
+typedef struct _lf_mpmc_cell
+{
+	volatile uint32_t seq;
+	uint32_t pad;
+	volatile uint64_t value;
+} __attribute__((aligned(16))) lfMpmcCell;
+
+/*! \brief Multi producer, multi consumer ring of u64 values. */
+typedef struct _lf_mpmc_ring
+{
+	volatile uint32_t head;         /*!< \brief consumers */
+	uint32_t pad0[31];
+	volatile uint32_t tail;         /*!< \brief producers */
+	uint32_t pad1[31];
+	uint64_t cells;                 /*!< \brief ea of capacity lfMpmcCells */
+	uint32_t capacity;              /*!< \brief power of 2 */
+	uint32_t pad2[29];
+} __attribute__((aligned(128))) lfMpmcRing;
+
+/*! \brief Treiber stack of indices 0 .. capacity - 1. */
+typedef struct _lf_stack
+{
+	volatile uint64_t head;         /*!< \brief ABA tag << 32 | top index + 1 (0: empty) */
+	uint64_t pad0[15];
+	uint64_t next;                  /*!< \brief ea of capacity u32 links (index + 1, 0: none) */
+	uint32_t capacity;
+	uint32_t pad1[29];
+} __attribute__((aligned(128))) lfStack;
+
+/*! \brief Sequence lock: odd while a writer is inside. */
+typedef struct _lf_seqlock
+{
+	volatile uint32_t seq;
+	uint32_t pad[31];
+} __attribute__((aligned(128))) lfSeqlock;
+
+/*! \brief Allocator of indices 0 .. count - 1, one bit each. */
+typedef struct _lf_bitset
+{
+	volatile uint32_t hint;         /*!< \brief word the next search starts from */
+	uint32_t pad0[31];
+	uint64_t words;                 /*!< \brief ea of (count + 63) / 64 u64 words, 128 byte aligned */
+	uint32_t count;
+	uint32_t nwords;
+	uint32_t pad1[28];
+} __attribute__((aligned(128))) lfBitset;
+
+/*! \brief Result of \ref lfBench. */
+typedef struct _lf_bench_result
+{
+	uint64_t ops;                   /*!< \brief operations completed by every thread together */
+	uint64_t usecs;
+	double ops_per_sec;
+	uint32_t errors;                /*!< \brief lost, duplicated or torn items seen (must be 0) */
+} lfBenchResult;
+
+/* memory primitives on effective addresses: lock line reservations on the SPU, lwarx/stwcx. on the PPU */
+
+#ifdef __SPU__
+
+static uint8_t lf_line[128] __attribute__((aligned(128)));
+
+static inline uint32_t lf_load32(uint64_t ea)
+{
+	mfc_getllar(lf_line, ea & ~127ULL, 0, 0);
+	mfc_read_atomic_status();
+	return *(volatile uint32_t *) (lf_line + (ea & 127));
+}
+
+static inline uint64_t lf_load64(uint64_t ea)
+{
+	mfc_getllar(lf_line, ea & ~127ULL, 0, 0);
+	mfc_read_atomic_status();
+	return *(volatile uint64_t *) (lf_line + (ea & 127));
+}
+
+#define lf_peek32(ea)   lf_load32(ea)
+
+static inline void lf_store32(uint64_t ea, uint32_t value)
+{
+	do {
+		mfc_getllar(lf_line, ea & ~127ULL, 0, 0);
+		mfc_read_atomic_status();
+		*(volatile uint32_t *) (lf_line + (ea & 127)) = value;
+		mfc_putllc(lf_line, ea & ~127ULL, 0, 0);
+	} while (mfc_read_atomic_status() & MFC_PUTLLC_STATUS);
+}
+
+static inline int lf_cas32(uint64_t ea, uint32_t old, uint32_t value)
+{
+	for (;;) {
+		mfc_getllar(lf_line, ea & ~127ULL, 0, 0);
+		mfc_read_atomic_status();
+		if (*(volatile uint32_t *) (lf_line + (ea & 127)) != old)
+			return 0;
+		*(volatile uint32_t *) (lf_line + (ea & 127)) = value;
+		mfc_putllc(lf_line, ea & ~127ULL, 0, 0);
+		if (!(mfc_read_atomic_status() & MFC_PUTLLC_STATUS))
+			return 1;
+	}
+}
+
+static inline int lf_cas64(uint64_t ea, uint64_t old, uint64_t value)
+{
+	for (;;) {
+		mfc_getllar(lf_line, ea & ~127ULL, 0, 0);
+		mfc_read_atomic_status();
+		if (*(volatile uint64_t *) (lf_line + (ea & 127)) != old)
+			return 0;
+		*(volatile uint64_t *) (lf_line + (ea & 127)) = value;
+		mfc_putllc(lf_line, ea & ~127ULL, 0, 0);
+		if (!(mfc_read_atomic_status() & MFC_PUTLLC_STATUS))
+			return 1;
+	}
+}
+
+static inline uint32_t lf_add32(uint64_t ea, uint32_t delta)
+{
+	for (;;) {
+		uint32_t v;
+		mfc_getllar(lf_line, ea & ~127ULL, 0, 0);
+		mfc_read_atomic_status();
+		v = *(volatile uint32_t *) (lf_line + (ea & 127)) + delta;
+		*(volatile uint32_t *) (lf_line + (ea & 127)) = v;
+		mfc_putllc(lf_line, ea & ~127ULL, 0, 0);
+		if (!(mfc_read_atomic_status() & MFC_PUTLLC_STATUS))
+			return v;
+	}
+}
+
+/* value and sequence number of a ring cell land in one atomic line update */
+static inline void lf_cell_store(uint64_t ea, uint64_t value, uint32_t seq)
+{
+	do {
+		mfc_getllar(lf_line, ea & ~127ULL, 0, 0);
+		mfc_read_atomic_status();
+		((lfMpmcCell *) (lf_line + (ea & 127)))->value = value;
+		((lfMpmcCell *) (lf_line + (ea & 127)))->seq = seq;
+		mfc_putllc(lf_line, ea & ~127ULL, 0, 0);
+	} while (mfc_read_atomic_status() & MFC_PUTLLC_STATUS);
+}
+
+static inline void lf_get(void *ls, uint64_t ea, uint32_t size)
+{
+	while (size) {
+		uint32_t n = size > 16384 ? 16384 : size;
+		mfc_get(ls, ea, n, LF_TAG, 0, 0);
+		ls = (uint8_t *) ls + n;
+		ea += n;
+		size -= n;
+	}
+	mfc_write_tag_mask(1 << LF_TAG);
+	mfc_read_tag_status_all();
+}
+
+/* completes before returning, so a following index update cannot pass the data */
+static inline void lf_put(const void *ls, uint64_t ea, uint32_t size)
+{
+	while (size) {
+		uint32_t n = size > 16384 ? 16384 : size;
+		mfc_put((volatile void *) ls, ea, n, LF_TAG, 0, 0);
+		ls = (const uint8_t *) ls + n;
+		ea += n;
+		size -= n;
+	}
+	mfc_write_tag_mask(1 << LF_TAG);
+	mfc_read_tag_status_all();
+}
+
+#define lf_fence()      do { } while (0)
+#define lf_pause()      do { } while (0)
+
+#elif defined(__PPU__)
+
+#define lf_fence()      __asm__ volatile ("lwsync" ::: "memory")
+#define lf_pause()      __asm__ volatile ("or 1,1,1\n\tor 2,2,2" ::: "memory")
+
+/* relaxed load of a word only this side writes */
+static inline uint32_t lf_peek32(uint64_t ea)
+{
+	return *(volatile uint32_t *) LF_PTR(ea);
+}
+
+static inline uint32_t lf_load32(uint64_t ea)
+{
+	uint32_t v = *(volatile uint32_t *) LF_PTR(ea);
+	lf_fence();
+	return v;
+}
+
+static inline uint64_t lf_load64(uint64_t ea)
+{
+	uint64_t v = *(volatile uint64_t *) LF_PTR(ea);
+	lf_fence();
+	return v;
+}
+
+static inline void lf_store32(uint64_t ea, uint32_t value)
+{
+	lf_fence();
+	*(volatile uint32_t *) LF_PTR(ea) = value;
+}
+
+static inline int lf_cas32(uint64_t ea, uint32_t old, uint32_t value)
+{
+	uint32_t prev;
+
+	lf_fence();
+	prev = (uint32_t) __cmpxchg_u32((volatile unsigned int *) LF_PTR(ea), old, value);
+	lf_fence();
+	return prev == old;
+}
+
+static inline int lf_cas64(uint64_t ea, uint64_t old, uint64_t value)
+{
+	uint64_t prev;
+
+	lf_fence();
+	prev = __cmpxchg_u64((volatile u64 *) LF_PTR(ea), old, value);
+	lf_fence();
+	return prev == old;
+}
+
+static inline uint32_t lf_add32(uint64_t ea, uint32_t delta)
+{
+	uint32_t v;
+
+	lf_fence();
+	v = sysAtomicAddReturn(delta, (atomic_t *) LF_PTR(ea));
+	lf_fence();
+	return v;
+}
+
+static inline void lf_cell_store(uint64_t ea, uint64_t value, uint32_t seq)
+{
+	((lfMpmcCell *) LF_PTR(ea))->value = value;
+	lf_store32(ea + offsetof(lfMpmcCell, seq), seq);
+}
+
+#define lf_get(ls, ea, size)    memcpy((ls), LF_PTR(ea), (size))
+#define lf_put(ls, ea, size)    memcpy(LF_PTR(ea), (ls), (size))
+
+#else
+
+#define lf_fence()      __atomic_thread_fence(__ATOMIC_ACQ_REL)
+#if defined(__x86_64__) || defined(__i386__)
+#define lf_pause()      __builtin_ia32_pause()
+#else
+#define lf_pause()      do { } while (0)
+#endif
+
+static inline uint32_t lf_peek32(uint64_t ea)
+{
+	return __atomic_load_n((volatile uint32_t *) LF_PTR(ea), __ATOMIC_RELAXED);
+}
+
+static inline uint32_t lf_load32(uint64_t ea)
+{
+	return __atomic_load_n((volatile uint32_t *) LF_PTR(ea), __ATOMIC_ACQUIRE);
+}
+
+static inline uint64_t lf_load64(uint64_t ea)
+{
+	return __atomic_load_n((volatile uint64_t *) LF_PTR(ea), __ATOMIC_ACQUIRE);
+}
+
+static inline void lf_store32(uint64_t ea, uint32_t value)
+{
+	__atomic_store_n((volatile uint32_t *) LF_PTR(ea), value, __ATOMIC_RELEASE);
+}
+
+static inline int lf_cas32(uint64_t ea, uint32_t old, uint32_t value)
+{
+	return __atomic_compare_exchange_n((volatile uint32_t *) LF_PTR(ea), &old, value, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static inline int lf_cas64(uint64_t ea, uint64_t old, uint64_t value)
+{
+	return __atomic_compare_exchange_n((volatile uint64_t *) LF_PTR(ea), &old, value, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static inline uint32_t lf_add32(uint64_t ea, uint32_t delta)
+{
+	return __atomic_add_fetch((volatile uint32_t *) LF_PTR(ea), delta, __ATOMIC_ACQ_REL);
+}
+
+static inline void lf_cell_store(uint64_t ea, uint64_t value, uint32_t seq)
+{
+	__atomic_store_n(&((lfMpmcCell *) LF_PTR(ea))->value, value, __ATOMIC_RELAXED);
+	lf_store32(ea + offsetof(lfMpmcCell, seq), seq);
+}
+
+#define lf_get(ls, ea, size)    memcpy((ls), LF_PTR(ea), (size))
+#define lf_put(ls, ea, size)    memcpy(LF_PTR(ea), (ls), (size))
+
+#endif
+
+#define LF_FIELD(ea, type, field)   ((ea) + offsetof(type, field))
+
+/* SPSC ring */
+
+/*! \brief Set up a ring over \p data (capacity * size bytes); capacity a power of 2. */
+static inline int lfSpscInit(lfSpscRing *ring, void *data, uint32_t capacity, uint32_t size)
+{
+	if (!capacity || (capacity & (capacity - 1)) || !size)
+		return LF_EINVAL;
+	memset(ring, 0, sizeof(*ring));
+	ring->data = (uint64_t) (uintptr_t) data;
+	ring->capacity = capacity;
+	ring->size = size;
+	return LF_OK;
+}
+
+/*! \brief Producer side: copy one element in. */
+static inline int lfSpscPush(LF_REF(lfSpscRing) ring, const void *element)
+{
+	uint64_t ea = LF_EA(ring);
+	uint64_t data = lf_load64(LF_FIELD(ea, lfSpscRing, data));
+	uint32_t capacity = lf_peek32(LF_FIELD(ea, lfSpscRing, capacity));
+	uint32_t size = lf_peek32(LF_FIELD(ea, lfSpscRing, size));
+	uint32_t tail = lf_peek32(LF_FIELD(ea, lfSpscRing, tail));
+
+	if (tail - lf_peek32(LF_FIELD(ea, lfSpscRing, head_cache)) == capacity) {
+		uint32_t head = lf_load32(LF_FIELD(ea, lfSpscRing, head));
+		if (tail - head == capacity)
+			return LF_EFULL;
+		lf_store32(LF_FIELD(ea, lfSpscRing, head_cache), head);
+	}
+	lf_put(element, data + (uint64_t) (tail & (capacity - 1)) * size, size);
+	lf_store32(LF_FIELD(ea, lfSpscRing, tail), tail + 1);
+	return LF_OK;
+}
+
+/*! \brief Consumer side: copy one element out. */
+static inline int lfSpscPop(LF_REF(lfSpscRing) ring, void *element)
+{
+	uint64_t ea = LF_EA(ring);
+	uint64_t data = lf_load64(LF_FIELD(ea, lfSpscRing, data));
+	uint32_t capacity = lf_peek32(LF_FIELD(ea, lfSpscRing, capacity));
+	uint32_t size = lf_peek32(LF_FIELD(ea, lfSpscRing, size));
+	uint32_t head = lf_peek32(LF_FIELD(ea, lfSpscRing, head));
+
+	if (head == lf_peek32(LF_FIELD(ea, lfSpscRing, tail_cache))) {
+		uint32_t tail = lf_load32(LF_FIELD(ea, lfSpscRing, tail));
+		if (tail == head)
+			return LF_EEMPTY;
+		lf_store32(LF_FIELD(ea, lfSpscRing, tail_cache), tail);
+	}
+	lf_get(element, data + (uint64_t) (head & (capacity - 1)) * size, size);
+	lf_store32(LF_FIELD(ea, lfSpscRing, head), head + 1);
+	return LF_OK;
+}
+
+/* MPMC ring */
+
+/*! \brief Set up a ring over \p cells (capacity cells); capacity a power of 2. */
+static inline int lfMpmcInit(lfMpmcRing *ring, lfMpmcCell *cells, uint32_t capacity)
+{
+	uint32_t i;
+
+	if (!capacity || (capacity & (capacity - 1)))
+		return LF_EINVAL;
+	memset(ring, 0, sizeof(*ring));
+	ring->cells = (uint64_t) (uintptr_t) cells;
+	ring->capacity = capacity;
+	for (i = 0; i < capacity; i++) {
+		cells[i].seq = i;
+		cells[i].value = 0;
+	}
+	lf_fence();
+	return LF_OK;
+}
+
+static inline int lfMpmcPush(LF_REF(lfMpmcRing) ring, uint64_t value)
+{
+	uint64_t ea = LF_EA(ring);
+	uint64_t cells = lf_load64(LF_FIELD(ea, lfMpmcRing, cells));
+	uint32_t mask = lf_peek32(LF_FIELD(ea, lfMpmcRing, capacity)) - 1;
+	uint32_t pos = lf_load32(LF_FIELD(ea, lfMpmcRing, tail));
+
+	for (;;) {
+		uint64_t cell = cells + (uint64_t) (pos & mask) * sizeof(lfMpmcCell);
+		int32_t dif = (int32_t) (lf_load32(cell + offsetof(lfMpmcCell, seq)) - pos);
+
+		if (dif == 0) {
+			if (lf_cas32(LF_FIELD(ea, lfMpmcRing, tail), pos, pos + 1)) {
+				lf_cell_store(cell, value, pos + 1);
+				return LF_OK;
+			}
+		} else if (dif < 0) {
+			return LF_EFULL;
+		}
+		pos = lf_load32(LF_FIELD(ea, lfMpmcRing, tail));
+	}
+}
+
+static inline int lfMpmcPop(LF_REF(lfMpmcRing) ring, uint64_t *value)
+{
+	uint64_t ea = LF_EA(ring);
+	uint64_t cells = lf_load64(LF_FIELD(ea, lfMpmcRing, cells));
+	uint32_t mask = lf_peek32(LF_FIELD(ea, lfMpmcRing, capacity)) - 1;
+	uint32_t pos = lf_load32(LF_FIELD(ea, lfMpmcRing, head));
+
+	for (;;) {
+		uint64_t cell = cells + (uint64_t) (pos & mask) * sizeof(lfMpmcCell);
+		int32_t dif = (int32_t) (lf_load32(cell + offsetof(lfMpmcCell, seq)) - (pos + 1));
+
+		if (dif == 0) {
+			if (lf_cas32(LF_FIELD(ea, lfMpmcRing, head), pos, pos + 1)) {
+				*value = lf_load64(cell + offsetof(lfMpmcCell, value));
+				lf_store32(cell + offsetof(lfMpmcCell, seq), pos + mask + 1);
+				return LF_OK;
+			}
+		} else if (dif < 0) {
+			return LF_EEMPTY;
+		}
+		pos = lf_load32(LF_FIELD(ea, lfMpmcRing, head));
+	}
+}
+
+/* Treiber stack */
+
+/*! \brief Set up a stack over \p next (capacity links); \p full pushes every index. */
+static inline int lfStackInit(lfStack *stack, uint32_t *next, uint32_t capacity, int full)
+{
+	uint32_t i;
+
+	if (!capacity)
+		return LF_EINVAL;
+	memset(stack, 0, sizeof(*stack));
+	stack->next = (uint64_t) (uintptr_t) next;
+	stack->capacity = capacity;
+	for (i = 0; i < capacity; i++)
+		next[i] = (full && i + 1 < capacity) ? i + 2 : 0;
+	stack->head = full ? 1 : 0;
+	lf_fence();
+	return LF_OK;
+}
+
+static inline void lfStackPush(LF_REF(lfStack) stack, uint32_t index)
+{
+	uint64_t ea = LF_EA(stack);
+	uint64_t next = lf_load64(LF_FIELD(ea, lfStack, next));
+	uint64_t head;
+
+	do {
+		head = lf_load64(LF_FIELD(ea, lfStack, head));
+		lf_store32(next + (uint64_t) index * 4, (uint32_t) head);
+	} while (!lf_cas64(LF_FIELD(ea, lfStack, head), head, (((head >> 32) + 1) << 32) | (index + 1)));
+}
+
+/*! \brief Pop the top index, or LF_EEMPTY. */
+static inline int32_t lfStackPop(LF_REF(lfStack) stack)
+{
+	uint64_t ea = LF_EA(stack);
+	uint64_t next = lf_load64(LF_FIELD(ea, lfStack, next));
+	uint64_t head;
+	uint32_t top;
+
+	do {
+		head = lf_load64(LF_FIELD(ea, lfStack, head));
+		top = (uint32_t) head;
+		if (!top)
+			return LF_EEMPTY;
+		/* a stale link is harmless: the tag makes the CAS fail */
+	} while (!lf_cas64(LF_FIELD(ea, lfStack, head), head,
+	                   (((head >> 32) + 1) << 32) | lf_load32(next + (uint64_t) (top - 1) * 4)));
+	return (int32_t) (top - 1);
+}
+
+/* seqlock */
+
+static inline void lfSeqlockInit(lfSeqlock *lock)
+{
+	memset(lock, 0, sizeof(*lock));
+}
+
+/*! \brief Enter the write side; writers exclude each other. */
+static inline void lfSeqlockWriteBegin(LF_REF(lfSeqlock) lock)
+{
+	uint64_t ea = LF_FIELD(LF_EA(lock), lfSeqlock, seq);
+	uint32_t seq;
+
+	for (;;) {
+		seq = lf_load32(ea);
+		if (!(seq & 1) && lf_cas32(ea, seq, seq + 1))
+			break;
+		lf_pause();
+	}
+	lf_fence();
+}
+
+static inline void lfSeqlockWriteEnd(LF_REF(lfSeqlock) lock)
+{
+	lf_add32(LF_FIELD(LF_EA(lock), lfSeqlock, seq), 1);
+}
+
+/*! \brief Start a read; pass the result to \ref lfSeqlockReadRetry. */
+static inline uint32_t lfSeqlockReadBegin(LF_REF(lfSeqlock) lock)
+{
+	uint32_t seq;
+
+	while ((seq = lf_load32(LF_FIELD(LF_EA(lock), lfSeqlock, seq))) & 1)
+		lf_pause();
+	return seq;
+}
+
+/*! \brief Non zero when a writer ran since \p seq: the data read must be read again. */
+static inline int lfSeqlockReadRetry(LF_REF(lfSeqlock) lock, uint32_t seq)
+{
+	lf_fence();
+	return lf_load32(LF_FIELD(LF_EA(lock), lfSeqlock, seq)) != seq;
+}
+
+/*! \brief Consistent copy of \p size bytes at \p data_ea guarded by \p lock. */
+static inline void lfSeqlockRead(LF_REF(lfSeqlock) lock, void *dst, uint64_t data_ea, uint32_t size)
+{
+	uint32_t seq;
+
+	do {
+		seq = lfSeqlockReadBegin(lock);
+		lf_get(dst, data_ea, size);
+	} while (lfSeqlockReadRetry(lock, seq));
+}
+
+/*! \brief Replace \p size bytes at \p data_ea guarded by \p lock. */
+static inline void lfSeqlockWrite(LF_REF(lfSeqlock) lock, uint64_t data_ea, const void *src, uint32_t size)
+{
+	lfSeqlockWriteBegin(lock);
+	lf_put(src, data_ea, size);
+	lfSeqlockWriteEnd(lock);
+}
+
+/* bitset allocator */
+
+/*! \brief Set up an allocator of \p count indices over \p words ((count + 63) / 64 words, 128 byte aligned). */
+static inline int lfBitsetInit(lfBitset *set, uint64_t *words, uint32_t count)
+{
+	uint32_t i;
+
+	if (!count)
+		return LF_EINVAL;
+	memset(set, 0, sizeof(*set));
+	set->words = (uint64_t) (uintptr_t) words;
+	set->count = count;
+	set->nwords = (count + 63) / 64;
+	for (i = 0; i < set->nwords; i++)
+		words[i] = 0;
+	/* indices past count are never handed out */
+	if (count & 63)
+		words[set->nwords - 1] = ~0ULL << (count & 63);
+	lf_fence();
+	return LF_OK;
+}
+
+/*! \brief Allocate a free index, or LF_EFULL. */
+static inline int32_t lfBitsetAlloc(LF_REF(lfBitset) set)
+{
+	uint64_t ea = LF_EA(set);
+	uint64_t words = lf_load64(LF_FIELD(ea, lfBitset, words));
+	uint32_t nwords = lf_peek32(LF_FIELD(ea, lfBitset, nwords));
+	uint32_t start = lf_peek32(LF_FIELD(ea, lfBitset, hint));
+	uint32_t i;
+
+	for (i = 0; i < nwords; i++) {
+		uint32_t w = (start + i) % nwords;
+		uint64_t word = words + (uint64_t) w * 8;
+		uint64_t bits = lf_load64(word);
+
+		while (bits != ~0ULL) {
+			uint32_t bit = __builtin_ctzll(~bits);
+
+			if (lf_cas64(word, bits, bits | (1ULL << bit))) {
+				if (w != start)
+					lf_store32(LF_FIELD(ea, lfBitset, hint), w);
+				return (int32_t) (w * 64 + bit);
+			}
+			bits = lf_load64(word);
+		}
+	}
+	return LF_EFULL;
+}
+
+static inline void lfBitsetFree(LF_REF(lfBitset) set, uint32_t index)
+{
+	uint64_t ea = LF_EA(set);
+	uint64_t word = lf_load64(LF_FIELD(ea, lfBitset, words)) + (uint64_t) (index / 64) * 8;
+	uint64_t bits;
+
+	do {
+		bits = lf_load64(word);
+	} while (!lf_cas64(word, bits, bits & ~(1ULL << (index & 63))));
+}
+
+#ifndef __SPU__
+
+/*! \brief Contended throughput of one container.
+ \param kind
+ LF_BENCH_*.
+ \param threads
+ Threads hammering the container, 2 to 16 (LF_BENCH_SPSC always uses 2).
+ \param ops
+ Operations per thread.
+ \return
+ LF_OK, or LF_EINVAL.
+*/
+int lfBench(int kind, uint32_t threads, uint32_t ops, lfBenchResult *result);
+
+#ifdef LOCKFREE_IMPLEMENTATION
+
+#ifdef __PPU__
+#include <malloc.h>
+#include <sys/thread.h>
+#include <sys/systime.h>
+#else
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#endif
+
+#define LF_BENCH_MAX_THREADS    16
+#define LF_BENCH_CAPACITY       1024
+
+typedef struct
+{
+	uint64_t seq;                   /* seqlock payload: every word equal */
+	uint64_t copy[15];
+} lf_bench_payload;
+
+typedef struct
+{
+	lfSpscRing spsc;
+	lfMpmcRing mpmc;
+	lfStack stack;
+	lfSeqlock seqlock;
+	lfBitset bitset;
+	lfMpmcCell cells[LF_BENCH_CAPACITY];
+	uint64_t spsc_data[LF_BENCH_CAPACITY];
+	uint32_t next[LF_BENCH_CAPACITY];
+	uint64_t words[LF_BENCH_CAPACITY / 64];
+	lf_bench_payload payload __attribute__((aligned(128)));
+	volatile uint32_t owner[LF_BENCH_CAPACITY];
+	volatile uint32_t start;
+	volatile uint32_t done;
+	volatile uint32_t errors;
+	volatile uint64_t sum_in;
+	volatile uint64_t sum_out;
+	int kind;
+	uint32_t threads;
+	uint32_t ops;
+} __attribute__((aligned(128))) lf_bench;
+
+typedef struct
+{
+	lf_bench *bench;
+	uint32_t index;
+} lf_bench_arg;
+
+static void lf_bench_error(lf_bench *b)
+{
+	__atomic_fetch_add(&b->errors, 1, __ATOMIC_RELAXED);
+}
+
+/* spin, then give the processor away: threads may outnumber hardware threads */
+static void lf_bench_backoff(uint32_t *spins)
+{
+	if (++*spins & 63) {
+		lf_pause();
+		return;
+	}
+#ifdef __PPU__
+	sysThreadYield();
+#else
+	sched_yield();
+#endif
+}
+
+static void lf_bench_run(lf_bench *b, uint32_t index)
+{
+	uint64_t sum_in = 0, sum_out = 0, v;
+	uint32_t i, half = b->threads / 2, spins = 0;
+	int32_t n;
+
+	while (!__atomic_load_n(&b->start, __ATOMIC_ACQUIRE))
+		lf_bench_backoff(&spins);
+
+	switch (b->kind) {
+	case LF_BENCH_SPSC:
+		for (i = 0; i < b->ops; i++) {
+			if (index == 0) {
+				v = i;
+				while (lfSpscPush(&b->spsc, &v) != LF_OK)
+					lf_bench_backoff(&spins);
+			} else {
+				while (lfSpscPop(&b->spsc, &v) != LF_OK)
+					lf_bench_backoff(&spins);
+				if (v != i)
+					lf_bench_error(b);
+			}
+		}
+		break;
+	case LF_BENCH_MPMC:
+		for (i = 0; i < b->ops; i++) {
+			if (index < half) {
+				v = ((uint64_t) index << 32) | i;
+				while (lfMpmcPush(&b->mpmc, v) != LF_OK)
+					lf_bench_backoff(&spins);
+				sum_in += v;
+			} else {
+				while (lfMpmcPop(&b->mpmc, &v) != LF_OK)
+					lf_bench_backoff(&spins);
+				sum_out += v;
+			}
+		}
+		break;
+	case LF_BENCH_STACK:
+		for (i = 0; i < b->ops; i++) {
+			while ((n = lfStackPop(&b->stack)) < 0)
+				lf_bench_backoff(&spins);
+			/* an index is owned by one thread between pop and push */
+			if (__atomic_exchange_n(&b->owner[n], index + 1, __ATOMIC_ACQ_REL) != 0)
+				lf_bench_error(b);
+			__atomic_store_n(&b->owner[n], 0, __ATOMIC_RELEASE);
+			lfStackPush(&b->stack, n);
+		}
+		break;
+	case LF_BENCH_SEQLOCK:
+		for (i = 0; i < b->ops; i++) {
+			lf_bench_payload p;
+			uint32_t k;
+
+			if (index == 0) {
+				for (k = 0; k < 16; k++)
+					((uint64_t *) &p)[k] = i + 1;
+				lfSeqlockWrite(&b->seqlock, LF_EA(&b->payload), &p, sizeof(p));
+			} else {
+				lfSeqlockRead(&b->seqlock, &p, LF_EA(&b->payload), sizeof(p));
+				for (k = 1; k < 16; k++)
+					if (((uint64_t *) &p)[k] != p.seq)
+						lf_bench_error(b);
+			}
+		}
+		break;
+	case LF_BENCH_BITSET:
+		for (i = 0; i < b->ops; i++) {
+			while ((n = lfBitsetAlloc(&b->bitset)) < 0)
+				lf_bench_backoff(&spins);
+			if (__atomic_exchange_n(&b->owner[n], index + 1, __ATOMIC_ACQ_REL) != 0)
+				lf_bench_error(b);
+			__atomic_store_n(&b->owner[n], 0, __ATOMIC_RELEASE);
+			lfBitsetFree(&b->bitset, n);
+		}
+		break;
+	}
+	__atomic_fetch_add(&b->sum_in, sum_in, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&b->sum_out, sum_out, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&b->done, 1, __ATOMIC_RELEASE);
+}
+
+#ifdef __PPU__
+static void lf_bench_thread(void *arg)
+{
+	lf_bench_run(((lf_bench_arg *) arg)->bench, ((lf_bench_arg *) arg)->index);
+	sysThreadExit(0);
+}
+#else
+static void *lf_bench_thread(void *arg)
+{
+	lf_bench_run(((lf_bench_arg *) arg)->bench, ((lf_bench_arg *) arg)->index);
+	return NULL;
+}
+#endif
+
+static uint64_t lf_bench_usecs(void)
+{
+#ifdef __PPU__
+	return sysGetSystemTime();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+#endif
+}
+
+int lfBench(int kind, uint32_t threads, uint32_t ops, lfBenchResult *result)
+{
+	lf_bench_arg args[LF_BENCH_MAX_THREADS];
+#ifdef __PPU__
+	sys_ppu_thread_t ids[LF_BENCH_MAX_THREADS];
+#else
+	pthread_t ids[LF_BENCH_MAX_THREADS];
+#endif
+	lf_bench *b;
+	uint64_t t0;
+	uint32_t i, started;
+
+	if (kind == LF_BENCH_SPSC)
+		threads = 2;
+	if (kind < LF_BENCH_SPSC || kind > LF_BENCH_BITSET || threads < 2 || threads > LF_BENCH_MAX_THREADS)
+		return LF_EINVAL;
+	if (kind == LF_BENCH_MPMC)
+		threads &= ~1;
+
+#ifdef __PPU__
+	b = (lf_bench *) memalign(128, sizeof(lf_bench));
+#else
+	if (posix_memalign((void **) &b, 128, sizeof(lf_bench)))
+		b = NULL;
+#endif
+	if (!b)
+		return LF_EINVAL;
+	memset(b, 0, sizeof(*b));
+	b->kind = kind;
+	b->threads = threads;
+	b->ops = ops;
+	lfSpscInit(&b->spsc, b->spsc_data, LF_BENCH_CAPACITY, sizeof(uint64_t));
+	lfMpmcInit(&b->mpmc, b->cells, LF_BENCH_CAPACITY);
+	lfStackInit(&b->stack, b->next, threads < 4 ? 4 : threads, 1);
+	lfSeqlockInit(&b->seqlock);
+	lfBitsetInit(&b->bitset, b->words, threads < 4 ? 4 : threads);
+
+	for (started = 0; started < threads; started++) {
+		args[started].bench = b;
+		args[started].index = started;
+#ifdef __PPU__
+		if (sysThreadCreate(&ids[started], lf_bench_thread, &args[started], 1000, 0x4000, THREAD_JOINABLE, (char *) "lfbench"))
+#else
+		if (pthread_create(&ids[started], NULL, lf_bench_thread, &args[started]))
+#endif
+			break;
+	}
+	if (started < threads) {
+		/* release the threads that did start with nothing to do */
+		b->ops = 0;
+	}
+	t0 = lf_bench_usecs();
+	__atomic_store_n(&b->start, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < started; i++) {
+#ifdef __PPU__
+		u64 retval;
+		sysThreadJoin(ids[i], &retval);
+#else
+		pthread_join(ids[i], NULL);
+#endif
+	}
+	result->usecs = lf_bench_usecs() - t0;
+	result->ops = (uint64_t) b->ops * threads;
+	result->ops_per_sec = result->usecs ? result->ops * 1e6 / result->usecs : 0;
+	result->errors = b->errors + (b->sum_in != b->sum_out);
+	free(b);
+	return started < threads ? LF_EINVAL : LF_OK;
+}
+
+#endif /* LOCKFREE_IMPLEMENTATION */
+
+#endif /* __SPU__ */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
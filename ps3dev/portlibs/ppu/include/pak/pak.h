@@ -0,0 +1,1267 @@
+/*! \file pak.h
+ \brief Indexed, chunk compressed asset archive.
+
+ One archive file, built on the host by bin/pakbuild.py, replaces the
+ loose files of a game: it is opened once, its index is read once, and
+ finding an entry costs a hash and a bucket lookup, with no sysFsOpen.
+
+ Layout (big endian):
+
+ - \ref pakHeader, 64 bytes;
+ - the index: a table of 2^bucket_bits + 1 bucket starts, the entries
+   sorted by the FNV-1a hash of their name (the bucket is the top bits
+   of the hash), the chunk table and the names;
+ - the data. Every entry is cut into chunks of \ref pakHeader::chunk_size
+   bytes (64KB) compressed on their own, with zlib or the LZ4 block
+   format, or stored when that does not pay. The first chunk of an
+   entry starts at the alignment chosen by the packer, the others follow
+   it.
+
+ The reader issues the chunk reads through fsched/fsched.h, so archive
+ loads share the drive with the other streams of the scheduler.
+ Compressed chunks are read into a slot buffer of the archive and
+ decoded into the buffer of the caller, stored chunks are read into it
+ directly (\ref FSCHED_DIRECT): a texture stored in the archive lands
+ in rsxMemalign memory without a copy.
+
+ When spujob/spujob.h is included before this header, chunks are decoded
+ by \ref pakDecodeJob on the workers of a job system: SPU threads, or
+ PPU threads when the system was started without an SPU worker. The SPU
+ build of the job has its own inflate, as there is no SPU zlib; the PPU
+ and the host use libz. Without a job system, chunks are decoded by the
+ thread calling \ref pakPoll or \ref pakWait.
+
+ An archive is driven by one thread: loads progress in \ref pakPoll
+ and \ref pakWait.
+
+ - PPU / host: #include <pak/pak.h>; #define PAK_IMPLEMENTATION in one
+   source file (and FSCHED_IMPLEMENTATION), link with -lz.
+ - SPU job binary: #include <spujob/spujob.h> and <pak/pak.h>, and make
+   the entry point call \ref pakDecodeJob. The job keeps a chunk on its
+   stack, 64KB.
+*/
+
+#ifndef __PAK_H__
+#define __PAK_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SPU__
+#include <spu_intrinsics.h>
+#include <spu_mfcio.h>
+#else
+#include <zlib.h>
+#include <fsched/fsched.h>
+#endif
+
+#define PAK_MAGIC               0x50414b31  /* "PAK1" */
+#define PAK_VERSION             1
+#define PAK_CHUNK_SIZE          65536       /*!< largest chunk size */
+
+#define PAK_CODEC_STORED        0
+#define PAK_CODEC_ZLIB          1
+#define PAK_CODEC_LZ4           2
+
+#define PAK_ENTRY_STORED        0x01        /*!< every chunk of the entry is stored */
+
+#define PAK_OK                  0
+#define PAK_PENDING             1           /*!< status of a load not completed yet */
+#define PAK_EINVAL              -1
+#define PAK_ENOMEM              -2
+#define PAK_EIO                 -3          /* open or read failed */
+#define PAK_EFORMAT             -4          /* not an archive, or a damaged index */
+#define PAK_ENOENT              -5
+#define PAK_ECORRUPT            -6          /* a chunk did not decode */
+
+#ifndef PAK_SLOTS
+#define PAK_SLOTS               8           /*!< default compressed chunks read or decoded at once */
+#endif
+
+#define PAK_SLOT_PAD            128         /* slot buffers: DMA rounds reads up to 16 bytes */
+
+#define PAK_CHUNK_CODEC(info)   ((info) >> 24)
+#define PAK_CHUNK_BYTES(info)   ((info) & 0xffffff)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! \brief Archive header, at offset 0. */
+typedef struct _pak_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t chunk_size;
+	uint32_t align;                 /*!< \brief alignment of the entries */
+	uint32_t entry_count;
+	uint32_t bucket_bits;
+	uint32_t chunk_count;
+	uint32_t names_size;
+	uint64_t index_offset;          /*!< \brief file offset of the index */
+	uint32_t index_size;
+	uint32_t entries;               /*!< \brief offsets in the index */
+	uint32_t chunks;
+	uint32_t names;
+	uint64_t file_size;
+} pakHeader;
+
+/*! \brief Index entry. */
+typedef struct _pak_entry
+{
+	uint32_t hash;                  /*!< \brief \ref pakHash of the name */
+	uint32_t name;                  /*!< \brief offset in the names */
+	uint32_t size;                  /*!< \brief bytes, uncompressed */
+	uint32_t flags;                 /*!< \brief \ref PAK_ENTRY_STORED */
+	uint32_t first_chunk;
+	uint32_t chunk_count;
+	uint64_t offset;                /*!< \brief file offset of the first chunk */
+} pakEntry;
+
+/*! \brief Chunk table entry. */
+typedef struct _pak_chunk
+{
+	uint32_t offset;                /*!< \brief from the offset of the entry */
+	uint32_t info;                  /*!< \brief bytes in the file | codec << 24 */
+} pakChunk;
+
+/*! \brief FNV-1a hash of a name, as used by the index. */
+static inline uint32_t pakHash(const char *name)
+{
+	uint32_t h = 0x811c9dc5;
+
+	while (*name)
+		h = (h ^ (uint8_t) *name++) * 0x01000193;
+	return h;
+}
+
+/* decoders, on every platform; the SPU streams the input through local store */
+
+#define PAK_SPU_BLOCK           8192        /* input DMA block, two in the job input area */
+#define PAK_SPU_TAG             2           /* and 3: input, 4: output */
+
+typedef struct _pak_in
+{
+	const uint8_t *p;
+	const uint8_t *end;
+#ifdef __SPU__
+	uint8_t *buf;
+	uint64_t ea;
+	uint32_t left;                  /* bytes not requested yet */
+	uint32_t size[2];               /* bytes of the block in flight into each half, 0: none */
+	uint32_t next;                  /* half to consume next */
+#endif
+} pak_in;
+
+#ifdef __SPU__
+
+static inline void pak_in_request(pak_in *in, uint32_t half)
+{
+	uint32_t n = in->left > PAK_SPU_BLOCK ? PAK_SPU_BLOCK : in->left;
+
+	in->size[half] = n;
+	if (!n)
+		return;
+	mfc_get(in->buf + half * PAK_SPU_BLOCK, in->ea, (n + 15) & ~15, PAK_SPU_TAG + half, 0, 0);
+	in->ea += n;
+	in->left -= n;
+}
+
+static inline void pak_in_open(pak_in *in, void *buf, uint64_t ea, uint32_t size)
+{
+	in->p = in->end = NULL;
+	in->buf = (uint8_t *) buf;
+	in->ea = ea;
+	in->left = size;
+	in->next = 0;
+	in->size[1] = 0;
+	pak_in_request(in, 0);
+}
+
+static inline int pak_refill(pak_in *in)
+{
+	uint32_t half = in->next;
+	uint32_t n = in->size[half];
+
+	if (!n)
+		return -1;
+	mfc_write_tag_mask(1 << (PAK_SPU_TAG + half));
+	mfc_read_tag_status_all();
+	in->p = in->buf + half * PAK_SPU_BLOCK;
+	in->end = in->p + n;
+	in->size[half] = 0;
+	in->next = half ^ 1;
+	pak_in_request(in, half ^ 1);
+	return 0;
+}
+
+/* the block in flight must land before the input area is handed to another job */
+static inline void pak_in_close(pak_in *in)
+{
+	(void) in;
+	mfc_write_tag_mask(3 << PAK_SPU_TAG);
+	mfc_read_tag_status_all();
+}
+
+#else
+
+static inline void pak_in_open(pak_in *in, const void *src, uint32_t size)
+{
+	in->p = (const uint8_t *) src;
+	in->end = in->p + size;
+}
+
+static inline int pak_refill(pak_in *in)
+{
+	(void) in;
+	return -1;
+}
+
+#endif
+
+static inline int pak_byte(pak_in *in)
+{
+	if (in->p == in->end && pak_refill(in))
+		return -1;
+	return *in->p++;
+}
+
+static inline int pak_copy(pak_in *in, uint8_t *dst, uint32_t len)
+{
+	while (len) {
+		uint32_t n;
+
+		if (in->p == in->end && pak_refill(in))
+			return -1;
+		n = in->end - in->p;
+		if (n > len)
+			n = len;
+		memcpy(dst, in->p, n);
+		in->p += n;
+		dst += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* LZ4 block format: token, literals, 16 bit little endian offset, match */
+
+static inline int pak_lz4_length(pak_in *in, uint32_t *len)
+{
+	int c;
+
+	do {
+		c = pak_byte(in);
+		if (c < 0)
+			return -1;
+		*len += c;
+	} while (c == 255);
+	return 0;
+}
+
+static inline int pak_lz4_decode(pak_in *in, uint8_t *out, uint32_t size)
+{
+	uint8_t *op = out, *end = out + size;
+	const uint8_t *match;
+	uint32_t len, offset;
+	int token, lo, hi;
+
+	for (;;) {
+		token = pak_byte(in);
+		if (token < 0)
+			return PAK_ECORRUPT;
+		len = token >> 4;
+		if (len == 15 && pak_lz4_length(in, &len))
+			return PAK_ECORRUPT;
+		if (len > (uint32_t) (end - op) || pak_copy(in, op, len))
+			return PAK_ECORRUPT;
+		op += len;
+		if (op == end)
+			return PAK_OK;
+
+		lo = pak_byte(in);
+		hi = pak_byte(in);
+		if (hi < 0)
+			return PAK_ECORRUPT;
+		offset = lo | hi << 8;
+		len = token & 15;
+		if (len == 15 && pak_lz4_length(in, &len))
+			return PAK_ECORRUPT;
+		len += 4;
+		if (!offset || offset > (uint32_t) (op - out) || len > (uint32_t) (end - op))
+			return PAK_ECORRUPT;
+		match = op - offset;
+		if (offset >= len) {
+			memcpy(op, match, len);
+			op += len;
+		} else {
+			while (len--)
+				*op++ = *match++;
+		}
+	}
+}
+
+/* inflate, for the SPU: canonical Huffman codes decoded a bit at a time */
+
+typedef struct
+{
+	uint16_t count[16];
+	uint16_t symbol[288];
+} pak_huffman;
+
+typedef struct
+{
+	pak_in *in;
+	uint32_t bitbuf;
+	uint32_t bitcnt;
+	int error;
+	uint8_t *out;
+	uint8_t *op;
+	uint8_t *end;
+} pak_inflate_state;
+
+static inline uint32_t pak_bits(pak_inflate_state *s, uint32_t need)
+{
+	uint32_t val = s->bitbuf;
+	int c;
+
+	while (s->bitcnt < need) {
+		c = pak_byte(s->in);
+		if (c < 0) {
+			s->error = 1;
+			return 0;
+		}
+		val |= (uint32_t) c << s->bitcnt;
+		s->bitcnt += 8;
+	}
+	s->bitbuf = val >> need;
+	s->bitcnt -= need;
+	return val & ((1U << need) - 1);
+}
+
+static inline int pak_huffman_build(pak_huffman *h, const uint16_t *length, int n)
+{
+	uint16_t offs[16];
+	int len, symbol, left;
+
+	memset(h->count, 0, sizeof(h->count));
+	for (symbol = 0; symbol < n; symbol++)
+		h->count[length[symbol]]++;
+	if (h->count[0] == n)
+		return 0;
+	left = 1;
+	for (len = 1; len < 16; len++) {
+		left <<= 1;
+		left -= h->count[len];
+		if (left < 0)
+			return -1;              /* over subscribed */
+	}
+	offs[1] = 0;
+	for (len = 1; len < 15; len++)
+		offs[len + 1] = offs[len] + h->count[len];
+	for (symbol = 0; symbol < n; symbol++)
+		if (length[symbol])
+			h->symbol[offs[length[symbol]]++] = symbol;
+	return left;
+}
+
+static inline int pak_huffman_decode(pak_inflate_state *s, const pak_huffman *h)
+{
+	int code = 0, first = 0, index = 0, count, len;
+
+	for (len = 1; len < 16; len++) {
+		code |= pak_bits(s, 1);
+		if (s->error)
+			return -1;
+		count = h->count[len];
+		if (code - count < first)
+			return h->symbol[index + (code - first)];
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+	return -1;
+}
+
+static inline int pak_inflate_codes(pak_inflate_state *s, const pak_huffman *lencode, const pak_huffman *distcode)
+{
+	static const uint16_t lbase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+		35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+	static const uint8_t lext[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+		3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	static const uint16_t dbase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+		257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+	static const uint8_t dext[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+		7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+	int symbol;
+	uint32_t len, dist;
+
+	for (;;) {
+		symbol = pak_huffman_decode(s, lencode);
+		if (symbol < 0)
+			return -1;
+		if (symbol < 256) {
+			if (s->op == s->end)
+				return -1;
+			*s->op++ = symbol;
+		} else if (symbol == 256) {
+			return 0;
+		} else {
+			symbol -= 257;
+			if (symbol >= 29)
+				return -1;
+			len = lbase[symbol] + pak_bits(s, lext[symbol]);
+			symbol = pak_huffman_decode(s, distcode);
+			if (symbol < 0 || symbol >= 30)
+				return -1;
+			dist = dbase[symbol] + pak_bits(s, dext[symbol]);
+			if (s->error || dist > (uint32_t) (s->op - s->out) || len > (uint32_t) (s->end - s->op))
+				return -1;
+			while (len--) {
+				*s->op = *(s->op - dist);
+				s->op++;
+			}
+		}
+	}
+}
+
+static inline int pak_inflate_fixed(pak_inflate_state *s)
+{
+	pak_huffman lencode, distcode;
+	uint16_t lengths[288];
+	int symbol;
+
+	for (symbol = 0; symbol < 144; symbol++)
+		lengths[symbol] = 8;
+	for (; symbol < 256; symbol++)
+		lengths[symbol] = 9;
+	for (; symbol < 280; symbol++)
+		lengths[symbol] = 7;
+	for (; symbol < 288; symbol++)
+		lengths[symbol] = 8;
+	pak_huffman_build(&lencode, lengths, 288);
+	for (symbol = 0; symbol < 30; symbol++)
+		lengths[symbol] = 5;
+	pak_huffman_build(&distcode, lengths, 30);
+	return pak_inflate_codes(s, &lencode, &distcode);
+}
+
+static inline int pak_inflate_dynamic(pak_inflate_state *s)
+{
+	static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+	pak_huffman lencode, distcode;
+	uint16_t lengths[320];
+	int nlen, ndist, ncode, index, symbol, len, err;
+
+	nlen = pak_bits(s, 5) + 257;
+	ndist = pak_bits(s, 5) + 1;
+	ncode = pak_bits(s, 4) + 4;
+	if (s->error || nlen > 286 || ndist > 30)
+		return -1;
+	for (index = 0; index < ncode; index++)
+		lengths[order[index]] = pak_bits(s, 3);
+	for (; index < 19; index++)
+		lengths[order[index]] = 0;
+	if (s->error || pak_huffman_build(&lencode, lengths, 19) != 0)
+		return -1;
+
+	index = 0;
+	while (index < nlen + ndist) {
+		symbol = pak_huffman_decode(s, &lencode);
+		if (symbol < 0)
+			return -1;
+		if (symbol < 16) {
+			lengths[index++] = symbol;
+			continue;
+		}
+		len = 0;
+		if (symbol == 16) {
+			if (!index)
+				return -1;
+			len = lengths[index - 1];
+			symbol = 3 + pak_bits(s, 2);
+		} else if (symbol == 17)
+			symbol = 3 + pak_bits(s, 3);
+		else
+			symbol = 11 + pak_bits(s, 7);
+		if (s->error || index + symbol > nlen + ndist)
+			return -1;
+		while (symbol--)
+			lengths[index++] = len;
+	}
+	if (!lengths[256])
+		return -1;
+	err = pak_huffman_build(&lencode, lengths, nlen);
+	if (err < 0 || (err > 0 && nlen - lencode.count[0] != 1))
+		return -1;
+	err = pak_huffman_build(&distcode, lengths + nlen, ndist);
+	if (err < 0 || (err > 0 && ndist - distcode.count[0] != 1))
+		return -1;
+	return pak_inflate_codes(s, &lencode, &distcode);
+}
+
+static inline int pak_inflate_stored(pak_inflate_state *s)
+{
+	int b0, b1, b2, b3;
+	uint32_t len;
+
+	s->bitbuf = 0;
+	s->bitcnt = 0;
+	b0 = pak_byte(s->in);
+	b1 = pak_byte(s->in);
+	b2 = pak_byte(s->in);
+	b3 = pak_byte(s->in);
+	if (b3 < 0 || b0 != (~b2 & 0xff) || b1 != (~b3 & 0xff))
+		return -1;
+	len = b0 | b1 << 8;
+	if (len > (uint32_t) (s->end - s->op) || pak_copy(s->in, s->op, len))
+		return -1;
+	s->op += len;
+	return 0;
+}
+
+/* zlib stream: header, deflate blocks; the adler32 is not checked */
+static inline int pak_inflate(pak_in *in, uint8_t *out, uint32_t size)
+{
+	pak_inflate_state s;
+	int cmf, flg, last, type, err;
+
+	cmf = pak_byte(in);
+	flg = pak_byte(in);
+	if (flg < 0 || (cmf & 15) != 8 || (cmf * 256 + flg) % 31 || (flg & 0x20))
+		return PAK_ECORRUPT;
+	s.in = in;
+	s.bitbuf = 0;
+	s.bitcnt = 0;
+	s.error = 0;
+	s.out = s.op = out;
+	s.end = out + size;
+	do {
+		last = pak_bits(&s, 1);
+		type = pak_bits(&s, 2);
+		if (s.error)
+			return PAK_ECORRUPT;
+		if (type == 0)
+			err = pak_inflate_stored(&s);
+		else if (type == 1)
+			err = pak_inflate_fixed(&s);
+		else if (type == 2)
+			err = pak_inflate_dynamic(&s);
+		else
+			err = -1;
+		if (err || s.error)
+			return PAK_ECORRUPT;
+	} while (!last);
+	return s.op == s.end ? PAK_OK : PAK_ECORRUPT;
+}
+
+#ifndef __SPU__
+
+/* one chunk on the PPU or the host: zlib from libz */
+static inline int pak_decode(uint32_t codec, const uint8_t *src, uint32_t csize, uint8_t *dst, uint32_t size)
+{
+	pak_in in;
+	uLongf n = size;
+
+	if (codec == PAK_CODEC_LZ4) {
+		pak_in_open(&in, src, csize);
+		return pak_lz4_decode(&in, dst, size);
+	}
+	if (codec == PAK_CODEC_ZLIB)
+		return uncompress(dst, &n, src, csize) == Z_OK && n == size ? PAK_OK : PAK_ECORRUPT;
+	if (csize != size)
+		return PAK_ECORRUPT;
+	memcpy(dst, src, size);
+	return PAK_OK;
+}
+
+#endif
+
+#ifdef __SPUJOB_H__
+
+/* job parameters */
+#define PAK_JOB_SRC             0           /* ea of the compressed chunk, 128 byte aligned */
+#define PAK_JOB_SRC_SIZE        1
+#define PAK_JOB_DST             2           /* ea of the output, 16 byte aligned */
+#define PAK_JOB_DST_SIZE        3
+#define PAK_JOB_CODEC           4
+
+/*! \brief Decode one chunk; the job output (16 bytes) receives the status as an int32_t. */
+static inline void pakDecodeJob(spuJobContext *ctx, const spuJob *job, void *input, void *output)
+{
+	uint32_t csize = (uint32_t) job->params[PAK_JOB_SRC_SIZE];
+	uint32_t size = (uint32_t) job->params[PAK_JOB_DST_SIZE];
+	uint32_t codec = (uint32_t) job->params[PAK_JOB_CODEC];
+	int32_t *result = (int32_t *) output;
+#ifdef __SPU__
+	uint8_t out[PAK_CHUNK_SIZE] __attribute__((aligned(128)));
+	pak_in in;
+	int ret;
+
+	(void) ctx;
+	if (size > PAK_CHUNK_SIZE || csize > PAK_CHUNK_SIZE + PAK_SLOT_PAD) {
+		result[0] = PAK_ECORRUPT;
+		return;
+	}
+	pak_in_open(&in, input, job->params[PAK_JOB_SRC], csize);
+	if (codec == PAK_CODEC_LZ4)
+		ret = pak_lz4_decode(&in, out, size);
+	else if (codec == PAK_CODEC_ZLIB)
+		ret = pak_inflate(&in, out, size);
+	else
+		ret = pak_copy(&in, out, size) ? PAK_ECORRUPT : PAK_OK;
+	pak_in_close(&in);
+	if (ret == PAK_OK)
+		spujob_put(out, job->params[PAK_JOB_DST], (size + 15) & ~15);
+	result[0] = ret;
+#else
+	(void) ctx;
+	(void) input;
+	result[0] = pak_decode(codec, (const uint8_t *) SPUJOB_PTR(job->params[PAK_JOB_SRC]), csize,
+		(uint8_t *) SPUJOB_PTR(job->params[PAK_JOB_DST]), size);
+#endif
+}
+
+#endif /* __SPUJOB_H__ */
+
+#ifndef __SPU__
+
+typedef struct _pak_archive pakArchive;
+typedef struct _pak_load pakLoad;
+
+/*! \brief Reader configuration, see \ref pakDefaults. */
+typedef struct _pak_config
+{
+	uint32_t slots;                 /*!< \brief compressed chunks read or decoded at once */
+	void *jobs;                     /*!< \brief spuJobSystem decoding the chunks, NULL: inline */
+	uint32_t binary;                /*!< \brief index of the \ref pakDecodeJob binary in it */
+} pakConfig;
+
+/*! \brief Load of an entry; owned by the caller until its status is no longer \ref PAK_PENDING. */
+struct _pak_load
+{
+	uint32_t entry;                 /*!< \brief from \ref pakFind */
+	uint32_t priority;              /*!< \brief of the reads, see fschedRequest */
+	void *buffer;                   /*!< \brief 16 byte aligned, \ref pakBufferSize bytes */
+	uint64_t deadline;              /*!< \brief of the reads, see fschedRequest */
+	volatile int32_t status;        /*!< \brief \ref PAK_PENDING, then PAK_OK or an error */
+
+	/* private */
+	pakLoad *next;
+	uint32_t issued;                /* chunks */
+	uint32_t active;                /* slots working for the load */
+	int32_t error;
+};
+
+/*! \brief Archive statistics. */
+typedef struct _pak_stats
+{
+	uint64_t lookups;
+	uint64_t loads;
+	uint64_t chunks;                /*!< \brief chunks completed */
+	uint64_t stored_reads;          /*!< \brief reads of stored chunks into the buffer of a load */
+	uint64_t jobs;                  /*!< \brief chunks decoded by the job system */
+	uint64_t inline_decodes;        /*!< \brief chunks decoded by the polling thread */
+	uint64_t bytes_read;
+	uint64_t bytes_out;
+	uint64_t errors;
+} pakStats;
+
+/*! \brief Fill \p config with the defaults: \ref PAK_SLOTS slots, inline decoding. */
+void pakDefaults(pakConfig *config);
+
+/*! \brief Open an archive and read its index.
+ \param sched Scheduler issuing the reads; it must outlive the archive.
+ \param config NULL for the defaults.
+*/
+int pakOpen(pakArchive **archive, fsched *sched, const char *path, const pakConfig *config);
+
+/*! \brief Wait for the loads, then close the archive. */
+int pakClose(pakArchive *archive);
+
+/*! \brief Entry of a name, or PAK_ENOENT. */
+int pakFind(pakArchive *archive, const char *name);
+
+/*! \brief Entry of a hash computed ahead with \ref pakHash (the first one if names collide), or PAK_ENOENT. */
+int pakFindHash(pakArchive *archive, uint32_t hash);
+
+uint32_t pakCount(pakArchive *archive);
+const pakEntry *pakGetEntry(pakArchive *archive, uint32_t entry);
+const char *pakEntryName(pakArchive *archive, uint32_t entry);
+
+/*! \brief Bytes a load buffer of the entry needs: its size rounded up to 16. */
+uint32_t pakBufferSize(pakArchive *archive, uint32_t entry);
+
+/*! \brief Queue a load; \p buffer may be rsxMemalign memory. */
+int pakLoadAsync(pakArchive *archive, pakLoad *load, uint32_t entry, void *buffer, uint32_t priority, uint64_t deadline);
+
+/*! \brief Advance the loads without blocking.
+ \return the loads not completed */
+int pakPoll(pakArchive *archive);
+
+/*! \brief Advance the loads until \p load completed.
+ \return its status */
+int pakWait(pakArchive *archive, pakLoad *load);
+
+/*! \brief Load an entry by name and wait for it. */
+int pakRead(pakArchive *archive, const char *name, void *buffer, uint32_t size);
+
+void pakGetStats(pakArchive *archive, pakStats *stats);
+
+#endif /* !__SPU__ */
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef PAK_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <zlib.h>
+
+#ifdef __PPU__
+#include <malloc.h>
+#endif
+
+#define PAK_SLOT_FREE           0
+#define PAK_SLOT_READING        1
+#define PAK_SLOT_DECODING       2
+
+typedef struct _pak_slot
+{
+#ifdef __SPUJOB_H__
+	spuJob job;
+	spuJobCounter counter;
+#endif
+	int32_t result[4] __attribute__((aligned(16)));    /* job output */
+	fschedRequest req;
+	uint32_t state;
+	uint32_t chunk;                 /* first chunk, in the entry */
+	uint32_t count;                 /* chunks read by the request */
+	uint32_t codec;
+	uint32_t size;                  /* bytes once decoded */
+	pakLoad *load;
+	uint8_t *buffer;
+} __attribute__((aligned(128))) pak_slot;
+
+struct _pak_archive
+{
+	fsched *sched;
+	int file;
+	pakConfig config;
+	pakHeader header;
+	uint8_t *index;
+	uint32_t *buckets;
+	pakEntry *entries;
+	pakChunk *chunks;
+	const char *names;
+	pak_slot *slots;
+	uint8_t *memory;
+	pakLoad *head;                  /* loads with chunks to issue */
+	pakLoad *tail;
+	uint32_t loads;                 /* not completed */
+	pakStats stats;
+};
+
+static void *pak_alloc(size_t size)
+{
+#ifdef __PPU__
+	return memalign(128, size);
+#else
+	void *p;
+
+	return posix_memalign(&p, 128, size) ? NULL : p;
+#endif
+}
+
+static inline uint32_t pak_be32(uint32_t v)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	return __builtin_bswap32(v);
+#else
+	return v;
+#endif
+}
+
+static inline uint64_t pak_be64(uint64_t v)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	return __builtin_bswap64(v);
+#else
+	return v;
+#endif
+}
+
+/* the readahead of the scheduler may still be reading the file */
+static void pak_close_file(pakArchive *ar)
+{
+	if (fschedClose(ar->sched, ar->file) == FSCHED_EBUSY) {
+		fschedDrain(ar->sched);
+		fschedClose(ar->sched, ar->file);
+	}
+}
+
+static int pak_block(pakArchive *ar);
+
+/* read and wait, for the header and the index */
+static int pak_read_sync(pakArchive *ar, uint64_t offset, uint64_t size, void *buffer)
+{
+	fschedRequest req;
+
+	memset(&req, 0, sizeof(req));
+	if (fschedReadAsync(ar->sched, &req, ar->file, offset, size, buffer, 0, 0, NULL, NULL))
+		return PAK_EIO;
+	if (fschedWait(ar->sched, &req, 0) != FSCHED_OK || req.result != size)
+		return PAK_EIO;
+	return PAK_OK;
+}
+
+/* index to native order and checked once, so that loads can trust it */
+static int pak_load_index(pakArchive *ar)
+{
+	pakHeader *h = &ar->header;
+	uint32_t buckets = 1U << h->bucket_bits;
+	uint32_t i, j, chunk_size = h->chunk_size;
+	uint64_t end;
+
+	if (h->entries < (buckets + 1) * 4 || h->chunks < h->entries + (uint64_t) h->entry_count * sizeof(pakEntry) ||
+	    h->names < h->chunks + (uint64_t) h->chunk_count * sizeof(pakChunk) ||
+	    (uint64_t) h->names + h->names_size > h->index_size || (h->entries & 7) || (h->chunks & 3) ||
+	    (h->names_size && ar->index[h->names + h->names_size - 1]))
+		return PAK_EFORMAT;
+	ar->buckets = (uint32_t *) ar->index;
+	ar->entries = (pakEntry *) (ar->index + h->entries);
+	ar->chunks = (pakChunk *) (ar->index + h->chunks);
+	ar->names = (const char *) ar->index + h->names;
+
+	for (i = 0; i <= buckets; i++) {
+		ar->buckets[i] = pak_be32(ar->buckets[i]);
+		if (ar->buckets[i] > h->entry_count || (i && ar->buckets[i] < ar->buckets[i - 1]))
+			return PAK_EFORMAT;
+	}
+	if (ar->buckets[buckets] != h->entry_count)
+		return PAK_EFORMAT;
+	for (i = 0; i < h->chunk_count; i++) {
+		ar->chunks[i].offset = pak_be32(ar->chunks[i].offset);
+		ar->chunks[i].info = pak_be32(ar->chunks[i].info);
+	}
+	for (i = 0; i < h->entry_count; i++) {
+		pakEntry *e = &ar->entries[i];
+
+		e->hash = pak_be32(e->hash);
+		e->name = pak_be32(e->name);
+		e->size = pak_be32(e->size);
+		e->flags = pak_be32(e->flags);
+		e->first_chunk = pak_be32(e->first_chunk);
+		e->chunk_count = pak_be32(e->chunk_count);
+		e->offset = pak_be64(e->offset);
+		if (e->name >= h->names_size || (uint64_t) e->first_chunk + e->chunk_count > h->chunk_count ||
+		    e->chunk_count != (uint32_t) (((uint64_t) e->size + chunk_size - 1) / chunk_size))
+			return PAK_EFORMAT;
+		for (j = 0; j < e->chunk_count; j++) {
+			uint32_t info = ar->chunks[e->first_chunk + j].info;
+			uint32_t raw = j + 1 < e->chunk_count ? chunk_size : e->size - j * chunk_size;
+			uint32_t bytes = PAK_CHUNK_BYTES(info);
+
+			end = e->offset + ar->chunks[e->first_chunk + j].offset + bytes;
+			if (end > h->file_size || PAK_CHUNK_CODEC(info) > PAK_CODEC_LZ4 ||
+			    (PAK_CHUNK_CODEC(info) == PAK_CODEC_STORED ? bytes != raw : bytes > chunk_size + PAK_SLOT_PAD - 16))
+				return PAK_EFORMAT;
+		}
+	}
+	return PAK_OK;
+}
+
+void pakDefaults(pakConfig *config)
+{
+	memset(config, 0, sizeof(*config));
+	config->slots = PAK_SLOTS;
+}
+
+int pakOpen(pakArchive **archive, fsched *sched, const char *path, const pakConfig *config)
+{
+	pakArchive *ar;
+	pakHeader *h;
+	uint32_t i, slot_size;
+	int ret;
+
+	if (!archive || !sched || !path)
+		return PAK_EINVAL;
+	*archive = NULL;
+	ar = (pakArchive *) calloc(1, sizeof(pakArchive));
+	if (!ar)
+		return PAK_ENOMEM;
+	if (config)
+		ar->config = *config;
+	else
+		pakDefaults(&ar->config);
+	if (!ar->config.slots) {
+		free(ar);
+		return PAK_EINVAL;
+	}
+#ifndef __SPUJOB_H__
+	ar->config.jobs = NULL;
+#endif
+	ar->sched = sched;
+	ar->file = fschedOpen(sched, path, FSCHED_BASE_AUTO);
+	if (ar->file < 0) {
+		ret = ar->file == FSCHED_EIO ? PAK_EIO : PAK_ENOMEM;
+		free(ar);
+		return ret;
+	}
+
+	h = &ar->header;
+	ret = pak_read_sync(ar, 0, sizeof(pakHeader), h);
+	if (ret == PAK_OK) {
+		h->magic = pak_be32(h->magic);
+		h->version = pak_be32(h->version);
+		h->chunk_size = pak_be32(h->chunk_size);
+		h->align = pak_be32(h->align);
+		h->entry_count = pak_be32(h->entry_count);
+		h->bucket_bits = pak_be32(h->bucket_bits);
+		h->chunk_count = pak_be32(h->chunk_count);
+		h->names_size = pak_be32(h->names_size);
+		h->index_offset = pak_be64(h->index_offset);
+		h->index_size = pak_be32(h->index_size);
+		h->entries = pak_be32(h->entries);
+		h->chunks = pak_be32(h->chunks);
+		h->names = pak_be32(h->names);
+		h->file_size = pak_be64(h->file_size);
+		if (h->magic != PAK_MAGIC || h->version != PAK_VERSION || !h->chunk_size || h->chunk_size > PAK_CHUNK_SIZE ||
+		    (h->chunk_size & 15) || h->bucket_bits > 24 || h->file_size > fschedFileSize(sched, ar->file) ||
+		    h->index_offset + h->index_size > h->file_size)
+			ret = PAK_EFORMAT;
+	}
+	if (ret == PAK_OK) {
+		ar->index = (uint8_t *) pak_alloc(h->index_size ? h->index_size : 16);
+		if (!ar->index)
+			ret = PAK_ENOMEM;
+		else if ((ret = pak_read_sync(ar, h->index_offset, h->index_size, ar->index)) == PAK_OK)
+			ret = pak_load_index(ar);
+	}
+	if (ret == PAK_OK) {
+		slot_size = h->chunk_size + PAK_SLOT_PAD;
+		ar->slots = (pak_slot *) pak_alloc(ar->config.slots * sizeof(pak_slot));
+		ar->memory = (uint8_t *) pak_alloc((size_t) ar->config.slots * slot_size);
+		if (!ar->slots || !ar->memory)
+			ret = PAK_ENOMEM;
+		else {
+			memset(ar->slots, 0, ar->config.slots * sizeof(pak_slot));
+			for (i = 0; i < ar->config.slots; i++)
+				ar->slots[i].buffer = ar->memory + (size_t) i * slot_size;
+		}
+	}
+	if (ret != PAK_OK) {
+		free(ar->slots);
+		free(ar->memory);
+		free(ar->index);
+		pak_close_file(ar);
+		free(ar);
+		return ret;
+	}
+	*archive = ar;
+	return PAK_OK;
+}
+
+int pakClose(pakArchive *ar)
+{
+	if (!ar)
+		return PAK_EINVAL;
+	while (pakPoll(ar))
+		pak_block(ar);
+	pak_close_file(ar);
+	free(ar->slots);
+	free(ar->memory);
+	free(ar->index);
+	free(ar);
+	return PAK_OK;
+}
+
+int pakFindHash(pakArchive *ar, uint32_t hash)
+{
+	uint32_t bits = ar->header.bucket_bits;
+	uint32_t b = bits ? hash >> (32 - bits) : 0;
+	uint32_t i;
+
+	ar->stats.lookups++;
+	for (i = ar->buckets[b]; i < ar->buckets[b + 1]; i++)
+		if (ar->entries[i].hash == hash)
+			return (int) i;
+	return PAK_ENOENT;
+}
+
+int pakFind(pakArchive *ar, const char *name)
+{
+	uint32_t hash = pakHash(name);
+	uint32_t bits = ar->header.bucket_bits;
+	uint32_t b = bits ? hash >> (32 - bits) : 0;
+	uint32_t i;
+
+	ar->stats.lookups++;
+	for (i = ar->buckets[b]; i < ar->buckets[b + 1]; i++)
+		if (ar->entries[i].hash == hash && !strcmp(ar->names + ar->entries[i].name, name))
+			return (int) i;
+	return PAK_ENOENT;
+}
+
+uint32_t pakCount(pakArchive *ar)
+{
+	return ar->header.entry_count;
+}
+
+const pakEntry *pakGetEntry(pakArchive *ar, uint32_t entry)
+{
+	return entry < ar->header.entry_count ? &ar->entries[entry] : NULL;
+}
+
+const char *pakEntryName(pakArchive *ar, uint32_t entry)
+{
+	return entry < ar->header.entry_count ? ar->names + ar->entries[entry].name : NULL;
+}
+
+uint32_t pakBufferSize(pakArchive *ar, uint32_t entry)
+{
+	return entry < ar->header.entry_count ? (ar->entries[entry].size + 15) & ~15U : 0;
+}
+
+static void pak_unqueue(pakArchive *ar, pakLoad *load)
+{
+	pakLoad **p, *prev = NULL;
+
+	for (p = &ar->head; *p && *p != load; p = &(*p)->next)
+		prev = *p;
+	if (!*p)
+		return;
+	*p = load->next;
+	if (ar->tail == load)
+		ar->tail = prev;
+	load->next = NULL;
+}
+
+static void pak_load_check(pakArchive *ar, pakLoad *load)
+{
+	if (load->issued < ar->entries[load->entry].chunk_count || load->active)
+		return;
+	if (load->error)
+		ar->stats.errors++;
+	ar->loads--;
+	load->status = load->error;
+}
+
+static void pak_slot_done(pakArchive *ar, pak_slot *slot, int32_t error)
+{
+	pakLoad *load = slot->load;
+
+	slot->state = PAK_SLOT_FREE;
+	slot->load = NULL;
+	load->active--;
+	if (error && !load->error) {
+		/* the chunks not issued yet are dropped */
+		load->error = error;
+		pak_unqueue(ar, load);
+		load->issued = ar->entries[load->entry].chunk_count;
+	}
+	if (!error) {
+		ar->stats.chunks += slot->count;
+		ar->stats.bytes_out += slot->size;
+	}
+	pak_load_check(ar, load);
+}
+
+static void pak_slot_decode(pakArchive *ar, pak_slot *slot)
+{
+	uint8_t *dst = (uint8_t *) slot->load->buffer + (size_t) slot->chunk * ar->header.chunk_size;
+
+#ifdef __SPUJOB_H__
+	if (ar->config.jobs) {
+		spuJob *job = &slot->job;
+
+		memset(job, 0, sizeof(*job));
+		job->binary = ar->config.binary;
+		job->counter = SPUJOB_EA(&slot->counter);
+		job->output = SPUJOB_EA(slot->result);
+		job->output_size = 16;
+		job->params[PAK_JOB_SRC] = SPUJOB_EA(slot->buffer);
+		job->params[PAK_JOB_SRC_SIZE] = slot->req.size;
+		job->params[PAK_JOB_DST] = SPUJOB_EA(dst);
+		job->params[PAK_JOB_DST_SIZE] = slot->size;
+		job->params[PAK_JOB_CODEC] = slot->codec;
+		slot->result[0] = PAK_ECORRUPT;
+		spuJobCounterInit(&slot->counter, 1, NULL);
+		if (spuJobSubmit((spuJobSystem *) ar->config.jobs, job) == SPUJOB_OK) {
+			slot->state = PAK_SLOT_DECODING;
+			ar->stats.jobs++;
+			return;
+		}
+	}
+#endif
+	ar->stats.inline_decodes++;
+	pak_slot_done(ar, slot, pak_decode(slot->codec, slot->buffer, slot->req.size, dst, slot->size));
+}
+
+/* next chunk of the first queued load into a free slot; stored chunks in a row are read at once */
+static void pak_issue(pakArchive *ar, pak_slot *slot)
+{
+	pakLoad *load = ar->head;
+	const pakEntry *e = &ar->entries[load->entry];
+	const pakChunk *c = &ar->chunks[e->first_chunk + load->issued];
+	uint32_t chunk_size = ar->header.chunk_size;
+	uint32_t bytes = PAK_CHUNK_BYTES(c->info);
+	fschedRequest *req = &slot->req;
+
+	memset(req, 0, sizeof(*req));
+	slot->load = load;
+	slot->chunk = load->issued;
+	slot->codec = PAK_CHUNK_CODEC(c->info);
+	slot->count = 1;
+	req->file = ar->file;
+	req->priority = load->priority;
+	req->deadline = load->deadline;
+	req->offset = e->offset + c->offset;
+	req->size = bytes;
+	if (slot->codec == PAK_CODEC_STORED) {
+		while (slot->chunk + slot->count < e->chunk_count && PAK_CHUNK_CODEC(c[slot->count].info) == PAK_CODEC_STORED &&
+		       c[slot->count].offset == c->offset + req->size) {
+			req->size += PAK_CHUNK_BYTES(c[slot->count].info);
+			slot->count++;
+		}
+		req->buffer = (uint8_t *) load->buffer + (size_t) slot->chunk * chunk_size;
+		req->flags = FSCHED_DIRECT;
+		slot->size = req->size;
+		ar->stats.stored_reads++;
+	} else {
+		req->buffer = slot->buffer;
+		slot->size = slot->chunk + 1 < e->chunk_count ? chunk_size : e->size - slot->chunk * chunk_size;
+	}
+	load->issued += slot->count;
+	load->active++;
+	if (load->issued == e->chunk_count)
+		pak_unqueue(ar, load);
+	slot->state = PAK_SLOT_READING;
+	ar->stats.bytes_read += req->size;
+	if (fschedRead(ar->sched, req) != FSCHED_OK)
+		pak_slot_done(ar, slot, PAK_EIO);
+}
+
+int pakPoll(pakArchive *ar)
+{
+	pak_slot *slot;
+	uint32_t i;
+	int progress = 1;
+
+	while (progress) {
+		progress = 0;
+		for (i = 0; i < ar->config.slots; i++) {
+			slot = &ar->slots[i];
+			if (slot->state == PAK_SLOT_READING && slot->req.status != FSCHED_PENDING) {
+				progress = 1;
+				if (slot->req.status != FSCHED_OK || slot->req.result != slot->req.size)
+					pak_slot_done(ar, slot, PAK_EIO);
+				else if (slot->codec == PAK_CODEC_STORED)
+					pak_slot_done(ar, slot, PAK_OK);
+				else
+					pak_slot_decode(ar, slot);
+			}
+#ifdef __SPUJOB_H__
+			if (slot->state == PAK_SLOT_DECODING && spuJobFenceTest(&slot->counter)) {
+				progress = 1;
+				pak_slot_done(ar, slot, slot->result[0]);
+			}
+#endif
+		}
+		for (i = 0; i < ar->config.slots && ar->head; i++) {
+			if (ar->slots[i].state == PAK_SLOT_FREE) {
+				pak_issue(ar, &ar->slots[i]);
+				progress = 1;
+			}
+		}
+	}
+	return (int) ar->loads;
+}
+
+/* wait for the work of a slot; 0 when every slot is free */
+static int pak_block(pakArchive *ar)
+{
+	pak_slot *slot;
+	uint32_t i;
+
+	for (i = 0; i < ar->config.slots; i++) {
+		slot = &ar->slots[i];
+		if (slot->state == PAK_SLOT_READING) {
+			fschedWait(ar->sched, &slot->req, 0);
+			return 1;
+		}
+#ifdef __SPUJOB_H__
+		if (slot->state == PAK_SLOT_DECODING) {
+			spuJobFenceWait(&slot->counter);
+			return 1;
+		}
+#endif
+	}
+	return 0;
+}
+
+int pakWait(pakArchive *ar, pakLoad *load)
+{
+	for (;;) {
+		pakPoll(ar);
+		if (load->status != PAK_PENDING)
+			return load->status;
+		if (!pak_block(ar))
+			return PAK_EINVAL;      /* not queued on this archive */
+	}
+}
+
+int pakLoadAsync(pakArchive *ar, pakLoad *load, uint32_t entry, void *buffer, uint32_t priority, uint64_t deadline)
+{
+	if (!ar || !load || entry >= ar->header.entry_count || (!buffer && ar->entries[entry].size) || ((uintptr_t) buffer & 15))
+		return PAK_EINVAL;
+	load->entry = entry;
+	load->buffer = buffer;
+	load->priority = priority;
+	load->deadline = deadline;
+	load->status = PAK_PENDING;
+	load->next = NULL;
+	load->issued = 0;
+	load->active = 0;
+	load->error = PAK_OK;
+	ar->loads++;
+	ar->stats.loads++;
+	if (!ar->entries[entry].chunk_count) {
+		pak_load_check(ar, load);
+		return PAK_OK;
+	}
+	if (ar->tail)
+		ar->tail->next = load;
+	else
+		ar->head = load;
+	ar->tail = load;
+	pakPoll(ar);
+	return PAK_OK;
+}
+
+int pakRead(pakArchive *ar, const char *name, void *buffer, uint32_t size)
+{
+	pakLoad load;
+	int entry, ret;
+
+	if (!ar || !name)
+		return PAK_EINVAL;
+	entry = pakFind(ar, name);
+	if (entry < 0)
+		return entry;
+	if (size < pakBufferSize(ar, entry))
+		return PAK_EINVAL;
+	ret = pakLoadAsync(ar, &load, entry, buffer, 0, 0);
+	return ret ? ret : pakWait(ar, &load);
+}
+
+void pakGetStats(pakArchive *ar, pakStats *stats)
+{
+	*stats = ar->stats;
+}
+
+#endif /* PAK_IMPLEMENTATION */
+
+#endif
@@ -0,0 +1,827 @@
+/*! \file ppuprof.h
+ \brief Sampling profiler and hitch detector for PPU threads.
+
+ A profiler thread wakes up every \p interval microseconds, lists the PPU
+ threads of the process with sysDbgGetPPUThreadIds and, for each thread
+ that is running (or sleeping, with \ref PPUPROF_SLEEPING), reads its
+ context with sysDbgReadPPUThreadContext: PC, LR, and up to \p depth
+ return addresses walked along the back chain from r1 (the 64 bit ABI
+ saves the link register 16 bytes into the caller's frame). The walk
+ never leaves the stack of the thread, and lv2 only tells a thread its
+ own: \ref ppuProfStart and the first \ref ppuProfFrame register the
+ stack of their thread, other threads call \ref ppuProfThreadStack, and
+ a thread without a registered stack is sampled with PC and LR only.
+ sys/dbg.h has no call to suspend a thread, so contexts are read as lv2 last saved
+ them; a thread the kernel refuses to describe (the call fails, e.g. on
+ a kernel without the debug calls enabled) is sampled by status alone.
+
+ Samples are encoded as compact records (\ref ppuProfRecord: 8 bytes
+ plus 4 per address) into a buffer that a sink sends to the host:
+ \ref ppuProfSinkTty writes hex lines to a TTY channel, so they travel
+ with the program's output, and \ref ppuProfSinkSocket writes the raw
+ stream to a TCP connection (\ref ppuProfConnect). bin/ppuprof.py
+ decodes either, symbolises against the PPU ELF and prints flat
+ profiles, folded stacks for flamegraph.pl, frame times and hitches.
+
+ The program marks the end of each frame with \ref ppuProfFrame. In
+ \ref PPUPROF_CONTINUOUS mode every sample and frame is sent. In
+ \ref PPUPROF_HITCH mode samples only go to an in memory history; the
+ frame records are sent, and a frame longer than \p budget is sent as a
+ \ref PPUPROF_REC_HITCH record followed by the full stacks sampled while
+ it ran. The history must cover a frame: \p history samples of every
+ running thread at \p interval.
+
+ On the host there are no thread contexts: the thread that called
+ \ref ppuProfStart is sampled by status, which is enough to exercise the
+ stream, the hitch detector and the tool.
+
+ - PPU / host: #define PPUPROF_IMPLEMENTATION in one source file.
+*/
+
+#ifndef __PPUPROF_H__
+#define __PPUPROF_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <lockfree/lockfree.h>
+
+#ifdef __PPU__
+#include <ppu-types.h>
+#include <sys/dbg.h>
+#else
+#include <pthread.h>
+#endif
+
+#ifndef PPUPROF_DEPTH
+#define PPUPROF_DEPTH           16          /*!< most return addresses per sample, after pc and lr */
+#endif
+#ifndef PPUPROF_MAX_THREADS
+#define PPUPROF_MAX_THREADS     64          /*!< threads listed per tick */
+#endif
+#ifndef PPUPROF_MARKS
+#define PPUPROF_MARKS           64          /*!< frame marks in flight to the profiler thread, power of 2 */
+#endif
+#ifndef PPUPROF_MAX_FRAME
+#define PPUPROF_MAX_FRAME       0x10000     /*!< largest stack frame the walker steps over */
+#endif
+
+#if PPUPROF_DEPTH < 1 || PPUPROF_DEPTH > 64
+#error "PPUPROF_DEPTH must be between 1 and 64"
+#endif
+
+#define PPUPROF_OK              0
+#define PPUPROF_EINVAL          -1
+#define PPUPROF_ENOMEM          -2
+#define PPUPROF_EBUSY           -3          /* already running */
+#define PPUPROF_EKERNEL         -4          /* an lv2 call failed */
+#define PPUPROF_EIO             -5
+
+#define PPUPROF_MAGIC           0x50505246  /*!< "PPRF", first word of the header record */
+#define PPUPROF_VERSION         1
+
+/* ppuProfConfig.mode */
+#define PPUPROF_CONTINUOUS      0           /*!< send every sample */
+#define PPUPROF_HITCH           1           /*!< send samples only for frames over budget */
+
+/* ppuProfConfig.flags */
+#define PPUPROF_SLEEPING        0x01        /*!< sample sleeping threads too (off cpu time) */
+
+/* ppuProfRecord.type; payload in 32 bit words */
+#define PPUPROF_REC_HEADER      0           /*!< magic, version, interval, mode, budget, flags */
+#define PPUPROF_REC_SAMPLE      1           /*!< pc, lr, return addresses; none if the context was not readable */
+#define PPUPROF_REC_FRAME       2           /*!< frame number, duration in usecs */
+#define PPUPROF_REC_HITCH       3           /*!< frame number, duration, budget, samples that follow */
+#define PPUPROF_REC_THREAD      4           /*!< thread id, 28 byte name */
+#define PPUPROF_REC_LOST        5           /*!< records dropped by a failed send */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! \brief Record header; \p count 32 bit words follow. */
+typedef struct _ppu_prof_record
+{
+	uint8_t type;                   /*!< \brief PPUPROF_REC_* */
+	uint8_t thread;                 /*!< \brief index of the thread in the THREAD records */
+	uint8_t count;                  /*!< \brief payload words */
+	uint8_t status;                 /*!< \brief sys_dbg_ppu_thread_status_t of a sample */
+	uint32_t stamp;                 /*!< \brief usecs since ppuProfStart */
+} ppuProfRecord;
+
+/*! \brief Sends \p size bytes of stream; returns 0 on success. Called on the profiler thread. */
+typedef int (*ppuProfSink)(void *arg, const void *data, uint32_t size);
+
+/*! \brief Profiler settings; \ref ppuProfDefaults fills in the defaults. */
+typedef struct _ppu_prof_config
+{
+	uint32_t interval;              /*!< \brief usecs between samples (1000) */
+	uint32_t depth;                 /*!< \brief return addresses per sample, at most PPUPROF_DEPTH (PPUPROF_DEPTH) */
+	uint32_t mode;                  /*!< \brief PPUPROF_CONTINUOUS or PPUPROF_HITCH */
+	uint32_t flags;                 /*!< \brief PPUPROF_SLEEPING */
+	uint32_t budget;                /*!< \brief hitch mode: usecs a frame may take (33333) */
+	uint32_t history;               /*!< \brief hitch mode: samples kept, power of 2 (1024) */
+	uint32_t buffer;                /*!< \brief bytes gathered before a send (4096) */
+	uint32_t flush;                 /*!< \brief usecs after which a partial buffer is sent (100000) */
+	int32_t priority;               /*!< \brief of the profiler thread (100) */
+	uint32_t stackSize;             /*!< \brief of the profiler thread (0x4000) */
+	ppuProfSink sink;               /*!< \brief where the stream goes (ppuProfSinkTty) */
+	void *sinkArg;                  /*!< \brief passed to \p sink (TTY channel 0) */
+} ppuProfConfig;
+
+/*! \brief Counters kept by the profiler thread. */
+typedef struct _ppu_prof_stats
+{
+	uint64_t ticks;                 /*!< \brief profiler wake ups */
+	uint64_t samples;               /*!< \brief thread samples taken */
+	uint64_t noContext;             /*!< \brief samples whose context could not be read */
+	uint64_t frames;                /*!< \brief frame marks seen */
+	uint64_t hitches;               /*!< \brief frames over budget */
+	uint64_t records;               /*!< \brief records sent */
+	uint64_t bytes;                 /*!< \brief bytes sent */
+	uint64_t lost;                  /*!< \brief records dropped by failed sends, frame marks dropped by a full queue */
+	uint64_t busyUsecs;             /*!< \brief time spent sampling and sending */
+} ppuProfStats;
+
+/*! \brief Default settings: continuous sampling every millisecond to TTY channel 0. */
+void ppuProfDefaults(ppuProfConfig *config);
+
+/*! \brief Start the profiler thread; the stream begins with a header record. */
+int ppuProfStart(const ppuProfConfig *config);
+
+/*! \brief Mark the end of a frame. Call it from one thread, not concurrently with ppuProfStop. */
+void ppuProfFrame(void);
+
+/*! \brief Register the stack of the calling thread, so its samples carry return addresses.
+ \return PPUPROF_OK, PPUPROF_EINVAL when the profiler is not running, PPUPROF_ENOMEM when PPUPROF_MAX_THREADS stacks are registered.
+*/
+int ppuProfThreadStack(void);
+
+/*! \brief Stop the profiler thread and send what is buffered. */
+int ppuProfStop(void);
+
+/*! \brief Copy of the counters (approximate while running). */
+void ppuProfGetStats(ppuProfStats *stats);
+
+/*! \brief Sink writing "PPROF <hex>" lines to the TTY channel in \p arg ((void *) channel; stderr, or the fd, on the host). */
+int ppuProfSinkTty(void *arg, const void *data, uint32_t size);
+
+/*! \brief Sink writing the raw stream to the socket in \p arg ((void *) (intptr_t) socket). */
+int ppuProfSinkSocket(void *arg, const void *data, uint32_t size);
+
+/*! \brief Connect a TCP socket to \p ip (dotted quad) \p port for \ref ppuProfSinkSocket; the network must be initialized. */
+int ppuProfConnect(const char *ip, uint16_t port);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef PPUPROF_IMPLEMENTATION
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifdef __PPU__
+#include <malloc.h>
+#include <ppu-asm.h>
+#include <sys/thread.h>
+#include <sys/systime.h>
+#include <sys/tty.h>
+#include <lv2/thread.h>
+#else
+#include <time.h>
+#endif
+
+typedef struct
+{
+	uint32_t frame;
+	uint32_t start;
+	uint32_t duration;
+	uint32_t pad;
+} ppuprof_mark;
+
+typedef struct
+{
+	ppuProfRecord rec;
+	uint32_t words[2 + PPUPROF_DEPTH];
+} ppuprof_sample;
+
+#ifdef __PPU__
+/* stack of a thread, published by the thread itself: id is stored last */
+typedef struct
+{
+	volatile uint64_t id;
+	uintptr_t lo;
+	uintptr_t hi;
+} ppuprof_stack;
+#endif
+
+typedef struct
+{
+	lfSpscRing marks;
+	ppuprof_mark mark_data[PPUPROF_MARKS];
+	ppuProfConfig config;
+	ppuProfStats stats;
+	uint64_t base;
+	uint64_t known[PPUPROF_MAX_THREADS];
+	uint32_t nknown;
+	ppuprof_sample *history;
+	uint32_t history_head;
+	uint32_t hitch_until;
+	uint8_t *buffer;
+	uint32_t used;
+	uint32_t pending;
+	uint32_t lost_pending;
+	uint32_t last_send;
+	volatile uint32_t running;
+	/* ppuProfFrame side */
+	uint32_t frame;
+	uint32_t frame_start;
+	volatile uint32_t marks_lost;
+#ifdef __PPU__
+	sys_ppu_thread_t thread;
+	sys_ppu_thread_t self;
+	sys_ppu_thread_t ids[PPUPROF_MAX_THREADS];
+	sys_dbg_ppu_thread_context_t context;
+	ppuprof_stack stacks[PPUPROF_MAX_THREADS];
+	uint32_t nstacks;               /* slots taken, may run past PPUPROF_MAX_THREADS */
+	uint32_t frame_stack;           /* the ppuProfFrame thread registered its stack */
+#else
+	pthread_t thread;
+	pthread_t target;
+#endif
+} ppuprof;
+
+static ppuprof *ppuprof_state;
+
+#ifdef __PPU__
+
+static uint64_t ppuprof_tb_per_usec;
+
+static uint64_t ppuprof_now(void)
+{
+	return __gettime() / ppuprof_tb_per_usec;
+}
+
+static void ppuprof_sleep(uint32_t usecs)
+{
+	sysUsleep(usecs);
+}
+
+#else
+
+static uint64_t ppuprof_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void ppuprof_sleep(uint32_t usecs)
+{
+	usleep(usecs);
+}
+
+#endif
+
+static inline uint32_t ppuprof_stamp(ppuprof *p)
+{
+	return (uint32_t) (ppuprof_now() - p->base);
+}
+
+/* stream */
+
+static void ppuprof_send(ppuprof *p)
+{
+	uint32_t now;
+
+	if (!p->used)
+		return;
+	now = ppuprof_stamp(p);
+	if (p->config.sink(p->config.sinkArg, p->buffer, p->used)) {
+		p->stats.lost += p->pending;
+		p->lost_pending += p->pending;
+	} else {
+		p->stats.records += p->pending;
+		p->stats.bytes += p->used;
+	}
+	p->used = 0;
+	p->pending = 0;
+	p->last_send = now;
+}
+
+static void ppuprof_put(ppuprof *p, uint32_t type, uint32_t thread, uint32_t status, uint32_t stamp, const uint32_t *words, uint32_t count)
+{
+	ppuProfRecord rec;
+	uint32_t size = sizeof(rec) + count * 4;
+
+	if (p->used + size > p->config.buffer)
+		ppuprof_send(p);
+	if (!p->used && p->lost_pending) {
+		/* the first record after a failed send says how much it lost */
+		rec.type = PPUPROF_REC_LOST;
+		rec.thread = 0;
+		rec.count = 1;
+		rec.status = 0;
+		rec.stamp = stamp;
+		memcpy(p->buffer, &rec, sizeof(rec));
+		memcpy(p->buffer + sizeof(rec), &p->lost_pending, 4);
+		p->used = sizeof(rec) + 4;
+		p->pending = 1;
+		p->lost_pending = 0;
+	}
+	rec.type = (uint8_t) type;
+	rec.thread = (uint8_t) thread;
+	rec.count = (uint8_t) count;
+	rec.status = (uint8_t) status;
+	rec.stamp = stamp;
+	memcpy(p->buffer + p->used, &rec, sizeof(rec));
+	memcpy(p->buffer + p->used + sizeof(rec), words, count * 4);
+	p->used += size;
+	p->pending++;
+}
+
+static void ppuprof_put_sample(ppuprof *p, const ppuprof_sample *s)
+{
+	ppuprof_put(p, PPUPROF_REC_SAMPLE, s->rec.thread, s->rec.status, s->rec.stamp, s->words, s->rec.count);
+}
+
+/* threads */
+
+static uint32_t ppuprof_thread(ppuprof *p, uint64_t id, uint32_t stamp)
+{
+	uint32_t words[8], i;
+	char name[32];
+
+	for (i = 0; i < p->nknown; i++) {
+		if (p->known[i] == id)
+			return i;
+	}
+	if (p->nknown == PPUPROF_MAX_THREADS)
+		return PPUPROF_MAX_THREADS - 1;
+	memset(name, 0, sizeof(name));
+#ifdef __PPU__
+	if (sysDbgGetPPUThreadName((sys_ppu_thread_t) id, name))
+		snprintf(name, sizeof(name), "0x%llx", (unsigned long long) id);
+#else
+	strcpy(name, p->nknown ? "thread" : "main");
+#endif
+	name[27] = 0;
+	words[0] = (uint32_t) id;
+	memcpy(&words[1], name, 28);
+	p->known[p->nknown] = id;
+	ppuprof_put(p, PPUPROF_REC_THREAD, p->nknown, 0, stamp, words, 8);
+	return p->nknown++;
+}
+
+#ifdef __PPU__
+
+/* Return addresses along the back chain from sp: each frame links to its
+   caller's, and the caller's frame holds our link register at 16. Every
+   word read lies in the stack [lo, hi) of the thread. */
+static uint32_t ppuprof_walk(uintptr_t sp, uintptr_t lo, uintptr_t hi, uint32_t *out, uint32_t max)
+{
+	uintptr_t next, ret;
+	uint32_t n = 0;
+
+	while (n < max && sp >= lo && sp + 8 <= hi && !(sp & 15)) {
+		next = (uintptr_t) *(volatile uint64_t *) sp;
+		if (next <= sp || next - sp > PPUPROF_MAX_FRAME || (next & 15) || next + 24 > hi)
+			break;
+		ret = (uintptr_t) *(volatile uint64_t *) (next + 16);
+		if (!ret)
+			break;
+		out[n++] = (uint32_t) ret;
+		sp = next;
+	}
+	return n;
+}
+
+static int ppuprof_register(ppuprof *p)
+{
+	sys_ppu_thread_stack_t info;
+	sys_ppu_thread_t id;
+	uint32_t i, n = __atomic_load_n(&p->nstacks, __ATOMIC_ACQUIRE);
+
+	sysThreadGetId(&id);
+	for (i = 0; i < n && i < PPUPROF_MAX_THREADS; i++)
+		if (p->stacks[i].id == id)
+			return PPUPROF_OK;
+	if (sysThreadGetStackInformation(&info))
+		return PPUPROF_EKERNEL;
+	i = __atomic_fetch_add(&p->nstacks, 1, __ATOMIC_ACQ_REL);
+	if (i >= PPUPROF_MAX_THREADS)
+		return PPUPROF_ENOMEM;
+	p->stacks[i].lo = (uintptr_t) info.addr;
+	p->stacks[i].hi = (uintptr_t) info.addr + info.size;
+	__atomic_store_n(&p->stacks[i].id, id, __ATOMIC_RELEASE);
+	return PPUPROF_OK;
+}
+
+static const ppuprof_stack *ppuprof_find_stack(ppuprof *p, sys_ppu_thread_t id)
+{
+	uint32_t i, n = __atomic_load_n(&p->nstacks, __ATOMIC_ACQUIRE);
+
+	for (i = 0; i < n && i < PPUPROF_MAX_THREADS; i++)
+		if (__atomic_load_n(&p->stacks[i].id, __ATOMIC_ACQUIRE) == id)
+			return &p->stacks[i];
+	return NULL;
+}
+
+static uint32_t ppuprof_list(ppuprof *p)
+{
+	u64 n = PPUPROF_MAX_THREADS, all = 0;
+
+	if (sysDbgGetPPUThreadIds(p->ids, &n, &all))
+		return 0;
+	return (uint32_t) n;
+}
+
+/* status, and pc, lr and the stack into s->words when the context is readable */
+static int ppuprof_read(ppuprof *p, uint32_t i, ppuprof_sample *s)
+{
+	sys_dbg_ppu_thread_status_t status;
+	const ppuprof_stack *stack;
+
+	if (p->ids[i] == p->self || sysDbgGetPPUThreadStatus(p->ids[i], &status))
+		return 0;
+	if (status != PPU_THREAD_STATUS_ONPROC && status != PPU_THREAD_STATUS_RUNNABLE &&
+		!(status == PPU_THREAD_STATUS_SLEEP && (p->config.flags & PPUPROF_SLEEPING)))
+		return 0;
+	s->rec.status = (uint8_t) status;
+	s->rec.count = 0;
+	if (sysDbgReadPPUThreadContext(p->ids[i], &p->context))
+		return 1;
+	s->words[0] = p->context.pc;
+	s->words[1] = p->context.lr;
+	stack = ppuprof_find_stack(p, p->ids[i]);
+	s->rec.count = (uint8_t) (2 + (stack ? ppuprof_walk((uintptr_t) p->context.gpr[1], stack->lo, stack->hi, &s->words[2],
+		p->config.depth) : 0));
+	return 1;
+}
+
+static uint64_t ppuprof_id(ppuprof *p, uint32_t i)
+{
+	return p->ids[i];
+}
+
+#else
+
+static uint32_t ppuprof_list(ppuprof *p)
+{
+	(void) p;
+	return 1;
+}
+
+static int ppuprof_read(ppuprof *p, uint32_t i, ppuprof_sample *s)
+{
+	(void) p;
+	(void) i;
+	s->rec.status = 2;              /* PPU_THREAD_STATUS_ONPROC */
+	s->rec.count = 0;
+	return 1;
+}
+
+static uint64_t ppuprof_id(ppuprof *p, uint32_t i)
+{
+	(void) i;
+	return (uint64_t) (uintptr_t) p->target;
+}
+
+#endif
+
+/* frames and hitches */
+
+/* taken while the frame ran, and not sent with an earlier hitch */
+static inline int ppuprof_in_hitch(const ppuprof *p, const ppuprof_sample *s, const ppuprof_mark *m)
+{
+	return s->rec.stamp - m->start <= m->duration && (int32_t) (s->rec.stamp - p->hitch_until) > 0;
+}
+
+static void ppuprof_hitch(ppuprof *p, const ppuprof_mark *m)
+{
+	uint32_t mask = p->config.history - 1, first, i, n = 0, words[4];
+
+	first = p->history_head > p->config.history ? p->history_head - p->config.history : 0;
+	for (i = first; i != p->history_head; i++)
+		n += ppuprof_in_hitch(p, &p->history[i & mask], m);
+	words[0] = m->frame;
+	words[1] = m->duration;
+	words[2] = p->config.budget;
+	words[3] = n;
+	ppuprof_put(p, PPUPROF_REC_HITCH, 0, 0, m->start, words, 4);
+	for (i = first; i != p->history_head; i++) {
+		if (ppuprof_in_hitch(p, &p->history[i & mask], m))
+			ppuprof_put_sample(p, &p->history[i & mask]);
+	}
+	p->hitch_until = m->start + m->duration;
+	p->stats.hitches++;
+}
+
+static void ppuprof_marks(ppuprof *p)
+{
+	ppuprof_mark m;
+	uint32_t words[2];
+
+	while (lfSpscPop(&p->marks, &m) == LF_OK) {
+		words[0] = m.frame;
+		words[1] = m.duration;
+		ppuprof_put(p, PPUPROF_REC_FRAME, 0, 0, m.start, words, 2);
+		p->stats.frames++;
+		if (p->config.mode == PPUPROF_HITCH && m.duration > p->config.budget)
+			ppuprof_hitch(p, &m);
+	}
+	/* ppuProfFrame() adds to it from the game thread */
+	p->stats.lost += __atomic_exchange_n(&p->marks_lost, 0, __ATOMIC_RELAXED);
+}
+
+static void ppuprof_tick(ppuprof *p)
+{
+	uint32_t stamp = ppuprof_stamp(p), n = ppuprof_list(p), i;
+	ppuprof_sample local, *s;
+
+	p->stats.ticks++;
+	for (i = 0; i < n; i++) {
+		s = p->config.mode == PPUPROF_HITCH ? &p->history[p->history_head & (p->config.history - 1)] : &local;
+		if (!ppuprof_read(p, i, s))
+			continue;
+		s->rec.type = PPUPROF_REC_SAMPLE;
+		s->rec.thread = (uint8_t) ppuprof_thread(p, ppuprof_id(p, i), stamp);
+		s->rec.stamp = stamp;
+		p->stats.samples++;
+		if (!s->rec.count)
+			p->stats.noContext++;
+		if (p->config.mode == PPUPROF_HITCH)
+			p->history_head++;
+		else
+			ppuprof_put_sample(p, s);
+	}
+	ppuprof_marks(p);
+	if (p->used && stamp - p->last_send >= p->config.flush)
+		ppuprof_send(p);
+}
+
+static void ppuprof_run(ppuprof *p)
+{
+	uint64_t next = ppuprof_now(), t0, now;
+
+#ifdef __PPU__
+	sysThreadGetId(&p->self);
+#endif
+	while (p->running) {
+		t0 = ppuprof_now();
+		ppuprof_tick(p);
+		now = ppuprof_now();
+		p->stats.busyUsecs += now - t0;
+		next += p->config.interval;
+		if (next > now)
+			ppuprof_sleep((uint32_t) (next - now));
+		else
+			next = now;
+	}
+	ppuprof_marks(p);
+	ppuprof_send(p);
+}
+
+#ifdef __PPU__
+static void ppuprof_entry(void *arg)
+{
+	ppuprof_run((ppuprof *) arg);
+	sysThreadExit(0);
+}
+#else
+static void *ppuprof_entry(void *arg)
+{
+	ppuprof_run((ppuprof *) arg);
+	return NULL;
+}
+#endif
+
+/* API */
+
+void ppuProfDefaults(ppuProfConfig *config)
+{
+	memset(config, 0, sizeof(*config));
+	config->interval = 1000;
+	config->depth = PPUPROF_DEPTH;
+	config->mode = PPUPROF_CONTINUOUS;
+	config->budget = 33333;
+	config->history = 1024;
+	config->buffer = 4096;
+	config->flush = 100000;
+	config->priority = 100;
+	config->stackSize = 0x4000;
+	config->sink = ppuProfSinkTty;
+	config->sinkArg = NULL;
+}
+
+int ppuProfStart(const ppuProfConfig *config)
+{
+	uint32_t words[6];
+	ppuprof *p;
+
+	if (ppuprof_state)
+		return PPUPROF_EBUSY;
+	if (!config || !config->sink || !config->interval || config->depth > PPUPROF_DEPTH || config->mode > PPUPROF_HITCH ||
+		config->buffer < sizeof(ppuprof_sample) || (config->mode == PPUPROF_HITCH &&
+		(!config->history || (config->history & (config->history - 1)))))
+		return PPUPROF_EINVAL;
+#ifdef __PPU__
+	{
+		u64 n = 1, all;
+		sys_ppu_thread_t id;
+
+		/* fails where the kernel does not offer the debug calls */
+		if (sysDbgGetPPUThreadIds(&id, &n, &all))
+			return PPUPROF_EKERNEL;
+	}
+	ppuprof_tb_per_usec = sysGetTimebaseFrequency() / 1000000;
+	p = (ppuprof *) memalign(128, sizeof(ppuprof));
+#else
+	if (posix_memalign((void **) &p, 128, sizeof(ppuprof)))
+		p = NULL;
+#endif
+	if (!p)
+		return PPUPROF_ENOMEM;
+	memset(p, 0, sizeof(*p));
+	p->config = *config;
+	p->buffer = (uint8_t *) malloc(config->buffer);
+	if (config->mode == PPUPROF_HITCH)
+		p->history = (ppuprof_sample *) malloc(config->history * sizeof(ppuprof_sample));
+	if (!p->buffer || (config->mode == PPUPROF_HITCH && !p->history)) {
+		free(p->buffer);
+		free(p->history);
+		free(p);
+		return PPUPROF_ENOMEM;
+	}
+	lfSpscInit(&p->marks, p->mark_data, PPUPROF_MARKS, sizeof(ppuprof_mark));
+	p->base = ppuprof_now();
+	p->hitch_until = ~0U;
+	words[0] = PPUPROF_MAGIC;
+	words[1] = PPUPROF_VERSION;
+	words[2] = config->interval;
+	words[3] = config->mode;
+	words[4] = config->budget;
+	words[5] = config->flags;
+	ppuprof_put(p, PPUPROF_REC_HEADER, 0, 0, 0, words, 6);
+	p->running = 1;
+#ifdef __PPU__
+	ppuprof_register(p);
+	if (sysThreadCreate(&p->thread, ppuprof_entry, p, config->priority, config->stackSize, THREAD_JOINABLE, (char *) "ppuprof")) {
+#else
+	p->target = pthread_self();
+	if (pthread_create(&p->thread, NULL, ppuprof_entry, p)) {
+#endif
+		free(p->buffer);
+		free(p->history);
+		free(p);
+		return PPUPROF_EKERNEL;
+	}
+	ppuprof_state = p;
+	return PPUPROF_OK;
+}
+
+void ppuProfFrame(void)
+{
+	ppuprof *p = ppuprof_state;
+	ppuprof_mark m;
+	uint32_t now;
+
+	if (!p)
+		return;
+#ifdef __PPU__
+	if (!p->frame_stack) {
+		ppuprof_register(p);
+		p->frame_stack = 1;
+	}
+#endif
+	now = ppuprof_stamp(p);
+	if (p->frame++) {
+		m.frame = p->frame - 1;
+		m.start = p->frame_start;
+		m.duration = now - p->frame_start;
+		m.pad = 0;
+		if (lfSpscPush(&p->marks, &m) != LF_OK)
+			__atomic_fetch_add(&p->marks_lost, 1, __ATOMIC_RELAXED);
+	}
+	p->frame_start = now;
+}
+
+int ppuProfThreadStack(void)
+{
+	ppuprof *p = ppuprof_state;
+
+	if (!p)
+		return PPUPROF_EINVAL;
+#ifdef __PPU__
+	return ppuprof_register(p);
+#else
+	return PPUPROF_OK;
+#endif
+}
+
+int ppuProfStop(void)
+{
+	ppuprof *p = ppuprof_state;
+#ifdef __PPU__
+	u64 retval;
+#endif
+
+	if (!p)
+		return PPUPROF_EINVAL;
+	p->running = 0;
+#ifdef __PPU__
+	sysThreadJoin(p->thread, &retval);
+#else
+	pthread_join(p->thread, NULL);
+#endif
+	ppuprof_state = NULL;
+	free(p->buffer);
+	free(p->history);
+	free(p);
+	return PPUPROF_OK;
+}
+
+void ppuProfGetStats(ppuProfStats *stats)
+{
+	if (ppuprof_state)
+		*stats = ppuprof_state->stats;
+	else
+		memset(stats, 0, sizeof(*stats));
+}
+
+int ppuProfSinkTty(void *arg, const void *data, uint32_t size)
+{
+	static const char hex[] = "0123456789abcdef";
+	const uint8_t *b = (const uint8_t *) data;
+	char line[6 + 2 * 48 + 1];
+	uint32_t i, n, len;
+
+	while (size) {
+		n = size > 48 ? 48 : size;
+		memcpy(line, "PPROF ", 6);
+		for (i = 0; i < n; i++) {
+			line[6 + 2 * i] = hex[b[i] >> 4];
+			line[7 + 2 * i] = hex[b[i] & 15];
+		}
+		line[6 + 2 * n] = '\n';
+		len = 7 + 2 * n;
+#ifdef __PPU__
+		{
+			u32 written;
+
+			if (sysTtyWrite((s32) (intptr_t) arg, line, len, &written) || written != len)
+				return PPUPROF_EIO;
+		}
+#else
+		if (write(arg ? (int) (intptr_t) arg : 2, line, len) != (ssize_t) len)
+			return PPUPROF_EIO;
+#endif
+		b += n;
+		size -= n;
+	}
+	return PPUPROF_OK;
+}
+
+int ppuProfSinkSocket(void *arg, const void *data, uint32_t size)
+{
+	const uint8_t *b = (const uint8_t *) data;
+	ssize_t n;
+
+	while (size) {
+		n = send((int) (intptr_t) arg, b, size, 0);
+		if (n <= 0)
+			return PPUPROF_EIO;
+		b += n;
+		size -= (uint32_t) n;
+	}
+	return PPUPROF_OK;
+}
+
+int ppuProfConnect(const char *ip, uint16_t port)
+{
+	struct sockaddr_in addr;
+	int s;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if (!inet_aton(ip, &addr.sin_addr))
+		return PPUPROF_EINVAL;
+	s = socket(AF_INET, SOCK_STREAM, 0);
+	if (s < 0)
+		return PPUPROF_EIO;
+	if (connect(s, (struct sockaddr *) &addr, sizeof(addr))) {
+		close(s);
+		return PPUPROF_EIO;
+	}
+	return s;
+}
+
+#endif /* PPUPROF_IMPLEMENTATION */
+
+#endif /* __PPUPROF_H__ */
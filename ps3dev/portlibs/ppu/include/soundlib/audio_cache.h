@@ -0,0 +1,866 @@
+/*
+    Copyright (C) 1985, 2010  Francisco Mu�oz "Hermes" <www.elotrolado.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+    Decoded PCM cache and memory decoding for OGG/MP3.
+
+    - DecodeAudioMem() decodes an OGG/MP3 file that is already in memory (loaded, memory
+      mapped or embedded with bin2o). The decoders read straight from that buffer through
+      ov_open_callbacks() / mpg123_replace_reader(), there is no mem_open() copy and the
+      background player (PlayAudio) is not stopped.
+
+    - AudioCache keeps decoded clips by asset id under a byte budget (LRU). Clips in use
+      (AudioCacheGet() without AudioCacheRelease()) are never evicted.
+
+    - AudioDecodeAhead decodes a long track on its own thread into a bounded ring, the
+      player only copies samples out of it.
+
+    Building: #define AUDIO_CACHE_IMPLEMENTATION in one source file before the include and
+    link with -lvorbisfile -lvorbis -logg -lmpg123.
+*/
+
+#ifndef __AUDIO_CACHE_H__
+#define __AUDIO_CACHE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include "audio_stream.h"	// AST_Time(), AST_Barrier()
+
+#ifdef __PPU__
+#include <sys/thread.h>
+#include <sys/systime.h>
+#include <lv2/mutex.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AUDIO_CACHE_BUCKETS   256
+#define AUDIO_MEM_FILES       16	// memory files open at the same time by the MP3 decoder
+
+#define AUDIO_FORMAT_UNKNOWN  0
+#define AUDIO_FORMAT_OGG      1
+#define AUDIO_FORMAT_MP3      2
+
+typedef struct {
+	short *samples;		// 16 bit signed, L/R interleaved if is_stereo
+	int size;			// bytes
+	int freq;
+	int is_stereo;
+} AudioPCM;
+
+/* decoder reading from memory, used by the cache and by the decode ahead thread */
+
+typedef struct {
+	int format;
+	const unsigned char *data;
+	long size, pos;
+	void *handle;		// OggVorbis_File * or mpg123_handle *
+	int fd;
+	int freq, is_stereo;
+} AudioMemDecoder;
+
+typedef struct AudioCacheEntry {
+	uint32_t id;
+	AudioPCM pcm;
+	int refs;
+	struct AudioCacheEntry *hnext;
+	struct AudioCacheEntry *prev, *next;	// LRU, head = most recent
+} AudioCacheEntry;
+
+typedef struct {
+	uint32_t hits, misses, evictions, failed;
+	uint32_t entries;
+	uint32_t bytes;
+	uint64_t decode_us;		// total time spent decoding misses
+	uint32_t decode_max_us;
+} AudioCacheStats;
+
+typedef struct {
+	AudioCacheEntry *hash[AUDIO_CACHE_BUCKETS];
+	AudioCacheEntry *head, *tail;
+	uint32_t budget;
+	AudioCacheStats stats;
+#ifdef __PPU__
+	sys_lwmutex_t lock;
+#else
+	pthread_mutex_t lock;
+#endif
+} AudioCache;
+
+typedef struct {
+	AudioMemDecoder dec;
+	short *ring;
+	short *chunk;			// AUDIO_AHEAD_CHUNK samples, one decode call, kept off the thread stack
+	uint32_t frames;		// power of 2
+	volatile uint32_t head, tail;
+	int channels;
+	int loop;
+	volatile int eof;
+	volatile int running;
+	uint32_t underruns;		// AudioDecodeAheadRead() calls that got less than asked
+	uint64_t decode_us;
+#ifdef __PPU__
+	sys_ppu_thread_t thread;
+#else
+	pthread_t thread;
+#endif
+} AudioDecodeAhead;
+
+/*------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+/* int DecodeAudioMem(const void *audiofile, int size, AudioPCM *pcm);
+
+Decode in memory an Audio file (MP3 or OGG) without copying it and without stopping the player.
+
+-- Params ---
+
+audiofile: pointer with the OGG/MP3 file (it can be a bin2o symbol)
+
+size: size in bytes of the OGG/MP3 file
+
+pcm: receives the samples (allocated with malloc, free them with FreeAudioPCM()), the frequency and the channels
+
+return: 0- Ok, -1 Error
+
+*/
+
+int DecodeAudioMem(const void *audiofile, int size, AudioPCM * pcm);
+void FreeAudioPCM(AudioPCM * pcm);
+
+int AudioMemOpen(AudioMemDecoder * dec, const void *audiofile, int size);
+int AudioMemRead(AudioMemDecoder * dec, short *samples, int bytes);	// bytes decoded, 0 = end, -1 = error
+int AudioMemRewind(AudioMemDecoder * dec);
+void AudioMemClose(AudioMemDecoder * dec);
+
+/*------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+/* void AudioCacheInit(AudioCache *cache, uint32_t budget);
+
+budget: bytes of decoded samples the cache can keep
+
+*/
+
+void AudioCacheInit(AudioCache * cache, uint32_t budget);
+void AudioCacheEnd(AudioCache * cache);
+
+/* const AudioPCM *AudioCacheGet(AudioCache *cache, uint32_t id, const void *audiofile, int size);
+
+Returns the decoded clip 'id', decoding 'audiofile' on a miss. The clip stays valid until AudioCacheRelease().
+
+Usage:
+
+	const AudioPCM *pcm = AudioCacheGet(&cache, SFX_JUMP, jump_ogg, jump_ogg_size);
+	SND_SetVoice(voice, pcm->is_stereo ? VOICE_STEREO_16BIT : VOICE_MONO_16BIT, pcm->freq, 0, pcm->samples, pcm->size, 255, 255, NULL);
+	...
+	AudioCacheRelease(&cache, pcm);  // when the voice has finished
+
+return: the clip or NULL if it can not be decoded
+
+*/
+
+const AudioPCM *AudioCacheGet(AudioCache * cache, uint32_t id, const void *audiofile, int size);
+void AudioCacheRelease(AudioCache * cache, const AudioPCM * pcm);
+void AudioCacheGetStats(AudioCache * cache, AudioCacheStats * stats);
+
+static inline float AudioCacheHitRate(const AudioCacheStats * stats)
+{
+	uint32_t total = stats->hits + stats->misses;
+	return total ? (float) stats->hits / (float) total : 0.0f;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+/* int AudioDecodeAheadOpen(AudioDecodeAhead *s, const void *audiofile, int size, uint32_t ring_frames, int loop);
+
+Starts a thread that decodes 'audiofile' into a ring of 'ring_frames' frames, staying as far ahead of the reader as the ring allows.
+
+loop: 1-> restart from the beginning at the end of the file
+
+return: 0- Ok, -1 Error
+
+*/
+
+int AudioDecodeAheadOpen(AudioDecodeAhead * s, const void *audiofile, int size, uint32_t ring_frames, int loop);
+
+/* frames copied in 'samples' (interleaved if stereo); less than 'frames' on an under-run or at the end */
+
+uint32_t AudioDecodeAheadRead(AudioDecodeAhead * s, short *samples, uint32_t frames);
+
+/* 1 when the file ended and the ring is empty */
+
+static inline int AudioDecodeAheadEOF(const AudioDecodeAhead * s)
+{
+	return s->eof && s->head == s->tail;
+}
+
+void AudioDecodeAheadClose(AudioDecodeAhead * s);
+
+#ifdef AUDIO_CACHE_IMPLEMENTATION
+
+#include <vorbis/vorbisfile.h>
+#include "mpg123.h"
+
+#if defined(__BIG_ENDIAN__) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define AUDIO_BIG_ENDIAN 1
+#else
+#define AUDIO_BIG_ENDIAN 0
+#endif
+
+static AudioMemDecoder *audio_mem_files[AUDIO_MEM_FILES];
+static int audio_mpg123_ready;
+
+#ifdef __PPU__
+static sys_lwmutex_t audio_mem_lock;
+static volatile int audio_mem_lock_state;	// 0: none, 1: being created, 2: ready
+
+/* creates the lock once, whichever of AudioCacheInit() or AudioMemOpen() comes first, from any thread */
+
+static void audio_mem_lock_init()
+{
+	if (audio_mem_lock_state == 2)
+		return;
+	if (__sync_bool_compare_and_swap(&audio_mem_lock_state, 0, 1)) {
+		sys_lwmutex_attr_t attr = { SYS_LWMUTEX_PROTOCOL_PRIO, SYS_LWMUTEX_ATTR_NOT_RECURSIVE, "audmem" };
+		sysLwMutexCreate(&audio_mem_lock, &attr);
+		__sync_synchronize();
+		audio_mem_lock_state = 2;
+		return;
+	}
+	while (audio_mem_lock_state != 2)
+		sysThreadYield();
+}
+
+static void audio_mem_files_lock(int lock)
+{
+	audio_mem_lock_init();
+	if (lock)
+		sysLwMutexLock(&audio_mem_lock, 0);
+	else
+		sysLwMutexUnlock(&audio_mem_lock);
+}
+#else
+static pthread_mutex_t audio_mem_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void audio_mem_files_lock(int lock)
+{
+	if (lock)
+		pthread_mutex_lock(&audio_mem_lock);
+	else
+		pthread_mutex_unlock(&audio_mem_lock);
+}
+#endif
+
+/* ogg callbacks, the datasource is the decoder */
+
+static size_t audio_ogg_read(void *ptr, size_t size, size_t nmemb, void *src)
+{
+	AudioMemDecoder *d = (AudioMemDecoder *) src;
+	size_t n = size * nmemb;
+
+	if (n > (size_t) (d->size - d->pos))
+		n = d->size - d->pos;
+	memcpy(ptr, d->data + d->pos, n);
+	d->pos += n;
+	return size ? n / size : 0;
+}
+
+static int audio_ogg_seek(void *src, ogg_int64_t offset, int whence)
+{
+	AudioMemDecoder *d = (AudioMemDecoder *) src;
+	ogg_int64_t pos = whence == SEEK_SET ? offset : (whence == SEEK_CUR ? d->pos + offset : d->size + offset);
+
+	if (pos < 0 || pos > d->size)
+		return -1;
+	d->pos = (long) pos;
+	return 0;
+}
+
+static int audio_ogg_close(void *src)
+{
+	(void) src;
+	return 0;
+}
+
+static long audio_ogg_tell(void *src)
+{
+	return ((AudioMemDecoder *) src)->pos;
+}
+
+/* mpg123 reader, 'fd' is an index in audio_mem_files */
+
+static ssize_t audio_mp3_read(int fd, void *buf, size_t count)
+{
+	AudioMemDecoder *d = audio_mem_files[fd];
+
+	if (count > (size_t) (d->size - d->pos))
+		count = d->size - d->pos;
+	memcpy(buf, d->data + d->pos, count);
+	d->pos += count;
+	return count;
+}
+
+static off_t audio_mp3_lseek(int fd, off_t offset, int whence)
+{
+	AudioMemDecoder *d = audio_mem_files[fd];
+	off_t pos = whence == SEEK_SET ? offset : (whence == SEEK_CUR ? d->pos + offset : d->size + offset);
+
+	if (pos < 0 || pos > d->size)
+		return -1;
+	d->pos = (long) pos;
+	return pos;
+}
+
+static int audio_detect(const unsigned char *p, int size)
+{
+	if (size >= 4 && !memcmp(p, "OggS", 4))
+		return AUDIO_FORMAT_OGG;
+	if (size >= 3 && !memcmp(p, "ID3", 3))
+		return AUDIO_FORMAT_MP3;
+	if (size >= 2 && p[0] == 0xff && (p[1] & 0xe0) == 0xe0)
+		return AUDIO_FORMAT_MP3;
+	return AUDIO_FORMAT_UNKNOWN;
+}
+
+int AudioMemOpen(AudioMemDecoder * dec, const void *audiofile, int size)
+{
+	memset(dec, 0, sizeof(*dec));
+	dec->data = (const unsigned char *) audiofile;
+	dec->size = size;
+	dec->fd = -1;
+	dec->format = audio_detect(dec->data, size);
+
+	if (dec->format == AUDIO_FORMAT_OGG) {
+		ov_callbacks cb = { audio_ogg_read, audio_ogg_seek, audio_ogg_close, audio_ogg_tell };
+		OggVorbis_File *vf = (OggVorbis_File *) malloc(sizeof(OggVorbis_File));
+		vorbis_info *vi;
+
+		if (!vf)
+			return -1;
+		if (ov_open_callbacks(dec, vf, NULL, 0, cb) < 0) {
+			free(vf);
+			return -1;
+		}
+		vi = ov_info(vf, -1);
+		dec->freq = vi->rate;
+		dec->is_stereo = vi->channels == 2;
+		if (vi->channels > 2) {
+			ov_clear(vf);
+			free(vf);
+			return -1;
+		}
+		dec->handle = vf;
+		return 0;
+	}
+
+	if (dec->format == AUDIO_FORMAT_MP3) {
+		mpg123_handle *mh;
+		const long *rates;
+		size_t nrates;
+		long rate;
+		int n, channels, encoding;
+
+		audio_mem_files_lock(1);
+		if (!audio_mpg123_ready)
+			audio_mpg123_ready = mpg123_init() == MPG123_OK;
+		for (n = 0; n < AUDIO_MEM_FILES; n++)
+			if (!audio_mem_files[n]) {
+				audio_mem_files[n] = dec;
+				dec->fd = n;
+				break;
+			}
+		audio_mem_files_lock(0);
+		if (dec->fd < 0)
+			return -1;
+
+		mh = mpg123_new(NULL, NULL);
+		if (!mh)
+			goto mp3_fail;
+		dec->handle = mh;
+		// 16 bit signed at every rate, the samples go to SND_SetVoice() as they are
+		mpg123_format_none(mh);
+		mpg123_rates(&rates, &nrates);
+		for (n = 0; n < (int) nrates; n++)
+			mpg123_format(mh, rates[n], MPG123_MONO | MPG123_STEREO, MPG123_ENC_SIGNED_16);
+		if (mpg123_replace_reader(mh, audio_mp3_read, audio_mp3_lseek) != MPG123_OK ||
+		    mpg123_open_fd(mh, dec->fd) != MPG123_OK ||
+		    mpg123_getformat(mh, &rate, &channels, &encoding) != MPG123_OK)
+			goto mp3_fail;
+		dec->freq = rate;
+		dec->is_stereo = channels == 2;
+		return 0;
+
+	  mp3_fail:
+		AudioMemClose(dec);
+		return -1;
+	}
+	return -1;
+}
+
+int AudioMemRead(AudioMemDecoder * dec, short *samples, int bytes)
+{
+	if (dec->format == AUDIO_FORMAT_OGG) {
+		int bitstream, done = 0;
+		while (done < bytes) {
+			long n = ov_read((OggVorbis_File *) dec->handle, (char *) samples + done, bytes - done, AUDIO_BIG_ENDIAN, 2, 1, &bitstream);
+			if (n == OV_HOLE)
+				continue;
+			if (n < 0)
+				return done ? done : -1;
+			if (n == 0)
+				break;
+			done += n;
+		}
+		return done;
+	}
+	if (dec->format == AUDIO_FORMAT_MP3) {
+		size_t n = 0;
+		int r = mpg123_read((mpg123_handle *) dec->handle, (unsigned char *) samples, bytes, &n);
+		if (r == MPG123_NEW_FORMAT && n == 0)
+			r = mpg123_read((mpg123_handle *) dec->handle, (unsigned char *) samples, bytes, &n);
+		if (r != MPG123_OK && r != MPG123_DONE && r != MPG123_NEW_FORMAT && n == 0)
+			return -1;
+		return (int) n;
+	}
+	return -1;
+}
+
+int AudioMemRewind(AudioMemDecoder * dec)
+{
+	if (dec->format == AUDIO_FORMAT_OGG)
+		return ov_raw_seek((OggVorbis_File *) dec->handle, 0) ? -1 : 0;
+	if (dec->format == AUDIO_FORMAT_MP3)
+		return mpg123_seek((mpg123_handle *) dec->handle, 0, SEEK_SET) < 0 ? -1 : 0;
+	return -1;
+}
+
+void AudioMemClose(AudioMemDecoder * dec)
+{
+	if (dec->format == AUDIO_FORMAT_OGG && dec->handle) {
+		ov_clear((OggVorbis_File *) dec->handle);
+		free(dec->handle);
+	}
+	if (dec->format == AUDIO_FORMAT_MP3) {
+		if (dec->handle) {
+			mpg123_close((mpg123_handle *) dec->handle);
+			mpg123_delete((mpg123_handle *) dec->handle);
+		}
+		if (dec->fd >= 0) {
+			audio_mem_files_lock(1);
+			audio_mem_files[dec->fd] = NULL;
+			audio_mem_files_lock(0);
+		}
+	}
+	dec->handle = NULL;
+	dec->fd = -1;
+}
+
+int DecodeAudioMem(const void *audiofile, int size, AudioPCM * pcm)
+{
+	AudioMemDecoder dec;
+	int cap = 0, n;
+
+	memset(pcm, 0, sizeof(*pcm));
+	if (AudioMemOpen(&dec, audiofile, size))
+		return -1;
+	pcm->freq = dec.freq;
+	pcm->is_stereo = dec.is_stereo;
+
+	// first guess: 10 times the compressed size, then doubles
+	cap = size * 10 < 65536 ? 65536 : size * 10;
+	for (;;) {
+		if (!pcm->samples || cap - pcm->size < 16384) {
+			short *p;
+			if (pcm->samples)
+				cap *= 2;
+			p = (short *) realloc(pcm->samples, cap);
+			if (!p)
+				goto fail;
+			pcm->samples = p;
+		}
+		n = AudioMemRead(&dec, (short *) ((char *) pcm->samples + pcm->size), (cap - pcm->size) & ~3);
+		if (n < 0)
+			goto fail;
+		if (n == 0)
+			break;
+		pcm->size += n;
+	}
+	AudioMemClose(&dec);
+	if (pcm->size == 0)
+		goto fail_closed;
+	{
+		// shrink to fit; on failure the larger block is still valid
+		short *p = (short *) realloc(pcm->samples, pcm->size);
+		if (p)
+			pcm->samples = p;
+	}
+	return 0;
+
+  fail:
+	AudioMemClose(&dec);
+  fail_closed:
+	FreeAudioPCM(pcm);
+	return -1;
+}
+
+void FreeAudioPCM(AudioPCM * pcm)
+{
+	free(pcm->samples);
+	memset(pcm, 0, sizeof(*pcm));
+}
+
+/* cache */
+
+static void audio_cache_lock(AudioCache * cache, int lock)
+{
+#ifdef __PPU__
+	if (lock)
+		sysLwMutexLock(&cache->lock, 0);
+	else
+		sysLwMutexUnlock(&cache->lock);
+#else
+	if (lock)
+		pthread_mutex_lock(&cache->lock);
+	else
+		pthread_mutex_unlock(&cache->lock);
+#endif
+}
+
+static void audio_cache_unlink(AudioCache * cache, AudioCacheEntry * e)
+{
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		cache->head = e->next;
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		cache->tail = e->prev;
+	e->prev = e->next = NULL;
+}
+
+static void audio_cache_push(AudioCache * cache, AudioCacheEntry * e)
+{
+	e->prev = NULL;
+	e->next = cache->head;
+	if (cache->head)
+		cache->head->prev = e;
+	cache->head = e;
+	if (!cache->tail)
+		cache->tail = e;
+}
+
+static void audio_cache_remove(AudioCache * cache, AudioCacheEntry * e)
+{
+	AudioCacheEntry **p = &cache->hash[e->id % AUDIO_CACHE_BUCKETS];
+
+	while (*p != e)
+		p = &(*p)->hnext;
+	*p = e->hnext;
+	audio_cache_unlink(cache, e);
+	cache->stats.bytes -= e->pcm.size;
+	cache->stats.entries--;
+	FreeAudioPCM(&e->pcm);
+	free(e);
+}
+
+/* evicts the least recently used clips nobody is playing */
+
+static void audio_cache_trim(AudioCache * cache)
+{
+	AudioCacheEntry *e = cache->tail;
+
+	while (e && cache->stats.bytes > cache->budget) {
+		AudioCacheEntry *prev = e->prev;
+		if (e->refs == 0) {
+			audio_cache_remove(cache, e);
+			cache->stats.evictions++;
+		}
+		e = prev;
+	}
+}
+
+void AudioCacheInit(AudioCache * cache, uint32_t budget)
+{
+	memset(cache, 0, sizeof(*cache));
+	cache->budget = budget;
+#ifdef __PPU__
+	audio_mem_lock_init();
+	{
+		sys_lwmutex_attr_t attr = { SYS_LWMUTEX_PROTOCOL_PRIO, SYS_LWMUTEX_ATTR_NOT_RECURSIVE, "audcach" };
+		sysLwMutexCreate(&cache->lock, &attr);
+	}
+#else
+	pthread_mutex_init(&cache->lock, NULL);
+#endif
+}
+
+void AudioCacheEnd(AudioCache * cache)
+{
+	while (cache->head)
+		audio_cache_remove(cache, cache->head);
+#ifdef __PPU__
+	sysLwMutexDestroy(&cache->lock);
+#else
+	pthread_mutex_destroy(&cache->lock);
+#endif
+}
+
+const AudioPCM *AudioCacheGet(AudioCache * cache, uint32_t id, const void *audiofile, int size)
+{
+	AudioCacheEntry *e, *other;
+	uint64_t t;
+	uint32_t us;
+
+	audio_cache_lock(cache, 1);
+	for (e = cache->hash[id % AUDIO_CACHE_BUCKETS]; e; e = e->hnext)
+		if (e->id == id) {
+			e->refs++;
+			audio_cache_unlink(cache, e);
+			audio_cache_push(cache, e);
+			cache->stats.hits++;
+			audio_cache_lock(cache, 0);
+			return &e->pcm;
+		}
+	cache->stats.misses++;
+	audio_cache_lock(cache, 0);
+
+	// decode without the lock, other threads keep hitting the cache
+	e = (AudioCacheEntry *) calloc(1, sizeof(AudioCacheEntry));
+	if (!e)
+		return NULL;
+	t = AST_Time();
+	if (DecodeAudioMem(audiofile, size, &e->pcm)) {
+		free(e);
+		audio_cache_lock(cache, 1);
+		cache->stats.failed++;
+		audio_cache_lock(cache, 0);
+		return NULL;
+	}
+	us = (uint32_t) (AST_Time() - t);
+	e->id = id;
+	e->refs = 1;
+
+	audio_cache_lock(cache, 1);
+	cache->stats.decode_us += us;
+	if (us > cache->stats.decode_max_us)
+		cache->stats.decode_max_us = us;
+	// another thread may have decoded the same clip meanwhile
+	for (other = cache->hash[id % AUDIO_CACHE_BUCKETS]; other; other = other->hnext)
+		if (other->id == id) {
+			other->refs++;
+			audio_cache_lock(cache, 0);
+			FreeAudioPCM(&e->pcm);
+			free(e);
+			return &other->pcm;
+		}
+	e->hnext = cache->hash[id % AUDIO_CACHE_BUCKETS];
+	cache->hash[id % AUDIO_CACHE_BUCKETS] = e;
+	audio_cache_push(cache, e);
+	cache->stats.bytes += e->pcm.size;
+	cache->stats.entries++;
+	audio_cache_trim(cache);
+	audio_cache_lock(cache, 0);
+	return &e->pcm;
+}
+
+void AudioCacheRelease(AudioCache * cache, const AudioPCM * pcm)
+{
+	AudioCacheEntry *e;
+
+	if (!pcm)
+		return;
+	e = (AudioCacheEntry *) ((char *) pcm - offsetof(AudioCacheEntry, pcm));
+	audio_cache_lock(cache, 1);
+	if (e->refs > 0)
+		e->refs--;
+	audio_cache_trim(cache);
+	audio_cache_lock(cache, 0);
+}
+
+void AudioCacheGetStats(AudioCache * cache, AudioCacheStats * stats)
+{
+	audio_cache_lock(cache, 1);
+	*stats = cache->stats;
+	audio_cache_lock(cache, 0);
+}
+
+/* decode ahead */
+
+#define AUDIO_AHEAD_CHUNK 4096
+
+#ifdef __PPU__
+static void audio_ahead_thread(void *arg)
+#else
+static void *audio_ahead_thread(void *arg)
+#endif
+{
+	AudioDecodeAhead *s = (AudioDecodeAhead *) arg;
+	short *chunk = s->chunk;
+	int chunk_frames = 0, chunk_pos = 0;
+
+	while (s->running) {
+		uint32_t space = s->frames - (s->head - s->tail), n, pos;
+
+		if (chunk_pos == chunk_frames) {
+			uint64_t t;
+			int bytes;
+
+			if (space < 1024) {
+#ifdef __PPU__
+				sysUsleep(2000);
+#else
+				usleep(2000);
+#endif
+				continue;
+			}
+			t = AST_Time();
+			bytes = AudioMemRead(&s->dec, chunk, AUDIO_AHEAD_CHUNK * sizeof(short));
+			s->decode_us += AST_Time() - t;
+			if (bytes <= 0) {
+				if (bytes == 0 && s->loop && AudioMemRewind(&s->dec) == 0)
+					continue;
+				s->eof = 1;
+				break;
+			}
+			chunk_frames = bytes / (2 * s->channels);
+			chunk_pos = 0;
+		}
+
+		n = chunk_frames - chunk_pos;
+		if (n > space)
+			n = space;
+		for (pos = 0; pos < n; pos++) {
+			uint32_t at = ((s->head + pos) & (s->frames - 1)) * s->channels;
+			s->ring[at] = chunk[(chunk_pos + pos) * s->channels];
+			if (s->channels == 2)
+				s->ring[at + 1] = chunk[(chunk_pos + pos) * 2 + 1];
+		}
+		chunk_pos += n;
+		AST_Barrier();
+		s->head += n;
+		if (n == 0) {
+#ifdef __PPU__
+			sysUsleep(2000);
+#else
+			usleep(2000);
+#endif
+		}
+	}
+#ifdef __PPU__
+	sysThreadExit(0);
+#else
+	return NULL;
+#endif
+}
+
+int AudioDecodeAheadOpen(AudioDecodeAhead * s, const void *audiofile, int size, uint32_t ring_frames, int loop)
+{
+	uint32_t frames = 4096;
+
+	memset(s, 0, sizeof(*s));
+	while (frames < ring_frames)
+		frames <<= 1;
+	if (AudioMemOpen(&s->dec, audiofile, size))
+		return -1;
+	s->channels = s->dec.is_stereo ? 2 : 1;
+	s->frames = frames;
+	s->loop = loop;
+	s->ring = (short *) malloc(frames * s->channels * sizeof(short));
+	s->chunk = (short *) malloc(AUDIO_AHEAD_CHUNK * sizeof(short));
+	if (!s->ring || !s->chunk) {
+		free(s->ring);
+		free(s->chunk);
+		s->ring = NULL;
+		AudioMemClose(&s->dec);
+		return -1;
+	}
+	s->running = 1;
+#ifdef __PPU__
+	if (sysThreadCreate(&s->thread, audio_ahead_thread, s, 1000, 0x8000, THREAD_JOINABLE, (char *) "Audio Decode Ahead"))
+#else
+	if (pthread_create(&s->thread, NULL, audio_ahead_thread, s))
+#endif
+	{
+		s->running = 0;
+		free(s->ring);
+		free(s->chunk);
+		s->ring = NULL;
+		AudioMemClose(&s->dec);
+		return -1;
+	}
+	return 0;
+}
+
+uint32_t AudioDecodeAheadRead(AudioDecodeAhead * s, short *samples, uint32_t frames)
+{
+	uint32_t avail = s->head - s->tail, n;
+
+	AST_Barrier();
+	if (frames > avail) {
+		if (!s->eof)
+			s->underruns++;
+		frames = avail;
+	}
+	for (n = 0; n < frames;) {
+		uint32_t pos = (s->tail + n) & (s->frames - 1);
+		uint32_t run = s->frames - pos;
+		if (run > frames - n)
+			run = frames - n;
+		memcpy(samples + n * s->channels, s->ring + pos * s->channels, run * s->channels * sizeof(short));
+		n += run;
+	}
+	AST_Barrier();
+	s->tail += frames;
+	return frames;
+}
+
+void AudioDecodeAheadClose(AudioDecodeAhead * s)
+{
+	if (!s->ring)
+		return;
+	s->running = 0;
+#ifdef __PPU__
+	{
+		u64 ret;
+		sysThreadJoin(s->thread, &ret);
+	}
+#else
+	pthread_join(s->thread, NULL);
+#endif
+	AudioMemClose(&s->dec);
+	free(s->ring);
+	free(s->chunk);
+	s->ring = NULL;
+}
+
+#endif /* AUDIO_CACHE_IMPLEMENTATION */
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif
@@ -0,0 +1,929 @@
+/*
+	mpg123_spu: SPU back end for the layer III synthesis stages
+
+	copyright 2010 by the mpg123 project - free software under the terms of the LGPL 2.1
+	see COPYING and AUTHORS files in distribution or http://mpg123.org
+*/
+
+/** \file mpg123_spu.h
+ *
+ *  Synthesis on an SPU: the polyphase synthesis filterbank of all layers and, for layer III
+ *  granules, dequantisation, alias reduction and IMDCT with overlap-add.
+ *
+ *  There are two ways to feed it.
+ *
+ *  - From libmpg123 (mpg123_spu_attach() + mpg123_spu_decode_frame()): the library still parses
+ *    the frames and runs its layer I/II/III front end on the PPU, but its 16 bit 1:1 synthesis
+ *    calls are taken over. Every call hands over 32 subband samples of one channel; they are
+ *    collected for the whole frame and synthesised on the SPU in one command. libmpg123 is a
+ *    prebuilt archive, so the synthesis functions are replaced at link time:
+ *
+ *        -Wl,--wrap=synth_1to1,--wrap=synth_1to1_mono,--wrap=synth_1to1_mono2stereo
+ *
+ *    Without these flags mpg123_spu_decode_frame() returns the library output unchanged.
+ *    On the SPU the frames are double buffered: the library front end of frame N + 1 runs on
+ *    the PPU while frame N is synthesised, so the PCM comes out one call late and the first
+ *    call parses two frames.
+ *    The output is 16 bit signed at the stream rate; volume, RVA and the equalizer of the
+ *    library are not applied, gapless trimming is turned off by the attach.
+ *  - From a layer III parser of your own (mpg123_spu_submit()): one mpg123_spu_granule per
+ *    granule holds the quantised lines and the gain exponent of every line, already combining
+ *    global gain, subblock gain and scale factors. The SPU streams the granules through local
+ *    store with double buffered DMA and writes interleaved 16 bit PCM.
+ *
+ *  A command completes with an SPU thread user event on a private event queue, so
+ *  mpg123_spu_wait() sleeps in the kernel instead of polling; mpg123_spu_poll() checks without
+ *  blocking, which lets the PPU parse the next frame while the SPU is busy.
+ *
+ *  The synthesis window is the D[] table of ISO/IEC 11172-3, built from the same 257
+ *  coefficients libmpg123 uses. The kernels build on the host (and on the PPU) without SPU
+ *  intrinsics, so the output can be checked against a double precision reference.
+ *
+ *  - SPU program:  #include <soundlib/mpg123_spu.h>
+ *                  int main(uint64_t ctx) { return mpg123_spu_main(ctx); }
+ *  - PPU / host:   #define MPG123_SPU_IMPLEMENTATION in one source file.
+ */
+
+#ifndef MPG123_SPU_H
+#define MPG123_SPU_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef __SPU__
+#include <spu_intrinsics.h>
+#include <spu_mfcio.h>
+#include <sys/spu_thread.h>
+#include <sys/spu_event.h>
+#else
+#include <stdlib.h>
+#include "mpg123.h"
+#ifdef __PPU__
+#include <ppu-types.h>
+#include <malloc.h>
+#include <sys/spu.h>
+#include <sys/event_queue.h>
+#include <lv2/spu.h>
+#endif
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Name of the back end, the same string mpg123_spu_new() accepts. */
+#define MPG123_SPU_DECODER   "SPU"
+
+#define MPG123_SPU_LINES     576
+#define MPG123_SPU_SBLIMIT   32
+#define MPG123_SPU_SSLIMIT   18
+#define MPG123_SPU_SLOTS     36		/**< subband slots of the longest frame (1152 samples) */
+#define MPG123_SPU_POW43     8207		/**< largest quantised magnitude + 1 */
+#define MPG123_SPU_PORT      16		/**< SPU event port of the completion event */
+#define MPG123_SPU_HOOKS     8		/**< libmpg123 handles attached at the same time */
+
+/** Block types of the layer III side info. */
+enum mpg123_spu_block
+{
+	MPG123_SPU_BLOCK_NORMAL = 0,
+	MPG123_SPU_BLOCK_START  = 1,
+	MPG123_SPU_BLOCK_SHORT  = 2,
+	MPG123_SPU_BLOCK_STOP   = 3
+};
+
+/** Flags of a granule. */
+enum mpg123_spu_flags
+{
+	MPG123_SPU_MS_STEREO = 0x1,	/**< channel 0 is mid, channel 1 is side */
+	MPG123_SPU_MIXED     = 0x2,	/**< mixed block: the first 2 subbands are long */
+	MPG123_SPU_XR        = 0x4	/**< lines are already dequantised (xr), e.g. after intensity stereo */
+};
+
+/** One granule of one frame, filled by the parser. 128 byte aligned for DMA. */
+typedef struct
+{
+	union
+	{
+		int16_t is[2][MPG123_SPU_LINES];	/**< quantised lines, sign included */
+		float xr[2][MPG123_SPU_LINES];	/**< dequantised lines with MPG123_SPU_XR */
+	} l;
+	int8_t gain[2][MPG123_SPU_LINES];	/**< line gain exponent: xr = is^4/3 * 2^(gain/4) */
+	uint8_t block_type[2];
+	uint8_t flags;
+	uint8_t channels;
+	uint32_t pad[31];
+} __attribute__((aligned(128))) mpg123_spu_granule;
+
+/** Subband samples of one frame as the libmpg123 front end produced them: [slot][channel][subband]. */
+typedef float mpg123_spu_subbands[MPG123_SPU_SLOTS][2][MPG123_SPU_SBLIMIT];
+
+/** Per channel decoder state that lives between granules. */
+typedef struct
+{
+	float overlap[MPG123_SPU_SBLIMIT][MPG123_SPU_SSLIMIT];
+	float v[1024];		/**< synthesis FIFO */
+	uint32_t v_off;
+	uint32_t pad[31];
+} __attribute__((aligned(128))) mpg123_spu_channel;
+
+/** Command block, one per SPU. */
+typedef struct
+{
+	uint64_t input;		/**< ea of mpg123_spu_granule[count] (RUN) or of mpg123_spu_subbands (SYNTH) */
+	uint64_t pcm;		/**< ea of the interleaved output */
+	uint64_t state;		/**< ea of mpg123_spu_channel[2] */
+	uint64_t window;	/**< ea of float[512], the synthesis window D[] */
+	uint32_t count;		/**< granules, or subband slots */
+	uint32_t channels;	/**< output channels */
+	uint32_t seq;
+	volatile uint32_t done;	/**< = seq when the batch is written */
+	uint32_t ticks;		/**< decrementer ticks of the last batch */
+	uint32_t cmd;
+	uint32_t flags;
+	uint32_t pad[17];
+} __attribute__((aligned(128))) mpg123_spu_command;
+
+#define MPG123_SPU_CMD_RUN    1
+#define MPG123_SPU_CMD_QUIT   2
+#define MPG123_SPU_CMD_SYNTH  3
+
+#define MPG123_SPU_CMD_DUP    0x1	/**< SYNTH: one synthesised channel written to both outputs */
+
+/** Tables built once (mpg123_spu_tables_init()), uploaded to the SPU after the command block. */
+typedef struct
+{
+	float n[64][32];		/**< matrixing, cos((16 + i)(2k + 1)pi/64) */
+	float cos36[18][36];
+	float cos12[6][12];
+	float imdct_long[4][36];	/**< window for block types 0, 1, 3 (2 unused) */
+	float win_short[12];
+	float cs[8], ca[8];		/**< alias reduction butterflies */
+	float gain[256];		/**< 2^((i - 128) / 4) */
+	float pow43[(MPG123_SPU_POW43 + 3) & ~3];
+} __attribute__((aligned(16))) mpg123_spu_tables;
+
+static const float mpg123_spu_ci[8] = { -0.6f, -0.535f, -0.33f, -0.185f, -0.095f, -0.041f, -0.0142f, -0.0037f };
+
+/** First half of the synthesis window in 1/65536, the intwinbase table of libmpg123. */
+static const int32_t mpg123_spu_winbase[257] =
+{
+	0, -1, -1, -1, -1, -1, -1, -2, -2, -2, -2, -3,
+	-3, -4, -4, -5, -5, -6, -7, -7, -8, -9, -10, -11,
+	-13, -14, -16, -17, -19, -21, -24, -26, -29, -31, -35, -38,
+	-41, -45, -49, -53, -58, -63, -68, -73, -79, -85, -91, -97,
+	-104, -111, -117, -125, -132, -139, -147, -154, -161, -169, -176, -183,
+	-190, -196, -202, -208, -213, -218, -222, -225, -227, -228, -228, -227,
+	-224, -221, -215, -208, -200, -189, -177, -163, -146, -127, -106, -83,
+	-57, -29, 2, 36, 72, 111, 153, 197, 244, 294, 347, 401,
+	459, 519, 581, 645, 711, 779, 848, 919, 991, 1064, 1137, 1210,
+	1283, 1356, 1428, 1498, 1567, 1634, 1698, 1759, 1817, 1870, 1919, 1962,
+	2001, 2032, 2057, 2075, 2085, 2087, 2080, 2063, 2037, 2000, 1952, 1893,
+	1822, 1739, 1644, 1535, 1414, 1280, 1131, 970, 794, 605, 402, 185,
+	-45, -288, -545, -814, -1095, -1388, -1692, -2006, -2330, -2663, -3004, -3351,
+	-3705, -4063, -4425, -4788, -5153, -5517, -5879, -6237, -6589, -6935, -7271, -7597,
+	-7910, -8209, -8491, -8755, -8998, -9219, -9416, -9585, -9727, -9838, -9916, -9959,
+	-9966, -9935, -9863, -9750, -9592, -9389, -9139, -8840, -8492, -8092, -7640, -7134,
+	-6574, -5959, -5288, -4561, -3776, -2935, -2037, -1082, -70, 998, 2122, 3300,
+	4533, 5818, 7154, 8540, 9975, 11455, 12980, 14548, 16155, 17799, 19478, 21189,
+	22929, 24694, 26482, 28289, 30112, 31947, 33791, 35640, 37489, 39336, 41176, 43006,
+	44821, 46617, 48390, 50137, 51853, 53534, 55178, 56778, 58333, 59838, 61289, 62684,
+	64019, 65290, 66494, 67629, 68692, 69679, 70590, 71420, 72169, 72835, 73415, 73908,
+	74313, 74630, 74856, 74992, 75038
+};
+
+/** Fills the tables; plain libm, done on the PPU or host. */
+static inline void mpg123_spu_tables_init(mpg123_spu_tables *t)
+{
+	int i, k, b;
+
+	for(i = 0; i < MPG123_SPU_POW43; i++) t->pow43[i] = (float)pow((double)i, 4.0 / 3.0);
+	for(i = 0; i < 256; i++) t->gain[i] = (float)pow(2.0, (i - 128) / 4.0);
+
+	for(i = 0; i < 18; i++)
+	for(k = 0; k < 36; k++)
+		t->cos36[i][k] = (float)cos(M_PI / 72.0 * (2 * k + 1 + 18) * (2 * i + 1));
+	for(i = 0; i < 6; i++)
+	for(k = 0; k < 12; k++)
+		t->cos12[i][k] = (float)cos(M_PI / 24.0 * (2 * k + 1 + 6) * (2 * i + 1));
+
+	for(b = 0; b < 4; b++)
+	for(k = 0; k < 36; k++)
+	{
+		double w = sin(M_PI / 36.0 * (k + 0.5));
+		if(b == MPG123_SPU_BLOCK_START)
+			w = k < 18 ? w : k < 24 ? 1.0 : k < 30 ? sin(M_PI / 12.0 * (k - 18 + 0.5)) : 0.0;
+		else if(b == MPG123_SPU_BLOCK_STOP)
+			w = k < 6 ? 0.0 : k < 12 ? sin(M_PI / 12.0 * (k - 6 + 0.5)) : k < 18 ? 1.0 : w;
+		t->imdct_long[b][k] = (float)w;
+	}
+	for(k = 0; k < 12; k++) t->win_short[k] = (float)sin(M_PI / 12.0 * (k + 0.5));
+
+	for(i = 0; i < 8; i++)
+	{
+		double sq = sqrt(1.0 + mpg123_spu_ci[i] * mpg123_spu_ci[i]);
+		t->cs[i] = (float)(1.0 / sq);
+		t->ca[i] = (float)(mpg123_spu_ci[i] / sq);
+	}
+	for(i = 0; i < 64; i++)
+	for(k = 0; k < 32; k++)
+		t->n[i][k] = (float)cos((16 + i) * (2 * k + 1) * M_PI / 64.0);
+}
+
+/** The 512 coefficient window D[]: symmetric around 256, the sign flips every 64 taps. */
+static inline void mpg123_spu_window_init(float *d)
+{
+	int i;
+
+	for(i = 0; i < 512; i++)
+	{
+		float v = (float)mpg123_spu_winbase[i <= 256 ? i : 512 - i] / 65536.0f;
+		d[i] = ((i >> 6) & 1) ? -v : v;
+	}
+}
+
+/** 32 term dot product, 4 lanes on SPU / AltiVec. */
+static inline float mpg123_spu_dot32(const float *a, const float *b)
+{
+#if defined(__SPU__)
+	const vec_float4 *va = (const vec_float4 *)a, *vb = (const vec_float4 *)b;
+	vec_float4 s = spu_mul(va[0], vb[0]);
+	int i;
+	for(i = 1; i < 8; i++) s = spu_madd(va[i], vb[i], s);
+	s = spu_add(s, spu_rlqwbyte(s, 8));
+	s = spu_add(s, spu_rlqwbyte(s, 4));
+	return spu_extract(s, 0);
+#else
+	float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+	int i;
+	for(i = 0; i < 32; i += 4)
+	{
+		s0 += a[i] * b[i];
+		s1 += a[i + 1] * b[i + 1];
+		s2 += a[i + 2] * b[i + 2];
+		s3 += a[i + 3] * b[i + 3];
+	}
+	return (s0 + s1) + (s2 + s3);
+#endif
+}
+
+/** Dequantisation, M/S stereo and alias reduction of a granule, in place into xr. */
+static inline void mpg123_spu_dequant(const mpg123_spu_tables *t, const mpg123_spu_granule *g, float xr[2][MPG123_SPU_LINES])
+{
+	int ch, i, sb;
+
+	for(ch = 0; ch < g->channels; ch++)
+	{
+		if(g->flags & MPG123_SPU_XR)
+		{
+			memcpy(xr[ch], g->l.xr[ch], sizeof(xr[ch]));
+			continue;
+		}
+		for(i = 0; i < MPG123_SPU_LINES; i++)
+		{
+			int q = g->l.is[ch][i];
+			int m = q < 0 ? -q : q;
+			float v;
+			if(m >= MPG123_SPU_POW43) m = MPG123_SPU_POW43 - 1;
+			v = t->pow43[m] * t->gain[(uint8_t)(g->gain[ch][i] + 128)];
+			xr[ch][i] = q < 0 ? -v : v;
+		}
+	}
+
+	if((g->flags & MPG123_SPU_MS_STEREO) && g->channels == 2 && !(g->flags & MPG123_SPU_XR))
+		for(i = 0; i < MPG123_SPU_LINES; i++)
+		{
+			float m = xr[0][i], s = xr[1][i];
+			xr[0][i] = (m + s) * (float)M_SQRT1_2;
+			xr[1][i] = (m - s) * (float)M_SQRT1_2;
+		}
+
+	for(ch = 0; ch < g->channels; ch++)
+	{
+		int sblimit = g->block_type[ch] != MPG123_SPU_BLOCK_SHORT ? 32 : (g->flags & MPG123_SPU_MIXED) ? 2 : 0;
+		for(sb = 1; sb < sblimit; sb++)
+		for(i = 0; i < 8; i++)
+		{
+			float *lo = &xr[ch][sb * 18 - 1 - i], *hi = &xr[ch][sb * 18 + i];
+			float a = *lo, b = *hi;
+			*lo = a * t->cs[i] - b * t->ca[i];
+			*hi = b * t->cs[i] + a * t->ca[i];
+		}
+	}
+}
+
+/** IMDCT + overlap-add + frequency inversion of one channel, out is [18][32] (time, subband). */
+static inline void mpg123_spu_hybrid(const mpg123_spu_tables *t, const float *xr, int block_type, int mixed,
+	mpg123_spu_channel *st, float out[MPG123_SPU_SSLIMIT][MPG123_SPU_SBLIMIT])
+{
+	int sb, i, k, w;
+
+	for(sb = 0; sb < MPG123_SPU_SBLIMIT; sb++)
+	{
+		const float *in = xr + sb * 18;
+		float res[36];
+		int type = (mixed && sb < 2) ? MPG123_SPU_BLOCK_NORMAL : block_type;
+
+		if(type != MPG123_SPU_BLOCK_SHORT)
+		{
+			for(k = 0; k < 36; k++)
+			{
+				float s = 0.0f;
+				for(i = 0; i < 18; i++) s += in[i] * t->cos36[i][k];
+				res[k] = s * t->imdct_long[type][k];
+			}
+		}
+		else
+		{
+			memset(res, 0, sizeof(res));
+			for(w = 0; w < 3; w++)
+			for(k = 0; k < 12; k++)
+			{
+				float s = 0.0f;
+				for(i = 0; i < 6; i++) s += in[i * 3 + w] * t->cos12[i][k];
+				res[6 + w * 6 + k] += s * t->win_short[k];
+			}
+		}
+
+		for(i = 0; i < 18; i++)
+		{
+			float v = res[i] + st->overlap[sb][i];
+			st->overlap[sb][i] = res[i + 18];
+			out[i][sb] = ((sb & 1) && (i & 1)) ? -v : v;
+		}
+	}
+}
+
+/** Polyphase synthesis of 'slots' x 32 subband samples ('stride' floats apart) into 32 PCM per slot,
+ *  stride 'step' in 'pcm'. */
+static inline void mpg123_spu_synth(const mpg123_spu_tables *t, const float *window,
+	const float *in, int slots, int stride, mpg123_spu_channel *st, int16_t *pcm, int step)
+{
+	int s, i, j;
+
+	for(s = 0; s < slots; s++, in += stride)
+	{
+		float *v;
+		st->v_off = (st->v_off - 64) & 1023;
+		v = st->v;
+		for(i = 0; i < 64; i++)
+			v[(st->v_off + i) & 1023] = mpg123_spu_dot32(t->n[i], in);
+
+		for(j = 0; j < 32; j++)
+		{
+			float sum = 0.0f;
+			int x;
+			for(i = 0; i < 8; i++)
+			{
+				sum += window[i * 64 + j] * v[(st->v_off + i * 128 + j) & 1023];
+				sum += window[i * 64 + 32 + j] * v[(st->v_off + i * 128 + 96 + j) & 1023];
+			}
+			x = (int)(sum * 32768.0f + (sum < 0.0f ? -0.5f : 0.5f));
+			pcm[(s * 32 + j) * step] = (int16_t)(x > 32767 ? 32767 : x < -32768 ? -32768 : x);
+		}
+	}
+}
+
+/** Scratch of one granule. */
+typedef struct
+{
+	float xr[2][MPG123_SPU_LINES] __attribute__((aligned(16)));
+	float hy[MPG123_SPU_SSLIMIT][MPG123_SPU_SBLIMIT] __attribute__((aligned(16)));
+} mpg123_spu_work;
+
+/** Whole granule: 576 frames, interleaved if stereo. */
+static inline void mpg123_spu_granule_run(const mpg123_spu_tables *t, const float *window,
+	const mpg123_spu_granule *g, mpg123_spu_channel *st, mpg123_spu_work *w, int16_t *pcm)
+{
+	int ch;
+
+	mpg123_spu_dequant(t, g, w->xr);
+	for(ch = 0; ch < g->channels; ch++)
+	{
+		mpg123_spu_hybrid(t, w->xr[ch], g->block_type[ch], g->flags & MPG123_SPU_MIXED, &st[ch], w->hy);
+		mpg123_spu_synth(t, window, &w->hy[0][0], MPG123_SPU_SSLIMIT, MPG123_SPU_SBLIMIT, &st[ch], pcm + ch, g->channels);
+	}
+}
+
+/** Subband slots of one frame: 'channels' outputs, channel 0 copied to channel 1 with MPG123_SPU_CMD_DUP. */
+static inline void mpg123_spu_subbands_run(const mpg123_spu_tables *t, const float *window,
+	const float *sb, int slots, int channels, int flags, mpg123_spu_channel *st, int16_t *pcm)
+{
+	int ch, i;
+
+	if(flags & MPG123_SPU_CMD_DUP)
+	{
+		mpg123_spu_synth(t, window, sb, slots, 2 * MPG123_SPU_SBLIMIT, &st[0], pcm, 2);
+		for(i = 0; i < slots * 32; i++) pcm[i * 2 + 1] = pcm[i * 2];
+		return;
+	}
+	for(ch = 0; ch < channels; ch++)
+		mpg123_spu_synth(t, window, sb + ch * MPG123_SPU_SBLIMIT, slots, 2 * MPG123_SPU_SBLIMIT, &st[ch], pcm + ch, channels);
+}
+
+#ifdef __SPU__
+
+static mpg123_spu_command mpg123_spu_cmd;
+static mpg123_spu_tables mpg123_spu_tab __attribute__((aligned(128)));
+static float mpg123_spu_win[512] __attribute__((aligned(128)));
+static mpg123_spu_channel mpg123_spu_state[2];
+static mpg123_spu_granule mpg123_spu_in[2];
+static int16_t mpg123_spu_out[2][MPG123_SPU_LINES * 2] __attribute__((aligned(128)));
+static mpg123_spu_work mpg123_spu_scratch;
+static mpg123_spu_subbands mpg123_spu_sb __attribute__((aligned(128)));
+static int16_t mpg123_spu_pcm[MPG123_SPU_SLOTS * 32 * 2] __attribute__((aligned(128)));
+
+/** DMA of any size (multiple of 16) in 16 KB pieces. */
+static inline void mpg123_spu_dma(void *ls, uint64_t ea, uint32_t size, uint32_t tag, int put)
+{
+	while(size)
+	{
+		uint32_t n = size > 16384 ? 16384 : size;
+		if(put) mfc_put(ls, ea, n, tag, 0, 0);
+		else mfc_get(ls, ea, n, tag, 0, 0);
+		ls = (char *)ls + n;
+		ea += n;
+		size -= n;
+	}
+}
+
+static inline void mpg123_spu_dma_wait(uint32_t tag)
+{
+	mfc_write_tag_mask(1 << tag);
+	mfc_read_tag_status_all();
+}
+
+/** Granules, streamed with double buffering. */
+static inline void mpg123_spu_run_granules(void)
+{
+	uint32_t n, bytes = MPG123_SPU_LINES * mpg123_spu_cmd.channels * sizeof(int16_t);
+
+	mpg123_spu_dma(&mpg123_spu_in[0], mpg123_spu_cmd.input, sizeof(mpg123_spu_granule), 1, 0);
+	for(n = 0; n < mpg123_spu_cmd.count; n++)
+	{
+		int cur = n & 1;
+		if(n + 1 < mpg123_spu_cmd.count)
+			mpg123_spu_dma(&mpg123_spu_in[cur ^ 1], mpg123_spu_cmd.input + (uint64_t)(n + 1) * sizeof(mpg123_spu_granule),
+				sizeof(mpg123_spu_granule), 1 + (cur ^ 1), 0);
+		mpg123_spu_dma_wait(1 + cur);	// granule in, and the put of this buffer two granules ago
+		mpg123_spu_dma_wait(3 + cur);
+		mpg123_spu_granule_run(&mpg123_spu_tab, mpg123_spu_win, &mpg123_spu_in[cur], mpg123_spu_state, &mpg123_spu_scratch, mpg123_spu_out[cur]);
+		mpg123_spu_dma(mpg123_spu_out[cur], mpg123_spu_cmd.pcm + (uint64_t)n * bytes, (bytes + 15) & ~15, 3 + cur, 1);
+	}
+	mpg123_spu_dma_wait(3);
+	mpg123_spu_dma_wait(4);
+}
+
+/** One frame of subband slots. */
+static inline void mpg123_spu_run_subbands(void)
+{
+	uint32_t slots = mpg123_spu_cmd.count > MPG123_SPU_SLOTS ? MPG123_SPU_SLOTS : mpg123_spu_cmd.count;
+
+	mpg123_spu_dma(mpg123_spu_sb, mpg123_spu_cmd.input, slots * sizeof(mpg123_spu_sb[0]), 1, 0);
+	mpg123_spu_dma_wait(1);
+	mpg123_spu_subbands_run(&mpg123_spu_tab, mpg123_spu_win, &mpg123_spu_sb[0][0][0], slots, mpg123_spu_cmd.channels,
+		mpg123_spu_cmd.flags, mpg123_spu_state, mpg123_spu_pcm);
+	mpg123_spu_dma(mpg123_spu_pcm, mpg123_spu_cmd.pcm, slots * 32 * mpg123_spu_cmd.channels * sizeof(int16_t), 3, 1);
+	mpg123_spu_dma_wait(3);
+}
+
+/** SPU thread: waits in the mailbox, runs a command, writes the PCM back and sends the completion event. */
+static inline int mpg123_spu_main(uint64_t ctx)
+{
+	int tables = 0;
+
+	spu_write_decrementer(0xffffffff);
+	for(;;)
+	{
+		uint32_t start;
+
+		spu_read_in_mbox();
+		mpg123_spu_dma(&mpg123_spu_cmd, ctx, sizeof(mpg123_spu_cmd), 0, 0);
+		mpg123_spu_dma_wait(0);
+		if(mpg123_spu_cmd.cmd == MPG123_SPU_CMD_QUIT) break;
+
+		start = spu_read_decrementer();
+		if(!tables)
+		{
+			// the tables follow the command block
+			mpg123_spu_dma(&mpg123_spu_tab, ctx + sizeof(mpg123_spu_command), sizeof(mpg123_spu_tab), 0, 0);
+			mpg123_spu_dma(mpg123_spu_win, mpg123_spu_cmd.window, sizeof(mpg123_spu_win), 0, 0);
+			tables = 1;
+		}
+		mpg123_spu_dma(mpg123_spu_state, mpg123_spu_cmd.state, sizeof(mpg123_spu_state), 0, 0);
+		mpg123_spu_dma_wait(0);
+
+		if(mpg123_spu_cmd.cmd == MPG123_SPU_CMD_SYNTH) mpg123_spu_run_subbands();
+		else mpg123_spu_run_granules();
+
+		mpg123_spu_dma(mpg123_spu_state, mpg123_spu_cmd.state, sizeof(mpg123_spu_state), 0, 1);
+		mpg123_spu_dma_wait(0);
+
+		mpg123_spu_cmd.ticks = start - spu_read_decrementer();
+		mpg123_spu_cmd.done = mpg123_spu_cmd.seq;
+		mpg123_spu_dma(&mpg123_spu_cmd, ctx, sizeof(mpg123_spu_cmd), 0, 1);
+		mpg123_spu_dma_wait(0);
+		// after the put: the PPU sees 'done' once the event arrives
+		spu_thread_send_event(MPG123_SPU_PORT, mpg123_spu_cmd.seq & EVENT_DATA0_MASK, 0);
+	}
+	spu_thread_exit(0);
+	return 0;
+}
+
+#else
+
+/** Synthesis back end of one stream. */
+typedef struct
+{
+	mpg123_spu_command cmd;		/**< must be first, followed by the tables */
+	mpg123_spu_tables tables;
+	mpg123_spu_channel state[2];
+	float window[512] __attribute__((aligned(128)));
+	mpg123_spu_subbands sb[2] __attribute__((aligned(128)));	/**< frame being collected, frame on the SPU */
+	int16_t pcm[2][MPG123_SPU_SLOTS * 32 * 2] __attribute__((aligned(128)));
+	mpg123_spu_work work;
+	int channels;
+	int on_spu;
+	int events;			/**< completion events not received yet */
+	mpg123_handle *mh;		/**< attached libmpg123 handle */
+	int cur;			/**< sb[] / pcm[] the library is feeding */
+	int slots;			/**< subband slots collected for the current frame */
+	int sb_channels;		/**< 1 or 2, how the library called the synthesis */
+	int out_channels;
+	int busy;			/**< a frame of pcm[cur ^ 1] is being synthesised on the SPU */
+	off_t busy_num;
+	size_t busy_bytes;
+	int held;			/**< result to return on the next call, parked behind the busy frame */
+	int held_ret;
+	off_t held_num;
+	int16_t *held_pcm;
+	size_t held_bytes;
+#ifdef __PPU__
+	sysSpuImage image;
+	sys_spu_group_t group;
+	sys_spu_thread_t thread;
+	sys_event_queue_t queue;
+#endif
+} __attribute__((aligned(128))) mpg123_spu_handle;
+
+/** Create a back end.
+ *  \param decoder MPG123_SPU_DECODER to run on an SPU, anything else (or NULL) runs the same kernels on the calling thread
+ *  \param spu_elf the SPU program built around mpg123_spu_main() (ignored off the console)
+ *  \param channels 1 or 2, channels of the granules given to mpg123_spu_submit()
+ *  \param error 0, -1 on failure, 1 when the SPU could not be started and the PPU is used
+ *  \return NULL on error */
+mpg123_spu_handle *mpg123_spu_new(const char *decoder, const void *spu_elf, int channels, int *error);
+
+/** Starts the synthesis of 'count' granules into pcm (576 * channels samples per granule) and returns.
+ *  granules and pcm must be 128 and 16 byte aligned and stay untouched until mpg123_spu_wait();
+ *  short block lines are in the reordered layout of the generic decoder (line = subband * 18 + frequency * 3 + window).
+ *  A previous command is waited for first. Off the SPU the work is done before returning.
+ *  \return 0 or -1 */
+int mpg123_spu_submit(mpg123_spu_handle *h, const mpg123_spu_granule *granules, int count, int16_t *pcm);
+
+/** \return 1 when the last command completed (or there is none), 0 while the SPU is busy */
+int mpg123_spu_poll(mpg123_spu_handle *h);
+
+/** Sleeps on the completion event of the last command. */
+void mpg123_spu_wait(mpg123_spu_handle *h);
+
+/** mpg123_spu_submit() followed by mpg123_spu_wait(). \return 0 or -1 */
+int mpg123_spu_decode(mpg123_spu_handle *h, const mpg123_spu_granule *granules, int count, int16_t *pcm);
+
+/** Takes over the synthesis of a libmpg123 handle (see the link flags above) and turns gapless trimming off.
+ *  \return 0, -1 when MPG123_SPU_HOOKS handles are attached already */
+int mpg123_spu_attach(mpg123_spu_handle *h, mpg123_handle *mh);
+
+void mpg123_spu_detach(mpg123_spu_handle *h);
+
+/** mpg123_decode_frame() of the attached handle with the synthesis on the SPU.
+ *  On the SPU the frame returned is the one before the last parsed (see above); the results that
+ *  are not a frame (MPG123_DONE, MPG123_NEW_FORMAT, errors) are returned after the frames before them.
+ *  \param pcm set to the 16 bit PCM of the frame, valid until the next call
+ *  \param bytes set to the size of the PCM in bytes
+ *  \return the mpg123_decode_frame() result (MPG123_OK, MPG123_NEW_FORMAT, MPG123_DONE, ...) */
+int mpg123_spu_decode_frame(mpg123_spu_handle *h, off_t *num, int16_t **pcm, size_t *bytes);
+
+/** Clears the overlap and synthesis state and drops the frame in flight, call it after a seek. */
+void mpg123_spu_reset(mpg123_spu_handle *h);
+
+/** SPU decrementer ticks of the last batch, 0 when running on the PPU. */
+static inline uint32_t mpg123_spu_ticks(const mpg123_spu_handle *h) { return h->cmd.ticks; }
+
+void mpg123_spu_delete(mpg123_spu_handle *h);
+
+#ifdef MPG123_SPU_IMPLEMENTATION
+
+static mpg123_spu_handle *mpg123_spu_hooks[MPG123_SPU_HOOKS];
+
+mpg123_spu_handle *mpg123_spu_new(const char *decoder, const void *spu_elf, int channels, int *error)
+{
+	mpg123_spu_handle *h;
+
+	if(error) *error = 0;
+	if(channels < 1 || channels > 2) { if(error) *error = -1; return NULL; }
+#ifdef __PPU__
+	h = (mpg123_spu_handle *)memalign(128, sizeof(*h));
+#else
+	if(posix_memalign((void **)&h, 128, sizeof(*h))) h = NULL;
+#endif
+	if(!h) { if(error) *error = -1; return NULL; }
+	memset(h, 0, sizeof(*h));
+	mpg123_spu_tables_init(&h->tables);
+	mpg123_spu_window_init(h->window);
+	h->channels = channels;
+
+#ifdef __PPU__
+	if(decoder && !strcmp(decoder, MPG123_SPU_DECODER) && spu_elf)
+	{
+		sysSpuThreadGroupAttribute gattr = {sizeof("mpg123 SPU"), (u32)(u64)"mpg123 SPU", 0, 0};
+		sysSpuThreadAttribute attr = {(u32)(u64)"mpg123 SPU", sizeof("mpg123 SPU"), SPU_THREAD_ATTR_NONE};
+		sysSpuThreadArgument arg = {(u64)h, 0, 0, 0};
+		sys_event_queue_attr_t qattr = { SYS_EVENT_QUEUE_FIFO, SYS_EVENT_QUEUE_PPU, "mpg123" };
+
+		if(sysEventQueueCreate(&h->queue, &qattr, SYS_EVENT_QUEUE_KEY_LOCAL, 4) == 0)
+		{
+			if(sysSpuImageImport(&h->image, spu_elf, SPU_IMAGE_PROTECT) == 0)
+			{
+				if(sysSpuThreadGroupCreate(&h->group, 1, 100, &gattr) == 0)
+				{
+					if(sysSpuThreadInitialize(&h->thread, h->group, 0, &h->image, &attr, &arg) == 0 &&
+					   sysSpuThreadConnectEvent(h->thread, h->queue, SPU_THREAD_EVENT_USER, MPG123_SPU_PORT) == 0 &&
+					   sysSpuThreadGroupStart(h->group) == 0)
+						h->on_spu = 1;
+					else
+						sysSpuThreadGroupDestroy(h->group);
+				}
+				if(!h->on_spu) sysSpuImageClose(&h->image);
+			}
+			if(!h->on_spu) sysEventQueueDestroy(h->queue, 0);
+		}
+		if(!h->on_spu && error) *error = 1;	// still usable, on the PPU
+	}
+#else
+	(void)decoder;
+	(void)spu_elf;
+#endif
+	return h;
+}
+
+int mpg123_spu_poll(mpg123_spu_handle *h)
+{
+	return !h->events || h->cmd.done == h->cmd.seq;
+}
+
+void mpg123_spu_wait(mpg123_spu_handle *h)
+{
+#ifdef __PPU__
+	// one event per command, sent after the command block is written back
+	while(h->events > 0)
+	{
+		sys_event_t ev;
+		if(sysEventQueueReceive(h->queue, &ev, 0) == 0) h->events--;
+	}
+	__asm__ volatile("lwsync" ::: "memory");
+#else
+	(void)h;
+#endif
+}
+
+#ifdef __PPU__
+static void mpg123_spu_start(mpg123_spu_handle *h, uint32_t cmd, const void *input, int count, int channels, uint32_t flags, int16_t *pcm)
+{
+	h->cmd.input = (u64)input;
+	h->cmd.pcm = (u64)pcm;
+	h->cmd.state = (u64)h->state;
+	h->cmd.window = (u64)h->window;
+	h->cmd.count = count;
+	h->cmd.channels = channels;
+	h->cmd.flags = flags;
+	h->cmd.cmd = cmd;
+	h->cmd.seq++;
+	h->events++;
+	__asm__ volatile("lwsync" ::: "memory");
+	sysSpuThreadWriteMb(h->thread, 1);
+}
+#endif
+
+int mpg123_spu_submit(mpg123_spu_handle *h, const mpg123_spu_granule *granules, int count, int16_t *pcm)
+{
+	int n;
+
+	if(!h || count < 0) return -1;
+	mpg123_spu_wait(h);
+	if(!count) return 0;
+#ifdef __PPU__
+	if(h->on_spu)
+	{
+		mpg123_spu_start(h, MPG123_SPU_CMD_RUN, granules, count, h->channels, 0, pcm);
+		return 0;
+	}
+#endif
+	for(n = 0; n < count; n++)
+		mpg123_spu_granule_run(&h->tables, h->window, &granules[n], h->state, &h->work, pcm + n * MPG123_SPU_LINES * h->channels);
+	return 0;
+}
+
+int mpg123_spu_decode(mpg123_spu_handle *h, const mpg123_spu_granule *granules, int count, int16_t *pcm)
+{
+	int ret = mpg123_spu_submit(h, granules, count, pcm);
+
+	if(ret == 0) mpg123_spu_wait(h);
+	return ret;
+}
+
+static mpg123_spu_handle *mpg123_spu_find(mpg123_handle *mh)
+{
+	int i;
+
+	for(i = 0; i < MPG123_SPU_HOOKS; i++)
+		if(mpg123_spu_hooks[i] && mpg123_spu_hooks[i]->mh == mh) return mpg123_spu_hooks[i];
+	return NULL;
+}
+
+int mpg123_spu_attach(mpg123_spu_handle *h, mpg123_handle *mh)
+{
+	int i;
+
+	mpg123_spu_detach(h);
+	for(i = 0; i < MPG123_SPU_HOOKS; i++)
+		if(!mpg123_spu_hooks[i])
+		{
+			h->mh = mh;
+			mpg123_spu_hooks[i] = h;
+			// trimming works on the library output buffer, which stays empty
+			mpg123_param(mh, MPG123_REMOVE_FLAGS, MPG123_GAPLESS, 0.0);
+			mpg123_spu_reset(h);
+			return 0;
+		}
+	return -1;
+}
+
+void mpg123_spu_detach(mpg123_spu_handle *h)
+{
+	int i;
+
+	for(i = 0; i < MPG123_SPU_HOOKS; i++)
+		if(mpg123_spu_hooks[i] == h) mpg123_spu_hooks[i] = NULL;
+	h->mh = NULL;
+}
+
+int mpg123_spu_decode_frame(mpg123_spu_handle *h, off_t *num, int16_t **pcm, size_t *bytes)
+{
+	*pcm = NULL;
+	*bytes = 0;
+	if(!h->mh) return MPG123_ERR;
+	if(h->held)
+	{
+		h->held = 0;
+		*num = h->held_num;
+		*pcm = h->held_pcm;
+		*bytes = h->held_bytes;
+		return h->held_ret;
+	}
+
+	for(;;)
+	{
+		unsigned char *audio = NULL;
+		size_t n = 0;
+		off_t frame = 0;
+		int ret, b = h->cur, flags;
+
+		h->slots = 0;
+		ret = mpg123_decode_frame(h->mh, &frame, &audio, &n);
+		flags = h->sb_channels < h->out_channels ? MPG123_SPU_CMD_DUP : 0;
+
+#ifdef __PPU__
+		if(ret == MPG123_OK && h->slots && h->on_spu)
+		{
+			int busy = h->busy;
+			off_t done_num = h->busy_num;
+			size_t done_bytes = h->busy_bytes;
+
+			// frame N is done (or there is none yet), N + 1 goes to the SPU and the next call parses N + 2
+			mpg123_spu_wait(h);
+			mpg123_spu_start(h, MPG123_SPU_CMD_SYNTH, h->sb[b], h->slots, h->out_channels, flags, h->pcm[b]);
+			h->busy = 1;
+			h->busy_num = frame;
+			h->busy_bytes = (size_t)h->slots * 32 * h->out_channels * sizeof(int16_t);
+			h->cur = b ^ 1;
+			if(!busy) continue;
+			*num = done_num;
+			*pcm = h->pcm[b ^ 1];
+			*bytes = done_bytes;
+			return MPG123_OK;
+		}
+#endif
+		if(ret == MPG123_OK && h->slots)
+		{
+			mpg123_spu_subbands_run(&h->tables, h->window, &h->sb[b][0][0][0], h->slots, h->out_channels, flags, h->state, h->pcm[b]);
+			audio = (unsigned char *)h->pcm[b];
+			n = (size_t)h->slots * 32 * h->out_channels * sizeof(int16_t);
+		}
+		else if(ret != MPG123_OK)
+		{
+			audio = NULL;
+			n = 0;
+		}
+		// otherwise not linked with --wrap, or a format the hook does not cover: the library synthesised it
+
+		if(!h->busy)
+		{
+			*num = frame;
+			*pcm = (int16_t *)audio;
+			*bytes = n;
+			return ret;
+		}
+		// the frame on the SPU comes first; the library buffer stays valid until mpg123_decode_frame() is called again
+		h->held = 1;
+		h->held_ret = ret;
+		h->held_num = frame;
+		h->held_pcm = (int16_t *)audio;
+		h->held_bytes = n;
+		mpg123_spu_wait(h);
+		h->busy = 0;
+		*num = h->busy_num;
+		*pcm = h->pcm[b ^ 1];
+		*bytes = h->busy_bytes;
+		return MPG123_OK;
+	}
+}
+
+/* The libmpg123 synthesis entry points (decode.c). With --wrap the function pointers the library
+ * installs in set_synth_functions() lead here; the originals stay reachable as __real_*. */
+int __real_synth_1to1(float *bandPtr, int channel, mpg123_handle *fr, int final) __attribute__((weak));
+int __real_synth_1to1_mono(float *bandPtr, mpg123_handle *fr) __attribute__((weak));
+int __real_synth_1to1_mono2stereo(float *bandPtr, mpg123_handle *fr) __attribute__((weak));
+
+static int mpg123_spu_collect(mpg123_handle *fr, const float *band, int channel, int last, int sb_channels, int out_channels)
+{
+	mpg123_spu_handle *h = mpg123_spu_find(fr);
+
+	if(!h) return -1;
+	if(h->slots < MPG123_SPU_SLOTS)
+	{
+		memcpy(h->sb[h->cur][h->slots][channel], band, sizeof(h->sb[0][0][0]));
+		if(last) h->slots++;
+	}
+	h->sb_channels = sb_channels;
+	h->out_channels = out_channels;
+	return 0;
+}
+
+int __wrap_synth_1to1(float *bandPtr, int channel, mpg123_handle *fr, int final)
+{
+	if(mpg123_spu_collect(fr, bandPtr, channel & 1, final, 2, 2) == 0) return 0;
+	return __real_synth_1to1(bandPtr, channel, fr, final);
+}
+
+int __wrap_synth_1to1_mono(float *bandPtr, mpg123_handle *fr)
+{
+	if(mpg123_spu_collect(fr, bandPtr, 0, 1, 1, 1) == 0) return 0;
+	return __real_synth_1to1_mono(bandPtr, fr);
+}
+
+int __wrap_synth_1to1_mono2stereo(float *bandPtr, mpg123_handle *fr)
+{
+	if(mpg123_spu_collect(fr, bandPtr, 0, 1, 1, 2) == 0) return 0;
+	return __real_synth_1to1_mono2stereo(bandPtr, fr);
+}
+
+void mpg123_spu_reset(mpg123_spu_handle *h)
+{
+	mpg123_spu_wait(h);
+	h->busy = 0;
+	h->held = 0;
+	memset(h->state, 0, sizeof(h->state));
+}
+
+void mpg123_spu_delete(mpg123_spu_handle *h)
+{
+	if(!h) return;
+	mpg123_spu_detach(h);
+	mpg123_spu_wait(h);
+#ifdef __PPU__
+	if(h->on_spu)
+	{
+		u32 cause, status;
+		h->cmd.cmd = MPG123_SPU_CMD_QUIT;
+		__asm__ volatile("lwsync" ::: "memory");
+		sysSpuThreadWriteMb(h->thread, 1);
+		sysSpuThreadGroupJoin(h->group, &cause, &status);
+		sysSpuThreadDisconnectEvent(h->thread, SPU_THREAD_EVENT_USER, MPG123_SPU_PORT);
+		sysSpuThreadGroupDestroy(h->group);
+		sysSpuImageClose(&h->image);
+		sysEventQueueDestroy(h->queue, 0);
+	}
+#endif
+	free(h);
+}
+
+#endif /* MPG123_SPU_IMPLEMENTATION */
+
+#endif /* __SPU__ */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1899 @@
+/*
+    Copyright (C) 1985, 2010  Francisco Mu�oz "Hermes" <www.elotrolado.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+    Vorbis audio packet decode on an SPU.
+
+    The PPU keeps the Ogg framing and reads the headers: VSPU_NewSetup() turns the setup header into
+    one position independent block (codebooks with their decode tables and vectors, floors, residues,
+    mappings and modes) that the SPU keeps in local store. Every audio packet is then decoded by the
+    SPU from its first bit:
+
+    floor 1 and residue (types 0, 1 and 2) decode -> inverse channel coupling -> floor curve * residue
+    -> inverse MDCT (DCT-IV over an N/4 point FFT)
+
+    after which the SPU either writes the N samples of every channel back (what vorbis_synthesis()
+    leaves in the vorbis_block), or applies the Vorbis power-sine window, overlap-adds the previous
+    packet and writes 16 bit interleaved PCM. The packet, the spectra and the output are streamed
+    through local store, the output of channel c is written back while channel c+1 is transformed.
+
+    A packet completes with an SPU thread user event on a private event queue: VSPU_Wait() sleeps in
+    the kernel, VSPU_Submit() + VSPU_Poll() let the PPU read the next packet meanwhile.
+
+    libvorbis and libvorbisfile are prebuilt archives, so the players (vorbisfile, and liboggplayer
+    on top of it) are moved to the SPU at link time:
+
+        -Wl,--wrap=vorbis_synthesis,--wrap=vorbis_synthesis_headerin,--wrap=vorbis_info_clear
+
+    plus VSPU_Attach(decoder). The setup header of every stream is parsed again while the library
+    reads it, and ov_read() gets its packets decoded on the SPU; libvorbis is left with the windowed
+    overlap-add of vorbis_synthesis_blockin(). Streams the SPU program does not cover (floor 0, more
+    than 2 channels, blocks larger than 4096, a setup larger than VSPU_MAX_SETUP) stay with libvorbis,
+    and so does everything without the link flags.
+
+    The same code runs on the PPU and on the host, which is how it was checked against libvorbis.
+
+    - SPU program:  #include <soundlib/vorbis_spu.h>
+                    int main(uint64_t ctx) { return VSPU_SpuMain(ctx); }
+    - PPU / host:   #define VSPU_IMPLEMENTATION in one source file.
+*/
+
+#ifndef VORBIS_SPU_H
+#define VORBIS_SPU_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef __SPU__
+#include <spu_intrinsics.h>
+#include <spu_mfcio.h>
+#include <sys/spu_thread.h>
+#include <sys/spu_event.h>
+#else
+#include <stdlib.h>
+#include <vorbis/codec.h>
+#ifdef __PPU__
+#include <ppu-types.h>
+#include <malloc.h>
+#include <sys/spu.h>
+#include <sys/event_queue.h>
+#include <lv2/spu.h>
+#include <lv2/mutex.h>
+#endif
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define VSPU_MAX_BLOCK     4096		// largest blocksize (larger streams stay with libvorbis)
+#define VSPU_MAX_CHANNELS  2
+#define VSPU_MAX_COUPLING  8
+#define VSPU_MAX_POSTS     65		// floor 1 posts, the limit of the specification
+#define VSPU_MAX_PARTWORDS 512		// residue partition words of one channel in a packet
+#define VSPU_MAX_SETUP     (64 * 1024)	// parsed setup, it stays in local store (libvorbis streams need up to ~47K)
+#define VSPU_MAX_PACKET    8192		// larger packets are decoded on the PPU
+#define VSPU_SPU_PORT      18		// SPU event port of the completion event
+#define VSPU_STREAMS       8		// libvorbis streams known to the hook at the same time
+
+#define VSPU_OK        0
+#define VSPU_INVALID  -1
+#define VSPU_NOTAUDIO -2
+
+/* parsed setup header: one block, the arrays are at byte offsets from its start */
+
+typedef struct {
+	uint32_t used;		// codewords
+	uint16_t dim;
+	uint8_t maxlen;		// longest codeword
+	uint8_t vq;			// 1 when the book has vectors
+	uint32_t codes;		// uint32_t[used], codewords MSB first and left aligned, ascending
+	uint32_t lengths;	// uint8_t[used]
+	uint32_t entry;		// uint16_t[used], entry number of each codeword
+	uint32_t values;	// float[used * dim], vector of each codeword, or the multiplicands when 'index' is set
+	uint32_t index;		// 0 or uint8_t[used * dim], multiplicand of every vector element
+} VSPU_Book;
+
+typedef struct {
+	uint8_t partitions;
+	uint8_t multiplier;
+	uint8_t rangebits;
+	uint8_t posts;
+	uint8_t partition_class[32];
+	uint8_t class_dim[16];
+	uint8_t class_subs[16];
+	uint8_t class_book[16];
+	int16_t subbook[16][8];		// -1: no book
+	uint16_t x[VSPU_MAX_POSTS];
+	uint8_t lo[VSPU_MAX_POSTS];	// neighbours of every post in coding order
+	uint8_t hi[VSPU_MAX_POSTS];
+	uint8_t order[VSPU_MAX_POSTS];	// posts sorted by x
+} VSPU_Floor;
+
+typedef struct {
+	uint32_t type;
+	uint32_t begin, end, grouping;
+	uint32_t classifications;
+	uint32_t classbook;
+	uint32_t partvals;	// classifications ^ dim of the class book
+	uint32_t stages;
+	uint32_t decodemap;	// uint8_t[partvals][dim], the classes of a partition word
+	uint32_t books;		// int16_t[classifications][8], book of every stage (-1: none)
+} VSPU_Residue;
+
+typedef struct {
+	uint8_t submaps;
+	uint8_t coupling_steps;
+	uint8_t mux[VSPU_MAX_CHANNELS];
+	uint8_t magnitude[VSPU_MAX_COUPLING];
+	uint8_t angle[VSPU_MAX_COUPLING];
+	uint8_t floor[16];
+	uint8_t residue[16];
+} VSPU_Mapping;
+
+typedef struct {
+	uint32_t size;		// bytes of the whole setup
+	uint32_t id;		// unique, the SPU keeps the last setup it was given
+	uint32_t channels, rate;
+	uint32_t blocksize[2];
+	uint32_t modebits, modes;
+	uint32_t books, floors, residues, mappings;
+	uint32_t book, floor, residue, mapping;		// offsets of the arrays
+	uint8_t blockflag[64];
+	uint8_t mode_mapping[64];
+} __attribute__((aligned(16))) VSPU_Setup;
+
+#define VSPU_AT(base, offset, type) ((type *) ((uintptr_t) (base) + (offset)))
+
+/* command block of the SPU thread */
+
+typedef struct {
+	uint64_t setup;		// ea of the VSPU_Setup
+	uint64_t packet;	// ea of the packet, any alignment
+	uint64_t out[VSPU_MAX_CHANNELS];	// VSPU_CMD_BLOCK: float[n] per channel, VSPU_CMD_PCM: out[0] is the int16_t PCM
+	uint64_t state;		// ea of float[VSPU_MAX_CHANNELS][VSPU_MAX_BLOCK], previous windowed blocks
+	uint32_t setup_id;
+	uint32_t setup_size;
+	uint32_t bytes;		// of the packet
+	uint32_t pn;		// blocksize of the previous packet (VSPU_CMD_PCM), updated
+	uint32_t cmd;
+	uint32_t seq;
+	volatile uint32_t done;
+	uint32_t ticks;
+	int32_t result;		// written back: blocksize, PCM frames or VSPU_INVALID / VSPU_NOTAUDIO
+	uint32_t pad[13];
+} __attribute__((aligned(128))) VSPU_Command;
+
+#define VSPU_CMD_BLOCK 1
+#define VSPU_CMD_PCM   2
+#define VSPU_CMD_QUIT  3
+
+/* working memory of one packet */
+
+typedef struct {
+	float spectrum[VSPU_MAX_CHANNELS][VSPU_MAX_BLOCK / 2 + 8];	// the slack takes a vector running over a partition
+	int32_t fit[VSPU_MAX_CHANNELS][VSPU_MAX_POSTS];
+	uint16_t partword[VSPU_MAX_CHANNELS][VSPU_MAX_PARTWORDS];
+	uint16_t codes[VSPU_MAX_BLOCK / 2];
+} __attribute__((aligned(16))) VSPU_Scratch;
+
+/* trig tables for one blocksize */
+
+typedef struct {
+	uint32_t n;
+	float pre[VSPU_MAX_BLOCK / 4][2];		// exp(-i pi (h + 1/4) / M), M = n / 2
+	float post[VSPU_MAX_BLOCK / 4][2];		// exp(-i pi k / M)
+	float fft[VSPU_MAX_BLOCK / 8][2];		// exp(-2 i pi k / (n / 4))
+	float slope[VSPU_MAX_BLOCK / 2];		// window slope of length n / 2
+} __attribute__((aligned(16))) VSPU_Tables;
+
+/* blocksize and window flags of a packet */
+
+typedef struct {
+	int32_t mode, W, lW, nW;
+	uint32_t n;
+} VSPU_Frame;
+
+static inline void VSPU_BuildTables(VSPU_Tables * t, uint32_t n)
+{
+	uint32_t m = n / 2, q = n / 4, i;
+
+	t->n = n;
+	for (i = 0; i < q; i++) {
+		t->pre[i][0] = (float) cos(M_PI * (i + 0.25) / m);
+		t->pre[i][1] = (float) -sin(M_PI * (i + 0.25) / m);
+		t->post[i][0] = (float) cos(M_PI * i / m);
+		t->post[i][1] = (float) -sin(M_PI * i / m);
+	}
+	for (i = 0; i < q / 2; i++) {
+		t->fft[i][0] = (float) cos(2.0 * M_PI * i / q);
+		t->fft[i][1] = (float) -sin(2.0 * M_PI * i / q);
+	}
+	for (i = 0; i < m; i++) {
+		double s = sin((i + 0.5) / m * M_PI / 2.0);
+		t->slope[i] = (float) sin(M_PI / 2.0 * s * s);
+	}
+}
+
+/* in place radix-2 complex FFT of 'size' points (power of 2), z is re/im interleaved */
+
+static inline void VSPU_FFT(float *z, uint32_t size, const float (*tw)[2], uint32_t tw_size)
+{
+	uint32_t i, j, len, k;
+
+	for (i = 1, j = 0; i < size; i++) {
+		uint32_t bit = size >> 1;
+		for (; j & bit; bit >>= 1)
+			j ^= bit;
+		j |= bit;
+		if (i < j) {
+			float r = z[i * 2], m = z[i * 2 + 1];
+			z[i * 2] = z[j * 2];
+			z[i * 2 + 1] = z[j * 2 + 1];
+			z[j * 2] = r;
+			z[j * 2 + 1] = m;
+		}
+	}
+	for (len = 2; len <= size; len <<= 1) {
+		uint32_t half = len >> 1, step = tw_size * 2 / len;
+		for (i = 0; i < size; i += len)
+			for (k = 0; k < half; k++) {
+				float wr = tw[k * step][0], wi = tw[k * step][1];
+				float *a = &z[(i + k) * 2], *b = &z[(i + k + half) * 2];
+				float br = b[0] * wr - b[1] * wi, bi = b[0] * wi + b[1] * wr;
+				b[0] = a[0] - br;
+				b[1] = a[1] - bi;
+				a[0] += br;
+				a[1] += bi;
+			}
+	}
+}
+
+/*
+   y[j] = sum(k = 0 .. n/2 - 1) X[k] cos(2 pi / n (j + 1/2 + n/4) (k + 1/2)), j = 0 .. n - 1
+   'work' holds n / 2 floats.
+*/
+
+static inline void VSPU_InverseMDCT(const VSPU_Tables * t, const float *x, float *y, float *work)
+{
+	uint32_t n = t->n, m = n / 2, q = n / 4, h, j;
+	float *u = y;		// the DCT-IV goes in y[0 .. m), then it is unfolded
+
+	// DCT-IV of size m with an m/2 point complex FFT
+	for (h = 0; h < q; h++) {
+		float re = x[2 * h], im = x[m - 1 - 2 * h];
+		work[h * 2] = re * t->pre[h][0] - im * t->pre[h][1];
+		work[h * 2 + 1] = re * t->pre[h][1] + im * t->pre[h][0];
+	}
+	VSPU_FFT(work, q, t->fft, q / 2);
+	for (h = 0; h < q; h++) {
+		float re = work[h * 2] * t->post[h][0] - work[h * 2 + 1] * t->post[h][1];
+		float im = work[h * 2] * t->post[h][1] + work[h * 2 + 1] * t->post[h][0];
+		work[h * 2] = re;
+		work[h * 2 + 1] = im;
+	}
+	for (h = 0; h < q; h++) {
+		u[2 * h] = work[h * 2];
+		u[m - 1 - 2 * h] = -work[h * 2 + 1];
+	}
+
+	// unfold: y[j] = U(j + m/2), U(k) = u[k] (k < m), -u[2m - 1 - k] (k < 2m), -u[k - 2m]
+	memcpy(work, u, m * sizeof(float));
+	for (j = 0; j < n; j++) {
+		uint32_t k = j + m / 2;
+		y[j] = k < m ? work[k] : (k < 2 * m ? -work[2 * m - 1 - k] : -work[k - 2 * m]);
+	}
+}
+
+/* Vorbis window of a block of size n between windows of size pn and nn */
+
+static inline void VSPU_Window(float *y, uint32_t n, uint32_t pn, uint32_t nn, const VSPU_Tables * left, const VSPU_Tables * right)
+{
+	uint32_t ln = (pn && pn < n ? pn : n) / 2, rn = (nn && nn < n ? nn : n) / 2;
+	uint32_t lb = n / 4 - ln / 2, rb = 3 * n / 4 - rn / 2, i;
+
+	for (i = 0; i < lb; i++)
+		y[i] = 0.0f;
+	for (i = 0; i < ln; i++)
+		y[lb + i] *= left->slope[i];
+	for (i = 0; i < rn; i++)
+		y[rb + i] *= right->slope[rn - 1 - i];
+	for (i = rb + rn; i < n; i++)
+		y[i] = 0.0f;
+}
+
+/* inverse magnitude / angle coupling of the spectra */
+
+static inline void VSPU_Decouple(float *mag, float *ang, uint32_t count)
+{
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		float m = mag[i], a = ang[i];
+		if (m > 0.0f) {
+			if (a > 0.0f) {
+				ang[i] = m - a;
+			} else {
+				ang[i] = m;
+				mag[i] = m + a;
+			}
+		} else {
+			if (a > 0.0f) {
+				ang[i] = m + a;
+			} else {
+				ang[i] = m;
+				mag[i] = m - a;
+			}
+		}
+	}
+}
+
+/*
+   Overlap-add of the windowed block 'cur' (size n) with 'prev' (size pn), writes (pn/4 + n/4) frames
+   from the centre of prev to the centre of cur in channel 'ch' of 'pcm'. Returns the frames.
+*/
+
+static inline uint32_t VSPU_OverlapAdd(const float *prev, uint32_t pn, const float *cur, uint32_t n, int16_t * pcm, uint32_t ch,
+				       uint32_t channels)
+{
+	uint32_t frames = pn / 4 + n / 4, i;
+
+	if (!pn)
+		return 0;
+	for (i = 0; i < frames; i++) {
+		int32_t pi = (int32_t) (pn / 2 + i), ci = (int32_t) (i + n / 4) - (int32_t) (pn / 4);
+		float v = (pi < (int32_t) pn ? prev[pi] : 0.0f) + (ci >= 0 && ci < (int32_t) n ? cur[ci] : 0.0f);
+		int32_t s = (int32_t) (v * 32768.0f + (v < 0.0f ? -0.5f : 0.5f));
+		pcm[i * channels + ch] = (int16_t) (s > 32767 ? 32767 : (s < -32768 ? -32768 : s));
+	}
+	return frames;
+}
+
+/* packet bits, LSB first like libogg; the data is followed by at least 4 readable bytes */
+
+typedef struct {
+	const uint8_t *data;
+	uint32_t pos, end;	// in bits, pos > end once a read ran over the end
+} VSPU_Bits;
+
+static inline uint32_t VSPU_Peek(const VSPU_Bits * b)
+{
+	const uint8_t *p = b->data + (b->pos >> 3);
+	uint64_t v = (uint64_t) p[0] | (uint64_t) p[1] << 8 | (uint64_t) p[2] << 16 | (uint64_t) p[3] << 24 | (uint64_t) p[4] << 32;
+
+	return (uint32_t) (v >> (b->pos & 7));
+}
+
+/* n <= 31 bits, -1 at the end of the packet (and for every read after it) */
+
+static inline int32_t VSPU_Read(VSPU_Bits * b, uint32_t n)
+{
+	uint32_t v;
+
+	if (b->pos + n > b->end) {
+		b->pos = b->end + 1;
+		return -1;
+	}
+	if (!n)
+		return 0;
+	v = VSPU_Peek(b) & (0xffffffffu >> (32 - n));
+	b->pos += n;
+	return (int32_t) v;
+}
+
+static inline uint32_t VSPU_Reverse(uint32_t v)
+{
+	v = ((v >> 1) & 0x55555555) | ((v & 0x55555555) << 1);
+	v = ((v >> 2) & 0x33333333) | ((v & 0x33333333) << 2);
+	v = ((v >> 4) & 0x0f0f0f0f) | ((v & 0x0f0f0f0f) << 4);
+	v = ((v >> 8) & 0x00ff00ff) | ((v & 0x00ff00ff) << 8);
+	return (v >> 16) | (v << 16);
+}
+
+/* the next codeword of 'book' as its index in codeword order, -1 at the end of the packet (as libvorbis) */
+
+static inline int32_t VSPU_DecodeCode(const VSPU_Setup * s, const VSPU_Book * book, VSPU_Bits * b)
+{
+	const uint32_t *codes = VSPU_AT(s, book->codes, const uint32_t);
+	const uint8_t *lengths = VSPU_AT(s, book->lengths, const uint8_t);
+	uint32_t read = book->maxlen, lo = 0, hi = book->used, word;
+
+	if (b->pos >= b->end)
+		return -1;
+	if (read > b->end - b->pos)
+		read = b->end - b->pos;
+	word = VSPU_Reverse(VSPU_Peek(b) & (0xffffffffu >> (32 - read)));
+	while (hi - lo > 1) {
+		uint32_t p = (hi - lo) >> 1;
+		if (codes[lo + p] > word)
+			hi -= p;
+		else
+			lo += p;
+	}
+	if (lengths[lo] > read) {
+		b->pos = b->end + 1;
+		return -1;
+	}
+	b->pos += lengths[lo];
+	return (int32_t) lo;
+}
+
+/* the next entry number of a scalar book */
+
+static inline int32_t VSPU_DecodeEntry(const VSPU_Setup * s, const VSPU_Book * book, VSPU_Bits * b)
+{
+	int32_t code;
+
+	if (!book->used)
+		return -1;
+	code = VSPU_DecodeCode(s, book, b);
+	return code < 0 ? -1 : VSPU_AT(s, book->entry, const uint16_t)[code];
+}
+
+/* residue vectors: type 0 (interleaved), 1 (in order) and 2 (across the channels), -1 at the end of the packet */
+
+static inline float VSPU_Value(const VSPU_Setup * s, const VSPU_Book * book, uint32_t k)
+{
+	const float *values = VSPU_AT(s, book->values, const float);
+
+	return book->index ? values[VSPU_AT(s, book->index, const uint8_t)[k]] : values[k];
+}
+
+static inline int VSPU_DecodeVS(const VSPU_Setup * s, const VSPU_Book * book, float *a, VSPU_Bits * b, uint32_t n, uint16_t * codes)
+{
+	uint32_t dim = book->dim, step = n / dim, i, j, o;
+
+	if (!book->used)
+		return 0;
+	// all the codewords first, a partition cut by the end of the packet adds nothing
+	for (i = 0; i < step; i++) {
+		int32_t code = VSPU_DecodeCode(s, book, b);
+		if (code < 0)
+			return -1;
+		codes[i] = (uint16_t) code;
+	}
+	for (i = 0, o = 0; i < dim; i++, o += step)
+		for (j = 0; j < step; j++)
+			a[o + j] += VSPU_Value(s, book, codes[j] * dim + i);
+	return 0;
+}
+
+static inline int VSPU_DecodeV(const VSPU_Setup * s, const VSPU_Book * book, float *a, VSPU_Bits * b, uint32_t n)
+{
+	uint32_t dim = book->dim, i, j;
+
+	if (!book->used)
+		return 0;
+	for (i = 0; i < n;) {
+		int32_t code = VSPU_DecodeCode(s, book, b);
+		if (code < 0)
+			return -1;
+		for (j = 0; j < dim; j++)
+			a[i++] += VSPU_Value(s, book, code * dim + j);
+	}
+	return 0;
+}
+
+static inline int VSPU_DecodeVV(const VSPU_Setup * s, const VSPU_Book * book, float **a, uint32_t offset, uint32_t ch, VSPU_Bits * b,
+				uint32_t n)
+{
+	uint32_t dim = book->dim, i, j, c = 0;
+
+	if (!book->used)
+		return 0;
+	for (i = offset / ch; i < (offset + n) / ch;) {
+		int32_t code = VSPU_DecodeCode(s, book, b);
+		if (code < 0)
+			return -1;
+		for (j = 0; j < dim; j++) {
+			a[c++][i] += VSPU_Value(s, book, code * dim + j);
+			if (c == ch) {
+				c = 0;
+				i++;
+			}
+		}
+	}
+	return 0;
+}
+
+/* residue of the 'ch' vectors of one submap, n is the half blocksize */
+
+static inline void VSPU_ResidueDecode(const VSPU_Setup * s, const VSPU_Residue * r, VSPU_Bits * b, float **in, uint32_t ch, uint32_t n,
+				      VSPU_Scratch * w)
+{
+	const VSPU_Book *books = VSPU_AT(s, s->book, const VSPU_Book);
+	const VSPU_Book *phrase = &books[r->classbook];
+	const uint8_t *decodemap = VSPU_AT(s, r->decodemap, const uint8_t);
+	const int16_t *stagebooks = VSPU_AT(s, r->books, const int16_t);
+	uint32_t per = phrase->dim, words = r->type == 2 ? 1 : ch, parts, i, j, k, l, st;
+	int32_t max = (int32_t) (r->type == 2 ? n * ch : n), end = (int32_t) r->end < max ? (int32_t) r->end : max;
+
+	if (end - (int32_t) r->begin <= 0)
+		return;
+	parts = (end - r->begin) / r->grouping;
+	for (st = 0; st < r->stages; st++)
+		for (i = 0, l = 0; i < parts; l++) {
+			if (st == 0)
+				for (j = 0; j < words; j++) {
+					int32_t temp = VSPU_DecodeEntry(s, phrase, b);
+					if (temp < 0 || temp >= (int32_t) r->partvals)
+						return;
+					w->partword[j][l] = (uint16_t) temp;
+				}
+			for (k = 0; k < per && i < parts; k++, i++)
+				for (j = 0; j < words; j++) {
+					int32_t book = stagebooks[decodemap[w->partword[j][l] * per + k] * 8 + st];
+					uint32_t offset = r->begin + i * r->grouping;
+					int ret;
+
+					if (book < 0)
+						continue;
+					if (r->type == 2)
+						ret = VSPU_DecodeVV(s, &books[book], in, offset, ch, b, r->grouping);
+					else if (r->type == 1)
+						ret = VSPU_DecodeV(s, &books[book], in[j] + offset, b, r->grouping);
+					else
+						ret = VSPU_DecodeVS(s, &books[book], in[j] + offset, b, r->grouping, w->codes);
+					if (ret < 0)
+						return;
+				}
+		}
+}
+
+/* floor 1 of one channel: reads the posts into 'fit', 0 when the floor is unused in this packet */
+
+static inline int32_t VSPU_RenderPoint(int32_t x0, int32_t x1, int32_t y0, int32_t y1, int32_t x)
+{
+	int32_t dy, adx, off;
+
+	y0 &= 0x7fff;
+	y1 &= 0x7fff;
+	dy = y1 - y0;
+	adx = x1 - x0;
+	off = (dy < 0 ? -dy : dy) * (x - x0) / adx;
+	return dy < 0 ? y0 - off : y0 + off;
+}
+
+static inline int VSPU_Floor1Decode(const VSPU_Setup * s, const VSPU_Floor * f, VSPU_Bits * b, int32_t * fit)
+{
+	static const int32_t range[4] = { 256, 128, 86, 64 }, bits[4] = { 8, 7, 7, 6 };
+	const VSPU_Book *books = VSPU_AT(s, s->book, const VSPU_Book);
+	int32_t q = range[f->multiplier - 1];
+	uint32_t i, j, k;
+
+	if (VSPU_Read(b, 1) != 1)
+		return 0;
+	fit[0] = VSPU_Read(b, bits[f->multiplier - 1]);
+	fit[1] = VSPU_Read(b, bits[f->multiplier - 1]);
+	for (i = 0, j = 2; i < f->partitions; i++) {
+		uint32_t cls = f->partition_class[i], cdim = f->class_dim[cls], csub = f->class_subs[cls];
+		int32_t cval = 0;
+
+		if (csub) {
+			cval = VSPU_DecodeEntry(s, &books[f->class_book[cls]], b);
+			if (cval < 0)
+				return 0;
+		}
+		for (k = 0; k < cdim; k++) {
+			int32_t book = f->subbook[cls][cval & ((1 << csub) - 1)];
+			cval >>= csub;
+			if (book >= 0) {
+				if ((fit[j + k] = VSPU_DecodeEntry(s, &books[book], b)) < 0)
+					return 0;
+			} else
+				fit[j + k] = 0;
+		}
+		j += cdim;
+	}
+
+	// unwrap the values against the prediction from the neighbours
+	for (i = 2; i < f->posts; i++) {
+		int32_t lo = f->lo[i], hi = f->hi[i];
+		int32_t predicted = VSPU_RenderPoint(f->x[lo], f->x[hi], fit[lo], fit[hi], f->x[i]);
+		int32_t hiroom = q - predicted, loroom = predicted, room = (hiroom < loroom ? hiroom : loroom) << 1, val = fit[i];
+
+		if (val) {
+			if (val >= room)
+				val = hiroom > loroom ? val - loroom : -1 - (val - hiroom);
+			else
+				val = (val & 1) ? -((val + 1) >> 1) : val >> 1;
+			fit[i] = (val + predicted) & 0x7fff;
+			fit[lo] &= 0x7fff;
+			fit[hi] &= 0x7fff;
+		} else
+			fit[i] = predicted | 0x8000;
+	}
+	return 1;
+}
+
+static const float vspu_fromdb[256] = {
+	1.06498632e-07F, 1.1341951e-07F, 1.20790148e-07F, 1.28639783e-07F, 1.36999503e-07F, 1.45902504e-07F,
+	1.55384086e-07F, 1.65481808e-07F, 1.76235744e-07F, 1.87688556e-07F, 1.99885605e-07F, 2.12875307e-07F,
+	2.26709133e-07F, 2.41441967e-07F, 2.57132228e-07F, 2.73842119e-07F, 2.91637917e-07F, 3.10590224e-07F,
+	3.307741e-07F, 3.52269666e-07F, 3.75162131e-07F, 3.99542301e-07F, 4.25506812e-07F, 4.53158634e-07F,
+	4.82607447e-07F, 5.13970008e-07F, 5.47370632e-07F, 5.8294188e-07F, 6.20824721e-07F, 6.61169395e-07F,
+	7.04135914e-07F, 7.49894639e-07F, 7.98627013e-07F, 8.50526305e-07F, 9.05798288e-07F, 9.64662149e-07F,
+	1.02735135e-06F, 1.0941144e-06F, 1.16521608e-06F, 1.24093845e-06F, 1.32158164e-06F, 1.40746545e-06F,
+	1.49893049e-06F, 1.59633942e-06F, 1.70007854e-06F, 1.81055918e-06F, 1.92821949e-06F, 2.05352603e-06F,
+	2.18697573e-06F, 2.3290977e-06F, 2.48045581e-06F, 2.64164964e-06F, 2.81331904e-06F, 2.9961443e-06F,
+	3.19085052e-06F, 3.39821008e-06F, 3.61904495e-06F, 3.85423073e-06F, 4.10470057e-06F, 4.37144718e-06F,
+	4.6555283e-06F, 4.9580708e-06F, 5.28027385e-06F, 5.6234162e-06F, 5.98885708e-06F, 6.37804669e-06F,
+	6.79252844e-06F, 7.23394533e-06F, 7.70404768e-06F, 8.20469995e-06F, 8.73788758e-06F, 9.30572514e-06F,
+	9.91046363e-06F, 1.05545014e-05F, 1.12403923e-05F, 1.19708557e-05F, 1.27487892e-05F, 1.3577278e-05F,
+	1.44596061e-05F, 1.53992714e-05F, 1.64000048e-05F, 1.74657689e-05F, 1.86007928e-05F, 1.98095768e-05F,
+	2.10969138e-05F, 2.24679115e-05F, 2.39280016e-05F, 2.54829774e-05F, 2.71390054e-05F, 2.89026502e-05F,
+	3.07809096e-05F, 3.27812268e-05F, 3.49115326e-05F, 3.71802817e-05F, 3.95964671e-05F, 4.21696677e-05F,
+	4.49100917e-05F, 4.7828602e-05F, 5.09367746e-05F, 5.42469315e-05F, 5.77722021e-05F, 6.15265672e-05F,
+	6.55249096e-05F, 6.97830837e-05F, 7.43179844e-05F, 7.91475832e-05F, 8.42910376e-05F, 8.97687496e-05F,
+	9.56024232e-05F, 0.000101815211F, 0.000108431741F, 0.000115478237F, 0.000122982674F, 0.000130974775F,
+	0.000139486248F, 0.000148550855F, 0.000158204537F, 0.000168485552F, 0.00017943469F, 0.000191095358F,
+	0.000203513817F, 0.000216739296F, 0.000230824226F, 0.000245824485F, 0.000261799549F, 0.000278812746F,
+	0.000296931568F, 0.000316227874F, 0.000336778146F, 0.000358663878F, 0.000381971884F, 0.00040679457F,
+	0.000433230365F, 0.000461384101F, 0.000491367478F, 0.00052329927F, 0.000557306223F, 0.000593523087F,
+	0.000632093579F, 0.000673170609F, 0.000716916984F, 0.000763506279F, 0.000813123246F, 0.000865964568F,
+	0.000922239851F, 0.000982172205F, 0.00104599923F, 0.00111397426F, 0.00118636654F, 0.00126346329F,
+	0.0013455702F, 0.00143301289F, 0.00152613816F, 0.00162531529F, 0.00173093739F, 0.00184342347F,
+	0.00196321961F, 0.00209080055F, 0.0022266726F, 0.00237137428F, 0.00252547953F, 0.00268959929F,
+	0.00286438479F, 0.0030505287F, 0.00324876909F, 0.00345989247F, 0.00368473586F, 0.00392419053F,
+	0.00417920668F, 0.00445079478F, 0.00474003283F, 0.00504806684F, 0.0053761187F, 0.005725489F,
+	0.00609756354F, 0.00649381755F, 0.00691582263F, 0.00736525143F, 0.00784388743F, 0.00835362729F,
+	0.00889649242F, 0.00947463699F, 0.010090352F, 0.0107460804F, 0.0114444206F, 0.012188144F,
+	0.0129801976F, 0.0138237253F, 0.0147220679F, 0.0156787913F, 0.0166976862F, 0.0177827962F,
+	0.0189384222F, 0.0201691482F, 0.0214798544F, 0.0228757355F, 0.0243623294F, 0.0259455312F,
+	0.0276316181F, 0.0294272769F, 0.0313396268F, 0.0333762504F, 0.0355452262F, 0.0378551558F,
+	0.0403151996F, 0.0429351069F, 0.0457252748F, 0.0486967564F, 0.0518613495F, 0.0552315898F,
+	0.0588208511F, 0.0626433641F, 0.0667142794F, 0.0710497499F, 0.0756669641F, 0.080584228F,
+	0.0858210474F, 0.0913981795F, 0.0973377451F, 0.103663303F, 0.110399932F, 0.117574342F,
+	0.125214979F, 0.133352146F, 0.142018124F, 0.151247263F, 0.161076173F, 0.171543807F,
+	0.182691678F, 0.194564015F, 0.207207873F, 0.220673427F, 0.235014021F, 0.250286549F,
+	0.266551584F, 0.283873618F, 0.302321315F, 0.32196787F, 0.342891127F, 0.365174145F,
+	0.388905197F, 0.414178461F, 0.44109413F, 0.469758898F, 0.50028646F, 0.532797933F,
+	0.567422092F, 0.604296386F, 0.643566966F, 0.685389578F, 0.729930043F, 0.777365029F,
+	0.827882588F, 0.881683052F, 0.938979805F, 1.0F
+};
+
+static inline void VSPU_RenderLine(int32_t n, int32_t x0, int32_t x1, int32_t y0, int32_t y1, float *d)
+{
+	int32_t dy = y1 - y0, adx = x1 - x0, ady = dy < 0 ? -dy : dy, base = dy / adx, sy = dy < 0 ? base - 1 : base + 1;
+	int32_t x = x0, y = y0, err = 0;
+
+	ady -= (base < 0 ? -base : base) * adx;
+	if (n > x1)
+		n = x1;
+	if (x < n)
+		d[x] *= vspu_fromdb[y];
+	while (++x < n) {
+		err += ady;
+		if (err >= adx) {
+			err -= adx;
+			y += sy;
+		} else
+			y += base;
+		d[x] *= vspu_fromdb[y];
+	}
+}
+
+/* multiplies the n lines of 'd' by the floor curve */
+
+static inline void VSPU_Floor1Apply(const VSPU_Floor * f, const int32_t * fit, float *d, int32_t n)
+{
+	int32_t hx = 0, lx = 0, ly = fit[0] * f->multiplier, j, x;
+
+	ly = ly < 0 ? 0 : (ly > 255 ? 255 : ly);
+	for (j = 1; j < f->posts; j++) {
+		int32_t cur = f->order[j], hy = fit[cur] & 0x7fff;
+		if (hy == fit[cur]) {
+			hx = f->x[cur];
+			hy *= f->multiplier;
+			hy = hy < 0 ? 0 : (hy > 255 ? 255 : hy);
+			VSPU_RenderLine(n, lx, hx, ly, hy, d);
+			lx = hx;
+			ly = hy;
+		}
+	}
+	for (x = hx; x < n; x++)
+		d[x] *= vspu_fromdb[ly];
+}
+
+/* mode and window flags, VSPU_NOTAUDIO for a header packet */
+
+static inline int VSPU_DecodeHeader(const VSPU_Setup * s, VSPU_Bits * b, VSPU_Frame * f)
+{
+	int32_t mode;
+
+	if (VSPU_Read(b, 1) != 0)
+		return VSPU_NOTAUDIO;
+	mode = VSPU_Read(b, s->modebits);
+	if (mode < 0 || (uint32_t) mode >= s->modes)
+		return VSPU_INVALID;
+	f->mode = mode;
+	f->W = s->blockflag[mode];
+	f->lW = f->nW = 0;
+	if (f->W) {
+		f->lW = VSPU_Read(b, 1);
+		f->nW = VSPU_Read(b, 1);
+		if (f->nW < 0)
+			return VSPU_INVALID;
+	}
+	f->n = s->blocksize[f->W];
+	return VSPU_OK;
+}
+
+/* the rest of the packet: w->spectrum[c] gets the n/2 lines of every channel, ready for the inverse MDCT */
+
+static inline void VSPU_DecodeSpectrum(const VSPU_Setup * s, VSPU_Bits * b, const VSPU_Frame * f, VSPU_Scratch * w)
+{
+	const VSPU_Mapping *map = VSPU_AT(s, s->mapping, const VSPU_Mapping) + s->mode_mapping[f->mode];
+	const VSPU_Floor *floors = VSPU_AT(s, s->floor, const VSPU_Floor);
+	const VSPU_Residue *residues = VSPU_AT(s, s->residue, const VSPU_Residue);
+	uint32_t half = f->n / 2, c, i;
+	int used[VSPU_MAX_CHANNELS], nonzero[VSPU_MAX_CHANNELS];
+	float *bundle[VSPU_MAX_CHANNELS];
+
+	for (c = 0; c < s->channels; c++) {
+		used[c] = nonzero[c] = VSPU_Floor1Decode(s, &floors[map->floor[map->mux[c]]], b, w->fit[c]);
+		memset(w->spectrum[c], 0, half * sizeof(float));
+	}
+	// coupling needs both vectors once one of them is used
+	for (i = 0; i < map->coupling_steps; i++)
+		if (nonzero[map->magnitude[i]] || nonzero[map->angle[i]])
+			nonzero[map->magnitude[i]] = nonzero[map->angle[i]] = 1;
+
+	for (i = 0; i < map->submaps; i++) {
+		const VSPU_Residue *r = &residues[map->residue[i]];
+		uint32_t count = 0;
+		int any = 0;
+
+		for (c = 0; c < s->channels; c++)
+			if (map->mux[c] == i) {
+				// type 2 decodes the whole bundle, types 0 and 1 only the used vectors
+				any |= nonzero[c];
+				if (r->type == 2 || nonzero[c])
+					bundle[count++] = w->spectrum[c];
+			}
+		if (count && any)
+			VSPU_ResidueDecode(s, r, b, bundle, count, half, w);
+	}
+
+	for (i = map->coupling_steps; i-- > 0;)
+		VSPU_Decouple(w->spectrum[map->magnitude[i]], w->spectrum[map->angle[i]], half);
+
+	for (c = 0; c < s->channels; c++)
+		if (used[c])
+			VSPU_Floor1Apply(&floors[map->floor[map->mux[c]]], w->fit[c], w->spectrum[c], (int32_t) half);
+		else
+			memset(w->spectrum[c], 0, half * sizeof(float));
+}
+
+#ifdef __SPU__
+
+static VSPU_Command vspu_cmd;
+static uint8_t vspu_setup[VSPU_MAX_SETUP] __attribute__((aligned(128)));
+static uint32_t vspu_setup_id;		// of the setup in vspu_setup, 0: none
+static uint8_t vspu_packet[VSPU_MAX_PACKET + 32] __attribute__((aligned(128)));
+static VSPU_Scratch vspu_scratch __attribute__((aligned(128)));
+static VSPU_Tables vspu_tables[2] __attribute__((aligned(128)));	// short and long blocksize
+static float vspu_block[2][VSPU_MAX_BLOCK] __attribute__((aligned(128)));
+static float vspu_work[VSPU_MAX_BLOCK / 2] __attribute__((aligned(128)));
+static int16_t vspu_pcm[VSPU_MAX_BLOCK / 2 * VSPU_MAX_CHANNELS] __attribute__((aligned(128)));
+
+static inline void VSPU_Dma(void *ls, uint64_t ea, uint32_t size, uint32_t tag, int put)
+{
+	while (size) {
+		uint32_t n = size > 16384 ? 16384 : size;
+		if (put)
+			mfc_put(ls, ea, n, tag, 0, 0);
+		else
+			mfc_get(ls, ea, n, tag, 0, 0);
+		ls = (char *) ls + n;
+		ea += n;
+		size -= n;
+	}
+}
+
+static inline void VSPU_DmaWait(uint32_t mask)
+{
+	mfc_write_tag_mask(mask);
+	mfc_read_tag_status_all();
+}
+
+static inline const VSPU_Tables *VSPU_GetTables(const VSPU_Setup * s, int32_t W)
+{
+	if (vspu_tables[W].n != s->blocksize[W])
+		VSPU_BuildTables(&vspu_tables[W], s->blocksize[W]);
+	return &vspu_tables[W];
+}
+
+static inline int32_t VSPU_SpuPacket(void)
+{
+	const VSPU_Setup *s = (const VSPU_Setup *) vspu_setup;
+	uint32_t skew = (uint32_t) vspu_cmd.packet & 15, c, frames = 0;
+	const VSPU_Tables *t, *lt, *rt;
+	VSPU_Frame f;
+	VSPU_Bits b;
+	int ret;
+
+	if (vspu_cmd.setup_size > VSPU_MAX_SETUP || vspu_cmd.bytes > VSPU_MAX_PACKET)
+		return VSPU_INVALID;
+	if (vspu_cmd.setup_id != vspu_setup_id) {
+		VSPU_Dma(vspu_setup, vspu_cmd.setup, (vspu_cmd.setup_size + 15) & ~15, 1, 0);
+		vspu_setup_id = vspu_cmd.setup_id;
+	}
+	VSPU_Dma(vspu_packet, vspu_cmd.packet - skew, (vspu_cmd.bytes + skew + 15) & ~15, 1, 0);
+	VSPU_DmaWait(1 << 1);
+	memset(vspu_packet + skew + vspu_cmd.bytes, 0, 8);
+
+	b.data = vspu_packet + skew;
+	b.pos = 0;
+	b.end = vspu_cmd.bytes * 8;
+	ret = VSPU_DecodeHeader(s, &b, &f);
+	if (ret != VSPU_OK)
+		return ret;
+	VSPU_DecodeSpectrum(s, &b, &f, &vspu_scratch);
+	t = VSPU_GetTables(s, f.W);
+
+	if (vspu_cmd.cmd == VSPU_CMD_BLOCK) {
+		// channel c goes out of one buffer while c + 1 is transformed in the other
+		for (c = 0; c < s->channels; c++) {
+			float *y = vspu_block[c & 1];
+			VSPU_DmaWait(1 << (2 + (c & 1)));
+			VSPU_InverseMDCT(t, vspu_scratch.spectrum[c], y, vspu_work);
+			VSPU_Dma(y, vspu_cmd.out[c], f.n * sizeof(float), 2 + (c & 1), 1);
+		}
+		VSPU_DmaWait(3 << 2);
+		return (int32_t) f.n;
+	}
+
+	lt = VSPU_GetTables(s, f.W ? f.lW : 0);
+	rt = VSPU_GetTables(s, f.W ? f.nW : 0);
+	for (c = 0; c < s->channels; c++) {
+		// the previous block comes in while this one is transformed
+		if (vspu_cmd.pn)
+			VSPU_Dma(vspu_block[1], vspu_cmd.state + c * VSPU_MAX_BLOCK * sizeof(float), vspu_cmd.pn * sizeof(float), 4, 0);
+		VSPU_InverseMDCT(t, vspu_scratch.spectrum[c], vspu_block[0], vspu_work);
+		VSPU_Window(vspu_block[0], f.n, lt->n, rt->n, lt, rt);
+		VSPU_DmaWait(1 << 4);
+		frames = VSPU_OverlapAdd(vspu_block[1], vspu_cmd.pn, vspu_block[0], f.n, vspu_pcm, c, s->channels);
+		VSPU_Dma(vspu_block[0], vspu_cmd.state + c * VSPU_MAX_BLOCK * sizeof(float), f.n * sizeof(float), 4, 1);
+		VSPU_DmaWait(1 << 4);
+	}
+	if (frames) {
+		VSPU_Dma(vspu_pcm, vspu_cmd.out[0], (frames * s->channels * sizeof(int16_t) + 15) & ~15, 5, 1);
+		VSPU_DmaWait(1 << 5);
+	}
+	vspu_cmd.pn = f.n;
+	return (int32_t) frames;
+}
+
+static inline int VSPU_SpuMain(uint64_t ctx)
+{
+	spu_write_decrementer(0xffffffff);
+	for (;;) {
+		uint32_t start;
+
+		spu_read_in_mbox();
+		VSPU_Dma(&vspu_cmd, ctx, sizeof(vspu_cmd), 0, 0);
+		VSPU_DmaWait(1);
+		if (vspu_cmd.cmd == VSPU_CMD_QUIT)
+			break;
+		start = spu_read_decrementer();
+		vspu_cmd.result = VSPU_SpuPacket();
+		vspu_cmd.ticks = start - spu_read_decrementer();
+		vspu_cmd.done = vspu_cmd.seq;
+		VSPU_Dma(&vspu_cmd, ctx, sizeof(vspu_cmd), 0, 1);
+		VSPU_DmaWait(1);
+		// after the put: the PPU sees 'done' and the result once the event arrives
+		spu_thread_send_event(VSPU_SPU_PORT, vspu_cmd.seq & EVENT_DATA0_MASK, 0);
+	}
+	spu_thread_exit(0);
+	return 0;
+}
+
+#else
+
+typedef struct {
+	VSPU_Command cmd;			// first, 128 byte aligned
+	float prev[VSPU_MAX_CHANNELS][VSPU_MAX_BLOCK] __attribute__((aligned(128)));
+	float block[VSPU_MAX_BLOCK] __attribute__((aligned(16)));
+	float work[VSPU_MAX_BLOCK / 2] __attribute__((aligned(16)));
+	VSPU_Scratch scratch;
+	VSPU_Tables tables[2];
+	uint8_t *packet;			// padded copy of the packet on the PPU path
+	uint32_t packet_size;
+	int result;					// of a packet decoded on the PPU
+	int on_spu;
+	int events;					// completion events not received yet
+#ifdef __PPU__
+	sysSpuImage image;
+	sys_spu_group_t group;
+	sys_spu_thread_t thread;
+	sys_event_queue_t queue;
+	sys_lwmutex_t lock;			// the libvorbis hook can be entered from several threads
+#endif
+} __attribute__((aligned(128))) VSPU_Decoder;
+
+/*------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+/* VSPU_Setup *VSPU_NewSetup(const void *ident, uint32_t ident_bytes, const void *setup, uint32_t setup_bytes);
+
+Parses the identification and the setup header packets of a stream. Returns NULL when they are invalid or
+the stream is not covered (see above). Free it with VSPU_DeleteSetup() once no packet of it is in flight.
+
+*/
+
+VSPU_Setup *VSPU_NewSetup(const void *ident, uint32_t ident_bytes, const void *setup, uint32_t setup_bytes);
+
+void VSPU_DeleteSetup(VSPU_Setup * s);
+
+/* VSPU_Decoder *VSPU_New(const void *spu_elf);
+
+Creates a decoder. With spu_elf (the program built around VSPU_SpuMain) the packets are decoded on an SPU
+thread, with NULL (or off the console) on the calling thread.
+
+*/
+
+VSPU_Decoder *VSPU_New(const void *spu_elf);
+
+/* int VSPU_Submit(VSPU_Decoder *d, const VSPU_Setup *s, const void *packet, uint32_t bytes, int16_t *pcm);
+
+Starts the decode of one audio packet to interleaved 16 bit PCM and returns. pcm (16 byte aligned, room for
+VSPU_MAX_BLOCK / 2 frames) and the packet stay untouched until VSPU_Wait(). A previous packet is waited for
+first. Off the SPU the work is done before returning.
+
+*/
+
+int VSPU_Submit(VSPU_Decoder * d, const VSPU_Setup * s, const void *packet, uint32_t bytes, int16_t * pcm);
+
+/* 1 when the last packet completed (or there is none), 0 while the SPU is busy */
+
+int VSPU_Poll(VSPU_Decoder * d);
+
+/* sleeps on the completion event of the last packet, returns the PCM frames it produced (0 for the first
+packet of a stream), VSPU_NOTAUDIO for a header packet or VSPU_INVALID */
+
+int VSPU_Wait(VSPU_Decoder * d);
+
+/* VSPU_Submit() followed by VSPU_Wait() */
+
+int VSPU_Synthesis(VSPU_Decoder * d, const VSPU_Setup * s, const void *packet, uint32_t bytes, int16_t * pcm);
+
+/* int VSPU_Block(VSPU_Decoder *d, const VSPU_Setup *s, const void *packet, uint32_t bytes, float **out);
+
+Decodes one audio packet up to the inverse MDCT, out[c] (16 byte aligned) gets the n samples of channel c, not
+windowed (what libvorbis leaves in vorbis_block.pcm). Returns the blocksize n, VSPU_NOTAUDIO or VSPU_INVALID.
+Does not touch the overlap state of VSPU_Synthesis().
+
+*/
+
+int VSPU_Block(VSPU_Decoder * d, const VSPU_Setup * s, const void *packet, uint32_t bytes, float **out);
+
+/* void VSPU_Attach(VSPU_Decoder *d);
+
+Decodes the packets of the libvorbis streams on 'd' (see the link flags above), NULL goes back to libvorbis.
+While it is attached, use the decoder only through libvorbis.
+
+*/
+
+void VSPU_Attach(VSPU_Decoder * d);
+
+/* forget the previous block, after a seek */
+
+void VSPU_Reset(VSPU_Decoder * d);
+
+/* SPU decrementer ticks of the last packet, 0 on the PPU */
+
+static inline uint32_t VSPU_Ticks(const VSPU_Decoder * d)
+{
+	return d->cmd.ticks;
+}
+
+void VSPU_Delete(VSPU_Decoder * d);
+
+#ifdef VSPU_IMPLEMENTATION
+
+/* setup header parser, libvorbis 1.3 rules; anything it does not take is left to libvorbis */
+
+typedef struct {
+	uint8_t *data;		// VSPU_MAX_SETUP bytes, allocated once so the parser may keep pointers into it
+	uint32_t size;
+	int failed;
+} vspu_blob;
+
+static uint32_t vspu_ids;
+
+/* zeroed room for 'bytes' at a 16 byte aligned offset */
+static uint32_t vspu_blob_add(vspu_blob * bl, uint32_t bytes)
+{
+	uint32_t at = (bl->size + 15) & ~15;
+
+	if (bl->failed || bytes > VSPU_MAX_SETUP - at) {
+		bl->failed = 1;
+		return 0;
+	}
+	bl->size = at + bytes;
+	return at;
+}
+
+static int vspu_ilog(uint32_t v)
+{
+	int ret = 0;
+
+	while (v) {
+		ret++;
+		v >>= 1;
+	}
+	return ret;
+}
+
+static uint32_t vspu_read32(VSPU_Bits * b)
+{
+	uint32_t lo = (uint32_t) VSPU_Read(b, 16);
+
+	return (lo & 0xffff) | (uint32_t) VSPU_Read(b, 16) << 16;
+}
+
+static float vspu_float32(uint32_t v)
+{
+	double mant = v & 0x1fffff;
+	int32_t exp = (int32_t) ((v & 0x7fe00000) >> 21);
+
+	if (v & 0x80000000)
+		mant = -mant;
+	return (float) ldexp(mant, exp - 20 - 768);
+}
+
+/* the largest v with v^dim <= entries */
+static uint32_t vspu_quantvals(uint32_t entries, uint32_t dim)
+{
+	uint32_t v = (uint32_t) floor(pow((float) entries, 1.0f / dim)), i;
+
+	for (;;) {
+		uint64_t acc = 1, acc1 = 1;
+		for (i = 0; i < dim && acc1 <= entries; i++) {
+			acc *= v;
+			acc1 *= v + 1;
+		}
+		if (acc <= entries && acc1 > entries)
+			return v;
+		if (acc > entries)
+			v--;
+		else
+			v++;
+	}
+}
+
+typedef struct {
+	uint32_t code, entry;
+	uint8_t length;
+} vspu_word;
+
+static int vspu_word_cmp(const void *a, const void *b)
+{
+	uint32_t x = ((const vspu_word *) a)->code, y = ((const vspu_word *) b)->code;
+
+	return x < y ? -1 : x > y;
+}
+
+/* codewords in entry order as the specification assigns them; -1 for an over or underfull tree */
+static int vspu_make_words(const uint8_t * len, uint32_t entries, uint32_t used, vspu_word * words)
+{
+	uint32_t marker[33], i, j, count = 0;
+
+	memset(marker, 0, sizeof(marker));
+	for (i = 0; i < entries; i++) {
+		uint32_t length = len[i], entry;
+		if (!length)
+			continue;
+		entry = marker[length];
+		if (length < 32 && (entry >> length))
+			return -1;
+		words[count].code = length < 32 ? entry << (32 - length) : entry;
+		words[count].entry = i;
+		words[count++].length = (uint8_t) length;
+		for (j = length; j > 0; j--) {
+			if (marker[j] & 1) {
+				if (j == 1)
+					marker[1]++;
+				else
+					marker[j] = marker[j - 1] << 1;
+				break;
+			}
+			marker[j]++;
+		}
+		for (j = length + 1; j < 33; j++) {
+			if ((marker[j] >> 1) != entry)
+				break;
+			entry = marker[j];
+			marker[j] = marker[j - 1] << 1;
+		}
+	}
+	if (used != 1)
+		for (i = 1; i < 33; i++)
+			if (marker[i] & (0xffffffffu >> (32 - i)))
+				return -1;
+	return 0;
+}
+
+static int vspu_parse_book(vspu_blob * bl, uint32_t index, VSPU_Bits * b)
+{
+	uint32_t dim, entries, used = 0, lookup, i, k, quantvals = 0, maxlen = 0, at;
+	uint8_t *len = NULL;
+	uint32_t *quant = NULL;
+	vspu_word *words = NULL;
+	float mindel = 0.0f, delta = 0.0f;
+	int seq = 0, ret = -1;
+	VSPU_Book *book;
+
+	if (VSPU_Read(b, 24) != 0x564342)
+		return -1;
+	dim = (uint32_t) VSPU_Read(b, 16);
+	entries = (uint32_t) VSPU_Read(b, 24);
+	if (b->pos > b->end || !dim || !entries || entries > 65535 || vspu_ilog(dim) + vspu_ilog(entries) > 24)
+		return -1;
+	len = (uint8_t *) malloc(entries);
+	if (!len)
+		return -1;
+
+	if (VSPU_Read(b, 1) == 0) {
+		int sparse = VSPU_Read(b, 1);
+		for (i = 0; i < entries; i++)
+			len[i] = !sparse || VSPU_Read(b, 1) == 1 ? (uint8_t) (VSPU_Read(b, 5) + 1) : 0;
+	} else {
+		uint32_t length = (uint32_t) VSPU_Read(b, 5) + 1, cur = 0;
+		while (cur < entries && b->pos <= b->end) {
+			int32_t num = VSPU_Read(b, vspu_ilog(entries - cur));
+			if (num < 0 || cur + num > entries || length > 32)
+				goto out;
+			memset(len + cur, (int) length, num);
+			cur += num;
+			length++;
+		}
+	}
+	lookup = (uint32_t) VSPU_Read(b, 4);
+	if (b->pos > b->end || lookup > 2)
+		goto out;
+	if (lookup) {
+		uint32_t vbits;
+		mindel = vspu_float32(vspu_read32(b));
+		delta = vspu_float32(vspu_read32(b));
+		vbits = (uint32_t) VSPU_Read(b, 4) + 1;
+		seq = VSPU_Read(b, 1);
+		quantvals = lookup == 1 ? vspu_quantvals(entries, dim) : entries * dim;
+		quant = (uint32_t *) malloc(quantvals * sizeof(uint32_t));
+		if (!quant)
+			goto out;
+		for (i = 0; i < quantvals; i++)
+			quant[i] = (uint32_t) VSPU_Read(b, vbits);
+	}
+	if (b->pos > b->end)
+		goto out;
+
+	for (i = 0; i < entries; i++)
+		if (len[i]) {
+			used++;
+			if (len[i] > maxlen)
+				maxlen = len[i];
+		}
+	words = (vspu_word *) malloc((used ? used : 1) * sizeof(vspu_word));
+	if (!words || vspu_make_words(len, entries, used, words) < 0)
+		goto out;
+	qsort(words, used, sizeof(vspu_word), vspu_word_cmp);
+
+	at = vspu_blob_add(bl, used * sizeof(uint32_t));
+	k = vspu_blob_add(bl, used);
+	i = vspu_blob_add(bl, used * sizeof(uint16_t));
+	if (bl->failed)
+		goto out;
+	book = VSPU_AT(bl->data, VSPU_AT(bl->data, 0, VSPU_Setup)->book, VSPU_Book) + index;
+	book->used = used;
+	book->dim = (uint16_t) dim;
+	book->maxlen = (uint8_t) maxlen;
+	book->codes = at;
+	book->lengths = k;
+	book->entry = i;
+	for (i = 0; i < used; i++) {
+		VSPU_AT(bl->data, book->codes, uint32_t)[i] = words[i].code;
+		VSPU_AT(bl->data, book->lengths, uint8_t)[i] = words[i].length;
+		VSPU_AT(bl->data, book->entry, uint16_t)[i] = (uint16_t) words[i].entry;
+	}
+
+	if (lookup == 1 && !seq && quantvals <= 256) {
+		// the usual residue book: one byte per element, the floats once per multiplicand
+		float *values;
+		uint8_t *index;
+		at = vspu_blob_add(bl, quantvals * sizeof(float));
+		k = vspu_blob_add(bl, used * dim);
+		if (bl->failed)
+			goto out;
+		book->vq = 1;
+		book->values = at;
+		book->index = k;
+		values = VSPU_AT(bl->data, at, float);
+		index = VSPU_AT(bl->data, k, uint8_t);
+		for (i = 0; i < quantvals; i++)
+			values[i] = (float) (fabs((double) quant[i]) * delta + mindel);
+		for (i = 0; i < used; i++) {
+			uint32_t e = words[i].entry;
+			for (k = 0; k < dim; k++) {
+				index[i * dim + k] = (uint8_t) (e % quantvals);
+				e /= quantvals;
+			}
+		}
+	} else if (lookup) {
+		float *values;
+		at = vspu_blob_add(bl, used * dim * sizeof(float));
+		if (bl->failed)
+			goto out;
+		book->vq = 1;
+		book->values = at;
+		values = VSPU_AT(bl->data, at, float);
+		// as libvorbis unquantizes: in double, rounded to float once per value
+		for (i = 0; i < used; i++) {
+			uint32_t e = words[i].entry, div = 1;
+			float last = 0.0f;
+			for (k = 0; k < dim; k++) {
+				uint32_t q = lookup == 1 ? quant[(e / div) % quantvals] : quant[e * dim + k];
+				float val = (float) (fabs((double) q) * delta + mindel + last);
+				if (seq)
+					last = val;
+				values[i * dim + k] = val;
+				div *= quantvals;
+			}
+		}
+	}
+	ret = 0;
+  out:
+	free(words);
+	free(quant);
+	free(len);
+	return ret;
+}
+
+static int vspu_parse_floor(VSPU_Floor * f, uint32_t books, VSPU_Bits * b)
+{
+	int32_t maxclass = -1;
+	uint32_t i, j, k;
+
+	f->partitions = (uint8_t) VSPU_Read(b, 5);
+	for (i = 0; i < f->partitions; i++) {
+		f->partition_class[i] = (uint8_t) VSPU_Read(b, 4);
+		if (f->partition_class[i] > maxclass)
+			maxclass = f->partition_class[i];
+	}
+	for (i = 0; (int32_t) i <= maxclass; i++) {
+		f->class_dim[i] = (uint8_t) (VSPU_Read(b, 3) + 1);
+		f->class_subs[i] = (uint8_t) VSPU_Read(b, 2);
+		if (f->class_subs[i]) {
+			f->class_book[i] = (uint8_t) VSPU_Read(b, 8);
+			if (f->class_book[i] >= books)
+				return -1;
+		}
+		for (j = 0; j < (1u << f->class_subs[i]); j++) {
+			f->subbook[i][j] = (int16_t) (VSPU_Read(b, 8) - 1);
+			if (f->subbook[i][j] >= (int32_t) books)
+				return -1;
+		}
+	}
+	f->multiplier = (uint8_t) (VSPU_Read(b, 2) + 1);
+	f->rangebits = (uint8_t) VSPU_Read(b, 4);
+	if (b->pos > b->end)
+		return -1;
+	f->x[0] = 0;
+	f->x[1] = (uint16_t) (1 << f->rangebits);
+	f->posts = 2;
+	for (i = 0; i < f->partitions; i++)
+		for (j = 0; j < f->class_dim[f->partition_class[i]]; j++) {
+			if (f->posts >= VSPU_MAX_POSTS)
+				return -1;
+			f->x[f->posts++] = (uint16_t) VSPU_Read(b, f->rangebits);
+		}
+	if (b->pos > b->end)
+		return -1;
+
+	// the neighbours of every post among the posts before it, and the posts in x order
+	for (i = 2; i < f->posts; i++) {
+		uint32_t lo = 0, hi = 1, lx = 0, hx = f->x[1];
+		for (j = 0; j < i; j++) {
+			if (f->x[j] > lx && f->x[j] < f->x[i]) {
+				lo = j;
+				lx = f->x[j];
+			}
+			if (f->x[j] < hx && f->x[j] > f->x[i]) {
+				hi = j;
+				hx = f->x[j];
+			}
+		}
+		f->lo[i] = (uint8_t) lo;
+		f->hi[i] = (uint8_t) hi;
+	}
+	for (i = 0; i < f->posts; i++) {
+		for (j = i; j > 0 && f->x[f->order[j - 1]] > f->x[i]; j--)
+			f->order[j] = f->order[j - 1];
+		f->order[j] = (uint8_t) i;
+	}
+	for (k = 1; k < f->posts; k++)
+		if (f->x[f->order[k]] == f->x[f->order[k - 1]])
+			return -1;
+	return 0;
+}
+
+static int vspu_parse_residue(vspu_blob * bl, uint32_t index, uint32_t type, const VSPU_Setup * hdr, VSPU_Bits * b)
+{
+	uint32_t cascade[64], i, j, at, map, dim, partvals = 1, len;
+	const VSPU_Book *books;
+	VSPU_Residue *r;
+	int16_t *stage;
+	uint8_t *decodemap;
+
+	r = VSPU_AT(bl->data, hdr->residue, VSPU_Residue) + index;
+	r->type = type;
+	r->begin = (uint32_t) VSPU_Read(b, 24);
+	r->end = (uint32_t) VSPU_Read(b, 24);
+	r->grouping = (uint32_t) VSPU_Read(b, 24) + 1;
+	r->classifications = (uint32_t) VSPU_Read(b, 6) + 1;
+	r->classbook = (uint32_t) VSPU_Read(b, 8);
+	if (b->pos > b->end || r->classbook >= hdr->books)
+		return -1;
+	for (i = 0; i < r->classifications; i++) {
+		cascade[i] = (uint32_t) VSPU_Read(b, 3);
+		if (VSPU_Read(b, 1) == 1)
+			cascade[i] |= (uint32_t) VSPU_Read(b, 5) << 3;
+		if (vspu_ilog(cascade[i]) > (int) r->stages)
+			r->stages = vspu_ilog(cascade[i]);
+	}
+	books = VSPU_AT(bl->data, hdr->book, const VSPU_Book);
+	dim = books[r->classbook].dim;
+	for (i = 0; i < dim; i++) {
+		partvals *= r->classifications;
+		if (partvals > 65535)
+			return -1;
+	}
+	r->partvals = partvals;
+
+	// partition words of the longest block, type 2 interleaves the channels
+	len = type == 2 ? hdr->blocksize[1] / 2 * hdr->channels : hdr->blocksize[1] / 2;
+	len = (r->end < len ? r->end : len);
+	if (len > r->begin && ((len - r->begin) / r->grouping + dim - 1) / dim > VSPU_MAX_PARTWORDS)
+		return -1;
+
+	at = vspu_blob_add(bl, r->classifications * 8 * sizeof(int16_t));
+	map = vspu_blob_add(bl, partvals * dim);
+	if (bl->failed)
+		return -1;
+	r->books = at;
+	r->decodemap = map;
+	stage = VSPU_AT(bl->data, at, int16_t);
+	for (i = 0; i < r->classifications; i++)
+		for (j = 0; j < 8; j++) {
+			int32_t book = -1;
+			if (cascade[i] & (1 << j)) {
+				book = VSPU_Read(b, 8);
+				// a stage book needs vectors that tile the partition
+				if (book < 0 || (uint32_t) book >= hdr->books || !books[book].vq || r->grouping % books[book].dim)
+					return -1;
+			}
+			stage[i * 8 + j] = (int16_t) book;
+		}
+	decodemap = VSPU_AT(bl->data, map, uint8_t);
+	for (i = 0; i < partvals; i++) {
+		uint32_t val = i, mult = partvals / r->classifications;
+		for (j = 0; j < dim; j++) {
+			decodemap[i * dim + j] = (uint8_t) (val / mult);
+			val %= mult;
+			mult /= r->classifications;
+		}
+	}
+	return b->pos > b->end ? -1 : 0;
+}
+
+static int vspu_parse_mapping(VSPU_Mapping * m, const VSPU_Setup * hdr, VSPU_Bits * b)
+{
+	uint32_t i, bits = vspu_ilog(hdr->channels - 1);
+
+	if (VSPU_Read(b, 16) != 0)
+		return -1;
+	m->submaps = (uint8_t) (VSPU_Read(b, 1) == 1 ? VSPU_Read(b, 4) + 1 : 1);
+	if (VSPU_Read(b, 1) == 1) {
+		uint32_t steps = (uint32_t) VSPU_Read(b, 8) + 1;
+		if (steps > VSPU_MAX_COUPLING)
+			return -1;
+		m->coupling_steps = (uint8_t) steps;
+		for (i = 0; i < steps; i++) {
+			int32_t mag = VSPU_Read(b, bits), ang = VSPU_Read(b, bits);
+			if (mag < 0 || ang < 0 || mag == ang || (uint32_t) mag >= hdr->channels || (uint32_t) ang >= hdr->channels)
+				return -1;
+			m->magnitude[i] = (uint8_t) mag;
+			m->angle[i] = (uint8_t) ang;
+		}
+	}
+	if (VSPU_Read(b, 2) != 0)
+		return -1;
+	for (i = 0; i < hdr->channels; i++) {
+		m->mux[i] = (uint8_t) (m->submaps > 1 ? VSPU_Read(b, 4) : 0);
+		if (m->mux[i] >= m->submaps)
+			return -1;
+	}
+	for (i = 0; i < m->submaps; i++) {
+		VSPU_Read(b, 8);
+		m->floor[i] = (uint8_t) VSPU_Read(b, 8);
+		m->residue[i] = (uint8_t) VSPU_Read(b, 8);
+		if (m->floor[i] >= hdr->floors || m->residue[i] >= hdr->residues)
+			return -1;
+	}
+	return b->pos > b->end ? -1 : 0;
+}
+
+static VSPU_Setup *vspu_parse_setup(uint32_t channels, uint32_t rate, uint32_t bs0, uint32_t bs1, const uint8_t * packet, uint32_t bytes)
+{
+	vspu_blob bl = { NULL, 0, 0 };
+	VSPU_Setup *s = NULL;
+	uint8_t *copy;
+	VSPU_Bits b;
+	uint32_t i, count, at;
+
+	if (channels < 1 || channels > VSPU_MAX_CHANNELS || bs0 < 64 || bs1 < bs0 || bs1 > VSPU_MAX_BLOCK || bytes < 7 || packet[0] != 5 ||
+	    memcmp(packet + 1, "vorbis", 6))
+		return NULL;
+	copy = (uint8_t *) calloc(bytes + 8, 1);
+	bl.data = (uint8_t *) calloc(VSPU_MAX_SETUP, 1);
+	if (!copy || !bl.data)
+		goto fail;
+	memcpy(copy, packet, bytes);
+	b.data = copy + 7;
+	b.pos = 0;
+	b.end = (bytes - 7) * 8;
+
+	// header first, the arrays follow as their counts are read
+	vspu_blob_add(&bl, sizeof(VSPU_Setup));
+#define HDR VSPU_AT(bl.data, 0, VSPU_Setup)
+	HDR->channels = channels;
+	HDR->rate = rate;
+	HDR->blocksize[0] = bs0;
+	HDR->blocksize[1] = bs1;
+
+	HDR->books = (uint32_t) VSPU_Read(&b, 8) + 1;
+	at = vspu_blob_add(&bl, HDR->books * sizeof(VSPU_Book));
+	if (bl.failed)
+		goto fail;
+	HDR->book = at;
+	for (i = 0; i < HDR->books; i++)
+		if (vspu_parse_book(&bl, i, &b) < 0)
+			goto fail;
+
+	// time domain transforms, placeholders
+	count = (uint32_t) VSPU_Read(&b, 6) + 1;
+	for (i = 0; i < count; i++)
+		if (VSPU_Read(&b, 16) != 0)
+			goto fail;
+
+	HDR->floors = (uint32_t) VSPU_Read(&b, 6) + 1;
+	at = vspu_blob_add(&bl, HDR->floors * sizeof(VSPU_Floor));
+	if (bl.failed)
+		goto fail;
+	HDR->floor = at;
+	for (i = 0; i < HDR->floors; i++)
+		if (VSPU_Read(&b, 16) != 1 || vspu_parse_floor(VSPU_AT(bl.data, HDR->floor, VSPU_Floor) + i, HDR->books, &b) < 0)
+			goto fail;
+
+	HDR->residues = (uint32_t) VSPU_Read(&b, 6) + 1;
+	at = vspu_blob_add(&bl, HDR->residues * sizeof(VSPU_Residue));
+	if (bl.failed)
+		goto fail;
+	HDR->residue = at;
+	for (i = 0; i < HDR->residues; i++) {
+		int32_t type = VSPU_Read(&b, 16);
+		if (type < 0 || type > 2 || vspu_parse_residue(&bl, i, (uint32_t) type, HDR, &b) < 0)
+			goto fail;
+	}
+
+	HDR->mappings = (uint32_t) VSPU_Read(&b, 6) + 1;
+	at = vspu_blob_add(&bl, HDR->mappings * sizeof(VSPU_Mapping));
+	if (bl.failed)
+		goto fail;
+	HDR->mapping = at;
+	for (i = 0; i < HDR->mappings; i++)
+		if (vspu_parse_mapping(VSPU_AT(bl.data, HDR->mapping, VSPU_Mapping) + i, HDR, &b) < 0)
+			goto fail;
+
+	HDR->modes = (uint32_t) VSPU_Read(&b, 6) + 1;
+	HDR->modebits = vspu_ilog(HDR->modes - 1);
+	for (i = 0; i < HDR->modes; i++) {
+		HDR->blockflag[i] = (uint8_t) VSPU_Read(&b, 1);
+		if (VSPU_Read(&b, 16) != 0 || VSPU_Read(&b, 16) != 0)
+			goto fail;
+		HDR->mode_mapping[i] = (uint8_t) VSPU_Read(&b, 8);
+		if (HDR->mode_mapping[i] >= HDR->mappings)
+			goto fail;
+	}
+	if (VSPU_Read(&b, 1) != 1)
+		goto fail;
+
+	// one 128 byte aligned block, the SPU takes it with a single DMA list
+#ifdef __PPU__
+	s = (VSPU_Setup *) memalign(128, (bl.size + 127) & ~127);
+#else
+	if (posix_memalign((void **) &s, 128, (bl.size + 127) & ~127))
+		s = NULL;
+#endif
+	if (s) {
+		HDR->size = bl.size;
+		HDR->id = ++vspu_ids ? vspu_ids : ++vspu_ids;
+		memcpy(s, bl.data, bl.size);
+	}
+#undef HDR
+  fail:
+	free(bl.data);
+	free(copy);
+	return s;
+}
+
+VSPU_Setup *VSPU_NewSetup(const void *ident, uint32_t ident_bytes, const void *setup, uint32_t setup_bytes)
+{
+	const uint8_t *id = (const uint8_t *) ident;
+
+	// type, "vorbis", version, channels, rate, 3 bitrates, blocksizes, framing
+	if (!id || ident_bytes < 30 || id[0] != 1 || memcmp(id + 1, "vorbis", 6) || id[7] | id[8] | id[9] | id[10] || !(id[29] & 1))
+		return NULL;
+	return vspu_parse_setup(id[11], id[12] | id[13] << 8 | id[14] << 16 | (uint32_t) id[15] << 24, 1u << (id[28] & 15), 1u << (id[28] >> 4),
+				(const uint8_t *) setup, setup_bytes);
+}
+
+void VSPU_DeleteSetup(VSPU_Setup * s)
+{
+	free(s);
+}
+
+VSPU_Decoder *VSPU_New(const void *spu_elf)
+{
+	VSPU_Decoder *d;
+
+#ifdef __PPU__
+	d = (VSPU_Decoder *) memalign(128, sizeof(VSPU_Decoder));
+#else
+	if (posix_memalign((void **) &d, 128, sizeof(VSPU_Decoder)))
+		d = NULL;
+#endif
+	if (!d)
+		return NULL;
+	memset(d, 0, sizeof(*d));
+
+#ifdef __PPU__
+	{
+		sys_lwmutex_attr_t mattr = { SYS_LWMUTEX_PROTOCOL_FIFO, SYS_LWMUTEX_ATTR_NOT_RECURSIVE, "vorbis" };
+		if (sysLwMutexCreate(&d->lock, &mattr)) {
+			free(d);
+			return NULL;
+		}
+	}
+	if (spu_elf) {
+		sysSpuThreadGroupAttribute gattr = { sizeof("Vorbis SPU"), (u32) (u64) "Vorbis SPU", 0, 0 };
+		sysSpuThreadAttribute attr = { (u32) (u64) "Vorbis SPU", sizeof("Vorbis SPU"), SPU_THREAD_ATTR_NONE };
+		sysSpuThreadArgument arg = { (u64) & d->cmd, 0, 0, 0 };
+		sys_event_queue_attr_t qattr = { SYS_EVENT_QUEUE_FIFO, SYS_EVENT_QUEUE_PPU, "vorbis" };
+
+		if (sysEventQueueCreate(&d->queue, &qattr, SYS_EVENT_QUEUE_KEY_LOCAL, 4) == 0) {
+			if (sysSpuImageImport(&d->image, spu_elf, SPU_IMAGE_PROTECT) == 0) {
+				if (sysSpuThreadGroupCreate(&d->group, 1, 100, &gattr) == 0) {
+					if (sysSpuThreadInitialize(&d->thread, d->group, 0, &d->image, &attr, &arg) == 0 &&
+					    sysSpuThreadConnectEvent(d->thread, d->queue, SPU_THREAD_EVENT_USER, VSPU_SPU_PORT) == 0 &&
+					    sysSpuThreadGroupStart(d->group) == 0)
+						d->on_spu = 1;
+					else
+						sysSpuThreadGroupDestroy(d->group);
+				}
+				if (!d->on_spu)
+					sysSpuImageClose(&d->image);
+			}
+			if (!d->on_spu)
+				sysEventQueueDestroy(d->queue, 0);
+		}
+	}
+#else
+	(void) spu_elf;
+#endif
+	return d;
+}
+
+/* the packet on the calling thread, out == NULL: windowed to 16 bit PCM */
+static int vspu_decode(VSPU_Decoder * d, const VSPU_Setup * s, const void *packet, uint32_t bytes, float **out, int16_t * pcm)
+{
+	const VSPU_Tables *t, *lt, *rt;
+	uint32_t c, frames = 0;
+	VSPU_Frame f;
+	VSPU_Bits b;
+	int ret, W;
+
+	// the bit reader looks 4 bytes ahead
+	if (bytes + 8 > d->packet_size) {
+		uint8_t *p = (uint8_t *) realloc(d->packet, bytes + 8);
+		if (!p)
+			return VSPU_INVALID;
+		d->packet = p;
+		d->packet_size = bytes + 8;
+	}
+	memcpy(d->packet, packet, bytes);
+	memset(d->packet + bytes, 0, 8);
+	b.data = d->packet;
+	b.pos = 0;
+	b.end = bytes * 8;
+	ret = VSPU_DecodeHeader(s, &b, &f);
+	if (ret != VSPU_OK)
+		return ret;
+	VSPU_DecodeSpectrum(s, &b, &f, &d->scratch);
+
+	for (W = 0; W < 2; W++)
+		if (d->tables[W].n != s->blocksize[W])
+			VSPU_BuildTables(&d->tables[W], s->blocksize[W]);
+	t = &d->tables[f.W];
+	if (out) {
+		for (c = 0; c < s->channels; c++)
+			VSPU_InverseMDCT(t, d->scratch.spectrum[c], out[c], d->work);
+		return (int) f.n;
+	}
+	lt = &d->tables[f.W ? f.lW : 0];
+	rt = &d->tables[f.W ? f.nW : 0];
+	for (c = 0; c < s->channels; c++) {
+		VSPU_InverseMDCT(t, d->scratch.spectrum[c], d->block, d->work);
+		VSPU_Window(d->block, f.n, lt->n, rt->n, lt, rt);
+		frames = VSPU_OverlapAdd(d->prev[c], d->cmd.pn, d->block, f.n, pcm, c, s->channels);
+		memcpy(d->prev[c], d->block, f.n * sizeof(float));
+	}
+	d->cmd.pn = f.n;
+	return (int) frames;
+}
+
+int VSPU_Poll(VSPU_Decoder * d)
+{
+	return !d->events || d->cmd.done == d->cmd.seq;
+}
+
+int VSPU_Wait(VSPU_Decoder * d)
+{
+#ifdef __PPU__
+	if (d->events) {
+		// one event per packet, sent after the command block is written back
+		while (d->events > 0) {
+			sys_event_t ev;
+			if (sysEventQueueReceive(d->queue, &ev, 0) == 0)
+				d->events--;
+		}
+		__asm__ volatile ("lwsync":::"memory");
+		d->result = d->cmd.result;
+	}
+#endif
+	return d->result;
+}
+
+#ifdef __PPU__
+static void vspu_start(VSPU_Decoder * d, uint32_t cmd, const VSPU_Setup * s, const void *packet, uint32_t bytes, float **out, int16_t * pcm)
+{
+	uint32_t c;
+
+	d->cmd.setup = (u64) s;
+	d->cmd.setup_id = s->id;
+	d->cmd.setup_size = s->size;
+	d->cmd.packet = (u64) packet;
+	d->cmd.bytes = bytes;
+	for (c = 0; c < VSPU_MAX_CHANNELS; c++)
+		d->cmd.out[c] = out ? (u64) out[c < s->channels ? c : 0] : (u64) pcm;
+	d->cmd.state = (u64) d->prev;
+	d->cmd.cmd = cmd;
+	d->cmd.seq++;
+	d->events++;
+	__asm__ volatile ("lwsync":::"memory");
+	sysSpuThreadWriteMb(d->thread, 1);
+}
+#endif
+
+int VSPU_Submit(VSPU_Decoder * d, const VSPU_Setup * s, const void *packet, uint32_t bytes, int16_t * pcm)
+{
+	VSPU_Wait(d);
+	if (!s || !packet || !pcm)
+		return VSPU_INVALID;
+#ifdef __PPU__
+	if (d->on_spu && bytes <= VSPU_MAX_PACKET) {
+		vspu_start(d, VSPU_CMD_PCM, s, packet, bytes, NULL, pcm);
+		return VSPU_OK;
+	}
+#endif
+	d->result = vspu_decode(d, s, packet, bytes, NULL, pcm);
+	return VSPU_OK;
+}
+
+int VSPU_Synthesis(VSPU_Decoder * d, const VSPU_Setup * s, const void *packet, uint32_t bytes, int16_t * pcm)
+{
+	int ret = VSPU_Submit(d, s, packet, bytes, pcm);
+
+	return ret == VSPU_OK ? VSPU_Wait(d) : ret;
+}
+
+int VSPU_Block(VSPU_Decoder * d, const VSPU_Setup * s, const void *packet, uint32_t bytes, float **out)
+{
+	int ret;
+
+	if (!s || !packet || !out)
+		return VSPU_INVALID;
+#ifdef __PPU__
+	sysLwMutexLock(&d->lock, 0);
+	VSPU_Wait(d);
+	if (d->on_spu && bytes <= VSPU_MAX_PACKET) {
+		vspu_start(d, VSPU_CMD_BLOCK, s, packet, bytes, out, NULL);
+		ret = VSPU_Wait(d);
+	} else
+		ret = vspu_decode(d, s, packet, bytes, out, NULL);
+	sysLwMutexUnlock(&d->lock);
+#else
+	ret = vspu_decode(d, s, packet, bytes, out, NULL);
+#endif
+	return ret;
+}
+
+void VSPU_Reset(VSPU_Decoder * d)
+{
+	VSPU_Wait(d);
+	memset(d->prev, 0, sizeof(d->prev));
+	d->cmd.pn = 0;
+}
+
+/* libvorbis hook: vorbis_synthesis() of a known stream is done here, the rest stays in the library */
+
+static VSPU_Decoder *vspu_hook;
+static struct {
+	vorbis_info *volatile vi;
+	VSPU_Setup *volatile setup;
+} vspu_streams[VSPU_STREAMS];
+
+int __real_vorbis_synthesis(vorbis_block * vb, ogg_packet * op) __attribute__((weak));
+int __real_vorbis_synthesis_headerin(vorbis_info * vi, vorbis_comment * vc, ogg_packet * op) __attribute__((weak));
+void __real_vorbis_info_clear(vorbis_info * vi) __attribute__((weak));
+int vorbis_info_blocksize(vorbis_info * vi, int zo) __attribute__((weak));
+void *_vorbis_block_alloc(vorbis_block * vb, long bytes) __attribute__((weak));
+void _vorbis_block_ripcord(vorbis_block * vb) __attribute__((weak));
+
+void VSPU_Attach(VSPU_Decoder * d)
+{
+	vspu_hook = d;
+}
+
+static void vspu_forget(vorbis_info * vi)
+{
+	int i;
+
+	for (i = 0; i < VSPU_STREAMS; i++)
+		if (vspu_streams[i].vi == vi) {
+			VSPU_Setup *s = vspu_streams[i].setup;
+			vspu_streams[i].setup = NULL;
+			vspu_streams[i].vi = NULL;
+			free(s);
+		}
+}
+
+static const VSPU_Setup *vspu_find(vorbis_info * vi)
+{
+	int i;
+
+	for (i = 0; i < VSPU_STREAMS; i++)
+		if (vspu_streams[i].vi == vi)
+			return vspu_streams[i].setup;
+	return NULL;
+}
+
+int __wrap_vorbis_synthesis_headerin(vorbis_info * vi, vorbis_comment * vc, ogg_packet * op)
+{
+	int ret = __real_vorbis_synthesis_headerin(vi, vc, op), i;
+	VSPU_Setup *s;
+
+	// the setup header comes last, the identification header is in vi by then
+	if (ret != 0 || !op || op->bytes < 7 || op->packet[0] != 5)
+		return ret;
+	vspu_forget(vi);
+	s = vspu_parse_setup(vi->channels, vi->rate, vorbis_info_blocksize(vi, 0), vorbis_info_blocksize(vi, 1), op->packet, op->bytes);
+	if (!s)
+		return ret;
+	for (i = 0; i < VSPU_STREAMS; i++)
+		if (__sync_bool_compare_and_swap(&vspu_streams[i].vi, NULL, vi)) {
+			vspu_streams[i].setup = s;
+			return ret;
+		}
+	free(s);
+	return ret;
+}
+
+void __wrap_vorbis_info_clear(vorbis_info * vi)
+{
+	vspu_forget(vi);
+	__real_vorbis_info_clear(vi);
+}
+
+int __wrap_vorbis_synthesis(vorbis_block * vb, ogg_packet * op)
+{
+	VSPU_Decoder *d = vspu_hook;
+	const VSPU_Setup *s = d && vb && vb->vd ? vspu_find(vb->vd->vi) : NULL;
+	uint8_t head[16];
+	VSPU_Frame f;
+	VSPU_Bits b;
+	uint32_t c;
+	int ret;
+
+	if (!s || !op || op->bytes < 1)
+		return __real_vorbis_synthesis(vb, op);
+
+	// the block needs the window flags now, the decoder reads them again
+	_vorbis_block_ripcord(vb);
+	memset(head, 0, sizeof(head));
+	memcpy(head, op->packet, op->bytes < 8 ? (size_t) op->bytes : 8);
+	b.data = head;
+	b.pos = 0;
+	b.end = (uint32_t) op->bytes * 8;
+	ret = VSPU_DecodeHeader(s, &b, &f);
+	if (ret != VSPU_OK)
+		return ret == VSPU_NOTAUDIO ? OV_ENOTAUDIO : OV_EBADPACKET;
+
+	vb->mode = f.mode;
+	vb->W = f.W;
+	vb->lW = f.lW;
+	vb->nW = f.nW;
+	vb->granulepos = op->granulepos;
+	vb->sequence = op->packetno;
+	vb->eofflag = op->e_o_s;
+	vb->pcmend = (int) f.n;
+	vb->pcm = (float **) _vorbis_block_alloc(vb, sizeof(*vb->pcm) * s->channels);
+	for (c = 0; c < s->channels; c++)
+		vb->pcm[c] = (float *) (((uintptr_t) _vorbis_block_alloc(vb, f.n * sizeof(float) + 127) + 127) & ~(uintptr_t) 127);
+
+	// a packet the decoder rejects goes to the library, which decodes what it can of it
+	if (VSPU_Block(d, s, op->packet, (uint32_t) op->bytes, vb->pcm) < 0)
+		return __real_vorbis_synthesis(vb, op);
+	return 0;
+}
+
+void VSPU_Delete(VSPU_Decoder * d)
+{
+	if (!d)
+		return;
+	if (vspu_hook == d)
+		vspu_hook = NULL;
+	VSPU_Wait(d);
+#ifdef __PPU__
+	if (d->on_spu) {
+		u32 cause, status;
+		d->cmd.cmd = VSPU_CMD_QUIT;
+		__asm__ volatile ("lwsync":::"memory");
+		sysSpuThreadWriteMb(d->thread, 1);
+		sysSpuThreadGroupJoin(d->group, &cause, &status);
+		sysSpuThreadDisconnectEvent(d->thread, SPU_THREAD_EVENT_USER, VSPU_SPU_PORT);
+		sysSpuThreadGroupDestroy(d->group);
+		sysSpuImageClose(&d->image);
+		sysEventQueueDestroy(d->queue, 0);
+	}
+	sysLwMutexDestroy(&d->lock);
+#endif
+	free(d->packet);
+	free(d);
+}
+
+#endif /* VSPU_IMPLEMENTATION */
+
+#endif /* __SPU__ */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,862 @@
+/*! \file spujob.h
+ \brief SPU job system.
+
+ Persistent worker kernels, one per SPU thread, pull job descriptors from
+ lock-free queues in main memory. Each worker owns one queue and steals
+ from the queues of the other workers when its own is empty. The queues
+ are bounded MPMC rings (a sequence number per cell). On the SPU every
+ atomic update is a getllar/putllc pair on the 128 byte line holding the
+ word; the PPU and host use the compiler atomics on the same layout.
+
+ A job can decrement a \ref spuJobCounter when it completes. When the
+ counter reaches zero the job chained to it is queued, which expresses
+ dependencies (n jobs -> one continuation) and chains. The PPU waits on
+ counters with \ref spuJobFenceWait.
+
+ \ref spuJobBench measures the jobs per second of a started system.
+
+ Job code lives in job binaries: flat position independent images (built
+ with -fpic, entry point at offset 0, objcopy -O binary) loaded by the
+ SPU worker into its overlay area when a job needs another binary. On the
+ PPU and on the host the workers are threads, and run the same code
+ through the function pointer of the binary.
+
+ - SPU worker:  #include <spujob/spujob.h>
+                int main(u64 system, u64 index) { return spuJobSpuMain(system, index); }
+ - PPU / host:  #define SPUJOB_IMPLEMENTATION in one source file.
+*/
+
+#ifndef __SPUJOB_H__
+#define __SPUJOB_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+
+#ifdef __SPU__
+#include <spu_intrinsics.h>
+#include <spu_mfcio.h>
+#include <sys/spu_thread.h>
+#else
+#include <ppu-types.h>
+#include <stdlib.h>
+#ifdef __PPU__
+#include <malloc.h>
+#include <sys/spu.h>
+#include <sys/thread.h>
+#include <lv2/spu.h>
+#include <lv2/systime.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#endif
+#endif
+
+#define SPUJOB_MAX_WORKERS      6           /*!< SPU threads (or PPU / host threads) */
+#define SPUJOB_QUEUE_SIZE       256         /*!< jobs per worker queue, power of 2 */
+#define SPUJOB_IO_SIZE          16384       /*!< largest job input and output, bytes */
+#define SPUJOB_OVERLAY_SIZE     65536       /*!< largest job binary, bytes */
+#define SPUJOB_IDLE_TICKS       4000        /*!< SPU idle wait before looking for work to steal (decrementer ticks) */
+#define SPUJOB_BENCH_MAX_BATCH  1024        /*!< largest batch of \ref spuJobBench */
+
+#define SPUJOB_OK               0
+#define SPUJOB_EINVAL           -1
+#define SPUJOB_EBUSY            -2          /* every queue is full */
+#define SPUJOB_ESPU             -3
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! \brief Job descriptor, in main memory. */
+typedef struct _spu_job
+{
+	uint32_t binary;                /*!< \brief index of the job binary */
+	uint32_t flags;                 /*!< \brief free for the job */
+	uint64_t counter;               /*!< \brief ea of the \ref spuJobCounter decremented on completion (0: none) */
+	uint64_t input;                 /*!< \brief ea of the input, 16 byte aligned */
+	uint64_t output;                /*!< \brief ea of the output, 16 byte aligned */
+	uint32_t input_size;            /*!< \brief bytes copied to the job before it runs, multiple of 16 */
+	uint32_t output_size;           /*!< \brief bytes copied back after it ran, multiple of 16 */
+	uint64_t params[11];            /*!< \brief free for the job */
+} __attribute__((aligned(128))) spuJob;
+
+/*! \brief Dependency counter and fence. */
+typedef struct _spu_job_counter
+{
+	volatile uint32_t count;        /*!< \brief jobs still to complete */
+	uint32_t pad;
+	uint64_t next;                  /*!< \brief ea of the job queued when count reaches zero (0: none) */
+	uint64_t reserved[14];
+} __attribute__((aligned(128))) spuJobCounter;
+
+typedef struct _spu_job_context spuJobContext;
+
+/*! \brief Entry point of a job: input and output are local copies of job->input / job->output. */
+typedef void (*spuJobFunc)(spuJobContext *ctx, const spuJob *job, void *input, void *output);
+
+/*! \brief Worker services handed to the job code. */
+struct _spu_job_context
+{
+	uint64_t system;                /*!< \brief ea of the spuJobSystem */
+	uint64_t job;                   /*!< \brief ea of the running job */
+	uint32_t worker;
+	uint32_t workers;
+	/*! \brief queues a job (on the queue of this worker); returns SPUJOB_OK */
+	int (*push)(spuJobContext *ctx, uint64_t job);
+};
+
+/*! \brief Job binary. */
+typedef struct _spu_job_binary
+{
+	uint64_t ea;                    /*!< \brief flat image for the SPU, 128 byte aligned */
+	uint32_t size;                  /*!< \brief bytes, multiple of 16 */
+	uint32_t pad;
+	uint64_t func;                  /*!< \brief spuJobFunc run by the PPU / host workers */
+	uint64_t reserved;
+} __attribute__((aligned(16))) spuJobBinary;
+
+/* one line per cell: a reservation on a shared line would fail for every update of a neighbour */
+typedef struct _spu_job_cell
+{
+	volatile uint32_t seq;
+	uint32_t pad;
+	volatile uint64_t job;
+	uint64_t pad1[14];
+} __attribute__((aligned(128))) spuJobCell;
+
+typedef struct _spu_job_queue
+{
+	volatile uint32_t head;         /* own line: consumers */
+	uint32_t pad0[31];
+	volatile uint32_t tail;         /* own line: producers */
+	uint32_t pad1[31];
+	spuJobCell cells[SPUJOB_QUEUE_SIZE];
+} __attribute__((aligned(128))) spuJobQueue;
+
+/*! \brief Counters of one worker. */
+typedef struct _spu_job_stats
+{
+	uint64_t jobs;                  /*!< \brief jobs run */
+	uint64_t steals;                /*!< \brief jobs taken from the queue of another worker */
+	uint64_t idle;                  /*!< \brief waits for work */
+	uint64_t overlay_loads;         /*!< \brief job binaries loaded */
+	uint64_t chained;               /*!< \brief jobs queued by a counter reaching zero */
+	uint64_t pad[11];
+} __attribute__((aligned(128))) spuJobStats;
+
+#ifndef __SPU__
+/* start argument of a PPU / host worker thread */
+typedef struct
+{
+	struct _spu_job_system *sys;
+	u32 index;
+} spujob_thread_arg;
+#endif
+
+/*! \brief Job system, in main memory; opaque to the caller. */
+typedef struct _spu_job_system
+{
+	uint32_t workers;
+	volatile uint32_t quit;
+	uint32_t binary_count;
+	volatile uint32_t next_queue;
+	uint64_t binaries;              /* ea of spuJobBinary[binary_count] */
+	uint64_t pad[13];
+	spuJobQueue queues[SPUJOB_MAX_WORKERS];
+	spuJobStats stats[SPUJOB_MAX_WORKERS];
+#ifndef __SPU__
+	int on_spu;
+#ifdef __PPU__
+	sysSpuImage image;
+	sys_spu_group_t group;
+	sys_spu_thread_t spu_threads[SPUJOB_MAX_WORKERS];
+	sys_ppu_thread_t threads[SPUJOB_MAX_WORKERS];
+#else
+	pthread_t threads[SPUJOB_MAX_WORKERS];
+#endif
+	spujob_thread_arg args[SPUJOB_MAX_WORKERS];
+#endif
+} __attribute__((aligned(128))) spuJobSystem;
+
+/* memory primitives: DMA and lock line reservations on the SPU, atomics elsewhere */
+
+#ifdef __SPU__
+
+static uint8_t spujob_line[128] __attribute__((aligned(128)));
+
+static inline uint32_t spujob_load32(uint64_t ea)
+{
+	mfc_getllar(spujob_line, ea & ~127ULL, 0, 0);
+	mfc_read_atomic_status();
+	return *(volatile uint32_t *) (spujob_line + (ea & 127));
+}
+
+static inline uint64_t spujob_load64(uint64_t ea)
+{
+	mfc_getllar(spujob_line, ea & ~127ULL, 0, 0);
+	mfc_read_atomic_status();
+	return *(volatile uint64_t *) (spujob_line + (ea & 127));
+}
+
+static inline int spujob_cas32(uint64_t ea, uint32_t old, uint32_t value)
+{
+	for (;;) {
+		mfc_getllar(spujob_line, ea & ~127ULL, 0, 0);
+		mfc_read_atomic_status();
+		if (*(volatile uint32_t *) (spujob_line + (ea & 127)) != old)
+			return 0;
+		*(volatile uint32_t *) (spujob_line + (ea & 127)) = value;
+		mfc_putllc(spujob_line, ea & ~127ULL, 0, 0);
+		if (!(mfc_read_atomic_status() & MFC_PUTLLC_STATUS))
+			return 1;
+	}
+}
+
+static inline uint32_t spujob_add32(uint64_t ea, int32_t delta)
+{
+	for (;;) {
+		uint32_t v;
+		mfc_getllar(spujob_line, ea & ~127ULL, 0, 0);
+		mfc_read_atomic_status();
+		v = *(volatile uint32_t *) (spujob_line + (ea & 127)) + delta;
+		*(volatile uint32_t *) (spujob_line + (ea & 127)) = v;
+		mfc_putllc(spujob_line, ea & ~127ULL, 0, 0);
+		if (!(mfc_read_atomic_status() & MFC_PUTLLC_STATUS))
+			return v;
+	}
+}
+
+/* writes a queue cell: job and sequence number land in one atomic line update */
+static inline void spujob_cell_store(uint64_t ea, int with_job, uint64_t job, uint32_t seq)
+{
+	do {
+		mfc_getllar(spujob_line, ea & ~127ULL, 0, 0);
+		mfc_read_atomic_status();
+		if (with_job)
+			((spuJobCell *) (spujob_line + (ea & 127)))->job = job;
+		((spuJobCell *) (spujob_line + (ea & 127)))->seq = seq;
+		mfc_putllc(spujob_line, ea & ~127ULL, 0, 0);
+	} while (mfc_read_atomic_status() & MFC_PUTLLC_STATUS);
+}
+
+static inline void spujob_get(void *ls, uint64_t ea, uint32_t size)
+{
+	while (size) {
+		uint32_t n = size > 16384 ? 16384 : size;
+		mfc_get(ls, ea, n, 1, 0, 0);
+		ls = (uint8_t *) ls + n;
+		ea += n;
+		size -= n;
+	}
+	mfc_write_tag_mask(1 << 1);
+	mfc_read_tag_status_all();
+}
+
+static inline void spujob_put(const void *ls, uint64_t ea, uint32_t size)
+{
+	while (size) {
+		uint32_t n = size > 16384 ? 16384 : size;
+		mfc_put((volatile void *) ls, ea, n, 1, 0, 0);
+		ls = (const uint8_t *) ls + n;
+		ea += n;
+		size -= n;
+	}
+	mfc_write_tag_mask(1 << 1);
+	mfc_read_tag_status_all();
+}
+
+#else
+
+#define SPUJOB_PTR(ea)  ((void *) (uintptr_t) (ea))
+#define SPUJOB_EA(p)    ((uint64_t) (uintptr_t) (p))
+
+static inline uint32_t spujob_load32(uint64_t ea)
+{
+	return __atomic_load_n((volatile uint32_t *) SPUJOB_PTR(ea), __ATOMIC_ACQUIRE);
+}
+
+static inline uint64_t spujob_load64(uint64_t ea)
+{
+	return __atomic_load_n((volatile uint64_t *) SPUJOB_PTR(ea), __ATOMIC_ACQUIRE);
+}
+
+static inline int spujob_cas32(uint64_t ea, uint32_t old, uint32_t value)
+{
+	return __atomic_compare_exchange_n((volatile uint32_t *) SPUJOB_PTR(ea), &old, value, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static inline uint32_t spujob_add32(uint64_t ea, int32_t delta)
+{
+	return __atomic_add_fetch((volatile uint32_t *) SPUJOB_PTR(ea), (uint32_t) delta, __ATOMIC_ACQ_REL);
+}
+
+static inline void spujob_cell_store(uint64_t ea, int with_job, uint64_t job, uint32_t seq)
+{
+	spuJobCell *cell = (spuJobCell *) SPUJOB_PTR(ea);
+
+	if (with_job)
+		__atomic_store_n(&cell->job, job, __ATOMIC_RELAXED);
+	__atomic_store_n(&cell->seq, seq, __ATOMIC_RELEASE);
+}
+
+static inline void spujob_get(void *ls, uint64_t ea, uint32_t size)
+{
+	memcpy(ls, SPUJOB_PTR(ea), size);
+}
+
+static inline void spujob_put(const void *ls, uint64_t ea, uint32_t size)
+{
+	memcpy(SPUJOB_PTR(ea), ls, size);
+}
+
+#endif
+
+/* queue of worker q: Vyukov's bounded MPMC ring */
+
+#define SPUJOB_QUEUE_EA(sys, q)  ((sys) + offsetof(spuJobSystem, queues) + (uint64_t) (q) * sizeof(spuJobQueue))
+#define SPUJOB_CELL_EA(queue, pos) ((queue) + offsetof(spuJobQueue, cells) + (uint64_t) ((pos) & (SPUJOB_QUEUE_SIZE - 1)) * sizeof(spuJobCell))
+
+static inline int spujob_queue_push(uint64_t queue, uint64_t job)
+{
+	for (;;) {
+		uint32_t pos = spujob_load32(queue + offsetof(spuJobQueue, tail));
+		uint64_t cell = SPUJOB_CELL_EA(queue, pos);
+		int32_t dif = (int32_t) (spujob_load32(cell) - pos);
+
+		if (dif < 0)
+			return SPUJOB_EBUSY;
+		if (dif == 0 && spujob_cas32(queue + offsetof(spuJobQueue, tail), pos, pos + 1)) {
+			spujob_cell_store(cell, 1, job, pos + 1);
+			return SPUJOB_OK;
+		}
+	}
+}
+
+static inline uint64_t spujob_queue_pop(uint64_t queue)
+{
+	for (;;) {
+		uint32_t pos = spujob_load32(queue + offsetof(spuJobQueue, head));
+		uint64_t cell = SPUJOB_CELL_EA(queue, pos);
+		int32_t dif = (int32_t) (spujob_load32(cell) - (pos + 1));
+
+		if (dif < 0)
+			return 0;
+		if (dif == 0 && spujob_cas32(queue + offsetof(spuJobQueue, head), pos, pos + 1)) {
+			uint64_t job = spujob_load64(cell + offsetof(spuJobCell, job));
+			spujob_cell_store(cell, 0, 0, pos + SPUJOB_QUEUE_SIZE);
+			return job;
+		}
+	}
+}
+
+/* queues a job starting with the queue of worker 'first'; returns SPUJOB_EBUSY when every queue is full */
+static inline int spujob_push_any(uint64_t sys, uint32_t workers, uint32_t first, uint64_t job)
+{
+	uint32_t i;
+
+	for (i = 0; i < workers; i++)
+		if (spujob_queue_push(SPUJOB_QUEUE_EA(sys, (first + i) % workers), job) == SPUJOB_OK)
+			return SPUJOB_OK;
+	return SPUJOB_EBUSY;
+}
+
+/* worker, the same on SPU, PPU and host */
+
+typedef struct
+{
+	spuJobContext ctx;
+	spuJobStats stats;
+	uint64_t binaries;
+	uint32_t binary_count;
+	uint32_t loaded;                /* binary in the overlay area, ~0: none */
+	spuJob job;
+	uint8_t *input;
+	uint8_t *output;
+#ifdef __SPU__
+	uint8_t *overlay;
+#endif
+} spujob_worker;
+
+static int spujob_ctx_push(spuJobContext *ctx, uint64_t job)
+{
+	/* every queue full: wait for the other workers to drain them (a job must not queue more
+	   jobs than SPUJOB_QUEUE_SIZE * workers while every worker does the same) */
+	while (spujob_push_any(ctx->system, ctx->workers, ctx->worker, job) != SPUJOB_OK)
+		;
+	return SPUJOB_OK;
+}
+
+static inline void spujob_complete(spujob_worker *w)
+{
+	uint64_t counter = w->job.counter, next;
+
+	if (!counter)
+		return;
+	/* read before the decrement: once the count is zero the waiter may free the counter */
+	next = spujob_load64(counter + offsetof(spuJobCounter, next));
+	if (spujob_add32(counter + offsetof(spuJobCounter, count), -1) == 0 && next) {
+		spujob_ctx_push(&w->ctx, next);
+		w->stats.chained++;
+	}
+}
+
+static inline void spujob_run(spujob_worker *w, uint64_t job)
+{
+	spuJobBinary bin;
+	spuJobFunc func;
+
+	spujob_get(&w->job, job, sizeof(spuJob));
+	w->ctx.job = job;
+	if (w->job.binary >= w->binary_count || w->job.input_size > SPUJOB_IO_SIZE || w->job.output_size > SPUJOB_IO_SIZE) {
+		spujob_complete(w);
+		return;
+	}
+	spujob_get(&bin, w->binaries + (uint64_t) w->job.binary * sizeof(spuJobBinary), sizeof(bin));
+#ifdef __SPU__
+	if (w->loaded != w->job.binary) {
+		if (bin.size > SPUJOB_OVERLAY_SIZE) {
+			spujob_complete(w);
+			return;
+		}
+		spujob_get(w->overlay, bin.ea, bin.size);
+		spu_sync();             /* code was written by DMA */
+		w->loaded = w->job.binary;
+		w->stats.overlay_loads++;
+	}
+	func = (spuJobFunc) (void *) w->overlay;
+#else
+	if (w->loaded != w->job.binary) {
+		w->loaded = w->job.binary;
+		w->stats.overlay_loads++;
+	}
+	func = (spuJobFunc) (uintptr_t) bin.func;
+#endif
+	if (w->job.input_size)
+		spujob_get(w->input, w->job.input, w->job.input_size);
+	func(&w->ctx, &w->job, w->input, w->output);
+	if (w->job.output_size)
+		spujob_put(w->output, w->job.output, w->job.output_size);
+	w->stats.jobs++;
+	spujob_complete(w);
+}
+
+#ifdef __SPU__
+
+static inline void spujob_idle(uint64_t queue)
+{
+	uint64_t tail = queue + offsetof(spuJobQueue, tail);
+	uint32_t events;
+
+	uint32_t head = spujob_load32(queue + offsetof(spuJobQueue, head));
+
+	/* the reservations of the queue accesses may have been lost since: drop that event, or it ends the sleep at once */
+	spu_write_event_mask(MFC_LLR_LOST_EVENT | MFC_DECREMENTER_EVENT);
+	if (spu_stat_event_status()) {
+		events = spu_read_event_status();
+		spu_write_event_ack(events);
+	}
+	spu_write_event_mask(0);
+
+	/* sleep until a producer writes our tail line, or the decrementer says it is time to steal */
+	mfc_getllar(spujob_line, tail, 0, 0);
+	mfc_read_atomic_status();
+	if (*(volatile uint32_t *) spujob_line != head)
+		return;
+	spu_write_decrementer(SPUJOB_IDLE_TICKS);
+	spu_write_event_mask(MFC_LLR_LOST_EVENT | MFC_DECREMENTER_EVENT);
+	events = spu_read_event_status();
+	spu_write_event_mask(0);
+	spu_write_event_ack(events);
+}
+
+#else
+
+static inline void spujob_idle(uint64_t queue)
+{
+	(void) queue;
+#ifdef __PPU__
+	sysThreadYield();
+#else
+	sched_yield();
+#endif
+}
+
+#endif
+
+static inline int spujob_worker_loop(spujob_worker *w)
+{
+	uint64_t sys = w->ctx.system;
+	uint64_t stats = sys + offsetof(spuJobSystem, stats) + (uint64_t) w->ctx.worker * sizeof(spuJobStats);
+	uint64_t own = SPUJOB_QUEUE_EA(sys, w->ctx.worker);
+
+	w->ctx.push = spujob_ctx_push;
+	w->loaded = ~0U;
+	memset(&w->stats, 0, sizeof(w->stats));
+
+	for (;;) {
+		uint64_t job = spujob_queue_pop(own);
+		uint32_t i;
+
+		for (i = 1; !job && i < w->ctx.workers; i++) {
+			job = spujob_queue_pop(SPUJOB_QUEUE_EA(sys, (w->ctx.worker + i) % w->ctx.workers));
+			if (job)
+				w->stats.steals++;
+		}
+		if (job) {
+			spujob_run(w, job);
+			continue;
+		}
+		spujob_put(&w->stats, stats, sizeof(spuJobStats));
+		if (spujob_load32(sys + offsetof(spuJobSystem, quit)))
+			break;
+		w->stats.idle++;
+		spujob_idle(own);
+	}
+	spujob_put(&w->stats, stats, sizeof(spuJobStats));
+	return 0;
+}
+
+#ifdef __SPU__
+
+static uint8_t spujob_overlay[SPUJOB_OVERLAY_SIZE] __attribute__((aligned(128)));
+static uint8_t spujob_input[SPUJOB_IO_SIZE] __attribute__((aligned(128)));
+static uint8_t spujob_output[SPUJOB_IO_SIZE] __attribute__((aligned(128)));
+static spujob_worker spujob_self __attribute__((aligned(128)));
+static uint8_t spujob_header[128] __attribute__((aligned(128)));   /* first line of the spuJobSystem */
+
+/*! \brief Main loop of an SPU worker thread. */
+static inline int spuJobSpuMain(uint64_t system, uint64_t index)
+{
+	spujob_get(spujob_header, system, sizeof(spujob_header));
+	spujob_self.ctx.system = system;
+	spujob_self.ctx.worker = (uint32_t) index;
+	spujob_self.ctx.workers = *(uint32_t *) (spujob_header + offsetof(spuJobSystem, workers));
+	spujob_self.binaries = *(uint64_t *) (spujob_header + offsetof(spuJobSystem, binaries));
+	spujob_self.binary_count = *(uint32_t *) (spujob_header + offsetof(spuJobSystem, binary_count));
+	spujob_self.input = spujob_input;
+	spujob_self.output = spujob_output;
+	spujob_self.overlay = spujob_overlay;
+	spujob_worker_loop(&spujob_self);
+	spu_thread_exit(0);
+	return 0;
+}
+
+#else
+
+/*! \brief Start the workers.
+ \param sys Job system, 128 byte aligned (\ref spuJobSystemAlloc).
+ \param worker_elf SPU worker program (built around spuJobSpuMain), or NULL to run the workers on PPU threads (always on the host).
+ \param workers Number of workers (1 - SPUJOB_MAX_WORKERS).
+ \param binaries Job binaries, kept alive by the caller until \ref spuJobSystemEnd.
+ \param count Number of job binaries.
+ \return SPUJOB_OK or an error code.
+*/
+s32 spuJobSystemInit(spuJobSystem *sys, const void *worker_elf, u32 workers, const spuJobBinary *binaries, u32 count);
+
+/*! \brief Stop the workers once the queues are empty. */
+s32 spuJobSystemEnd(spuJobSystem *sys);
+
+/*! \brief Allocate a job system (128 byte aligned); free with free(). */
+spuJobSystem *spuJobSystemAlloc(void);
+
+/*! \brief Queue a job, 128 byte aligned and valid until it completed.
+ \return SPUJOB_OK, or SPUJOB_EBUSY when every queue is full.
+*/
+s32 spuJobSubmit(spuJobSystem *sys, spuJob *job);
+
+/*! \brief Set a counter: count completions queue next (NULL: nothing). */
+static inline void spuJobCounterInit(spuJobCounter *counter, u32 count, spuJob *next)
+{
+	memset(counter, 0, sizeof(*counter));
+	counter->next = SPUJOB_EA(next);
+	__atomic_store_n(&counter->count, count, __ATOMIC_RELEASE);
+}
+
+/*! \brief Nonzero when every job of the counter completed. */
+static inline s32 spuJobFenceTest(const spuJobCounter *counter)
+{
+	return __atomic_load_n(&counter->count, __ATOMIC_ACQUIRE) == 0;
+}
+
+/*! \brief Wait until every job of the counter completed. */
+void spuJobFenceWait(spuJobCounter *counter);
+
+/*! \brief Sum of the counters of the workers (updated when a worker goes idle or stops). */
+void spuJobGetStats(spuJobSystem *sys, spuJobStats *stats);
+
+/*! \brief Result of \ref spuJobBench. */
+typedef struct _spu_job_bench_result
+{
+	uint64_t jobs;
+	uint64_t usecs;
+	double jobs_per_sec;
+	double usecs_per_job;           /*!< \brief submit to completion, amortized over a batch */
+	uint64_t busy;                  /*!< \brief submits that found every queue full */
+} spuJobBenchResult;
+
+/*! \brief Run \p jobs jobs of \p binary (an empty job measures the system itself, no input or output) on a
+ started system, in batches of \p batch (up to SPUJOB_BENCH_MAX_BATCH, 0: the largest) waited for with a counter.
+*/
+s32 spuJobBench(spuJobSystem *sys, u32 binary, u32 jobs, u32 batch, spuJobBenchResult *result);
+
+#ifdef SPUJOB_IMPLEMENTATION
+
+static void spujob_thread_main(spujob_thread_arg *arg)
+{
+	spujob_worker *w;
+
+#ifdef __PPU__
+	w = (spujob_worker *) memalign(128, sizeof(spujob_worker) + 2 * SPUJOB_IO_SIZE);
+#else
+	if (posix_memalign((void **) &w, 128, sizeof(spujob_worker) + 2 * SPUJOB_IO_SIZE))
+		w = NULL;
+#endif
+	if (!w)
+		return;
+	memset(w, 0, sizeof(*w));
+	w->ctx.system = SPUJOB_EA(arg->sys);
+	w->ctx.worker = arg->index;
+	w->ctx.workers = arg->sys->workers;
+	w->binaries = arg->sys->binaries;
+	w->binary_count = arg->sys->binary_count;
+	w->input = (u8 *) (w + 1);
+	w->output = w->input + SPUJOB_IO_SIZE;
+	spujob_worker_loop(w);
+	free(w);
+}
+
+#ifdef __PPU__
+static void spujob_thread(void *arg)
+{
+	spujob_thread_main((spujob_thread_arg *) arg);
+	sysThreadExit(0);
+}
+#else
+static void *spujob_thread(void *arg)
+{
+	spujob_thread_main((spujob_thread_arg *) arg);
+	return NULL;
+}
+#endif
+
+spuJobSystem *spuJobSystemAlloc(void)
+{
+	void *p;
+
+#ifdef __PPU__
+	p = memalign(128, sizeof(spuJobSystem));
+#else
+	if (posix_memalign(&p, 128, sizeof(spuJobSystem)))
+		p = NULL;
+#endif
+	return (spuJobSystem *) p;
+}
+
+s32 spuJobSystemInit(spuJobSystem *sys, const void *worker_elf, u32 workers, const spuJobBinary *binaries, u32 count)
+{
+	u32 i, j;
+
+	if (!sys || (SPUJOB_EA(sys) & 127) || workers < 1 || workers > SPUJOB_MAX_WORKERS)
+		return SPUJOB_EINVAL;
+	memset(sys, 0, sizeof(*sys));
+	sys->workers = workers;
+	sys->binaries = SPUJOB_EA(binaries);
+	sys->binary_count = count;
+	for (i = 0; i < workers; i++)
+		for (j = 0; j < SPUJOB_QUEUE_SIZE; j++)
+			sys->queues[i].cells[j].seq = j;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+#ifdef __PPU__
+	if (worker_elf) {
+		sysSpuThreadGroupAttribute gattr = { sizeof("spujob"), (u32) (u64) "spujob", 0, 0 };
+		sysSpuThreadAttribute attr = { (u32) (u64) "spujob", sizeof("spujob"), SPU_THREAD_ATTR_NONE };
+
+		if (sysSpuImageImport(&sys->image, worker_elf, SPU_IMAGE_PROTECT))
+			return SPUJOB_ESPU;
+		if (sysSpuThreadGroupCreate(&sys->group, workers, 100, &gattr)) {
+			sysSpuImageClose(&sys->image);
+			return SPUJOB_ESPU;
+		}
+		for (i = 0; i < workers; i++) {
+			sysSpuThreadArgument arg = { (u64) sys, i, 0, 0 };
+			if (sysSpuThreadInitialize(&sys->spu_threads[i], sys->group, i, &sys->image, &attr, &arg)) {
+				sysSpuThreadGroupDestroy(sys->group);
+				sysSpuImageClose(&sys->image);
+				return SPUJOB_ESPU;
+			}
+		}
+		if (sysSpuThreadGroupStart(sys->group)) {
+			sysSpuThreadGroupDestroy(sys->group);
+			sysSpuImageClose(&sys->image);
+			return SPUJOB_ESPU;
+		}
+		sys->on_spu = 1;
+		return SPUJOB_OK;
+	}
+#else
+	(void) worker_elf;
+#endif
+
+	for (i = 0; i < workers; i++) {
+		sys->args[i].sys = sys;
+		sys->args[i].index = i;
+#ifdef __PPU__
+		if (sysThreadCreate(&sys->threads[i], spujob_thread, &sys->args[i], 1000, 0x10000, THREAD_JOINABLE, (char *) "spujob")) {
+#else
+		if (pthread_create(&sys->threads[i], NULL, spujob_thread, &sys->args[i])) {
+#endif
+			sys->workers = i;
+			spuJobSystemEnd(sys);
+			return SPUJOB_ESPU;
+		}
+	}
+	return SPUJOB_OK;
+}
+
+s32 spuJobSubmit(spuJobSystem *sys, spuJob *job)
+{
+	u32 first;
+
+	if (!job || (SPUJOB_EA(job) & 127) || (job->input_size & 15) || (job->output_size & 15) ||
+	    job->input_size > SPUJOB_IO_SIZE || job->output_size > SPUJOB_IO_SIZE || job->binary >= sys->binary_count)
+		return SPUJOB_EINVAL;
+	first = __atomic_fetch_add(&sys->next_queue, 1, __ATOMIC_RELAXED) % sys->workers;
+	/* release the descriptor before it can be seen in a queue */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	return spujob_push_any(SPUJOB_EA(sys), sys->workers, first, SPUJOB_EA(job));
+}
+
+static void spujob_yield(void)
+{
+#ifdef __PPU__
+	sysThreadYield();
+#else
+	sched_yield();
+#endif
+}
+
+void spuJobFenceWait(spuJobCounter *counter)
+{
+	while (!spuJobFenceTest(counter))
+		spujob_yield();
+}
+
+s32 spuJobSystemEnd(spuJobSystem *sys)
+{
+	u32 i;
+
+	__atomic_store_n(&sys->quit, 1, __ATOMIC_RELEASE);
+	/* a store to each tail line wakes the SPU workers sleeping on it */
+	for (i = 0; i < sys->workers; i++)
+		__atomic_fetch_add(&sys->queues[i].tail, 0, __ATOMIC_SEQ_CST);
+
+#ifdef __PPU__
+	if (sys->on_spu) {
+		u32 cause, status;
+		sysSpuThreadGroupJoin(sys->group, &cause, &status);
+		sysSpuThreadGroupDestroy(sys->group);
+		sysSpuImageClose(&sys->image);
+		sys->on_spu = 0;
+		return SPUJOB_OK;
+	}
+	for (i = 0; i < sys->workers; i++) {
+		u64 retval;
+		sysThreadJoin(sys->threads[i], &retval);
+	}
+#else
+	for (i = 0; i < sys->workers; i++)
+		pthread_join(sys->threads[i], NULL);
+#endif
+	return SPUJOB_OK;
+}
+
+void spuJobGetStats(spuJobSystem *sys, spuJobStats *stats)
+{
+	u32 i;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < sys->workers; i++) {
+		const spuJobStats *s = &sys->stats[i];
+		stats->jobs += s->jobs;
+		stats->steals += s->steals;
+		stats->idle += s->idle;
+		stats->overlay_loads += s->overlay_loads;
+		stats->chained += s->chained;
+	}
+}
+
+/* benchmark */
+
+static uint64_t spujob_usecs(void)
+{
+#ifdef __PPU__
+	return sysGetSystemTime();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+#endif
+}
+
+s32 spuJobBench(spuJobSystem *sys, u32 binary, u32 jobs, u32 batch, spuJobBenchResult *result)
+{
+	spuJobCounter *counter;
+	spuJob *descs;
+	uint64_t t0;
+	u32 done = 0, i;
+
+	if (!sys || !result || !jobs || binary >= sys->binary_count)
+		return SPUJOB_EINVAL;
+	if (!batch || batch > SPUJOB_BENCH_MAX_BATCH)
+		batch = SPUJOB_BENCH_MAX_BATCH;
+	/* the counter, then the descriptors of one batch; they are reused batch after batch */
+#ifdef __PPU__
+	counter = (spuJobCounter *) memalign(128, sizeof(spuJobCounter) + batch * sizeof(spuJob));
+#else
+	if (posix_memalign((void **) &counter, 128, sizeof(spuJobCounter) + batch * sizeof(spuJob)))
+		counter = NULL;
+#endif
+	if (!counter)
+		return SPUJOB_EINVAL;
+	descs = (spuJob *) (counter + 1);
+	memset(descs, 0, batch * sizeof(spuJob));
+	for (i = 0; i < batch; i++) {
+		descs[i].binary = binary;
+		descs[i].counter = SPUJOB_EA(counter);
+	}
+	memset(result, 0, sizeof(*result));
+
+	t0 = spujob_usecs();
+	while (done < jobs) {
+		u32 n = jobs - done < batch ? jobs - done : batch;
+
+		spuJobCounterInit(counter, n, NULL);
+		for (i = 0; i < n; i++)
+			while (spuJobSubmit(sys, &descs[i]) == SPUJOB_EBUSY) {
+				result->busy++;
+				spujob_yield();
+			}
+		spuJobFenceWait(counter);
+		done += n;
+	}
+	result->usecs = spujob_usecs() - t0;
+	result->jobs = done;
+	result->jobs_per_sec = result->usecs ? done * 1e6 / result->usecs : 0;
+	result->usecs_per_job = (double) result->usecs / done;
+	free(counter);
+	return SPUJOB_OK;
+}
+
+#endif /* SPUJOB_IMPLEMENTATION */
+
+#endif /* __SPU__ */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,569 @@
+/*! \file spuprof.h
+ \brief Sampling profiler for SPU threads.
+
+ The SPU side is a small runtime linked into the SPU program. It takes a
+ sample every \p interval timebase ticks from a timer of spu_timer.h
+ (decrementer interrupts, dispatched by the newlib first level interrupt
+ handler). A sample holds:
+
+ - the interrupted program counter, read from SRR0;
+ - the interrupted link register, read from the register save area of
+   the interrupt handler frame (\ref SPUPROF_FLIH_FRAME bytes, $0 saved
+   at offset 32), found by walking the back chain from the timer
+   callback;
+ - up to \ref SPUPROF_DEPTH - 2 return addresses from the back chain of
+   the interrupted stack (the ABI saves the link register at 16 bytes
+   into the caller's frame).
+
+ Every address carries the index of the overlay that was mapped at it,
+ taken from the _ovly_table / _ovly_buf_table the linker builds for
+ overlay programs, in the bits above \ref SPUPROF_ADDR_BITS.
+
+ The interrupt handler only writes samples into a ring in local store:
+ MFC commands are not interrupt safe unless the whole program brackets
+ its DMA with critical sections, so the ring goes out to main memory
+ from the program itself, in \ref spuProfPoll (cheap, call it in the main
+ loop), \ref spuProfFlush and \ref spuProfStop. A sample taken while the
+ ring is full is counted as dropped.
+
+ The PPU side allocates one \ref spuProfHeader buffer per SPU thread of a
+ group, sends its address to the threads through a signal notification
+ register (or leaves that to the program), and writes the buffers to a
+ file after the group has joined. bin/spuprof.py symbolises that file
+ against the SPU ELF, overlays included, and prints a flat profile or
+ folded stacks for flamegraph.pl.
+
+ - SPU: #define SPUPROF_IMPLEMENTATION in one source file; link with
+   the spu_timer functions of libc.
+ - PPU / host: #define SPUPROF_IMPLEMENTATION in one source file.
+*/
+
+#ifndef __SPUPROF_H__
+#define __SPUPROF_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SPU__
+#include <spu_intrinsics.h>
+#include <spu_mfcio.h>
+#include <spu_timer.h>
+#elif defined(__PPU__)
+#include <sys/spu.h>
+#endif
+
+#ifndef SPUPROF_RING
+#define SPUPROF_RING            128         /*!< samples in the local store ring, power of 2 */
+#endif
+#ifndef SPUPROF_DEPTH
+#define SPUPROF_DEPTH           6           /*!< addresses per sample: pc, lr and the stack (2, 6, 14 or 30) */
+#endif
+#ifndef SPUPROF_TAG
+#define SPUPROF_TAG             29          /*!< MFC tag of the flushes */
+#endif
+#ifndef SPUPROF_FLIH_FRAME
+#define SPUPROF_FLIH_FRAME      3312        /*!< stack frame of the newlib interrupt handler */
+#endif
+#ifndef SPUPROF_FLIH_LR
+#define SPUPROF_FLIH_LR         32          /*!< offset of the saved $0 in that frame */
+#endif
+#ifndef SPUPROF_MAX_SPUS
+#define SPUPROF_MAX_SPUS        8           /*!< threads per collector */
+#endif
+
+#if (SPUPROF_RING & (SPUPROF_RING - 1)) || SPUPROF_RING < 2
+#error "SPUPROF_RING must be a power of 2"
+#endif
+#if SPUPROF_DEPTH < 2 || (8 + 4 * SPUPROF_DEPTH) % 16
+#error "SPUPROF_DEPTH must be 2, 6, 14 or 30"
+#endif
+#if SPUPROF_RING * (8 + 4 * SPUPROF_DEPTH) > 16384
+#error "the SPUPROF_RING samples must fit one 16KB DMA"
+#endif
+
+#define SPUPROF_OK              0
+#define SPUPROF_EINVAL          -1
+#define SPUPROF_ENOMEM          -2
+#define SPUPROF_EBUSY           -3          /* no spu timer left */
+#define SPUPROF_EKERNEL         -4          /* an lv2 call failed */
+#define SPUPROF_EIO             -5
+
+#define SPUPROF_MAGIC           0x53505246  /*!< "SPRF", first word of a buffer */
+#define SPUPROF_FILE_MAGIC      0x53504644  /*!< "SPFD", first word of a saved profile */
+#define SPUPROF_VERSION         1
+
+#define SPUPROF_ADDR_BITS       18          /*!< local store address bits of a sample address */
+#define SPUPROF_ADDR(a)         ((a) & ((1 << SPUPROF_ADDR_BITS) - 1))
+#define SPUPROF_OVERLAY(a)      ((a) >> SPUPROF_ADDR_BITS)
+
+/* spuProfHeader.flags */
+#define SPUPROF_WRAP            0x01        /*!< keep the latest samples instead of the first ones */
+#define SPUPROF_RUNNING         0x02        /*!< set by the SPU in spuProfStart */
+#define SPUPROF_STOPPED         0x04        /*!< set by the SPU in spuProfStop */
+
+/* spuProfSample.flags */
+#define SPUPROF_SAMPLE_LR       0x01        /*!< pc[1] is the interrupted link register */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! \brief One sample, as stored in local store and in main memory. */
+typedef struct _spu_prof_sample
+{
+	uint32_t stamp;                 /*!< \brief low word of spu_clock_read() */
+	uint16_t depth;                 /*!< \brief valid entries of \p pc */
+	uint16_t flags;                 /*!< \brief SPUPROF_SAMPLE_* */
+	uint32_t pc[SPUPROF_DEPTH];     /*!< \brief pc, lr (0 if unknown), then return addresses, innermost first */
+} spuProfSample;
+
+/*! \brief Main memory buffer of one SPU thread: this header, then \p capacity samples. */
+typedef struct _spu_prof_header
+{
+	uint32_t magic;                 /*!< \brief SPUPROF_MAGIC (collector) */
+	uint32_t version;               /*!< \brief SPUPROF_VERSION (collector) */
+	uint32_t capacity;              /*!< \brief samples after the header (collector, rewritten by the SPU for its sample size) */
+	uint32_t interval;              /*!< \brief timebase ticks between samples (collector) */
+	uint32_t flags;                 /*!< \brief SPUPROF_WRAP (collector), RUNNING and STOPPED (SPU) */
+	uint32_t index;                 /*!< \brief index of the thread in the collector (collector) */
+	uint32_t thread;                /*!< \brief sys_spu_thread_t (collector) */
+	uint32_t sample_size;           /*!< \brief sizeof(spuProfSample) of the SPU program */
+	uint32_t depth;                 /*!< \brief SPUPROF_DEPTH of the SPU program */
+	uint32_t written;               /*!< \brief samples written to the buffer, wrapped ones included */
+	uint32_t samples;               /*!< \brief timer ticks */
+	uint32_t dropped;               /*!< \brief samples lost to a full ring or a full buffer */
+	uint32_t flushes;               /*!< \brief ring flushes */
+	uint32_t start;                 /*!< \brief spu_clock_read() at spuProfStart */
+	uint32_t stop;                  /*!< \brief spu_clock_read() at the last flush */
+	uint32_t bytes;                 /*!< \brief size of the sample area (collector) */
+	uint32_t pad[16];
+} spuProfHeader;
+
+#ifdef __SPU__
+
+extern volatile uint32_t spuprof_head;
+extern volatile uint32_t spuprof_tail;
+
+/*! \brief Start sampling into the buffer at \p ea, prepared by the collector. Starts the spu clock and enables interrupts. */
+int spuProfStart(uint64_t ea);
+
+/*! \brief Wait for the collector to write the buffer address to signal notification register \p snr (1 or 2), then start. */
+int spuProfStartSignal(uint32_t snr);
+
+/*! \brief Copy the samples in the ring and the header out to main memory. */
+void spuProfFlush(void);
+
+/*! \brief Stop the timer, flush and mark the buffer as stopped. */
+void spuProfStop(void);
+
+/*! \brief Flush when the ring is half full; meant for the main loop. */
+static inline void spuProfPoll(void)
+{
+	if (spuprof_head - spuprof_tail >= SPUPROF_RING / 2)
+		spuProfFlush();
+}
+
+#else
+
+/*! \brief Collector settings. */
+typedef struct _spu_prof_config
+{
+	uint32_t capacity;              /*!< \brief samples per thread */
+	uint32_t interval;              /*!< \brief timebase ticks between samples (at least SPU_TIMER_MIN_INTERVAL, 100) */
+	uint32_t flags;                 /*!< \brief SPUPROF_WRAP */
+	uint32_t signal;                /*!< \brief signal notification register carrying the buffer address: 1, 2, or 0 to pass it yourself */
+} spuProfConfig;
+
+/*! \brief Collector of one SPU thread group. */
+typedef struct _spu_prof_collector
+{
+	uint32_t count;
+	uint32_t group;
+	uint32_t threads[SPUPROF_MAX_SPUS];
+	spuProfHeader *buffers[SPUPROF_MAX_SPUS];
+} spuProfCollector;
+
+/*! \brief Allocate a buffer for each of the \p count threads of \p group and, if \p config asks for it, send the addresses.
+
+ Call it once the threads are initialized; with a signal register the
+ SPU side waits in \ref spuProfStartSignal until the address arrives. */
+int spuProfAttach(spuProfCollector *c, uint32_t group, const uint32_t *threads, uint32_t count, const spuProfConfig *config);
+
+/*! \brief Address of the buffer of thread \p index, for programs passing it themselves (e.g. as a thread argument). */
+uint64_t spuProfBufferEa(const spuProfCollector *c, uint32_t index);
+
+/*! \brief Call \p fn on the samples of thread \p index, oldest first; returns the number of samples.
+
+ Buffers are stable once the thread has called spuProfStop. */
+uint32_t spuProfForEach(const spuProfCollector *c, uint32_t index, void (*fn)(const spuProfSample *sample, void *arg), void *arg);
+
+/*! \brief Write every buffer to \p path for bin/spuprof.py. */
+int spuProfSave(const spuProfCollector *c, const char *path);
+
+/*! \brief Free the buffers. */
+void spuProfDetach(spuProfCollector *c);
+
+#endif /* __SPU__ */
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef SPUPROF_IMPLEMENTATION
+
+#ifdef __SPU__
+
+/* Defined by the linker for overlay programs: _ovly_table holds
+   { vma, size, file offset, buffer } for overlays 1..n, _ovly_buf_table
+   the overlay mapped in each buffer (1 based). */
+extern const uint32_t _ovly_table[][4] __attribute__((weak));
+extern const uint32_t _ovly_table_end[] __attribute__((weak));
+extern const volatile uint32_t _ovly_buf_table[] __attribute__((weak));
+
+volatile uint32_t spuprof_head;
+volatile uint32_t spuprof_tail;
+
+static spuProfSample spuprof_ring[SPUPROF_RING] __attribute__((aligned(128)));
+static spuProfHeader spuprof_header __attribute__((aligned(128)));
+static volatile uint32_t spuprof_samples;
+static volatile uint32_t spuprof_dropped;
+static uint32_t spuprof_lost;
+static uint32_t spuprof_overlays;
+static uint32_t spuprof_ovl_lo;
+static uint32_t spuprof_ovl_hi;
+static uint64_t spuprof_ea;
+static int spuprof_timer = -1;
+
+static inline uint32_t spuprof_word(uint32_t ls)
+{
+	return *(volatile uint32_t *) (uintptr_t) ls;
+}
+
+static inline int spuprof_link(uint32_t sp, uint32_t next)
+{
+	return next > sp && next < 0x40000 && !(next & 15);
+}
+
+static uint32_t spuprof_tag(uint32_t a)
+{
+	uint32_t i;
+
+	a = SPUPROF_ADDR(a);
+	if (a < spuprof_ovl_lo || a >= spuprof_ovl_hi)
+		return a;
+	for (i = 0; i < spuprof_overlays; i++) {
+		if (a - _ovly_table[i][0] < _ovly_table[i][1] && _ovly_buf_table[_ovly_table[i][3] - 1] == i + 1)
+			return a | ((i + 1) << SPUPROF_ADDR_BITS);
+	}
+	return a;
+}
+
+static void spuprof_tick(int id)
+{
+	uint32_t head = spuprof_head, sp, next, n, i;
+	spuProfSample *s;
+
+	(void) id;
+	spuprof_samples++;
+	if (head - spuprof_tail >= SPUPROF_RING) {
+		spuprof_dropped++;
+		return;
+	}
+	s = &spuprof_ring[head & (SPUPROF_RING - 1)];
+	s->stamp = (uint32_t) spu_clock_read();
+	s->flags = 0;
+	s->pc[0] = spuprof_tag(spu_read_srr0());
+	s->pc[1] = 0;
+	n = 2;
+
+	/* callback, spu_clock_slih, ..., first level handler, interrupted code */
+	__asm__ volatile ("ori %0,$1,0" : "=r" (sp));
+	for (i = 0; i < 8; i++) {
+		next = spuprof_word(sp);
+		if (!spuprof_link(sp, next))
+			break;
+		if (next - sp == SPUPROF_FLIH_FRAME) {
+			s->pc[1] = spuprof_tag(spuprof_word(sp + SPUPROF_FLIH_LR));
+			s->flags = SPUPROF_SAMPLE_LR;
+			for (sp = next; n < SPUPROF_DEPTH; sp = next) {
+				next = spuprof_word(sp);
+				if (!spuprof_link(sp, next) || !spuprof_word(next + 16))
+					break;
+				s->pc[n++] = spuprof_tag(spuprof_word(next + 16));
+			}
+			break;
+		}
+		sp = next;
+	}
+	s->depth = (uint16_t) n;
+	spuprof_head = head + 1;
+}
+
+static void spuprof_publish(uint32_t flags)
+{
+	spuprof_header.flags = (spuprof_header.flags & SPUPROF_WRAP) | flags;
+	spuprof_header.samples = spuprof_samples;
+	spuprof_header.dropped = spuprof_dropped + spuprof_lost;
+	spuprof_header.stop = (uint32_t) spu_clock_read();
+	/* fenced behind the samples of the same flush */
+	mfc_putf(&spuprof_header, spuprof_ea, sizeof(spuprof_header), SPUPROF_TAG, 0, 0);
+}
+
+static void spuprof_flush(uint32_t flags)
+{
+	uint32_t head = spuprof_head, tail = spuprof_tail, cap = spuprof_header.capacity;
+	uint32_t mask = mfc_read_tag_mask(), i, n, slot;
+
+	while (tail != head) {
+		i = tail & (SPUPROF_RING - 1);
+		n = head - tail;
+		if (n > SPUPROF_RING - i)
+			n = SPUPROF_RING - i;
+		if (spuprof_header.flags & SPUPROF_WRAP) {
+			slot = spuprof_header.written % cap;
+		} else {
+			if (spuprof_header.written >= cap) {
+				spuprof_lost += head - tail;
+				tail = head;
+				break;
+			}
+			slot = spuprof_header.written;
+		}
+		if (n > cap - slot)
+			n = cap - slot;
+		mfc_put(&spuprof_ring[i], spuprof_ea + sizeof(spuProfHeader) + (uint64_t) slot * sizeof(spuProfSample),
+				n * sizeof(spuProfSample), SPUPROF_TAG, 0, 0);
+		spuprof_header.written += n;
+		tail += n;
+	}
+	spuprof_header.flushes++;
+	spuprof_publish(flags);
+	mfc_write_tag_mask(1 << SPUPROF_TAG);
+	mfc_read_tag_status_all();
+	mfc_write_tag_mask(mask);
+	/* the handler may reuse the slots once their DMA is done */
+	spuprof_tail = tail;
+}
+
+int spuProfStart(uint64_t ea)
+{
+	uint32_t mask = mfc_read_tag_mask(), i, end;
+
+	if (spuprof_timer >= 0 || !ea || (ea & 127))
+		return SPUPROF_EINVAL;
+	mfc_get(&spuprof_header, ea, sizeof(spuprof_header), SPUPROF_TAG, 0, 0);
+	mfc_write_tag_mask(1 << SPUPROF_TAG);
+	mfc_read_tag_status_all();
+	mfc_write_tag_mask(mask);
+	spuprof_header.capacity = spuprof_header.bytes / sizeof(spuProfSample);
+	if (spuprof_header.magic != SPUPROF_MAGIC || spuprof_header.version != SPUPROF_VERSION ||
+		!spuprof_header.capacity || spuprof_header.interval < SPU_TIMER_MIN_INTERVAL)
+		return SPUPROF_EINVAL;
+
+	/* both are 0 without overlays */
+	spuprof_overlays = (uint32_t) ((uintptr_t) _ovly_table_end - (uintptr_t) _ovly_table) / 16;
+	spuprof_ovl_lo = 0x40000;
+	spuprof_ovl_hi = 0;
+	for (i = 0; i < spuprof_overlays; i++) {
+		end = _ovly_table[i][0] + _ovly_table[i][1];
+		if (_ovly_table[i][0] < spuprof_ovl_lo)
+			spuprof_ovl_lo = _ovly_table[i][0];
+		if (end > spuprof_ovl_hi)
+			spuprof_ovl_hi = end;
+	}
+
+	spuprof_ea = ea;
+	spuprof_head = spuprof_tail = 0;
+	spuprof_samples = spuprof_dropped = spuprof_lost = 0;
+	spuprof_header.sample_size = sizeof(spuProfSample);
+	spuprof_header.depth = SPUPROF_DEPTH;
+	spuprof_header.written = 0;
+	spuprof_header.flushes = 0;
+
+	spu_clock_start();
+	spuprof_timer = spu_timer_alloc(spuprof_header.interval, spuprof_tick);
+	if (spuprof_timer < 0) {
+		spu_clock_stop();
+		return SPUPROF_EBUSY;
+	}
+	spuprof_header.start = (uint32_t) spu_clock_read();
+	spuprof_flush(SPUPROF_RUNNING);
+	spu_timer_start(spuprof_timer);
+	spu_ienable();
+	return SPUPROF_OK;
+}
+
+int spuProfStartSignal(uint32_t snr)
+{
+	uint32_t ea;
+
+	if (snr != 1 && snr != 2)
+		return SPUPROF_EINVAL;
+	ea = snr == 1 ? spu_read_signal1() : spu_read_signal2();
+	return spuProfStart(ea);
+}
+
+void spuProfFlush(void)
+{
+	if (spuprof_timer >= 0)
+		spuprof_flush(SPUPROF_RUNNING);
+}
+
+void spuProfStop(void)
+{
+	if (spuprof_timer < 0)
+		return;
+	spu_timer_stop(spuprof_timer);
+	spu_timer_free(spuprof_timer);
+	spu_clock_stop();               /* fails harmlessly while the program has timers of its own */
+	spuprof_timer = -1;
+	spuprof_flush(SPUPROF_STOPPED);
+}
+
+#else /* !__SPU__ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __PPU__
+#include <malloc.h>
+#include <sys/systime.h>
+#endif
+
+int spuProfAttach(spuProfCollector *c, uint32_t group, const uint32_t *threads, uint32_t count, const spuProfConfig *config)
+{
+	size_t size;
+	uint32_t i;
+
+	if (!c || !threads || !count || count > SPUPROF_MAX_SPUS || !config || !config->capacity ||
+		config->interval < 100 || config->signal > 2)
+		return SPUPROF_EINVAL;
+	memset(c, 0, sizeof(*c));
+	c->group = group;
+	size = sizeof(spuProfHeader) + (size_t) config->capacity * sizeof(spuProfSample);
+	for (i = 0; i < count; i++) {
+#ifdef __PPU__
+		c->buffers[i] = (spuProfHeader *) memalign(128, size);
+#else
+		if (posix_memalign((void **) &c->buffers[i], 128, size))
+			c->buffers[i] = NULL;
+#endif
+		if (!c->buffers[i]) {
+			spuProfDetach(c);
+			return SPUPROF_ENOMEM;
+		}
+		memset(c->buffers[i], 0, sizeof(spuProfHeader));
+		c->buffers[i]->magic = SPUPROF_MAGIC;
+		c->buffers[i]->version = SPUPROF_VERSION;
+		c->buffers[i]->capacity = config->capacity;
+		c->buffers[i]->bytes = config->capacity * sizeof(spuProfSample);
+		c->buffers[i]->interval = config->interval;
+		c->buffers[i]->flags = config->flags & SPUPROF_WRAP;
+		c->buffers[i]->index = i;
+		c->buffers[i]->thread = threads[i];
+		c->threads[i] = threads[i];
+		c->count = i + 1;
+	}
+#ifdef __PPU__
+	/* the headers are in memory before an SPU can learn where they are */
+	__asm__ volatile ("sync" ::: "memory");
+	for (i = 0; config->signal && i < count; i++) {
+		if (sysSpuThreadWriteSignal(threads[i], config->signal - 1, (uint32_t) (uintptr_t) c->buffers[i])) {
+			spuProfDetach(c);
+			return SPUPROF_EKERNEL;
+		}
+	}
+#endif
+	return SPUPROF_OK;
+}
+
+uint64_t spuProfBufferEa(const spuProfCollector *c, uint32_t index)
+{
+	return index < c->count ? (uint64_t) (uintptr_t) c->buffers[index] : 0;
+}
+
+static uint32_t spuprof_range(const spuProfHeader *h, uint32_t *first)
+{
+	if (!h->sample_size || h->written <= h->capacity) {
+		*first = 0;
+		return h->sample_size ? h->written : 0;
+	}
+	*first = (h->flags & SPUPROF_WRAP) ? h->written % h->capacity : 0;
+	return h->capacity;
+}
+
+uint32_t spuProfForEach(const spuProfCollector *c, uint32_t index, void (*fn)(const spuProfSample *sample, void *arg), void *arg)
+{
+	const spuProfHeader *h;
+	const spuProfSample *s;
+	uint32_t first, n, i;
+
+	if (index >= c->count || !fn || c->buffers[index]->sample_size != sizeof(spuProfSample))
+		return 0;
+	h = c->buffers[index];
+	n = spuprof_range(h, &first);
+#ifdef __PPU__
+	__asm__ volatile ("lwsync" ::: "memory");
+#endif
+	s = (const spuProfSample *) (h + 1);
+	for (i = 0; i < n; i++)
+		fn(&s[(first + i) % h->capacity], arg);
+	return n;
+}
+
+int spuProfSave(const spuProfCollector *c, const char *path)
+{
+	const spuProfHeader *h;
+	const uint8_t *s;
+	uint32_t file[8], first, n, i;
+	FILE *f;
+	int ok = 1;
+
+	if (!c || !c->count || !path)
+		return SPUPROF_EINVAL;
+	f = fopen(path, "wb");
+	if (!f)
+		return SPUPROF_EIO;
+	memset(file, 0, sizeof(file));
+	file[0] = SPUPROF_FILE_MAGIC;
+	file[1] = SPUPROF_VERSION;
+	file[2] = c->count;
+	file[3] = c->group;
+#ifdef __PPU__
+	file[4] = (uint32_t) sysGetTimebaseFrequency();
+#else
+	file[4] = 79800000;
+#endif
+	ok &= fwrite(file, sizeof(file), 1, f) == 1;
+	for (i = 0; i < c->count; i++) {
+		h = c->buffers[i];
+		n = spuprof_range(h, &first);
+#ifdef __PPU__
+		__asm__ volatile ("lwsync" ::: "memory");
+#endif
+		s = (const uint8_t *) (h + 1);
+		/* min(written, capacity) samples, oldest first, in the layout of the SPU program */
+		ok &= fwrite(h, sizeof(spuProfHeader), 1, f) == 1;
+		if (n)
+			ok &= fwrite(s + (size_t) first * h->sample_size, h->sample_size, n - first, f) == n - first;
+		if (first)
+			ok &= fwrite(s, h->sample_size, first, f) == first;
+	}
+	ok &= fclose(f) == 0;
+	return ok ? SPUPROF_OK : SPUPROF_EIO;
+}
+
+void spuProfDetach(spuProfCollector *c)
+{
+	uint32_t i;
+
+	for (i = 0; i < c->count; i++)
+		free(c->buffers[i]);
+	memset(c, 0, sizeof(*c));
+}
+
+#endif /* __SPU__ */
+
+#endif /* SPUPROF_IMPLEMENTATION */
+
+#endif /* __SPUPROF_H__ */
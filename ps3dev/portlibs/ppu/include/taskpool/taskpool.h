@@ -0,0 +1,1143 @@
+/*! \file taskpool.h
+  \brief Fork-join task scheduler and parallel algorithms for the PPU.
+
+  A pool of worker threads running \ref taskpool::Task objects:
+
+  - The thread that calls Scheduler::start() becomes worker 0. The other
+    workers are threads created by the pool: by default one per remaining
+    PPU hardware thread, plus Config::oversubscribe extra threads for
+    work that blocks.
+  - Every worker owns a Chase-Lev deque. Spawned tasks go to the bottom
+    of the deque of the spawning worker. An idle worker takes the
+    bottom of its own deque, then steals the top of another one, so
+    large pieces of work are stolen and small ones stay local. Threads
+    outside the pool queue their tasks on a shared list.
+  - A \ref taskpool::TaskGroup counts its unfinished tasks. TaskGroup::wait()
+    runs other tasks while it waits, so tasks and their children may
+    live on the stack of the waiting function. Cancelling a group skips
+    the tasks of the group and of the groups created under it that did
+    not start yet.
+  - parallel_for(), parallel_reduce() and parallel_sort() split their
+    range recursively down to a grain size.
+  - A \ref taskpool::Offload handed to parallel_for() may take leaf ranges
+    away from the PPU; taskpool::SpuJobOffload queues them as jobs of
+    spujob/spujob.h when that header is included first.
+
+  Workers that find no work spin briefly, then sleep on a condition
+  variable until a task is spawned. Without a started scheduler every
+  task runs inline on the calling thread. On the host the workers are
+  pthreads, so code using the pool can be tested there.
+
+  \code
+  struct Scale {
+      float *data;
+      void operator()(size_t begin,size_t end) const { for(size_t i=begin;i<end;i++) data[i] *= 2.0f; }
+  };
+
+  taskpool::Scheduler::instance().start();
+  Scale s = { data };
+  taskpool::parallel_for(0,count,1024,s);
+  \endcode
+
+  benchScaling() times a loop, a reduction, a sort and a spawn heavy
+  recursion with 1 to n threads.
+*/
+
+#ifndef __TASKPOOL_H__
+#define __TASKPOOL_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+
+#ifdef __PPU__
+#include <ppu-asm.h>
+#include <sys/thread.h>
+#include <sys/systime.h>
+#include <lv2/mutex.h>
+#include <lv2/cond.h>
+#include <lv2/thread.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+namespace taskpool {
+
+static const uint32_t MAX_WORKERS = 16;			/*!< worker slots, worker 0 included */
+static const uint32_t DEQUE_SIZE = 1024;		/*!< tasks per worker deque, power of 2 */
+static const uint32_t SPINS_BEFORE_SLEEP = 64;	/*!< failed looks for work before an idle worker sleeps */
+static const uint32_t SLEEP_USEC = 10000;		/*!< longest sleep before an idle worker looks again */
+
+class TaskGroup;
+class Scheduler;
+
+/*! \brief Unit of work; stays valid until its group finished it. */
+class Task
+{
+public:
+	Task() : _group(0),_next(0) {}
+	virtual ~Task() {}
+	virtual void execute() = 0;
+
+private:
+	friend class TaskGroup;
+	friend class Scheduler;
+
+	TaskGroup *_group;
+	Task *_next;				/* list of tasks queued from outside the pool */
+};
+
+/*! \brief Scheduler settings. */
+struct Config
+{
+	uint32_t threads;			/*!< threads created besides worker 0, ~0U: one per other hardware thread */
+	uint32_t oversubscribe;		/*!< extra threads added to the default */
+	int32_t priority;			/*!< PPU thread priority */
+	uint32_t stackSize;
+
+	Config() : threads(~0U),oversubscribe(0),priority(1000),stackSize(0x10000) {}
+};
+
+/*! \brief Counters of a worker, or their sum. */
+struct Stats
+{
+	uint64_t executed;			/*!< tasks run */
+	uint64_t spawned;			/*!< tasks queued on the deque of the worker */
+	uint64_t inlined;			/*!< tasks run at once because the deque was full */
+	uint64_t stolen;			/*!< tasks taken from another worker */
+	uint64_t stealMisses;		/*!< looks through every deque that found nothing */
+	uint64_t sleeps;
+
+	Stats() { memset(this,0,sizeof(*this)); }
+};
+
+namespace detail {
+
+static inline double seconds()
+{
+#ifdef __PPU__
+	return (double)__gettime()/(double)sysGetTimebaseFrequency();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec + ts.tv_nsec*1e-9;
+#endif
+}
+
+static inline void yield()
+{
+#ifdef __PPU__
+	sysThreadYield();
+#else
+	sched_yield();
+#endif
+}
+
+/* lower the SMT priority of this hardware thread for a moment */
+static inline void pause()
+{
+#ifdef __PPU__
+	__asm__ volatile ("or 1,1,1\n\tor 2,2,2" ::: "memory");
+#elif defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+/*! \brief Chase-Lev work stealing deque of fixed size.
+
+  The owner pushes and pops at the bottom, any thread steals at the top.
+  Memory orders follow Le et al., "Correct and Efficient Work-Stealing
+  for Weak Memory Models".
+*/
+class Deque
+{
+public:
+	Deque() : _top(0),_bottom(0) { memset(_tasks,0,sizeof(_tasks)); }
+
+	/*! \brief Owner only; false when full. */
+	bool push(Task *task)
+	{
+		int64_t b = __atomic_load_n(&_bottom,__ATOMIC_RELAXED);
+		int64_t t = __atomic_load_n(&_top,__ATOMIC_ACQUIRE);
+
+		if(b - t >= (int64_t)DEQUE_SIZE) return false;
+		__atomic_store_n(&_tasks[b&(DEQUE_SIZE - 1)],task,__ATOMIC_RELAXED);
+		__atomic_store_n(&_bottom,b + 1,__ATOMIC_RELEASE);
+		return true;
+	}
+
+	/*! \brief Owner only. */
+	Task* pop()
+	{
+		int64_t b = __atomic_load_n(&_bottom,__ATOMIC_RELAXED) - 1;
+		int64_t t;
+		Task *task = 0;
+
+		__atomic_store_n(&_bottom,b,__ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		t = __atomic_load_n(&_top,__ATOMIC_RELAXED);
+		if(t <= b) {
+			task = __atomic_load_n(&_tasks[b&(DEQUE_SIZE - 1)],__ATOMIC_RELAXED);
+			if(t == b) {
+				/* last task: race the thieves for it */
+				if(!__atomic_compare_exchange_n(&_top,&t,t + 1,false,__ATOMIC_SEQ_CST,__ATOMIC_RELAXED))
+					task = 0;
+				__atomic_store_n(&_bottom,b + 1,__ATOMIC_RELAXED);
+			}
+		} else
+			__atomic_store_n(&_bottom,b + 1,__ATOMIC_RELAXED);
+		return task;
+	}
+
+	/*! \brief Any thread; NULL when empty or when another thief won. */
+	Task* steal()
+	{
+		int64_t t = __atomic_load_n(&_top,__ATOMIC_ACQUIRE);
+		int64_t b;
+		Task *task;
+
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		b = __atomic_load_n(&_bottom,__ATOMIC_ACQUIRE);
+		if(t >= b) return 0;
+		task = __atomic_load_n(&_tasks[t&(DEQUE_SIZE - 1)],__ATOMIC_RELAXED);
+		if(!__atomic_compare_exchange_n(&_top,&t,t + 1,false,__ATOMIC_SEQ_CST,__ATOMIC_RELAXED))
+			return 0;
+		return task;
+	}
+
+	bool empty() const
+	{
+		return __atomic_load_n(&_bottom,__ATOMIC_RELAXED) <= __atomic_load_n(&_top,__ATOMIC_RELAXED);
+	}
+
+private:
+	int64_t _top;				/* own cache line: written by thieves */
+	uint8_t _pad0[120];
+	int64_t _bottom;			/* own cache line: written by the owner */
+	uint8_t _pad1[120];
+	Task *_tasks[DEQUE_SIZE];
+};
+
+/*! \brief Mutex and condition variable of the kernel. */
+class Monitor
+{
+public:
+	bool init()
+	{
+#ifdef __PPU__
+		// attribute names are char[8]
+		sys_lwmutex_attr_t mattr = { SYS_LWMUTEX_PROTOCOL_FIFO,SYS_LWMUTEX_ATTR_NOT_RECURSIVE,"tskpool" };
+		sys_lwcond_attr_t cattr = { "tskpool" };
+
+		if(sysLwMutexCreate(&_mutex,&mattr)) return false;
+		if(sysLwCondCreate(&_cond,&_mutex,&cattr)) {
+			sysLwMutexDestroy(&_mutex);
+			return false;
+		}
+#else
+		pthread_condattr_t attr;
+
+		if(pthread_mutex_init(&_mutex,NULL)) return false;
+		pthread_condattr_init(&attr);
+		pthread_condattr_setclock(&attr,CLOCK_MONOTONIC);
+		if(pthread_cond_init(&_cond,&attr)) {
+			pthread_mutex_destroy(&_mutex);
+			return false;
+		}
+#endif
+		return true;
+	}
+
+	void destroy()
+	{
+#ifdef __PPU__
+		sysLwCondDestroy(&_cond);
+		sysLwMutexDestroy(&_mutex);
+#else
+		pthread_cond_destroy(&_cond);
+		pthread_mutex_destroy(&_mutex);
+#endif
+	}
+
+#ifdef __PPU__
+	void lock() { sysLwMutexLock(&_mutex,0); }
+	void unlock() { sysLwMutexUnlock(&_mutex); }
+	void signal() { sysLwCondSignal(&_cond); }
+	void broadcast() { sysLwCondSignalAll(&_cond); }
+	void wait(uint32_t usec) { sysLwCondWait(&_cond,usec); }
+#else
+	void lock() { pthread_mutex_lock(&_mutex); }
+	void unlock() { pthread_mutex_unlock(&_mutex); }
+	void signal() { pthread_cond_signal(&_cond); }
+	void broadcast() { pthread_cond_broadcast(&_cond); }
+
+	void wait(uint32_t usec)
+	{
+		struct timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC,&ts);
+		ts.tv_nsec += (long)(usec%1000000)*1000;
+		ts.tv_sec += usec/1000000 + ts.tv_nsec/1000000000;
+		ts.tv_nsec %= 1000000000;
+		pthread_cond_timedwait(&_cond,&_mutex,&ts);
+	}
+#endif
+
+private:
+#ifdef __PPU__
+	sys_lwmutex_t _mutex;
+	sys_lwcond_t _cond;
+#else
+	pthread_mutex_t _mutex;
+	pthread_cond_t _cond;
+#endif
+};
+
+} // namespace detail
+
+/*! \brief Takes leaf ranges of parallel_for() off the PPU workers.
+
+  Called from any worker at the same time.
+*/
+class Offload
+{
+public:
+	virtual ~Offload() {}
+
+	/*! \brief Start work on [begin,end); false to run the range on the PPU instead. */
+	virtual bool submit(size_t begin,size_t end) = 0;
+
+	/*! \brief Wait for everything submitted; parallel_for() calls it before it returns. */
+	virtual void wait() = 0;
+};
+
+/*! \brief Worker threads and their deques; one instance per process. */
+class Scheduler
+{
+public:
+	static Scheduler& instance()
+	{
+		static Scheduler scheduler;
+		return scheduler;
+	}
+
+	/*! \brief One per PPU hardware thread; the online CPUs on the host. */
+	static uint32_t hardwareThreads()
+	{
+#ifdef __PPU__
+		return 2;
+#else
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+		return n > 0 ? (uint32_t)n : 1;
+#endif
+	}
+
+	/*! \brief Create the workers; the calling thread becomes worker 0.
+	  \return false when already running or when a thread could not be created.
+	*/
+	bool start(const Config &config = Config())
+	{
+		uint32_t threads = config.threads;
+
+		if(_count) return false;
+		if(threads == ~0U) threads = hardwareThreads() - 1 + config.oversubscribe;
+		if(threads > MAX_WORKERS - 1) threads = MAX_WORKERS - 1;
+		if(!_monitor.init()) return false;
+
+		_workers = new Worker[threads + 1];
+		for(uint32_t i=0;i<=threads;i++) {
+			_workers[i].index = i;
+			_workers[i].rng = 0x9e3779b9*(i + 1);
+			_workers[i].scheduler = this;
+		}
+		_quit = 0;
+		_injected = 0;
+		_injectedTail = 0;
+		_sleepers = 0;
+		_epoch = 0;
+		__atomic_store_n(&_count,threads + 1,__ATOMIC_RELEASE);
+		current() = &_workers[0];
+
+		for(uint32_t i=1;i<=threads;i++) {
+#ifdef __PPU__
+			if(sysThreadCreate(&_workers[i].thread,threadEntry,&_workers[i],config.priority,config.stackSize,THREAD_JOINABLE,(char*)"taskpool")) {
+#else
+			pthread_attr_t attr;
+			int failed;
+
+			pthread_attr_init(&attr);
+			pthread_attr_setstacksize(&attr,config.stackSize < 0x10000 ? 0x10000 : config.stackSize);
+			failed = pthread_create(&_workers[i].thread,&attr,threadEntry,&_workers[i]);
+			pthread_attr_destroy(&attr);
+			if(failed) {
+#endif
+				_threads = i - 1;
+				stop();
+				return false;
+			}
+		}
+		_threads = threads;
+		return true;
+	}
+
+	/*! \brief Join the workers; call from worker 0 once every group was waited for. */
+	void stop()
+	{
+		if(!_count) return;
+		__atomic_store_n(&_quit,1,__ATOMIC_RELEASE);
+		_monitor.lock();
+		__atomic_fetch_add(&_epoch,1,__ATOMIC_RELAXED);
+		_monitor.broadcast();
+		_monitor.unlock();
+		for(uint32_t i=1;i<=_threads;i++) {
+#ifdef __PPU__
+			u64 retval;
+			sysThreadJoin(_workers[i].thread,&retval);
+#else
+			pthread_join(_workers[i].thread,NULL);
+#endif
+		}
+		current() = 0;
+		__atomic_store_n(&_count,0,__ATOMIC_RELEASE);
+		_threads = 0;
+		delete[] _workers;
+		_workers = 0;
+		_monitor.destroy();
+	}
+
+	bool running() const { return __atomic_load_n(&_count,__ATOMIC_ACQUIRE) != 0; }
+
+	/*! \brief Worker slots, worker 0 included; 1 when not running. */
+	uint32_t workers() const { uint32_t n = __atomic_load_n(&_count,__ATOMIC_ACQUIRE); return n ? n : 1; }
+
+	/*! \brief Sum of the counters of the workers; exact once they are idle. */
+	Stats stats() const
+	{
+		Stats sum;
+
+		for(uint32_t i=0;i<_count;i++) {
+			const Stats &s = _workers[i].stats;
+			sum.executed += s.executed;
+			sum.spawned += s.spawned;
+			sum.inlined += s.inlined;
+			sum.stolen += s.stolen;
+			sum.stealMisses += s.stealMisses;
+			sum.sleeps += s.sleeps;
+		}
+		return sum;
+	}
+
+	void resetStats()
+	{
+		for(uint32_t i=0;i<_count;i++) _workers[i].stats = Stats();
+	}
+
+	/*! \brief Queue a task whose group was set and counted. */
+	void spawn(Task *task)
+	{
+		Worker *w = current();
+
+		if(w && w->scheduler == this) {
+			if(!w->deque.push(task)) {
+				w->stats.inlined++;
+				execute(task);
+				return;
+			}
+			w->stats.spawned++;
+		} else {
+			task->_next = 0;
+			_monitor.lock();
+			if(_injectedTail) _injectedTail->_next = task;
+			else __atomic_store_n(&_injected,task,__ATOMIC_RELAXED);
+			_injectedTail = task;
+			_monitor.unlock();
+		}
+		wake();
+	}
+
+	/*! \brief A task to run next for the calling thread, NULL if there is none. */
+	Task* findWork()
+	{
+		Worker *w = current();
+		uint32_t n = _count;
+		Task *task;
+
+		if(w && w->scheduler != this) w = 0;
+		if(w && (task = w->deque.pop())) return task;
+		if(__atomic_load_n(&_injected,__ATOMIC_RELAXED)) {
+			_monitor.lock();
+			task = _injected;
+			if(task) {
+				__atomic_store_n(&_injected,task->_next,__ATOMIC_RELAXED);
+				if(!task->_next) _injectedTail = 0;
+			}
+			_monitor.unlock();
+			if(task) return task;
+		}
+
+		uint32_t start = w ? next(w->rng) : (uint32_t)(uintptr_t)&task;
+		for(uint32_t i=0;i<n;i++) {
+			Worker *victim = &_workers[(start + i)%n];
+
+			if(victim == w) continue;
+			if((task = victim->deque.steal())) {
+				if(w) w->stats.stolen++;
+				return task;
+			}
+		}
+		if(w) w->stats.stealMisses++;
+		return 0;
+	}
+
+	/*! \brief Run a task in the context of its group and mark it finished. */
+	inline void execute(Task *task);
+
+	/*! \brief Group of the task running on this thread, NULL outside tasks. */
+	static TaskGroup*& currentGroup()
+	{
+		static __thread TaskGroup *group;
+		return group;
+	}
+
+private:
+	struct Worker
+	{
+		detail::Deque deque;
+		Stats stats;
+		uint32_t index;
+		uint32_t rng;
+		Scheduler *scheduler;
+#ifdef __PPU__
+		sys_ppu_thread_t thread;
+#else
+		pthread_t thread;
+#endif
+		uint8_t pad[128];
+	};
+
+	Scheduler() : _workers(0),_count(0),_threads(0),_quit(0),_injected(0),_injectedTail(0),_sleepers(0),_epoch(0) {}
+	~Scheduler() { stop(); }
+
+	static Worker*& current()
+	{
+		static __thread Worker *worker;
+		return worker;
+	}
+
+	static uint32_t next(uint32_t &x)
+	{
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		return x;
+	}
+
+	bool hasWork() const
+	{
+		if(__atomic_load_n(&_injected,__ATOMIC_RELAXED)) return true;
+		for(uint32_t i=0;i<_count;i++)
+			if(!_workers[i].deque.empty()) return true;
+		return false;
+	}
+
+	/* pairs with the fence in sleep(): either the sleeper sees the task or we see the sleeper */
+	void wake()
+	{
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if(__atomic_load_n(&_sleepers,__ATOMIC_RELAXED)) {
+			_monitor.lock();
+			__atomic_fetch_add(&_epoch,1,__ATOMIC_RELAXED);
+			_monitor.signal();
+			_monitor.unlock();
+		}
+	}
+
+	void sleep(Worker *w)
+	{
+		uint32_t epoch = __atomic_load_n(&_epoch,__ATOMIC_ACQUIRE);
+
+		__atomic_fetch_add(&_sleepers,1,__ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if(!hasWork()) {
+			_monitor.lock();
+			if(__atomic_load_n(&_epoch,__ATOMIC_RELAXED) == epoch && !__atomic_load_n(&_quit,__ATOMIC_ACQUIRE))
+				_monitor.wait(SLEEP_USEC);
+			_monitor.unlock();
+			w->stats.sleeps++;
+		}
+		__atomic_fetch_sub(&_sleepers,1,__ATOMIC_RELAXED);
+	}
+
+	void run(Worker *w)
+	{
+		uint32_t idle = 0;
+
+		current() = w;
+		while(!__atomic_load_n(&_quit,__ATOMIC_ACQUIRE)) {
+			Task *task = findWork();
+
+			if(task) {
+				execute(task);
+				idle = 0;
+			} else if(++idle < SPINS_BEFORE_SLEEP) {
+				if(idle&7) detail::pause();
+				else detail::yield();
+			} else {
+				sleep(w);
+				idle = 0;
+			}
+		}
+		current() = 0;
+	}
+
+#ifdef __PPU__
+	static void threadEntry(void *arg)
+	{
+		Worker *w = (Worker*)arg;
+		w->scheduler->run(w);
+		sysThreadExit(0);
+	}
+#else
+	static void* threadEntry(void *arg)
+	{
+		Worker *w = (Worker*)arg;
+		w->scheduler->run(w);
+		return NULL;
+	}
+#endif
+
+	Worker *_workers;
+	uint32_t _count;			/* worker slots, 0: not running */
+	uint32_t _threads;
+	uint32_t _quit;
+	Task *_injected;			/* tasks queued from outside the pool, under _monitor */
+	Task *_injectedTail;
+	uint32_t _sleepers;
+	uint32_t _epoch;			/* bumped under _monitor to wake sleepers */
+	detail::Monitor _monitor;
+};
+
+/*! \brief Set of tasks waited for together, and the unit of cancellation.
+
+  A group is cancelled when cancel() was called on it or on the group it
+  was created under (by default the group of the task running on this
+  thread). Tasks of a cancelled group that did not start are skipped;
+  running tasks can poll isCancelled().
+*/
+class TaskGroup
+{
+public:
+	TaskGroup() : _pending(0),_cancelled(0),_parent(Scheduler::currentGroup()) {}
+	explicit TaskGroup(TaskGroup *parent) : _pending(0),_cancelled(0),_parent(parent) {}
+	~TaskGroup() { wait(); }
+
+	/*! \brief Queue a task; it runs at once when the scheduler is not running. */
+	void run(Task *task)
+	{
+		Scheduler &s = Scheduler::instance();
+
+		task->_group = this;
+		__atomic_fetch_add(&_pending,1,__ATOMIC_RELAXED);
+		if(s.running()) s.spawn(task);
+		else s.execute(task);
+	}
+
+	/*! \brief Run other tasks until every task of the group finished.
+	  \return true when the group was cancelled.
+	*/
+	bool wait()
+	{
+		Scheduler &s = Scheduler::instance();
+		uint32_t idle = 0;
+
+		while(__atomic_load_n(&_pending,__ATOMIC_ACQUIRE)) {
+			Task *task = s.findWork();
+
+			if(task) {
+				s.execute(task);
+				idle = 0;
+			} else if(++idle&15) detail::pause();
+			else detail::yield();
+		}
+		return isCancelled();
+	}
+
+	void cancel() { __atomic_store_n(&_cancelled,1,__ATOMIC_RELAXED); }
+
+	bool isCancelled() const
+	{
+		for(const TaskGroup *g=this;g;g=g->_parent)
+			if(__atomic_load_n(&g->_cancelled,__ATOMIC_RELAXED)) return true;
+		return false;
+	}
+
+private:
+	friend class Scheduler;
+
+	void finish() { __atomic_fetch_sub(&_pending,1,__ATOMIC_RELEASE); }
+
+	uint32_t _pending;
+	uint32_t _cancelled;
+	TaskGroup *_parent;
+
+	TaskGroup(const TaskGroup&);
+	TaskGroup& operator=(const TaskGroup&);
+};
+
+inline void Scheduler::execute(Task *task)
+{
+	TaskGroup *group = task->_group;
+	TaskGroup *&running = currentGroup();
+	TaskGroup *outer = running;
+	Worker *w = current();
+
+	running = group;
+	if(!group->isCancelled()) task->execute();
+	running = outer;
+	if(w) w->stats.executed++;
+	/* the task may be gone once its group is finished */
+	group->finish();
+}
+
+/*! \brief Cancel the group of the task running on this thread, and the groups below it. */
+static inline void cancelCurrent()
+{
+	TaskGroup *group = Scheduler::currentGroup();
+	if(group) group->cancel();
+}
+
+/*! \brief True when the task running on this thread was cancelled. */
+static inline bool isCancelled()
+{
+	TaskGroup *group = Scheduler::currentGroup();
+	return group && group->isCancelled();
+}
+
+namespace detail {
+
+static inline size_t autoGrain(size_t count)
+{
+	size_t grain = count/(Scheduler::instance().workers()*8);
+	return grain ? grain : 1;
+}
+
+template<class F>
+class ForTask : public Task
+{
+public:
+	ForTask(size_t begin,size_t end,size_t grain,const F &f,Offload *offload)
+	: _begin(begin),_end(end),_grain(grain),_f(f),_offload(offload) {}
+
+	void execute() { run(_begin,_end); }
+
+	void run(size_t begin,size_t end)
+	{
+		if(end - begin <= _grain) {
+			if(taskpool::isCancelled()) return;
+			if(!_offload || !_offload->submit(begin,end)) _f(begin,end);
+			return;
+		}
+
+		size_t mid = begin + (end - begin)/2;
+		ForTask right(mid,end,_grain,_f,_offload);
+		TaskGroup group;
+
+		group.run(&right);
+		run(begin,mid);
+		group.wait();
+	}
+
+private:
+	size_t _begin,_end,_grain;
+	const F &_f;
+	Offload *_offload;
+};
+
+template<class T,class F,class J>
+class ReduceTask : public Task
+{
+public:
+	ReduceTask(size_t begin,size_t end,size_t grain,const T &identity,const F &f,const J &join)
+	: _begin(begin),_end(end),_grain(grain),_identity(identity),_f(f),_join(join),_result(identity) {}
+
+	void execute() { _result = run(_begin,_end); }
+
+	T run(size_t begin,size_t end)
+	{
+		if(end - begin <= _grain)
+			return taskpool::isCancelled() ? _identity : _f(begin,end,_identity);
+
+		size_t mid = begin + (end - begin)/2;
+		ReduceTask right(mid,end,_grain,_identity,_f,_join);
+		TaskGroup group;
+
+		group.run(&right);
+		T left = run(begin,mid);
+		group.wait();
+		return _join(left,right._result);
+	}
+
+	const T& result() const { return _result; }
+
+private:
+	size_t _begin,_end,_grain;
+	const T &_identity;
+	const F &_f;
+	const J &_join;
+	T _result;
+};
+
+template<class It,class Cmp>
+class SortTask : public Task
+{
+public:
+	SortTask(It first,It last,const Cmp &cmp,size_t cutoff) : _first(first),_last(last),_cmp(cmp),_cutoff(cutoff) {}
+
+	void execute() { run(_first,_last); }
+
+	void run(It first,It last)
+	{
+		while((size_t)(last - first) > _cutoff) {
+			if(taskpool::isCancelled()) return;
+
+			/* split around the median of three; when nothing is less than the
+			   pivot, split off the elements equal to it so the range shrinks */
+			It mid = first + (last - first)/2;
+			Value pivot = median(*first,*mid,*(last - 1));
+			It lt = std::partition(first,last,Less(pivot,_cmp));
+			It gt = lt;
+
+			if(lt == first) gt = std::partition(lt,last,NotGreater(pivot,_cmp));
+
+			/* spawn the larger side, loop on the smaller one */
+			if(lt - first > last - gt) {
+				SortTask left(first,lt,_cmp,_cutoff);
+				TaskGroup group;
+
+				group.run(&left);
+				run(gt,last);
+				group.wait();
+			} else {
+				SortTask right(gt,last,_cmp,_cutoff);
+				TaskGroup group;
+
+				group.run(&right);
+				run(first,lt);
+				group.wait();
+			}
+			return;
+		}
+		if(!taskpool::isCancelled()) std::sort(first,last,_cmp);
+	}
+
+private:
+	typedef typename std::iterator_traits<It>::value_type Value;
+
+	struct Less
+	{
+		const Value &pivot; const Cmp &cmp;
+		Less(const Value &p,const Cmp &c) : pivot(p),cmp(c) {}
+		bool operator()(const Value &v) const { return cmp(v,pivot); }
+	};
+
+	struct NotGreater
+	{
+		const Value &pivot; const Cmp &cmp;
+		NotGreater(const Value &p,const Cmp &c) : pivot(p),cmp(c) {}
+		bool operator()(const Value &v) const { return !cmp(pivot,v); }
+	};
+
+	Value median(const Value &a,const Value &b,const Value &c) const
+	{
+		if(_cmp(a,b)) return _cmp(b,c) ? b : (_cmp(a,c) ? c : a);
+		return _cmp(a,c) ? a : (_cmp(b,c) ? c : b);
+	}
+
+	It _first,_last;
+	const Cmp &_cmp;
+	size_t _cutoff;
+};
+
+template<class T>
+struct DefaultLess
+{
+	bool operator()(const T &a,const T &b) const { return a < b; }
+};
+
+} // namespace detail
+
+/*! \brief Call f(begin,end) on subranges of [begin,end) of at most \p grain elements.
+  \param grain Largest leaf range, 0: about 8 leaves per worker.
+  \param parent Group the loop is created under; cancelling it stops the loop.
+  \param offload Leaf ranges are offered to it before they run on the PPU.
+*/
+template<class F>
+void parallel_for(size_t begin,size_t end,size_t grain,const F &f,TaskGroup *parent = 0,Offload *offload = 0)
+{
+	if(end <= begin) return;
+	if(!grain) grain = detail::autoGrain(end - begin);
+
+	TaskGroup group(parent ? parent : Scheduler::currentGroup());
+	detail::ForTask<F> root(begin,end,grain,f,offload);
+
+	group.run(&root);
+	group.wait();
+	if(offload) offload->wait();
+}
+
+/*! \brief Reduce [begin,end): leaves compute f(begin,end,identity), results are combined with join(left,right).
+
+  The leaves are combined in index order, so \p join needs to be
+  associative but not commutative.
+*/
+template<class T,class F,class J>
+T parallel_reduce(size_t begin,size_t end,size_t grain,const T &identity,const F &f,const J &join,TaskGroup *parent = 0)
+{
+	if(end <= begin) return identity;
+	if(!grain) grain = detail::autoGrain(end - begin);
+
+	TaskGroup group(parent ? parent : Scheduler::currentGroup());
+	detail::ReduceTask<T,F,J> root(begin,end,grain,identity,f,join);
+
+	group.run(&root);
+	group.wait();
+	return root.result();
+}
+
+/*! \brief Sort [first,last) with \p cmp; parallel quicksort, std::sort below \p cutoff elements. Not stable. */
+template<class It,class Cmp>
+void parallel_sort(It first,It last,const Cmp &cmp,size_t cutoff = 2048,TaskGroup *parent = 0)
+{
+	if(last - first < 2) return;
+
+	TaskGroup group(parent ? parent : Scheduler::currentGroup());
+	detail::SortTask<It,Cmp> root(first,last,cmp,cutoff < 16 ? 16 : cutoff);
+
+	group.run(&root);
+	group.wait();
+}
+
+template<class T>
+void parallel_sort(T *first,T *last)
+{
+	parallel_sort(first,last,detail::DefaultLess<T>());
+}
+
+#ifdef __SPUJOB_H__
+
+/*! \brief Offload that queues leaf ranges as jobs of spujob/spujob.h.
+
+  Every job is a copy of prototype() with params[0] = begin and
+  params[1] = end. At most \c MaxJobs ranges are queued per loop; later
+  ones, and ranges smaller than \p minCount, run on the PPU. The jobs
+  live in the object, which must be 128 byte aligned (static or
+  memalign()); otherwise spuJobSubmit() refuses them and every range
+  runs on the PPU.
+*/
+template<uint32_t MaxJobs>
+class SpuJobOffload : public Offload
+{
+public:
+	SpuJobOffload(spuJobSystem *system,uint32_t binary,size_t minCount = 0)
+	: _system(system),_minCount(minCount),_used(0)
+	{
+		memset(&_prototype,0,sizeof(_prototype));
+		_prototype.binary = binary;
+		spuJobCounterInit(&_counter,BIAS,NULL);
+	}
+
+	~SpuJobOffload() { wait(); }
+
+	/*! \brief Fields copied into every job: flags, input, output and params[2..]. */
+	spuJob& prototype() { return _prototype; }
+
+	bool submit(size_t begin,size_t end)
+	{
+		uint32_t i;
+
+		if(end - begin < _minCount) return false;
+		i = __atomic_fetch_add(&_used,1,__ATOMIC_RELAXED);
+		if(i >= MaxJobs) return false;
+
+		spuJob &job = _jobs[i];
+		job = _prototype;
+		job.counter = SPUJOB_EA(&_counter);
+		job.params[0] = begin;
+		job.params[1] = end;
+		__atomic_fetch_add(&_counter.count,1,__ATOMIC_RELAXED);
+		if(spuJobSubmit(_system,&job) != SPUJOB_OK) {
+			__atomic_fetch_sub(&_counter.count,1,__ATOMIC_RELAXED);
+			return false;
+		}
+		return true;
+	}
+
+	void wait()
+	{
+		/* the bias kept the count above zero while jobs were being added */
+		__atomic_fetch_sub(&_counter.count,BIAS,__ATOMIC_RELEASE);
+		spuJobFenceWait(&_counter);
+		spuJobCounterInit(&_counter,BIAS,NULL);
+		_used = 0;
+	}
+
+private:
+	static const uint32_t BIAS = 0x40000000;
+
+	spuJob _jobs[MaxJobs];
+	spuJob _prototype;
+	spuJobCounter _counter;
+	spuJobSystem *_system;
+	size_t _minCount;
+	uint32_t _used;
+};
+
+#endif
+
+/*! \brief Seconds of the four workloads of benchScaling() at one thread count. */
+struct BenchResult
+{
+	uint32_t threads;
+	double forSeconds;			/*!< parallel_for, math on every element */
+	double reduceSeconds;		/*!< parallel_reduce, sum of the same math */
+	double sortSeconds;			/*!< parallel_sort of pseudo random integers */
+	double spawnSeconds;		/*!< recursive fibonacci, one task per call above a cutoff */
+	uint64_t checksum;			/*!< equal for every thread count when the results are right */
+};
+
+namespace detail {
+
+struct BenchFor
+{
+	float *data;
+	void operator()(size_t begin,size_t end) const
+	{
+		for(size_t i=begin;i<end;i++) data[i] = sqrtf((float)i)*sinf((float)i*0.001f) + cosf(data[i]);
+	}
+};
+
+struct BenchSum
+{
+	double operator()(size_t begin,size_t end,double sum) const
+	{
+		for(size_t i=begin;i<end;i++) sum += sqrt((double)i)*sin((double)i*0.001);
+		return sum;
+	}
+};
+
+struct BenchJoin
+{
+	double operator()(double a,double b) const { return a + b; }
+};
+
+class BenchFib : public Task
+{
+public:
+	BenchFib(uint32_t n) : _n(n),_result(0) {}
+
+	void execute()
+	{
+		if(_n < 16) {
+			_result = serial(_n);
+			return;
+		}
+
+		BenchFib a(_n - 1),b(_n - 2);
+		TaskGroup group;
+
+		group.run(&a);
+		group.run(&b);
+		group.wait();
+		_result = a._result + b._result;
+	}
+
+	static uint64_t serial(uint32_t n) { return n < 2 ? n : serial(n - 1) + serial(n - 2); }
+
+	uint32_t _n;
+	uint64_t _result;
+};
+
+} // namespace detail
+
+/*! \brief Run the workloads with 1 to \p maxThreads threads (worker 0 included).
+
+  Starts and stops the scheduler for every thread count, so it must not
+  be running. Speedup at n threads is results[0].xxxSeconds divided by
+  results[n - 1].xxxSeconds.
+  \param count Elements of the loop, the reduction and the sort.
+  \return Results written.
+*/
+static inline uint32_t benchScaling(BenchResult *results,uint32_t maxThreads,size_t count)
+{
+	Scheduler &s = Scheduler::instance();
+	float *data = (float*)malloc(count*sizeof(float));
+	uint32_t *keys = (uint32_t*)malloc(count*sizeof(uint32_t));
+	uint32_t n = 0;
+
+	if(s.running() || !data || !keys) {
+		free(data);
+		free(keys);
+		return 0;
+	}
+	if(maxThreads > MAX_WORKERS) maxThreads = MAX_WORKERS;
+
+	for(uint32_t threads=1;threads<=maxThreads;threads++) {
+		BenchResult &r = results[n];
+		Config config;
+		double t;
+		uint32_t x = 12345;
+
+		config.threads = threads - 1;
+		if(!s.start(config)) break;
+		r.threads = threads;
+		r.checksum = 0;
+
+		memset(data,0,count*sizeof(float));
+		detail::BenchFor f = { data };
+		t = detail::seconds();
+		parallel_for(0,count,0,f);
+		r.forSeconds = detail::seconds() - t;
+		for(size_t i=0;i<count;i+=97) r.checksum += (uint64_t)(int64_t)(data[i]*1000.0f);
+
+		t = detail::seconds();
+		double sum = parallel_reduce(0,count,0,0.0,detail::BenchSum(),detail::BenchJoin());
+		r.reduceSeconds = detail::seconds() - t;
+		r.checksum += (uint64_t)fabs(sum);
+
+		for(size_t i=0;i<count;i++) {
+			x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+			keys[i] = x;
+		}
+		t = detail::seconds();
+		parallel_sort(keys,keys + count);
+		r.sortSeconds = detail::seconds() - t;
+		for(size_t i=1;i<count;i++)
+			if(keys[i - 1] > keys[i]) r.checksum++;
+
+		detail::BenchFib fib(30);
+		TaskGroup group;
+		t = detail::seconds();
+		group.run(&fib);
+		group.wait();
+		r.spawnSeconds = detail::seconds() - t;
+		r.checksum += fib._result;
+
+		s.stop();
+		n++;
+	}
+	free(data);
+	free(keys);
+	return n;
+}
+
+} // namespace taskpool
+
+#endif
@@ -0,0 +1,115 @@
+/*
+   Host test of fsched/fsched.h on the simulated drive: a reader going through a 24MB file
+   with requests that do not divide the readahead windows, one request in flight at a time,
+   then the same with several streams of requests queued ahead. Checks the data delivered
+   and that the file is read about once, without seeking back at the end of every window.
+
+   gcc -O2 -Wall -I../ppu/include fsched_test.c -o fsched_test -lpthread && ./fsched_test
+*/
+
+#define FSCHED_IMPLEMENTATION
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fsched/fsched.h>
+
+#define FILE_SIZE   (24 << 20)
+#define QUEUED      8
+
+static int failures;
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf(__VA_ARGS__); printf("\n"); failures++; } } while (0)
+
+static uint8_t pattern(uint64_t offset)
+{
+	return (uint8_t) (offset * 2654435761u >> 13);
+}
+
+static int check_data(const uint8_t *data, uint64_t offset, uint64_t size)
+{
+	uint64_t i;
+
+	for (i = 0; i < size; i++)
+		if (data[i] != pattern(offset + i))
+			return 0;
+	return 1;
+}
+
+/* reads the file in 'request' byte pieces, 'queued' requests in flight */
+static void sequential(const char *path, uint32_t request, uint32_t queued)
+{
+	static fschedRequest reqs[QUEUED];
+	static uint8_t *buffers[QUEUED];
+	fschedConfig config;
+	fschedStats st;
+	fsched *s;
+	uint64_t next = 0, done = 0;
+	uint32_t i, bad = 0;
+	int file;
+
+	fschedDefaults(&config);
+	config.seek_usec = 1000;
+	config.seek_usec_gb = 2000;
+	config.rate = 400 << 20;
+	if (fschedCreate(&s, &config) != FSCHED_OK || (file = fschedOpen(s, path, 0)) < 0) {
+		printf("can't open %s\n", path);
+		exit(1);
+	}
+	for (i = 0; i < queued; i++) {
+		buffers[i] = (uint8_t *) malloc(request);
+		fschedReadAsync(s, &reqs[i], file, next, request, buffers[i], 0, 0, NULL, NULL);
+		next += request;
+	}
+	while (done < FILE_SIZE) {
+		for (i = 0; i < queued && done < FILE_SIZE; i++) {
+			fschedRequest *req = &reqs[i];
+
+			if (fschedWait(s, req, 0) != FSCHED_OK || req->result != (req->offset + request <= FILE_SIZE ? request :
+				FILE_SIZE - req->offset) || !check_data(buffers[i], req->offset, req->result))
+				bad++;
+			done += req->result;
+			if (next < FILE_SIZE) {
+				fschedReadAsync(s, req, file, next, request, buffers[i], 0, 0, NULL, NULL);
+				next += request;
+			}
+		}
+	}
+	fschedDrain(s);
+	fschedGetStats(s, &st);
+	printf("%u byte requests, %u queued: read %.1f MB of %.1f MB, %llu ops, %llu seeks, %llu hits, %llu joined\n", request,
+	       queued, st.bytes_read / 1048576.0, FILE_SIZE / 1048576.0, (unsigned long long) st.ops,
+	       (unsigned long long) st.seeks, (unsigned long long) st.hits, (unsigned long long) st.joined);
+	CHECK(!bad, "  %u requests with wrong data", bad);
+	/* the last window may read one readahead past what was asked */
+	CHECK(st.bytes_read <= FILE_SIZE + config.readahead, "  the file was read more than once in places");
+	CHECK(st.seeks <= 2, "  %llu seeks for one sequential reader", (unsigned long long) st.seeks);
+	fschedDestroy(s);
+	for (i = 0; i < queued; i++)
+		free(buffers[i]);
+}
+
+int main(void)
+{
+	static const uint32_t sizes[] = { 100000, 65536, 333333, 1500000 };
+	char path[] = "/tmp/fsched_testXXXXXX";
+	uint8_t *data = (uint8_t *) malloc(FILE_SIZE);
+	uint32_t i;
+	int fd = mkstemp(path);
+
+	for (i = 0; i < FILE_SIZE; i++)
+		data[i] = pattern(i);
+	if (fd < 0 || write(fd, data, FILE_SIZE) != FILE_SIZE) {
+		printf("can't write %s\n", path);
+		return 1;
+	}
+	close(fd);
+	free(data);
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		sequential(path, sizes[i], 1);
+		sequential(path, sizes[i], QUEUED);
+	}
+	unlink(path);
+	printf("%s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
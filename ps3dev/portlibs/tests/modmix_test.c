@@ -0,0 +1,191 @@
+/*
+   Host test of soundlib/modmix.h in libmod mode: MODMIX_MixBlock() with the scale of
+   MODMIX_LibmodScale() against a transcription of libmod's mix_stereo_16bit() and
+   mix_mono_16bit() (loop unrolled by 4, remainder loop, per channel saturation).
+   The output and the channel state after every call must be bit-exact.
+
+   gcc -O2 -Wall -I../ppu/include modmix_test.c -o modmix_test && ./modmix_test
+*/
+
+#define MODMIX_IMPLEMENTATION
+#include <stdio.h>
+#include <stdlib.h>
+#include <soundlib/modmix.h>
+
+#define CHANNELS 8
+#define CALLS    400
+
+/* the part of libmod's channel state the mixer reads and writes */
+
+typedef struct {
+	const int8_t *data;
+	uint32_t pos;
+	uint32_t inc;
+	uint32_t loop_end, loop_length;
+	int looped;
+	int active;
+	int32_t vol;
+	int right;
+} LibmodVoice;
+
+static int16_t clamp16(int32_t s)
+{
+	return (int16_t) (s > 32767 ? 32767 : (s < -32768 ? -32768 : s));
+}
+
+/* one sample of a voice, then the end of sample test of libmod; 0 when the voice stops */
+
+static int libmod_step(LibmodVoice * v, int16_t * out, uint32_t shift)
+{
+	int32_t s = v->data[(v->pos >> 16) & 0xffff];
+
+	*out = clamp16(*out + (int32_t) ((uint32_t) ((s * v->vol) >> 6) << shift));
+	v->pos += v->inc;
+	if (v->pos >= v->loop_end << 16) {
+		if (v->looped) {
+			v->pos -= v->loop_length << 16;
+		} else {
+			v->pos = (v->loop_end - 1) << 16;
+			v->active = 0;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void libmod_mix(LibmodVoice * voices, int nvoices, int16_t * buf, uint32_t frames, int stereo, uint32_t shiftval)
+{
+	uint32_t shift = shiftval + (stereo ? 1 : 0);
+	int n;
+
+	for (n = 0; n < nvoices; n++) {
+		LibmodVoice *v = &voices[n];
+		uint32_t f = 0, g, r;
+		int16_t *out = buf + (stereo && v->right ? 1 : 0);
+		uint32_t step = stereo ? 2 : 1;
+
+		if (!v->active)
+			continue;
+		for (g = 0; g < frames / 4; g++) {
+			if (!libmod_step(v, out + f++ * step, shift) || !libmod_step(v, out + f++ * step, shift) ||
+			    !libmod_step(v, out + f++ * step, shift) || !libmod_step(v, out + f++ * step, shift))
+				break;
+		}
+		// an end inside the unrolled loop lands here too, and plays from loop_end - 1
+		for (r = 0; r < frames % 4; r++)
+			if (!libmod_step(v, out + f++ * step, shift))
+				break;
+	}
+}
+
+/* what MODMIX_FromMOD() and modmix_mod() do with a libmod voice */
+
+static void to_modmix(const LibmodVoice * v, MODMIX_Channel * c, int stereo)
+{
+	memset(c, 0, sizeof(*c));
+	c->data = (uint64_t) (uintptr_t) v->data;
+	c->pos = v->pos;
+	c->inc = v->inc;
+	c->length = v->loop_end;
+	c->loop_start = v->loop_end - v->loop_length;
+	c->loop_end = v->loop_end;
+	c->vol_l = !stereo || !v->right ? v->vol : 0;
+	c->vol_r = stereo && v->right ? v->vol : 0;
+	c->flags = (v->active ? MODMIX_ACTIVE : 0) | (v->looped ? MODMIX_LOOP : 0);
+}
+
+/* MODMIX_ToMOD(): 1 if the state matches the libmod voice */
+
+static int same_state(const MODMIX_Channel * c, const LibmodVoice * v)
+{
+	uint32_t pos = c->pos;
+	int active = 1;
+
+	while ((pos >> MODMIX_FRAC_BITS) >= c->loop_end && (c->flags & MODMIX_LOOP) && c->loop_end > c->loop_start)
+		pos -= (c->loop_end - c->loop_start) << MODMIX_FRAC_BITS;
+	if (!(c->flags & MODMIX_ACTIVE) || (pos >> MODMIX_FRAC_BITS) >= c->loop_end)
+		active = 0;
+	if (active != v->active)
+		return 0;
+	return !active || pos == v->pos;
+}
+
+static uint32_t rnd(void)
+{
+	static uint32_t seed = 0x2545f491;
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+int main(void)
+{
+	static int8_t samples[CHANNELS][6000];
+	static int16_t ref[5000 * 2], out[5000 * 2];
+	static MODMIX_Bus bus;
+	static MODMIX_Window window;
+	LibmodVoice voices[CHANNELS];
+	MODMIX_Channel ch[CHANNELS];
+	uint32_t call, n, i, tails = 0, failures = 0;
+
+	for (n = 0; n < CHANNELS; n++)
+		for (i = 0; i < 6000; i++)
+			samples[n][i] = (int8_t) rnd();
+
+	for (call = 0; call < CALLS; call++) {
+		int stereo = call % 3 != 0;
+		uint32_t shiftval = rnd() % 3;
+		uint32_t frames = call % 5 == 0 ? 2048 + rnd() % 2000 : 1 + rnd() % 1200;	// some calls are split in blocks
+		uint32_t done;
+		MODMIX_Scale sc;
+
+		// new notes: short one-shots that end inside the call, and loops
+		for (n = 0; n < CHANNELS; n++) {
+			LibmodVoice *v = &voices[n];
+			if (call && v->active && rnd() % 4)
+				continue;
+			v->data = samples[n];
+			v->loop_end = 16 + rnd() % 5900;
+			v->looped = rnd() % 3 == 0;
+			v->loop_length = v->looped ? 1 + rnd() % v->loop_end : 0;
+			v->pos = (rnd() % v->loop_end) << 16;
+			v->inc = 0x2000 + rnd() % 0x30000;
+			v->vol = rnd() % 65;
+			v->right = (n & 3) == 1 || (n & 3) == 2;
+			v->active = 1;
+		}
+		for (n = 0; n < CHANNELS; n++)
+			to_modmix(&voices[n], &ch[n], stereo);
+
+		memset(ref, 0, sizeof(ref));
+		libmod_mix(voices, CHANNELS, ref, frames, stereo, shiftval);
+		for (n = 0; n < CHANNELS; n++)
+			if ((ch[n].flags & MODMIX_ACTIVE) && !voices[n].active && frames % 4)
+				tails++;	// a one-shot that ended in a call with a remainder loop
+
+		memset(&sc, 0, sizeof(sc));
+		for (done = 0; done < frames;) {
+			uint32_t b = frames - done > MODMIX_MAX_BLOCK ? MODMIX_MAX_BLOCK : frames - done;
+			MODMIX_LibmodScale(&sc, shiftval, stereo, frames, done);
+			MODMIX_MixBlock(ch, CHANNELS, b, &sc, &bus, &window, out + done * 2);
+			done += b;
+		}
+		if (!stereo)
+			for (i = 0; i < frames; i++)
+				out[i] = out[i * 2];
+
+		for (i = 0; i < frames * (stereo ? 2 : 1); i++)
+			if (out[i] != ref[i]) {
+				printf("call %u (%s, %u frames): sample %u is %d, libmod %d\n", call, stereo ? "stereo" : "mono", frames, i, out[i],
+				       ref[i]);
+				failures++;
+				break;
+			}
+		for (n = 0; n < CHANNELS; n++)
+			if (!same_state(&ch[n], &voices[n])) {
+				printf("call %u: channel %u state differs\n", call, n);
+				failures++;
+			}
+	}
+	printf("%u calls, %u one-shot ends with a remainder, %u failures\n", CALLS, tails, failures);
+	return failures ? 1 : 0;
+}
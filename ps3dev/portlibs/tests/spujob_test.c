@@ -0,0 +1,210 @@
+/*
+   Host test of spujob/spujob.h: the workers run on pthreads, with the queues, the stealing,
+   the counters and the chaining of the SPU workers. Checks that every job runs once with its
+   input and output copied, that a continuation runs after all its jobs, that jobs queued by
+   jobs complete, that two systems run side by side, then prints the jobs per second of
+   spuJobBench() for 1 to SPUJOB_MAX_WORKERS workers.
+
+   gcc -O2 -Wall -I../ppu/include -idirafter ../../ppu/include spujob_test.c -o spujob_test -lpthread && ./spujob_test
+*/
+
+#define SPUJOB_IMPLEMENTATION
+#include <stdio.h>
+#include <spujob/spujob.h>
+
+#define JOBS     4000
+#define FAN      64
+#define CHAIN    500
+
+static volatile uint32_t runs[JOBS];
+static volatile uint32_t fan_done, fan_after;
+static volatile uint32_t chain_runs;
+
+static int failures;
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf(__VA_ARGS__); printf("\n"); failures++; } } while (0)
+
+/* binary 0: output = input * 2 + params[0], marks the job */
+static void job_double(spuJobContext *ctx, const spuJob *job, void *input, void *output)
+{
+	const uint32_t *in = (const uint32_t *) input;
+	uint32_t *out = (uint32_t *) output, i;
+
+	(void) ctx;
+	for (i = 0; i < job->input_size / 4; i++)
+		out[i] = in[i] * 2 + (uint32_t) job->params[0];
+	__atomic_add_fetch(&runs[job->params[1]], 1, __ATOMIC_RELAXED);
+}
+
+/* binary 1: one of the FAN jobs of a counter */
+static void job_fan(spuJobContext *ctx, const spuJob *job, void *input, void *output)
+{
+	(void) ctx, (void) job, (void) input, (void) output;
+	__atomic_add_fetch(&fan_done, 1, __ATOMIC_RELAXED);
+}
+
+/* binary 2: the continuation, sees how many of the FAN jobs completed */
+static void job_after(spuJobContext *ctx, const spuJob *job, void *input, void *output)
+{
+	(void) ctx, (void) job, (void) input, (void) output;
+	__atomic_store_n(&fan_after, __atomic_load_n(&fan_done, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+/* binary 3: queues the next job of the chain from the worker (params[0] ea of the next one) */
+static void job_chain(spuJobContext *ctx, const spuJob *job, void *input, void *output)
+{
+	(void) input, (void) output;
+	__atomic_add_fetch(&chain_runs, 1, __ATOMIC_RELAXED);
+	if (job->params[0])
+		ctx->push(ctx, job->params[0]);
+}
+
+static const spuJobBinary binaries[] = {
+	{ 0, 0, 0, (uint64_t) (uintptr_t) job_double, 0 },
+	{ 0, 0, 0, (uint64_t) (uintptr_t) job_fan, 0 },
+	{ 0, 0, 0, (uint64_t) (uintptr_t) job_after, 0 },
+	{ 0, 0, 0, (uint64_t) (uintptr_t) job_chain, 0 },
+};
+
+static void *alloc128(size_t size)
+{
+	void *p;
+
+	if (posix_memalign(&p, 128, size)) {
+		printf("out of memory\n");
+		exit(1);
+	}
+	memset(p, 0, size);
+	return p;
+}
+
+static void submit(spuJobSystem *sys, spuJob *job)
+{
+	while (spuJobSubmit(sys, job) == SPUJOB_EBUSY)
+		sched_yield();
+}
+
+/* every job once, with its data: two systems at the same time share nothing */
+static void test_jobs(spuJobSystem *a, spuJobSystem *b)
+{
+	spuJob *jobs = (spuJob *) alloc128(JOBS * sizeof(spuJob));
+	uint32_t *in = (uint32_t *) alloc128(JOBS * 64), *out = (uint32_t *) alloc128(JOBS * 64);
+	spuJobCounter *counter = (spuJobCounter *) alloc128(2 * sizeof(spuJobCounter));
+	uint32_t i, j, bad = 0, twice = 0;
+
+	spuJobCounterInit(&counter[0], JOBS / 2, NULL);
+	spuJobCounterInit(&counter[1], JOBS - JOBS / 2, NULL);
+	for (i = 0; i < JOBS; i++) {
+		for (j = 0; j < 16; j++)
+			in[i * 16 + j] = i * 16 + j;
+		jobs[i].binary = 0;
+		jobs[i].counter = SPUJOB_EA(&counter[i & 1]);
+		jobs[i].input = SPUJOB_EA(in + i * 16);
+		jobs[i].output = SPUJOB_EA(out + i * 16);
+		jobs[i].input_size = jobs[i].output_size = 64;
+		jobs[i].params[0] = i & 7;
+		jobs[i].params[1] = i;
+		runs[i] = 0;
+	}
+	for (i = 0; i < JOBS; i++)
+		submit(i & 1 ? b : a, &jobs[i]);
+	spuJobFenceWait(&counter[0]);
+	spuJobFenceWait(&counter[1]);
+	for (i = 0; i < JOBS; i++) {
+		if (runs[i] != 1)
+			twice++;
+		for (j = 0; j < 16; j++)
+			if (out[i * 16 + j] != (i * 16 + j) * 2 + (i & 7))
+				bad++;
+	}
+	CHECK(!twice, "jobs: %u jobs did not run exactly once", twice);
+	CHECK(!bad, "jobs: %u wrong output words", bad);
+	free(jobs);
+	free(in);
+	free(out);
+	free(counter);
+}
+
+/* FAN jobs -> a counter -> one continuation, fenced with a second counter */
+static void test_counter(spuJobSystem *sys)
+{
+	spuJob *jobs = (spuJob *) alloc128((FAN + 1) * sizeof(spuJob));
+	spuJobCounter *counter = (spuJobCounter *) alloc128(2 * sizeof(spuJobCounter));
+	uint32_t i;
+
+	fan_done = 0;
+	fan_after = 0;
+	jobs[FAN].binary = 2;
+	jobs[FAN].counter = SPUJOB_EA(&counter[1]);
+	spuJobCounterInit(&counter[1], 1, NULL);
+	spuJobCounterInit(&counter[0], FAN, &jobs[FAN]);
+	for (i = 0; i < FAN; i++) {
+		jobs[i].binary = 1;
+		jobs[i].counter = SPUJOB_EA(&counter[0]);
+		submit(sys, &jobs[i]);
+	}
+	spuJobFenceWait(&counter[1]);
+	CHECK(fan_done == FAN, "counter: %u of %u jobs ran", fan_done, FAN);
+	CHECK(fan_after == FAN, "counter: the continuation ran after %u of %u jobs", fan_after, FAN);
+	free(jobs);
+	free(counter);
+}
+
+/* a chain of CHAIN jobs, each queued by the previous one */
+static void test_chain(spuJobSystem *sys)
+{
+	spuJob *jobs = (spuJob *) alloc128(CHAIN * sizeof(spuJob));
+	spuJobCounter *counter = (spuJobCounter *) alloc128(sizeof(spuJobCounter));
+	uint32_t i;
+
+	chain_runs = 0;
+	spuJobCounterInit(counter, CHAIN, NULL);
+	for (i = 0; i < CHAIN; i++) {
+		jobs[i].binary = 3;
+		jobs[i].counter = SPUJOB_EA(counter);
+		jobs[i].params[0] = i + 1 < CHAIN ? SPUJOB_EA(&jobs[i + 1]) : 0;
+	}
+	submit(sys, &jobs[0]);
+	spuJobFenceWait(counter);
+	CHECK(chain_runs == CHAIN, "chain: %u of %u jobs ran", chain_runs, CHAIN);
+	free(jobs);
+	free(counter);
+}
+
+int main(void)
+{
+	spuJobSystem *a = spuJobSystemAlloc(), *b = spuJobSystemAlloc();
+	spuJobStats stats;
+	spuJobBenchResult r;
+	uint32_t w;
+
+	CHECK(spuJobSystemInit(a, NULL, 0, binaries, 4) == SPUJOB_EINVAL, "init: 0 workers accepted");
+	CHECK(spuJobSystemInit(a, NULL, SPUJOB_MAX_WORKERS + 1, binaries, 4) == SPUJOB_EINVAL, "init: too many workers accepted");
+
+	for (w = 1; w <= SPUJOB_MAX_WORKERS; w++) {
+		if (spuJobSystemInit(a, NULL, w, binaries, 4) != SPUJOB_OK || spuJobSystemInit(b, NULL, 3, binaries, 4) != SPUJOB_OK) {
+			printf("%u workers: init failed\n", w);
+			return 1;
+		}
+		test_jobs(a, b);
+		test_counter(a);
+		test_chain(a);
+		spuJobSystemEnd(a);
+		spuJobSystemEnd(b);
+		spuJobGetStats(a, &stats);
+		CHECK(stats.jobs == JOBS / 2 + FAN + 1 + CHAIN, "%u workers: stats count %llu jobs", w, (unsigned long long) stats.jobs);
+		CHECK(stats.chained == 1, "%u workers: stats count %llu chained jobs", w, (unsigned long long) stats.chained);
+	}
+
+	for (w = 1; w <= SPUJOB_MAX_WORKERS; w++) {
+		spuJobSystemInit(a, NULL, w, binaries, 4);
+		spuJobBench(a, 1, 200000, 0, &r);
+		spuJobSystemEnd(a);
+		printf("%u workers: %.0f jobs/s, %.3f us/job, %llu busy submits\n", w, r.jobs_per_sec, r.usecs_per_job,
+		       (unsigned long long) r.busy);
+	}
+	free(a);
+	free(b);
+	printf("%s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,225 @@
+/*
+   Host accuracy test of soundlib/vorbis_spu.h: decodes an Ogg Vorbis file with
+   VSPU_Block() (float, windowed and overlapped here) and VSPU_Synthesis() (16 bit PCM)
+   and compares both with the output of libvorbis, given as raw little endian float
+   samples, interleaved:
+
+   sox file.ogg -t f32 file.f32          (or any decoder built on libvorbis)
+
+   gcc -O2 -Wall -I../ppu/include vorbis_spu_test.c -o vorbis_spu_test -lm && ./vorbis_spu_test file.ogg file.f32
+*/
+
+#define VSPU_IMPLEMENTATION
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <soundlib/vorbis_spu.h>
+
+#define MAX_FLOAT_ERROR 1e-4	// libvorbis itself is float, the order of the sums differs
+#define MAX_PCM_ERROR   (2 / 32768.0)
+
+typedef struct {
+	uint8_t *data;
+	uint32_t bytes;
+} Packet;
+
+static void *load(const char *name, long *bytes)
+{
+	FILE *f = fopen(name, "rb");
+	void *p;
+
+	if (!f)
+		return NULL;
+	fseek(f, 0, SEEK_END);
+	*bytes = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	p = malloc(*bytes + 1);
+	if (fread(p, 1, *bytes, f) != (size_t) *bytes) {
+		free(p);
+		p = NULL;
+	}
+	fclose(f);
+	return p;
+}
+
+/* the packets of the first logical stream, joined across the lacing of the pages */
+
+static Packet *ogg_packets(const uint8_t *d, long bytes, int *count)
+{
+	Packet *v = NULL;
+	uint8_t *cur = NULL;
+	uint32_t len = 0, serial = 0;
+	long p = 0;
+	int n = 0;
+
+	while (p + 27 <= bytes && !memcmp(d + p, "OggS", 4)) {
+		uint32_t segs = d[p + 26], s;
+		long q = p + 27 + segs;
+		uint32_t page_serial = d[p + 14] | d[p + 15] << 8 | d[p + 16] << 16 | (uint32_t) d[p + 17] << 24;
+
+		if (!p)
+			serial = page_serial;
+		for (s = 0; s < segs && q <= bytes; s++) {
+			uint32_t l = d[p + 27 + s];
+			if (page_serial == serial) {
+				cur = realloc(cur, len + l + 1);
+				memcpy(cur + len, d + q, l);
+				len += l;
+				if (l < 255) {
+					v = realloc(v, (n + 1) * sizeof(*v));
+					v[n].data = cur;
+					v[n].bytes = len;
+					n++;
+					cur = NULL;
+					len = 0;
+				}
+			}
+			q += l;
+		}
+		p = q;
+	}
+	free(cur);
+	*count = n;
+	return v;
+}
+
+int main(int argc, char **argv)
+{
+	static float block[2][8192] __attribute__((aligned(16))), prev[2][8192];
+	static int16_t pcm[8192 * 2] __attribute__((aligned(16)));
+	static VSPU_Tables tables[2];
+	VSPU_Setup *s;
+	VSPU_Decoder *d, *d2;
+	Packet *packets;
+	uint8_t *file;
+	float *ref, *outf, *out16;
+	long bytes, nref, rf, nf = 0, n16 = 0, k, off, best = 0, m;
+	double best_err = 1e30, maxe = 0, maxe16 = 0;
+	uint32_t ch, pn = 0, c, j;
+	int np, i, failures = 0;
+
+	if (argc < 3) {
+		printf("usage: %s file.ogg file.f32\n", argv[0]);
+		return 2;
+	}
+	file = load(argv[1], &bytes);
+	ref = load(argv[2], &nref);
+	if (!file || !ref) {
+		printf("can't read %s\n", file ? argv[2] : argv[1]);
+		return 2;
+	}
+	nref /= sizeof(float);
+	packets = ogg_packets(file, bytes, &np);
+	if (np < 4) {
+		printf("%s: no vorbis stream\n", argv[1]);
+		return 2;
+	}
+	s = VSPU_NewSetup(packets[0].data, packets[0].bytes, packets[2].data, packets[2].bytes);
+	if (!s) {
+		printf("%s: setup rejected\n", argv[1]);
+		return 1;
+	}
+	ch = s->channels;
+	rf = nref / ch;
+	printf("%s: %u channels, %u Hz, blocks %u/%u, setup %u bytes, %d packets\n", argv[1], ch, s->rate, s->blocksize[0],
+	       s->blocksize[1], s->size, np);
+
+	d = VSPU_New(NULL);
+	d2 = VSPU_New(NULL);
+	outf = malloc(sizeof(float) * (nref + 8192 * ch));
+	out16 = malloc(sizeof(float) * (nref + 8192 * ch));
+	VSPU_BuildTables(&tables[0], s->blocksize[0]);
+	VSPU_BuildTables(&tables[1], s->blocksize[1]);
+
+	for (i = 3; i < np; i++) {
+		float *o[2] = { block[0], block[1] };
+		uint8_t head[16];
+		VSPU_Bits b;
+		VSPU_Frame f;
+		const VSPU_Tables *lt, *rt;
+		int n = VSPU_Block(d, s, packets[i].data, packets[i].bytes, o), fr;
+
+		if (n < 0) {
+			printf("packet %d: VSPU_Block %d\n", i, n);
+			failures++;
+			continue;
+		}
+		// the window and the overlap of libvorbis' vorbis_synthesis_blockin()
+		memset(head, 0, sizeof(head));
+		memcpy(head, packets[i].data, packets[i].bytes < 8 ? packets[i].bytes : 8);
+		b.data = head;
+		b.pos = 0;
+		b.end = packets[i].bytes * 8;
+		if (VSPU_DecodeHeader(s, &b, &f) != VSPU_OK) {
+			printf("packet %d: header rejected after decoding\n", i);
+			failures++;
+			continue;
+		}
+		lt = &tables[f.W ? f.lW : 0];
+		rt = &tables[f.W ? f.nW : 0];
+		for (c = 0; c < ch; c++)
+			VSPU_Window(block[c], n, lt->n, rt->n, lt, rt);
+		if (pn && nf + pn / 4 + n / 4 <= rf + 8192) {
+			for (j = 0; j < pn / 4 + n / 4; j++)
+				for (c = 0; c < ch; c++) {
+					int32_t pi = pn / 2 + j, ci = (int32_t) (j + n / 4) - (int32_t) (pn / 4);
+					outf[(nf + j) * ch + c] = (pi < (int32_t) pn ? prev[c][pi] : 0) + (ci >= 0 && ci < n ? block[c][ci] : 0);
+				}
+			nf += pn / 4 + n / 4;
+		}
+		for (c = 0; c < ch; c++)
+			memcpy(prev[c], block[c], n * sizeof(float));
+		pn = n;
+
+		fr = VSPU_Synthesis(d2, s, packets[i].data, packets[i].bytes, pcm);
+		if (fr < 0) {
+			printf("packet %d: VSPU_Synthesis %d\n", i, fr);
+			failures++;
+			continue;
+		}
+		if (n16 + fr <= rf + 8192)
+			for (k = 0; k < fr * (long) ch; k++)
+				out16[n16 * ch + k] = pcm[k] / 32768.0f;
+		n16 += fr;
+	}
+
+	// libvorbis trims the start of the stream by the granule positions, find where the reference begins
+	for (off = 0; off < 4096 && off < nf; off++) {
+		double e = 0;
+		m = rf < nf - off ? rf : nf - off;
+		if (m > 20000)
+			m = 20000;
+		for (k = 0; k < m * (long) ch; k++) {
+			double dd = outf[off * ch + k] - ref[k];
+			e += dd * dd;
+		}
+		if (e < best_err) {
+			best_err = e;
+			best = off;
+		}
+	}
+	m = rf < nf - best ? rf : nf - best;
+	for (k = 0; k < m * (long) ch; k++) {
+		double r = ref[k] > 32767 / 32768.0 ? 32767 / 32768.0 : (ref[k] < -1 ? -1 : ref[k]);
+		if (fabs(outf[best * ch + k] - ref[k]) > maxe)
+			maxe = fabs(outf[best * ch + k] - ref[k]);
+		if (best * ch + k < n16 * (long) ch && fabs(out16[best * ch + k] - r) > maxe16)
+			maxe16 = fabs(out16[best * ch + k] - r);
+	}
+	printf("%ld frames (%ld pcm, %ld reference), offset %ld, float error %.3g, pcm error %.3g\n", nf, n16, rf, best, maxe, maxe16);
+	if (m < rf - 8192 || maxe > MAX_FLOAT_ERROR || maxe16 > MAX_PCM_ERROR)
+		failures++;
+
+	VSPU_Delete(d);
+	VSPU_Delete(d2);
+	VSPU_DeleteSetup(s);
+	for (i = 0; i < np; i++)
+		free(packets[i].data);
+	free(packets);
+	free(outf);
+	free(out16);
+	free(ref);
+	free(file);
+	printf("%s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,636 @@
+/*! \file input.h
+    \brief Input sampling thread for pads, keyboards, mice and PS Move.
+
+    The input service samples every device on its own thread at a fixed rate
+    (e.g. 240 Hz) and publishes the result in a triple buffered state block:
+    the game thread gets the newest consistent state with \ref inputRead
+    without a syscall and without waiting for the sampling thread. Button and
+    key transitions seen between two reads are not lost, they are queued as
+    timestamped edge events (\ref inputPollEvent).
+
+    Devices are read through an \ref inputDevice: \ref inputDeviceSystem uses
+    ioPad, ioKb and ioMouse and can chain another device (the Move controllers
+    come from the one of libmove/moveinput.h in the portlibs),
+    \ref inputDeviceReplay plays recorded states, also on the host.
+
+    The libraries of the devices must be initialized by the caller
+    (ioPadInit(), ioKbInit(), ioMouseInit()). Define \c INPUT_IMPLEMENTATION
+    in one source file.
+*/
+
+#ifndef __LV2_INPUT_H__
+#define __LV2_INPUT_H__
+
+#include <ppu-types.h>
+#include <string.h>
+
+#ifdef __PPU__
+#include <io/pad.h>
+#include <io/kb.h>
+#include <io/mouse.h>
+#include <sys/thread.h>
+#include <sys/systime.h>
+#include <sys/atomic.h>
+#include <lv2/systime.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#define INPUT_MAX_PADS            (7)       /*!< pads sampled */
+#define INPUT_MAX_MICE            (2)       /*!< mice sampled */
+#define INPUT_MAX_MOVES           (4)       /*!< Move controllers sampled */
+#define INPUT_EVENT_QUEUE         (256)     /*!< edge events kept between two polls, power of 2 */
+
+/* digital pad buttons, padData.button[2] << 8 | padData.button[3] */
+#define INPUT_PAD_LEFT            (0x8000)
+#define INPUT_PAD_DOWN            (0x4000)
+#define INPUT_PAD_RIGHT           (0x2000)
+#define INPUT_PAD_UP              (0x1000)
+#define INPUT_PAD_START           (0x0800)
+#define INPUT_PAD_R3              (0x0400)
+#define INPUT_PAD_L3              (0x0200)
+#define INPUT_PAD_SELECT          (0x0100)
+#define INPUT_PAD_SQUARE          (0x0080)
+#define INPUT_PAD_CROSS           (0x0040)
+#define INPUT_PAD_CIRCLE          (0x0020)
+#define INPUT_PAD_TRIANGLE        (0x0010)
+#define INPUT_PAD_R1              (0x0008)
+#define INPUT_PAD_L1              (0x0004)
+#define INPUT_PAD_R2              (0x0002)
+#define INPUT_PAD_L2              (0x0001)
+
+/* inputEvent.device */
+#define INPUT_DEVICE_PAD          (0)
+#define INPUT_DEVICE_KEYBOARD     (1)
+#define INPUT_DEVICE_MOUSE        (2)
+#define INPUT_DEVICE_MOVE         (3)
+
+/* inputEvent.type */
+#define INPUT_EVENT_RELEASE       (0)
+#define INPUT_EVENT_PRESS         (1)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! \brief State of every device at one sampling instant. */
+typedef struct _input_state
+{
+    u64 seq;                                /*!< \brief sample number */
+    s64 time;                               /*!< \brief sample time (microseconds) */
+
+    u32 pad_connected;                      /*!< \brief bit n: pad n connected */
+    u16 pad_buttons[INPUT_MAX_PADS];        /*!< \brief INPUT_PAD_* */
+    u8 pad_analog[INPUT_MAX_PADS][4];       /*!< \brief right H, right V, left H, left V (\c 0x00 - \c 0xFF, \c 0x80 centered) */
+
+    u32 kb_connected;                       /*!< \brief bit n: keyboard n connected */
+    u32 kb_mkeys;                           /*!< \brief modifier keys (KbMkey) of all keyboards */
+    u32 kb_keys[8];                         /*!< \brief bit map of the raw key codes held, all keyboards */
+
+    u32 mouse_connected;                    /*!< \brief bit n: mouse n connected */
+    u8 mouse_buttons[INPUT_MAX_MICE];       /*!< \brief button bits */
+    s32 mouse_x[INPUT_MAX_MICE];            /*!< \brief motion accumulated since the service started */
+    s32 mouse_y[INPUT_MAX_MICE];
+    s32 mouse_wheel[INPUT_MAX_MICE];
+    s16 mouse_dx[INPUT_MAX_MICE];           /*!< \brief motion reported by the device in this sample */
+    s16 mouse_dy[INPUT_MAX_MICE];
+    s16 mouse_dwheel[INPUT_MAX_MICE];
+
+    u32 move_connected;                     /*!< \brief bit n: Move controller n connected */
+    u16 move_buttons[INPUT_MAX_MOVES];      /*!< \brief button bits of the Move controllers */
+} inputState;
+
+/*! \brief Button or key transition. */
+typedef struct _input_event
+{
+    s64 time;                               /*!< \brief sample time of the transition (microseconds) */
+    u8 device;                              /*!< \brief INPUT_DEVICE_* */
+    u8 port;                                /*!< \brief pad, keyboard, mouse or Move number */
+    u8 type;                                /*!< \brief INPUT_EVENT_PRESS or INPUT_EVENT_RELEASE */
+    u8 reserved;
+    u32 code;                               /*!< \brief INPUT_PAD_* bit, raw key code, mouse button bit or Move button bit */
+} inputEvent;
+
+/*! \brief A source of samples. */
+typedef struct _input_device
+{
+    /*! \brief Fills the device fields of \c state (the previous sample on entry). Returns zero if no error occured. */
+    s32 (*sample)(void *user, inputState *state);
+    void *user;
+} inputDevice;
+
+/*! \brief Counters of the service. */
+typedef struct _input_stats
+{
+    u64 samples;                            /*!< \brief samples taken */
+    u64 dropped_samples;                    /*!< \brief sampling periods missed because the thread ran late */
+    u64 events;                             /*!< \brief edge events queued */
+    u64 dropped_events;                     /*!< \brief edge events lost on a full queue */
+    u64 reads;                              /*!< \brief calls to inputRead() */
+    u64 stale_reads;                        /*!< \brief reads without a new sample */
+    u32 latency_last;                       /*!< \brief age of the state returned by the last read (microseconds) */
+    u32 latency_max;
+    u32 latency_avg;
+    u32 sample_cost_max;                    /*!< \brief longest device sampling (microseconds) */
+} inputStats;
+
+/*! \brief Recorded states played by \ref inputDeviceReplay. */
+typedef struct _input_replay
+{
+    const inputState *frames;
+    u32 count;
+    u32 next;
+    u32 loop;
+} inputReplay;
+
+/*! \brief Input service; the structure is opaque to the caller. */
+typedef struct _input_service
+{
+    inputState slots[3];
+    volatile u32 middle;                    /* slot index, INPUT_FRESH when not read yet */
+    u32 back;                               /* sampling thread slot */
+    u32 front;                              /* reader slot */
+    inputState prev;
+
+    inputEvent events[INPUT_EVENT_QUEUE];
+    volatile u32 event_head;                /* written by the sampling thread */
+    volatile u32 event_tail;                /* written by the reader */
+
+    inputDevice device;
+    u32 period;                             /* microseconds */
+    volatile u32 running;
+    inputStats stats;
+    u64 latency_sum;
+#ifdef __PPU__
+    sys_ppu_thread_t thread;
+#else
+    pthread_t thread;
+#endif
+} inputService;
+
+/*! \brief Start the sampling thread.
+    \param service Pointer to the service structure.
+    \param device Device to sample, NULL for \ref inputDeviceSystem.
+    \param rate Samples per second.
+    \param priority Priority of the sampling thread (ignored on the host).
+    \return zero if no error occured, nonzero otherwise.
+*/
+s32 inputServiceStart(inputService *service, const inputDevice *device, u32 rate, s32 priority);
+
+/*! \brief Stop the sampling thread.
+    \param service Pointer to the service structure.
+    \return zero if no error occured, nonzero otherwise.
+*/
+s32 inputServiceStop(inputService *service);
+
+/*! \brief Get the newest sample. Wait free, no syscall; call from one thread only.
+    \param service Pointer to the service structure.
+    \param state Pointer to the storage of the state.
+    \return nonzero if the state is newer than the one of the previous call.
+*/
+s32 inputRead(inputService *service, inputState *state);
+
+/*! \brief Get the next edge event, oldest first; call from the thread of \ref inputRead.
+    \param service Pointer to the service structure.
+    \param event Pointer to the storage of the event.
+    \return nonzero if an event was returned.
+*/
+s32 inputPollEvent(inputService *service, inputEvent *event);
+
+/*! \brief Get the counters of the service.
+    \param service Pointer to the service structure.
+    \param stats Pointer to the storage of the counters.
+*/
+void inputGetStats(inputService *service, inputStats *stats);
+
+/*! \brief Test a key of the state.
+    \param state Pointer to the state.
+    \param code Raw key code.
+*/
+static inline s32 inputKeyDown(const inputState *state, u32 code)
+{
+    return (state->kb_keys[(code >> 5) & 7] >> (code & 31)) & 1;
+}
+
+/*! \brief Device reading ioPad, ioKb and ioMouse.
+    \param device Pointer to the device to fill.
+    \param extra Device sampled after them into the same state (e.g. the Move controllers), NULL for none.
+*/
+void inputDeviceSystem(inputDevice *device, const inputDevice *extra);
+
+/*! \brief Device playing recorded states, one per sample.
+    \param device Pointer to the device to fill.
+    \param replay Pointer to the replay state, kept by the caller.
+    \param frames Recorded states (the \c seq and \c time fields are ignored).
+    \param count Number of frames.
+    \param loop Nonzero to restart at the end, otherwise the last frame is held.
+*/
+void inputDeviceReplay(inputDevice *device, inputReplay *replay, const inputState *frames, u32 count, s32 loop);
+
+#ifdef INPUT_IMPLEMENTATION
+
+#define INPUT_FRESH               (0x80000000)
+
+#ifdef __PPU__
+#define INPUT_RELEASE()           __asm__ volatile ("lwsync" ::: "memory")
+#define INPUT_ACQUIRE()           __asm__ volatile ("lwsync" ::: "memory")
+#define INPUT_XCHG(p, v)          __xchg_u32((p), (v))
+
+static s64 input_time(void)
+{
+    return sysGetSystemTime();
+}
+
+static void input_sleep(u32 us)
+{
+    sysUsleep(us);
+}
+#else
+#define INPUT_RELEASE()           __sync_synchronize()
+#define INPUT_ACQUIRE()           __sync_synchronize()
+#define INPUT_XCHG(p, v)          __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+
+static s64 input_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (s64) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void input_sleep(u32 us)
+{
+    struct timespec ts = { us / 1000000, (long) (us % 1000000) * 1000 };
+
+    nanosleep(&ts, NULL);
+}
+#endif
+
+#ifdef __PPU__
+
+typedef struct
+{
+    inputDevice extra;
+    u32 kb_configured;
+    u32 kb_mkeys[MAX_KB_PORT_NUM];          /* last packet of every keyboard, kept while it reports no change */
+    u32 kb_keys[MAX_KB_PORT_NUM][8];
+} input_system;
+
+static input_system input_system_device;
+
+static s32 input_system_sample(void *user, inputState *state)
+{
+    input_system *sys = (input_system *) user;
+    padInfo pinfo;
+    KbInfo kinfo;
+    mouseInfo minfo;
+    u32 i, j;
+
+    if (ioPadGetInfo(&pinfo) == 0) {
+        state->pad_connected = 0;
+        for (i = 0; i < INPUT_MAX_PADS && i < pinfo.max; i++) {
+            padData data;
+
+            if (!pinfo.status[i]) {
+                /* unplugged: release what it held */
+                state->pad_buttons[i] = 0;
+                memset(state->pad_analog[i], 0x80, sizeof(state->pad_analog[i]));
+                continue;
+            }
+            state->pad_connected |= 1 << i;
+            /* len 0: no change since the last read */
+            if (ioPadGetData(i, &data) != 0 || data.len == 0)
+                continue;
+            state->pad_buttons[i] = (u16) (((data.button[2] & 0xff) << 8) | (data.button[3] & 0xff));
+            for (j = 0; j < 4; j++)
+                state->pad_analog[i][j] = (u8) data.button[4 + j];
+        }
+    }
+
+    if (ioKbGetInfo(&kinfo) == 0) {
+        state->kb_connected = 0;
+        state->kb_mkeys = 0;
+        memset(state->kb_keys, 0, sizeof(state->kb_keys));
+        for (i = 0; i < MAX_KB_PORT_NUM && i < kinfo.max; i++) {
+            KbData data;
+
+            if (!kinfo.status[i]) {
+                sys->kb_configured &= ~(1 << i);
+                sys->kb_mkeys[i] = 0;
+                memset(sys->kb_keys[i], 0, sizeof(sys->kb_keys[i]));
+                continue;
+            }
+            state->kb_connected |= 1 << i;
+            if (!(sys->kb_configured & (1 << i))) {
+                /* the held keys are only reported in packet mode */
+                ioKbSetReadMode(i, KB_RMODE_PACKET);
+                ioKbSetCodeType(i, KB_CODETYPE_RAW);
+                sys->kb_configured |= 1 << i;
+            }
+            /* nb_keycode 0: no change since the last read */
+            if (ioKbRead(i, &data) == 0 && data.nb_keycode > 0) {
+                memset(sys->kb_keys[i], 0, sizeof(sys->kb_keys[i]));
+                sys->kb_mkeys[i] = data.mkey._KbMkeyU.mkeys;
+                for (j = 0; j < (u32) data.nb_keycode && j < MAX_KEYCODES; j++) {
+                    u32 code = data.keycode[j] & 0xff;
+                    if (code)
+                        sys->kb_keys[i][code >> 5] |= 1 << (code & 31);
+                }
+            }
+            state->kb_mkeys |= sys->kb_mkeys[i];
+            for (j = 0; j < 8; j++)
+                state->kb_keys[j] |= sys->kb_keys[i][j];
+        }
+    }
+
+    memset(state->mouse_dx, 0, sizeof(state->mouse_dx));
+    memset(state->mouse_dy, 0, sizeof(state->mouse_dy));
+    memset(state->mouse_dwheel, 0, sizeof(state->mouse_dwheel));
+    if (ioMouseGetInfo(&minfo) == 0) {
+        state->mouse_connected = 0;
+        for (i = 0; i < INPUT_MAX_MICE && i < minfo.max; i++) {
+            mouseDataList list;
+
+            if (!minfo.status[i]) {
+                state->mouse_buttons[i] = 0;
+                continue;
+            }
+            state->mouse_connected |= 1 << i;
+            if (ioMouseGetDataList(i, &list) != 0)
+                continue;
+            for (j = 0; j < list.count && j < MOUSE_MAX_DATA_LIST; j++) {
+                if (!list.list[j].update)
+                    continue;
+                state->mouse_buttons[i] = list.list[j].buttons;
+                state->mouse_dx[i] += list.list[j].x_axis;
+                state->mouse_dy[i] += list.list[j].y_axis;
+                state->mouse_dwheel[i] += list.list[j].wheel;
+            }
+        }
+    }
+
+    if (sys->extra.sample)
+        return sys->extra.sample(sys->extra.user, state);
+    return 0;
+}
+
+void inputDeviceSystem(inputDevice *device, const inputDevice *extra)
+{
+    memset(&input_system_device, 0, sizeof(input_system_device));
+    if (extra)
+        input_system_device.extra = *extra;
+    device->sample = input_system_sample;
+    device->user = &input_system_device;
+}
+
+#endif /* __PPU__ */
+
+static s32 input_replay_sample(void *user, inputState *state)
+{
+    inputReplay *rep = (inputReplay *) user;
+    u64 seq = state->seq;
+    s64 time = state->time;
+
+    if (!rep->count)
+        return -1;
+    if (rep->next >= rep->count) {
+        if (!rep->loop) {
+            /* hold the last frame, without repeating its motion */
+            memset(state->mouse_dx, 0, sizeof(state->mouse_dx));
+            memset(state->mouse_dy, 0, sizeof(state->mouse_dy));
+            memset(state->mouse_dwheel, 0, sizeof(state->mouse_dwheel));
+            return 0;
+        }
+        rep->next = 0;
+    }
+    *state = rep->frames[rep->next++];
+    state->seq = seq;
+    state->time = time;
+    return 0;
+}
+
+void inputDeviceReplay(inputDevice *device, inputReplay *replay, const inputState *frames, u32 count, s32 loop)
+{
+    replay->frames = frames;
+    replay->count = count;
+    replay->next = 0;
+    replay->loop = loop != 0;
+    device->sample = input_replay_sample;
+    device->user = replay;
+}
+
+static void input_push_event(inputService *s, s64 time, u32 device, u32 port, u32 type, u32 code)
+{
+    u32 head = s->event_head;
+    inputEvent *e;
+
+    if (head - s->event_tail >= INPUT_EVENT_QUEUE) {
+        s->stats.dropped_events++;
+        return;
+    }
+    e = &s->events[head & (INPUT_EVENT_QUEUE - 1)];
+    e->time = time;
+    e->device = (u8) device;
+    e->port = (u8) port;
+    e->type = (u8) type;
+    e->reserved = 0;
+    e->code = code;
+    INPUT_RELEASE();
+    s->event_head = head + 1;
+    s->stats.events++;
+}
+
+static void input_push_edges(inputService *s, s64 time, u32 device, u32 port, u32 before, u32 after, u32 base)
+{
+    u32 changed = before ^ after;
+
+    while (changed) {
+        u32 bit = changed & (~changed + 1);
+
+        input_push_event(s, time, device, port, (after & bit) ? INPUT_EVENT_PRESS : INPUT_EVENT_RELEASE,
+                         base == 0xffffffff ? bit : base + (u32) __builtin_ctz(bit));
+        changed &= changed - 1;
+    }
+}
+
+static void input_edges(inputService *s, const inputState *a, const inputState *b)
+{
+    u32 i;
+
+    for (i = 0; i < INPUT_MAX_PADS; i++)
+        input_push_edges(s, b->time, INPUT_DEVICE_PAD, i, a->pad_buttons[i], b->pad_buttons[i], 0xffffffff);
+    for (i = 0; i < 8; i++)
+        input_push_edges(s, b->time, INPUT_DEVICE_KEYBOARD, 0, a->kb_keys[i], b->kb_keys[i], i * 32);
+    for (i = 0; i < INPUT_MAX_MICE; i++)
+        input_push_edges(s, b->time, INPUT_DEVICE_MOUSE, i, a->mouse_buttons[i], b->mouse_buttons[i], 0xffffffff);
+    for (i = 0; i < INPUT_MAX_MOVES; i++)
+        input_push_edges(s, b->time, INPUT_DEVICE_MOVE, i, a->move_buttons[i], b->move_buttons[i], 0xffffffff);
+}
+
+static void input_sample(inputService *s)
+{
+    inputState *next = &s->slots[s->back];
+    s64 start = input_time(), cost;
+    u32 i;
+
+    *next = s->prev;
+    next->seq = s->prev.seq + 1;
+    next->time = start;
+    if (s->device.sample(s->device.user, next) != 0) {
+        s->stats.dropped_samples++;
+        return;
+    }
+    for (i = 0; i < INPUT_MAX_MICE; i++) {
+        next->mouse_x[i] = s->prev.mouse_x[i] + next->mouse_dx[i];
+        next->mouse_y[i] = s->prev.mouse_y[i] + next->mouse_dy[i];
+        next->mouse_wheel[i] = s->prev.mouse_wheel[i] + next->mouse_dwheel[i];
+    }
+    input_edges(s, &s->prev, next);
+    s->prev = *next;
+
+    /* publish: the back slot becomes the middle one, the old middle slot is reused */
+    INPUT_RELEASE();
+    s->back = INPUT_XCHG(&s->middle, s->back | INPUT_FRESH) & ~INPUT_FRESH;
+
+    cost = input_time() - start;
+    if (cost > (s64) s->stats.sample_cost_max)
+        s->stats.sample_cost_max = (u32) cost;
+    s->stats.samples++;
+}
+
+#ifdef __PPU__
+static void input_thread(void *arg)
+#else
+static void *input_thread(void *arg)
+#endif
+{
+    inputService *s = (inputService *) arg;
+    s64 deadline = input_time();
+
+    while (s->running) {
+        s64 now;
+
+        input_sample(s);
+        deadline += s->period;
+        now = input_time();
+        if (now > deadline + s->period) {
+            /* woke up late: skip the periods that were missed */
+            u64 missed = (u64) (now - deadline) / s->period;
+            s->stats.dropped_samples += missed;
+            deadline += (s64) missed * s->period;
+        }
+        if (deadline > now)
+            input_sleep((u32) (deadline - now));
+    }
+#ifdef __PPU__
+    sysThreadExit(0);
+#else
+    return NULL;
+#endif
+}
+
+s32 inputServiceStart(inputService *service, const inputDevice *device, u32 rate, s32 priority)
+{
+    if (!rate)
+        return -1;
+    memset(service, 0, sizeof(*service));
+    if (device) {
+        service->device = *device;
+    } else {
+#ifdef __PPU__
+        inputDeviceSystem(&service->device, NULL);
+#else
+        return -1;
+#endif
+    }
+    service->period = 1000000 / rate;
+    if (!service->period)
+        service->period = 1;
+    service->front = 0;
+    service->middle = 1;
+    service->back = 2;
+    service->running = 1;
+
+#ifdef __PPU__
+    if (sysThreadCreate(&service->thread, input_thread, service, priority, 0x4000, THREAD_JOINABLE, (char *) "input service")) {
+        service->running = 0;
+        return -1;
+    }
+#else
+    (void) priority;
+    if (pthread_create(&service->thread, NULL, input_thread, service)) {
+        service->running = 0;
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+s32 inputServiceStop(inputService *service)
+{
+    if (!service->running)
+        return -1;
+    service->running = 0;
+#ifdef __PPU__
+    {
+        u64 retval;
+        sysThreadJoin(service->thread, &retval);
+    }
+#else
+    pthread_join(service->thread, NULL);
+#endif
+    return 0;
+}
+
+s32 inputRead(inputService *service, inputState *state)
+{
+    inputStats *st = &service->stats;
+    s32 fresh = (service->middle & INPUT_FRESH) != 0;
+    s64 age;
+
+    if (fresh) {
+        service->front = INPUT_XCHG(&service->middle, service->front) & ~INPUT_FRESH;
+        INPUT_ACQUIRE();
+    }
+    *state = service->slots[service->front];
+
+    st->reads++;
+    if (!fresh) {
+        st->stale_reads++;
+    } else {
+        age = input_time() - state->time;
+        st->latency_last = age > 0 ? (u32) age : 0;
+        if (st->latency_last > st->latency_max)
+            st->latency_max = st->latency_last;
+        service->latency_sum += st->latency_last;
+        st->latency_avg = (u32) (service->latency_sum / (st->reads - st->stale_reads));
+    }
+    return fresh;
+}
+
+s32 inputPollEvent(inputService *service, inputEvent *event)
+{
+    u32 tail = service->event_tail;
+
+    if (tail == service->event_head)
+        return 0;
+    INPUT_ACQUIRE();
+    *event = service->events[tail & (INPUT_EVENT_QUEUE - 1)];
+    INPUT_RELEASE();
+    service->event_tail = tail + 1;
+    return 1;
+}
+
+void inputGetStats(inputService *service, inputStats *stats)
+{
+    *stats = service->stats;
+}
+
+#endif /* INPUT_IMPLEMENTATION */
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif
@@ -27,6 +27,134 @@ s32 spursAttributeSetSpuThreadGroupType(SpursAttribute* attr, int type);
 s32 spursAttributeEnableSpuPrintfIfAvailable(SpursAttribute* attr);
 s32	spursAttributeSetMemoryContainerForSpuThread(SpursAttribute* attr,sys_mem_container_t container);
 
+/* revision arguments of the *Initialize calls below, as used by spursAttributeInitialize */
+#define SPURS_SDK_VERSION					0x330000
+#define SPURS_TASKSET_ATTRIBUTE_REVISION	1
+#define SPURS_TASKSET_ATTRIBUTE2_REVISION	1
+#define SPURS_TASK_ATTRIBUTE2_REVISION		1
+#define SPURS_JOB_REVISION					3
+
+/* taskset: a workload scheduling up to SPURS_MAX_TASK SPU ELF tasks, its id works with spursSetPriorities/spursSetMaxContention */
+s32 spursCreateTaskset(Spurs* spurs,SpursTaskset* taskset,u64 argTaskset,const u8 priority[SPURS_MAX_SPU],u32 maxContention);
+s32 spursTasksetAttributeInitialize(SpursTasksetAttribute* attr,u32 revision,u32 sdkVersion,u64 argTaskset,const u8 priority[SPURS_MAX_SPU],u32 maxContention);
+s32 spursTasksetAttributeSetName(SpursTasksetAttribute* attr,const char* name);
+s32 spursTasksetAttributeSetTasksetSize(SpursTasksetAttribute* attr,size_t size);
+s32 spursTasksetAttributeEnableClearLS(SpursTasksetAttribute* attr,s32 enable);
+s32 spursCreateTasksetWithAttribute(Spurs* spurs,SpursTaskset* taskset,const SpursTasksetAttribute* attr);
+s32 spursShutdownTaskset(SpursTaskset* taskset);
+s32 spursJoinTaskset(SpursTaskset* taskset);
+s32 spursGetTasksetId(const SpursTaskset* taskset,u32* workloadId);
+s32 spursTasksetGetSpursAddress(const SpursTaskset* taskset,Spurs** spurs);
+s32 spursLookUpTasksetAddress(Spurs* spurs,SpursTaskset** taskset,u32 workloadId);
+
+/* elf: SPU ELF image (16 byte aligned), context NULL for a task that is never preempted */
+s32 spursCreateTask(SpursTaskset* taskset,SpursTaskId* taskId,const void* elf,const void* context,u32 sizeContext,const SpursTaskLsPattern* lsPattern,const SpursTaskArgument* argument);
+s32 spursTaskExitCodeInitialize(SpursTaskExitCode* exitCode);
+s32 spursTaskExitCodeGet(SpursTaskExitCode* exitCode,s32* status);
+s32 spursTaskExitCodeTryGet(SpursTaskExitCode* exitCode,s32* status);
+s32 spursTaskGetContextSaveAreaSize(u32* size,const SpursTaskLsPattern* lsPattern);
+s32 spursTaskGetLoadableSegmentPattern(SpursTaskLsPattern* lsPattern,const void* elf);
+
+/* taskset2: tasks with a name and an exit code returned by spursJoinTask2 */
+s32 spursTasksetAttribute2Initialize(SpursTasksetAttribute2* attr,u32 revision);
+s32 spursCreateTaskset2(Spurs* spurs,SpursTaskset2* taskset,const SpursTasksetAttribute2* attr);
+s32 spursDestroyTaskset2(SpursTaskset2* taskset);
+s32 spursTaskAttribute2Initialize(SpursTaskAttribute2* attr,u32 revision);
+s32 spursCreateTask2(SpursTaskset2* taskset,SpursTaskId* taskId,const void* elf,const SpursTaskArgument* argument,const SpursTaskAttribute2* attr);
+s32 spursJoinTask2(SpursTaskset2* taskset,SpursTaskId taskId,s32* exitCode);
+s32 spursTryJoinTask2(SpursTaskset2* taskset,SpursTaskId taskId,s32* exitCode);
+
+/* event flag: 16 bits, owned by a taskset (spurs NULL) or by the spurs instance (taskset NULL) */
+s32 spursEventFlagInitialize(Spurs* spurs,SpursTaskset* taskset,SpursEventFlag* eventFlag,u32 clearMode,u32 direction);
+s32 spursEventFlagAttachLv2EventQueue(SpursEventFlag* eventFlag);
+s32 spursEventFlagDetachLv2EventQueue(SpursEventFlag* eventFlag);
+s32 spursEventFlagSet(SpursEventFlag* eventFlag,u16 bits);
+s32 spursEventFlagClear(SpursEventFlag* eventFlag,u16 bits);
+s32 spursEventFlagWait(SpursEventFlag* eventFlag,u16* mask,u32 mode);
+s32 spursEventFlagTryWait(SpursEventFlag* eventFlag,u16* mask,u32 mode);
+s32 spursEventFlagGetDirection(const SpursEventFlag* eventFlag,u32* direction);
+s32 spursEventFlagGetClearMode(const SpursEventFlag* eventFlag,u32* clearMode);
+s32 spursEventFlagGetTasksetAddress(const SpursEventFlag* eventFlag,SpursTaskset** taskset);
+
+/* lock-free queue: owned by a taskset or by the spurs instance (pass either one) */
+s32 spursLFQueueInitialize(void* tasksetOrSpurs,SpursLFQueue* queue,const void* buffer,u32 entrySize,u32 depth,u32 direction);
+s32 spursLFQueueAttachLv2EventQueue(SpursLFQueue* queue);
+s32 spursLFQueueDetachLv2EventQueue(SpursLFQueue* queue);
+s32 spursLFQueuePushBody(SpursLFQueue* queue,const void* entry,u32 isBlocking);
+s32 spursLFQueuePopBody(SpursLFQueue* queue,void* entry,u32 isBlocking);
+s32 spursLFQueueGetTasksetAddress(const SpursLFQueue* queue,SpursTaskset** taskset);
+
+static inline s32 spursLFQueuePush(SpursLFQueue* queue,const void* entry) { return spursLFQueuePushBody(queue,entry,1); }
+static inline s32 spursLFQueueTryPush(SpursLFQueue* queue,const void* entry) { return spursLFQueuePushBody(queue,entry,0); }
+static inline s32 spursLFQueuePop(SpursLFQueue* queue,void* entry) { return spursLFQueuePopBody(queue,entry,1); }
+static inline s32 spursLFQueueTryPop(SpursLFQueue* queue,void* entry) { return spursLFQueuePopBody(queue,entry,0); }
+
+/* job chain: a list of SPURS_JOB_COMMAND_* run by the job manager workload */
+#define SPURS_JOB_OPCODE_NOP				0
+#define SPURS_JOB_OPCODE_RESET_PC			1
+#define SPURS_JOB_OPCODE_SYNC				(2|(0<<3))
+#define SPURS_JOB_OPCODE_LWSYNC				(2|(2<<3))
+#define SPURS_JOB_OPCODE_NEXT				3
+#define SPURS_JOB_OPCODE_CALL				4
+#define SPURS_JOB_OPCODE_FLUSH				5
+#define SPURS_JOB_OPCODE_JOBLIST			6
+#define SPURS_JOB_OPCODE_ABORT				(7|(0<<3))
+#define SPURS_JOB_OPCODE_GUARD				(7|(1<<3))
+#define SPURS_JOB_OPCODE_RET				(7|(14<<3))
+#define SPURS_JOB_OPCODE_END				(7|(15<<3))
+
+#define SPURS_JOB_COMMAND_JOB(job)			((u64)(uintptr_t)(job))
+#define SPURS_JOB_COMMAND_NEXT(cmds)		(SPURS_JOB_OPCODE_NEXT|(u64)(uintptr_t)(cmds))
+#define SPURS_JOB_COMMAND_CALL(cmds)		(SPURS_JOB_OPCODE_CALL|(u64)(uintptr_t)(cmds))
+#define SPURS_JOB_COMMAND_GUARD(guard)		(SPURS_JOB_OPCODE_GUARD|(u64)(uintptr_t)(guard))
+#define SPURS_JOB_COMMAND_SYNC				((u64)SPURS_JOB_OPCODE_SYNC)
+#define SPURS_JOB_COMMAND_LWSYNC			((u64)SPURS_JOB_OPCODE_LWSYNC)
+#define SPURS_JOB_COMMAND_RET				((u64)SPURS_JOB_OPCODE_RET)
+#define SPURS_JOB_COMMAND_END				((u64)SPURS_JOB_OPCODE_END)
+
+s32 spursJobChainAttributeInitialize(u32 jmRevision,u32 sdkRevision,SpursJobChainAttribute* attr,const u64* jobChainEntry,u16 sizeJobDescriptor,u16 maxGrabbedJob,const u8 priority[SPURS_MAX_SPU],u32 maxContention,bool autoRequestSpuCount,u32 tag1,u32 tag2,bool isFixedMemAlloc,u32 maxSizeJobDescriptor,u32 initialRequestSpuCount);
+s32 spursJobChainAttributeSetName(SpursJobChainAttribute* attr,const char* name);
+s32 spursJobChainAttributeSetHaltOnError(SpursJobChainAttribute* attr);
+s32 spursCreateJobChainWithAttribute(Spurs* spurs,SpursJobChain* jobChain,const SpursJobChainAttribute* attr);
+s32 spursRunJobChain(SpursJobChain* jobChain);
+s32 spursJoinJobChain(SpursJobChain* jobChain);
+s32 spursShutdownJobChain(SpursJobChain* jobChain);
+s32 spursGetJobChainId(const SpursJobChain* jobChain,u32* workloadId);
+s32 spursJobChainGetError(SpursJobChain* jobChain,void** cause);
+s32 spursJobSetMaxGrab(SpursJobChain* jobChain,u32 maxGrabbedJob);
+
+/* trace: the kernel writes SpursTracePacket records after a SpursTraceInfo head, buffer 16 byte aligned */
+s32 spursTraceInitialize(Spurs* spurs,SpursTraceInfo* buffer,u32 size,u32 mode);
+s32 spursTraceStart(Spurs* spurs);
+s32 spursTraceStop(Spurs* spurs);
+s32 spursTraceFinalize(Spurs* spurs);
+
+/* bytes of a trace buffer holding packets records per SPU */
+static inline u32 spursTraceBufferSize(u32 nSpus,u32 packets)
+{
+	return sizeof(SpursTraceInfo) + nSpus*packets*sizeof(SpursTracePacket);
+}
+
+/*
+ * Calls func on the packets of one SPU, oldest first, once the trace is stopped.
+ * The packet area is split evenly between the SPUs, in wrap mode an SPU overwrites its oldest packets.
+ * Returns the number of packets visited.
+ */
+static inline u32 spursTraceForEach(const SpursTraceInfo* info,u32 size,u32 spu,void (*func)(const SpursTracePacket* packet,void* user),void* user)
+{
+	const SpursTracePacket *packets = (const SpursTracePacket*)(info + 1);
+	u32 capacity,count,first,i;
+
+	if(!info->numSpus || spu>=info->numSpus || size<sizeof(SpursTraceInfo)) return 0;
+	capacity = (size - sizeof(SpursTraceInfo))/sizeof(SpursTracePacket)/info->numSpus;
+	packets += spu*capacity;
+	count = info->count[spu];
+	first = count>capacity ? count%capacity : 0;
+	if(count>capacity) count = capacity;
+	for(i=0;i<count;i++) func(&packets[(first + i)%capacity],user);
+	return count;
+}
+
 #ifdef __cplusplus
 	}
 #endif
@@ -54,6 +54,207 @@ typedef struct SpursAttribute {
 	unsigned char	skip[SPURS_ATTRIBUTE_SIZE];
 } __attribute__((aligned(SPURS_ATTRIBUTE_ALIGN))) SpursAttribute;
 
+/* taskset */
+
+#define SPURS_TASKSET_ALIGN				128
+#define SPURS_TASKSET_SIZE				6400
+#define SPURS_TASKSET2_SIZE				10496
+#define SPURS_TASKSET_ATTRIBUTE_ALIGN	8
+#define SPURS_TASKSET_ATTRIBUTE_SIZE	512
+#define SPURS_TASK_ATTRIBUTE_ALIGN		8
+#define SPURS_TASK_ATTRIBUTE_SIZE		256
+#define SPURS_MAX_TASK					128
+#define SPURS_TASK_EXIT_CODE_ALIGN		128
+#define SPURS_TASK_EXIT_CODE_SIZE		128
+
+typedef u32 SpursTaskId;
+
+typedef struct SpursTaskset {
+	unsigned char space[SPURS_TASKSET_SIZE];
+} __attribute__((aligned(SPURS_TASKSET_ALIGN))) SpursTaskset;
+
+typedef struct SpursTaskset2 {
+	unsigned char space[SPURS_TASKSET2_SIZE];
+} __attribute__((aligned(SPURS_TASKSET_ALIGN))) SpursTaskset2;
+
+typedef struct SpursTasksetAttribute {
+	unsigned char skip[SPURS_TASKSET_ATTRIBUTE_SIZE];
+} __attribute__((aligned(SPURS_TASKSET_ATTRIBUTE_ALIGN))) SpursTasksetAttribute;
+
+typedef struct SpursTasksetAttribute2 {
+	u32 revision;
+	const char *name ATTRIBUTE_PRXPTR;
+	u64 argTaskset;
+	u8 priority[SPURS_MAX_SPU];
+	u32 maxContention;
+	s32 enableClearLs;
+	void *taskNameBuffer ATTRIBUTE_PRXPTR;
+	u8 reserved[SPURS_TASKSET_ATTRIBUTE_SIZE-36];
+} __attribute__((aligned(SPURS_TASKSET_ATTRIBUTE_ALIGN))) SpursTasksetAttribute2;
+
+/* each bit is one 2 KB block of local store */
+typedef struct SpursTaskLsPattern {
+	union {
+		u32 u32[4];
+		u64 u64[2];
+	};
+} __attribute__((aligned(16))) SpursTaskLsPattern;
+
+/* argument passed to the task main(qword argTask, u64 argTaskset) */
+typedef struct SpursTaskArgument {
+	union {
+		u32 u32[4];
+		u64 u64[2];
+	};
+} __attribute__((aligned(16))) SpursTaskArgument;
+
+typedef struct SpursTaskAttribute2 {
+	u32 revision;
+	u32 sizeContext;
+	u64 eaContext;
+	SpursTaskLsPattern lsPattern;
+	const char *name ATTRIBUTE_PRXPTR;
+	u8 reserved[SPURS_TASK_ATTRIBUTE_SIZE-36];
+} __attribute__((aligned(SPURS_TASK_ATTRIBUTE_ALIGN))) SpursTaskAttribute2;
+
+typedef struct SpursTaskExitCode {
+	unsigned char skip[SPURS_TASK_EXIT_CODE_SIZE];
+} __attribute__((aligned(SPURS_TASK_EXIT_CODE_ALIGN))) SpursTaskExitCode;
+
+/* event flag */
+
+#define SPURS_EVENT_FLAG_ALIGN			128
+#define SPURS_EVENT_FLAG_SIZE			128
+
+#define SPURS_EVENT_FLAG_CLEAR_AUTO		0
+#define SPURS_EVENT_FLAG_CLEAR_MANUAL	1
+
+#define SPURS_EVENT_FLAG_SPU2SPU		0
+#define SPURS_EVENT_FLAG_SPU2PPU		1
+#define SPURS_EVENT_FLAG_PPU2SPU		2
+#define SPURS_EVENT_FLAG_ANY2ANY		3
+
+#define SPURS_EVENT_FLAG_OR				0
+#define SPURS_EVENT_FLAG_AND			1
+
+typedef struct SpursEventFlag {
+	unsigned char skip[SPURS_EVENT_FLAG_SIZE];
+} __attribute__((aligned(SPURS_EVENT_FLAG_ALIGN))) SpursEventFlag;
+
+/* lock-free queue */
+
+#define SPURS_LFQUEUE_ALIGN				128
+#define SPURS_LFQUEUE_SIZE				128
+#define SPURS_LFQUEUE_MAX_DEPTH			0x7fff
+#define SPURS_LFQUEUE_MAX_ENTRY_SIZE	16384	/* multiple of 16 */
+
+#define SPURS_LFQUEUE_SPU2SPU			0
+#define SPURS_LFQUEUE_SPU2PPU			1
+#define SPURS_LFQUEUE_PPU2SPU			2
+#define SPURS_LFQUEUE_ANY2ANY			3
+
+typedef struct SpursLFQueue {
+	unsigned char skip[SPURS_LFQUEUE_SIZE];
+} __attribute__((aligned(SPURS_LFQUEUE_ALIGN))) SpursLFQueue;
+
+/* job chain */
+
+#define SPURS_JOBCHAIN_ALIGN			128
+#define SPURS_JOBCHAIN_SIZE				272
+#define SPURS_JOBCHAIN_ATTRIBUTE_ALIGN	8
+#define SPURS_JOBCHAIN_ATTRIBUTE_SIZE	512
+
+typedef struct SpursJobChain {
+	unsigned char skip[SPURS_JOBCHAIN_SIZE];
+} __attribute__((aligned(SPURS_JOBCHAIN_ALIGN))) SpursJobChain;
+
+typedef struct SpursJobChainAttribute {
+	unsigned char skip[SPURS_JOBCHAIN_ATTRIBUTE_SIZE];
+} __attribute__((aligned(SPURS_JOBCHAIN_ATTRIBUTE_ALIGN))) SpursJobChainAttribute;
+
+typedef struct SpursJobHeader {
+	u64 eaBinary;			/* job binary, 16 byte aligned */
+	u16 sizeBinary;			/* in 16 byte units */
+	u16 sizeDmaList;		/* bytes of the input DMA list */
+	u32 eaHighInput;		/* high word of the input DMA list addresses */
+	u32 useInOutBuffer;
+	u32 sizeInOrInOut;
+	u32 sizeOut;
+	u16 sizeStack;			/* in 16 byte units, 0: default */
+	u16 sizeScratch;		/* in 16 byte units */
+	u32 eaHighCache;
+	u32 sizeCacheDmaList;
+} __attribute__((aligned(16))) SpursJobHeader;
+
+typedef struct SpursJob64 {
+	SpursJobHeader header;
+	union {
+		u64 dmaList[2];
+		u64 userData[2];
+	} workArea;
+} __attribute__((aligned(64))) SpursJob64;
+
+typedef struct SpursJob128 {
+	SpursJobHeader header;
+	union {
+		u64 dmaList[10];
+		u64 userData[10];
+	} workArea;
+} __attribute__((aligned(128))) SpursJob128;
+
+typedef struct SpursJob256 {
+	SpursJobHeader header;
+	union {
+		u64 dmaList[26];
+		u64 userData[26];
+	} workArea;
+} __attribute__((aligned(128))) SpursJob256;
+
+/* trace */
+
+#define SPURS_TRACE_MODE_FLAG_WRAP_BUFFER			0x1
+#define SPURS_TRACE_MODE_FLAG_SYNCHRONOUS_START_STOP	0x2
+
+#define SPURS_TRACE_TAG_KERNEL			0x20
+#define SPURS_TRACE_TAG_SERVICE			0x21
+#define SPURS_TRACE_TAG_TASK			0x22
+#define SPURS_TRACE_TAG_JOB				0x23
+#define SPURS_TRACE_TAG_OVIS			0x24
+#define SPURS_TRACE_TAG_LOAD			0x2a
+#define SPURS_TRACE_TAG_MAP				0x2b
+#define SPURS_TRACE_TAG_START			0x2c
+#define SPURS_TRACE_TAG_STOP			0x2d
+#define SPURS_TRACE_TAG_USER			0x2e
+#define SPURS_TRACE_TAG_GUID			0x2f
+
+/* head of the trace buffer, followed by the packets */
+typedef struct SpursTraceInfo {
+	u32 spuThread[SPURS_MAX_SPU];
+	u32 count[SPURS_MAX_SPU];		/* packets written by each SPU */
+	u32 spuThreadGroup;
+	u32 numSpus;
+	u8 padding[56];
+} __attribute__((aligned(16))) SpursTraceInfo;
+
+typedef struct SpursTracePacket {
+	struct {
+		u8 tag;						/* SPURS_TRACE_TAG_* */
+		u8 length;
+		u8 spu;
+		u8 workload;
+		u32 time;					/* SPU decrementer based time stamp */
+	} header;
+	union {
+		struct { u32 incident; u32 reserved; } service;
+		struct { u32 ea; u16 ls; u16 size; } load;
+		struct { u32 offset; u16 ls; u16 size; } map;
+		struct { s8 module[4]; u16 level; u16 ls; } start;
+		u64 user;
+		u64 guid;
+		u64 raw;
+	} data;
+} __attribute__((aligned(16))) SpursTracePacket;
+
 #ifdef __cplusplus
 	}
 #endif
@@ -0,0 +1,539 @@
+/*! \file spudma.h
+  \brief Streaming DMA templates for SPU kernels.
+
+  C++ helpers over spu_mfcio.h for the chunk/buffer/tag bookkeeping every
+  streaming kernel needs:
+
+  - spudma::InputStream and spudma::OutputStream walk an effective address
+    array in fixed size chunks through a ring of \c Depth local store
+    buffers (2 = double, 3 = triple buffering), each buffer on its own tag.
+  - spudma::transform() connects both into a get/compute/put pipeline.
+  - spudma::Gather fetches strided or indexed elements with DMA lists.
+  - spudma::get() and spudma::put() split transfers at 16 KB and move
+    unaligned heads and tails with naturally aligned 1/2/4/8 byte
+    commands, so no byte outside the requested range is ever written.
+  - spudma::bench() measures achieved bandwidth against the MFC peak; on
+    the SPU it times with the decrementer, which must be running.
+
+  When compiled for anything other than the SPU the MFC is replaced by a
+  memcpy backend that asserts the same size, alignment and tag rules the
+  hardware enforces, so kernel logic can be unit tested on the host.
+  Effective addresses are then plain pointers cast to \c spudma::ea_t.
+
+  The only local store address rule left to the caller of get() and
+  put() is that \c ls and \c ea share their low 4 bits; the streams and
+  the gather arrange that themselves.
+
+  \code
+  static void scale(const float *in,float *out,uint32_t n)
+  {
+      for(uint32_t i=0;i<n;i++) out[i] = in[i]*2.0f;
+  }
+
+  // 3 input and 3 output buffers of 4 KB, tags 0..5
+  spudma::transform<float,float,1024,3>(ea_in,ea_out,count,0,scale);
+  \endcode
+*/
+
+#ifndef __SPUDMA_H__
+#define __SPUDMA_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#ifdef __SPU__
+#include <spu_mfcio.h>
+#else
+#include <time.h>
+#endif
+
+namespace spudma {
+
+typedef uint64_t ea_t;
+
+static const uint32_t MAX_TRANSFER = 16384;		/*!< largest single MFC transfer */
+static const uint32_t MAX_LIST_ELEMENTS = 2048;	/*!< largest DMA list */
+static const uint32_t MAX_TAGS = 32;
+static const uint32_t QUADWORD = 16;
+static const uint32_t CACHE_LINE = 128;			/*!< best transfer alignment */
+
+/*! \brief Theoretical MFC bandwidth of one SPU, each direction (bytes/s). */
+static const double PEAK_BYTES_PER_SECOND = 25.6e9;
+
+#define SPUDMA_STATIC_ASSERT(expr,name) typedef char spudma_assert_##name[(expr) ? 1 : -1]
+
+static inline uint32_t roundUp(uint32_t n,uint32_t align) { return (n + align - 1)&~(align - 1); }
+static inline uint32_t tagMask(uint32_t tag,uint32_t count = 1) { return ((count >= 32) ? ~0U : ((1U << count) - 1)) << tag; }
+
+#ifdef __SPU__
+typedef mfc_list_element_t ListElement;
+#else
+typedef struct ListElement {
+	uint64_t notify		:  1;
+	uint64_t reserved	: 16;
+	uint64_t size		: 15;
+	uint64_t eal		: 32;
+} ListElement;
+#endif
+
+/*! \brief Raw MFC commands, one hardware transfer each. */
+struct Mfc
+{
+#ifdef __SPU__
+	static inline void get(void *ls,ea_t ea,uint32_t size,uint32_t tag) { mfc_get(ls,ea,size,tag,0,0); }
+	static inline void put(const void *ls,ea_t ea,uint32_t size,uint32_t tag) { mfc_put((volatile void*)ls,ea,size,tag,0,0); }
+	static inline void getl(void *ls,ea_t ea,const ListElement *list,uint32_t n,uint32_t tag) { mfc_getl(ls,ea,(void*)list,n*sizeof(ListElement),tag,0,0); }
+	static inline void wait(uint32_t mask) { mfc_write_tag_mask(mask); mfc_read_tag_status_all(); }
+	static inline uint32_t done(uint32_t mask) { mfc_write_tag_mask(mask); return mfc_read_tag_status_immediate(); }
+
+	/*! \brief Free running tick counter, ticks at the timebase frequency. */
+	static inline uint32_t ticks() { return ~spu_read_decrementer(); }
+	static inline double ticksPerSecond() { return 79800000.0; }
+#else
+	/*! \brief Transfers and bytes issued by the host backend. */
+	struct Stats {
+		uint32_t commands;
+		uint32_t lists;
+		uint64_t bytes;
+	};
+
+	static inline Stats& stats() { static Stats s; return s; }
+
+	static inline void check(const void *ls,ea_t ea,uint32_t size,uint32_t tag)
+	{
+		assert(tag < MAX_TAGS);
+		assert(size <= MAX_TRANSFER);
+		assert(size == 1 || size == 2 || size == 4 || size == 8 || (size%QUADWORD) == 0);
+		assert(((uintptr_t)ls&(QUADWORD - 1)) == (ea&(QUADWORD - 1)));
+		assert(size >= QUADWORD ? (ea&(QUADWORD - 1)) == 0 : (ea&(size - 1)) == 0);
+		(void)ls; (void)ea; (void)size; (void)tag;
+	}
+
+	static inline void get(void *ls,ea_t ea,uint32_t size,uint32_t tag)
+	{
+		check(ls,ea,size,tag);
+		memcpy(ls,(const void*)(uintptr_t)ea,size);
+		stats().commands++;
+		stats().bytes += size;
+	}
+
+	static inline void put(const void *ls,ea_t ea,uint32_t size,uint32_t tag)
+	{
+		check(ls,ea,size,tag);
+		memcpy((void*)(uintptr_t)ea,ls,size);
+		stats().commands++;
+		stats().bytes += size;
+	}
+
+	static inline void getl(void *ls,ea_t ea,const ListElement *list,uint32_t n,uint32_t tag)
+	{
+		uint8_t *dst = (uint8_t*)ls;
+
+		assert(n > 0 && n <= MAX_LIST_ELEMENTS);
+		assert(((uintptr_t)list&7) == 0);
+		for(uint32_t i=0;i<n;i++) {
+			ea_t src = (ea&0xffffffff00000000ULL)|list[i].eal;
+
+			check(dst,src,list[i].size,tag);
+			memcpy(dst,(const void*)(uintptr_t)src,list[i].size);
+			dst += list[i].size;
+			stats().bytes += list[i].size;
+		}
+		stats().commands++;
+		stats().lists++;
+	}
+
+	static inline void wait(uint32_t mask) { (void)mask; }
+	static inline uint32_t done(uint32_t mask) { return mask; }
+
+	static inline uint32_t ticks()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC,&ts);
+		return (uint32_t)(ts.tv_sec*1000000000ULL + ts.tv_nsec);
+	}
+	static inline double ticksPerSecond() { return 1e9; }
+#endif
+};
+
+namespace detail {
+
+/* largest naturally aligned small transfer at ea that fits in size */
+static inline uint32_t smallSize(ea_t ea,uint32_t size)
+{
+	uint32_t n = 8;
+	while(n > size || (ea&(n - 1)) != 0) n >>= 1;
+	return n;
+}
+
+template <bool Put>
+static inline void transfer(uint8_t *ls,ea_t ea,uint32_t size,uint32_t tag)
+{
+	assert(((uintptr_t)ls&(QUADWORD - 1)) == (ea&(QUADWORD - 1)));
+
+	while(size > 0 && (ea&(QUADWORD - 1)) != 0) {
+		uint32_t n = smallSize(ea,size);
+		if(Put) Mfc::put(ls,ea,n,tag); else Mfc::get(ls,ea,n,tag);
+		ls += n; ea += n; size -= n;
+	}
+	while(size >= QUADWORD) {
+		uint32_t n = (size < MAX_TRANSFER) ? (size&~(QUADWORD - 1)) : MAX_TRANSFER;
+		if(Put) Mfc::put(ls,ea,n,tag); else Mfc::get(ls,ea,n,tag);
+		ls += n; ea += n; size -= n;
+	}
+	while(size > 0) {
+		uint32_t n = smallSize(ea,size);
+		if(Put) Mfc::put(ls,ea,n,tag); else Mfc::get(ls,ea,n,tag);
+		ls += n; ea += n; size -= n;
+	}
+}
+
+}
+
+/*! \brief Get any number of bytes.
+ \param ls
+ Local store destination, same low 4 bits as \p ea.
+ \param ea
+ Effective address of the source.
+ \param size
+ Bytes to transfer, split into 16 KB commands plus small head and tail
+ commands when \p ea or \p size are not quadword multiples.
+ \param tag
+ Tag of every command issued.
+*/
+static inline void get(void *ls,ea_t ea,uint32_t size,uint32_t tag)
+{
+	detail::transfer<false>((uint8_t*)ls,ea,size,tag);
+}
+
+/*! \brief Put any number of bytes, see get(). */
+static inline void put(const void *ls,ea_t ea,uint32_t size,uint32_t tag)
+{
+	detail::transfer<true>((uint8_t*)ls,ea,size,tag);
+}
+
+/*! \brief Wait for every command issued on \p count tags from \p tag. */
+static inline void wait(uint32_t tag,uint32_t count = 1)
+{
+	Mfc::wait(tagMask(tag,count));
+}
+
+/*! \brief Sequential reader over an effective address array.
+
+ Each call to next() hands out the following chunk and implicitly releases
+ the previous one, whose buffer is immediately refilled with the chunk
+ \c Depth - 1 places ahead.  Uses tags \c tag .. \c tag + \c Depth - 1.
+
+ \tparam T element type
+ \tparam Chunk elements per chunk, \c Chunk*sizeof(T) a multiple of 16
+ \tparam Depth buffers in the ring, 2 for double buffering
+*/
+template <typename T,uint32_t Chunk,uint32_t Depth = 2>
+class InputStream
+{
+public:
+	static const uint32_t CHUNK_BYTES = Chunk*sizeof(T);
+	static const uint32_t SLOT_BYTES = (CHUNK_BYTES + QUADWORD + CACHE_LINE - 1)&~(CACHE_LINE - 1);
+
+	InputStream(ea_t ea,uint32_t count,uint32_t tag) : _ea(ea),_count(count),_tag(tag),_next(0),_issued(0)
+	{
+		assert(tag + Depth <= MAX_TAGS);
+		while(_issued < Depth && fetch(_issued)) _issued++;
+	}
+
+	~InputStream() { Mfc::wait(tagMask(_tag,Depth)); }
+
+	/*! \brief Wait for the next chunk.
+	 \param data
+	 Set to the chunk in local store, valid until the following call.
+	 \return
+	 Elements in the chunk, 0 at the end of the stream.
+	*/
+	uint32_t next(const T*& data)
+	{
+		if(_next > 0 && fetch(_issued)) _issued++;
+		if(_next >= _issued) return 0;
+
+		uint32_t slot = _next%Depth;
+		Mfc::wait(tagMask(_tag + slot));
+		data = (const T*)(_buffer[slot] + (chunkEa(_next)&(QUADWORD - 1)));
+		return elements(_next++);
+	}
+
+private:
+	SPUDMA_STATIC_ASSERT((CHUNK_BYTES%QUADWORD) == 0,chunk_bytes_must_be_a_quadword_multiple);
+	SPUDMA_STATIC_ASSERT(Depth >= 2 && Depth <= 16,depth_out_of_range);
+
+	ea_t chunkEa(uint32_t i) const { return _ea + (ea_t)i*CHUNK_BYTES; }
+	uint32_t elements(uint32_t i) const { uint32_t left = _count - i*Chunk; return (left < Chunk) ? left : Chunk; }
+
+	bool fetch(uint32_t i)
+	{
+		if((uint64_t)i*Chunk >= _count) return false;
+
+		ea_t ea = chunkEa(i);
+		uint32_t slot = i%Depth;
+		get(_buffer[slot] + (ea&(QUADWORD - 1)),ea,elements(i)*sizeof(T),_tag + slot);
+		return true;
+	}
+
+	uint8_t _buffer[Depth][SLOT_BYTES] __attribute__((aligned(CACHE_LINE)));
+	ea_t _ea;
+	uint32_t _count;
+	uint32_t _tag;
+	uint32_t _next;
+	uint32_t _issued;
+};
+
+/*! \brief Sequential writer over an effective address array.
+
+ Each call to next() puts the chunk handed out by the previous call and
+ returns a buffer for the following one, waiting only when that buffer's
+ put from \c Depth chunks ago is still in flight.  Uses tags \c tag ..
+ \c tag + \c Depth - 1.  Partial bytes at either end of the array are
+ written with small commands, never with a read-modify-write.
+
+ \tparam T element type
+ \tparam Chunk elements per chunk, \c Chunk*sizeof(T) a multiple of 16
+ \tparam Depth buffers in the ring
+*/
+template <typename T,uint32_t Chunk,uint32_t Depth = 2>
+class OutputStream
+{
+public:
+	static const uint32_t CHUNK_BYTES = Chunk*sizeof(T);
+	static const uint32_t SLOT_BYTES = (CHUNK_BYTES + QUADWORD + CACHE_LINE - 1)&~(CACHE_LINE - 1);
+
+	OutputStream(ea_t ea,uint32_t count,uint32_t tag) : _ea(ea),_count(count),_tag(tag),_next(0),_pending(false)
+	{
+		assert(tag + Depth <= MAX_TAGS);
+	}
+
+	~OutputStream() { flush(); }
+
+	/*! \brief Commit the current chunk and get the next one.
+	 \param data
+	 Set to the local store buffer to fill.
+	 \return
+	 Elements to write into \p data, 0 at the end of the stream.
+	*/
+	uint32_t next(T*& data)
+	{
+		commit();
+		if((uint64_t)_next*Chunk >= _count) return 0;
+
+		uint32_t slot = _next%Depth;
+		Mfc::wait(tagMask(_tag + slot));
+		data = (T*)(_buffer[slot] + (chunkEa(_next)&(QUADWORD - 1)));
+		_pending = true;
+		return elements(_next++);
+	}
+
+	/*! \brief Commit the current chunk and wait for every put to complete. */
+	void flush()
+	{
+		commit();
+		Mfc::wait(tagMask(_tag,Depth));
+	}
+
+private:
+	SPUDMA_STATIC_ASSERT((CHUNK_BYTES%QUADWORD) == 0,chunk_bytes_must_be_a_quadword_multiple);
+	SPUDMA_STATIC_ASSERT(Depth >= 2 && Depth <= 16,depth_out_of_range);
+
+	ea_t chunkEa(uint32_t i) const { return _ea + (ea_t)i*CHUNK_BYTES; }
+	uint32_t elements(uint32_t i) const { uint32_t left = _count - i*Chunk; return (left < Chunk) ? left : Chunk; }
+
+	void commit()
+	{
+		if(!_pending) return;
+
+		uint32_t i = _next - 1;
+		ea_t ea = chunkEa(i);
+		uint32_t slot = i%Depth;
+		put(_buffer[slot] + (ea&(QUADWORD - 1)),ea,elements(i)*sizeof(T),_tag + slot);
+		_pending = false;
+	}
+
+	uint8_t _buffer[Depth][SLOT_BYTES] __attribute__((aligned(CACHE_LINE)));
+	ea_t _ea;
+	uint32_t _count;
+	uint32_t _tag;
+	uint32_t _next;
+	bool _pending;
+};
+
+/*! \brief Stream \p count elements through \p f.
+
+ \p f is called as <tt>f(const TIn *in,TOut *out,uint32_t n)</tt> once per
+ chunk.  Input uses tags \p tag .. \p tag + \c Depth - 1, output the next
+ \c Depth tags.  Both rings live on the stack, 2*Depth*Chunk elements.
+*/
+template <typename TIn,typename TOut,uint32_t Chunk,uint32_t Depth,typename F>
+static inline void transform(ea_t in,ea_t out,uint32_t count,uint32_t tag,F f)
+{
+	InputStream<TIn,Chunk,Depth> input(in,count,tag);
+	OutputStream<TOut,Chunk,Depth> output(out,count,tag + Depth);
+	const TIn *src = 0;
+	TOut *dst = 0;
+	uint32_t n;
+
+	/* same count and chunk on both sides: the output chunk always matches */
+	while((n = input.next(src)) != 0 && output.next(dst) == n)
+		f(src,dst,n);
+	output.flush();
+}
+
+/*! \brief DMA list gather of up to \c MaxCount elements.
+
+ Each element is fetched as the quadwords covering it, so any element
+ alignment works and nothing outside those quadwords is read.  Elements
+ are packed back to back in local store; operator[] accounts for each
+ element's offset within its first quadword.  Lists are split at 2048
+ elements and wherever the high word of the address changes.
+
+ \tparam T element type, at most 16 KB - 16 bytes
+ \tparam MaxCount capacity of one gather
+*/
+template <typename T,uint32_t MaxCount>
+class Gather
+{
+public:
+	static const uint32_t SLOT_BYTES = (sizeof(T) + 2*QUADWORD - 2)&~(QUADWORD - 1);
+
+	Gather() : _count(0),_tag(0) {}
+
+	/*! \brief Gather elements \p ea + i*\p stride for i < \p count. */
+	void strided(ea_t ea,uint32_t stride,uint32_t count,uint32_t tag)
+	{
+		assert(count <= MaxCount);
+		for(uint32_t i=0;i<count;i++) add(i,ea + (ea_t)i*stride);
+		issue(count,tag);
+	}
+
+	/*! \brief Gather elements \p base + \p index[i]*sizeof(T) for i < \p count. */
+	void indexed(ea_t base,const uint32_t *index,uint32_t count,uint32_t tag)
+	{
+		assert(count <= MaxCount);
+		for(uint32_t i=0;i<count;i++) add(i,base + (ea_t)index[i]*sizeof(T));
+		issue(count,tag);
+	}
+
+	/*! \brief Wait for the last gather. */
+	void wait() { Mfc::wait(tagMask(_tag)); }
+
+	uint32_t size() const { return _count; }
+	const T& operator[](uint32_t i) const { return *(const T*)(_data + _offset[i]); }
+
+private:
+	SPUDMA_STATIC_ASSERT(SLOT_BYTES <= MAX_TRANSFER,element_too_large);
+	SPUDMA_STATIC_ASSERT(MaxCount*SLOT_BYTES <= 256*1024,gather_exceeds_local_store);
+
+	void add(uint32_t i,ea_t ea)
+	{
+		uint32_t misalign = (uint32_t)ea&(QUADWORD - 1);
+
+		_high[i] = (uint32_t)(ea >> 32);
+		_misalign[i] = misalign;
+		_list[i].notify = 0;
+		_list[i].reserved = 0;
+		_list[i].size = roundUp(misalign + sizeof(T),QUADWORD);
+		_list[i].eal = (uint32_t)ea&~(QUADWORD - 1);
+	}
+
+	void issue(uint32_t count,uint32_t tag)
+	{
+		uint32_t ls = 0;
+
+		_count = count;
+		_tag = tag;
+		for(uint32_t first=0;first<count;) {
+			uint32_t last = first + 1;
+			while(last < count && last - first < MAX_LIST_ELEMENTS && _high[last] == _high[first]) last++;
+
+			uint32_t start = ls;
+			for(uint32_t i=first;i<last;i++) {
+				_offset[i] = ls + _misalign[i];
+				ls += _list[i].size;
+			}
+			Mfc::getl(_data + start,((ea_t)_high[first] << 32),_list + first,last - first,tag);
+			first = last;
+		}
+	}
+
+	uint8_t _data[MaxCount*SLOT_BYTES] __attribute__((aligned(CACHE_LINE)));
+	ListElement _list[MaxCount] __attribute__((aligned(8)));
+	uint32_t _high[MaxCount];
+	uint32_t _offset[MaxCount];
+	uint8_t _misalign[MaxCount];
+	uint32_t _count;
+	uint32_t _tag;
+};
+
+/*! \brief Result of bench(). */
+struct BenchResult
+{
+	uint64_t bytes;			/*!< bytes moved, gets plus puts */
+	double seconds;
+	double bytesPerSecond;
+	double efficiency;		/*!< fraction of the peak for the directions used */
+};
+
+enum BenchMode {
+	BENCH_GET,				/*!< stream in only */
+	BENCH_PUT,				/*!< stream out only */
+	BENCH_COPY				/*!< stream in and out, peak counts both directions */
+};
+
+/*! \brief Measure streaming bandwidth with the stream templates.
+ \param src
+ Source array, \p bytes long.
+ \param dst
+ Destination array, \p bytes long.
+ \param bytes
+ Size of the arrays.
+ \param mode
+ Directions to measure.
+ \param tag
+ First of 2*\c Depth tags used.
+*/
+template <uint32_t ChunkBytes,uint32_t Depth>
+static inline BenchResult bench(ea_t src,ea_t dst,uint32_t bytes,BenchMode mode,uint32_t tag)
+{
+	typedef uint32_t Word __attribute__((vector_size(16)));
+	uint32_t count = bytes/sizeof(Word);
+	uint32_t start = Mfc::ticks();
+	BenchResult r;
+
+	if(mode == BENCH_GET) {
+		InputStream<Word,ChunkBytes/sizeof(Word),Depth> input(src,count,tag);
+		const Word *data;
+		while(input.next(data) != 0) {}
+		r.bytes = bytes;
+	} else if(mode == BENCH_PUT) {
+		OutputStream<Word,ChunkBytes/sizeof(Word),Depth> output(dst,count,tag);
+		Word *data;
+		while(output.next(data) != 0) {}
+		output.flush();
+		r.bytes = bytes;
+	} else {
+		InputStream<Word,ChunkBytes/sizeof(Word),Depth> input(src,count,tag);
+		OutputStream<Word,ChunkBytes/sizeof(Word),Depth> output(dst,count,tag + Depth);
+		const Word *in = 0;
+		Word *out = 0;
+		uint32_t n;
+		while((n = input.next(in)) != 0 && output.next(out) == n)
+			memcpy(out,in,n*sizeof(Word));
+		output.flush();
+		r.bytes = 2*(uint64_t)bytes;
+	}
+
+	r.seconds = (uint32_t)(Mfc::ticks() - start)/Mfc::ticksPerSecond();
+	r.bytesPerSecond = (r.seconds > 0) ? r.bytes/r.seconds : 0;
+	r.efficiency = r.bytesPerSecond/(PEAK_BYTES_PER_SECOND*((mode == BENCH_COPY) ? 2 : 1));
+	return r;
+}
+
+}
+
+#endif